@@ -0,0 +1,65 @@
+#include <benchmark/benchmark.h>
+
+#include <mls/common.h>
+
+using namespace mls;
+
+// The byte-at-a-time loop that bytes::operator== used before it compared a
+// word or vector at a time, kept here as a baseline
+static bool
+bytewise_equal(const bytes& lhs, const bytes& rhs)
+{
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+
+  auto diff = uint8_t(0);
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    diff |= static_cast<uint8_t>(lhs.at(i) ^ rhs.at(i));
+  }
+  return diff == 0;
+}
+
+static bytes
+bytewise_xor(const bytes& lhs, const bytes& rhs)
+{
+  auto out = lhs;
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    out.at(i) ^= rhs.at(i);
+  }
+  return out;
+}
+
+static void
+bench_equal(benchmark::State& bench, bool bytewise)
+{
+  const auto size = static_cast<size_t>(bench.range(0));
+  const auto lhs = bytes(size, 0xa0);
+  const auto rhs = bytes(size, 0xa0);
+  for (auto _ : bench) {
+    silence_unused(_);
+    auto equal = bytewise ? bytewise_equal(lhs, rhs) : (lhs == rhs);
+    benchmark::DoNotOptimize(equal);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_xor(benchmark::State& bench, bool bytewise)
+{
+  const auto size = static_cast<size_t>(bench.range(0));
+  const auto lhs = bytes(size, 0xa0);
+  const auto rhs = bytes(size, 0x0b);
+  for (auto _ : bench) {
+    silence_unused(_);
+    auto out = bytewise ? bytewise_xor(lhs, rhs) : (lhs ^ rhs);
+    benchmark::DoNotOptimize(out);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+// Nonces, hashes and keys, then larger buffers
+BENCHMARK_CAPTURE(bench_equal, bytewise, true)->Arg(12)->Arg(32)->Arg(4096);
+BENCHMARK_CAPTURE(bench_equal, wide, false)->Arg(12)->Arg(32)->Arg(4096);
+BENCHMARK_CAPTURE(bench_xor, bytewise, true)->Arg(12)->Arg(32)->Arg(4096);
+BENCHMARK_CAPTURE(bench_xor, wide, false)->Arg(12)->Arg(32)->Arg(4096);
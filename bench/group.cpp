@@ -0,0 +1,152 @@
+#include "group.h"
+
+#include <hpke/random.h>
+
+using namespace mls;
+
+// Gives the fixture access to a member's TreeKEM private key, so that TreeKEM
+// operations can be measured on their own
+class TreePrivAccess : public State
+{
+public:
+  explicit TreePrivAccess(const State& state)
+    : State(state)
+  {
+  }
+
+  const TreeKEMPrivateKey& tree_priv() const { return _tree_priv; }
+};
+
+BenchClient
+BenchClient::create(CipherSuite suite)
+{
+  auto init_priv = HPKEPrivateKey::generate(suite);
+  auto leaf_priv = HPKEPrivateKey::generate(suite);
+  auto sig_priv = SignaturePrivateKey::generate(suite);
+  auto leaf_node = LeafNode{ suite,
+                             leaf_priv.public_key,
+                             sig_priv.public_key,
+                             Credential::basic(random_bytes(16)),
+                             Capabilities::create_default(),
+                             Lifetime::create_default(),
+                             {},
+                             sig_priv };
+  auto key_package =
+    KeyPackage{ suite, init_priv.public_key, leaf_node, {}, sig_priv };
+
+  return { std::move(init_priv),
+           std::move(leaf_priv),
+           std::move(sig_priv),
+           std::move(key_package) };
+}
+
+bool
+BenchGroup::Params::operator==(const Params& other) const
+{
+  return suite == other.suite && size == other.size && sparse == other.sparse;
+}
+
+BenchGroup&
+BenchGroup::get(const Params& params)
+{
+  static auto cached = std::unique_ptr<BenchGroup>{};
+  if (!cached || !(cached->params == params)) {
+    // Release the old group before building the new one
+    cached.reset();
+    cached = std::make_unique<BenchGroup>(params);
+  }
+
+  return *cached;
+}
+
+BenchGroup::BenchGroup(const Params& params_in)
+  : params(params_in)
+  , suite(params.suite)
+  , group_id(random_bytes(16))
+  , creator_client(BenchClient::create(suite))
+  , joiner(BenchClient::create(suite))
+{
+  if (params.size < 2) {
+    throw InvalidParameterError("Benchmark groups need at least two members");
+  }
+
+  // Create the group and add everyone in one Commit
+  creator.emplace(group_id,
+                  suite,
+                  creator_client.leaf_priv,
+                  creator_client.sig_priv,
+                  creator_client.key_package.leaf_node,
+                  ExtensionList{});
+
+  auto adds = std::vector<Proposal>{};
+  for (uint32_t i = 1; i < params.size; i++) {
+    member_clients.push_back(BenchClient::create(suite));
+    adds.push_back(creator->add_proposal(member_clients.back().key_package));
+  }
+
+  auto [add_commit, add_welcome, add_next] =
+    creator->commit(fresh_secret(), CommitOpts{ adds, true, false, {} }, {});
+  silence_unused(add_commit);
+  creator = add_next;
+
+  const auto& first = member_clients.front();
+  member.emplace(first.init_priv,
+                 first.leaf_priv,
+                 first.sig_priv,
+                 first.key_package,
+                 add_welcome,
+                 std::nullopt);
+
+  // Thin out the tree if requested
+  if (params.sparse && params.size > 2) {
+    auto removes = std::vector<Proposal>{};
+    for (uint32_t i = 2; i < params.size; i += 2) {
+      removes.push_back(creator->remove_proposal(LeafIndex{ i }));
+    }
+
+    auto [remove_commit, remove_welcome, remove_next] = creator->commit(
+      fresh_secret(), CommitOpts{ removes, false, false, {} }, {});
+    silence_unused(remove_welcome);
+    creator = remove_next;
+    member = opt::get(member->handle(remove_commit));
+  }
+
+  // Messages for the State benchmarks
+  auto [empty_commit, empty_welcome, empty_next] =
+    creator->commit(fresh_secret(), CommitOpts{ {}, false, false, {} }, {});
+  silence_unused(empty_welcome);
+  silence_unused(empty_next);
+  commit = empty_commit;
+
+  auto join_add = creator->add_proposal(joiner.key_package);
+  auto join_opts = CommitOpts{ { join_add }, true, false, {} };
+  auto [join_commit, join_welcome, join_next] =
+    creator->commit(fresh_secret(), join_opts, {});
+  silence_unused(join_commit);
+  silence_unused(join_next);
+  welcome = join_welcome;
+
+  // Inputs for the TreeKEM benchmarks
+  creator_tree_priv = TreePrivAccess(*creator).tree_priv();
+  member_tree = member->tree();
+  encap_context = random_bytes(32);
+
+  auto encap_tree = member_tree;
+  auto [member_priv, path] = encap_tree.encap(member->index(),
+                                              group_id,
+                                              encap_context,
+                                              fresh_secret(),
+                                              first.sig_priv,
+                                              {},
+                                              {});
+  silence_unused(member_priv);
+  member_path = path;
+
+  encoded_tree = tls::marshal(creator->tree());
+}
+
+bytes
+BenchGroup::fresh_secret() const
+{
+  return random_bytes(suite.secret_size());
+}
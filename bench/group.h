@@ -0,0 +1,68 @@
+#pragma once
+
+#include <mls/state.h>
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+// The keys and KeyPackage for one client
+struct BenchClient
+{
+  mls::HPKEPrivateKey init_priv;
+  mls::HPKEPrivateKey leaf_priv;
+  mls::SignaturePrivateKey sig_priv;
+  mls::KeyPackage key_package;
+
+  static BenchClient create(mls::CipherSuite suite);
+};
+
+// A group of `size` members, as seen by its creator (leaf 0) and one other
+// member (leaf 1).  If `sparse` is set, every other member after the first two
+// has been removed, leaving blanks throughout the tree.
+//
+// Alongside the group, the fixture holds messages for the benchmarks to
+// process, none of which have been applied to the group:
+//
+// * A Commit from the creator, for the member to handle
+// * A Welcome adding one more client, for that client to join
+// * An UpdatePath from the member, for the creator to decapsulate
+struct BenchGroup
+{
+  struct Params
+  {
+    mls::CipherSuite::ID suite = mls::CipherSuite::ID::unknown;
+    uint32_t size = 0;
+    bool sparse = false;
+
+    bool operator==(const Params& other) const;
+  };
+
+  // Building a large group is expensive, so the most recently built group is
+  // kept and reused while the parameters stay the same.
+  static BenchGroup& get(const Params& params);
+
+  explicit BenchGroup(const Params& params);
+
+  Params params;
+  mls::CipherSuite suite;
+  bytes group_id;
+
+  BenchClient creator_client;
+  std::vector<BenchClient> member_clients;
+  std::optional<mls::State> creator;
+  std::optional<mls::State> member;
+
+  mls::MLSMessage commit;
+
+  BenchClient joiner;
+  mls::Welcome welcome;
+
+  mls::TreeKEMPrivateKey creator_tree_priv;
+  mls::TreeKEMPublicKey member_tree;
+  bytes encap_context;
+  mls::UpdatePath member_path;
+  bytes encoded_tree;
+
+  bytes fresh_secret() const;
+};
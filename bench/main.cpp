@@ -0,0 +1,193 @@
+#include <benchmark/benchmark.h>
+
+#include "group.h"
+
+#include <string>
+
+using namespace mls;
+
+using Params = BenchGroup::Params;
+
+///
+/// State operations
+///
+
+static void
+bench_commit(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  const auto opts = CommitOpts{ {}, false, false, {} };
+  for (auto _ : bench) {
+    silence_unused(_);
+    auto result = group.creator->commit(group.fresh_secret(), opts, {});
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+static void
+bench_handle(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  for (auto _ : bench) {
+    silence_unused(_);
+    auto next = group.member->handle(group.commit);
+    benchmark::DoNotOptimize(next);
+  }
+}
+
+static void
+bench_join(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  const auto& joiner = group.joiner;
+  for (auto _ : bench) {
+    silence_unused(_);
+    auto joined = State{ joiner.init_priv,   joiner.leaf_priv,
+                         joiner.sig_priv,    joiner.key_package,
+                         group.welcome,      std::nullopt };
+    benchmark::DoNotOptimize(joined);
+  }
+}
+
+static const auto message_size = size_t(1024);
+
+static void
+bench_protect(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  const auto pt = bytes(message_size, 0xa0);
+  for (auto _ : bench) {
+    silence_unused(_);
+    auto ct = group.creator->protect({}, pt, 0);
+    benchmark::DoNotOptimize(ct);
+  }
+}
+
+static void
+bench_unprotect(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  const auto pt = bytes(message_size, 0xa0);
+  for (auto _ : bench) {
+    // Each message can only be decrypted once
+    bench.PauseTiming();
+    auto ct = group.creator->protect({}, pt, 0);
+    bench.ResumeTiming();
+
+    auto result = group.member->unprotect(ct);
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+///
+/// TreeKEM operations
+///
+
+static void
+bench_encap(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  for (auto _ : bench) {
+    bench.PauseTiming();
+    auto tree = group.creator->tree();
+    bench.ResumeTiming();
+
+    auto result = tree.encap(LeafIndex{ 0 },
+                             group.group_id,
+                             group.encap_context,
+                             group.fresh_secret(),
+                             group.creator_client.sig_priv,
+                             {},
+                             {});
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+static void
+bench_decap(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  const auto from = group.member->index();
+  for (auto _ : bench) {
+    bench.PauseTiming();
+    auto priv = group.creator_tree_priv;
+    bench.ResumeTiming();
+
+    priv.decap(
+      from, group.member_tree, group.encap_context, group.member_path, {});
+    benchmark::DoNotOptimize(priv);
+  }
+}
+
+static void
+bench_root_hash(benchmark::State& bench, const Params& params)
+{
+  auto& group = BenchGroup::get(params);
+  for (auto _ : bench) {
+    // Decode the tree afresh so that no hashes are cached
+    bench.PauseTiming();
+    auto tree = tls::get<TreeKEMPublicKey>(group.encoded_tree);
+    tree.suite = group.suite;
+    bench.ResumeTiming();
+
+    tree.set_hash_all();
+    benchmark::DoNotOptimize(tree.root_hash());
+  }
+}
+
+///
+/// Registration
+///
+
+using BenchFn = void (*)(benchmark::State&, const Params&);
+
+struct Operation
+{
+  const char* name = nullptr;
+  BenchFn fn = nullptr;
+};
+
+static const auto operations = std::vector<Operation>{
+  { "commit", bench_commit },       { "handle", bench_handle },
+  { "join", bench_join },           { "protect", bench_protect },
+  { "unprotect", bench_unprotect }, { "encap", bench_encap },
+  { "decap", bench_decap },         { "root_hash", bench_root_hash },
+};
+
+static const auto group_sizes =
+  std::vector<uint32_t>{ 2, 10, 100, 1000, 10000, 100000 };
+
+int
+main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+
+  // Benchmarks run in registration order, so all of the operations for one
+  // group are registered together and share the cached group.  Groups are
+  // only built once one of their benchmarks runs, so a filter that excludes
+  // the larger sizes also skips building them.
+  for (const auto suite_id : all_supported_suites) {
+    const auto suite_name = std::to_string(static_cast<uint16_t>(suite_id));
+    for (const auto size : group_sizes) {
+      for (const auto sparse : { false, true }) {
+        // Removing every other member needs a few members to remove
+        if (sparse && size < 4) {
+          continue;
+        }
+
+        const auto params = Params{ suite_id, size, sparse };
+        const auto shape = std::string(sparse ? "sparse" : "dense");
+        for (const auto& op : operations) {
+          const auto name = std::string(op.name) + "/" + suite_name + "/" +
+                            std::to_string(size) + "/" + shape;
+          benchmark::RegisterBenchmark(name.c_str(), op.fn, params)
+            ->Unit(benchmark::kMicrosecond);
+        }
+      }
+    }
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
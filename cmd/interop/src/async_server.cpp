@@ -0,0 +1,207 @@
+#include "async_server.h"
+
+using grpc::ServerAsyncResponseWriter;
+using grpc::ServerCompletionQueue;
+
+// One call in progress, used as its tag on the completion queue
+class Call
+{
+public:
+  virtual ~Call() = default;
+
+  // Called by the worker when the operation tagged with this call completes
+  virtual void proceed(bool ok) = 0;
+};
+
+template<typename Req, typename Resp>
+class MethodCall : public Call
+{
+public:
+  using RequestMethod =
+    void (MLSClient::AsyncService::*)(ServerContext*,
+                                      Req*,
+                                      ServerAsyncResponseWriter<Resp>*,
+                                      grpc::CompletionQueue*,
+                                      ServerCompletionQueue*,
+                                      void*);
+  using Handler = Status (MLSClientImpl::*)(ServerContext*, const Req*, Resp*);
+
+  // Waits for a call to the method; the call deletes itself once it is done
+  static void start(MLSClient::AsyncService* service,
+                    ServerCompletionQueue* cq,
+                    MLSClientImpl* impl,
+                    RequestMethod request,
+                    Handler handler)
+  {
+    auto* call = new MethodCall(service, cq, impl, request, handler); // NOLINT
+    (service->*request)(&call->ctx, &call->req, &call->responder, cq, cq, call);
+  }
+
+  void proceed(bool ok) override
+  {
+    if (!ok || finished) {
+      delete this; // NOLINT
+      return;
+    }
+
+    // Wait for the next call to this method before running this one, so that
+    // other threads can pick it up in the meantime
+    start(service, cq, impl, request, handler);
+
+    const auto status = (impl->*handler)(&ctx, &req, &resp);
+    finished = true;
+    responder.Finish(resp, status, this);
+  }
+
+private:
+  MLSClient::AsyncService* service;
+  ServerCompletionQueue* cq;
+  MLSClientImpl* impl;
+  RequestMethod request;
+  Handler handler;
+
+  ServerContext ctx;
+  Req req;
+  Resp resp;
+  ServerAsyncResponseWriter<Resp> responder;
+  bool finished = false;
+
+  MethodCall(MLSClient::AsyncService* service_in,
+             ServerCompletionQueue* cq_in,
+             MLSClientImpl* impl_in,
+             RequestMethod request_in,
+             Handler handler_in)
+    : service(service_in)
+    , cq(cq_in)
+    , impl(impl_in)
+    , request(request_in)
+    , handler(handler_in)
+    , responder(&ctx)
+  {
+  }
+};
+
+template<typename Req, typename Resp>
+static void
+serve_method(MLSClient::AsyncService* service,
+             ServerCompletionQueue* cq,
+             MLSClientImpl* impl,
+             typename MethodCall<Req, Resp>::RequestMethod request,
+             typename MethodCall<Req, Resp>::Handler handler)
+{
+  MethodCall<Req, Resp>::start(service, cq, impl, request, handler);
+}
+
+using Service = MLSClient::AsyncService;
+
+AsyncServer::AsyncServer(MLSClientImpl& impl_in,
+                         const std::string& address,
+                         size_t thread_count)
+  : impl(impl_in)
+{
+  grpc::EnableDefaultHealthCheckService(true);
+
+  auto builder = grpc::ServerBuilder{};
+  builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+  builder.RegisterService(&service);
+  for (size_t i = 0; i < thread_count; i++) {
+    queues.push_back(builder.AddCompletionQueue());
+  }
+  server = builder.BuildAndStart();
+
+  for (auto& queue : queues) {
+    auto* cq = queue.get();
+    workers.emplace_back([this, cq] { serve(cq); });
+  }
+}
+
+AsyncServer::~AsyncServer()
+{
+  shutdown();
+  wait();
+}
+
+void
+AsyncServer::wait()
+{
+  for (auto& worker : workers) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+void
+AsyncServer::shutdown()
+{
+  if (stopped) {
+    return;
+  }
+
+  // The server has to stop accepting calls before its queues are shut down
+  server->Shutdown();
+  for (auto& queue : queues) {
+    queue->Shutdown();
+  }
+  stopped = true;
+}
+
+void
+AsyncServer::serve(ServerCompletionQueue* cq)
+{
+  // Every worker waits for calls to every method on its own queue
+  auto* svc = &service;
+  auto* im = &impl;
+
+  // clang-format off
+  serve_method<NameRequest, NameResponse>(
+    svc, cq, im, &Service::RequestName, &MLSClientImpl::Name);
+  serve_method<SupportedCiphersuitesRequest, SupportedCiphersuitesResponse>(
+    svc, cq, im, &Service::RequestSupportedCiphersuites,
+    &MLSClientImpl::SupportedCiphersuites);
+  serve_method<GenerateTestVectorRequest, GenerateTestVectorResponse>(
+    svc, cq, im, &Service::RequestGenerateTestVector,
+    &MLSClientImpl::GenerateTestVector);
+  serve_method<VerifyTestVectorRequest, VerifyTestVectorResponse>(
+    svc, cq, im, &Service::RequestVerifyTestVector,
+    &MLSClientImpl::VerifyTestVector);
+
+  serve_method<CreateGroupRequest, CreateGroupResponse>(
+    svc, cq, im, &Service::RequestCreateGroup, &MLSClientImpl::CreateGroup);
+  serve_method<CreateKeyPackageRequest, CreateKeyPackageResponse>(
+    svc, cq, im, &Service::RequestCreateKeyPackage,
+    &MLSClientImpl::CreateKeyPackage);
+  serve_method<JoinGroupRequest, JoinGroupResponse>(
+    svc, cq, im, &Service::RequestJoinGroup, &MLSClientImpl::JoinGroup);
+  serve_method<ExternalJoinRequest, ExternalJoinResponse>(
+    svc, cq, im, &Service::RequestExternalJoin, &MLSClientImpl::ExternalJoin);
+
+  serve_method<PublicGroupStateRequest, PublicGroupStateResponse>(
+    svc, cq, im, &Service::RequestPublicGroupState,
+    &MLSClientImpl::PublicGroupState);
+  serve_method<StateAuthRequest, StateAuthResponse>(
+    svc, cq, im, &Service::RequestStateAuth, &MLSClientImpl::StateAuth);
+  serve_method<ExportRequest, ExportResponse>(
+    svc, cq, im, &Service::RequestExport, &MLSClientImpl::Export);
+  serve_method<ProtectRequest, ProtectResponse>(
+    svc, cq, im, &Service::RequestProtect, &MLSClientImpl::Protect);
+  serve_method<UnprotectRequest, UnprotectResponse>(
+    svc, cq, im, &Service::RequestUnprotect, &MLSClientImpl::Unprotect);
+
+  serve_method<AddProposalRequest, ProposalResponse>(
+    svc, cq, im, &Service::RequestAddProposal, &MLSClientImpl::AddProposal);
+  serve_method<CommitRequest, CommitResponse>(
+    svc, cq, im, &Service::RequestCommit, &MLSClientImpl::Commit);
+  serve_method<HandleCommitRequest, HandleCommitResponse>(
+    svc, cq, im, &Service::RequestHandleCommit, &MLSClientImpl::HandleCommit);
+  serve_method<HandleExternalCommitRequest, HandleExternalCommitResponse>(
+    svc, cq, im, &Service::RequestHandleExternalCommit,
+    &MLSClientImpl::HandleExternalCommit);
+  // clang-format on
+
+  void* tag = nullptr;
+  auto ok = false;
+  while (cq->Next(&tag, &ok)) {
+    static_cast<Call*>(tag)->proceed(ok);
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+#include "mls_client_impl.h"
+
+// Serves MLSClientImpl with the asynchronous gRPC API.  Each worker thread has
+// its own completion queue, on which it waits for calls to any method, and
+// runs the calls it receives.
+class AsyncServer
+{
+public:
+  AsyncServer(MLSClientImpl& impl_in,
+              const std::string& address,
+              size_t thread_count);
+  ~AsyncServer();
+
+  // Blocks until the server is shut down
+  void wait();
+  void shutdown();
+
+private:
+  MLSClientImpl& impl;
+  MLSClient::AsyncService service;
+  std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> queues;
+  std::unique_ptr<grpc::Server> server;
+  std::vector<std::thread> workers;
+  bool stopped = false;
+
+  void serve(grpc::ServerCompletionQueue* cq);
+};
@@ -1,5 +1,7 @@
 #include "json_details.h"
 
+#include <string_view>
+
 ///
 /// Bytes
 ///
@@ -18,6 +20,94 @@ from_json(const json& j, bytes& v)
   v = from_hex(j.get<std::string>());
 }
 
-} // namespace mls_vectors
+} // namespace nlohmann
 
 // TODO(RLB) Other concrete, non-templated type serializers could be moved here.
+
+///
+/// Streaming output
+///
+
+namespace mls_vectors {
+
+// Write all but the closing brace of a JSON object
+static void
+write_open_object(std::ostream& out, const json& head)
+{
+  auto text = head.dump();
+  text.pop_back();
+  out << text;
+}
+
+// Write a member whose value is a hex string, without holding the hex
+static void
+write_hex_member(std::ostream& out, const char* name, const bytes& data)
+{
+  static constexpr auto digits = std::string_view("0123456789abcdef");
+  static constexpr size_t chunk_size = 4096;
+
+  out << ",\"" << name << "\":\"";
+
+  auto chunk = std::string{};
+  chunk.reserve(chunk_size);
+  for (const auto byte : data) {
+    chunk.push_back(digits.at(byte >> 4));
+    chunk.push_back(digits.at(byte & 0x0f));
+    if (chunk.size() >= chunk_size) {
+      out << chunk;
+      chunk.clear();
+    }
+  }
+
+  out << chunk << '"';
+}
+
+void
+write_json(std::ostream& out, const EncryptionTestVector& tv)
+{
+  write_open_object(out,
+                    {
+                      { "cipher_suite", tv.cipher_suite },
+                      { "encryption_secret", tv.encryption_secret },
+                      { "sender_data_secret", tv.sender_data_secret },
+                      { "padding_size", tv.padding_size },
+                      { "sender_data_info", tv.sender_data_info },
+                      { "authenticated_data", tv.authenticated_data },
+                    });
+  write_hex_member(out, "tree", tv.tree);
+
+  out << ",\"leaves\":[";
+  for (size_t i = 0; i < tv.leaves.size(); i++) {
+    out << (i == 0 ? "" : ",") << json(tv.leaves[i]).dump();
+  }
+  out << "]}";
+}
+
+void
+write_json(std::ostream& out, const TreeKEMTestVector& tv)
+{
+  write_open_object(out,
+                    {
+                      { "cipher_suite", tv.cipher_suite },
+                      { "group_id", tv.group_id },
+                      { "add_sender", tv.add_sender },
+                      { "my_leaf_secret", tv.my_leaf_secret },
+                      { "my_leaf_node", tv.my_leaf_node },
+                      { "my_path_secret", tv.my_path_secret },
+                      { "update_sender", tv.update_sender },
+                      { "update_path", tv.update_path },
+                      { "update_group_context", tv.update_group_context },
+                      { "tree_hash_before", tv.tree_hash_before },
+                      { "root_secret_after_add", tv.root_secret_after_add },
+                      { "root_secret_after_update",
+                        tv.root_secret_after_update },
+                      { "tree_hash_after", tv.tree_hash_after },
+                    });
+  write_hex_member(
+    out, "ratchet_tree_before", tls::marshal(tv.ratchet_tree_before));
+  write_hex_member(
+    out, "ratchet_tree_after", tls::marshal(tv.ratchet_tree_after));
+  out << "}";
+}
+
+} // namespace mls_vectors
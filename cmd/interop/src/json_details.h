@@ -2,6 +2,7 @@
 
 #include <mls_vectors/mls_vectors.h>
 #include <nlohmann/json.hpp>
+#include <ostream>
 
 using nlohmann::json;
 
@@ -225,4 +226,13 @@ NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(MessagesTestVector,
                                    mls_plaintext,
                                    mls_ciphertext)
 
+// Write the same JSON as the serializers above, without first building the
+// whole vector as a json value.  The parts that grow with the group, the
+// leaves of an EncryptionTestVector and the trees of a TreeKEMTestVector, are
+// written out piece by piece.
+void
+write_json(std::ostream& out, const EncryptionTestVector& tv);
+void
+write_json(std::ostream& out, const TreeKEMTestVector& tv);
+
 } // namespace mls_vectors
@@ -1,42 +1,55 @@
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <gflags/gflags.h>
 #include <grpcpp/grpcpp.h>
 #include <mls_vectors/mls_vectors.h>
 
+#include "async_server.h"
 #include "json_details.h"
 #include "mls_client_impl.h"
 
-using grpc::Server;
-using grpc::ServerBuilder;
 using nlohmann::json;
 using namespace mls_client;
 
+#define NO_SAMPLE 0xffffffffffffffff
+DEFINE_uint64(sample, NO_SAMPLE, "Generate a sample JSON file (by enum value)");
+DEFINE_uint64(sample_size,
+              5,
+              "Size of the sample, e.g., leaves in the group (default 5)");
+DEFINE_uint64(port, 50001, "Listen for gRPC on this port");
+DEFINE_uint64(threads, 0, "Worker threads serving calls (0 = one per core)");
+
+static size_t
+thread_count()
+{
+  auto threads = static_cast<size_t>(FLAGS_threads);
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  return threads;
+}
+
 static json
 make_sample(uint64_t type)
 {
   auto suite = mls::CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519;
-  auto n = 5;
+  auto n = static_cast<uint32_t>(FLAGS_sample_size);
   switch (type) {
     case TestVectorType::TREE_MATH:
       return mls_vectors::TreeMathTestVector::create(n);
 
-    case TestVectorType::ENCRYPTION:
-      return mls_vectors::EncryptionTestVector::create(suite, n, n);
-
     case TestVectorType::KEY_SCHEDULE:
       return mls_vectors::KeyScheduleTestVector::create(suite, n, n);
 
     case TestVectorType::TRANSCRIPT:
       return mls_vectors::TranscriptTestVector::create(suite);
 
-    case TestVectorType::TREEKEM:
-      return mls_vectors::TreeKEMTestVector::create(suite, n);
-
     case TestVectorType::MESSAGES:
       return mls_vectors::MessagesTestVector::create();
 
@@ -48,6 +61,32 @@ make_sample(uint64_t type)
 static void
 print_sample(uint64_t type)
 {
+  // Encryption and TreeKEM vectors grow with the group, so they are generated
+  // on all of the worker threads and written out as they are serialized
+  auto suite = mls::CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519;
+  auto n = static_cast<uint32_t>(FLAGS_sample_size);
+  auto executor = mls_vectors::thread_executor(thread_count());
+  switch (type) {
+    case TestVectorType::ENCRYPTION: {
+      // Many generations add little beyond the first few
+      const auto n_generations = std::min(n, uint32_t(5));
+      write_json(std::cout,
+                 mls_vectors::EncryptionTestVector::create(
+                   suite, n, n_generations, executor));
+      std::cout << std::endl;
+      return;
+    }
+
+    case TestVectorType::TREEKEM:
+      write_json(std::cout,
+                 mls_vectors::TreeKEMTestVector::create(suite, n, executor));
+      std::cout << std::endl;
+      return;
+
+    default:
+      break;
+  }
+
   auto j = make_sample(type);
   if (j.is_null()) {
     std::cout << "Invalid test vector type" << std::endl;
@@ -57,10 +96,6 @@ print_sample(uint64_t type)
   std::cout << j.dump(2) << std::endl;
 }
 
-#define NO_SAMPLE 0xffffffffffffffff
-DEFINE_uint64(sample, NO_SAMPLE, "Generate a sample JSON file (by enum value)");
-DEFINE_uint64(port, 50001, "Listen for gRPC on this port");
-
 int
 main(int argc, char* argv[])
 {
@@ -76,14 +111,11 @@ main(int argc, char* argv[])
   addr_stream << "0.0.0.0:" << FLAGS_port;
   auto server_address = addr_stream.str();
 
-  grpc::EnableDefaultHealthCheckService(true);
-  ServerBuilder builder;
-  builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
-  builder.RegisterService(&service);
-
-  std::cout << "Listening on " << server_address << std::endl;
-  std::unique_ptr<Server> server(builder.BuildAndStart());
-  server->Wait();
+  auto threads = thread_count();
+  auto server = AsyncServer(service, server_address, threads);
+  std::cout << "Listening on " << server_address << " with " << threads
+            << " threads" << std::endl;
+  server.wait();
 
   return 0;
 }
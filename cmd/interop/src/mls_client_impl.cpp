@@ -2,6 +2,10 @@
 #include "json_details.h"
 #include <bytes/bytes.h>
 
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
 using grpc::StatusCode;
 using nlohmann::json;
 using namespace bytes_ns;
@@ -24,6 +28,15 @@ mls_suite(uint32_t suite_id)
   return static_cast<mls::CipherSuite::ID>(suite_id);
 }
 
+// Test vectors for large groups are generated and verified on all cores
+static const mls::Executor&
+vector_executor()
+{
+  static const auto executor = mls_vectors::thread_executor(
+    std::max(std::thread::hardware_concurrency(), 1U));
+  return executor;
+}
+
 // Map C++ exceptions to gRPC errors
 static inline Status
 catch_wrap(std::function<Status()>&& f)
@@ -44,8 +57,9 @@ MLSClientImpl::state_wrap(const Req* req, F&& f)
     return Status(StatusCode::NOT_FOUND, "Unknown state");
   }
 
+  // The state stays locked until the method returns
   try {
-    return f(*maybe_state);
+    return f(*opt::get(maybe_state));
   } catch (const std::exception& e) {
     return Status(StatusCode::INTERNAL, e.what());
   }
@@ -227,17 +241,14 @@ MLSClientImpl::store_join(mls::HPKEPrivateKey&& init_priv,
                            std::move(leaf_priv),
                            std::move(sig_priv),
                            std::move(kp) };
-  join_cache.emplace(std::make_pair(join_id, std::move(entry)));
+  join_cache.store(join_id, std::move(entry));
   return join_id;
 }
 
-MLSClientImpl::CachedJoin*
+std::optional<ShardedCache<MLSClientImpl::CachedJoin>::Handle>
 MLSClientImpl::load_join(uint32_t join_id)
 {
-  if (join_cache.count(join_id) == 0) {
-    return nullptr;
-  }
-  return &join_cache.at(join_id);
+  return join_cache.load(join_id);
 }
 
 // Cached group state
@@ -273,23 +284,20 @@ MLSClientImpl::store_state(mls::State&& state, bool encrypt_handshake)
   state_id += state.index().val;
 
   auto entry = CachedState{ std::move(state), encrypt_handshake, {}, {} };
-  state_cache.emplace(std::make_pair(state_id, std::move(entry)));
+  state_cache.store(state_id, std::move(entry));
   return state_id;
 }
 
-MLSClientImpl::CachedState*
+std::optional<ShardedCache<MLSClientImpl::CachedState>::Handle>
 MLSClientImpl::load_state(uint32_t state_id)
 {
-  if (state_cache.count(state_id) == 0) {
-    return nullptr;
-  }
-  return &state_cache.at(state_id);
+  return state_cache.load(state_id);
 }
 
 void
 MLSClientImpl::remove_state(uint32_t state_id)
 {
-  state_cache.erase(state_id);
+  state_cache.remove(state_id);
 }
 
 // Fallible method implementations, wrapped before being exposed to gRPC
@@ -305,7 +313,8 @@ MLSClientImpl::verify_test_vector(const VerifyTestVectorRequest* request)
     }
 
     case TestVectorType::ENCRYPTION: {
-      error = tv_json.get<mls_vectors::EncryptionTestVector>().verify();
+      error = tv_json.get<mls_vectors::EncryptionTestVector>().verify(
+        vector_executor());
       break;
     }
 
@@ -321,8 +330,8 @@ MLSClientImpl::verify_test_vector(const VerifyTestVectorRequest* request)
 
     case TestVectorType::TREEKEM: {
       auto tv = tv_json.get<mls_vectors::TreeKEMTestVector>();
-      tv.initialize_trees();
-      error = tv.verify();
+      tv.initialize_trees(vector_executor());
+      error = tv.verify(vector_executor());
       break;
     }
 
@@ -358,9 +367,15 @@ MLSClientImpl::generate_test_vector(const GenerateTestVectorRequest* request,
 
     case TestVectorType::ENCRYPTION: {
       auto suite = static_cast<mls::CipherSuite::ID>(request->cipher_suite());
-      j = mls_vectors::EncryptionTestVector::create(
-        suite, request->n_leaves(), request->n_generations());
-      break;
+      const auto tv =
+        mls_vectors::EncryptionTestVector::create(suite,
+                                                  request->n_leaves(),
+                                                  request->n_generations(),
+                                                  vector_executor());
+      auto out = std::ostringstream{};
+      write_json(out, tv);
+      reply->set_test_vector(out.str());
+      return Status::OK;
     }
 
     case TestVectorType::KEY_SCHEDULE: {
@@ -378,8 +393,12 @@ MLSClientImpl::generate_test_vector(const GenerateTestVectorRequest* request,
 
     case TestVectorType::TREEKEM: {
       auto suite = static_cast<mls::CipherSuite::ID>(request->cipher_suite());
-      j = mls_vectors::TreeKEMTestVector::create(suite, request->n_leaves());
-      break;
+      const auto tv = mls_vectors::TreeKEMTestVector::create(
+        suite, request->n_leaves(), vector_executor());
+      auto out = std::ostringstream{};
+      write_json(out, tv);
+      reply->set_test_vector(out.str());
+      return Status::OK;
     }
 
     case TestVectorType::MESSAGES: {
@@ -466,11 +485,13 @@ Status
 MLSClientImpl::join_group(const JoinGroupRequest* request,
                           JoinGroupResponse* response)
 {
-  auto join = load_join(request->transaction_id());
-  if (!join) {
+  auto maybe_join = load_join(request->transaction_id());
+  if (!maybe_join) {
     return Status(StatusCode::INVALID_ARGUMENT, "Unknown transaction ID");
   }
 
+  auto& join = opt::get(maybe_join);
+
   auto welcome_data = string_to_bytes(request->welcome());
   auto welcome = tls::get<mls::Welcome>(welcome_data);
 
@@ -530,7 +551,7 @@ MLSClientImpl::public_group_state(CachedState& entry,
                                   const PublicGroupStateRequest* /* request */,
                                   PublicGroupStateResponse* response)
 {
-  auto group_info_data = tls::marshal(entry.state.group_info());
+  const auto& group_info_data = entry.state.group_info_data(true);
   response->set_public_group_state(bytes_to_string(group_info_data));
   return Status::OK;
 }
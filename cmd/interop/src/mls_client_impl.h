@@ -5,73 +5,78 @@
 #include <mls_vectors/mls_vectors.h>
 
 #include "mls_client.grpc.pb.h"
+#include "sharded_cache.h"
 
 using grpc::ServerContext;
 using grpc::Status;
 using namespace mls_client;
 
-class MLSClientImpl final : public MLSClient::Service
+// The methods of the MLSClient service.  They are called by AsyncServer from
+// several threads at once; each state or join transaction is only worked on
+// by one of them at a time.
+class MLSClientImpl
 {
+public:
   // gRPC methods
   Status Name(ServerContext* context,
               const NameRequest* request,
-              NameResponse* reply) override;
+              NameResponse* reply);
 
   Status SupportedCiphersuites(ServerContext* context,
                                const SupportedCiphersuitesRequest* request,
-                               SupportedCiphersuitesResponse* reply) override;
+                               SupportedCiphersuitesResponse* reply);
 
   Status GenerateTestVector(ServerContext* context,
                             const GenerateTestVectorRequest* request,
-                            GenerateTestVectorResponse* reply) override;
+                            GenerateTestVectorResponse* reply);
   Status VerifyTestVector(ServerContext* context,
                           const VerifyTestVectorRequest* request,
-                          VerifyTestVectorResponse* reply) override;
+                          VerifyTestVectorResponse* reply);
 
   // Ways to become a member of a group
   Status CreateGroup(ServerContext* context,
                      const CreateGroupRequest* request,
-                     CreateGroupResponse* response) override;
+                     CreateGroupResponse* response);
   Status CreateKeyPackage(ServerContext* context,
                           const CreateKeyPackageRequest* request,
-                          CreateKeyPackageResponse* response) override;
+                          CreateKeyPackageResponse* response);
   Status JoinGroup(ServerContext* context,
                    const JoinGroupRequest* request,
-                   JoinGroupResponse* response) override;
+                   JoinGroupResponse* response);
   Status ExternalJoin(ServerContext* context,
                       const ExternalJoinRequest* request,
-                      ExternalJoinResponse* response) override;
+                      ExternalJoinResponse* response);
 
   // Access information from a group state
   Status PublicGroupState(ServerContext* context,
                           const PublicGroupStateRequest* request,
-                          PublicGroupStateResponse* response) override;
+                          PublicGroupStateResponse* response);
   Status StateAuth(ServerContext* context,
                    const StateAuthRequest* request,
-                   StateAuthResponse* response) override;
+                   StateAuthResponse* response);
   Status Export(ServerContext* context,
                 const ExportRequest* request,
-                ExportResponse* response) override;
+                ExportResponse* response);
   Status Protect(ServerContext* context,
                  const ProtectRequest* request,
-                 ProtectResponse* response) override;
+                 ProtectResponse* response);
   Status Unprotect(ServerContext* context,
                    const UnprotectRequest* request,
-                   UnprotectResponse* response) override;
+                   UnprotectResponse* response);
 
   // Operations using a group state
   Status AddProposal(ServerContext* context,
                      const AddProposalRequest* request,
-                     ProposalResponse* response) override;
+                     ProposalResponse* response);
   Status Commit(ServerContext* context,
                 const CommitRequest* request,
-                CommitResponse* response) override;
+                CommitResponse* response);
   Status HandleCommit(ServerContext* context,
                       const HandleCommitRequest* request,
-                      HandleCommitResponse* response) override;
+                      HandleCommitResponse* response);
   Status HandleExternalCommit(ServerContext* context,
                               const HandleExternalCommitRequest* request,
-                              HandleExternalCommitResponse* response) override;
+                              HandleExternalCommitResponse* response);
 
 private:
   // Wrapper for methods that rely on state
@@ -87,13 +92,13 @@ private:
     mls::KeyPackage key_package;
   };
 
-  std::map<uint32_t, CachedJoin> join_cache;
+  ShardedCache<CachedJoin> join_cache;
 
   uint32_t store_join(mls::HPKEPrivateKey&& init_priv,
                       mls::HPKEPrivateKey&& leaf_priv,
                       mls::SignaturePrivateKey&& sig_priv,
                       mls::KeyPackage&& kp);
-  CachedJoin* load_join(uint32_t join_id);
+  std::optional<ShardedCache<CachedJoin>::Handle> load_join(uint32_t join_id);
 
   // Cached group state
   struct CachedState
@@ -111,10 +116,11 @@ private:
     mls::MLSMessage unmarshal(const std::string& wire);
   };
 
-  std::map<uint32_t, CachedState> state_cache;
+  ShardedCache<CachedState> state_cache;
 
   uint32_t store_state(mls::State&& state, bool encrypt_handshake);
-  CachedState* load_state(uint32_t state_id);
+  std::optional<ShardedCache<CachedState>::Handle> load_state(
+    uint32_t state_id);
   void remove_state(uint32_t state_id);
 
   // Fallible method implementations, wrapped before being exposed to gRPC
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+// A map from IDs to values that can be used from many threads at once.  IDs
+// are spread over shards, each with its own lock, so that threads working on
+// different entries rarely contend.  The shard lock is only held to look up,
+// insert, or remove an entry; the entry itself has a lock that is held for as
+// long as a caller is working with it.
+template<typename T>
+class ShardedCache
+{
+  struct Entry
+  {
+    std::mutex mutex;
+    T value;
+
+    explicit Entry(T&& value_in)
+      : value(std::move(value_in))
+    {
+    }
+  };
+
+public:
+  // Exclusive access to one entry.  The entry stays alive while a Handle to
+  // it exists, even if it is removed from the cache in the meantime.
+  class Handle
+  {
+  public:
+    T& operator*() { return entry->value; }
+    T* operator->() { return &entry->value; }
+
+  private:
+    std::shared_ptr<Entry> entry;
+    std::unique_lock<std::mutex> lock;
+
+    explicit Handle(std::shared_ptr<Entry> entry_in)
+      : entry(std::move(entry_in))
+      , lock(entry->mutex)
+    {
+    }
+
+    friend class ShardedCache;
+  };
+
+  // Does not replace an existing entry with the same ID
+  void store(uint32_t id, T&& value)
+  {
+    auto entry = std::make_shared<Entry>(std::move(value));
+
+    auto& shard = shard_for(id);
+    const auto lock = std::lock_guard(shard.mutex);
+    shard.entries.emplace(id, std::move(entry));
+  }
+
+  // Blocks until any other Handle to the same entry is released
+  std::optional<Handle> load(uint32_t id)
+  {
+    auto entry = std::shared_ptr<Entry>{};
+    {
+      auto& shard = shard_for(id);
+      const auto lock = std::lock_guard(shard.mutex);
+      const auto it = shard.entries.find(id);
+      if (it == shard.entries.end()) {
+        return std::nullopt;
+      }
+
+      entry = it->second;
+    }
+
+    return Handle(std::move(entry));
+  }
+
+  void remove(uint32_t id)
+  {
+    auto& shard = shard_for(id);
+    const auto lock = std::lock_guard(shard.mutex);
+    shard.entries.erase(id);
+  }
+
+private:
+  struct Shard
+  {
+    std::mutex mutex;
+    std::map<uint32_t, std::shared_ptr<Entry>> entries;
+  };
+
+  static constexpr size_t shard_count = 64;
+  std::array<Shard, shard_count> shards;
+
+  Shard& shard_for(uint32_t id) { return shards.at(id % shard_count); }
+};
@@ -0,0 +1,181 @@
+#include "group.h"
+
+#include <algorithm>
+
+using namespace mls;
+
+namespace mls_loadgen {
+
+Group::Group(CipherSuite suite_in,
+             const bytes& group_id,
+             size_t size,
+             Stats& stats)
+  : suite(suite_in)
+  , rng(std::random_device{}())
+{
+  const auto timer = Timer(stats, "create");
+
+  // The creator adds everyone else in a single Commit
+  members.push_back(new_client().begin_session(group_id));
+  auto& creator = members.front();
+
+  auto joins = std::vector<PendingJoin>{};
+  for (size_t i = 1; i < size; i++) {
+    joins.push_back(new_client().start_join());
+    creator.handle(creator.add(joins.back().key_package()));
+  }
+
+  auto [welcome, commit] = creator.commit();
+  creator.handle(commit);
+  for (const auto& join : joins) {
+    members.push_back(join.complete(welcome));
+  }
+}
+
+size_t
+Group::pick(size_t bound)
+{
+  return std::uniform_int_distribution<size_t>(0, bound - 1)(rng);
+}
+
+Client
+Group::new_client() const
+{
+  auto sig_priv = SignaturePrivateKey::generate(suite);
+  auto cred = Credential::basic(sig_priv.public_key.data);
+  return { suite, sig_priv, cred };
+}
+
+void
+Group::step(const Mix& mix, size_t message_size, Stats& stats)
+{
+  const auto total = mix.add + mix.remove + mix.update + mix.message;
+  auto choice = pick(total);
+
+  if (choice < mix.add) {
+    add(stats);
+    return;
+  }
+  choice -= mix.add;
+
+  // A group is not shrunk below two members
+  if (choice < mix.remove) {
+    if (members.size() > 2) {
+      remove(stats);
+    } else {
+      add(stats);
+    }
+    return;
+  }
+  choice -= mix.remove;
+
+  if (choice < mix.update) {
+    update(stats);
+    return;
+  }
+
+  message(message_size, stats);
+}
+
+void
+Group::broadcast(const bytes& msg, size_t except, Stats& stats)
+{
+  for (size_t i = 0; i < members.size(); i++) {
+    if (i == except) {
+      continue;
+    }
+
+    const auto timer = Timer(stats, "handle");
+    members.at(i).handle(msg);
+  }
+}
+
+bytes
+Group::commit(size_t committer, size_t except, Stats& stats)
+{
+  auto welcome = bytes{};
+  auto commit = bytes{};
+  {
+    const auto timer = Timer(stats, "commit");
+    std::tie(welcome, commit) = members.at(committer).commit();
+  }
+
+  broadcast(commit, except, stats);
+  return welcome;
+}
+
+void
+Group::add(Stats& stats)
+{
+  const auto timer = Timer(stats, "add");
+
+  auto join = new_client().start_join();
+  const auto adder = pick(members.size());
+  const auto proposal = members.at(adder).add(join.key_package());
+  broadcast(proposal, nobody, stats);
+
+  const auto welcome = commit(adder, nobody, stats);
+
+  const auto join_timer = Timer(stats, "join");
+  members.push_back(join.complete(welcome));
+}
+
+void
+Group::remove(Stats& stats)
+{
+  const auto timer = Timer(stats, "remove");
+
+  const auto victim = pick(members.size());
+  const auto remover = (victim + 1 + pick(members.size() - 1)) % members.size();
+
+  // Proposals name the victim by its position in the roster
+  const auto victim_leaf = members.at(victim).index();
+  const auto roster_index = std::count_if(
+    members.begin(), members.end(), [&](const auto& member) {
+      return member.index() < victim_leaf;
+    });
+
+  const auto proposal =
+    members.at(remover).remove(static_cast<uint32_t>(roster_index));
+  broadcast(proposal, nobody, stats);
+
+  commit(remover, victim, stats);
+  members.erase(members.begin() + static_cast<ptrdiff_t>(victim));
+}
+
+void
+Group::update(Stats& stats)
+{
+  const auto timer = Timer(stats, "update");
+
+  // A member cannot commit its own Update
+  const auto updater = pick(members.size());
+  const auto committer =
+    (updater + 1 + pick(members.size() - 1)) % members.size();
+  broadcast(members.at(updater).update(), nobody, stats);
+  commit(committer, nobody, stats);
+}
+
+void
+Group::message(size_t message_size, Stats& stats)
+{
+  const auto sender = pick(members.size());
+  const auto plaintext = bytes(message_size, 0xA0);
+
+  auto ciphertext = bytes{};
+  {
+    const auto timer = Timer(stats, "protect");
+    ciphertext = members.at(sender).protect(plaintext);
+  }
+
+  for (size_t i = 0; i < members.size(); i++) {
+    if (i == sender) {
+      continue;
+    }
+
+    const auto timer = Timer(stats, "unprotect");
+    members.at(i).unprotect(ciphertext);
+  }
+}
+
+} // namespace mls_loadgen
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <mls/session.h>
+
+#include <bytes/bytes.h>
+
+#include <random>
+#include <vector>
+
+#include "stats.h"
+
+namespace mls_loadgen {
+
+// The relative weight of each operation in the mix
+struct Mix
+{
+  unsigned add = 1;
+  unsigned remove = 1;
+  unsigned update = 2;
+  unsigned message = 16;
+};
+
+// One simulated group, with a Session for every member.  A group is only ever
+// driven by one thread at a time.
+class Group
+{
+public:
+  Group(mls::CipherSuite suite, const bytes& group_id, size_t size, Stats& stats);
+
+  // Run one operation, chosen at random according to the mix
+  void step(const Mix& mix, size_t message_size, Stats& stats);
+
+  size_t size() const { return members.size(); }
+
+private:
+  mls::CipherSuite suite;
+  std::vector<mls::Session> members;
+  std::mt19937_64 rng;
+
+  size_t pick(size_t bound);
+  mls::Client new_client() const;
+
+  // Deliver a handshake message to every member, including its sender, but
+  // not to a member that it removes
+  static constexpr size_t nobody = static_cast<size_t>(-1);
+  void broadcast(const bytes& msg, size_t except, Stats& stats);
+
+  // Commit the proposals the group has seen and deliver the Commit,
+  // returning the Welcome
+  bytes commit(size_t committer, size_t except, Stats& stats);
+
+  void add(Stats& stats);
+  void remove(Stats& stats);
+  void update(Stats& stats);
+  void message(size_t message_size, Stats& stats);
+};
+
+} // namespace mls_loadgen
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <tls/tls_syntax.h>
+
+#include "group.h"
+#include "stats.h"
+
+using namespace mls_loadgen;
+
+DEFINE_uint64(groups, 16, "Number of groups to simulate");
+DEFINE_uint64(group_size, 32, "Initial number of members in each group");
+DEFINE_uint64(ops, 200, "Operations to run on each group");
+DEFINE_uint64(threads, 0, "Worker threads (0 for one per core)");
+DEFINE_uint64(message_size, 1024, "Size of application messages, in bytes");
+DEFINE_uint32(mix_add, 1, "Relative weight of Add operations");
+DEFINE_uint32(mix_remove, 1, "Relative weight of Remove operations");
+DEFINE_uint32(mix_update, 2, "Relative weight of Update operations");
+DEFINE_uint32(mix_message, 16, "Relative weight of application messages");
+DEFINE_uint32(suite,
+              uint32_t(mls::CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519),
+              "Cipher suite, by code point");
+
+static const char* const usage =
+  "Drives a mix of Adds, Removes, Updates and application messages against "
+  "many MLS groups at once, and reports throughput and latency per "
+  "operation.";
+
+int
+main(int argc, char* argv[])
+{
+  gflags::SetUsageMessage(usage);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  const auto suite =
+    mls::CipherSuite(static_cast<mls::CipherSuite::ID>(FLAGS_suite));
+  const auto mix =
+    Mix{ FLAGS_mix_add, FLAGS_mix_remove, FLAGS_mix_update, FLAGS_mix_message };
+  if (FLAGS_group_size < 2) {
+    std::cerr << "Groups must have at least two members" << std::endl;
+    return 1;
+  }
+
+  if (mix.add + mix.remove + mix.update + mix.message == 0) {
+    std::cerr << "The operation mix is empty" << std::endl;
+    return 1;
+  }
+
+  auto thread_count = static_cast<size_t>(FLAGS_threads);
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Each thread creates and then drives its own share of the groups, so no
+  // group is touched by two threads
+  const auto baseline_rss = peak_rss();
+  auto stats = std::vector<Stats>(thread_count);
+  auto errors = std::vector<std::string>(thread_count);
+  auto threads = std::vector<std::thread>{};
+
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < thread_count; t++) {
+    threads.emplace_back([&, t]() {
+      try {
+        auto groups = std::vector<std::unique_ptr<Group>>{};
+        for (auto g = uint64_t(t); g < FLAGS_groups; g += thread_count) {
+          const auto group_id = tls::marshal(g);
+          groups.push_back(std::make_unique<Group>(
+            suite, group_id, FLAGS_group_size, stats.at(t)));
+        }
+
+        for (uint64_t i = 0; i < FLAGS_ops; i++) {
+          for (auto& group : groups) {
+            group->step(mix, FLAGS_message_size, stats.at(t));
+          }
+        }
+      } catch (const std::exception& e) {
+        errors.at(t) = e.what();
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  for (const auto& error : errors) {
+    if (!error.empty()) {
+      std::cerr << "Error: " << error << std::endl;
+      return 1;
+    }
+  }
+
+  auto total = Stats{};
+  for (const auto& thread_stats : stats) {
+    total.merge(thread_stats);
+  }
+
+  std::cout << FLAGS_groups << " groups of " << FLAGS_group_size
+            << " members, " << FLAGS_ops << " operations each, on "
+            << thread_count << " threads" << std::endl
+            << std::endl;
+  total.report(std::cout, elapsed);
+
+  const auto rss = peak_rss();
+  if (rss > 0 && FLAGS_groups > 0) {
+    static constexpr auto bytes_per_kib = uint64_t(1024);
+    const auto per_group = (rss - std::min(rss, baseline_rss)) / FLAGS_groups;
+    std::cout << std::endl
+              << "peak RSS " << rss / bytes_per_kib << " KiB, about "
+              << per_group / bytes_per_kib << " KiB per group" << std::endl;
+  }
+
+  return 0;
+}
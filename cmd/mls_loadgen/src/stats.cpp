@@ -0,0 +1,98 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+namespace mls_loadgen {
+
+void
+Stats::record(const std::string& op, uint64_t ns)
+{
+  samples[op].push_back(ns);
+}
+
+void
+Stats::merge(const Stats& other)
+{
+  for (const auto& [op, values] : other.samples) {
+    auto& mine = samples[op];
+    mine.insert(mine.end(), values.begin(), values.end());
+  }
+}
+
+static double
+percentile_us(const std::vector<uint64_t>& sorted, double p)
+{
+  if (sorted.empty()) {
+    return 0.0;
+  }
+
+  const auto rank = static_cast<size_t>(p * double(sorted.size() - 1));
+  static constexpr auto ns_per_us = 1000.0;
+  return double(sorted.at(rank)) / ns_per_us;
+}
+
+void
+Stats::report(std::ostream& out, std::chrono::nanoseconds elapsed) const
+{
+  const auto seconds = std::chrono::duration<double>(elapsed).count();
+
+  out << std::left << std::setw(12) << "operation" << std::right
+      << std::setw(10) << "count" << std::setw(12) << "ops/s" << std::setw(12)
+      << "p50 us" << std::setw(12) << "p99 us" << std::setw(12) << "p999 us"
+      << std::endl;
+
+  out << std::fixed << std::setprecision(1);
+  for (const auto& [op, values] : samples) {
+    auto sorted = values;
+    std::sort(sorted.begin(), sorted.end());
+
+    out << std::left << std::setw(12) << op << std::right << std::setw(10)
+        << sorted.size() << std::setw(12) << double(sorted.size()) / seconds
+        << std::setw(12) << percentile_us(sorted, 0.50) << std::setw(12)
+        << percentile_us(sorted, 0.99) << std::setw(12)
+        << percentile_us(sorted, 0.999) << std::endl;
+  }
+}
+
+Timer::Timer(Stats& stats_in, std::string op_in)
+  : stats(stats_in)
+  , op(std::move(op_in))
+  , start(std::chrono::steady_clock::now())
+{
+}
+
+Timer::~Timer()
+{
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  const auto ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  stats.record(op, static_cast<uint64_t>(ns));
+}
+
+uint64_t
+peak_rss()
+{
+#if defined(_WIN32)
+  return 0;
+#else
+  auto usage = rusage{};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  // Linux reports kilobytes, macOS bytes
+#if defined(__APPLE__)
+  return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+  static constexpr uint64_t bytes_per_kb = 1024;
+  return static_cast<uint64_t>(usage.ru_maxrss) * bytes_per_kb;
+#endif
+#endif
+}
+
+} // namespace mls_loadgen
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mls_loadgen {
+
+// Latency samples for each kind of operation, in nanoseconds.  Each thread
+// keeps its own, and they are merged for the report.
+class Stats
+{
+public:
+  void record(const std::string& op, uint64_t ns);
+  void merge(const Stats& other);
+
+  // Throughput, and p50/p99/p999 latency, for each kind of operation
+  void report(std::ostream& out, std::chrono::nanoseconds elapsed) const;
+
+private:
+  std::map<std::string, std::vector<uint64_t>> samples;
+};
+
+// Records the time from construction to destruction under one operation
+class Timer
+{
+public:
+  Timer(Stats& stats_in, std::string op_in);
+  ~Timer();
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+private:
+  Stats& stats;
+  std::string op;
+  std::chrono::steady_clock::time_point start;
+};
+
+// The peak resident set size of the process, in bytes, or zero where it
+// cannot be measured
+uint64_t
+peak_rss();
+
+} // namespace mls_loadgen
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <mls/common.h>
+#include <mls/session.h>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define MLS_HAS_COROUTINES 1
+#endif
+
+#if defined(MLS_HAS_COROUTINES)
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <tuple>
+#include <vector>
+
+namespace mls {
+
+// A Session whose operations are awaited from C++20 coroutines.
+//
+// Each operation runs on the `worker` scheduler, and the awaiting coroutine is
+// resumed on the `strand` scheduler, e.g., the event loop strand that owns the
+// group, so that an event loop thread never does the work of a Commit itself.
+// Handshake operations on the Session are serialized; unprotect() runs
+// alongside other calls to unprotect(), as with Session.
+//
+// The bulk crypto within an operation, such as encrypting an UpdatePath or
+// validating the tree, runs on `executor` if one is given.
+//
+// The schedulers may also run tasks inline, before returning, though then the
+// work of an operation happens on the thread that awaits it.
+class AsyncSession
+{
+public:
+  struct Options
+  {
+    Scheduler worker;
+    Scheduler strand;
+    Executor executor = {};
+  };
+
+  AsyncSession(Session session, Options opts);
+
+  template<typename T>
+  class Operation;
+
+  Operation<bytes> add(bytes key_package_data);
+  Operation<bytes> update();
+  Operation<bytes> remove(uint32_t index);
+  Operation<std::tuple<bytes, bytes>> commit();
+  Operation<std::tuple<bytes, bytes>> commit(std::vector<bytes> proposals);
+  Operation<bool> handle(bytes handshake_data);
+  Operation<bytes> protect(bytes plaintext);
+  Operation<bytes> unprotect(bytes ciphertext) const;
+
+  // Direct access to the Session, for calls that are cheap enough to make on
+  // the strand.  No operation may be in flight while it is used.
+  Session& session() { return shared->session; }
+  const Session& session() const { return shared->session; }
+
+private:
+  // Operations that are still running keep the Session alive
+  struct Shared
+  {
+    Session session;
+    mutable std::shared_mutex mutex;
+
+    explicit Shared(Session session_in);
+  };
+
+  std::shared_ptr<Shared> shared;
+  Scheduler worker;
+  Scheduler strand;
+
+  template<typename T>
+  Operation<T> exclusive(std::function<T(Session&)> work) const;
+};
+
+template<typename T>
+class AsyncSession::Operation
+{
+public:
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle)
+  {
+    // If the schedulers run tasks inline, resuming the coroutine destroys this
+    // Operation while they are still running, so they are called through
+    // copies, and nothing touches `this` once the coroutine is resumed.
+    const auto run = worker;
+    run([this, handle, resume = strand]() {
+      try {
+        result.emplace(work());
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      resume([handle]() { handle.resume(); });
+    });
+  }
+
+  T await_resume()
+  {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    return std::move(*result);
+  }
+
+private:
+  Scheduler worker;
+  Scheduler strand;
+  std::function<T()> work;
+  std::optional<T> result;
+  std::exception_ptr error;
+
+  Operation(Scheduler worker_in, Scheduler strand_in, std::function<T()> work_in)
+    : worker(std::move(worker_in))
+    , strand(std::move(strand_in))
+    , work(std::move(work_in))
+  {
+  }
+
+  friend class AsyncSession;
+};
+
+template<typename T>
+AsyncSession::Operation<T>
+AsyncSession::exclusive(std::function<T(Session&)> work) const
+{
+  return { worker, strand, [shared = shared, work = std::move(work)]() {
+            const auto lock = std::unique_lock(shared->mutex);
+            return work(shared->session);
+          } };
+}
+
+} // namespace mls
+
+#endif // defined(MLS_HAS_COROUTINES)
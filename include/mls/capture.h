@@ -0,0 +1,113 @@
+#pragma once
+
+#include <mls/common.h>
+#include <tls/tls_syntax.h>
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace mls {
+
+// A capture records the traffic of one member of a group, so that it can be
+// replayed offline with the same messages, in the same order.
+//
+// struct {
+//   uint16 version;
+//   opaque state<V>;        // State::serialize() when capture started
+// } CaptureHeader;
+//
+// struct {
+//   CaptureType type;
+//   uint64 time_ns;         // since capture started
+//   uint64 duration_ns;
+//   uint64 plaintext_size;  // for protect
+//   opaque message<V>;      // the MLSMessage handled or produced
+// } CaptureRecord;
+//
+// A capture file is a CaptureHeader followed by CaptureRecords, each of them
+// as opaque<V>, so that a reader can skip records it does not understand.
+// Application plaintexts are never recorded, only their sizes.
+enum struct CaptureType : uint8_t
+{
+  handle = 1,
+  unprotect = 2,
+  protect = 3,
+  commit = 4,
+};
+
+struct CaptureHeader
+{
+  static constexpr uint16_t current_version = 1;
+
+  uint16_t version = current_version;
+  bytes state;
+
+  TLS_SERIALIZABLE(version, state)
+};
+
+struct CaptureRecord
+{
+  CaptureType type;
+  uint64_t time_ns = 0;
+  uint64_t duration_ns = 0;
+  uint64_t plaintext_size = 0;
+  bytes message;
+
+  TLS_SERIALIZABLE(type, time_ns, duration_ns, plaintext_size, message)
+};
+
+// Receives a capture as it is made.  Records may arrive from several threads
+// at once, since Session::unprotect() may be called concurrently.
+class CaptureSink
+{
+public:
+  virtual ~CaptureSink() = default;
+  virtual void start(const CaptureHeader& header) = 0;
+  virtual void record(const CaptureRecord& record) = 0;
+};
+
+// Writes a capture to a stream, in the format above
+class CaptureWriter : public CaptureSink
+{
+public:
+  explicit CaptureWriter(std::ostream& out_in);
+
+  void start(const CaptureHeader& header) override;
+  void record(const CaptureRecord& record) override;
+
+private:
+  std::mutex mutex;
+  std::ostream& out;
+
+  void write(const bytes& data);
+};
+
+// Reads a capture written by CaptureWriter
+struct Capture
+{
+  CaptureHeader header;
+  std::vector<CaptureRecord> records;
+
+  static Capture parse(const bytes& data);
+};
+
+// Times one operation for a capture, from construction to record()
+class CaptureTimer
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  CaptureTimer(CaptureSink* sink_in, Clock::time_point epoch_in);
+  void record(CaptureType type,
+              const bytes& message,
+              uint64_t plaintext_size = 0) const;
+
+private:
+  CaptureSink* sink;
+  Clock::time_point epoch;
+  Clock::time_point start;
+};
+
+} // namespace mls
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <mls/common.h>
+#include <mls/session.h>
+#include <mls/state.h>
+
+#include <hpke/hpke.h>
+
+#include <memory>
+
+namespace mls {
+
+// Framing for application payloads too large to carry in one MLS message.
+//
+// The sender and receivers of a transfer export a key and base nonce from the
+// group for that sender and a transfer ID that the application chooses, and
+// that must not be reused within an epoch.  Each chunk is then sealed under
+// the next nonce in sequence, as in an HPKE context: the chunk's sequence
+// number XORed into the base nonce.  A chunk is a flag byte, which marks the
+// last chunk of the transfer, followed by the AEAD ciphertext, with the flag
+// byte as the AAD.  So chunks that are dropped, reordered, replayed or added
+// after the end fail to open, and a transfer cut short is never finished().
+//
+// Only the signature on the message that announces a transfer identifies its
+// sender; the chunks are authenticated only as coming from a group member.
+class ChunkCipher
+{
+public:
+  ChunkCipher(const State& state, LeafIndex sender, const bytes& transfer_id);
+  ChunkCipher(const Session& session,
+              LeafIndex sender,
+              const bytes& transfer_id);
+
+protected:
+  bytes nonce() const;
+  void advance();
+
+  const hpke::AEAD& aead;
+  std::unique_ptr<hpke::AEAD::KeyedContext> ctx;
+  bytes base_nonce;
+  uint64_t seq = 0;
+  bool done = false;
+
+private:
+  ChunkCipher(CipherSuite suite, const bytes& secret);
+};
+
+// Seals the chunks of a transfer from our own leaf
+class ChunkSealer : public ChunkCipher
+{
+public:
+  ChunkSealer(const State& state, const bytes& transfer_id);
+  ChunkSealer(const Session& session, const bytes& transfer_id);
+
+  bytes seal(bytes_view chunk, bool last);
+};
+
+// Opens the chunks of a transfer from the given sender, in order
+class ChunkOpener : public ChunkCipher
+{
+public:
+  using ChunkCipher::ChunkCipher;
+
+  bytes open(bytes_view chunk);
+  bool finished() const { return done; }
+};
+
+} // namespace mls
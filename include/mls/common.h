@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <functional>
 #include <iomanip>
 #include <sstream>
 #include <stdexcept>
@@ -178,6 +179,15 @@ public:
   using parent::parent;
 };
 
+// The keys for a sender were evicted under a KeyRetentionPolicy, and cannot be
+// derived again in this epoch
+class EvictedKeyError : public MissingStateError
+{
+public:
+  using parent = MissingStateError;
+  using parent::parent;
+};
+
 // A slightly more elegant way to silence -Werror=unused-variable
 template<typename T>
 void
@@ -186,6 +196,27 @@ silence_unused(const T& val)
   (void)val;
 }
 
+// An Executor runs a batch of independent tasks, task(0) through
+// task(count - 1), possibly in parallel, and returns once all of them have
+// completed.  If a task throws, the executor should rethrow the exception on
+// the calling thread.  An empty Executor runs the tasks serially.
+using Executor =
+  std::function<void(size_t count, const std::function<void(size_t)>& task)>;
+
+void
+execute(const Executor& executor,
+        size_t count,
+        const std::function<void(size_t)>& task);
+
+// A Scheduler starts a task in the background, e.g., by posting it to a
+// thread pool, and returns without waiting for it to run.  The tasks given to
+// it do not throw, and it may be called from any thread.  An empty Scheduler
+// runs each task on a thread of its own.
+using Scheduler = std::function<void(std::function<void()> task)>;
+
+void
+schedule(const Scheduler& scheduler, std::function<void()> task);
+
 namespace stdx {
 
 // XXX(RLB) This method takes any container in, but always puts the resuls in
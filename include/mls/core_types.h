@@ -43,12 +43,11 @@ struct ExtensionType
   // XXX(RLB) There is no IANA-registered type for this extension yet, so we use
   // a value from the vendor-specific space
   static constexpr Extension::Type sframe_parameters = 0xff02;
+  static constexpr Extension::Type compressed_ratchet_tree = 0xff03;
 };
 
 struct ExtensionList
 {
-  std::vector<Extension> extensions;
-
   // XXX(RLB) It would be good if this maintained extensions in order.  It might
   // be possible to do this automatically by changing the storage to a
   // map<ExtensionType, bytes> and extending the TLS code to marshal that type.
@@ -61,21 +60,58 @@ struct ExtensionList
 
   void add(Extension::Type type, bytes data);
 
+  // The extension of type T, parsed on first use and remembered, or nullptr if
+  // there is none.  Later calls, including on copies of this list, return the
+  // same object without decoding it again.  The pointer is valid until the
+  // list is changed or destroyed.
+  template<typename T>
+  const T* get() const
+  {
+    return static_cast<const T*>(parsed(T::type, &parse_as<T>));
+  }
+
   template<typename T>
   std::optional<T> find() const
   {
-    for (const auto& ext : extensions) {
-      if (ext.type == T::type) {
-        return tls::get<T>(ext.data);
-      }
+    const auto* obj = get<T>();
+    if (obj == nullptr) {
+      return std::nullopt;
     }
 
-    return std::nullopt;
+    return *obj;
   }
 
   bool has(uint16_t type) const;
+  const std::vector<Extension>& extensions() const { return _extensions; }
 
-  TLS_SERIALIZABLE(extensions)
+  // Like TLS_SERIALIZABLE(extensions), except that reading into the list also
+  // drops any values parsed from its old contents
+  static const bool _tls_serializable = true;
+  auto _tls_fields_r()
+  {
+    _parsed.reset();
+    return std::forward_as_tuple(_extensions);
+  }
+  auto _tls_fields_w() const { return std::forward_as_tuple(_extensions); }
+
+private:
+  // The extensions are only changed through add() and decoding, both of which
+  // drop the parsed values, so that get() never returns stale values
+  std::vector<Extension> _extensions;
+
+  // Parsed extensions are kept in a flat map from type to value, which is
+  // shared between copies of the list until one of them changes
+  struct ParsedCache;
+  mutable std::shared_ptr<ParsedCache> _parsed;
+
+  using Parser = std::shared_ptr<const void> (*)(const bytes& data);
+  const void* parsed(Extension::Type type, Parser parse) const;
+
+  template<typename T>
+  static std::shared_ptr<const void> parse_as(const bytes& data)
+  {
+    return std::make_shared<const T>(tls::get<T>(data));
+  }
 };
 
 // enum {
@@ -218,6 +254,11 @@ struct LeafNode
   bool verify(CipherSuite cipher_suite,
               const std::optional<bytes>& group_id) const;
 
+  // The signature check performed by verify(), for use in batch verification
+  SignatureVerification signature_verification(
+    CipherSuite cipher_suite,
+    const std::optional<bytes>& group_id) const;
+
   bool verify_expiry(uint64_t now) const;
   bool verify_extension_support(const ExtensionList& ext_list) const;
 
@@ -302,11 +343,18 @@ struct KeyPackage
              ExtensionList extensions_in,
              const SignaturePrivateKey& sig_priv_in);
 
+  // The reference is computed when the KeyPackage is signed, or from its
+  // encoding when it is decoded, and remembered from then on.  Code that edits
+  // the fields of a KeyPackage must sign() it again.
   KeyPackageRef ref() const;
 
   void sign(const SignaturePrivateKey& sig_priv);
   bool verify() const;
 
+  // The signature checks performed by verify(), for use in batch verification.
+  // This does not check the source of the leaf node.
+  std::vector<SignatureVerification> signature_verifications() const;
+
   TLS_SERIALIZABLE(version,
                    cipher_suite,
                    init_key,
@@ -314,7 +362,11 @@ struct KeyPackage
                    extensions,
                    signature)
 
+  friend tls::istream& operator>>(tls::istream& str, KeyPackage& obj);
+
 private:
+  std::optional<KeyPackageRef> _ref;
+
   bytes to_be_signed() const;
 };
 
@@ -322,6 +374,46 @@ private:
 /// UpdatePath
 ///
 
+// The ciphertexts in an UpdatePathNode, one for each node in the resolution of
+// the copath child.  A receiver only decrypts one ciphertext from the whole
+// UpdatePath, so a decoded list keeps its entries encoded, in a single buffer,
+// and only decodes an entry when it is read.  A list built by a sender holds
+// the ciphertexts themselves, so that they can be filled in concurrently.
+class HPKECiphertextList
+{
+public:
+  HPKECiphertextList() = default;
+  explicit HPKECiphertextList(size_t size);
+  HPKECiphertextList(std::vector<HPKECiphertext> ciphertexts);
+  HPKECiphertextList(std::initializer_list<HPKECiphertext> ciphertexts);
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // Entries are returned by value, since a decoded list has to decode them
+  HPKECiphertext at(size_t i) const;
+  HPKECiphertext operator[](size_t i) const { return at(i); }
+
+  // Replace an entry.  Different entries of a list that was not decoded can be
+  // set from different threads.
+  void set(size_t i, HPKECiphertext ciphertext);
+
+  friend tls::ostream& operator<<(tls::ostream& str,
+                                  const HPKECiphertextList& obj);
+  friend tls::istream& operator>>(tls::istream& str, HPKECiphertextList& obj);
+  friend bool operator==(const HPKECiphertextList& lhs,
+                         const HPKECiphertextList& rhs);
+  friend bool operator!=(const HPKECiphertextList& lhs,
+                         const HPKECiphertextList& rhs);
+
+private:
+  std::vector<HPKECiphertext> _ciphertexts;
+
+  // The body of the encoded vector, and where each entry starts in it
+  bytes _encoded;
+  std::vector<size_t> _offsets;
+};
+
 // struct {
 //     HPKEPublicKey public_key;
 //     HPKECiphertext encrypted_path_secret<V>;
@@ -329,7 +421,7 @@ private:
 struct UpdatePathNode
 {
   HPKEPublicKey public_key;
-  std::vector<HPKECiphertext> encrypted_path_secret;
+  HPKECiphertextList encrypted_path_secret;
 
   TLS_SERIALIZABLE(public_key, encrypted_path_secret)
 };
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace mls {
+
+// A vector whose storage is shared between copies.  Elements are held in
+// fixed-size chunks behind shared pointers, so copying a CowVector copies only
+// the chunk pointers.  Writing to an element through `mut()` first copies the
+// element's chunk if that chunk is shared with another vector.
+//
+// Each element can be a row of `row_width` values of type T, which allows
+// fixed-width records such as digests to be stored without a heap allocation
+// per element.
+template<typename T>
+class CowVector
+{
+public:
+  static constexpr size_t chunk_rows = 64;
+
+  CowVector() = default;
+  explicit CowVector(size_t row_width)
+    : _row_width(row_width)
+  {
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  size_t row_width() const { return _row_width; }
+
+  const T& at(size_t i) const { return *row(i); }
+  T& mut(size_t i) { return *mut_row(i); }
+
+  const T* row(size_t i) const
+  {
+    check(i);
+    return _chunks[i / chunk_rows]->data() + offset(i);
+  }
+
+  T* mut_row(size_t i)
+  {
+    check(i);
+    return unique_chunk(i / chunk_rows).data() + offset(i);
+  }
+
+  void resize(size_t size)
+  {
+    // Reset the rows that fall off the end of the last retained chunk, so that
+    // any rows beyond the end of the vector always have their default value.
+    if (size < _size && size % chunk_rows != 0) {
+      auto& chunk = unique_chunk(size / chunk_rows);
+      auto start = chunk.begin() + static_cast<ptrdiff_t>(offset(size));
+      std::fill(start, chunk.end(), T{});
+    }
+
+    const auto chunk_count = (size + chunk_rows - 1) / chunk_rows;
+    _chunks.resize(chunk_count);
+    for (auto& chunk : _chunks) {
+      if (!chunk) {
+        chunk = std::make_shared<Chunk>(chunk_rows * _row_width);
+      }
+    }
+
+    _size = size;
+  }
+
+  // Make room for `size` elements without reallocating the chunk list.  The
+  // chunks themselves never move, so growing only ever appends chunks.
+  void reserve(size_t size)
+  {
+    _chunks.reserve((size + chunk_rows - 1) / chunk_rows);
+  }
+
+  // Ensure that no chunk is shared with another vector.  After this, distinct
+  // elements can be written concurrently from different threads, since no
+  // write will need to replace a chunk.
+  void detach()
+  {
+    for (size_t i = 0; i < _chunks.size(); i++) {
+      unique_chunk(i);
+    }
+  }
+
+  friend bool operator==(const CowVector& lhs, const CowVector& rhs)
+  {
+    if (lhs._size != rhs._size || lhs._row_width != rhs._row_width) {
+      return false;
+    }
+
+    // Rows beyond the end are kept at their default values, so whole chunks
+    // can be compared
+    for (size_t i = 0; i < lhs._chunks.size(); i++) {
+      const auto& l = lhs._chunks[i];
+      const auto& r = rhs._chunks[i];
+      if (l != r && *l != *r) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  friend bool operator!=(const CowVector& lhs, const CowVector& rhs)
+  {
+    return !(lhs == rhs);
+  }
+
+private:
+  using Chunk = std::vector<T>;
+
+  size_t _row_width = 1;
+  size_t _size = 0;
+  std::vector<std::shared_ptr<Chunk>> _chunks;
+
+  void check(size_t i) const
+  {
+    if (i >= _size) {
+      throw std::out_of_range("CowVector index out of range");
+    }
+  }
+
+  size_t offset(size_t i) const { return (i % chunk_rows) * _row_width; }
+
+  Chunk& unique_chunk(size_t c)
+  {
+    auto& chunk = _chunks[c];
+    if (chunk.use_count() > 1) {
+      chunk = std::make_shared<Chunk>(*chunk);
+    } else {
+      // Synchronize with the release of any other reference to the chunk
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    return *chunk;
+  }
+};
+
+} // namespace mls
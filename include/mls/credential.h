@@ -39,12 +39,20 @@ struct X509Credential
   SignaturePublicKey public_key() const;
   bool valid_for(const SignaturePublicKey& pub) const;
 
-  // TODO(rlb) This should be const or exposed via a method
-  std::vector<CertData> der_chain;
+  // Certificate chains are interned.  Credentials with the same chain, e.g.,
+  // the members of a large group that share a CA, refer to one immutable copy
+  // of it, which is parsed and validated only when it is first seen.
+  const std::vector<CertData>& der_chain() const;
 
 private:
-  SignaturePublicKey _public_key;
-  SignatureScheme _signature_scheme;
+  struct Chain;
+  class ChainTable;
+  std::shared_ptr<const Chain> _chain;
+
+  static std::shared_ptr<const Chain> intern(std::vector<CertData>&& der_chain);
+
+  friend tls::istream& operator>>(tls::istream& str, X509Credential& obj);
+  friend bool operator==(const X509Credential& lhs, const X509Credential& rhs);
 };
 
 tls::ostream&
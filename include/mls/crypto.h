@@ -1,5 +1,6 @@
 #pragma once
 
+#include <hpke/async.h>
 #include <hpke/digest.h>
 #include <hpke/hpke.h>
 #include <hpke/random.h>
@@ -7,6 +8,9 @@
 #include <mls/common.h>
 #include <tls/tls_syntax.h>
 
+#include <atomic>
+#include <cstring>
+#include <memory>
 #include <vector>
 
 namespace mls {
@@ -25,12 +29,22 @@ enum struct SignatureScheme : uint16_t
 SignatureScheme
 tls_signature_scheme(hpke::Signature::ID id);
 
+// An Executor that runs each task of a batch as an OpenSSL ASYNC job, with
+// hpke::AsyncBatch.  With an engine that offloads crypto to an accelerator,
+// the operations of the whole batch, e.g., the signatures on the KeyPackages
+// added by a Commit, are in flight at once, rather than each blocking the
+// thread in turn.
+Executor
+async_crypto_executor();
+
 /// Cipher suites
 
 struct KeyAndNonce
 {
   bytes key;
   bytes nonce;
+
+  TLS_SERIALIZABLE(key, nonce)
 };
 
 // opaque HashReference[16];
@@ -40,6 +54,64 @@ using HashReference = std::array<uint8_t, 16>;
 using KeyPackageRef = HashReference;
 using ProposalRef = HashReference;
 
+// References are hash outputs, so any of their bytes is as good a hash as any
+// other, for use as unordered_map keys
+struct HashReferenceHash
+{
+  size_t operator()(const HashReference& ref) const
+  {
+    auto hash = size_t(0);
+    std::memcpy(&hash, ref.data(), sizeof(hash));
+    return hash;
+  }
+};
+
+// A label for ExpandWithLabel.  The "mls10 " prefix and the length header of
+// the opaque<V> that carries the label in an HKDFLabel are encoded once, when
+// the label is built, so a derivation with a fixed label only has to encode
+// its length and context.
+class KDFLabel
+{
+public:
+  explicit KDFLabel(const std::string& label);
+
+  const bytes& encoded() const { return _encoded; }
+
+private:
+  bytes _encoded;
+};
+
+// The fixed labels used by the key schedule, the secret tree and TreeKEM,
+// built on first use
+struct KDFLabels
+{
+  KDFLabel key{ "key" };
+  KDFLabel nonce{ "nonce" };
+  KDFLabel secret{ "secret" };
+  KDFLabel tree{ "tree" };
+  KDFLabel handshake{ "handshake" };
+  KDFLabel application{ "application" };
+  KDFLabel path{ "path" };
+  KDFLabel node{ "node" };
+  KDFLabel joiner{ "joiner" };
+  KDFLabel epoch{ "epoch" };
+  KDFLabel derived_psk{ "derived psk" };
+  KDFLabel welcome{ "welcome" };
+  KDFLabel exporter{ "exporter" };
+
+  // The secrets derived from each epoch secret
+  KDFLabel sender_data{ "sender data" };
+  KDFLabel encryption{ "encryption" };
+  KDFLabel authentication{ "authentication" };
+  KDFLabel external{ "external" };
+  KDFLabel confirm{ "confirm" };
+  KDFLabel membership{ "membership" };
+  KDFLabel resumption{ "resumption" };
+  KDFLabel init{ "init" };
+
+  static const KDFLabels& get();
+};
+
 struct CipherSuite
 {
   enum struct ID : uint16_t
@@ -59,9 +131,11 @@ struct CipherSuite
   ID cipher_suite() const { return id; }
   SignatureScheme signature_scheme() const;
 
-  size_t secret_size() const { return get().digest.hash_size; }
-  size_t key_size() const { return get().hpke.aead.key_size; }
-  size_t nonce_size() const { return get().hpke.aead.nonce_size; }
+  // The sizes are compile-time constants of each suite, so they are read
+  // without going through the suite's primitives
+  size_t secret_size() const;
+  size_t key_size() const;
+  size_t nonce_size() const;
 
   bytes zero() const { return bytes(secret_size(), 0); }
   const hpke::HPKE& hpke() const { return get().hpke; }
@@ -74,18 +148,56 @@ struct CipherSuite
                           size_t length) const;
   bytes derive_secret(const bytes& secret, const std::string& label) const;
 
+  // As above, with a label that has already been encoded
+  bytes expand_with_label(const bytes& secret,
+                          const KDFLabel& label,
+                          const bytes& context,
+                          size_t length) const;
+  bytes derive_secret(const bytes& secret, const KDFLabel& label) const;
+
+  // Batched forms of the above, which derive several outputs from the same
+  // secret while reusing the KDF's keyed state.  Each label is paired with
+  // the length of its output.
+  using LabelAndLength = std::tuple<std::string, size_t>;
+  std::vector<bytes> expand_with_labels(
+    const bytes& secret,
+    const std::vector<LabelAndLength>& labels,
+    const bytes& context) const;
+  std::vector<bytes> derive_secrets(
+    const bytes& secret,
+    const std::vector<std::string>& labels) const;
+
+  using KDFLabelAndLength = std::tuple<const KDFLabel*, size_t>;
+  std::vector<bytes> expand_with_labels(
+    const bytes& secret,
+    const std::vector<KDFLabelAndLength>& labels,
+    const bytes& context) const;
+
   template<typename T>
   HashReference ref(const T& val) const
+  {
+    return ref_of_encoding<T>(tls::marshal(val));
+  }
+
+  // The reference of a value of type T from its encoding, e.g., as it was
+  // received, which saves marshaling the value again
+  template<typename T>
+  HashReference ref_of_encoding(bytes_view encoded) const
   {
     auto ref = HashReference{};
-    auto marshaled = tls::marshal(val);
-    auto extracted = hpke().kdf.extract({}, marshaled);
+    auto extracted = hpke().kdf.extract({}, encoded);
     auto expanded =
       hpke().kdf.expand(extracted, reference_label<T>(), ref.size());
     std::copy(expanded.begin(), expanded.end(), ref.begin());
     return ref;
   }
 
+  // Call `f` with the CipherSuiteTraits for this suite.  Code that does
+  // several operations with one suite can dispatch on it once here, and then
+  // use the traits' constant sizes and primitives.
+  template<typename F>
+  decltype(auto) visit(F&& f) const;
+
   TLS_SERIALIZABLE(id)
 
 private:
@@ -100,10 +212,156 @@ private:
 
   const Ciphers& get() const;
 
+  template<ID suite_id>
+  static const Ciphers& ciphers();
+
   template<typename T>
   static const bytes& reference_label();
 };
 
+// The algorithms and sizes of each cipher suite, fixed at compile time
+template<hpke::KEM::ID kem_in,
+         hpke::KDF::ID kdf_in,
+         hpke::AEAD::ID aead_in,
+         hpke::Digest::ID digest_in,
+         hpke::Signature::ID sig_in,
+         size_t hash_size_in,
+         size_t key_size_in>
+struct CipherSuiteAlgorithms
+{
+  static constexpr auto kem_id = kem_in;
+  static constexpr auto kdf_id = kdf_in;
+  static constexpr auto aead_id = aead_in;
+  static constexpr auto digest_id = digest_in;
+  static constexpr auto sig_id = sig_in;
+
+  static constexpr size_t hash_size = hash_size_in;
+  static constexpr size_t key_size = key_size_in;
+  static constexpr size_t nonce_size = 12;
+
+  static const hpke::KDF& kdf() { return hpke::KDF::get<kdf_id>(); }
+  static const hpke::AEAD& aead() { return hpke::AEAD::get<aead_id>(); }
+  static const hpke::Digest& digest() { return hpke::Digest::get<digest_id>(); }
+};
+
+template<CipherSuite::ID suite_id>
+struct CipherSuiteTraits;
+
+#define MLS_CIPHER_SUITE_TRAITS(suite, kem, kdf, aead, digest, sig, nh, nk)    \
+  template<>                                                                   \
+  struct CipherSuiteTraits<CipherSuite::ID::suite>                             \
+    : CipherSuiteAlgorithms<hpke::KEM::ID::kem,                                \
+                            hpke::KDF::ID::kdf,                                \
+                            hpke::AEAD::ID::aead,                              \
+                            hpke::Digest::ID::digest,                          \
+                            hpke::Signature::ID::sig,                          \
+                            nh,                                                \
+                            nk>                                                \
+  {                                                                            \
+    static constexpr auto id = CipherSuite::ID::suite;                         \
+  };
+
+MLS_CIPHER_SUITE_TRAITS(X25519_AES128GCM_SHA256_Ed25519,
+                        DHKEM_X25519_SHA256,
+                        HKDF_SHA256,
+                        AES_128_GCM,
+                        SHA256,
+                        Ed25519,
+                        32,
+                        16)
+MLS_CIPHER_SUITE_TRAITS(P256_AES128GCM_SHA256_P256,
+                        DHKEM_P256_SHA256,
+                        HKDF_SHA256,
+                        AES_128_GCM,
+                        SHA256,
+                        P256_SHA256,
+                        32,
+                        16)
+MLS_CIPHER_SUITE_TRAITS(X25519_CHACHA20POLY1305_SHA256_Ed25519,
+                        DHKEM_X25519_SHA256,
+                        HKDF_SHA256,
+                        CHACHA20_POLY1305,
+                        SHA256,
+                        Ed25519,
+                        32,
+                        32)
+MLS_CIPHER_SUITE_TRAITS(X448_AES256GCM_SHA512_Ed448,
+                        DHKEM_X448_SHA512,
+                        HKDF_SHA512,
+                        AES_256_GCM,
+                        SHA512,
+                        Ed448,
+                        64,
+                        32)
+MLS_CIPHER_SUITE_TRAITS(P521_AES256GCM_SHA512_P521,
+                        DHKEM_P521_SHA512,
+                        HKDF_SHA512,
+                        AES_256_GCM,
+                        SHA512,
+                        P521_SHA512,
+                        64,
+                        32)
+MLS_CIPHER_SUITE_TRAITS(X448_CHACHA20POLY1305_SHA512_Ed448,
+                        DHKEM_X448_SHA512,
+                        HKDF_SHA512,
+                        CHACHA20_POLY1305,
+                        SHA512,
+                        Ed448,
+                        64,
+                        32)
+
+#undef MLS_CIPHER_SUITE_TRAITS
+
+template<typename F>
+decltype(auto)
+CipherSuite::visit(F&& f) const
+{
+  switch (id) {
+    case ID::unknown:
+      throw InvalidParameterError("Uninitialized ciphersuite");
+
+    case ID::X25519_AES128GCM_SHA256_Ed25519:
+      return f(CipherSuiteTraits<ID::X25519_AES128GCM_SHA256_Ed25519>{});
+
+    case ID::P256_AES128GCM_SHA256_P256:
+      return f(CipherSuiteTraits<ID::P256_AES128GCM_SHA256_P256>{});
+
+    case ID::X25519_CHACHA20POLY1305_SHA256_Ed25519:
+      return f(
+        CipherSuiteTraits<ID::X25519_CHACHA20POLY1305_SHA256_Ed25519>{});
+
+    case ID::X448_AES256GCM_SHA512_Ed448:
+      return f(CipherSuiteTraits<ID::X448_AES256GCM_SHA512_Ed448>{});
+
+    case ID::P521_AES256GCM_SHA512_P521:
+      return f(CipherSuiteTraits<ID::P521_AES256GCM_SHA512_P521>{});
+
+    case ID::X448_CHACHA20POLY1305_SHA512_Ed448:
+      return f(CipherSuiteTraits<ID::X448_CHACHA20POLY1305_SHA512_Ed448>{});
+
+    default:
+      throw InvalidParameterError("Unsupported ciphersuite");
+  }
+}
+
+inline size_t
+CipherSuite::secret_size() const
+{
+  return visit([](auto traits) { return decltype(traits)::hash_size; });
+}
+
+inline size_t
+CipherSuite::key_size() const
+{
+  return visit([](auto traits) { return decltype(traits)::key_size; });
+}
+
+inline size_t
+CipherSuite::nonce_size() const
+{
+  return visit([](auto traits) { return decltype(traits)::nonce_size; });
+}
+
 extern const std::array<CipherSuite::ID, 6> all_supported_suites;
 
 // Utilities
@@ -118,6 +376,79 @@ struct HPKECiphertext
   TLS_SERIALIZABLE(kem_output, ciphertext)
 };
 
+// A parsed form of a serialized key, materialized on first use and shared
+// between copies of the object that holds it.  The parsed key records the
+// cipher suite and bytes it was parsed from, so that it is parsed again if the
+// serialized key changes.
+template<typename T>
+class ParsedKey
+{
+public:
+  ParsedKey() = default;
+  ParsedKey(ParsedKey&&) noexcept = default;
+  ParsedKey& operator=(ParsedKey&&) noexcept = default;
+  ~ParsedKey() = default;
+
+  ParsedKey(const ParsedKey& other)
+    : _entry(std::atomic_load(&other._entry))
+  {
+  }
+
+  ParsedKey& operator=(const ParsedKey& other)
+  {
+    if (this != &other) {
+      std::atomic_store(&_entry, std::atomic_load(&other._entry));
+    }
+    return *this;
+  }
+
+  template<typename Parse>
+  std::shared_ptr<const T> get(CipherSuite::ID suite,
+                               const bytes& data,
+                               const Parse& parse) const
+  {
+    auto entry = std::atomic_load(&_entry);
+    if (!entry || entry->suite != suite || entry->data != data) {
+      entry = std::make_shared<const Entry>(Entry{ suite, data, parse(data) });
+      std::atomic_store(&_entry, entry);
+    }
+
+    return entry->key;
+  }
+
+  // The key, if it has already been parsed from `data`
+  std::shared_ptr<const T> find(CipherSuite::ID suite, const bytes& data) const
+  {
+    auto entry = std::atomic_load(&_entry);
+    if (!entry || entry->suite != suite || entry->data != data) {
+      return nullptr;
+    }
+
+    return entry->key;
+  }
+
+  void set(CipherSuite::ID suite, const bytes& data, std::unique_ptr<T> key)
+  {
+    auto entry = std::make_shared<const Entry>(
+      Entry{ suite, data, std::shared_ptr<const T>(std::move(key)) });
+    std::atomic_store(&_entry, std::move(entry));
+  }
+
+private:
+  struct Entry
+  {
+    CipherSuite::ID suite;
+    bytes data;
+    std::shared_ptr<const T> key;
+  };
+
+  mutable std::shared_ptr<const Entry> _entry;
+};
+
+// Parsed public keys are kept in a process-wide cache keyed on the cipher
+// suite and the serialized key, since the same public keys are used many times
+// and copied freely.  Private keys instead carry their own ParsedKey, so that
+// the parsed form of a private key lives no longer than the key itself.
 struct HPKEPublicKey
 {
   bytes data;
@@ -127,6 +458,18 @@ struct HPKEPublicKey
                          const bytes& aad,
                          const bytes& pt) const;
 
+  // Encrypt each of `pts` to the matching key in `pubs`.  Where an engine can
+  // take the key exchanges together, the KEM encapsulations are done as one
+  // batch, as in hpke::KEM::encap_batch().  Otherwise each encryption is a
+  // task on the executor.
+  static std::vector<HPKECiphertext> encrypt_batch(
+    CipherSuite suite,
+    const std::vector<const HPKEPublicKey*>& pubs,
+    const bytes& info,
+    const bytes& aad,
+    const std::vector<bytes>& pts,
+    const Executor& executor);
+
   std::tuple<bytes, bytes> do_export(CipherSuite suite,
                                      const bytes& info,
                                      const std::string& label,
@@ -160,7 +503,14 @@ struct HPKEPrivateKey
   TLS_SERIALIZABLE(data, public_key)
 
 private:
-  HPKEPrivateKey(bytes priv_data, bytes pub_data);
+  ParsedKey<hpke::KEM::PrivateKey> parsed;
+
+  HPKEPrivateKey(CipherSuite suite,
+                 bytes priv_data,
+                 bytes pub_data,
+                 std::unique_ptr<hpke::KEM::PrivateKey> priv);
+  std::shared_ptr<const hpke::KEM::PrivateKey> parsed_key(
+    CipherSuite suite) const;
 };
 
 // Signature Keys
@@ -171,6 +521,8 @@ extern const bytes key_package;
 extern const bytes group_info;
 } // namespace sign_label
 
+struct SignatureVerification;
+
 struct SignaturePublicKey
 {
   bytes data;
@@ -180,9 +532,24 @@ struct SignaturePublicKey
               const bytes& message,
               const bytes& signature) const;
 
+  // Verify a batch of signatures, returning true only if all are valid.  The
+  // batch is split into chunks that are verified on the executor.
+  static bool verify_batch(const CipherSuite& suite,
+                           const std::vector<SignatureVerification>& batch,
+                           const Executor& executor);
+
   TLS_SERIALIZABLE(data)
 };
 
+// A signature to be checked as part of a batch
+struct SignatureVerification
+{
+  const SignaturePublicKey& key;
+  const bytes& label;
+  bytes message;
+  const bytes& signature;
+};
+
 struct SignaturePrivateKey
 {
   static SignaturePrivateKey generate(CipherSuite suite);
@@ -199,7 +566,14 @@ struct SignaturePrivateKey
   TLS_SERIALIZABLE(data, public_key)
 
 private:
-  SignaturePrivateKey(bytes priv_data, bytes pub_data);
+  ParsedKey<hpke::Signature::PrivateKey> parsed;
+
+  SignaturePrivateKey(CipherSuite suite,
+                      bytes priv_data,
+                      bytes pub_data,
+                      std::unique_ptr<hpke::Signature::PrivateKey> priv);
+  std::shared_ptr<const hpke::Signature::PrivateKey> parsed_key(
+    const CipherSuite& suite) const;
 };
 
 } // namespace mls
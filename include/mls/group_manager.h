@@ -0,0 +1,97 @@
+#pragma once
+
+#include <mls/common.h>
+#include <mls/session.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+namespace mls {
+
+// Holds the Sessions for many groups, keyed by group ID.
+//
+// Groups are spread across shards by a hash of their group ID.  A shard's lock
+// is only held while a group is looked up, added or removed.  Each group has
+// its own lock, which is held for the duration of an operation on the group,
+// so operations on different groups proceed in parallel, while operations on
+// the same group are serialized.  The exception is unprotect(), which only
+// needs shared access to a group, so messages for one group can be decrypted
+// on several threads at once.
+//
+// Each session keeps only its most recent `retained_epochs` epochs, so that
+// the memory held for an idle group stays bounded.
+class GroupManager
+{
+public:
+  struct Options
+  {
+    size_t shards = 64;
+    size_t retained_epochs = 4;
+  };
+
+  GroupManager();
+  explicit GroupManager(const Options& opts);
+
+  // Begin managing a group.  Throws InvalidParameterError if a group with the
+  // same ID is already managed.
+  void add(const bytes& group_id, Session session);
+
+  // Stop managing a group, returning false if it was not managed.  Operations
+  // already under way on the group are allowed to finish.
+  bool remove(const bytes& group_id);
+
+  bool contains(const bytes& group_id) const;
+  size_t size() const;
+
+  // The memory held for all managed groups, or for one of them.  Like
+  // unprotect(), these only need shared access to each group.
+  GroupMemoryUsage memory_usage() const;
+  GroupMemoryUsage memory_usage(const bytes& group_id) const;
+
+  // Operations on a managed group.  These throw InvalidParameterError if the
+  // group is not managed.
+  bool handle(const bytes& group_id, const bytes& handshake_data);
+  bytes protect(const bytes& group_id, const bytes& plaintext);
+  bytes unprotect(const bytes& group_id, const bytes& ciphertext);
+
+  // A view of a managed group's current epoch.  Only the shard's lock is taken,
+  // so readers are not held up by an operation under way on the group, nor do
+  // they hold it up.
+  std::shared_ptr<const EpochSnapshot> snapshot(const bytes& group_id) const;
+
+  // Run `f` with exclusive access to a group's Session
+  template<typename F>
+  auto with_session(const bytes& group_id, F&& f)
+  {
+    auto group = find(group_id);
+    const auto lock = std::lock_guard(group->mutex);
+    return f(group->session);
+  }
+
+private:
+  struct Group
+  {
+    std::shared_mutex mutex;
+    Session session;
+
+    explicit Group(Session session_in);
+  };
+
+  struct Shard
+  {
+    mutable std::shared_mutex mutex;
+    std::map<bytes, std::shared_ptr<Group>> groups;
+  };
+
+  std::vector<Shard> shards;
+  size_t retained_epochs;
+
+  Shard& shard_for(const bytes& group_id);
+  const Shard& shard_for(const bytes& group_id) const;
+  std::shared_ptr<Group> find(const bytes& group_id) const;
+};
+
+} // namespace mls
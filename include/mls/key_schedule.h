@@ -1,6 +1,9 @@
 #pragma once
 
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <mls/common.h>
 #include <mls/crypto.h>
 #include <mls/messages.h>
@@ -8,13 +11,26 @@
 
 namespace mls {
 
+// Limits on the generations a HashRatchet will serve.  A requested generation
+// may be at most `max_forward_distance` ahead of the next unused generation,
+// and keys are retained for at most the last `max_cached_keys` generations.
+// Ratchets used to serve any generation; see README.md for how to raise the
+// limits where that is still needed.
+struct HashRatchetLimits
+{
+  uint32_t max_forward_distance = 1024;
+  uint32_t max_cached_keys = 128;
+
+  TLS_SERIALIZABLE(max_forward_distance, max_cached_keys)
+};
+
 struct HashRatchet
 {
   CipherSuite suite;
   NodeIndex node;
   bytes next_secret;
   uint32_t next_generation;
-  std::map<uint32_t, KeyAndNonce> cache;
+  HashRatchetLimits limits;
 
   size_t key_size;
   size_t nonce_size;
@@ -28,10 +44,48 @@ struct HashRatchet
   HashRatchet& operator=(HashRatchet&& other) = default;
 
   HashRatchet(CipherSuite suite_in, NodeIndex node_in, bytes base_secret_in);
+  HashRatchet(CipherSuite suite_in,
+              NodeIndex node_in,
+              bytes base_secret_in,
+              const HashRatchetLimits& limits_in);
 
   std::tuple<uint32_t, KeyAndNonce> next();
   KeyAndNonce get(uint32_t generation);
   void erase(uint32_t generation);
+
+  // Derive the keys for the next `count` generations ahead of time, up to the
+  // forward distance limit, so that next() and get() can hand them out without
+  // deriving anything.  Keys derived ahead are not serialized; a deserialized
+  // ratchet derives them again as needed.
+  void warm(uint32_t count);
+
+  // The number of keys currently retained, and derived ahead
+  size_t cached_keys() const;
+  size_t derived_ahead() const { return ahead.size(); }
+
+  friend tls::ostream& operator<<(tls::ostream& str, const HashRatchet& obj);
+  friend tls::istream& operator>>(tls::istream& str, HashRatchet& obj);
+
+private:
+  // Keys for the generations just before `next_generation`, in a ring buffer
+  // that grows up to `limits.max_cached_keys` entries.  The oldest entry is at
+  // `cache_head` once the buffer is full.  Erased entries are left empty.
+  std::vector<std::optional<KeyAndNonce>> cache;
+  size_t cache_head = 0;
+
+  std::optional<KeyAndNonce>* cache_slot(uint32_t generation);
+  void cache_push(const KeyAndNonce& keys);
+
+  // Keys for generations `next_generation` onward, each with the secret for
+  // the generation after it
+  struct Derived
+  {
+    KeyAndNonce keys;
+    bytes next_secret;
+  };
+  std::deque<Derived> ahead;
+
+  Derived derive(const bytes& secret, uint32_t generation) const;
 };
 
 struct SecretTree
@@ -43,6 +97,17 @@ struct SecretTree
 
   bytes get(LeafIndex sender);
 
+  // Whether the secret for a sender in the group can still be derived, i.e.,
+  // whether it has not been handed out by get()
+  bool has_leaf_secret(LeafIndex sender) const;
+
+  // The number of leaves, and of node secrets currently held
+  LeafCount size() const { return group_size; }
+  size_t node_count() const { return secrets.size(); }
+
+  friend tls::ostream& operator<<(tls::ostream& str, const SecretTree& obj);
+  friend tls::istream& operator>>(tls::istream& str, SecretTree& obj);
+
 private:
   CipherSuite suite;
   LeafCount group_size;
@@ -51,11 +116,42 @@ private:
   size_t secret_size;
 };
 
+// Limits on the ratchets a GroupKeySource keeps for the senders in an epoch.
+// The ratchets for a sender are evicted once they have been idle for longer
+// than `max_idle_seconds`, or when they are the least recently used and more
+// than `max_senders` senders have ratchets.  A value of zero disables the
+// corresponding limit.
+//
+// The secret tree does not retain the secrets it has handed out, so an evicted
+// sender's ratchets cannot be re-derived.  Any later message from that sender
+// in the same epoch fails to decrypt with an EvictedKeyError, and erasing a
+// key of that sender does nothing.  The member's own ratchets, which it
+// needs to send, are never evicted (see GroupKeySource::set_own_index()).
+//
+// The clock is read when a sender's ratchets are created, and then once every
+// `clock_period` uses, so the idle time of a sender is measured to within the
+// time those uses take.
+//
+// The `ratchet_limits` apply to each ratchet created after the policy is set.
+struct KeyRetentionPolicy
+{
+  size_t max_senders = 0;
+  uint64_t max_idle_seconds = 0;
+  HashRatchetLimits ratchet_limits = {};
+
+  static constexpr uint64_t clock_period = 64;
+};
+
 using ReuseGuard = std::array<uint8_t, 4>;
 
+// A GroupKeySource may be used from several threads at once.  The secret tree
+// and the table of senders are guarded by one lock, which is held only to find
+// or create a sender's ratchets.  Each sender's ratchets have a lock of their
+// own, so messages from different senders are handled in parallel.  Copying or
+// deserializing into a key source must not overlap with other uses of it.
 struct GroupKeySource
 {
-  enum struct RatchetType
+  enum struct RatchetType : uint8_t
   {
     handshake,
     application,
@@ -74,15 +170,180 @@ struct GroupKeySource
                   ReuseGuard reuse_guard);
   void erase(ContentType type, LeafIndex sender, uint32_t generation);
 
+  // Evict ratchets according to the retention policy.  Eviction also happens
+  // automatically when a policy is set, when a sender's ratchets are created,
+  // and every `clock_period` uses of the key source.
+  void set_retention_policy(const KeyRetentionPolicy& policy);
+  const KeyRetentionPolicy& retention_policy() const;
+  void evict(uint64_t now);
+
+  // The sender whose ratchets are exempt from eviction, and do not count
+  // towards `max_senders`.  A member sets this to its own index, since it
+  // cannot send once its own ratchets are gone.
+  void set_own_index(LeafIndex index);
+
+  // Derive the ratchets for each of `senders`, and the keys for the first
+  // `generations` application messages from each, so that the first messages
+  // of the epoch do not wait for them.  The senders are handled in parallel on
+  // `executor`.  Warming a sender counts as using it under the retention
+  // policy.
+  void warm(const std::vector<LeafIndex>& senders,
+            uint32_t generations,
+            const Executor& executor);
+
+  // The key material currently held, for monitoring memory use
+  struct MemoryUsage
+  {
+    size_t secret_tree_nodes = 0;
+    size_t senders = 0;
+    size_t cached_keys = 0;
+    size_t derived_keys = 0;
+    size_t max_sender_keys = 0;
+    size_t secret_bytes = 0;
+  };
+
+  MemoryUsage memory_usage() const;
+
+  // Encrypt or decrypt with the given keys.  A single cipher context is kept
+  // for the life of the key source, so each message only has to re-key it.
+  // The key is wiped from the context once the message is done.
+  bytes seal(const KeyAndNonce& keys, bytes_view aad, bytes_view pt);
+  std::optional<bytes> open(const KeyAndNonce& keys,
+                            bytes_view aad,
+                            bytes_view ct);
+
+  // As seal(), but with the plaintext given in pieces, and the ciphertext
+  // appended to `out`
+  void seal_into(const KeyAndNonce& keys,
+                 bytes_view aad,
+                 const std::vector<bytes_view>& pt,
+                 bytes& out);
+
+  // As seal() and open(), but writing to memory provided by the caller, as
+  // with AEAD::KeyedContext::seal_to() and open_to()
+  void seal_to(const KeyAndNonce& keys,
+               bytes_view aad,
+               bytes_view pt,
+               uint8_t* ct_out);
+  bool open_to(const KeyAndNonce& keys,
+               bytes_view aad,
+               bytes_view ct,
+               uint8_t* pt_out);
+
+  // The serialized form covers the secret tree, the ratchets and their
+  // positions, and the retention policy and state
+  friend tls::ostream& operator<<(tls::ostream& str,
+                                  const GroupKeySource& obj);
+  friend tls::istream& operator>>(tls::istream& str, GroupKeySource& obj);
+
 private:
   CipherSuite suite;
   SecretTree secret_tree;
 
-  using Key = std::tuple<RatchetType, LeafIndex>;
-  std::map<Key, HashRatchet> chains;
+  // The ratchets for one sender, with the lock that guards them
+  struct SenderChains
+  {
+    std::mutex mutex;
+    HashRatchet handshake;
+    HashRatchet application;
+
+    SenderChains(HashRatchet handshake_in, HashRatchet application_in);
+    HashRatchet& chain(RatchetType type);
+  };
+
+  // A thread keeps its own reference to a sender's ratchets while it uses
+  // them, so that they can be evicted concurrently.  Copies of a key source get
+  // their own copies of the ratchets.
+  struct SharedChains
+  {
+    explicit SharedChains(std::shared_ptr<SenderChains> ptr_in);
+    SharedChains(const SharedChains& other);
+    SharedChains(SharedChains&& other) = default;
+    SharedChains& operator=(const SharedChains& other);
+    SharedChains& operator=(SharedChains&& other) = default;
+    ~SharedChains() = default;
+
+    std::shared_ptr<SenderChains> ptr;
+  };
+
+  std::map<LeafIndex, SharedChains> chains;
+
+  // Guards the secret tree, the table of senders and the retention state.
+  // Copies of a key source get a lock of their own.
+  struct Mutex
+  {
+    Mutex() = default;
+    Mutex(const Mutex& /* other */) {}
+    Mutex& operator=(const Mutex& /* other */) { return *this; }
+    ~Mutex() = default;
+
+    std::mutex mutex;
+  };
+
+  mutable Mutex senders_mutex;
+
+  // Each sender with ratchets has a last-use sequence number and time.  The
+  // `lru` map orders senders from least to most recently used.
+  struct SenderUse
+  {
+    uint64_t seq = 0;
+    uint64_t time = 0;
+
+    TLS_SERIALIZABLE(seq, time)
+  };
+
+  KeyRetentionPolicy retention;
+  std::optional<LeafIndex> own_index;
+  uint64_t use_seq = 0;
+  uint64_t last_clock = 0;
+  std::map<LeafIndex, SenderUse> sender_use;
+  std::map<uint64_t, LeafIndex> lru;
+
+  void touch(LeafIndex sender, bool created);
+  void evict_sender(LeafIndex sender);
+  void evict_locked(uint64_t now);
 
-  HashRatchet& chain(RatchetType type, LeafIndex sender);
-  HashRatchet& chain(ContentType type, LeafIndex sender);
+  // Copies of a key source get their own cipher context, so that they never
+  // share mutable cipher state
+  struct AEADContext
+  {
+    AEADContext() = default;
+    AEADContext(const AEADContext& /* other */) {}
+    AEADContext(AEADContext&& other) = default;
+    AEADContext& operator=(const AEADContext& other);
+    AEADContext& operator=(AEADContext&& other) = default;
+    ~AEADContext() = default;
+
+    std::unique_ptr<hpke::AEAD::KeyedContext> ctx;
+  };
+
+  // The shared cipher context is used by one thread at a time.  Other threads
+  // encrypt or decrypt without it in the meantime.  It holds a message key
+  // only while a KeyedUse of it is alive, so that no expanded key outlives the
+  // ratchet's erase() of the key.
+  class KeyedUse
+  {
+  public:
+    explicit KeyedUse(hpke::AEAD::KeyedContext& ctx_in);
+    KeyedUse(const KeyedUse&) = delete;
+    KeyedUse(KeyedUse&&) = delete;
+    KeyedUse& operator=(const KeyedUse&) = delete;
+    KeyedUse& operator=(KeyedUse&&) = delete;
+    ~KeyedUse();
+
+    hpke::AEAD::KeyedContext* operator->() { return &ctx; }
+
+  private:
+    hpke::AEAD::KeyedContext& ctx;
+  };
+
+  AEADContext aead_ctx;
+  Mutex aead_mutex;
+  KeyedUse aead(const bytes& key);
+
+  std::shared_ptr<SenderChains> sender_chains(LeafIndex sender);
+  std::shared_ptr<SenderChains> existing_chains(LeafIndex sender);
+  static RatchetType ratchet_type(ContentType type);
 
   static const std::array<RatchetType, 2> all_ratchet_types;
 };
@@ -107,7 +368,11 @@ public:
   bytes resumption_secret;
   bytes init_secret;
 
-  HPKEPrivateKey external_priv;
+  // The key pair for external joins is derived from external_secret the first
+  // time it is needed, since deriving a KEM key pair costs far more than the
+  // other secrets and many groups never accept external joins.  An encoded
+  // epoch carries the key pair only once it has been derived.
+  HPKEPrivateKey external_priv() const;
 
   KeyScheduleEpoch() = default;
 
@@ -147,6 +412,11 @@ public:
   bytes do_export(const std::string& label,
                   const bytes& context,
                   size_t size) const;
+  static bytes do_export(CipherSuite suite,
+                         const bytes& exporter_secret,
+                         const std::string& label,
+                         const bytes& context,
+                         size_t size);
   PSKWithSecret resumption_psk(ResumptionPSKUsage usage,
                                const bytes& group_id,
                                epoch_t epoch);
@@ -156,9 +426,23 @@ public:
                               const std::vector<PSKWithSecret>& psks);
   static KeyAndNonce sender_data_keys(CipherSuite suite,
                                       const bytes& sender_data_secret,
-                                      const bytes& ciphertext);
+                                      bytes_view ciphertext);
+
+  friend tls::ostream& operator<<(tls::ostream& str,
+                                  const KeyScheduleEpoch& obj);
+  friend tls::istream& operator>>(tls::istream& str, KeyScheduleEpoch& obj);
+
+private:
+  ParsedKey<HPKEPrivateKey> _external_priv;
 };
 
+// The derived external key pair is encoded after the secrets, as it was when
+// it was derived eagerly
+tls::ostream&
+operator<<(tls::ostream& str, const KeyScheduleEpoch& obj);
+tls::istream&
+operator>>(tls::istream& str, KeyScheduleEpoch& obj);
+
 bool
 operator==(const KeyScheduleEpoch& lhs, const KeyScheduleEpoch& rhs);
 
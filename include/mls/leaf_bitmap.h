@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mls {
+
+// Records which of a range of positions are occupied, and finds the lowest
+// unoccupied one.  Positions are packed into 64-bit words, and a summary
+// bitmap marks the words that are full, so a search reads one summary word per
+// 4096 positions and then a single word of positions.
+class LeafBitmap
+{
+public:
+  size_t size() const { return _size; }
+
+  // Positions added by growing are unoccupied
+  void resize(size_t size);
+  void reserve(size_t size);
+
+  bool occupied(size_t i) const;
+  void set(size_t i, bool occupied);
+
+  // The lowest unoccupied position, or size() if every position is occupied
+  size_t first_free() const;
+
+private:
+  static constexpr size_t word_bits = 64;
+
+  size_t _size = 0;
+  std::vector<uint64_t> _words;
+  std::vector<uint64_t> _full;
+
+  void update_summary(size_t word);
+};
+
+} // namespace mls
@@ -1,13 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
 
 namespace mls {
 namespace log {
 
+enum struct Level
+{
+  fatal,
+  error,
+  info,
+  warn,
+  debug,
+  crypto,
+};
+
 struct Sink
 {
   virtual ~Sink() = default;
+
+  // Messages at a disabled level are not formatted or delivered
+  virtual bool enabled(Level /*level*/) const { return true; }
+
   virtual void fatal(const std::string& /*mod*/, const std::string& /*msg*/) {}
   virtual void error(const std::string& /*mod*/, const std::string& /*msg*/) {}
   virtual void info(const std::string& /*mod*/, const std::string& /*msg*/) {}
@@ -16,6 +36,12 @@ struct Sink
   virtual void crypto(const std::string& /*mod*/, const std::string& /*msg*/) {}
 };
 
+// Tracing at the crypto level is compiled in unless MLS_NO_LOG_CRYPTO is
+// defined, which the LOG_CRYPTO=OFF CMake option does
+#ifndef MLS_NO_LOG_CRYPTO
+#define ENABLE_LOG_CRYPTO
+#endif
+
 struct Log
 {
 private:
@@ -33,10 +59,22 @@ public:
   static void set_sink(std::shared_ptr<Sink> sink_in);
   static void remove_sink();
 
+  // Callers whose log arguments are expensive to compute, such as hex
+  // encodings of secrets, should check this first
+  static bool enabled(Level level)
+  {
+#ifndef ENABLE_LOG_CRYPTO
+    if (level == Level::crypto) {
+      return false;
+    }
+#endif
+    return sink && sink->enabled(level);
+  }
+
   template<typename... Ts>
   static void fatal(const std::string& mod, const Ts&... vals)
   {
-    if (sink) {
+    if (enabled(Level::fatal)) {
       sink->fatal(mod, print(vals...));
     }
   }
@@ -44,7 +82,7 @@ public:
   template<typename... Ts>
   static void error(const std::string& mod, const Ts&... vals)
   {
-    if (sink) {
+    if (enabled(Level::error)) {
       sink->error(mod, print(vals...));
     }
   }
@@ -52,7 +90,7 @@ public:
   template<typename... Ts>
   static void info(const std::string& mod, const Ts&... vals)
   {
-    if (sink) {
+    if (enabled(Level::info)) {
       sink->info(mod, print(vals...));
     }
   }
@@ -60,7 +98,7 @@ public:
   template<typename... Ts>
   static void warn(const std::string& mod, const Ts&... vals)
   {
-    if (sink) {
+    if (enabled(Level::warn)) {
       sink->warn(mod, print(vals...));
     }
   }
@@ -68,18 +106,16 @@ public:
   template<typename... Ts>
   static void debug(const std::string& mod, const Ts&... vals)
   {
-    if (sink) {
+    if (enabled(Level::debug)) {
       sink->debug(mod, print(vals...));
     }
   }
 
-// TODO(rlb) Enable this value to be configured
-#define ENABLE_LOG_CRYPTO
 #ifdef ENABLE_LOG_CRYPTO
   template<typename... Ts>
   static void crypto(const std::string& mod, const Ts&... vals)
   {
-    if (sink) {
+    if (enabled(Level::crypto)) {
       sink->crypto(mod, print(vals...));
     }
   }
@@ -91,5 +127,131 @@ public:
 #endif
 };
 
+// Trace at the crypto level.  Unlike a call to Log::crypto(), the arguments
+// (e.g., hex encodings of secrets) are only evaluated if a sink has the crypto
+// level enabled, and with crypto tracing compiled out they are not evaluated
+// at all.
+#ifdef ENABLE_LOG_CRYPTO
+// NOLINTNEXTLINE(cppcoreguidelines-macro-usage)
+#define MLS_LOG_CRYPTO(mod, ...)                                               \
+  do {                                                                         \
+    if (::mls::log::Log::enabled(::mls::log::Level::crypto)) {                 \
+      ::mls::log::Log::crypto(mod, __VA_ARGS__);                               \
+    }                                                                          \
+  } while (false)
+#else
+// NOLINTNEXTLINE(cppcoreguidelines-macro-usage)
+#define MLS_LOG_CRYPTO(mod, ...)                                               \
+  do {                                                                         \
+  } while (false)
+#endif
+
+///
+/// Metrics
+///
+
+// Counters accumulate over the life of the process
+enum struct Counter
+{
+  ratchet_advances,  // Hash ratchet steps taken by GroupKeySource
+  bytes_serialized,  // Bytes of messages serialized by Session
+  signatures_cached, // Signature verifications answered from the cache
+};
+
+// Histograms receive one sample per operation.  Times are in nanoseconds.
+enum struct Histogram
+{
+  commit_time,         // State::commit
+  handle_time,         // State::handle
+  encap_time,          // TreeKEMPublicKey::encap
+  decap_time,          // TreeKEMPrivateKey::decap
+  tree_hash_time,      // TreeKEMPublicKey::set_hash_all
+  commit_hpke_ops,     // HPKE encryptions to the tree and joiners per Commit
+  ratchet_cached_keys, // Keys held by a hash ratchet after each use
+};
+
+struct MetricsSink
+{
+  virtual ~MetricsSink() = default;
+  virtual void count(Counter /*counter*/, uint64_t /*value*/) {}
+  virtual void record(Histogram /*histogram*/, uint64_t /*value*/) {}
+};
+
+// Like Log, Metrics dispatches to a single process-wide sink.  Metric points
+// are recorded from executor threads, so the sink may be swapped while they
+// run; it is only read with atomic loads.  With no sink installed, each metric
+// point costs only a check of an atomic flag.
+struct Metrics
+{
+private:
+  static std::atomic<bool> active;
+  static std::shared_ptr<MetricsSink> sink;
+
+public:
+  static void set_sink(std::shared_ptr<MetricsSink> sink_in);
+  static void remove_sink();
+
+  static bool enabled() { return active.load(std::memory_order_acquire); }
+
+  static void count(Counter counter, uint64_t value)
+  {
+    if (!enabled()) {
+      return;
+    }
+
+    if (const auto current = std::atomic_load(&sink)) {
+      current->count(counter, value);
+    }
+  }
+
+  static void record(Histogram histogram, uint64_t value)
+  {
+    if (!enabled()) {
+      return;
+    }
+
+    if (const auto current = std::atomic_load(&sink)) {
+      current->record(histogram, value);
+    }
+  }
+};
+
+// Records the time from construction to destruction in a histogram.  The
+// clock is only read if a metrics sink is installed at construction.
+class ScopedTimer
+{
+public:
+  explicit ScopedTimer(Histogram histogram_in)
+    : histogram(histogram_in)
+  {
+    if (Metrics::enabled()) {
+      start = Clock::now();
+    }
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer(ScopedTimer&&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(ScopedTimer&&) = delete;
+
+  ~ScopedTimer()
+  {
+    if (!start) {
+      return;
+    }
+
+    const auto elapsed = Clock::now() - *start;
+    const auto nanos =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    Metrics::record(histogram, static_cast<uint64_t>(nanos));
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  Histogram histogram;
+  std::optional<Clock::time_point> start;
+};
+
 } // namespace log
 } // namespace mls
@@ -5,6 +5,7 @@
 #include "mls/credential.h"
 #include "mls/crypto.h"
 #include "mls/treekem.h"
+#include <functional>
 #include <optional>
 #include <tls/tls_syntax.h>
 
@@ -26,6 +27,21 @@ struct RatchetTreeExtension
   TLS_SERIALIZABLE(tree)
 };
 
+// The ratchet tree in the compact encoding of
+// TreeKEMPublicKey::write_compressed().  A group carries its tree in this form
+// instead of a RatchetTreeExtension when its required capabilities include
+// this extension, so that every member and joiner can read it.
+struct CompressedRatchetTreeExtension
+{
+  TreeKEMPublicKey tree;
+
+  static const uint16_t type;
+  friend tls::ostream& operator<<(tls::ostream& str,
+                                  const CompressedRatchetTreeExtension& obj);
+  friend tls::istream& operator>>(tls::istream& str,
+                                  CompressedRatchetTreeExtension& obj);
+};
+
 struct ExternalSender
 {
   SignaturePublicKey signature_key;
@@ -175,6 +191,7 @@ struct GroupInfo
             LeafIndex signer_index,
             const SignaturePrivateKey& priv);
   bool verify(const TreeKEMPublicKey& tree) const;
+  bool verify(CipherSuite suite, const LeafNode& signer_leaf) const;
 
   TLS_SERIALIZABLE(group_context,
                    extensions,
@@ -236,14 +253,35 @@ struct Welcome
           const GroupInfo& group_info);
 
   void encrypt(const KeyPackage& kp, const std::optional<bytes>& path_secret);
+
+  // Encrypt the group secrets to several joiners, with the HPKE operations
+  // run on the executor.  The new entries are appended in order.
+  void encrypt(const std::vector<KeyPackage>& kps,
+               const std::vector<std::optional<bytes>>& path_secrets,
+               const Executor& executor);
+
+  // Look up the entry for a joiner.  Lookups use an index over the entries'
+  // KeyPackageRefs, which is built when the Welcome is decoded or encrypted.
   std::optional<int> find(const KeyPackage& kp) const;
+  std::optional<int> find(const KeyPackageRef& ref) const;
   GroupInfo decrypt(const bytes& joiner_secret,
                     const std::vector<PSKWithSecret>& psks) const;
 
-  TLS_SERIALIZABLE(version, cipher_suite, secrets, encrypted_group_info)
+  friend tls::ostream& operator<<(tls::ostream& str, const Welcome& obj);
+  friend tls::istream& operator>>(tls::istream& str, Welcome& obj);
+  friend bool operator==(const Welcome& lhs, const Welcome& rhs);
+  friend bool operator!=(const Welcome& lhs, const Welcome& rhs);
 
 private:
   bytes _joiner_secret;
+
+  // (new_member, position in secrets), sorted by new_member
+  std::vector<std::tuple<KeyPackageRef, size_t>> _secrets_index;
+  void index_secrets();
+  GroupSecrets group_secrets(const std::optional<bytes>& path_secret) const;
+  EncryptedGroupSecrets group_secrets_for(
+    const KeyPackage& kp,
+    const std::optional<bytes>& path_secret) const;
   static KeyAndNonce group_info_key_nonce(
     CipherSuite suite,
     const bytes& joiner_secret,
@@ -541,6 +579,7 @@ struct MLSAuthenticatedContent
               const std::optional<GroupContext>& context) const;
 
   bytes confirmed_transcript_hash_input() const;
+  void write_confirmed_transcript_hash_input(tls::ostream& str) const;
   bytes interim_transcript_hash_input() const;
 
   void set_confirmation_tag(const bytes& confirmation_tag);
@@ -559,7 +598,17 @@ private:
                           MLSContent content_in,
                           MLSContentAuthData auth_in);
 
-  bytes to_be_signed(const std::optional<GroupContext>& context) const;
+  // The encoding of the version, wire format and content, which begins the
+  // to-be-signed value, the to-be-MACed value and the confirmed transcript
+  // hash input.  It is kept from signing a message to protecting it, and from
+  // checking a membership tag to verifying the signature, so that the content
+  // is encoded once for all of them.  Code that edits the content of a signed
+  // MLSAuthenticatedContent must sign it again.
+  std::shared_ptr<const bytes> _tbs_prefix;
+  std::shared_ptr<const bytes> tbs_prefix() const;
+
+  bytes to_be_signed(const bytes& prefix,
+                     const std::optional<GroupContext>& context) const;
 
   friend struct MLSPlaintext;
   friend struct MLSCiphertext;
@@ -580,6 +629,11 @@ struct MLSPlaintext
     const std::optional<bytes>& membership_key,
     const std::optional<GroupContext>& context) const;
 
+  // The signed content, without checking the membership tag.  This is for
+  // parties outside the group, which do not have the membership key and can
+  // only verify the signature.
+  MLSAuthenticatedContent authenticated_content() const;
+
   friend tls::ostream& operator<<(tls::ostream& str, const MLSPlaintext& obj);
   friend tls::istream& operator>>(tls::istream& str, MLSPlaintext& obj);
 
@@ -592,6 +646,7 @@ private:
 
   bytes membership_mac(CipherSuite suite,
                        const bytes& membership_key,
+                       const bytes& tbs_prefix,
                        const std::optional<GroupContext>& context) const;
 };
 
@@ -607,12 +662,32 @@ struct MLSCiphertext
                                GroupKeySource& keys,
                                const bytes& sender_data_secret,
                                size_t padding_size);
+
+  // As protect(), but appending the encoded MLSCiphertext to `out`.  The
+  // content is encrypted directly into `out`, without first being marshaled
+  // or copied into a separate ciphertext.
+  static void protect_into(MLSAuthenticatedContent content_auth,
+                           CipherSuite suite,
+                           const LeafIndex& index,
+                           GroupKeySource& keys,
+                           const bytes& sender_data_secret,
+                           size_t padding_size,
+                           bytes& out);
+
   std::optional<MLSAuthenticatedContent> unprotect(
     CipherSuite suite,
     const TreeKEMPublicKey& tree,
     GroupKeySource& keys,
     const bytes& sender_data_secret) const;
 
+  // As above, with the leaves that can send given by a predicate instead of a
+  // tree, for callers that no longer hold the epoch's tree
+  std::optional<MLSAuthenticatedContent> unprotect(
+    CipherSuite suite,
+    const std::function<bool(LeafIndex)>& has_leaf,
+    GroupKeySource& keys,
+    const bytes& sender_data_secret) const;
+
   TLS_SERIALIZABLE(group_id,
                    epoch,
                    content_type,
@@ -633,6 +708,18 @@ private:
                 bytes ciphertext_in);
 };
 
+// The fields that identify where an MLSMessage belongs, which can be read from
+// the start of its encoding without decoding the rest.  Only MLSPlaintext and
+// MLSCiphertext messages carry a group_id, epoch and content_type; for other
+// wire formats, these are left empty, zero and invalid.
+struct MLSMessageHeader
+{
+  WireFormat wire_format = WireFormat::reserved;
+  bytes group_id;
+  epoch_t epoch = 0;
+  ContentType content_type = ContentType::invalid;
+};
+
 struct MLSMessage
 {
   ProtocolVersion version = ProtocolVersion::mls10;
@@ -642,6 +729,10 @@ struct MLSMessage
   epoch_t epoch() const;
   WireFormat wire_format() const;
 
+  // Reads the header of an encoded MLSMessage, e.g., to route it or to drop
+  // it for a stale epoch before paying for a full decode
+  static MLSMessageHeader peek_header(bytes_view data);
+
   MLSMessage() = default;
   MLSMessage(MLSPlaintext mls_plaintext);
   MLSMessage(MLSCiphertext mls_ciphertext);
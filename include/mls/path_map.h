@@ -0,0 +1,251 @@
+#pragma once
+
+#include "mls/common.h"
+#include "mls/tree_math.h"
+#include <tls/tls_syntax.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace mls {
+
+// A map from the nodes on one leaf's direct path to values of type T.  A direct
+// path holds at most one node per level, so each entry is stored in a fixed
+// slot for its node's level, and the map never allocates.  The interface
+// follows std::map, except that iteration runs from the lowest level up rather
+// than in NodeIndex order.  Inserting a node that shares a level with a
+// different node already in the map throws InvalidParameterError, since the two
+// cannot be on the same direct path.
+//
+// On the wire, a PathMap is encoded like the std::map it replaces, with its
+// entries in NodeIndex order.
+template<typename T>
+class PathMap
+{
+public:
+  static constexpr size_t max_levels = 32;
+
+  using key_type = NodeIndex;
+  using mapped_type = T;
+  using value_type = std::pair<NodeIndex, T>;
+
+private:
+  using SlotArray = std::array<std::optional<value_type>, max_levels>;
+
+public:
+
+  template<bool Const>
+  class basic_iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = PathMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference =
+      std::conditional_t<Const, const value_type&, value_type&>;
+    using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+
+    using Slots = std::conditional_t<Const, const SlotArray, SlotArray>;
+
+    basic_iterator(Slots* slots, size_t level)
+      : _slots(slots)
+      , _level(level)
+    {
+      skip_empty();
+    }
+
+    // A mutable iterator converts to a const one
+    operator basic_iterator<true>() const // NOLINT(google-explicit-constructor)
+    {
+      return { _slots, _level };
+    }
+
+    reference operator*() const { return *(*_slots)[_level]; }
+    pointer operator->() const { return &**this; }
+
+    basic_iterator& operator++()
+    {
+      _level += 1;
+      skip_empty();
+      return *this;
+    }
+
+    basic_iterator operator++(int)
+    {
+      auto prev = *this;
+      ++*this;
+      return prev;
+    }
+
+    bool operator==(const basic_iterator& other) const
+    {
+      return _slots == other._slots && _level == other._level;
+    }
+
+    bool operator!=(const basic_iterator& other) const
+    {
+      return !(*this == other);
+    }
+
+  private:
+    Slots* _slots;
+    size_t _level;
+
+    void skip_empty()
+    {
+      while (_level < max_levels && !(*_slots)[_level]) {
+        _level += 1;
+      }
+    }
+  };
+
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+
+  iterator begin() { return { &_slots, 0 }; }
+  iterator end() { return { &_slots, max_levels }; }
+  const_iterator begin() const { return { &_slots, 0 }; }
+  const_iterator end() const { return { &_slots, max_levels }; }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  void clear()
+  {
+    std::fill(_slots.begin(), _slots.end(), std::nullopt);
+    _size = 0;
+  }
+
+  iterator find(NodeIndex n)
+  {
+    return matches(n) ? iterator{ &_slots, n.level() } : end();
+  }
+
+  const_iterator find(NodeIndex n) const
+  {
+    return matches(n) ? const_iterator{ &_slots, n.level() } : end();
+  }
+
+  size_t count(NodeIndex n) const { return matches(n) ? 1 : 0; }
+
+  const T& at(NodeIndex n) const
+  {
+    if (!matches(n)) {
+      throw InvalidParameterError("Node not in PathMap");
+    }
+
+    return (*_slots[n.level()]).second;
+  }
+
+  // Adds an entry for `value.first` unless there is one already
+  std::pair<iterator, bool> insert(value_type value)
+  {
+    const auto level = slot_for(value.first);
+    if (_slots[level]) {
+      return { iterator{ &_slots, level }, false };
+    }
+
+    _slots[level].emplace(std::move(value));
+    _size += 1;
+    return { iterator{ &_slots, level }, true };
+  }
+
+  void insert_or_assign(NodeIndex n, T value)
+  {
+    auto [it, inserted] = insert({ n, T{} });
+    silence_unused(inserted);
+    it->second = std::move(value);
+  }
+
+  T& operator[](NodeIndex n) { return insert({ n, T{} }).first->second; }
+
+  size_t erase(NodeIndex n)
+  {
+    if (!matches(n)) {
+      return 0;
+    }
+
+    _slots[n.level()].reset();
+    _size -= 1;
+    return 1;
+  }
+
+  friend bool operator==(const PathMap& lhs, const PathMap& rhs)
+  {
+    return lhs._slots == rhs._slots;
+  }
+
+  friend bool operator!=(const PathMap& lhs, const PathMap& rhs)
+  {
+    return !(lhs == rhs);
+  }
+
+  friend tls::ostream& operator<<(tls::ostream& str, const PathMap& map)
+  {
+    auto sorted = std::vector<const value_type*>{};
+    for (const auto& entry : map) {
+      sorted.push_back(&entry);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) {
+      return a->first < b->first;
+    });
+
+    auto entries = std::vector<std::tuple<NodeIndex, const T&>>{};
+    for (const auto* entry : sorted) {
+      entries.emplace_back(entry->first, entry->second);
+    }
+
+    return str << entries;
+  }
+
+  friend tls::istream& operator>>(tls::istream& str, PathMap& map)
+  {
+    auto entries = std::vector<std::tuple<NodeIndex, T>>{};
+    str >> entries;
+
+    map.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+      auto& [node, value] = entries[i];
+      if (i > 0 && !(std::get<0>(entries[i - 1]) < node)) {
+        throw tls::ReadError("Map keys out of order");
+      }
+
+      map.insert({ node, std::move(value) });
+    }
+
+    return str;
+  }
+
+private:
+  SlotArray _slots;
+  size_t _size = 0;
+
+  bool matches(NodeIndex n) const
+  {
+    const auto level = n.level();
+    return level < max_levels && _slots[level] && _slots[level]->first == n;
+  }
+
+  size_t slot_for(NodeIndex n) const
+  {
+    const auto level = n.level();
+    if (level >= max_levels) {
+      throw InvalidParameterError("Node level out of range for PathMap");
+    }
+
+    if (_slots[level] && _slots[level]->first != n) {
+      throw InvalidParameterError("Node not on the direct path of PathMap");
+    }
+
+    return level;
+  }
+};
+
+} // namespace mls
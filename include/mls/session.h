@@ -1,13 +1,18 @@
 #pragma once
 
+#include <mls/capture.h>
 #include <mls/common.h>
 #include <mls/core_types.h>
 #include <mls/credential.h>
 #include <mls/crypto.h>
 #include <mls/state.h>
 
+#include <chrono>
+#include <future>
+
 namespace mls {
 
+class KeyPackagePool;
 class PendingJoin;
 class Session;
 
@@ -22,10 +27,17 @@ public:
 
   PendingJoin start_join() const;
 
+  // A pool that generates KeyPackages for this client ahead of time, in
+  // batches run on the executor
+  KeyPackagePool key_package_pool(size_t target_depth,
+                                  Executor executor) const;
+
 private:
   const CipherSuite suite;
   const SignaturePrivateKey sig_priv;
   const Credential cred;
+
+  friend class KeyPackagePool;
 };
 
 class PendingJoin
@@ -43,6 +55,88 @@ private:
 
   PendingJoin(Inner* inner);
   friend class Client;
+  friend class KeyPackagePool;
+};
+
+// KeyPackages generated ahead of time, so that a client can hand out many of
+// them at once, e.g., to upload at login, without waiting for the key
+// generation and signing behind each one.
+//
+// refill() tops the pool up to its target depth.  It may run on a background
+// thread while KeyPackages are taken from the pool; take() only generates
+// KeyPackages itself if the pool runs dry.  The private keys for each
+// KeyPackage that has been taken are kept until join() is given the Welcome
+// that adds it, or it is discarded.
+class KeyPackagePool
+{
+public:
+  KeyPackagePool(KeyPackagePool&& other) noexcept;
+  KeyPackagePool& operator=(KeyPackagePool&& other) noexcept;
+  ~KeyPackagePool();
+
+  void refill();
+
+  // Generated KeyPackages not yet taken, and KeyPackages taken but not yet
+  // joined with or discarded
+  size_t available() const;
+  size_t outstanding() const;
+
+  std::vector<bytes> take(size_t count);
+
+  // Join a group using the outstanding KeyPackage that the Welcome is for.
+  // The KeyPackage is looked up by each recipient reference in the Welcome,
+  // so the cost does not grow with the number outstanding.  Once the group has
+  // been joined, the KeyPackage's private keys are dropped.
+  Session join(const bytes& welcome);
+
+  // Drop the private keys for an outstanding KeyPackage, returning false if
+  // it is not outstanding
+  bool discard(const bytes& key_package);
+
+private:
+  struct Inner;
+  std::unique_ptr<Inner> inner;
+
+  KeyPackagePool(Inner* inner);
+  friend class Client;
+};
+
+// A Commit being built in the background by Session::commit_async()
+class PendingCommit
+{
+public:
+  // Whether the Commit has been built, so that get() will not block
+  bool ready() const;
+
+  // Wait for the Commit to be built, then return the Welcome and the Commit,
+  // as Session::commit() does.  Errors from building the Commit are rethrown
+  // here.
+  std::tuple<bytes, bytes> get() const;
+
+private:
+  struct Result
+  {
+    bytes welcome;
+    bytes commit;
+    State next;
+  };
+
+  struct Job;
+  std::shared_ptr<Job> job;
+
+  explicit PendingCommit(std::shared_ptr<Job> job_in);
+  friend class Session;
+};
+
+// When the membership changes queued on a Session are committed: once
+// `max_changes` are queued, or once the oldest of them has waited `max_delay`,
+// whichever comes first
+struct CommitSchedule
+{
+  using Clock = std::chrono::steady_clock;
+
+  size_t max_changes = 16;
+  Clock::duration max_delay = std::chrono::milliseconds(100);
 };
 
 class Session
@@ -55,6 +149,34 @@ public:
   // Settings
   void encrypt_handshake(bool enabled);
 
+  // Keep at most `count` epochs, including the current one.  Past epochs are
+  // reduced to what late application messages need to be decrypted, and the
+  // oldest is dropped as each new epoch is entered.
+  static constexpr size_t default_retained_epochs = 8;
+  void retain_epochs(size_t count);
+
+  // Each time a new epoch is entered, including now, derive the keys for the
+  // first `generations` application messages from our own leaf and from each
+  // of `senders`, so that those messages are not delayed by key derivation.
+  // The work for different senders runs on `executor`.  Zero generations turns
+  // this off.
+  void warm_keys(std::vector<LeafIndex> senders,
+                 uint32_t generations,
+                 Executor executor);
+
+  // Run bulk crypto, such as encrypting an UpdatePath or verifying the
+  // KeyPackages added by a Commit, on the given executor.  It carries over to
+  // later epochs.  Commits built by commit_async() are started with the given
+  // scheduler, which by default runs each on a thread of its own.
+  void set_executor(Executor executor);
+  void set_executor(Executor executor, Scheduler scheduler);
+
+  // Record this member's traffic from now on: the messages handled,
+  // unprotected, protected and committed, with their timings.  The capture
+  // starts with the current state, including its secrets, so it must be
+  // stored as securely as the state itself.  A null sink stops capturing.
+  void capture(std::shared_ptr<CaptureSink> sink);
+
   // Message producers
   bytes add(const bytes& key_package_data);
   bytes update();
@@ -63,6 +185,48 @@ public:
   std::tuple<bytes, bytes> commit(const std::vector<bytes>& proposals);
   std::tuple<bytes, bytes> commit();
 
+  // Coalesced membership changes.  Rather than being sent as proposals, the
+  // changes are queued and carried by value in the next Commit, so that the
+  // group enters one new epoch for all of them.  An update of our own leaf is
+  // made by the UpdatePath of that Commit.
+  //
+  // A member queued for removal is remembered by its signature key, not its
+  // place in the tree, and the proposals are only made when the Commit is
+  // built.  Each time the Session enters an epoch, changes that no longer
+  // apply are dropped: Removes of members who have left, and Adds of members
+  // who have joined.  The queue goes into the next call to commit(),
+  // commit_due() or commit_async(), and is emptied once commit() has built
+  // the Commit or commit_async() has taken it.  If a Commit started by
+  // commit_async() cannot be built, its changes are queued again the next time
+  // the Session handles a message or commits, queues or clears changes.
+  // clear_queue() drops the queue.
+  void set_commit_schedule(const CommitSchedule& schedule);
+  void queue_add(const bytes& key_package_data);
+  void queue_remove(uint32_t index);
+  void queue_update();
+  size_t queued_changes() const;
+  void clear_queue();
+
+  // The Welcome and Commit for the queued changes, if the schedule calls for
+  // them to be committed by `now`.  Meant to be polled, e.g., from a timer
+  // that fires at the schedule's `max_delay`.
+  std::optional<std::tuple<bytes, bytes>> commit_due();
+  std::optional<std::tuple<bytes, bytes>> commit_due(
+    CommitSchedule::Clock::time_point now);
+
+  // Build a Commit of the pending proposals in the background, with the
+  // scheduler given to set_executor(), so that messages can still be
+  // protected and handled while it is built.  The Session recognizes the
+  // Commit when it is handled, as with commit().  If a built Commit cannot be
+  // recorded for that, the error is thrown by the next call to handle().
+  PendingCommit commit_async();
+
+  // Speculatively build the Commit for the epoch after `previous`, while
+  // `previous` waits to be accepted.  The result can only be used if
+  // `previous` is the Commit that the group accepts.  The build is scheduled
+  // once `previous` has been built, and fails if `previous` failed.
+  PendingCommit commit_async(const PendingCommit& previous);
+
   // Message consumers
   bool handle(const bytes& handshake_data);
 
@@ -76,12 +240,32 @@ public:
                   const bytes& context,
                   size_t size) const;
   GroupInfo group_info() const;
+  bytes group_info_data(bool inline_tree) const;
   std::vector<LeafNode> roster() const;
   bytes authentication_secret() const;
 
-  // Application message protection
+  // A view of the current epoch, which is published each time the Session
+  // enters an epoch.  Unlike the accessors above, snapshot() may be called
+  // from any thread while other methods run, and the view it returns can be
+  // read without synchronizing with the Session at all.
+  std::shared_ptr<const EpochSnapshot> snapshot() const;
+
+  // The memory held for the current epoch and the past epochs retained
+  GroupMemoryUsage memory_usage() const;
+
+  // Application message protection.  Like the State methods they call,
+  // unprotect() and unprotect_batch() may be called from several threads at
+  // once, as long as no non-const method runs at the same time.
   bytes protect(const bytes& plaintext);
-  bytes unprotect(const bytes& ciphertext);
+  bytes unprotect(const bytes& ciphertext) const;
+
+  // Append the protected message to `out` instead of returning it, so that
+  // the caller can supply and reuse the output buffer
+  void protect_into(const bytes& plaintext, bytes& out);
+
+  std::vector<bytes> protect_batch(const std::vector<bytes>& plaintexts);
+  std::vector<bytes> unprotect_batch(
+    const std::vector<bytes>& ciphertexts) const;
 
 protected:
   struct Inner;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <mls/common.h>
+#include <mls/messages.h>
+#include <mls/session.h>
+#include <mls/state.h>
+
+#include <hpke/hpke.h>
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+namespace mls {
+
+// The header at the start of each SFrame ciphertext (RFC 9605, Section 4.3).
+// Values below 8 are carried in the first byte; larger ones follow it in as
+// few bytes as they need.
+struct SFrameHeader
+{
+  uint64_t key_id = 0;
+  uint64_t counter = 0;
+
+  bytes encode() const;
+
+  // Parse a header from the start of `data`, returning it with its size
+  static std::tuple<SFrameHeader, size_t> decode(bytes_view data);
+};
+
+// SFrame media keys for the members of an MLS group (RFC 9605, Section 5.2).
+//
+// For each epoch, the SFrame base secret is exported from the group once, when
+// the epoch is added.  The key and salt for each sender are derived from it the
+// first time they are needed and kept, together with an AEAD context keyed for
+// that sender, so that each frame only costs the AEAD operation itself.
+//
+// A key ID carries the sender's leaf index above the low `epoch_bits` bits of
+// the epoch.  The keys for the last 2^epoch_bits epochs added are kept, and
+// frames are always protected under the most recent one.
+//
+// Only the AES-GCM SFrame cipher suites are supported.  A provider holds
+// mutable state and must not be used concurrently.
+class SFrameKeyProvider
+{
+public:
+  enum struct CipherSuite : uint16_t
+  {
+    AES_128_GCM_SHA256_128 = 0x0004,
+    AES_256_GCM_SHA512_128 = 0x0005,
+  };
+
+  explicit SFrameKeyProvider(const SFrameParameters& params);
+
+  // Export the base secret for the current epoch of a group
+  void add_epoch(const State& state);
+  void add_epoch(const Session& session);
+
+  uint64_t key_id(epoch_t epoch, LeafIndex sender) const;
+
+  // Encrypt a frame from our own leaf in the most recent epoch.  The
+  // `metadata` is authenticated but not encrypted, and must be supplied again
+  // to unprotect().
+  bytes protect(bytes_view metadata, bytes_view plaintext);
+  bytes unprotect(bytes_view metadata, bytes_view ciphertext);
+
+private:
+  struct SenderKeys
+  {
+    bytes salt;
+    std::unique_ptr<hpke::AEAD::KeyedContext> aead;
+  };
+
+  struct Epoch
+  {
+    epoch_t epoch;
+    LeafIndex own_index;
+    bytes secret;
+    uint64_t counter = 0;
+    std::map<LeafIndex, SenderKeys> senders;
+  };
+
+  CipherSuite suite;
+  uint8_t epoch_bits;
+  const hpke::KDF& kdf;
+  const hpke::AEAD& aead;
+
+  // Epochs in slots indexed by their low `epoch_bits` bits
+  std::vector<std::optional<Epoch>> epochs;
+  std::optional<epoch_t> latest;
+
+  void add_epoch(epoch_t epoch, LeafIndex own_index, bytes secret);
+  SenderKeys derive_sender_keys(const Epoch& epoch, LeafIndex sender) const;
+  bytes nonce(const SenderKeys& keys, uint64_t counter) const;
+};
+
+} // namespace mls
@@ -4,7 +4,13 @@
 #include "mls/key_schedule.h"
 #include "mls/messages.h"
 #include "mls/treekem.h"
-#include <list>
+#include <array>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <unordered_map>
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -22,6 +28,25 @@ struct CommitOpts
   bool inline_tree;
   bool encrypt_handshake;
   LeafNodeOptions leaf_node_opts;
+
+  // Used to run independent public-key operations in parallel
+  Executor executor = {};
+};
+
+// Options for joining a group from a Welcome.  With `defer_tree_validation`,
+// the State is returned once the tree hash, the GroupInfo, the signer's leaf
+// and the parent hashes on the joiner's direct path have been checked, and the
+// rest of the tree is validated in the background.  Until that finishes, the
+// State can decrypt application messages, while methods that send, handle
+// handshake messages or export the state wait for it, and rethrow its error if
+// the tree turns out to be invalid.  The background validation is started with
+// `scheduler`, and runs its hashing on the executor in `hash_opts`, so both
+// must outlive it.
+struct JoinOptions
+{
+  TreeHashOptions hash_opts;
+  bool defer_tree_validation = false;
+  Scheduler scheduler = {};
 };
 
 struct MessageOpts
@@ -31,6 +56,88 @@ struct MessageOpts
   size_t padding_size = 0;
 };
 
+// The memory held for a group, for enforcing memory budgets.  The counts are
+// of items held; sizes in bytes are estimates.  Storage shared between the
+// epochs of a group is counted once for each epoch that refers to it.
+//
+// Usage for several epochs or groups can be summed with +=.  The key usage is
+// then summed over every epoch held, except `max_sender_keys`, which is the
+// largest number of keys held for any one sender in any one epoch.
+struct GroupMemoryUsage
+{
+  TreeKEMPublicKey::MemoryUsage tree;
+  TreeKEMPrivateKey::MemoryUsage tree_priv;
+  GroupKeySource::MemoryUsage keys;
+  size_t pending_proposals = 0;
+  size_t proposal_bytes = 0;
+
+  // The current epoch, if counted, and the past epochs retained
+  size_t epochs = 0;
+
+  size_t total_bytes() const;
+  GroupMemoryUsage& operator+=(const GroupMemoryUsage& other);
+};
+
+// A past epoch, reduced to what is needed to decrypt late application
+// messages: the epoch's message keys and sender data secret, its group context,
+// and the signature key of each member.  The ratchet tree and the other secrets
+// of the epoch are dropped.
+class RetainedEpoch
+{
+public:
+  epoch_t epoch() const { return _context.epoch; }
+
+  // May be called from several threads at once, like State::unprotect()
+  std::tuple<bytes, bytes> unprotect(const MLSMessage& ct) const;
+
+  GroupMemoryUsage memory_usage() const;
+
+  friend bool operator==(const RetainedEpoch& lhs, const RetainedEpoch& rhs);
+  friend bool operator!=(const RetainedEpoch& lhs, const RetainedEpoch& rhs);
+
+private:
+  CipherSuite _suite;
+  GroupContext _context;
+  bytes _sender_data_secret;
+  mutable GroupKeySource _keys;
+  std::vector<std::optional<SignaturePublicKey>> _signature_keys;
+
+  RetainedEpoch() = default;
+  friend class State;
+};
+
+// An immutable view of one epoch, for readers on other threads: its public
+// information, and the secrets that are exported from it.  The ratchet tree
+// shares its storage with the State the view was taken from, so taking a view
+// does not copy the tree, and later changes to the State are not seen in it.
+class EpochSnapshot
+{
+public:
+  epoch_t epoch() const { return _epoch; }
+  LeafIndex index() const { return _index; }
+  CipherSuite cipher_suite() const { return _suite; }
+  const ExtensionList& extensions() const { return _extensions; }
+  const TreeKEMPublicKey& tree() const { return _tree; }
+
+  bytes do_export(const std::string& label,
+                  const bytes& context,
+                  size_t size) const;
+  std::vector<LeafNode> roster() const;
+  const bytes& authentication_secret() const { return _authentication_secret; }
+
+private:
+  CipherSuite _suite;
+  epoch_t _epoch = 0;
+  LeafIndex _index;
+  ExtensionList _extensions;
+  TreeKEMPublicKey _tree;
+  bytes _exporter_secret;
+  bytes _authentication_secret;
+
+  EpochSnapshot() = default;
+  friend class State;
+};
+
 class State
 {
 public:
@@ -54,6 +161,46 @@ public:
         const Welcome& welcome,
         const std::optional<TreeKEMPublicKey>& tree);
 
+  // Initialize a group from a Welcome, hashing and validating the ratchet tree
+  // in parallel
+  State(const HPKEPrivateKey& init_priv,
+        HPKEPrivateKey leaf_priv,
+        SignaturePrivateKey sig_priv,
+        const KeyPackage& kp,
+        const Welcome& welcome,
+        const std::optional<TreeKEMPublicKey>& tree,
+        const TreeHashOptions& hash_opts);
+
+  // Initialize a group from a Welcome, possibly validating most of the ratchet
+  // tree in the background
+  State(const HPKEPrivateKey& init_priv,
+        HPKEPrivateKey leaf_priv,
+        SignaturePrivateKey sig_priv,
+        const KeyPackage& kp,
+        const Welcome& welcome,
+        const std::optional<TreeKEMPublicKey>& tree,
+        const JoinOptions& join_opts);
+
+  // Initialize a group from a Welcome and two slices of the ratchet tree: the
+  // joiner's, which must hold its leaf, and the GroupInfo signer's, which
+  // authenticates the signer's leaf.  Both are checked against the tree hash
+  // in the GroupInfo, so the join completes having seen only O(log n) of the
+  // tree.  The rest of the tree is fetched with `fetch_tree` and validated
+  // the first time a method needs it, as for a lazily restored state; until
+  // then, epoch(), group_context(), do_export() and the other accessors that
+  // do not involve the tree work without it.  The tree is validated when it
+  // is fetched, so `defer_tree_validation` has no effect here.
+  using TreeFetcher = std::function<TreeKEMPublicKey()>;
+  State(const HPKEPrivateKey& init_priv,
+        HPKEPrivateKey leaf_priv,
+        SignaturePrivateKey sig_priv,
+        const KeyPackage& kp,
+        const Welcome& welcome,
+        const TreeSlice& slice,
+        const TreeSlice& signer_slice,
+        TreeFetcher fetch_tree,
+        const JoinOptions& join_opts);
+
   // Join a group from outside
   // XXX(RLB) To be fully general, we would need a few more options here, e.g.,
   // whether to include PSKs or evict our prior appearance.
@@ -65,6 +212,46 @@ public:
     const std::optional<TreeKEMPublicKey>& tree,
     const MessageOpts& msg_opts);
 
+  ///
+  /// Persistence
+  ///
+
+  // Save and restore the complete state of a member, including its secrets,
+  // so that it can be carried across restarts.  The result must be stored as
+  // securely as the private keys it contains.
+  //
+  // struct {
+  //   uint16 version;
+  //   opaque state<V>;
+  //   opaque keys<V>;
+  //   opaque tree<V>;
+  // } SerializedState;
+  //
+  // The secret tree and the ratchet tree are in their own sections, after the
+  // rest of the state.  deserialize() reads directly from the buffer it is
+  // given, so a saved state can be restored from a memory-mapped file without
+  // first being copied.
+  static constexpr uint16_t serialization_version = 2;
+  bytes serialize() const;
+  static State deserialize(const uint8_t* data, size_t size);
+  static State deserialize(const bytes& data);
+
+  // Restore only the first section of a saved state.  The ratchet tree and
+  // the application keys are loaded on first use, by calling `loader` for the
+  // complete serialized state, e.g., by mapping the file it was saved to.
+  // Until then, epoch(), group_context(), do_export() and the other accessors
+  // that do not involve the tree or the keys work without loading them, so an
+  // idle group only costs the memory for its epoch secrets.
+  //
+  // Loading happens inside const methods, so a lazily restored state must not
+  // be shared between threads until hydrated() is true.
+  using Loader = std::function<bytes()>;
+  static State deserialize_lazy(const uint8_t* data,
+                                size_t size,
+                                Loader loader);
+  static State deserialize_lazy(const bytes& data, Loader loader);
+  bool hydrated() const { return !std::atomic_load(&_lazy); }
+
   // Propose that a new member be added a group
   static MLSMessage new_member_add(const bytes& group_id,
                                    epoch_t epoch,
@@ -103,6 +290,25 @@ public:
   std::optional<State> handle(const MLSMessage& msg,
                               std::optional<State> cached);
 
+  // Apply a backlog of handshake messages, in order, to this state.  Proposals
+  // are cached and Commits advance the epoch as with handle(), but without a
+  // copy of the state per message, and the encryption keys of intermediate
+  // epochs are only derived if one of their messages is encrypted.  If a
+  // message fails, this state is left at the point just before it, and the
+  // result holds its index and the error it raised.
+  struct SequenceResult
+  {
+    size_t handled = 0;
+    std::exception_ptr error;
+  };
+
+  SequenceResult handle_sequence(const std::vector<MLSMessage>& msgs);
+
+  // Handle a batch of Proposal messages for the current epoch.  The
+  // signatures are verified together, on the executor, and the proposals are
+  // only cached if all of them are valid.
+  void cache_proposals(const std::vector<MLSMessage>& msgs);
+
   ///
   /// Accessors
   ///
@@ -110,14 +316,21 @@ public:
   LeafIndex index() const { return _index; }
   CipherSuite cipher_suite() const { return _suite; }
   const ExtensionList& extensions() const { return _extensions; }
-  const TreeKEMPublicKey& tree() const { return _tree; }
+  const TreeKEMPublicKey& tree() const;
 
   bytes do_export(const std::string& label,
                   const bytes& context,
                   size_t size) const;
   GroupInfo group_info() const;
 
-  // Ordered list of credentials from non-blank leaves
+  // The signed, encoded GroupInfo for this epoch, with or without the ratchet
+  // tree in a RatchetTreeExtension, or in a CompressedRatchetTreeExtension if
+  // the group requires support for it.  Each form is signed once per epoch and
+  // shared by copies of the state, so repeated requests return the same bytes.
+  const bytes& group_info_data(bool inline_tree) const;
+
+  // Ordered list of credentials from non-blank leaves.  tree().leaves() visits
+  // the same leaves without copying them.
   std::vector<LeafNode> roster() const;
 
   bytes authentication_secret() const;
@@ -128,10 +341,68 @@ public:
   MLSMessage protect(const bytes& authenticated_data,
                      const bytes& pt,
                      size_t padding_size);
-  std::tuple<bytes, bytes> unprotect(const MLSMessage& ct);
 
-  // Assemble a group context for this state
-  GroupContext group_context() const;
+  // As protect(), but appending the encoded MLSMessage to `out`.  The
+  // ciphertext is written in place, so a large plaintext is not copied again
+  // after it has been signed.
+  void protect_into(const bytes& authenticated_data,
+                    const bytes& pt,
+                    size_t padding_size,
+                    bytes& out);
+
+  // Decryption only advances the per-sender ratchets of the key source, which
+  // does its own locking.  So unprotect() and unprotect_batch() may be called
+  // from several threads at once, and messages from different senders are
+  // decrypted in parallel.  They must not overlap with any non-const method.
+  std::tuple<bytes, bytes> unprotect(const MLSMessage& ct) const;
+
+  // Batch versions of protect() and unprotect().  Per-epoch work like
+  // assembling the group context is done once for the whole batch.  The
+  // messages given to unprotect_batch() are decrypted on the executor set
+  // with set_executor(), if any.  Once one of them fails, those not yet
+  // started are skipped, and the failure is rethrown after the batch.
+  std::vector<MLSMessage> protect_batch(const bytes& authenticated_data,
+                                        const std::vector<bytes>& pts,
+                                        size_t padding_size);
+  std::vector<std::tuple<bytes, bytes>> unprotect_batch(
+    const std::vector<MLSMessage>& cts) const;
+
+  // Reduce this epoch to what late application messages need
+  RetainedEpoch retain() const;
+
+  // A view of this epoch that can be shared with readers on other threads
+  std::shared_ptr<const EpochSnapshot> snapshot() const;
+
+  // Limit the per-sender ratchets held for this epoch.  The policy carries
+  // over to the states for later epochs.
+  void set_key_retention(const KeyRetentionPolicy& policy);
+  GroupKeySource::MemoryUsage key_memory_usage() const;
+
+  // The memory held for this epoch.  The parts of a lazily restored state
+  // that have not been loaded yet are not counted.
+  GroupMemoryUsage memory_usage() const;
+
+  // Derive ahead of time the keys for the first `generations` application
+  // messages from each of `senders` that is a member, as
+  // GroupKeySource::warm() does.  Like unprotect(), this may run concurrently
+  // with other const methods.
+  void warm_keys(const std::vector<LeafIndex>& senders,
+                 uint32_t generations,
+                 const Executor& executor) const;
+
+  // Run bulk work, such as verifying the KeyPackages added by a Commit, on the
+  // given executor.  The executor carries over to the states for later epochs.
+  void set_executor(Executor executor);
+
+  // For a State joined with deferred tree validation, whether the background
+  // validation is still running, and waiting for it to finish.  The wait
+  // rethrows the error if validation failed.
+  bool tree_validation_pending() const;
+  void wait_for_tree_validation() const;
+
+  // The group context for this state.  The context and its serialization are
+  // assembled on first use and kept until the group state next changes.
+  const GroupContext& group_context() const;
 
 protected:
   // Shared confirmed state
@@ -139,18 +410,40 @@ protected:
   CipherSuite _suite;
   bytes _group_id;
   epoch_t _epoch;
-  TreeKEMPublicKey _tree;
-  TreeKEMPrivateKey _tree_priv;
+  mutable TreeKEMPublicKey _tree;
+  mutable TreeKEMPrivateKey _tree_priv;
   TranscriptHash _transcript_hash;
   ExtensionList _extensions;
 
   // Shared secret state
   KeyScheduleEpoch _key_schedule;
-  GroupKeySource _keys;
+  mutable GroupKeySource _keys;
 
   // Per-participant state
   LeafIndex _index;
   SignaturePrivateKey _identity_priv;
+  Executor _executor;
+
+  // Validation of the tree still running after a deferred join, shared by
+  // the states for later epochs
+  std::shared_future<void> _tree_validation;
+
+  // Cached GroupContext for the current epoch, shared by copies of the state.
+  // This must be reset whenever the epoch, tree, transcript or extensions
+  // change.
+  struct GroupContextCache
+  {
+    GroupContext context;
+    bytes encoded;
+  };
+  mutable std::shared_ptr<const GroupContextCache> _group_context_cache;
+  const GroupContextCache& group_context_cache() const;
+
+  // Cached signed GroupInfo, without and with the inline tree, reset along
+  // with the GroupContext.  Entries are filled in with atomic operations, so
+  // that concurrent readers of one epoch can share them.
+  mutable std::array<std::shared_ptr<const bytes>, 2> _group_info_cache;
+  void reset_epoch_caches();
 
   // Cache of Proposals and update secrets
   struct CachedProposal
@@ -158,25 +451,83 @@ protected:
     ProposalRef ref;
     Proposal proposal;
     std::optional<LeafIndex> sender;
+
+    TLS_SERIALIZABLE(ref, proposal, sender)
   };
-  std::list<CachedProposal> _pending_proposals;
+  std::vector<CachedProposal> _pending_proposals;
+  std::unordered_map<ProposalRef, size_t, HashReferenceHash>
+    _pending_proposal_index;
 
   struct CachedUpdate
   {
     bytes update_secret;
     Update proposal;
+
+    TLS_SERIALIZABLE(update_secret, proposal)
   };
   std::optional<CachedUpdate> _cached_update;
 
+  // Restore a state from its serialized parts.  The tree and keys are left
+  // empty until load_sections() reads them.
+  struct Serialized;
+  explicit State(Serialized&& serialized);
+  static State read_state(tls::istream& str);
+  void load_sections(tls::istream& str) const;
+
+  // For a group joined from a tree slice, how to fetch the tree, the tree
+  // hash it must match, and the path secret from the Welcome, which can only
+  // be implanted once the filtered direct path is known
+  struct PendingTree
+  {
+    TreeFetcher fetch_tree;
+    bytes tree_hash;
+    TreeHashOptions hash_opts;
+    NodeIndex intersect;
+    std::optional<bytes> path_secret;
+  };
+
+  // For a lazily restored state, the source of the sections not yet loaded,
+  // a digest of the encoding it was restored from, which the loaded data must
+  // start with, and a lock under which concurrent readers wait for the first
+  // of them to load it.  For a group joined from a slice, only the tree is
+  // pending.  _tree, _tree_priv and _keys are mutable so that const methods
+  // can load them.
+  struct LazyLoad
+  {
+    Loader loader;
+    bytes restored_digest;
+    std::optional<PendingTree> pending_tree;
+    std::mutex mutex;
+  };
+
+  mutable std::shared_ptr<LazyLoad> _lazy;
+  void hydrate() const;
+  void load_tree(const PendingTree& pending) const;
+
+  // Join from a Welcome, with either a tree (or none, to use the extension) or
+  // slices and a way to fetch the tree when it is first needed
+  State(const HPKEPrivateKey& init_priv,
+        HPKEPrivateKey leaf_priv,
+        SignaturePrivateKey sig_priv,
+        const KeyPackage& kp,
+        const Welcome& welcome,
+        const std::optional<TreeKEMPublicKey>& tree,
+        const TreeSlice* slice,
+        const TreeSlice* signer_slice,
+        TreeFetcher fetch_tree,
+        const JoinOptions& join_opts);
+
   // Assemble a preliminary, unjoined group state
   State(SignaturePrivateKey sig_priv,
         const GroupInfo& group_info,
         const std::optional<TreeKEMPublicKey>& tree);
 
   // Import a tree from an externally-provided tree or an extension
-  TreeKEMPublicKey import_tree(const bytes& tree_hash,
+  TreeKEMPublicKey import_tree(const bytes& group_id,
+                               const bytes& tree_hash,
                                const std::optional<TreeKEMPublicKey>& external,
-                               const ExtensionList& extensions);
+                               const ExtensionList& extensions,
+                               const TreeHashOptions& hash_opts);
 
   std::tuple<MLSMessage, Welcome, State> commit(
     const bytes& leaf_secret,
@@ -198,7 +549,24 @@ protected:
   template<typename Inner>
   MLSMessage protect_full(Inner&& content, const MessageOpts& msg_opts);
 
-  MLSAuthenticatedContent unprotect_to_content_auth(const MLSMessage& msg);
+  // The checks common to all handshake messages, returning the verified
+  // content of a Proposal or Commit
+  MLSAuthenticatedContent authenticate_handshake(const MLSMessage& msg) const;
+  static std::optional<LeafIndex> commit_sender(const MLSContent& content);
+
+  // Apply a Commit from another member to this state, in place, with its
+  // proposals already resolved and verified
+  void apply_commit(const MLSAuthenticatedContent& content_auth,
+                    std::optional<LeafIndex> sender,
+                    const std::vector<CachedProposal>& proposals,
+                    bool derive_keys);
+  SequenceResult apply_sequence(const std::vector<MLSMessage>& msgs,
+                                size_t count);
+
+  MLSAuthenticatedContent unprotect_to_content_auth(
+    const MLSMessage& msg) const;
+  std::tuple<bytes, bytes> unprotect(const MLSMessage& ct,
+                                     const GroupContext& ctx) const;
 
   // Apply the changes requested by various messages
   void check_add_leaf_node(const LeafNode& leaf,
@@ -206,22 +574,25 @@ protected:
   void check_update_leaf_node(LeafIndex target,
                               const LeafNode& leaf,
                               LeafNodeSource required_source) const;
-  LeafIndex apply(const Add& add);
   void apply(LeafIndex target, const Update& update);
   void apply(LeafIndex target, const Update& update, const bytes& leaf_secret);
-  LeafIndex apply(const Remove& remove);
-  void apply(const GroupContextExtensions& gce);
-  std::vector<LeafIndex> apply(const std::vector<CachedProposal>& proposals,
-                               Proposal::Type required_type);
+
+  // Apply the proposals in a Commit, returning whether we updated our own
+  // leaf, whether any member was removed, and the locations of the joiners
   std::tuple<bool, bool, std::vector<LeafIndex>> apply(
     const std::vector<CachedProposal>& proposals);
 
+  // Verify the signatures on the KeyPackages in any Add proposals
+  void verify_add_key_packages(
+    const std::vector<CachedProposal>& proposals) const;
+
   // Verify that a specific key package or all members support a given set of
   // extensions
   bool extensions_supported(const ExtensionList& exts) const;
 
   // Extract a proposal from the cache
   void cache_proposal(MLSAuthenticatedContent content_auth);
+  void cache_proposal(CachedProposal cached);
   std::optional<CachedProposal> resolve(
     const ProposalOrRef& id,
     std::optional<LeafIndex> sender_index) const;
@@ -233,25 +604,96 @@ protected:
   friend bool operator==(const State& lhs, const State& rhs);
   friend bool operator!=(const State& lhs, const State& rhs);
 
-  // Derive and set the secrets for an epoch, given some new entropy
+  // Derive and set the secrets for an epoch, given some new entropy.  Setting
+  // up the encryption keys can be put off, for an epoch that will be passed
+  // through without sending or receiving encrypted messages.
   void update_epoch_secrets(const bytes& commit_secret,
                             const std::vector<PSKWithSecret>& psks,
-                            const std::optional<bytes>& force_init_secret);
+                            const std::optional<bytes>& force_init_secret,
+                            bool derive_keys = true);
+  void derive_encryption_keys();
 
   // Signature verification over a handshake message
-  bool verify_internal(const MLSAuthenticatedContent& content_auth) const;
-  bool verify_external(const MLSAuthenticatedContent& content_auth) const;
-  bool verify_new_member_proposal(
-    const MLSAuthenticatedContent& content_auth) const;
-  bool verify_new_member_commit(
-    const MLSAuthenticatedContent& content_auth) const;
   bool verify(const MLSAuthenticatedContent& content_auth) const;
+  bool verify(const MLSAuthenticatedContent& content_auth,
+              const GroupContext& ctx) const;
 
   // Convert a Roster entry into LeafIndex
   LeafIndex leaf_for_roster_entry(RosterIndex index) const;
 
   // Create a draft successor state
   State successor() const;
+
+  friend class GroupObserver;
+};
+
+// A view of a group from outside it, for a delivery service that validates the
+// handshake messages of groups it is not a member of.
+//
+// An observer holds only the public state of the group: the ratchet tree, the
+// transcript hashes, the group context extensions and the proposals cached in
+// the current epoch.  For each Proposal and Commit it checks the signature,
+// the epoch and the proposals, and for a Commit's UpdatePath, the parent
+// hashes, the new leaf and that there is a ciphertext for every member.  It
+// then applies the Commit to the tree, without any HPKE decryption or key
+// schedule.
+//
+// Without the epoch secrets, an observer cannot check membership tags or
+// confirmation tags, or read handshake messages sent as MLSCiphertext, so the
+// groups it observes must send their handshake messages in the clear.
+class GroupObserver
+{
+public:
+  // Start observing from a GroupInfo signed by a member, with the ratchet
+  // tree given or carried in a RatchetTreeExtension
+  GroupObserver(const GroupInfo& group_info,
+                const std::optional<TreeKEMPublicKey>& tree);
+
+  // Check and apply a handshake message for the current epoch.  Proposals are
+  // cached, and Commits advance the epoch, in which case this returns true.
+  // If the message is invalid, this throws and the observer is unchanged.
+  bool handle(const MLSMessage& msg);
+
+  epoch_t epoch() const { return _epoch; }
+  CipherSuite cipher_suite() const { return _suite; }
+  const bytes& group_id() const { return _group_id; }
+  const ExtensionList& extensions() const { return _extensions; }
+  const TreeKEMPublicKey& tree() const { return _tree; }
+  GroupContext group_context() const;
+
+  // The GroupInfo for the current epoch, as published by a member, so that it
+  // can be served to new joiners along with tree().  A GroupInfo is only
+  // accepted if a member signed it and its group context matches the current
+  // epoch, and it is dropped when the epoch advances.
+  void set_group_info(const GroupInfo& group_info);
+  const std::optional<GroupInfo>& group_info() const { return _group_info; }
+
+  // Run bulk work, such as verifying the KeyPackages added by a Commit, on the
+  // given executor
+  void set_executor(Executor executor);
+
+private:
+  CipherSuite _suite;
+  bytes _group_id;
+  epoch_t _epoch;
+  TreeKEMPublicKey _tree;
+  TranscriptHash _transcript_hash;
+  ExtensionList _extensions;
+  std::optional<GroupInfo> _group_info;
+  Executor _executor;
+
+  using CachedProposal = State::CachedProposal;
+  std::vector<CachedProposal> _pending_proposals;
+  std::unordered_map<ProposalRef, size_t, HashReferenceHash>
+    _pending_proposal_index;
+
+  void cache_proposal(CachedProposal cached);
+  std::vector<CachedProposal> must_resolve(
+    const std::vector<ProposalOrRef>& ids,
+    std::optional<LeafIndex> sender_index) const;
+
+  // Apply the proposals in a Commit, returning the locations of the joiners
+  std::vector<LeafIndex> apply(const std::vector<CachedProposal>& proposals);
 };
 
 } // namespace mls
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
+#include <stdexcept>
 #include <tls/tls_syntax.h>
 #include <vector>
 
@@ -29,6 +33,53 @@
 
 namespace mls {
 
+namespace bits {
+
+// The number of trailing one bits in x, i.e., the level of node x
+constexpr uint32_t
+trailing_ones(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return (~x == 0) ? 32 : static_cast<uint32_t>(__builtin_ctz(~x));
+#else
+  uint32_t k = 0;
+  while (k < 32 && ((x >> k) & 1U) == 1) {
+    k += 1;
+  }
+  return k;
+#endif
+}
+
+// The index of the highest set bit in x, with log2(0) taken to be 0
+constexpr uint32_t
+log2(uint32_t x)
+{
+  if (x == 0) {
+    return 0;
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  return 31 - static_cast<uint32_t>(__builtin_clz(x));
+#else
+  uint32_t k = 0;
+  while ((x >> k) > 1) {
+    k += 1;
+  }
+  return k;
+#endif
+}
+
+// The node at `level` above node x, computed in 64 bits so that the root level
+// of the largest trees does not overflow a shift
+constexpr uint32_t
+ancestor_at(uint32_t x, uint32_t level)
+{
+  const auto high = (uint64_t(x) >> (level + 1)) << (level + 1);
+  return static_cast<uint32_t>(high | ((uint64_t(1) << level) - 1));
+}
+
+} // namespace bits
+
 // Index types go in the overall namespace
 // XXX(rlb@ipv.sx): Seems like this stuff can probably get
 // simplified down a fair bit.
@@ -36,12 +87,12 @@ struct UInt32
 {
   uint32_t val;
 
-  UInt32()
+  constexpr UInt32()
     : val(0)
   {
   }
 
-  explicit UInt32(uint32_t val_in)
+  constexpr explicit UInt32(uint32_t val_in)
     : val(val_in)
   {
   }
@@ -62,7 +113,10 @@ struct LeafCount : public UInt32
 struct NodeCount : public UInt32
 {
   using UInt32::UInt32;
-  explicit NodeCount(const LeafCount n);
+  constexpr explicit NodeCount(const LeafCount n)
+    : UInt32(2 * (n.val - 1) + 1)
+  {
+  }
 };
 
 struct NodeIndex;
@@ -74,7 +128,7 @@ struct LeafIndex : public UInt32
   bool operator<(const LeafIndex other) const { return val < other.val; }
   bool operator<(const LeafCount other) const { return val < other.val; }
 
-  NodeIndex ancestor(LeafIndex other) const;
+  constexpr NodeIndex ancestor(LeafIndex other) const;
 };
 
 // Leaf indices serialize as node indices, and are validated on deserialize
@@ -83,22 +137,29 @@ operator<<(tls::ostream& str, const LeafIndex& obj);
 tls::istream&
 operator>>(tls::istream& str, LeafIndex& obj);
 
+class NodePath;
+class LeafRange;
+
 struct NodeIndex : public UInt32
 {
   using UInt32::UInt32;
-  explicit NodeIndex(const LeafIndex x);
+  constexpr explicit NodeIndex(const LeafIndex x)
+    : UInt32(2 * x.val)
+  {
+  }
+
   bool operator<(const NodeIndex other) const { return val < other.val; }
   bool operator<(const LeafCount other) const { return val < other.val; }
 
-  static NodeIndex root(LeafCount n);
+  static constexpr NodeIndex root(LeafCount n);
 
-  bool is_leaf() const;
-  bool is_below(NodeIndex other) const;
+  constexpr bool is_leaf() const { return (val & 1U) == 0; }
+  constexpr bool is_below(NodeIndex other) const;
 
-  NodeIndex left() const;
-  NodeIndex right() const;
-  NodeIndex parent() const;
-  NodeIndex sibling() const;
+  constexpr NodeIndex left() const;
+  constexpr NodeIndex right() const;
+  constexpr NodeIndex parent() const;
+  constexpr NodeIndex sibling() const;
 
   // Returns the sibling of this node "relative to this ancestor" -- the child
   // of `ancestor` that is not in the direct path of this node.
@@ -107,7 +168,279 @@ struct NodeIndex : public UInt32
   std::vector<NodeIndex> dirpath(LeafCount n);
   std::vector<NodeIndex> copath(LeafCount n);
 
-  uint32_t level() const;
+  // Allocation-free views of the same paths.  ancestors() is this node
+  // followed by its direct path, and leaves() are the leaves of the subtree
+  // rooted at this node that fall within a tree of `n` leaves.
+  constexpr NodePath dirpath_range(LeafCount n) const;
+  constexpr NodePath copath_range(LeafCount n) const;
+  constexpr NodePath ancestors(LeafCount n) const;
+  constexpr LeafRange leaves(LeafCount n) const;
+
+  constexpr uint32_t level() const { return bits::trailing_ones(val); }
 };
 
+// A run of nodes up the tree from a base node, one per level.  Entry `i` is the
+// ancestor of the base node `first + i` levels above it or, for a copath, the
+// sibling of that ancestor.  Each entry is computed directly from the base
+// node, so the range supports constant-time indexing.
+class NodePath
+{
+public:
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = NodeIndex;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const NodeIndex*;
+    using reference = NodeIndex;
+
+    constexpr iterator(const NodePath* path, uint32_t pos)
+      : _path(path)
+      , _pos(pos)
+    {
+    }
+
+    constexpr NodeIndex operator*() const { return (*_path)[_pos]; }
+
+    constexpr iterator& operator++()
+    {
+      _pos += 1;
+      return *this;
+    }
+
+    constexpr iterator operator++(int)
+    {
+      auto prev = *this;
+      _pos += 1;
+      return prev;
+    }
+
+    constexpr bool operator==(const iterator& other) const
+    {
+      return _pos == other._pos;
+    }
+
+    constexpr bool operator!=(const iterator& other) const
+    {
+      return _pos != other._pos;
+    }
+
+  private:
+    const NodePath* _path;
+    uint32_t _pos;
+  };
+
+  constexpr NodePath(NodeIndex base,
+                     uint32_t first,
+                     uint32_t count,
+                     bool siblings)
+    : _base(base)
+    , _first(first)
+    , _count(count)
+    , _siblings(siblings)
+  {
+  }
+
+  constexpr size_t size() const { return _count; }
+  constexpr bool empty() const { return _count == 0; }
+
+  constexpr NodeIndex operator[](size_t i) const
+  {
+    const auto level = _base.level() + _first + static_cast<uint32_t>(i);
+    const auto node = bits::ancestor_at(_base.val, level);
+    if (!_siblings) {
+      return NodeIndex{ node };
+    }
+
+    const auto bit = uint64_t(1) << (level + 1);
+    return NodeIndex{ static_cast<uint32_t>(node ^ bit) };
+  }
+
+  constexpr NodeIndex front() const { return (*this)[0]; }
+  constexpr NodeIndex back() const { return (*this)[_count - 1]; }
+
+  // NB: Iterators refer to the range, which must outlive them
+  constexpr iterator begin() const { return { this, 0 }; }
+  constexpr iterator end() const { return { this, _count }; }
+
+private:
+  NodeIndex _base;
+  uint32_t _first;
+  uint32_t _count;
+  bool _siblings;
+};
+
+// A run of consecutive leaf indices
+class LeafRange
+{
+public:
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = LeafIndex;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const LeafIndex*;
+    using reference = LeafIndex;
+
+    constexpr explicit iterator(uint32_t val)
+      : _val(val)
+    {
+    }
+
+    constexpr LeafIndex operator*() const { return LeafIndex{ _val }; }
+
+    constexpr iterator& operator++()
+    {
+      _val += 1;
+      return *this;
+    }
+
+    constexpr iterator operator++(int)
+    {
+      auto prev = *this;
+      _val += 1;
+      return prev;
+    }
+
+    constexpr bool operator==(const iterator& other) const
+    {
+      return _val == other._val;
+    }
+
+    constexpr bool operator!=(const iterator& other) const
+    {
+      return _val != other._val;
+    }
+
+  private:
+    uint32_t _val;
+  };
+
+  constexpr LeafRange(uint32_t first, uint32_t last)
+    : _first(first)
+    , _last(last < first ? first : last)
+  {
+  }
+
+  constexpr size_t size() const { return _last - _first; }
+  constexpr bool empty() const { return _last == _first; }
+
+  constexpr iterator begin() const { return iterator{ _first }; }
+  constexpr iterator end() const { return iterator{ _last }; }
+
+private:
+  uint32_t _first;
+  uint32_t _last;
+};
+
+///
+/// Inline definitions
+///
+
+constexpr NodeIndex
+LeafIndex::ancestor(LeafIndex other) const
+{
+  const auto ln = NodeIndex(*this).val;
+  const auto rn = NodeIndex(other).val;
+  if (ln == rn) {
+    return NodeIndex{ ln };
+  }
+
+  // The ancestor sits at the level of the highest bit where the nodes differ
+  const auto level = bits::log2(ln ^ rn);
+  return NodeIndex{ bits::ancestor_at(ln, level) };
+}
+
+constexpr NodeIndex
+NodeIndex::root(LeafCount n)
+{
+  if (n.val == 0) {
+    throw std::runtime_error("Root for zero-size tree is undefined");
+  }
+
+  const auto w = NodeCount(n);
+  return NodeIndex{ (uint32_t(1) << bits::log2(w.val)) - 1 };
+}
+
+constexpr bool
+NodeIndex::is_below(NodeIndex other) const
+{
+  const auto lx = level();
+  const auto ly = other.level();
+  return lx <= ly &&
+         (uint64_t(val) >> (ly + 1)) == (uint64_t(other.val) >> (ly + 1));
+}
+
+constexpr NodeIndex
+NodeIndex::left() const
+{
+  if (is_leaf()) {
+    return *this;
+  }
+
+  return NodeIndex{ val ^ (uint32_t(1) << (level() - 1)) };
+}
+
+constexpr NodeIndex
+NodeIndex::right() const
+{
+  if (is_leaf()) {
+    return *this;
+  }
+
+  return NodeIndex{ val ^ (uint32_t(0x03) << (level() - 1)) };
+}
+
+constexpr NodeIndex
+NodeIndex::parent() const
+{
+  const auto k = level();
+  const auto bit = uint64_t(1) << k;
+  return NodeIndex{ static_cast<uint32_t>((val | bit) & ~(bit << 1U)) };
+}
+
+constexpr NodeIndex
+NodeIndex::sibling() const
+{
+  const auto bit = uint64_t(1) << (level() + 1);
+  return NodeIndex{ static_cast<uint32_t>(val ^ bit) };
+}
+
+constexpr NodePath
+NodeIndex::dirpath_range(LeafCount n) const
+{
+  const auto height = root(n).level();
+  const auto count = (height > level()) ? height - level() : 0;
+  return { *this, 1, count, false };
+}
+
+constexpr NodePath
+NodeIndex::copath_range(LeafCount n) const
+{
+  const auto height = root(n).level();
+  const auto count = (height > level()) ? height - level() : 0;
+  return { *this, 0, count, true };
+}
+
+constexpr NodePath
+NodeIndex::ancestors(LeafCount n) const
+{
+  const auto height = root(n).level();
+  const auto count = (height > level()) ? height - level() : 0;
+  return { *this, 0, count + 1, false };
+}
+
+constexpr LeafRange
+NodeIndex::leaves(LeafCount n) const
+{
+  const auto k = level();
+  const auto first = static_cast<uint32_t>(
+    (uint64_t(val) + 1 - (uint64_t(1) << k)) >> 1U);
+  const auto last = static_cast<uint32_t>(
+    std::min(uint64_t(first) + (uint64_t(1) << k), uint64_t(n.val)));
+  return { first, last };
+}
+
 } // namespace mls
@@ -2,10 +2,16 @@
 
 #include "mls/common.h"
 #include "mls/core_types.h"
+#include "mls/cow_vector.h"
 #include "mls/crypto.h"
+#include "mls/leaf_bitmap.h"
+#include "mls/path_map.h"
 #include "mls/tree_math.h"
 #include <tls/tls_syntax.h>
 
+#include <cstddef>
+#include <iterator>
+
 #define ENABLE_TREE_DUMP 1
 
 namespace mls {
@@ -60,13 +66,55 @@ struct OptionalNode
 
 struct TreeKEMPublicKey;
 
+// The non-blank leaves of a tree, in order, without copying them.  A view must
+// not outlive its tree, and is invalidated when the tree changes.
+class LeafView
+{
+public:
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = LeafNode;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const LeafNode*;
+    using reference = const LeafNode&;
+
+    iterator(const TreeKEMPublicKey* tree, LeafIndex index);
+
+    LeafIndex index() const { return _index; }
+    reference operator*() const;
+    pointer operator->() const { return &**this; }
+    iterator& operator++();
+    bool operator==(const iterator& other) const;
+    bool operator!=(const iterator& other) const { return !(*this == other); }
+
+  private:
+    const TreeKEMPublicKey* _tree;
+    LeafIndex _index;
+
+    void skip_blanks();
+  };
+
+  explicit LeafView(const TreeKEMPublicKey& tree);
+
+  iterator begin() const;
+  iterator end() const;
+
+private:
+  const TreeKEMPublicKey* _tree;
+};
+
 struct TreeKEMPrivateKey
 {
   CipherSuite suite;
   LeafIndex index;
   bytes update_secret;
-  std::map<NodeIndex, bytes> path_secrets;
-  std::map<NodeIndex, HPKEPrivateKey> private_key_cache;
+
+  // Path secrets and the private keys derived from them, for the nodes on this
+  // member's direct path
+  PathMap<bytes> path_secrets;
+  PathMap<HPKEPrivateKey> private_key_cache;
 
   static TreeKEMPrivateKey solo(CipherSuite suite,
                                 LeafIndex index,
@@ -95,6 +143,16 @@ struct TreeKEMPrivateKey
 
   void truncate(LeafCount size);
 
+  // The secrets held, for monitoring memory use
+  struct MemoryUsage
+  {
+    size_t path_secrets = 0;
+    size_t private_keys = 0;
+    size_t bytes = 0;
+  };
+
+  MemoryUsage memory_usage() const;
+
   bool consistent(const TreeKEMPrivateKey& other) const;
   bool consistent(const TreeKEMPublicKey& other) const;
 
@@ -102,17 +160,53 @@ struct TreeKEMPrivateKey
   void dump() const;
 #endif
 
+  TLS_SERIALIZABLE(suite, index, update_secret, path_secrets, private_key_cache)
+
 private:
   void implant(const TreeKEMPublicKey& pub,
                NodeIndex start,
                const bytes& path_secret);
 };
 
+// A slice of a ratchet tree, holding what one member needs to recompute the
+// tree hash: the nodes on the member's direct path, starting with its leaf,
+// and the tree hashes of the subtrees rooted at its copath nodes.  A joiner
+// can be sent a slice, check it against the tree hash in the GroupInfo, and
+// fetch the remainder of the tree later, as the State constructor that takes a
+// slice does.  The slice is O(log n) in the size of the tree.
+//
+// struct {
+//   uint32 n_leaves;
+//   uint32 leaf_index;
+//   optional<Node> direct_path_nodes<V>;
+//   opaque copath_hashes<V><V>;
+// } TreeSlice;
+struct TreeSlice
+{
+  LeafCount n_leaves;
+  LeafIndex leaf_index;
+  std::vector<OptionalNode> direct_path_nodes;
+  std::vector<bytes> copath_hashes;
+
+  bytes tree_hash(CipherSuite suite) const;
+
+  TLS_SERIALIZABLE(n_leaves, leaf_index, direct_path_nodes, copath_hashes)
+};
+
+// Tree hashing and parent-hash validation both decompose into independent
+// subtrees.  The subtrees `depth` levels below the root are handed to the
+// executor as separate tasks, and the levels above them are finished serially.
+// A depth of zero or an empty executor does all of the work serially.
+struct TreeHashOptions
+{
+  Executor executor = {};
+  uint32_t depth = 0;
+};
+
 struct TreeKEMPublicKey
 {
   CipherSuite suite;
   LeafCount size{ 0 };
-  std::vector<OptionalNode> nodes;
 
   explicit TreeKEMPublicKey(CipherSuite suite);
 
@@ -126,17 +220,90 @@ struct TreeKEMPublicKey
   void update_leaf(LeafIndex index, const LeafNode& leaf);
   void blank_path(LeafIndex index);
 
+  // Add or blank many leaves in one pass over the tree.  The result is the
+  // same as calling add_leaf() or blank_path() for each leaf in turn, but the
+  // tree is resized at most once, and each unmerged list and cached hash is
+  // only updated once.
+  std::vector<LeafIndex> add_leaves(const std::vector<LeafNode>& leaves);
+  void blank_paths(const std::vector<LeafIndex>& indices);
+
+  // Make room for the tree to grow to `leaves` leaves without reallocating its
+  // node storage or hash cache.  Nodes are stored in fixed-size chunks that do
+  // not move as the tree grows, so this only avoids copying the lists of
+  // chunks and flags.
+  void reserve(LeafCount leaves);
+
   void merge(LeafIndex from, const UpdatePath& path);
   void set_hash_all();
+  void set_hash_all(const TreeHashOptions& opts);
   bytes root_hash() const;
 
   bool parent_hash_valid(LeafIndex from, const UpdatePath& path) const;
+
+  // Whether `path` has a node for each node in the filtered direct path of
+  // `from`, each carrying a ciphertext for every node in the resolution of its
+  // copath child other than the `joiners`, so that every member can decrypt it
+  bool path_shape_valid(LeafIndex from,
+                        const UpdatePath& path,
+                        const std::vector<LeafIndex>& joiners) const;
   bool parent_hash_valid() const;
+  bool parent_hash_valid(const TreeHashOptions& opts) const;
+
+  // Check the parent hashes of only the parent nodes on the direct path of
+  // `leaf`, e.g., to trust the part of the tree that a member depends on before
+  // the rest of it has been checked.  The tree hashes must be set.
+  bool direct_path_parent_hash_valid(LeafIndex leaf) const;
+
+  // Verify the signatures on all leaves, in batches on the executor
+  bool leaf_signatures_valid(const bytes& group_id,
+                             const Executor& executor) const;
+
+  // Extract the slice of the tree for a member.  The tree hashes must be set.
+  TreeSlice slice(LeafIndex index) const;
 
   bool has_leaf(LeafIndex index) const;
   std::optional<LeafIndex> find(const LeafNode& leaf) const;
+
+  // Lookups over the leaves, answered from indexes that are built on first
+  // use and kept up to date as the tree changes.  Leaves equal to `except` are
+  // left out, e.g., when checking the leaf that is to replace it.
+  bool has_encryption_key(const HPKEPublicKey& key,
+                          std::optional<LeafIndex> except) const;
+  bool has_signature_key(const SignaturePublicKey& key,
+                         std::optional<LeafIndex> except) const;
+
+  // Whether `capabilities` covers every credential type in use, and whether
+  // every member supports credentials of type `type`
+  bool credentials_supported(const Capabilities& capabilities,
+                             std::optional<LeafIndex> except) const;
+  bool credential_supported_by_all(CredentialType type,
+                                   std::optional<LeafIndex> except) const;
+
+  // The extension, proposal and credential types that every member supports,
+  // from counts kept alongside the lookups above, so that checking a change to
+  // the group's extensions does not visit every leaf.  The versions and cipher
+  // suites are left empty.
+  Capabilities common_capabilities() const;
+
+  // Give up this tree's share of the lookup indexes, so that a copy that is
+  // about to be changed, such as the tree of the next epoch, can update them
+  // in place rather than copying them.  This tree rebuilds them if it needs
+  // them again.
+  void release_lookups() const;
+
+  // leaf_node() returns a copy of the leaf, while leaf_node_ptr() refers into
+  // the tree and returns nullptr for a blank leaf.  The pointer is valid until
+  // the tree changes.
   std::optional<LeafNode> leaf_node(LeafIndex index) const;
+  const LeafNode* leaf_node_ptr(LeafIndex index) const;
+  LeafView leaves() const;
+
+  // The resolution of a node.  Where the node's hash is set, the second form
+  // returns the cached resolution by reference, valid until the tree changes;
+  // otherwise it computes the resolution into `scratch` and returns that.
   std::vector<NodeIndex> resolve(NodeIndex index) const;
+  const std::vector<NodeIndex>& resolve(NodeIndex index,
+                                        std::vector<NodeIndex>& scratch) const;
 
   using FilteredDirectPath =
     std::vector<std::tuple<NodeIndex, std::vector<NodeIndex>>>;
@@ -151,25 +318,151 @@ struct TreeKEMPublicKey
     const std::vector<LeafIndex>& except,
     const LeafNodeOptions& opts);
 
+  // The HPKE encryptions of path secrets are independent of each other, so
+  // they can be spread across an executor.  The resulting UpdatePath is the
+  // same as when they are done serially.
+  std::tuple<TreeKEMPrivateKey, UpdatePath> encap(
+    LeafIndex from,
+    const bytes& group_id,
+    const bytes& context,
+    const bytes& leaf_secret,
+    const SignaturePrivateKey& sig_priv,
+    const std::vector<LeafIndex>& except,
+    const LeafNodeOptions& opts,
+    const Executor& executor);
+
   void truncate();
 
-  OptionalNode& node_at(NodeIndex n);
-  const OptionalNode& node_at(NodeIndex n) const;
-  OptionalNode& node_at(LeafIndex n);
-  const OptionalNode& node_at(LeafIndex n) const;
+  // A compact encoding of the tree, for carrying it in a Welcome or GroupInfo.
+  // Runs of blank nodes are replaced by their length, node types are implied
+  // by position, and the capabilities and extensions of a leaf, which are
+  // usually the same for many leaves, are replaced by a reference to the
+  // first leaf that had them.  The decoder reads nodes straight into the tree.
+  //
+  // struct {
+  //   CompressedNode nodes<V>;   // the present nodes, in order, then the
+  //                              // number of blank nodes after the last one
+  // } CompressedTree;
+  //
+  // struct {
+  //   varint blanks;             // blank nodes before this one
+  //   select (position) {
+  //     case leaf:   CompressedLeafNode;
+  //     case parent: ParentNode;
+  //   };
+  // } CompressedNode;
+  //
+  // struct {
+  //   HPKEPublicKey encryption_key;
+  //   SignaturePublicKey signature_key;
+  //   Credential credential;
+  //   varint profile;            // 0 if new, else 1 + index of an earlier one
+  //   select (profile) {
+  //     case 0: Capabilities capabilities; Extension extensions<V>;
+  //   };
+  //   LeafNodeSource leaf_node_source;
+  //   select (leaf_node_source) { ... as in LeafNode ... };
+  //   opaque signature<V>;
+  // } CompressedLeafNode;
+  //
+  // So that a small message cannot make the decoder allocate a large tree, a
+  // tree may have at most `max_compressed_expansion` nodes for each present
+  // node up to that point, including the blank nodes at the end of the tree.
+  // compressible() reports whether a tree meets these limits; one that does
+  // not has to be sent in the plain encoding.
+  static constexpr size_t max_compressed_expansion = 64;
+  bool compressible() const;
+  void write_compressed(tls::ostream& str) const;
+  void read_compressed(tls::istream& str);
+
+  // The storage held by the tree, for monitoring memory use.  Storage that is
+  // shared with copies of the tree is counted in full by each copy, and the
+  // size of a node's heap allocations is estimated from its keys and hashes.
+  struct MemoryUsage
+  {
+    size_t nodes = 0;
+    size_t cached_hashes = 0;
+    size_t bytes = 0;
+  };
+
+  MemoryUsage memory_usage() const;
 
-  TLS_SERIALIZABLE(nodes)
+  // Nodes are assembled on demand from the underlying arrays, so these return
+  // copies.  Nodes beyond the end of the tree are blank.
+  OptionalNode node_at(NodeIndex n) const;
+  OptionalNode node_at(LeafIndex n) const;
 
 #if ENABLE_TREE_DUMP
   void dump() const;
 #endif
 
 private:
-  std::map<NodeIndex, bytes> hashes;
+  // Nodes are stored as a struct of arrays rather than as a vector of
+  // OptionalNode.  A bitmap records which nodes are present, so a blank node
+  // costs one bit plus empty, unallocated slots in the other arrays.  Leaf
+  // payloads are indexed by LeafIndex, and the fields of parent nodes by the
+  // parent's position among the parent nodes, i.e., NodeIndex / 2.
+  //
+  // The arrays are copy-on-write, so copies of a tree (e.g., in successive
+  // epochs of a State) share storage except for the chunks that have been
+  // modified since the copy was made.
+  //
+  // Each leaf's encoding is kept alongside it, as read off the wire when the
+  // tree is decoded, or as marshaled once when the leaf is set.  Hashing and
+  // encoding the tree copy these bytes rather than re-marshaling the leaves.
+  std::vector<bool> node_present;
+  CowVector<LeafNode> leaf_payloads;
+  CowVector<bytes> leaf_encodings;
+  CowVector<HPKEPublicKey> parent_keys;
+  CowVector<bytes> parent_hash_values;
+  CowVector<std::vector<LeafIndex>> parent_unmerged;
+
+  // Which leaves are present, kept alongside node_present so that add_leaf()
+  // can find the leftmost blank leaf without scanning the tree
+  LeafBitmap leaf_present;
+
+  // Indexes over the leaves for the lookups above.  They are built on first
+  // use, updated in place while the tree holds the only reference, and
+  // copied before being changed when they are shared with a copy of the tree.
+  struct LeafLookup;
+  mutable std::shared_ptr<LeafLookup> leaf_lookup;
+  std::shared_ptr<const LeafLookup> lookup() const;
+  LeafLookup* mutable_lookup();
+  void lookup_remove(LeafIndex index);
+  void lookup_add(LeafIndex index);
+
+  size_t width() const;
+  void resize_nodes(size_t width);
+  bool blank_at(NodeIndex n) const;
+  LeafIndex leftmost_blank_leaf() const;
+  const LeafNode& leaf_at(LeafIndex n) const;
+  const HPKEPublicKey& public_key_at(NodeIndex n) const;
+  const std::vector<LeafIndex>& unmerged_at(NodeIndex n) const;
+  void set_leaf(LeafIndex n, LeafNode leaf);
+  void set_leaf(LeafIndex n, LeafNode leaf, bytes encoding);
+  void set_parent(NodeIndex n, ParentNode parent);
+  void clear_node(NodeIndex n);
+
+  // Tree hashes are cached in a flat array of fixed-width digests indexed by
+  // NodeIndex, together with a bitmap marking which entries are valid.  The
+  // resolution of a node depends on the same subtree as its hash, so
+  // resolutions are cached alongside and share the validity bitmap.
+  CowVector<uint8_t> hash_data;
+  std::vector<bool> hash_valid;
+  CowVector<std::vector<NodeIndex>> resolutions;
 
   void clear_hash_all();
   void clear_hash_path(LeafIndex index);
-  const bytes& get_hash(NodeIndex index);
+  void clear_hash_paths(const std::vector<LeafIndex>& indices);
+  bool has_hash(NodeIndex index) const;
+  bytes cached_hash(NodeIndex index) const;
+  void reserve_hashes(size_t count);
+  void set_hash(NodeIndex index, const bytes& hash, bool mark_valid);
+  bytes get_hash(NodeIndex index);
+  bytes get_hash(NodeIndex index, bool mark_valid);
+  std::vector<NodeIndex> subtree_roots(uint32_t depth) const;
+  std::vector<NodeIndex> node_resolution(NodeIndex index) const;
+  void append_resolution(NodeIndex index, std::vector<NodeIndex>& out) const;
 
   bool has_parent_hash(NodeIndex child, const bytes& target_ph) const;
 
@@ -179,19 +472,44 @@ private:
     const FilteredDirectPath& fdp,
     const std::vector<UpdatePathNode>& path_nodes) const;
 
-  using TreeHashCache = std::map<NodeIndex, std::pair<size_t, bytes>>;
-  const bytes& original_tree_hash(TreeHashCache& cache,
-                                  NodeIndex index,
-                                  std::vector<LeafIndex> parent_except) const;
-  bytes original_parent_hash(TreeHashCache& cache,
+  // The second half of merge(), for a path whose filtered direct path and
+  // parent hashes have already been computed, as encap() has them to hand
+  void merge(LeafIndex from,
+             const UpdatePath& path,
+             const FilteredDirectPath& fdp,
+             const std::vector<bytes>& ph);
+
+  // Original tree hashes, keyed on the node and the sorted list of leaves
+  // excluded below it.  The cache is kept until the tree next changes, so it
+  // serves every parent hash check on the same tree.  Like the leaf lookup, it
+  // is shared between copies of an unchanged tree.
+  struct OriginalHashCache;
+  mutable std::shared_ptr<OriginalHashCache> original_hashes;
+  std::shared_ptr<OriginalHashCache> original_hash_cache() const;
+
+  bytes original_tree_hash(OriginalHashCache& cache,
+                           NodeIndex index,
+                           const std::vector<LeafIndex>& parent_except) const;
+  bytes original_parent_hash(OriginalHashCache& cache,
                              NodeIndex parent,
                              NodeIndex sibling) const;
-
-  OptionalNode blank_node;
+  bool parent_hash_valid(NodeIndex subtree, uint32_t min_level) const;
+  bool parent_node_valid(OriginalHashCache& cache, NodeIndex parent) const;
 
   friend struct TreeKEMPrivateKey;
+  friend class LeafView;
+  friend tls::ostream& operator<<(tls::ostream& str,
+                                  const TreeKEMPublicKey& obj);
+  friend tls::istream& operator>>(tls::istream& str, TreeKEMPublicKey& obj);
+  friend bool operator==(const TreeKEMPublicKey& lhs,
+                         const TreeKEMPublicKey& rhs);
 };
 
+bool
+operator==(const TreeKEMPublicKey& lhs, const TreeKEMPublicKey& rhs);
+bool
+operator!=(const TreeKEMPublicKey& lhs, const TreeKEMPublicKey& rhs);
+
 tls::ostream&
 operator<<(tls::ostream& str, const TreeKEMPublicKey& obj);
 tls::istream&
@@ -0,0 +1,128 @@
+#include <benchmark/benchmark.h>
+#include <bytes/bytes.h>
+
+#include <cstring>
+
+using namespace bytes_ns;
+
+// Each operation on bytes is measured next to the same operation on a plain
+// std::vector<uint8_t>, which is what bytes wraps.  Comparison in bytes is
+// constant-time, so it is expected to cost more than memcmp on unequal
+// inputs; the baseline shows by how much.
+
+static constexpr int64_t min_size = 16;
+static constexpr int64_t max_size = int64_t(1) << 20;
+static constexpr int size_multiplier = 16;
+
+static void
+bench_equal(benchmark::State& bench)
+{
+  const auto size = static_cast<size_t>(bench.range(0));
+  const auto lhs = bytes(size, 0xa0);
+  const auto rhs = bytes(size, 0xa0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto equal = (lhs == rhs);
+    benchmark::DoNotOptimize(equal);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_memcmp(benchmark::State& bench)
+{
+  const auto size = static_cast<size_t>(bench.range(0));
+  const auto lhs = std::vector<uint8_t>(size, 0xa0);
+  const auto rhs = std::vector<uint8_t>(size, 0xa0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto equal = (std::memcmp(lhs.data(), rhs.data(), size) == 0);
+    benchmark::DoNotOptimize(equal);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_less(benchmark::State& bench)
+{
+  const auto size = static_cast<size_t>(bench.range(0));
+  const auto lhs = bytes(size, 0xa0);
+  auto rhs = bytes(size, 0xa0);
+  rhs.at(size - 1) = 0xa1;
+  for ([[maybe_unused]] auto _ : bench) {
+    auto less = (lhs < rhs);
+    benchmark::DoNotOptimize(less);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_vector_less(benchmark::State& bench)
+{
+  const auto size = static_cast<size_t>(bench.range(0));
+  const auto lhs = std::vector<uint8_t>(size, 0xa0);
+  auto rhs = std::vector<uint8_t>(size, 0xa0);
+  rhs.at(size - 1) = 0xa1;
+  for ([[maybe_unused]] auto _ : bench) {
+    auto less = (lhs < rhs);
+    benchmark::DoNotOptimize(less);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+// Two halves of the given total size
+static void
+bench_concat(benchmark::State& bench)
+{
+  const auto size = static_cast<size_t>(bench.range(0)) / 2;
+  const auto lhs = bytes(size, 0xa0);
+  const auto rhs = bytes(size, 0xb0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto out = lhs + rhs;
+    benchmark::DoNotOptimize(out);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_vector_concat(benchmark::State& bench)
+{
+  const auto size = static_cast<size_t>(bench.range(0)) / 2;
+  const auto lhs = std::vector<uint8_t>(size, 0xa0);
+  const auto rhs = std::vector<uint8_t>(size, 0xb0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto out = std::vector<uint8_t>{};
+    out.reserve(lhs.size() + rhs.size());
+    out.insert(out.end(), lhs.begin(), lhs.end());
+    out.insert(out.end(), rhs.begin(), rhs.end());
+    benchmark::DoNotOptimize(out);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+// Results can be written in a machine-readable form with the usual Google
+// Benchmark flags, e.g.:
+//
+//   bytes_bench --benchmark_out=bytes.json --benchmark_out_format=json
+int
+main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+
+  // clang-format off
+  benchmark::RegisterBenchmark("equal/bytes", bench_equal)
+    ->RangeMultiplier(size_multiplier)->Range(min_size, max_size);
+  benchmark::RegisterBenchmark("equal/memcmp", bench_memcmp)
+    ->RangeMultiplier(size_multiplier)->Range(min_size, max_size);
+  benchmark::RegisterBenchmark("less/bytes", bench_less)
+    ->RangeMultiplier(size_multiplier)->Range(min_size, max_size);
+  benchmark::RegisterBenchmark("less/vector", bench_vector_less)
+    ->RangeMultiplier(size_multiplier)->Range(min_size, max_size);
+  benchmark::RegisterBenchmark("concat/bytes", bench_concat)
+    ->RangeMultiplier(size_multiplier)->Range(min_size, max_size);
+  benchmark::RegisterBenchmark("concat/vector", bench_vector_concat)
+    ->RangeMultiplier(size_multiplier)->Range(min_size, max_size);
+  // clang-format on
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <bytes/secure_memory.h>
+#include <functional>
 #include <string>
 #include <tls/tls_syntax.h>
 #include <vector>
 
 namespace bytes_ns {
 
+struct bytes_view;
+
 struct bytes
 {
   // Ensure defaults
@@ -16,7 +20,7 @@ struct bytes
   bytes& operator=(bytes&&) = default;
 
   // Zeroize on drop
-  ~bytes() { std::fill(_data.begin(), _data.end(), uint8_t(0)); }
+  ~bytes() { secure_wipe(_data.data(), _data.size()); }
 
   // Mimic std::vector ctors
   bytes(size_t count, const uint8_t& value = 0)
@@ -50,10 +54,13 @@ struct bytes
   }
 
   bytes(std::vector<uint8_t>&& vec)
-    : _data(vec)
+    : _data(std::move(vec))
   {
   }
 
+  // Copy out the contents of a view
+  explicit bytes(bytes_view view);
+
   operator const std::vector<uint8_t>&() const { return _data; }
   operator std::vector<uint8_t>&() { return _data; }
   operator std::vector<uint8_t>&&() && { return std::move(_data); }
@@ -106,6 +113,50 @@ private:
   std::vector<uint8_t> _data;
 };
 
+// A non-owning view of a contiguous range of bytes, which can be passed where
+// a copy of the data is not needed.  The underlying data must outlive the view.
+struct bytes_view
+{
+  bytes_view() = default;
+
+  bytes_view(const uint8_t* data, size_t size)
+    : _data(data)
+    , _size(size)
+  {
+  }
+
+  bytes_view(const std::vector<uint8_t>& vec)
+    : bytes_view(vec.data(), vec.size())
+  {
+  }
+
+  bytes_view(const bytes& data)
+    : bytes_view(data.data(), data.size())
+  {
+  }
+
+  template<size_t N>
+  bytes_view(const std::array<uint8_t, N>& data)
+    : bytes_view(data.data(), data.size())
+  {
+  }
+
+  // Slice out sub-views without copying
+  bytes_view slice(size_t begin_index, size_t end_index) const;
+
+  const uint8_t* data() const { return _data; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  const uint8_t* begin() const { return _data; }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  const uint8_t* end() const { return _data + _size; }
+
+private:
+  const uint8_t* _data = nullptr;
+  size_t _size = 0;
+};
+
 bytes
 from_ascii(const std::string& ascii);
 
@@ -116,3 +167,14 @@ bytes
 from_hex(const std::string& hex);
 
 } // namespace bytes_ns
+
+namespace std {
+
+// Hashing, to allow usage as unordered_map keys
+template<>
+struct hash<bytes_ns::bytes>
+{
+  size_t operator()(const bytes_ns::bytes& data) const;
+};
+
+} // namespace std
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <vector>
+
+namespace bytes_ns {
+
+// Overwrite memory with zeros, in a way that the compiler cannot remove even
+// when the memory is about to be freed
+void
+secure_wipe(void* ptr, size_t size);
+
+// Memory set aside for secrets.  Small allocations are served from pools of
+// fixed-size blocks, one pool per power-of-two size class, so that deriving a
+// secret does not go to the general-purpose heap.  Each pool grows in arenas
+// of whole pages, which are locked into memory where the platform allows it,
+// to keep them out of swap, and which sit between inaccessible guard pages.
+// Larger allocations get arenas of their own.  Memory is wiped as it is
+// returned to a pool.
+//
+// Where pages cannot be mapped this way, the global heap is used instead, with
+// the same wiping on free.
+//
+// Only state that is held for a long time and touched on its own is kept here,
+// i.e., the DRBG's key and buffer (see hpke/random.h).  The secrets of the MLS
+// key schedule, the secret tree, the hash ratchets and TreeKEM private keys
+// are `bytes`, which pass through the KDF and HPKE interfaces as ordinary
+// vectors; they are wiped with secure_wipe() when dropped, but are not pooled
+// or locked.
+namespace secure_memory {
+
+void*
+allocate(size_t size);
+
+void
+deallocate(void* ptr, size_t size);
+
+struct Stats
+{
+  size_t arenas = 0;         // Arenas mapped, including large allocations
+  size_t blocks_in_use = 0;  // Allocations not yet freed
+  size_t locked_bytes = 0;   // Bytes locked into memory
+};
+
+Stats
+stats();
+
+} // namespace secure_memory
+
+template<typename T>
+struct SecureAllocator
+{
+  using value_type = T;
+
+  SecureAllocator() = default;
+
+  template<typename U>
+  SecureAllocator(const SecureAllocator<U>& /* unused */)
+  {
+  }
+
+  T* allocate(size_t n)
+  {
+    if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+      throw std::bad_array_new_length();
+    }
+
+    return static_cast<T*>(secure_memory::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n)
+  {
+    secure_memory::deallocate(ptr, n * sizeof(T));
+  }
+
+  template<typename U>
+  bool operator==(const SecureAllocator<U>& /* unused */) const
+  {
+    return true;
+  }
+
+  template<typename U>
+  bool operator!=(const SecureAllocator<U>& /* unused */) const
+  {
+    return false;
+  }
+};
+
+using secure_vector = std::vector<uint8_t, SecureAllocator<uint8_t>>;
+
+} // namespace bytes_ns
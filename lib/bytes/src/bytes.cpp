@@ -1,12 +1,139 @@
 #include <bytes/bytes.h>
 
+#include <array>
+#include <cstdint>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace bytes_ns {
 
+///
+/// Comparison and XOR kernels
+///
+
+// These work 16 bytes at a time with SSE2 or NEON, and otherwise 8 bytes at a
+// time, finishing with any leftover bytes one at a time.  Memory is accessed
+// with unaligned loads, or with memcpy, which compiles to the same thing.
+//
+// The comparison is constant-time for inputs of a given size: it always reads
+// all of both inputs, and folds their differences together before a single
+// test at the end.
+
+// NOLINTBEGIN(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+// NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+
+static uint64_t
+load_word(const uint8_t* ptr)
+{
+  auto word = uint64_t(0);
+  std::memcpy(&word, ptr, sizeof(word));
+  return word;
+}
+
+static void
+store_word(uint8_t* ptr, uint64_t word)
+{
+  std::memcpy(ptr, &word, sizeof(word));
+}
+
+static bool
+ct_equal(const uint8_t* lhs, const uint8_t* rhs, size_t size)
+{
+  auto i = size_t(0);
+  auto diff = uint64_t(0);
+
+#if defined(__SSE2__)
+  auto acc = _mm_setzero_si128();
+  for (; i + 16 <= size; i += 16) {
+    const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+    const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+    acc = _mm_or_si128(acc, _mm_xor_si128(a, b));
+  }
+
+  auto lanes = std::array<uint64_t, 2>{};
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes.data()), acc);
+  diff |= lanes[0] | lanes[1];
+#elif defined(__ARM_NEON)
+  auto acc = vdupq_n_u8(0);
+  for (; i + 16 <= size; i += 16) {
+    acc = vorrq_u8(acc, veorq_u8(vld1q_u8(lhs + i), vld1q_u8(rhs + i)));
+  }
+
+  const auto lanes = vreinterpretq_u64_u8(acc);
+  diff |= vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1);
+#endif
+
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    diff |= load_word(lhs + i) ^ load_word(rhs + i);
+  }
+
+  for (; i < size; i++) {
+    diff |= uint64_t(lhs[i] ^ rhs[i]);
+  }
+
+  return diff == 0;
+}
+
+static void
+xor_into(uint8_t* out, const uint8_t* rhs, size_t size)
+{
+  auto i = size_t(0);
+
+#if defined(__SSE2__)
+  for (; i + 16 <= size; i += 16) {
+    auto* dst = reinterpret_cast<__m128i*>(out + i);
+    const auto a = _mm_loadu_si128(dst);
+    const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+    _mm_storeu_si128(dst, _mm_xor_si128(a, b));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= size; i += 16) {
+    vst1q_u8(out + i, veorq_u8(vld1q_u8(out + i), vld1q_u8(rhs + i)));
+  }
+#endif
+
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    store_word(out + i, load_word(out + i) ^ load_word(rhs + i));
+  }
+
+  for (; i < size; i++) {
+    out[i] ^= rhs[i];
+  }
+}
+
+// NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+// NOLINTEND(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+///
+/// bytes and bytes_view
+///
+
+bytes::bytes(bytes_view view)
+  : _data(view.begin(), view.end())
+{
+}
+
+bytes_view
+bytes_view::slice(size_t begin_index, size_t end_index) const
+{
+  if (begin_index > end_index || end_index > _size) {
+    throw std::out_of_range("Slice out of range");
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  return { _data + begin_index, end_index - begin_index };
+}
+
 bool
 bytes::operator==(const bytes& other) const
 {
@@ -22,18 +149,11 @@ bytes::operator!=(const bytes& other) const
 bool
 bytes::operator==(const std::vector<uint8_t>& other) const
 {
-  const size_t size = other.size();
-  if (_data.size() != size) {
+  if (_data.size() != other.size()) {
     return false;
   }
 
-  unsigned char diff = 0;
-  for (size_t i = 0; i < size; ++i) {
-    // Not sure why the linter thinks `diff` is signed
-    // NOLINTNEXTLINE(hicpp-signed-bitwise)
-    diff |= (_data.at(i) ^ other.at(i));
-  }
-  return (diff == 0);
+  return ct_equal(_data.data(), other.data(), other.size());
 }
 
 bool
@@ -73,9 +193,7 @@ bytes::operator^(const bytes& rhs) const
   }
 
   bytes out = *this;
-  for (size_t i = 0; i < size(); ++i) {
-    out.at(i) ^= rhs.at(i);
-  }
+  xor_into(out.data(), rhs.data(), rhs.size());
   return out;
 }
 
@@ -138,3 +256,15 @@ operator!=(const std::vector<uint8_t>& lhs, const bytes_ns::bytes& rhs)
 }
 
 } // namespace bytes_ns
+
+namespace std {
+
+size_t
+hash<bytes_ns::bytes>::operator()(const bytes_ns::bytes& data) const
+{
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+  const auto* chars = reinterpret_cast<const char*>(data.data());
+  return std::hash<std::string_view>{}(std::string_view(chars, data.size()));
+}
+
+} // namespace std
@@ -0,0 +1,264 @@
+#include <bytes/secure_memory.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BYTES_SECURE_MMAP 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace bytes_ns {
+
+void
+secure_wipe(void* ptr, size_t size)
+{
+  if (ptr == nullptr || size == 0) {
+    return;
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  // The empty assembly statement claims to read the memory, so the compiler
+  // has to perform the memset before it
+  std::memset(ptr, 0, size);
+  asm volatile("" : : "r"(ptr) : "memory");
+#else
+  auto* volatile_ptr = static_cast<volatile uint8_t*>(ptr);
+  for (size_t i = 0; i < size; i++) {
+    volatile_ptr[i] = 0;
+  }
+#endif
+}
+
+namespace secure_memory {
+
+class SecureHeap
+{
+public:
+  void* allocate(size_t size)
+  {
+    const auto lock = std::lock_guard(mutex);
+
+    const auto cls = size_class(size);
+    if (cls == class_count) {
+      return allocate_large(size);
+    }
+
+    auto& blocks = free_blocks.at(cls);
+    if (blocks.empty()) {
+      grow(cls);
+    }
+
+    if (blocks.empty()) {
+      // No arena could be mapped, so fall back to the heap
+      current.blocks_in_use += 1;
+      return ::operator new(block_size(cls));
+    }
+
+    auto* block = blocks.back();
+    blocks.pop_back();
+    current.blocks_in_use += 1;
+    return block;
+  }
+
+  void deallocate(void* ptr, size_t size)
+  {
+    if (ptr == nullptr) {
+      return;
+    }
+
+    const auto cls = size_class(size);
+    secure_wipe(ptr, cls == class_count ? size : block_size(cls));
+
+    const auto lock = std::lock_guard(mutex);
+    current.blocks_in_use -= 1;
+
+    if (!in_arena(ptr)) {
+      ::operator delete(ptr);
+      return;
+    }
+
+    if (cls == class_count) {
+      unmap_arena(ptr, round_to_pages(size));
+      return;
+    }
+
+    free_blocks.at(cls).push_back(ptr);
+  }
+
+  Stats stats()
+  {
+    const auto lock = std::lock_guard(mutex);
+    return current;
+  }
+
+private:
+  // Size classes run from 16 bytes to 2 KiB, and each pool grows by 64 KiB
+  static constexpr size_t min_block = 16;
+  static constexpr size_t class_count = 8;
+  static constexpr size_t arena_size = size_t(64) * 1024;
+
+  std::mutex mutex;
+  std::array<std::vector<void*>, class_count> free_blocks;
+  std::map<uintptr_t, size_t> arenas; // Data start -> data size
+  Stats current;
+
+  static size_t block_size(size_t cls) { return min_block << cls; }
+
+  static size_t size_class(size_t size)
+  {
+    auto cls = size_t(0);
+    while (cls < class_count && block_size(cls) < size) {
+      cls += 1;
+    }
+    return cls;
+  }
+
+  static size_t page_size()
+  {
+#if defined(BYTES_SECURE_MMAP)
+    static const auto size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+#else
+    return 4096;
+#endif
+  }
+
+  static size_t round_to_pages(size_t size)
+  {
+    const auto page = page_size();
+    return ((size + page - 1) / page) * page;
+  }
+
+  bool in_arena(void* ptr) const
+  {
+    const auto addr = reinterpret_cast<uintptr_t>(ptr); // NOLINT
+    auto it = arenas.upper_bound(addr);
+    if (it == arenas.begin()) {
+      return false;
+    }
+
+    --it;
+    return addr < it->first + it->second;
+  }
+
+  // Map `size` bytes of data, which must be a whole number of pages, between
+  // two guard pages
+  void* map_arena(size_t size)
+  {
+#if defined(BYTES_SECURE_MMAP)
+    const auto page = page_size();
+    const auto total = size + 2 * page;
+    auto* base = mmap(nullptr,
+                      total,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1,
+                      0);
+    if (base == MAP_FAILED) {
+      return nullptr;
+    }
+
+    auto* data = static_cast<uint8_t*>(base) + page; // NOLINT
+    auto* tail = data + size;                        // NOLINT
+    if (mprotect(base, page, PROT_NONE) != 0 ||
+        mprotect(tail, page, PROT_NONE) != 0) {
+      munmap(base, total);
+      return nullptr;
+    }
+
+    // Locking may fail under a low RLIMIT_MEMLOCK; the memory is still used
+    if (mlock(data, size) == 0) {
+      current.locked_bytes += size;
+    }
+
+#if defined(MADV_DONTDUMP)
+    madvise(data, size, MADV_DONTDUMP);
+#endif
+
+    arenas.emplace(reinterpret_cast<uintptr_t>(data), size); // NOLINT
+    current.arenas += 1;
+    return data;
+#else
+    (void)size;
+    return nullptr;
+#endif
+  }
+
+  void unmap_arena(void* data, size_t size)
+  {
+#if defined(BYTES_SECURE_MMAP)
+    const auto page = page_size();
+    if (munlock(data, size) == 0) {
+      current.locked_bytes -= std::min(current.locked_bytes, size);
+    }
+
+    arenas.erase(reinterpret_cast<uintptr_t>(data)); // NOLINT
+    current.arenas -= 1;
+    munmap(static_cast<uint8_t*>(data) - page, size + 2 * page); // NOLINT
+#else
+    (void)data;
+    (void)size;
+#endif
+  }
+
+  void grow(size_t cls)
+  {
+    auto* data = static_cast<uint8_t*>(map_arena(arena_size));
+    if (data == nullptr) {
+      return;
+    }
+
+    const auto size = block_size(cls);
+    auto& blocks = free_blocks.at(cls);
+    for (size_t offset = arena_size; offset >= size; offset -= size) {
+      blocks.push_back(data + offset - size); // NOLINT
+    }
+  }
+
+  void* allocate_large(size_t size)
+  {
+    current.blocks_in_use += 1;
+    auto* data = map_arena(round_to_pages(size));
+    if (data == nullptr) {
+      return ::operator new(size);
+    }
+    return data;
+  }
+};
+
+// The heap is never destroyed, so that secrets in static storage can still be
+// freed to it during shutdown
+static SecureHeap&
+heap()
+{
+  // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+  static auto* instance = new SecureHeap();
+  return *instance;
+}
+
+void*
+allocate(size_t size)
+{
+  return heap().allocate(size == 0 ? 1 : size);
+}
+
+void
+deallocate(void* ptr, size_t size)
+{
+  heap().deallocate(ptr, size == 0 ? 1 : size);
+}
+
+Stats
+stats()
+{
+  return heap().stats();
+}
+
+} // namespace secure_memory
+} // namespace bytes_ns
@@ -1,6 +1,9 @@
 #include <bytes/bytes.h>
+#include <bytes/secure_memory.h>
 #include <doctest/doctest.h>
+#include <algorithm>
 #include <sstream>
+#include <unordered_map>
 
 using namespace bytes_ns;
 using namespace std::literals::string_literals;
@@ -57,3 +60,123 @@ TEST_CASE("Operators")
   ss << lhs << rhs;
   REQUIRE(ss.str() == to_hex(added));
 }
+
+TEST_CASE("Comparison and XOR at all lengths")
+{
+  // Cover the vector, word and byte steps, and each way of mixing them
+  for (size_t size = 0; size <= 40; size++) {
+    auto lhs = bytes(size);
+    auto rhs = bytes(size);
+    auto expected = bytes(size);
+    for (size_t i = 0; i < size; i++) {
+      lhs.at(i) = static_cast<uint8_t>(3 * i + 1);
+      rhs.at(i) = static_cast<uint8_t>(7 * i + 5);
+      expected.at(i) = static_cast<uint8_t>(lhs.at(i) ^ rhs.at(i));
+    }
+
+    REQUIRE((lhs ^ rhs) == expected);
+    REQUIRE(lhs == bytes(lhs));
+
+    // A difference in any one position is found
+    for (size_t i = 0; i < size; i++) {
+      auto changed = lhs;
+      changed.at(i) ^= 0x80;
+      REQUIRE(changed != lhs);
+    }
+  }
+
+  REQUIRE(bytes(3) != bytes(4));
+  REQUIRE_THROWS_AS(bytes(3) ^ bytes(4), std::invalid_argument);
+}
+
+TEST_CASE("Hashing")
+{
+  const auto data = from_hex("00010203");
+  const auto hash = std::hash<bytes>{};
+  REQUIRE(hash(data) == hash(from_hex("00010203")));
+
+  auto map = std::unordered_map<bytes, int>{};
+  map[data] = 1;
+  map[from_hex("0001020304")] = 2;
+  REQUIRE(map.at(from_hex("00010203")) == 1);
+  REQUIRE(map.count(from_hex("000102")) == 0);
+}
+
+TEST_CASE("Move from vector")
+{
+  auto vec = std::vector<uint8_t>{ 0x00, 0x01, 0x02, 0x03 };
+  const auto* data = vec.data();
+
+  const auto moved = bytes(std::move(vec));
+  REQUIRE(moved.data() == data);
+  REQUIRE(moved == from_hex("00010203"));
+}
+
+TEST_CASE("Views")
+{
+  const auto data = from_hex("0001020304050607");
+  const auto view = bytes_view(data);
+  REQUIRE(view.data() == data.data());
+  REQUIRE(view.size() == data.size());
+
+  const auto sub = view.slice(2, 5);
+  REQUIRE(sub.data() == data.data() + 2);
+  REQUIRE(bytes(sub) == from_hex("020304"));
+  REQUIRE(view.slice(3, 3).empty());
+
+  REQUIRE_THROWS_AS(view.slice(5, 9), std::out_of_range);
+  REQUIRE_THROWS_AS(view.slice(5, 2), std::out_of_range);
+}
+
+TEST_CASE("Secure memory")
+{
+  const auto before = secure_memory::stats();
+
+  // Small blocks come from pools, and freed blocks are reused
+  const void* first_data = nullptr;
+  {
+    auto secret = secure_vector(32, 0xa5);
+    first_data = secret.data();
+    REQUIRE(secret == secure_vector(32, 0xa5));
+    REQUIRE(secure_memory::stats().blocks_in_use ==
+            before.blocks_in_use + 1);
+    REQUIRE(secure_memory::stats().arenas > 0);
+  }
+
+  {
+    auto secret = secure_vector(20, 0x5a);
+    REQUIRE(secret.data() == first_data);
+  }
+
+  // Growing a vector moves it between size classes, and allocations too
+  // large for any class get arenas of their own
+  auto grown = secure_vector{};
+  for (size_t i = 0; i < 10000; i++) {
+    grown.push_back(static_cast<uint8_t>(i));
+  }
+  for (size_t i = 0; i < grown.size(); i++) {
+    REQUIRE(grown.at(i) == static_cast<uint8_t>(i));
+  }
+
+  const auto arenas = secure_memory::stats().arenas;
+  grown = secure_vector{};
+  REQUIRE(secure_memory::stats().arenas <= arenas);
+  REQUIRE(secure_memory::stats().blocks_in_use == before.blocks_in_use);
+
+  // A count whose size in bytes would overflow is refused
+  auto wide = SecureAllocator<uint64_t>{};
+  const auto too_many = std::numeric_limits<size_t>::max() / 4;
+  REQUIRE_THROWS_AS(wide.allocate(too_many), std::bad_array_new_length);
+  REQUIRE(secure_memory::stats().blocks_in_use == before.blocks_in_use);
+}
+
+TEST_CASE("Secure wipe")
+{
+  auto data = std::vector<uint8_t>(100, 0xff);
+  secure_wipe(data.data(), 50);
+  REQUIRE(std::count(data.begin(), data.end(), uint8_t(0)) == 50);
+  REQUIRE(data.at(49) == 0);
+  REQUIRE(data.at(50) == 0xff);
+
+  secure_wipe(nullptr, 0);
+}
@@ -0,0 +1,213 @@
+#include "bench.h"
+
+#include <openssl/err.h>
+
+#include <vector>
+
+struct AEADParams
+{
+  AEAD::ID id;
+  const char* name;
+  const EVP_CIPHER* (*cipher)();
+};
+
+static const auto aeads = std::vector<AEADParams>{
+  { AEAD::ID::AES_128_GCM, "AES_128_GCM", EVP_aes_128_gcm },
+  { AEAD::ID::AES_256_GCM, "AES_256_GCM", EVP_aes_256_gcm },
+  { AEAD::ID::CHACHA20_POLY1305,
+    "CHACHA20_POLY1305",
+    EVP_chacha20_poly1305 },
+};
+
+// From a short application message up to a large one
+static constexpr int64_t min_size = 16;
+static constexpr int64_t max_size = int64_t(1) << 20;
+static constexpr int size_multiplier = 16;
+
+static constexpr size_t tag_size = 16;
+
+///
+/// Through the library
+///
+
+static void
+bench_seal(benchmark::State& bench, const AEADParams& params)
+{
+  const auto& aead = Backend::select(params.id);
+  const auto key = bytes(aead.key_size, 0xa0);
+  const auto nonce = bytes(aead.nonce_size, 0xb0);
+  const auto aad = bytes(32, 0xc0);
+  const auto pt = bytes(static_cast<size_t>(bench.range(0)), 0xd0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto ct = aead.seal(key, nonce, aad, pt);
+    benchmark::DoNotOptimize(ct);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_open(benchmark::State& bench, const AEADParams& params)
+{
+  const auto& aead = Backend::select(params.id);
+  const auto key = bytes(aead.key_size, 0xa0);
+  const auto nonce = bytes(aead.nonce_size, 0xb0);
+  const auto aad = bytes(32, 0xc0);
+  const auto pt = bytes(static_cast<size_t>(bench.range(0)), 0xd0);
+  const auto ct = aead.seal(key, nonce, aad, pt);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto out = aead.open(key, nonce, aad, ct);
+    benchmark::DoNotOptimize(out);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+///
+/// Directly with OpenSSL
+///
+
+using EVPCipherCtxPtr =
+  std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+static std::vector<uint8_t>
+openssl_seal(const EVP_CIPHER* cipher,
+             const std::vector<uint8_t>& key,
+             const std::vector<uint8_t>& nonce,
+             const std::vector<uint8_t>& aad,
+             const std::vector<uint8_t>& pt)
+{
+  auto ctx = EVPCipherCtxPtr(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+  auto ct = std::vector<uint8_t>(pt.size() + tag_size);
+  auto out_len = 0;
+  auto final_len = 0;
+  if (ctx == nullptr ||
+      1 != EVP_EncryptInit_ex(
+             ctx.get(), cipher, nullptr, key.data(), nonce.data()) ||
+      1 != EVP_EncryptUpdate(ctx.get(),
+                             nullptr,
+                             &out_len,
+                             aad.data(),
+                             static_cast<int>(aad.size())) ||
+      1 != EVP_EncryptUpdate(ctx.get(),
+                             ct.data(),
+                             &out_len,
+                             pt.data(),
+                             static_cast<int>(pt.size())) ||
+      1 != EVP_EncryptFinal_ex(ctx.get(), ct.data() + out_len, &final_len) ||
+      1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
+                               EVP_CTRL_AEAD_GET_TAG,
+                               static_cast<int>(tag_size),
+                               ct.data() + pt.size())) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  return ct;
+}
+
+static bool
+openssl_open(const EVP_CIPHER* cipher,
+             const std::vector<uint8_t>& key,
+             const std::vector<uint8_t>& nonce,
+             const std::vector<uint8_t>& aad,
+             const std::vector<uint8_t>& ct,
+             std::vector<uint8_t>& pt)
+{
+  const auto pt_size = ct.size() - tag_size;
+  auto* tag = const_cast<uint8_t*>(ct.data() + pt_size); // NOLINT
+  auto ctx = EVPCipherCtxPtr(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+  pt.resize(pt_size);
+  auto out_len = 0;
+  auto final_len = 0;
+  if (ctx == nullptr ||
+      1 != EVP_DecryptInit_ex(
+             ctx.get(), cipher, nullptr, key.data(), nonce.data()) ||
+      1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
+                               EVP_CTRL_AEAD_SET_TAG,
+                               static_cast<int>(tag_size),
+                               tag) ||
+      1 != EVP_DecryptUpdate(ctx.get(),
+                             nullptr,
+                             &out_len,
+                             aad.data(),
+                             static_cast<int>(aad.size())) ||
+      1 != EVP_DecryptUpdate(ctx.get(),
+                             pt.data(),
+                             &out_len,
+                             ct.data(),
+                             static_cast<int>(pt_size))) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  return 1 == EVP_DecryptFinal_ex(ctx.get(), pt.data() + out_len, &final_len);
+}
+
+static void
+bench_openssl_seal(benchmark::State& bench, const AEADParams& params)
+{
+  const auto* cipher = params.cipher();
+  const auto key = std::vector<uint8_t>(
+    static_cast<size_t>(EVP_CIPHER_key_length(cipher)), 0xa0);
+  const auto nonce = std::vector<uint8_t>(
+    static_cast<size_t>(EVP_CIPHER_iv_length(cipher)), 0xb0);
+  const auto aad = std::vector<uint8_t>(32, 0xc0);
+  const auto pt =
+    std::vector<uint8_t>(static_cast<size_t>(bench.range(0)), 0xd0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto ct = openssl_seal(cipher, key, nonce, aad, pt);
+    benchmark::DoNotOptimize(ct);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+static void
+bench_openssl_open(benchmark::State& bench, const AEADParams& params)
+{
+  const auto* cipher = params.cipher();
+  const auto key = std::vector<uint8_t>(
+    static_cast<size_t>(EVP_CIPHER_key_length(cipher)), 0xa0);
+  const auto nonce = std::vector<uint8_t>(
+    static_cast<size_t>(EVP_CIPHER_iv_length(cipher)), 0xb0);
+  const auto aad = std::vector<uint8_t>(32, 0xc0);
+  const auto pt =
+    std::vector<uint8_t>(static_cast<size_t>(bench.range(0)), 0xd0);
+  const auto ct = openssl_seal(cipher, key, nonce, aad, pt);
+  for ([[maybe_unused]] auto _ : bench) {
+    // The library returns a fresh plaintext from each open(), so this does too
+    auto out = std::vector<uint8_t>{};
+    auto ok = openssl_open(cipher, key, nonce, aad, ct, out);
+    benchmark::DoNotOptimize(ok);
+    benchmark::DoNotOptimize(out);
+  }
+  bench.SetBytesProcessed(bench.iterations() * bench.range(0));
+}
+
+///
+/// Registration
+///
+
+void
+register_aead_benchmarks()
+{
+  for (const auto& params : aeads) {
+    benchmark::RegisterBenchmark(
+      bench_name("aead_seal", params.name, "hpke").c_str(), bench_seal, params)
+      ->RangeMultiplier(size_multiplier)
+      ->Range(min_size, max_size);
+    benchmark::RegisterBenchmark(
+      bench_name("aead_seal", params.name, "openssl").c_str(),
+      bench_openssl_seal,
+      params)
+      ->RangeMultiplier(size_multiplier)
+      ->Range(min_size, max_size);
+
+    benchmark::RegisterBenchmark(
+      bench_name("aead_open", params.name, "hpke").c_str(), bench_open, params)
+      ->RangeMultiplier(size_multiplier)
+      ->Range(min_size, max_size);
+    benchmark::RegisterBenchmark(
+      bench_name("aead_open", params.name, "openssl").c_str(),
+      bench_openssl_open,
+      params)
+      ->RangeMultiplier(size_multiplier)
+      ->Range(min_size, max_size);
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <hpke/backend.h>
+#include <hpke/hpke.h>
+#include <hpke/signature.h>
+
+#include <openssl/evp.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace hpke;
+
+// Each family of primitives registers two benchmarks per algorithm: one that
+// goes through this library, and one that calls OpenSSL directly to do the
+// same core work without the library's encoding, key handling or dispatch.
+// The gap between the two is the library's overhead.
+void
+register_kem_benchmarks();
+void
+register_aead_benchmarks();
+void
+register_kdf_benchmarks();
+void
+register_signature_benchmarks();
+
+// Benchmark names are "<operation>/<algorithm>/<implementation>"
+std::string
+bench_name(const std::string& op,
+           const std::string& alg,
+           const std::string& impl);
+
+///
+/// Direct use of OpenSSL
+///
+
+using EVPPKeyPtr = std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>;
+
+struct OpenSSLError : std::runtime_error
+{
+  using parent = std::runtime_error;
+  using parent::parent;
+};
+
+// Generates a key of the given type; curve_nid is NID_undef except for EC keys
+EVPPKeyPtr
+openssl_generate(int type, int curve_nid);
@@ -0,0 +1,75 @@
+#include "bench.h"
+
+#include <openssl/err.h>
+#include <openssl/hmac.h>
+
+#include <vector>
+
+struct KDFParams
+{
+  KDF::ID id;
+  const char* name;
+  const EVP_MD* (*md)();
+};
+
+static const auto kdfs = std::vector<KDFParams>{
+  { KDF::ID::HKDF_SHA256, "HKDF_SHA256", EVP_sha256 },
+  { KDF::ID::HKDF_SHA384, "HKDF_SHA384", EVP_sha384 },
+  { KDF::ID::HKDF_SHA512, "HKDF_SHA512", EVP_sha512 },
+};
+
+// About the size of an MLS KDFLabel
+static constexpr size_t info_size = 48;
+
+// One hash output, as MLS expands for each secret it derives
+static void
+bench_expand(benchmark::State& bench, const KDFParams& params)
+{
+  const auto& kdf = Backend::select(params.id);
+  const auto prk = bytes(kdf.hash_size, 0xa0);
+  const auto info = bytes(info_size, 0xb0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto out = kdf.expand(prk, info, kdf.hash_size);
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+// HKDF-Expand for one hash output is a single HMAC over info || 0x01
+static void
+bench_openssl_expand(benchmark::State& bench, const KDFParams& params)
+{
+  const auto* md = params.md();
+  const auto hash_size = static_cast<size_t>(EVP_MD_size(md));
+  const auto prk = std::vector<uint8_t>(hash_size, 0xa0);
+  auto input = std::vector<uint8_t>(info_size, 0xb0);
+  input.push_back(0x01);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto out = std::vector<uint8_t>(hash_size);
+    auto out_len = static_cast<unsigned int>(out.size());
+    if (nullptr == HMAC(md,
+                        prk.data(),
+                        static_cast<int>(prk.size()),
+                        input.data(),
+                        input.size(),
+                        out.data(),
+                        &out_len)) {
+      throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+    }
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+void
+register_kdf_benchmarks()
+{
+  for (const auto& params : kdfs) {
+    benchmark::RegisterBenchmark(
+      bench_name("kdf_expand", params.name, "hpke").c_str(),
+      bench_expand,
+      params);
+    benchmark::RegisterBenchmark(
+      bench_name("kdf_expand", params.name, "openssl").c_str(),
+      bench_openssl_expand,
+      params);
+  }
+}
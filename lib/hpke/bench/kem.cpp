@@ -0,0 +1,235 @@
+#include "bench.h"
+
+#include <openssl/err.h>
+
+#include <vector>
+
+struct KEMParams
+{
+  KEM::ID id;
+  const char* name;
+  int type;
+  int curve_nid;
+};
+
+static const auto kems = std::vector<KEMParams>{
+  { KEM::ID::DHKEM_P256_SHA256,
+    "DHKEM_P256_SHA256",
+    EVP_PKEY_EC,
+    NID_X9_62_prime256v1 },
+  { KEM::ID::DHKEM_P384_SHA384,
+    "DHKEM_P384_SHA384",
+    EVP_PKEY_EC,
+    NID_secp384r1 },
+  { KEM::ID::DHKEM_P521_SHA512,
+    "DHKEM_P521_SHA512",
+    EVP_PKEY_EC,
+    NID_secp521r1 },
+  { KEM::ID::DHKEM_X25519_SHA256,
+    "DHKEM_X25519_SHA256",
+    EVP_PKEY_X25519,
+    NID_undef },
+  { KEM::ID::DHKEM_X448_SHA512, "DHKEM_X448_SHA512", EVP_PKEY_X448, NID_undef },
+};
+
+// The HPKE suites used by the MLS cipher suites
+struct HPKEParams
+{
+  const char* name;
+  KEMParams kem;
+  KDF::ID kdf;
+  AEAD::ID aead;
+};
+
+static const auto hpke_suites = std::vector<HPKEParams>{
+  { "P256_SHA256_AES128GCM",
+    kems.at(0),
+    KDF::ID::HKDF_SHA256,
+    AEAD::ID::AES_128_GCM },
+  { "P384_SHA384_AES256GCM",
+    kems.at(1),
+    KDF::ID::HKDF_SHA384,
+    AEAD::ID::AES_256_GCM },
+  { "P521_SHA512_AES256GCM",
+    kems.at(2),
+    KDF::ID::HKDF_SHA512,
+    AEAD::ID::AES_256_GCM },
+  { "X25519_SHA256_AES128GCM",
+    kems.at(3),
+    KDF::ID::HKDF_SHA256,
+    AEAD::ID::AES_128_GCM },
+  { "X25519_SHA256_CHACHA20POLY1305",
+    kems.at(3),
+    KDF::ID::HKDF_SHA256,
+    AEAD::ID::CHACHA20_POLY1305 },
+  { "X448_SHA512_AES256GCM",
+    kems.at(4),
+    KDF::ID::HKDF_SHA512,
+    AEAD::ID::AES_256_GCM },
+};
+
+// The size of the plaintext in HPKE benchmarks, about that of the path
+// secrets and Welcome secrets that MLS encrypts
+static constexpr size_t hpke_pt_size = 64;
+
+///
+/// Through the library
+///
+
+static void
+bench_encap(benchmark::State& bench, KEM::ID id)
+{
+  const auto& kem = Backend::select(id);
+  const auto skR = kem.generate_key_pair();
+  const auto pkR = skR->public_key();
+  for ([[maybe_unused]] auto _ : bench) {
+    auto [shared_secret, enc] = kem.encap(*pkR);
+    benchmark::DoNotOptimize(shared_secret);
+    benchmark::DoNotOptimize(enc);
+  }
+}
+
+// About the number of encaps in a Commit to a large group
+static constexpr size_t encap_batch_size = 64;
+
+static void
+bench_encap_batch(benchmark::State& bench, KEM::ID id)
+{
+  const auto& kem = Backend::select(id);
+  const auto skR = kem.generate_key_pair();
+  const auto pkR = skR->public_key();
+  const auto pkRs =
+    std::vector<const KEM::PublicKey*>(encap_batch_size, pkR.get());
+  for ([[maybe_unused]] auto _ : bench) {
+    auto results = kem.encap_batch(pkRs);
+    benchmark::DoNotOptimize(results);
+  }
+  bench.SetItemsProcessed(bench.iterations() *
+                          static_cast<int64_t>(encap_batch_size));
+}
+
+static void
+bench_decap(benchmark::State& bench, KEM::ID id)
+{
+  const auto& kem = Backend::select(id);
+  const auto skR = kem.generate_key_pair();
+  const auto pkR = skR->public_key();
+  const auto enc = kem.encap(*pkR).second;
+  for ([[maybe_unused]] auto _ : bench) {
+    auto shared_secret = kem.decap(enc, *skR);
+    benchmark::DoNotOptimize(shared_secret);
+  }
+}
+
+static void
+bench_hpke_seal(benchmark::State& bench, const HPKEParams& params)
+{
+  const auto hpke = HPKE(params.kem.id, params.kdf, params.aead);
+  const auto skR = hpke.kem.generate_key_pair();
+  const auto pkR = skR->public_key();
+  const auto info = bytes(32, 0xa0);
+  const auto pt = bytes(hpke_pt_size, 0xb0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto [enc, ctx] = hpke.setup_base_s(*pkR, info);
+    auto ct = ctx.seal({}, pt);
+    benchmark::DoNotOptimize(enc);
+    benchmark::DoNotOptimize(ct);
+  }
+}
+
+///
+/// Directly with OpenSSL
+///
+
+static std::vector<uint8_t>
+openssl_dh(EVP_PKEY* priv, EVP_PKEY* peer)
+{
+  using EVPPKeyCtxPtr =
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)>;
+  auto ctx = EVPPKeyCtxPtr(EVP_PKEY_CTX_new(priv, nullptr), EVP_PKEY_CTX_free);
+  auto size = size_t(0);
+  if (ctx == nullptr || 1 != EVP_PKEY_derive_init(ctx.get()) ||
+      1 != EVP_PKEY_derive_set_peer(ctx.get(), peer) ||
+      1 != EVP_PKEY_derive(ctx.get(), nullptr, &size)) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  auto out = std::vector<uint8_t>(size);
+  if (1 != EVP_PKEY_derive(ctx.get(), out.data(), &size)) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  out.resize(size);
+  return out;
+}
+
+// An ephemeral key pair and a DH with the receiver; the KEM's encoding of the
+// ephemeral key and its key derivation are not included
+static void
+bench_openssl_encap(benchmark::State& bench, const KEMParams& params)
+{
+  const auto skR = openssl_generate(params.type, params.curve_nid);
+  for ([[maybe_unused]] auto _ : bench) {
+    const auto skE = openssl_generate(params.type, params.curve_nid);
+    auto zz = openssl_dh(skE.get(), skR.get());
+    benchmark::DoNotOptimize(zz);
+  }
+}
+
+static void
+bench_openssl_decap(benchmark::State& bench, const KEMParams& params)
+{
+  const auto skR = openssl_generate(params.type, params.curve_nid);
+  const auto skE = openssl_generate(params.type, params.curve_nid);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto zz = openssl_dh(skR.get(), skE.get());
+    benchmark::DoNotOptimize(zz);
+  }
+}
+
+///
+/// Registration
+///
+
+void
+register_kem_benchmarks()
+{
+  for (const auto& params : kems) {
+    benchmark::RegisterBenchmark(
+      bench_name("kem_encap", params.name, "hpke").c_str(),
+      bench_encap,
+      params.id)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(
+      bench_name("kem_encap", params.name, "openssl").c_str(),
+      bench_openssl_encap,
+      params)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(
+      bench_name("kem_encap_batch", params.name, "hpke").c_str(),
+      bench_encap_batch,
+      params.id)
+      ->Unit(benchmark::kMicrosecond);
+
+    benchmark::RegisterBenchmark(
+      bench_name("kem_decap", params.name, "hpke").c_str(),
+      bench_decap,
+      params.id)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(
+      bench_name("kem_decap", params.name, "openssl").c_str(),
+      bench_openssl_decap,
+      params)
+      ->Unit(benchmark::kMicrosecond);
+  }
+
+  // Against the raw encap benchmarks above, which do the public-key part of
+  // the work; the key schedule and a short seal are small by comparison
+  for (const auto& params : hpke_suites) {
+    benchmark::RegisterBenchmark(
+      bench_name("hpke_seal", params.name, "hpke").c_str(),
+      bench_hpke_seal,
+      params)
+      ->Unit(benchmark::kMicrosecond);
+  }
+}
@@ -0,0 +1,55 @@
+#include "bench.h"
+
+#include <openssl/ec.h>
+#include <openssl/err.h>
+
+std::string
+bench_name(const std::string& op,
+           const std::string& alg,
+           const std::string& impl)
+{
+  return op + "/" + alg + "/" + impl;
+}
+
+EVPPKeyPtr
+openssl_generate(int type, int curve_nid)
+{
+  using EVPPKeyCtxPtr =
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)>;
+  auto ctx = EVPPKeyCtxPtr(EVP_PKEY_CTX_new_id(type, nullptr),
+                           EVP_PKEY_CTX_free);
+  if (ctx == nullptr || 1 != EVP_PKEY_keygen_init(ctx.get())) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  if (curve_nid != NID_undef &&
+      1 != EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx.get(), curve_nid)) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  auto* pkey = static_cast<EVP_PKEY*>(nullptr);
+  if (1 != EVP_PKEY_keygen(ctx.get(), &pkey)) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  return { pkey, EVP_PKEY_free };
+}
+
+// Results can be written in a machine-readable form with the usual Google
+// Benchmark flags, e.g.:
+//
+//   hpke_bench --benchmark_out=hpke.json --benchmark_out_format=json
+int
+main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+
+  register_kem_benchmarks();
+  register_aead_benchmarks();
+  register_kdf_benchmarks();
+  register_signature_benchmarks();
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
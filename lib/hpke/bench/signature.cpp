@@ -0,0 +1,172 @@
+#include "bench.h"
+
+#include <openssl/err.h>
+
+#include <vector>
+
+struct SignatureParams
+{
+  Signature::ID id;
+  const char* name;
+  int type;
+  int curve_nid;
+  const EVP_MD* (*md)();
+};
+
+// The signature schemes used by the MLS cipher suites.  EdDSA signs the
+// message itself, so it has no separate digest.
+static const auto signatures = std::vector<SignatureParams>{
+  { Signature::ID::P256_SHA256,
+    "P256_SHA256",
+    EVP_PKEY_EC,
+    NID_X9_62_prime256v1,
+    EVP_sha256 },
+  { Signature::ID::P384_SHA384,
+    "P384_SHA384",
+    EVP_PKEY_EC,
+    NID_secp384r1,
+    EVP_sha384 },
+  { Signature::ID::P521_SHA512,
+    "P521_SHA512",
+    EVP_PKEY_EC,
+    NID_secp521r1,
+    EVP_sha512 },
+  { Signature::ID::Ed25519, "Ed25519", EVP_PKEY_ED25519, NID_undef, nullptr },
+  { Signature::ID::Ed448, "Ed448", EVP_PKEY_ED448, NID_undef, nullptr },
+};
+
+// About the size of a signed LeafNode or FramedContent
+static constexpr size_t message_size = 256;
+
+///
+/// Through the library
+///
+
+static void
+bench_sign(benchmark::State& bench, const SignatureParams& params)
+{
+  const auto& sig = Backend::select(params.id);
+  const auto sk = sig.generate_key_pair();
+  const auto message = bytes(message_size, 0xa0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto signature = sig.sign(message, *sk);
+    benchmark::DoNotOptimize(signature);
+  }
+}
+
+static void
+bench_verify(benchmark::State& bench, const SignatureParams& params)
+{
+  const auto& sig = Backend::select(params.id);
+  const auto sk = sig.generate_key_pair();
+  const auto pk = sk->public_key();
+  const auto message = bytes(message_size, 0xa0);
+  const auto signature = sig.sign(message, *sk);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto ok = sig.verify(message, signature, *pk);
+    benchmark::DoNotOptimize(ok);
+  }
+}
+
+///
+/// Directly with OpenSSL
+///
+
+using EVPMDCtxPtr = std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>;
+
+static const EVP_MD*
+digest_for(const SignatureParams& params)
+{
+  return (params.md == nullptr) ? nullptr : params.md();
+}
+
+static std::vector<uint8_t>
+openssl_sign(const EVP_MD* md,
+             EVP_PKEY* pkey,
+             const std::vector<uint8_t>& message)
+{
+  auto ctx = EVPMDCtxPtr(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  auto size = size_t(0);
+  if (ctx == nullptr ||
+      1 != EVP_DigestSignInit(ctx.get(), nullptr, md, nullptr, pkey) ||
+      1 != EVP_DigestSign(
+             ctx.get(), nullptr, &size, message.data(), message.size())) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  auto signature = std::vector<uint8_t>(size);
+  if (1 != EVP_DigestSign(ctx.get(),
+                          signature.data(),
+                          &size,
+                          message.data(),
+                          message.size())) {
+    throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+  }
+
+  signature.resize(size);
+  return signature;
+}
+
+static void
+bench_openssl_sign(benchmark::State& bench, const SignatureParams& params)
+{
+  const auto* md = digest_for(params);
+  const auto pkey = openssl_generate(params.type, params.curve_nid);
+  const auto message = std::vector<uint8_t>(message_size, 0xa0);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto signature = openssl_sign(md, pkey.get(), message);
+    benchmark::DoNotOptimize(signature);
+  }
+}
+
+static void
+bench_openssl_verify(benchmark::State& bench, const SignatureParams& params)
+{
+  const auto* md = digest_for(params);
+  const auto pkey = openssl_generate(params.type, params.curve_nid);
+  const auto message = std::vector<uint8_t>(message_size, 0xa0);
+  const auto signature = openssl_sign(md, pkey.get(), message);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto ctx = EVPMDCtxPtr(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (ctx == nullptr ||
+        1 != EVP_DigestVerifyInit(
+               ctx.get(), nullptr, md, nullptr, pkey.get())) {
+      throw OpenSSLError(ERR_error_string(ERR_get_error(), nullptr));
+    }
+
+    auto ok = (1 == EVP_DigestVerify(ctx.get(),
+                                     signature.data(),
+                                     signature.size(),
+                                     message.data(),
+                                     message.size()));
+    benchmark::DoNotOptimize(ok);
+  }
+}
+
+///
+/// Registration
+///
+
+void
+register_signature_benchmarks()
+{
+  for (const auto& params : signatures) {
+    benchmark::RegisterBenchmark(
+      bench_name("sign", params.name, "hpke").c_str(), bench_sign, params)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(
+      bench_name("sign", params.name, "openssl").c_str(),
+      bench_openssl_sign,
+      params)
+      ->Unit(benchmark::kMicrosecond);
+
+    benchmark::RegisterBenchmark(
+      bench_name("verify", params.name, "hpke").c_str(), bench_verify, params)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(
+      bench_name("verify", params.name, "openssl").c_str(),
+      bench_openssl_verify,
+      params)
+      ->Unit(benchmark::kMicrosecond);
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <vector>
+
+namespace hpke {
+
+// Runs a batch of operations as OpenSSL ASYNC jobs.
+//
+// An engine or provider that offloads crypto to an accelerator, such as QAT,
+// can pause a job while its request is in flight.  The batch then starts or
+// resumes the other jobs, so that the requests of the whole batch are
+// submitted together, and waits on the engine's file descriptors only once no
+// job can make progress.  Without such an engine, or where the platform does
+// not support ASYNC jobs, each operation runs to completion in turn.
+//
+// All jobs run on the thread that calls run().  A paused job may be resumed
+// after other jobs have run on the same thread, so operations must not hold
+// on to thread-local state across the crypto calls they make.  Code that
+// caches such state per thread checks in_job(), and uses state of its own for
+// the call instead.
+class AsyncBatch
+{
+public:
+  void add(std::function<void()> op);
+  size_t size() const { return ops.size(); }
+
+  // Run every operation to completion.  If any of them threw, the first
+  // exception, in the order the operations were added, is rethrown once all
+  // of them have finished.
+  void run();
+
+  // Whether OpenSSL can run ASYNC jobs on this platform
+  static bool supported();
+
+  // Whether the calling code is running inside an ASYNC job
+  static bool in_job();
+
+  // Whether key exchanges go to an implementation that can run them
+  // asynchronously: an ENGINE registered as the default for them or, under
+  // OpenSSL 3, a provider other than the built-in ones.  Otherwise a batch
+  // only adds the cost of its jobs, and callers should run the operations in
+  // a plain loop.
+  static bool offload_available();
+
+private:
+  struct Op
+  {
+    std::function<void()> fn;
+    std::exception_ptr error;
+  };
+
+  std::vector<Op> ops;
+};
+
+} // namespace hpke
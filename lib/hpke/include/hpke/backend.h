@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+
+#include <hpke/digest.h>
+#include <hpke/hpke.h>
+#include <hpke/signature.h>
+
+namespace hpke {
+
+// A source of algorithm implementations.  The library's own implementations
+// are built on OpenSSL; a backend can replace any of them, e.g., with a faster
+// X25519 or ChaCha20-Poly1305 from another library, or with an implementation
+// that runs on a hardware accelerator.
+//
+// Each method returns the backend's implementation of an algorithm, or nullptr
+// if it does not provide one, in which case the OpenSSL implementation is
+// used.  The returned objects must live as long as the backend.
+struct Backend
+{
+  virtual ~Backend() = default;
+
+  virtual const KEM* kem(KEM::ID id) const;
+  virtual const KDF* kdf(KDF::ID id) const;
+  virtual const AEAD* aead(AEAD::ID id) const;
+  virtual const Digest* digest(Digest::ID id) const;
+  virtual const Signature* signature(Signature::ID id) const;
+
+  // The built-in implementations, which provide every algorithm
+  static const Backend& openssl();
+
+  // Installs a backend for the life of the process.  The algorithm chosen for
+  // each ID is cached the first time it is used, so a backend must be
+  // installed before anything else in the library is used; installing one
+  // afterward throws.
+  static void install(std::shared_ptr<const Backend> backend);
+
+  // The implementation of an algorithm in use: the installed backend's, if it
+  // has one, and otherwise the OpenSSL one
+  static const KEM& select(KEM::ID id);
+  static const KDF& select(KDF::ID id);
+  static const AEAD& select(AEAD::ID id);
+  static const Digest& select(Digest::ID id);
+  static const Signature& select(Signature::ID id);
+};
+
+} // namespace hpke
@@ -11,11 +11,19 @@ using namespace bytes_ns;
 
 namespace hpke {
 
+// Parsed certificates are immutable and shared, so copying a Certificate does
+// not re-parse it.  Certificates parsed from DER are also cached across the
+// process by the hash of their encoding, as are the issuer-to-subject links
+// that valid_from() has verified, so that the chains shared by many
+// credentials are only parsed and checked once.
 struct Certificate
 {
 private:
   struct ParsedCertificate;
-  std::unique_ptr<ParsedCertificate> parsed_cert;
+  std::shared_ptr<const ParsedCertificate> parsed_cert;
+
+  static std::shared_ptr<const ParsedCertificate> parse_cached(
+    const bytes& der);
 
 public:
   struct NameType
@@ -19,17 +19,66 @@ struct Digest
   template<ID id>
   static const Digest& get();
 
+  virtual ~Digest() = default;
+
   const ID id;
 
-  bytes hash(const bytes& data) const;
-  bytes hmac(const bytes& key, const bytes& data) const;
+  virtual bytes hash(bytes_view data) const;
+  virtual bytes hmac(bytes_view key, bytes_view data) const;
+
+  // An HMAC context initialized with a fixed key, which can be reused to MAC
+  // several messages without setting up the key each time
+  struct KeyedHMAC
+  {
+    virtual ~KeyedHMAC() = default;
+    virtual bytes hmac(bytes_view data) = 0;
+  };
+
+  virtual std::unique_ptr<KeyedHMAC> keyed_hmac(bytes_view key) const;
+
+  // An incremental hash or HMAC computation, for input that arrives in pieces.
+  // Copying a context copies its intermediate state, so a common prefix can be
+  // absorbed once and then finished several ways.  After finish(), a context
+  // must not be updated or finished again.
+  class Context
+  {
+  public:
+    Context(const Context& other);
+    Context(Context&& other) noexcept;
+    Context& operator=(const Context& other);
+    Context& operator=(Context&& other) noexcept;
+    ~Context();
+
+    void update(bytes_view data);
+    bytes finish();
+
+    // The state behind a context, implemented by each crypto backend
+    struct Impl
+    {
+      virtual ~Impl() = default;
+      virtual std::unique_ptr<Impl> clone() const = 0;
+      virtual void update(bytes_view data) = 0;
+      virtual bytes finish() = 0;
+    };
+
+    explicit Context(std::unique_ptr<Impl> impl);
+
+  private:
+    std::unique_ptr<Impl> impl;
+  };
+
+  virtual Context hash_context() const;
+  virtual Context hmac_context(bytes_view key) const;
 
   const size_t hash_size;
 
-private:
+protected:
+  // The default implementation uses OpenSSL.  A backend that derives from
+  // Digest overrides the operations it provides; see hpke/backend.h.
   explicit Digest(ID id);
 
-  bytes hmac_for_hkdf_extract(const bytes& key, const bytes& data) const;
+private:
+  virtual bytes hmac_for_hkdf_extract(bytes_view key, bytes_view data) const;
   friend struct HKDF;
 };
 
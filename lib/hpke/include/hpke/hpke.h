@@ -1,13 +1,26 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <optional>
+#include <tuple>
+#include <vector>
 
 #include <bytes/bytes.h>
 using namespace bytes_ns;
 
+struct ossl_lib_ctx_st;
+
 namespace hpke {
 
+// Under OpenSSL 3, selects the library context that algorithms are fetched
+// from, e.g., one in which only the FIPS provider is loaded.  Fetched
+// algorithms are cached for the life of the process, so this must be called
+// before anything else in the library is used.  Before OpenSSL 3, it has no
+// effect.
+void
+set_openssl_library_context(ossl_lib_ctx_st* libctx);
+
 struct KEM
 {
   enum struct ID : uint16_t
@@ -56,6 +69,14 @@ struct KEM
   virtual std::pair<bytes, bytes> encap(const PublicKey& pkR) const = 0;
   virtual bytes decap(const bytes& enc, const PrivateKey& skR) const = 0;
 
+  // Encapsulate to each of several recipients, returning (shared_secret, enc)
+  // for each in order.  Where AsyncBatch::offload_available(), the default runs
+  // the encaps as one AsyncBatch, so that an engine that computes several
+  // scalar multiplications at once, e.g., with multi-buffer SIMD, receives
+  // them together.  Otherwise each encap runs in turn.
+  virtual std::vector<std::pair<bytes, bytes>> encap_batch(
+    const std::vector<const PublicKey*>& pkRs) const;
+
   // (shared_secret, enc)
   virtual std::pair<bytes, bytes> auth_encap(const PublicKey& pkR,
                                              const PrivateKey& skS) const;
@@ -88,10 +109,16 @@ struct KDF
   const ID id;
   const size_t hash_size;
 
-  virtual bytes extract(const bytes& salt, const bytes& ikm) const = 0;
-  virtual bytes expand(const bytes& prk,
-                       const bytes& info,
-                       size_t size) const = 0;
+  virtual bytes extract(bytes_view salt, bytes_view ikm) const = 0;
+  virtual bytes expand(bytes_view prk, bytes_view info, size_t size) const = 0;
+
+  // Expand several outputs from the same PRK, one for each (info, size) pair.
+  // Implementations can reuse keyed state across the outputs; the default
+  // simply calls expand() for each one.
+  using Expansion = std::tuple<bytes_view, size_t>;
+  virtual std::vector<bytes> expand_multi(
+    bytes_view prk,
+    const std::vector<Expansion>& outputs) const;
 
   bytes labeled_extract(const bytes& suite_id,
                         const bytes& salt,
@@ -128,14 +155,58 @@ struct AEAD
   const size_t key_size;
   const size_t nonce_size;
 
-  virtual bytes seal(const bytes& key,
-                     const bytes& nonce,
-                     const bytes& aad,
-                     const bytes& pt) const = 0;
-  virtual std::optional<bytes> open(const bytes& key,
-                                    const bytes& nonce,
-                                    const bytes& aad,
-                                    const bytes& ct) const = 0;
+  virtual bytes seal(bytes_view key,
+                     bytes_view nonce,
+                     bytes_view aad,
+                     bytes_view pt) const = 0;
+  virtual std::optional<bytes> open(bytes_view key,
+                                    bytes_view nonce,
+                                    bytes_view aad,
+                                    bytes_view ct) const = 0;
+
+  // The size of the ciphertext for a plaintext of the given size.  The default
+  // implementation finds the tag size by sealing an empty plaintext.
+  virtual size_t ciphertext_size(size_t pt_size) const;
+
+  // A reusable context for AEAD operations.  The cipher is set up once, when
+  // the context is created or re-keyed, so that each message only has to set
+  // a nonce.  Contexts hold mutable state and must not be used concurrently.
+  struct KeyedContext
+  {
+    virtual ~KeyedContext() = default;
+    virtual void set_key(bytes_view key) = 0;
+
+    // Wipe the key and anything derived from it, keeping the context for
+    // reuse.  set_key() must be called before the context is used again.
+    virtual void clear_key() = 0;
+    virtual bytes seal(bytes_view nonce, bytes_view aad, bytes_view pt) = 0;
+    virtual std::optional<bytes> open(bytes_view nonce,
+                                      bytes_view aad,
+                                      bytes_view ct) = 0;
+
+    // Seal a plaintext given as a sequence of pieces, appending the
+    // ciphertext to `out`.  Implementations can encrypt the pieces directly
+    // into `out`; the default assembles them and calls seal().
+    virtual void seal_into(bytes_view nonce,
+                           bytes_view aad,
+                           const std::vector<bytes_view>& pt,
+                           bytes& out);
+
+    // Seal or open into memory provided by the caller, which may be the input
+    // itself.  `ct_out` must have room for ciphertext_size(pt.size()) bytes,
+    // and `pt_out` for the ciphertext less its tag.  open_to() fails where
+    // open() would.  The defaults copy the output of seal() and open().
+    virtual void seal_to(bytes_view nonce,
+                         bytes_view aad,
+                         bytes_view pt,
+                         uint8_t* ct_out);
+    virtual bool open_to(bytes_view nonce,
+                         bytes_view aad,
+                         bytes_view ct,
+                         uint8_t* pt_out);
+  };
+
+  virtual std::unique_ptr<KeyedContext> keyed(bytes_view key) const;
 
 protected:
   AEAD(ID id_in, size_t key_size_in, size_t nonce_size_in);
@@ -153,7 +224,11 @@ protected:
   const KDF& kdf;
   const AEAD& aead;
 
-  bytes current_nonce() const;
+  // The nonce for the current sequence number, written to a buffer on the
+  // caller's stack
+  static constexpr size_t max_nonce_size = 32;
+  using NonceBuffer = std::array<uint8_t, max_nonce_size>;
+  bytes_view current_nonce(NonceBuffer& buffer) const;
   void increment_seq();
 
 private:
@@ -174,13 +249,13 @@ private:
 struct SenderContext : public Context
 {
   SenderContext(Context&& c);
-  bytes seal(const bytes& aad, const bytes& pt);
+  bytes seal(bytes_view aad, bytes_view pt);
 };
 
 struct ReceiverContext : public Context
 {
   ReceiverContext(Context&& c);
-  std::optional<bytes> open(const bytes& aad, const bytes& ct);
+  std::optional<bytes> open(bytes_view aad, bytes_view ct);
 };
 
 struct HPKE
@@ -198,6 +273,9 @@ struct HPKE
   using SenderInfo = std::pair<bytes, SenderContext>;
 
   SenderInfo setup_base_s(const KEM::PublicKey& pkR, const bytes& info) const;
+  std::vector<SenderInfo> setup_base_s(
+    const std::vector<const KEM::PublicKey*>& pkRs,
+    const bytes& info) const;
   ReceiverContext setup_base_r(const bytes& enc,
                                const KEM::PrivateKey& skR,
                                const bytes& info) const;
@@ -8,4 +8,43 @@ namespace hpke {
 bytes
 random_bytes(size_t size);
 
+// Where random_bytes() draws its output from.
+//
+// By default, each call goes to OpenSSL's RAND_bytes().  With
+// `thread_local_drbg`, each thread instead runs its own generator, AES-256 in
+// counter mode keyed from RAND_bytes(), and serves small requests from a
+// buffer of its output.  The key is replaced with fresh output after each
+// refill of the buffer, so earlier output cannot be recovered from the
+// thread's state, and is reseeded from RAND_bytes() periodically and after
+// a fork.  Calls made inside an AsyncBatch job go to RAND_bytes().
+//
+// With `seeded`, all output comes from a single generator, keyed by a hash of
+// the seed given to set_random_seed(), so that a run that makes the same calls
+// in the same order gets the same output.  This is for tests and for replaying
+// captured traffic, and must never be used to generate real keys, so it is
+// only compiled in with the SEEDED_RANDOM build option (HPKE_SEEDED_RANDOM).
+//
+// The source is meant to be chosen once, at startup; a change applies to each
+// thread from its next call.
+enum struct RandomSource
+{
+  system,
+  thread_local_drbg,
+#if defined(HPKE_SEEDED_RANDOM)
+  seeded,
+#endif
+};
+
+void
+set_random_source(RandomSource source);
+
+#if defined(HPKE_SEEDED_RANDOM)
+// Restart the seeded generator from the given seed
+void
+set_random_seed(const bytes& seed);
+#endif
+
+RandomSource
+random_source();
+
 } // namespace hpke
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <bytes/bytes.h>
 using namespace bytes_ns;
@@ -55,6 +56,17 @@ struct Signature
                       const bytes& sig,
                       const PublicKey& pk) const = 0;
 
+  // Verify a batch of signatures, returning true only if all of them are
+  // valid.  Algorithms that support batch verification can override this; the
+  // default verifies each signature in turn, stopping at the first failure.
+  struct VerifyItem
+  {
+    const bytes& data;
+    const bytes& sig;
+    const PublicKey& pk;
+  };
+  virtual bool verify_batch(const std::vector<VerifyItem>& items) const;
+
   static std::unique_ptr<PrivateKey> generate_rsa(size_t bits);
 
 protected:
@@ -1,5 +1,6 @@
 #include "aead_cipher.h"
 #include "openssl_common.h"
+#include "probe.h"
 
 #include <openssl/evp.h>
 
@@ -9,19 +10,19 @@ namespace hpke {
 /// ExportOnlyCipher
 ///
 bytes
-ExportOnlyCipher::seal(const bytes& /* key */,
-                       const bytes& /* nonce */,
-                       const bytes& /* aad */,
-                       const bytes& /* pt */) const
+ExportOnlyCipher::seal(bytes_view /* key */,
+                       bytes_view /* nonce */,
+                       bytes_view /* aad */,
+                       bytes_view /* pt */) const
 {
   throw std::runtime_error("seal() on export-only context");
 }
 
 std::optional<bytes>
-ExportOnlyCipher::open(const bytes& /* key */,
-                       const bytes& /* nonce */,
-                       const bytes& /* aad */,
-                       const bytes& /* ct */) const
+ExportOnlyCipher::open(bytes_view /* key */,
+                       bytes_view /* nonce */,
+                       bytes_view /* aad */,
+                       bytes_view /* ct */) const
 {
   throw std::runtime_error("open() on export-only context");
 }
@@ -112,14 +113,23 @@ static const EVP_CIPHER*
 openssl_cipher(AEAD::ID cipher)
 {
   switch (cipher) {
-    case AEAD::ID::AES_128_GCM:
-      return EVP_aes_128_gcm();
+    case AEAD::ID::AES_128_GCM: {
+      static const auto* const cipher =
+        fetch_cipher("AES-128-GCM", EVP_aes_128_gcm());
+      return cipher;
+    }
 
-    case AEAD::ID::AES_256_GCM:
-      return EVP_aes_256_gcm();
+    case AEAD::ID::AES_256_GCM: {
+      static const auto* const cipher =
+        fetch_cipher("AES-256-GCM", EVP_aes_256_gcm());
+      return cipher;
+    }
 
-    case AEAD::ID::CHACHA20_POLY1305:
-      return EVP_chacha20_poly1305();
+    case AEAD::ID::CHACHA20_POLY1305: {
+      static const auto* const cipher =
+        fetch_cipher("ChaCha20-Poly1305", EVP_chacha20_poly1305());
+      return cipher;
+    }
 
     default:
       throw std::runtime_error("Unsupported algorithm");
@@ -132,116 +142,274 @@ AEADCipher::AEADCipher(AEAD::ID id_in)
 {
 }
 
-bytes
-AEADCipher::seal(const bytes& key,
-                 const bytes& nonce,
-                 const bytes& aad,
-                 const bytes& pt) const
-{
-  auto ctx = make_typed_unique(EVP_CIPHER_CTX_new());
-  if (ctx == nullptr) {
-    throw openssl_error();
-  }
+// An OpenSSL cipher context that has been set up with a cipher and key.  Each
+// operation only sets the nonce and direction, which leaves the expanded key
+// in place until clear_key() resets the context.
+struct EVPKeyedContext : AEAD::KeyedContext
+{
+  EVPKeyedContext(AEAD::ID id_in, size_t tag_size_in, bytes_view key)
+    : id(id_in)
+    , tag_size(tag_size_in)
+    , ctx(make_typed_unique(EVP_CIPHER_CTX_new()))
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
 
-  const auto* cipher = openssl_cipher(id);
-  if (1 != EVP_EncryptInit(ctx.get(), cipher, key.data(), nonce.data())) {
-    throw openssl_error();
+    const auto* cipher = openssl_cipher(id);
+    if (1 !=
+        EVP_CipherInit_ex(ctx.get(), cipher, nullptr, key.data(), nullptr, 1)) {
+      throw openssl_error();
+    }
   }
 
-  int outlen = 0;
-  if (!aad.empty()) {
-    if (1 != EVP_EncryptUpdate(ctx.get(),
-                               nullptr,
-                               &outlen,
-                               aad.data(),
-                               static_cast<int>(aad.size()))) {
+  void set_key(bytes_view key) override
+  {
+    // After a reset, the context has to be given the cipher again
+    const auto* cipher = cleared ? openssl_cipher(id) : nullptr;
+    const auto enc = cleared ? 1 : -1;
+    if (1 != EVP_CipherInit_ex(
+               ctx.get(), cipher, nullptr, key.data(), nullptr, enc)) {
       throw openssl_error();
     }
-  }
 
-  bytes ct(pt.size());
-  if (1 != EVP_EncryptUpdate(ctx.get(),
-                             ct.data(),
-                             &outlen,
-                             pt.data(),
-                             static_cast<int>(pt.size()))) {
-    throw openssl_error();
+    cleared = false;
   }
 
-  // Providing nullptr as an argument is safe here because this
-  // function never writes with GCM; it only computes the tag
-  if (1 != EVP_EncryptFinal(ctx.get(), nullptr, &outlen)) {
-    throw openssl_error();
+  // Resetting the context frees the expanded key, which OpenSSL cleanses.  This
+  // is called from destructors, so a failure is left for set_key() to report.
+  void clear_key() override
+  {
+    EVP_CIPHER_CTX_reset(ctx.get());
+    cleared = true;
   }
 
-  bytes tag(tag_size);
-  if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
-                               EVP_CTRL_GCM_GET_TAG,
-                               static_cast<int>(tag_size),
-                               tag.data())) {
-    throw openssl_error();
+  bytes seal(bytes_view nonce, bytes_view aad, bytes_view pt) override
+  {
+    bytes ct(pt.size() + tag_size);
+    seal_to(nonce, aad, pt, ct.data());
+    return ct;
   }
 
-  ct += tag;
-  return ct;
-}
+  // GCM and ChaCha20-Poly1305 both allow the output to alias the input
+  void seal_to(bytes_view nonce,
+               bytes_view aad,
+               bytes_view pt,
+               uint8_t* ct_out) override
+  {
+    HPKE_PROBE(seal_start, static_cast<uint16_t>(id), pt.size());
 
-std::optional<bytes>
-AEADCipher::open(const bytes& key,
-                 const bytes& nonce,
-                 const bytes& aad,
-                 const bytes& ct) const
-{
-  if (ct.size() < tag_size) {
-    throw std::runtime_error("AEAD ciphertext smaller than tag size");
-  }
+    if (1 != EVP_CipherInit_ex(
+               ctx.get(), nullptr, nullptr, nullptr, nonce.data(), 1)) {
+      throw openssl_error();
+    }
+
+    int outlen = 0;
+    if (!aad.empty()) {
+      if (1 != EVP_EncryptUpdate(ctx.get(),
+                                 nullptr,
+                                 &outlen,
+                                 aad.data(),
+                                 static_cast<int>(aad.size()))) {
+        throw openssl_error();
+      }
+    }
+
+    if (1 != EVP_EncryptUpdate(ctx.get(),
+                               ct_out,
+                               &outlen,
+                               pt.data(),
+                               static_cast<int>(pt.size()))) {
+      throw openssl_error();
+    }
+
+    // Providing nullptr as an argument is safe here because this
+    // function never writes with GCM; it only computes the tag
+    if (1 != EVP_EncryptFinal(ctx.get(), nullptr, &outlen)) {
+      throw openssl_error();
+    }
+
+    // The tag is written directly after the encrypted content
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    auto* tag = ct_out + pt.size();
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
+                                 EVP_CTRL_GCM_GET_TAG,
+                                 static_cast<int>(tag_size),
+                                 tag)) {
+      throw openssl_error();
+    }
 
-  auto ctx = make_typed_unique(EVP_CIPHER_CTX_new());
-  if (ctx == nullptr) {
-    throw openssl_error();
+    HPKE_PROBE(seal_done, static_cast<uint16_t>(id), pt.size());
   }
 
-  const auto* cipher = openssl_cipher(id);
-  if (1 != EVP_DecryptInit(ctx.get(), cipher, key.data(), nonce.data())) {
-    throw openssl_error();
+  void seal_into(bytes_view nonce,
+                 bytes_view aad,
+                 const std::vector<bytes_view>& pt,
+                 bytes& out) override
+  {
+    if (1 != EVP_CipherInit_ex(
+               ctx.get(), nullptr, nullptr, nullptr, nonce.data(), 1)) {
+      throw openssl_error();
+    }
+
+    int outlen = 0;
+    if (!aad.empty()) {
+      if (1 != EVP_EncryptUpdate(ctx.get(),
+                                 nullptr,
+                                 &outlen,
+                                 aad.data(),
+                                 static_cast<int>(aad.size()))) {
+        throw openssl_error();
+      }
+    }
+
+    // GCM and ChaCha20-Poly1305 are stream ciphers, so each piece encrypts to
+    // exactly its own size, directly after the one before
+    auto pt_size = size_t(0);
+    for (const auto& piece : pt) {
+      pt_size += piece.size();
+    }
+
+    HPKE_PROBE(seal_start, static_cast<uint16_t>(id), pt_size);
+
+    auto offset = out.size();
+    out.resize(offset + pt_size + tag_size);
+    for (const auto& piece : pt) {
+      if (piece.empty()) {
+        continue;
+      }
+
+      if (1 != EVP_EncryptUpdate(ctx.get(),
+                                 &out.at(offset),
+                                 &outlen,
+                                 piece.data(),
+                                 static_cast<int>(piece.size()))) {
+        throw openssl_error();
+      }
+      offset += piece.size();
+    }
+
+    if (1 != EVP_EncryptFinal(ctx.get(), nullptr, &outlen)) {
+      throw openssl_error();
+    }
+
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
+                                 EVP_CTRL_GCM_GET_TAG,
+                                 static_cast<int>(tag_size),
+                                 &out.at(offset))) {
+      throw openssl_error();
+    }
+
+    HPKE_PROBE(seal_done, static_cast<uint16_t>(id), pt_size);
   }
 
-  auto inner_ct_size = ct.size() - tag_size;
-  auto tag = ct.slice(inner_ct_size, ct.size());
-  if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
-                               EVP_CTRL_GCM_SET_TAG,
-                               static_cast<int>(tag_size),
-                               tag.data())) {
-    throw openssl_error();
+  std::optional<bytes> open(bytes_view nonce,
+                            bytes_view aad,
+                            bytes_view ct) override
+  {
+    if (ct.size() < tag_size) {
+      throw std::runtime_error("AEAD ciphertext smaller than tag size");
+    }
+
+    bytes pt(ct.size() - tag_size);
+    open_to(nonce, aad, ct, pt.data());
+    return pt;
   }
 
-  int out_size = 0;
-  if (!aad.empty()) {
+  bool open_to(bytes_view nonce,
+               bytes_view aad,
+               bytes_view ct,
+               uint8_t* pt_out) override
+  {
+    if (ct.size() < tag_size) {
+      throw std::runtime_error("AEAD ciphertext smaller than tag size");
+    }
+
+    auto inner_ct_size = ct.size() - tag_size;
+    HPKE_PROBE(open_start, static_cast<uint16_t>(id), inner_ct_size);
+
+    if (1 != EVP_CipherInit_ex(
+               ctx.get(), nullptr, nullptr, nullptr, nonce.data(), 0)) {
+      throw openssl_error();
+    }
+
+    // OpenSSL only reads the tag, despite taking it as a non-const pointer.
+    // The tag is set before decryption, so an in-place open does not
+    // disturb it.
+    auto tag = ct.slice(inner_ct_size, ct.size());
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
+    auto* tag_data = const_cast<uint8_t*>(tag.data());
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(),
+                                 EVP_CTRL_GCM_SET_TAG,
+                                 static_cast<int>(tag_size),
+                                 tag_data)) {
+      throw openssl_error();
+    }
+
+    int out_size = 0;
+    if (!aad.empty()) {
+      if (1 != EVP_DecryptUpdate(ctx.get(),
+                                 nullptr,
+                                 &out_size,
+                                 aad.data(),
+                                 static_cast<int>(aad.size()))) {
+        throw openssl_error();
+      }
+    }
+
     if (1 != EVP_DecryptUpdate(ctx.get(),
-                               nullptr,
+                               pt_out,
                                &out_size,
-                               aad.data(),
-                               static_cast<int>(aad.size()))) {
+                               ct.data(),
+                               static_cast<int>(inner_ct_size))) {
       throw openssl_error();
     }
-  }
 
-  bytes pt(inner_ct_size);
-  if (1 != EVP_DecryptUpdate(ctx.get(),
-                             pt.data(),
-                             &out_size,
-                             ct.data(),
-                             static_cast<int>(inner_ct_size))) {
-    throw openssl_error();
-  }
+    // Providing nullptr as an argument is safe here because this
+    // function never writes with GCM; it only verifies the tag
+    if (1 != EVP_DecryptFinal(ctx.get(), nullptr, &out_size)) {
+      throw std::runtime_error("AEAD authentication failure");
+    }
 
-  // Providing nullptr as an argument is safe here because this
-  // function never writes with GCM; it only verifies the tag
-  if (1 != EVP_DecryptFinal(ctx.get(), nullptr, &out_size)) {
-    throw std::runtime_error("AEAD authentication failure");
+    HPKE_PROBE(open_done, static_cast<uint16_t>(id), inner_ct_size);
+    return true;
   }
 
-  return pt;
+private:
+  const AEAD::ID id;
+  const size_t tag_size;
+  typed_unique_ptr<EVP_CIPHER_CTX> ctx;
+  bool cleared = false;
+};
+
+bytes
+AEADCipher::seal(bytes_view key,
+                 bytes_view nonce,
+                 bytes_view aad,
+                 bytes_view pt) const
+{
+  return EVPKeyedContext(id, tag_size, key).seal(nonce, aad, pt);
+}
+
+std::optional<bytes>
+AEADCipher::open(bytes_view key,
+                 bytes_view nonce,
+                 bytes_view aad,
+                 bytes_view ct) const
+{
+  return EVPKeyedContext(id, tag_size, key).open(nonce, aad, ct);
+}
+
+size_t
+AEADCipher::ciphertext_size(size_t pt_size) const
+{
+  return pt_size + tag_size;
+}
+
+std::unique_ptr<AEAD::KeyedContext>
+AEADCipher::keyed(bytes_view key) const
+{
+  return std::make_unique<EVPKeyedContext>(id, tag_size, key);
 }
 
 } // namespace hpke
@@ -9,14 +9,14 @@ struct ExportOnlyCipher : public AEAD
   ExportOnlyCipher();
   ~ExportOnlyCipher() override = default;
 
-  bytes seal(const bytes& key,
-             const bytes& nonce,
-             const bytes& aad,
-             const bytes& pt) const override;
-  std::optional<bytes> open(const bytes& key,
-                            const bytes& nonce,
-                            const bytes& aad,
-                            const bytes& ct) const override;
+  bytes seal(bytes_view key,
+             bytes_view nonce,
+             bytes_view aad,
+             bytes_view pt) const override;
+  std::optional<bytes> open(bytes_view key,
+                            bytes_view nonce,
+                            bytes_view aad,
+                            bytes_view ct) const override;
 };
 
 struct AEADCipher : public AEAD
@@ -26,14 +26,17 @@ struct AEADCipher : public AEAD
 
   ~AEADCipher() override = default;
 
-  bytes seal(const bytes& key,
-             const bytes& nonce,
-             const bytes& aad,
-             const bytes& pt) const override;
-  std::optional<bytes> open(const bytes& key,
-                            const bytes& nonce,
-                            const bytes& aad,
-                            const bytes& ct) const override;
+  bytes seal(bytes_view key,
+             bytes_view nonce,
+             bytes_view aad,
+             bytes_view pt) const override;
+  std::optional<bytes> open(bytes_view key,
+                            bytes_view nonce,
+                            bytes_view aad,
+                            bytes_view ct) const override;
+
+  size_t ciphertext_size(size_t pt_size) const override;
+  std::unique_ptr<KeyedContext> keyed(bytes_view key) const override;
 
 private:
   const size_t tag_size;
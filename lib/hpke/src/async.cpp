@@ -0,0 +1,223 @@
+#include <hpke/async.h>
+
+#include "openssl_common.h"
+
+#include <openssl/async.h>
+#if !defined(OPENSSL_NO_ENGINE)
+#include <openssl/engine.h>
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#endif
+
+#include <string>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#endif
+
+namespace hpke {
+
+#if !defined(OPENSSL_NO_ASYNC)
+template<>
+void
+typed_delete(ASYNC_WAIT_CTX* ptr)
+{
+  ASYNC_WAIT_CTX_free(ptr);
+}
+#endif
+
+void
+AsyncBatch::add(std::function<void()> op)
+{
+  ops.push_back({ std::move(op), nullptr });
+}
+
+bool
+AsyncBatch::supported()
+{
+#if defined(OPENSSL_NO_ASYNC)
+  return false;
+#else
+  return ASYNC_is_capable() == 1;
+#endif
+}
+
+bool
+AsyncBatch::in_job()
+{
+#if defined(OPENSSL_NO_ASYNC)
+  return false;
+#else
+  return ASYNC_get_current_job() != nullptr;
+#endif
+}
+
+bool
+AsyncBatch::offload_available()
+{
+#if defined(OPENSSL_NO_ASYNC)
+  return false;
+#else
+  if (!supported()) {
+    return false;
+  }
+
+#if !defined(OPENSSL_NO_ENGINE)
+  for (const auto nid : { EVP_PKEY_EC, EVP_PKEY_X25519, EVP_PKEY_X448 }) {
+    auto* engine = ENGINE_get_pkey_meth_engine(nid);
+    if (engine != nullptr) {
+      ENGINE_finish(engine);
+      return true;
+    }
+  }
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  for (const auto* name : { "ECDH", "X25519", "X448" }) {
+    auto* exch = EVP_KEYEXCH_fetch(openssl_library_context(), name, nullptr);
+    if (exch == nullptr) {
+      continue;
+    }
+
+    const auto provider =
+      std::string(OSSL_PROVIDER_get0_name(EVP_KEYEXCH_get0_provider(exch)));
+    EVP_KEYEXCH_free(exch);
+    if (provider != "default" && provider != "fips") {
+      return true;
+    }
+  }
+#endif
+
+  return false;
+#endif
+}
+
+#if !defined(OPENSSL_NO_ASYNC)
+// Wait until the engine signals one of the paused jobs, or briefly if it has
+// given no file descriptors to wait on
+static void
+wait_for_jobs(const std::vector<ASYNC_WAIT_CTX*>& wait_ctxs)
+{
+#if !defined(_WIN32)
+  auto fds = std::vector<pollfd>{};
+  for (auto* ctx : wait_ctxs) {
+    auto count = size_t(0);
+    if (1 != ASYNC_WAIT_CTX_get_all_fds(ctx, nullptr, &count) || count == 0) {
+      continue;
+    }
+
+    auto ctx_fds = std::vector<OSSL_ASYNC_FD>(count);
+    if (1 != ASYNC_WAIT_CTX_get_all_fds(ctx, ctx_fds.data(), &count)) {
+      continue;
+    }
+
+    for (const auto fd : ctx_fds) {
+      fds.push_back({ fd, POLLIN, 0 });
+    }
+  }
+
+  if (!fds.empty()) {
+    static constexpr auto poll_timeout_ms = 10;
+    poll(fds.data(), fds.size(), poll_timeout_ms);
+    return;
+  }
+#else
+  (void)wait_ctxs;
+#endif
+
+  std::this_thread::yield();
+}
+#endif
+
+void
+AsyncBatch::run()
+{
+#if defined(OPENSSL_NO_ASYNC)
+  for (auto& op : ops) {
+    try {
+      op.fn();
+    } catch (...) {
+      op.error = std::current_exception();
+    }
+  }
+#else
+  // The job function gets a copy of its argument, so it is passed a pointer
+  // to the operation.  Exceptions must not unwind out of a job.
+  static constexpr auto run_op = [](void* arg) -> int {
+    auto* op = *static_cast<Op**>(arg);
+    try {
+      op->fn();
+    } catch (...) {
+      op->error = std::current_exception();
+    }
+    return 1;
+  };
+
+  struct Job
+  {
+    Op* op = nullptr;
+    ASYNC_JOB* job = nullptr;
+    typed_unique_ptr<ASYNC_WAIT_CTX> wait_ctx;
+  };
+
+  auto pending = std::vector<Job>{};
+  pending.reserve(ops.size());
+  for (auto& op : ops) {
+    auto wait_ctx = make_typed_unique(ASYNC_WAIT_CTX_new());
+    if (wait_ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    pending.push_back({ &op, nullptr, std::move(wait_ctx) });
+  }
+
+  // Each pass starts or resumes every unfinished job.  A job that cannot be
+  // run asynchronously, e.g., because the pool of jobs is exhausted, is run
+  // directly instead.
+  while (!pending.empty()) {
+    auto paused = std::vector<Job>{};
+    for (auto& job : pending) {
+      auto ret = 0;
+      auto* op = job.op;
+      const auto status = ASYNC_start_job(
+        &job.job, job.wait_ctx.get(), &ret, run_op, &op, sizeof(op));
+
+      switch (status) {
+        case ASYNC_FINISH:
+          break;
+
+        case ASYNC_PAUSE:
+          paused.push_back(std::move(job));
+          break;
+
+        default:
+          run_op(&op);
+          break;
+      }
+    }
+
+    if (!paused.empty()) {
+      auto wait_ctxs = std::vector<ASYNC_WAIT_CTX*>{};
+      for (const auto& job : paused) {
+        wait_ctxs.push_back(job.wait_ctx.get());
+      }
+
+      wait_for_jobs(wait_ctxs);
+    }
+
+    pending = std::move(paused);
+  }
+#endif
+
+  auto batch = std::move(ops);
+  ops.clear();
+  for (auto& op : batch) {
+    if (op.error) {
+      std::rethrow_exception(op.error);
+    }
+  }
+}
+
+} // namespace hpke
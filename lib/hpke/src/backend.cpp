@@ -0,0 +1,188 @@
+#include <hpke/backend.h>
+
+#include "aead_cipher.h"
+#include "dhkem.h"
+#include "hkdf.h"
+#include "openssl_common.h"
+
+#include <atomic>
+#include <stdexcept>
+
+namespace hpke {
+
+///
+/// Backend defaults: provide nothing
+///
+
+const KEM*
+Backend::kem(KEM::ID /* id */) const
+{
+  return nullptr;
+}
+
+const KDF*
+Backend::kdf(KDF::ID /* id */) const
+{
+  return nullptr;
+}
+
+const AEAD*
+Backend::aead(AEAD::ID /* id */) const
+{
+  return nullptr;
+}
+
+const Digest*
+Backend::digest(Digest::ID /* id */) const
+{
+  return nullptr;
+}
+
+const Signature*
+Backend::signature(Signature::ID /* id */) const
+{
+  return nullptr;
+}
+
+///
+/// OpenSSL
+///
+
+struct OpenSSLBackend : Backend
+{
+  const KEM* kem(KEM::ID id) const override
+  {
+    switch (id) {
+      case KEM::ID::DHKEM_P256_SHA256:
+        return &DHKEM::get<KEM::ID::DHKEM_P256_SHA256>();
+      case KEM::ID::DHKEM_P384_SHA384:
+        return &DHKEM::get<KEM::ID::DHKEM_P384_SHA384>();
+      case KEM::ID::DHKEM_P521_SHA512:
+        return &DHKEM::get<KEM::ID::DHKEM_P521_SHA512>();
+      case KEM::ID::DHKEM_X25519_SHA256:
+        return &DHKEM::get<KEM::ID::DHKEM_X25519_SHA256>();
+      case KEM::ID::DHKEM_X448_SHA512:
+        return &DHKEM::get<KEM::ID::DHKEM_X448_SHA512>();
+      default:
+        return nullptr;
+    }
+  }
+
+  const KDF* kdf(KDF::ID id) const override
+  {
+    switch (id) {
+      case KDF::ID::HKDF_SHA256:
+        return &HKDF::get<Digest::ID::SHA256>();
+      case KDF::ID::HKDF_SHA384:
+        return &HKDF::get<Digest::ID::SHA384>();
+      case KDF::ID::HKDF_SHA512:
+        return &HKDF::get<Digest::ID::SHA512>();
+      default:
+        return nullptr;
+    }
+  }
+
+  const AEAD* aead(AEAD::ID id) const override
+  {
+    switch (id) {
+      case AEAD::ID::AES_128_GCM:
+        return &AEADCipher::get<AEAD::ID::AES_128_GCM>();
+      case AEAD::ID::AES_256_GCM:
+        return &AEADCipher::get<AEAD::ID::AES_256_GCM>();
+      case AEAD::ID::CHACHA20_POLY1305:
+        return &AEADCipher::get<AEAD::ID::CHACHA20_POLY1305>();
+      default:
+        return nullptr;
+    }
+  }
+
+  const Digest* digest(Digest::ID id) const override
+  {
+    return &openssl_digest(id);
+  }
+
+  const Signature* signature(Signature::ID id) const override
+  {
+    return &openssl_signature(id);
+  }
+};
+
+const Backend&
+Backend::openssl()
+{
+  static const auto instance = OpenSSLBackend{};
+  return instance;
+}
+
+///
+/// Selection
+///
+
+// The installed backend is never replaced once algorithms have been selected
+// from it, so the references handed out stay valid.
+static std::shared_ptr<const Backend> installed_backend; // NOLINT
+static std::atomic<bool> backend_used = false;
+
+void
+Backend::install(std::shared_ptr<const Backend> backend)
+{
+  if (backend_used) {
+    throw std::runtime_error("Backend installed after algorithms were used");
+  }
+
+  installed_backend = std::move(backend);
+}
+
+template<typename T, typename ID>
+static const T&
+select_from(ID id, const T* (Backend::*method)(ID) const)
+{
+  backend_used = true;
+
+  const T* impl = nullptr;
+  if (installed_backend) {
+    impl = ((*installed_backend).*method)(id);
+  }
+
+  if (impl == nullptr) {
+    impl = (Backend::openssl().*method)(id);
+  }
+
+  if (impl == nullptr) {
+    throw std::runtime_error("Unsupported algorithm");
+  }
+
+  return *impl;
+}
+
+const KEM&
+Backend::select(KEM::ID id)
+{
+  return select_from(id, &Backend::kem);
+}
+
+const KDF&
+Backend::select(KDF::ID id)
+{
+  return select_from(id, &Backend::kdf);
+}
+
+const AEAD&
+Backend::select(AEAD::ID id)
+{
+  return select_from(id, &Backend::aead);
+}
+
+const Digest&
+Backend::select(Digest::ID id)
+{
+  return select_from(id, &Backend::digest);
+}
+
+const Signature&
+Backend::select(Signature::ID id)
+{
+  return select_from(id, &Backend::signature);
+}
+
+} // namespace hpke
@@ -3,11 +3,17 @@
 #include "rsa.h"
 #include <hpke/certificate.h>
 #include <hpke/signature.h>
+#include <deque>
+#include <hpke/digest.h>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <set>
+#include <shared_mutex>
 #include <tls/compat.h>
 
 namespace hpke {
@@ -203,28 +209,6 @@ struct Certificate::ParsedCertificate
   {
   }
 
-  ParsedCertificate(const ParsedCertificate& other)
-    : x509(nullptr, typed_delete<X509>)
-    , pub_key_id(public_key_algorithm(other.x509.get()))
-    , sig_algo(signature_algorithm(other.x509.get()))
-    , issuer_hash(other.issuer_hash)
-    , subject_hash(other.subject_hash)
-    , issuer(other.issuer)
-    , subject(other.subject)
-    , subject_key_id(other.subject_key_id)
-    , authority_key_id(other.authority_key_id)
-    , sub_alt_names(other.sub_alt_names)
-    , is_ca(other.is_ca)
-    , hash(other.hash)
-    , not_before(other.not_before)
-    , not_after(other.not_after)
-  {
-    if (1 != X509_up_ref(other.x509.get())) {
-      throw openssl_error();
-    }
-    x509.reset(other.x509.get());
-  }
-
   static Signature::ID public_key_algorithm(X509* x509)
   {
     switch (EVP_PKEY_base_id(X509_get0_pubkey(x509))) {
@@ -327,6 +311,86 @@ struct Certificate::ParsedCertificate
   const std::chrono::system_clock::time_point not_after;
 };
 
+///
+/// Certificate caches
+///
+
+// Each cache holds at most `max_entries` entries, evicting the oldest first
+static constexpr size_t max_cached_certificates = 1024;
+static constexpr size_t max_cached_links = 4096;
+
+// Parsed certificates, keyed by the SHA-256 hash of their DER encoding
+template<typename Parsed>
+class ParsedCertificateCache
+{
+public:
+  template<typename Parse>
+  std::shared_ptr<const Parsed> get(const bytes& der, const Parse& parse)
+  {
+    const auto key = Digest::get<Digest::ID::SHA256>().hash(der);
+    {
+      const auto lock = std::shared_lock(mutex);
+      const auto it = certs.find(key);
+      if (it != certs.end()) {
+        return it->second;
+      }
+    }
+
+    // Parse outside the lock; if two threads race, the first insert wins
+    auto parsed = std::shared_ptr<const Parsed>(parse(der));
+
+    const auto lock = std::unique_lock(mutex);
+    auto [it, inserted] = certs.emplace(key, parsed);
+    if (!inserted) {
+      return it->second;
+    }
+
+    order.push_back(key);
+    if (order.size() > max_cached_certificates) {
+      certs.erase(order.front());
+      order.pop_front();
+    }
+
+    return parsed;
+  }
+
+private:
+  std::shared_mutex mutex;
+  std::map<bytes, std::shared_ptr<const Parsed>> certs;
+  std::deque<bytes> order;
+};
+
+// Issuer-to-subject links whose signatures have verified, keyed by the hashes
+// of the two certificates.  Failures are not remembered.
+class ValidLinkCache
+{
+public:
+  bool contains(const bytes& link)
+  {
+    const auto lock = std::shared_lock(mutex);
+    return links.count(link) > 0;
+  }
+
+  void insert(const bytes& link)
+  {
+    const auto lock = std::unique_lock(mutex);
+    if (!links.insert(link).second) {
+      return;
+    }
+
+    order.push_back(link);
+    if (order.size() > max_cached_links) {
+      links.erase(order.front());
+      order.pop_front();
+    }
+  }
+
+private:
+  std::shared_mutex mutex;
+  std::set<bytes> links;
+  std::deque<bytes> order;
+};
+
 ///
 /// Certificate
 ///
@@ -355,15 +419,22 @@ Certificate::Certificate(std::unique_ptr<ParsedCertificate>&& parsed_cert_in)
 {
 }
 
+std::shared_ptr<const Certificate::ParsedCertificate>
+Certificate::parse_cached(const bytes& der)
+{
+  static auto cache = ParsedCertificateCache<ParsedCertificate>{};
+  return cache.get(der, ParsedCertificate::parse);
+}
+
 Certificate::Certificate(const bytes& der)
-  : parsed_cert(ParsedCertificate::parse(der))
+  : parsed_cert(parse_cached(der))
   , public_key(signature_key(parsed_cert->public_key().release()))
   , raw(der)
 {
 }
 
 Certificate::Certificate(const Certificate& other)
-  : parsed_cert(std::make_unique<ParsedCertificate>(*other.parsed_cert))
+  : parsed_cert(other.parsed_cert)
   , public_key(signature_key(parsed_cert->public_key().release()))
   , raw(other.raw)
 {
@@ -405,8 +476,19 @@ Certificate::parse_pem(const bytes& pem)
 bool
 Certificate::valid_from(const Certificate& parent) const
 {
+  static auto cache = ValidLinkCache{};
+  const auto link = parent.parsed_cert->hash + parsed_cert->hash;
+  if (cache.contains(link)) {
+    return true;
+  }
+
   auto pub = parent.parsed_cert->public_key();
-  return (1 == X509_verify(parsed_cert->x509.get(), pub.get()));
+  if (1 != X509_verify(parsed_cert->x509.get(), pub.get())) {
+    return false;
+  }
+
+  cache.insert(link);
+  return true;
 }
 
 uint64_t
@@ -1,6 +1,7 @@
 #include "dhkem.h"
 
 #include "common.h"
+#include "probe.h"
 
 namespace hpke {
 
@@ -127,6 +128,7 @@ DHKEM::deserialize_private(const bytes& skm) const
 std::pair<bytes, bytes>
 DHKEM::encap(const KEM::PublicKey& pkR) const
 {
+  HPKE_PROBE(encap_start, static_cast<uint16_t>(id));
   const auto& gpkR = dynamic_cast<const Group::PublicKey&>(pkR);
 
   auto skE = group.generate_key_pair();
@@ -139,12 +141,14 @@ DHKEM::encap(const KEM::PublicKey& pkR) const
   auto kem_context = enc + pkRm;
 
   auto shared_secret = extract_and_expand(zz, kem_context);
+  HPKE_PROBE(encap_done, static_cast<uint16_t>(id));
   return std::make_pair(shared_secret, enc);
 }
 
 bytes
 DHKEM::decap(const bytes& enc, const KEM::PrivateKey& skR) const
 {
+  HPKE_PROBE(decap_start, static_cast<uint16_t>(id));
   const auto& gskR = dynamic_cast<const PrivateKey&>(skR);
   auto pkR = gskR.group_priv->public_key();
   auto pkE = group.deserialize(enc);
@@ -152,12 +156,15 @@ DHKEM::decap(const bytes& enc, const KEM::PrivateKey& skR) const
 
   auto pkRm = group.serialize(*pkR);
   auto kem_context = enc + pkRm;
-  return extract_and_expand(zz, kem_context);
+  auto shared_secret = extract_and_expand(zz, kem_context);
+  HPKE_PROBE(decap_done, static_cast<uint16_t>(id));
+  return shared_secret;
 }
 
 std::pair<bytes, bytes>
 DHKEM::auth_encap(const KEM::PublicKey& pkR, const KEM::PrivateKey& skS) const
 {
+  HPKE_PROBE(auth_encap_start, static_cast<uint16_t>(id));
   const auto& gpkR = dynamic_cast<const Group::PublicKey&>(pkR);
   const auto& gskS = dynamic_cast<const PrivateKey&>(skS);
 
@@ -175,6 +182,7 @@ DHKEM::auth_encap(const KEM::PublicKey& pkR, const KEM::PrivateKey& skS) const
   auto kem_context = enc + pkRm + pkSm;
 
   auto shared_secret = extract_and_expand(zz, kem_context);
+  HPKE_PROBE(auth_encap_done, static_cast<uint16_t>(id));
   return std::make_pair(shared_secret, enc);
 }
 
@@ -183,6 +191,7 @@ DHKEM::auth_decap(const bytes& enc,
                   const KEM::PublicKey& pkS,
                   const KEM::PrivateKey& skR) const
 {
+  HPKE_PROBE(auth_decap_start, static_cast<uint16_t>(id));
   const auto& gpkS = dynamic_cast<const Group::PublicKey&>(pkS);
   const auto& gskR = dynamic_cast<const PrivateKey&>(skR);
 
@@ -197,7 +206,9 @@ DHKEM::auth_decap(const bytes& enc,
   auto pkSm = group.serialize(gpkS);
   auto kem_context = enc + pkRm + pkSm;
 
-  return extract_and_expand(zz, kem_context);
+  auto shared_secret = extract_and_expand(zz, kem_context);
+  HPKE_PROBE(auth_decap_done, static_cast<uint16_t>(id));
+  return shared_secret;
 }
 
 bytes
@@ -1,3 +1,5 @@
+#include <hpke/async.h>
+#include <hpke/backend.h>
 #include <hpke/digest.h>
 
 #include <openssl/evp.h>
@@ -7,29 +9,11 @@
 
 namespace hpke {
 
-static const EVP_MD*
-openssl_digest_type(Digest::ID digest)
-{
-  switch (digest) {
-    case Digest::ID::SHA256:
-      return EVP_sha256();
-
-    case Digest::ID::SHA384:
-      return EVP_sha384();
-
-    case Digest::ID::SHA512:
-      return EVP_sha512();
-
-    default:
-      throw std::runtime_error("Unsupported ciphersuite");
-  }
-}
-
 template<>
 const Digest&
 Digest::get<Digest::ID::SHA256>()
 {
-  static const Digest instance(Digest::ID::SHA256);
+  static const auto& instance = Backend::select(Digest::ID::SHA256);
   return instance;
 }
 
@@ -37,7 +21,7 @@ template<>
 const Digest&
 Digest::get<Digest::ID::SHA384>()
 {
-  static const Digest instance(Digest::ID::SHA384);
+  static const auto& instance = Backend::select(Digest::ID::SHA384);
   return instance;
 }
 
@@ -45,10 +29,43 @@ template<>
 const Digest&
 Digest::get<Digest::ID::SHA512>()
 {
-  static const Digest instance(Digest::ID::SHA512);
+  static const auto& instance = Backend::select(Digest::ID::SHA512);
   return instance;
 }
 
+// The base Digest operations are the OpenSSL implementation
+struct OpenSSLDigest : Digest
+{
+  explicit OpenSSLDigest(Digest::ID id_in)
+    : Digest(id_in)
+  {
+  }
+};
+
+const Digest&
+openssl_digest(Digest::ID id)
+{
+  switch (id) {
+    case Digest::ID::SHA256: {
+      static const auto instance = OpenSSLDigest(Digest::ID::SHA256);
+      return instance;
+    }
+
+    case Digest::ID::SHA384: {
+      static const auto instance = OpenSSLDigest(Digest::ID::SHA384);
+      return instance;
+    }
+
+    case Digest::ID::SHA512: {
+      static const auto instance = OpenSSLDigest(Digest::ID::SHA512);
+      return instance;
+    }
+
+    default:
+      throw std::runtime_error("Unsupported algorithm");
+  }
+}
+
 Digest::Digest(Digest::ID id_in)
   : id(id_in)
   , hash_size(EVP_MD_size(openssl_digest_type(id_in)))
@@ -56,7 +73,7 @@ Digest::Digest(Digest::ID id_in)
 }
 
 bytes
-Digest::hash(const bytes& data) const
+Digest::hash(bytes_view data) const
 {
   auto md = bytes(hash_size);
   unsigned int size = 0;
@@ -69,27 +86,287 @@ Digest::hash(const bytes& data) const
   return md;
 }
 
+// HMAC_Init_ex treats a null key as "reuse the current key", so an empty key
+// needs a non-null pointer
+static const uint8_t*
+hmac_key_data(bytes_view key)
+{
+  static const auto non_null_zero_length_key = uint8_t(0);
+  if (key.data() == nullptr) {
+    return &non_null_zero_length_key;
+  }
+
+  return key.data();
+}
+
 bytes
-Digest::hmac(const bytes& key, const bytes& data) const
+Digest::hmac(bytes_view key, bytes_view data) const
 {
+  // One-shot HMAC() sets up and tears down a context on every call, so each
+  // thread keeps one context and re-keys it instead.  An ASYNC job can pause
+  // while another job uses the thread, so a job gets a context of its own.
+  thread_local const auto thread_ctx = make_typed_unique(HMAC_CTX_new());
+  const auto in_job = AsyncBatch::in_job();
+  const auto job_ctx = make_typed_unique(in_job ? HMAC_CTX_new() : nullptr);
+  const auto& ctx = in_job ? job_ctx : thread_ctx;
+  if (ctx == nullptr) {
+    throw openssl_error();
+  }
+
+  const auto* type = openssl_digest_type(id);
+  const auto key_size = static_cast<int>(key.size());
+  const auto* key_data = hmac_key_data(key);
   auto md = bytes(hash_size);
   unsigned int size = 0;
-  const auto* type = openssl_digest_type(id);
-  if (nullptr == HMAC(type,
-                      key.data(),
-                      static_cast<int>(key.size()),
-                      data.data(),
-                      static_cast<int>(data.size()),
-                      md.data(),
-                      &size)) {
+  const auto ok =
+    1 == HMAC_Init_ex(ctx.get(), key_data, key_size, type, nullptr) &&
+    1 == HMAC_Update(ctx.get(), data.data(), data.size()) &&
+    1 == HMAC_Final(ctx.get(), md.data(), &size);
+
+  // The context holds the keyed digest state, which is wiped as soon as the
+  // MAC is done, rather than living as long as the thread
+  HMAC_CTX_reset(ctx.get());
+  if (!ok) {
     throw openssl_error();
   }
 
   return md;
 }
 
+struct OpenSSLKeyedHMAC : Digest::KeyedHMAC
+{
+  OpenSSLKeyedHMAC(const EVP_MD* type, bytes_view key, size_t hash_size_in)
+    : ctx(make_typed_unique(HMAC_CTX_new()))
+    , hash_size(hash_size_in)
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    // Guard against sending nullptr to HMAC_Init_ex
+    const auto* key_data = key.data();
+    const auto non_null_zero_length_key = uint8_t(0);
+    if (key_data == nullptr) {
+      key_data = &non_null_zero_length_key;
+    }
+
+    const auto key_size = static_cast<int>(key.size());
+    if (1 != HMAC_Init_ex(ctx.get(), key_data, key_size, type, nullptr)) {
+      throw openssl_error();
+    }
+  }
+
+  ~OpenSSLKeyedHMAC() override = default;
+
+  bytes hmac(bytes_view data) override
+  {
+    // After the first message, re-initialize with a null key and digest, which
+    // restores the keyed state without hashing the key again
+    if (used &&
+        1 != HMAC_Init_ex(ctx.get(), nullptr, 0, nullptr, nullptr)) {
+      throw openssl_error();
+    }
+    used = true;
+
+    if (1 != HMAC_Update(ctx.get(), data.data(), data.size())) {
+      throw openssl_error();
+    }
+
+    auto md = bytes(hash_size);
+    unsigned int size = 0;
+    if (1 != HMAC_Final(ctx.get(), md.data(), &size)) {
+      throw openssl_error();
+    }
+
+    return md;
+  }
+
+private:
+  typed_unique_ptr<HMAC_CTX> ctx;
+  const size_t hash_size;
+  bool used = false;
+};
+
+std::unique_ptr<Digest::KeyedHMAC>
+Digest::keyed_hmac(bytes_view key) const
+{
+  return std::make_unique<OpenSSLKeyedHMAC>(
+    openssl_digest_type(id), key, hash_size);
+}
+
+///
+/// Incremental contexts
+///
+
+struct HashContext : Digest::Context::Impl
+{
+  HashContext(const EVP_MD* type, size_t hash_size_in)
+    : ctx(make_typed_unique(EVP_MD_CTX_new()))
+    , hash_size(hash_size_in)
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    if (1 != EVP_DigestInit_ex(ctx.get(), type, nullptr)) {
+      throw openssl_error();
+    }
+  }
+
+  HashContext(const HashContext& other)
+    : ctx(make_typed_unique(EVP_MD_CTX_new()))
+    , hash_size(other.hash_size)
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    if (1 != EVP_MD_CTX_copy_ex(ctx.get(), other.ctx.get())) {
+      throw openssl_error();
+    }
+  }
+
+  std::unique_ptr<Impl> clone() const override
+  {
+    return std::make_unique<HashContext>(*this);
+  }
+
+  void update(bytes_view data) override
+  {
+    if (1 != EVP_DigestUpdate(ctx.get(), data.data(), data.size())) {
+      throw openssl_error();
+    }
+  }
+
+  bytes finish() override
+  {
+    auto md = bytes(hash_size);
+    unsigned int size = 0;
+    if (1 != EVP_DigestFinal_ex(ctx.get(), md.data(), &size)) {
+      throw openssl_error();
+    }
+
+    return md;
+  }
+
+private:
+  typed_unique_ptr<EVP_MD_CTX> ctx;
+  const size_t hash_size;
+};
+
+struct HMACContext : Digest::Context::Impl
+{
+  HMACContext(const EVP_MD* type, bytes_view key, size_t hash_size_in)
+    : ctx(make_typed_unique(HMAC_CTX_new()))
+    , hash_size(hash_size_in)
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    const auto key_size = static_cast<int>(key.size());
+    const auto* key_data = hmac_key_data(key);
+    if (1 != HMAC_Init_ex(ctx.get(), key_data, key_size, type, nullptr)) {
+      throw openssl_error();
+    }
+  }
+
+  HMACContext(const HMACContext& other)
+    : ctx(make_typed_unique(HMAC_CTX_new()))
+    , hash_size(other.hash_size)
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    if (1 != HMAC_CTX_copy(ctx.get(), other.ctx.get())) {
+      throw openssl_error();
+    }
+  }
+
+  std::unique_ptr<Impl> clone() const override
+  {
+    return std::make_unique<HMACContext>(*this);
+  }
+
+  void update(bytes_view data) override
+  {
+    if (1 != HMAC_Update(ctx.get(), data.data(), data.size())) {
+      throw openssl_error();
+    }
+  }
+
+  bytes finish() override
+  {
+    auto md = bytes(hash_size);
+    unsigned int size = 0;
+    if (1 != HMAC_Final(ctx.get(), md.data(), &size)) {
+      throw openssl_error();
+    }
+
+    return md;
+  }
+
+private:
+  typed_unique_ptr<HMAC_CTX> ctx;
+  const size_t hash_size;
+};
+
+Digest::Context::Context(std::unique_ptr<Impl> impl_in)
+  : impl(std::move(impl_in))
+{
+}
+
+Digest::Context::Context(const Context& other)
+  : impl(other.impl->clone())
+{
+}
+
+Digest::Context::Context(Context&& other) noexcept = default;
+
+Digest::Context&
+Digest::Context::operator=(const Context& other)
+{
+  if (this != &other) {
+    impl = other.impl->clone();
+  }
+
+  return *this;
+}
+
+Digest::Context&
+Digest::Context::operator=(Context&& other) noexcept = default;
+
+Digest::Context::~Context() = default;
+
+void
+Digest::Context::update(bytes_view data)
+{
+  impl->update(data);
+}
+
+bytes
+Digest::Context::finish()
+{
+  return impl->finish();
+}
+
+Digest::Context
+Digest::hash_context() const
+{
+  return Context(
+    std::make_unique<HashContext>(openssl_digest_type(id), hash_size));
+}
+
+Digest::Context
+Digest::hmac_context(bytes_view key) const
+{
+  return Context(
+    std::make_unique<HMACContext>(openssl_digest_type(id), key, hash_size));
+}
+
 bytes
-Digest::hmac_for_hkdf_extract(const bytes& key, const bytes& data) const
+Digest::hmac_for_hkdf_extract(bytes_view key, bytes_view data) const
 {
   const auto* type = openssl_digest_type(id);
   auto ctx = make_typed_unique(HMAC_CTX_new());
@@ -1,5 +1,6 @@
 #include "group.h"
 
+#include <hpke/async.h>
 #include <hpke/random.h>
 
 #include "common.h"
@@ -62,7 +63,12 @@ EVPGroup::dh(const Group::PrivateKey& sk, const Group::PublicKey& pk) const
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-const-cast)
   auto* pub_pkey = const_cast<EVP_PKEY*>(rpk.pkey.get());
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  auto ctx = make_typed_unique(
+    EVP_PKEY_CTX_new_from_pkey(openssl_library_context(), priv_pkey, nullptr));
+#else
   auto ctx = make_typed_unique(EVP_PKEY_CTX_new(priv_pkey, nullptr));
+#endif
   if (ctx == nullptr) {
     throw openssl_error();
   }
@@ -99,10 +105,22 @@ EVPGroup::sign(const bytes& data, const Group::PrivateKey& sk) const
     throw openssl_error();
   }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  if (1 != EVP_DigestSignInit_ex(ctx.get(),
+                                 nullptr,
+                                 nullptr,
+                                 openssl_library_context(),
+                                 nullptr,
+                                 rsk.pkey.get(),
+                                 nullptr)) {
+    throw openssl_error();
+  }
+#else
   if (1 != EVP_DigestSignInit(
              ctx.get(), nullptr, nullptr, nullptr, rsk.pkey.get())) {
     throw openssl_error();
   }
+#endif
 
   size_t siglen = EVP_PKEY_size(rsk.pkey.get());
   bytes sig(siglen);
@@ -127,10 +145,22 @@ EVPGroup::verify(const bytes& data,
     throw openssl_error();
   }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  if (1 != EVP_DigestVerifyInit_ex(ctx.get(),
+                                   nullptr,
+                                   nullptr,
+                                   openssl_library_context(),
+                                   nullptr,
+                                   rpk.pkey.get(),
+                                   nullptr)) {
+    throw openssl_error();
+  }
+#else
   if (1 != EVP_DigestVerifyInit(
              ctx.get(), nullptr, nullptr, nullptr, rpk.pkey.get())) {
     throw openssl_error();
   }
+#endif
 
   auto rv = EVP_DigestVerify(
     ctx.get(), sig.data(), sig.size(), data.data(), data.size());
@@ -147,6 +177,7 @@ struct ECKeyGroup : public EVPGroup
   ECKeyGroup(Group::ID group_id, const KDF& kdf)
     : EVPGroup(group_id, kdf)
     , curve_nid(group_to_nid(group_id))
+    , order(curve_order(curve_nid))
   {
   }
 
@@ -160,18 +191,12 @@ struct ECKeyGroup : public EVPGroup
 
     auto dkp_prk = kdf.labeled_extract(suite_id, {}, label_dkp_prk, ikm);
 
-    auto eckey = make_typed_unique(new_ec_key());
-    const auto* group = EC_KEY_get0_group(eckey.get());
-
-    auto order = make_typed_unique(BN_new());
-    if (1 != EC_GROUP_get_order(group, order.get(), nullptr)) {
-      throw openssl_error();
-    }
-
+    // Each candidate is read into the same BIGNUM
     auto sk = make_typed_unique(BN_new());
-    if (1 != BN_zero(sk.get())) {
+    if (sk == nullptr || 1 != BN_zero(sk.get())) {
       throw openssl_error();
     }
+    BN_set_flags(sk.get(), BN_FLG_CONSTTIME);
 
     auto counter = int(0);
     while (BN_is_zero(sk.get()) != 0 || BN_cmp(sk.get(), order.get()) != -1) {
@@ -179,8 +204,11 @@ struct ECKeyGroup : public EVPGroup
       auto candidate =
         kdf.labeled_expand(suite_id, dkp_prk, label_candidate, ctr, sk_size);
       candidate.at(0) &= bitmask();
-      sk.reset(BN_bin2bn(
-        candidate.data(), static_cast<int>(candidate.size()), nullptr));
+      if (nullptr == BN_bin2bn(candidate.data(),
+                               static_cast<int>(candidate.size()),
+                               sk.get())) {
+        throw openssl_error();
+      }
 
       counter += 1;
       if (counter > retry_limit) {
@@ -188,13 +216,7 @@ struct ECKeyGroup : public EVPGroup
       }
     }
 
-    auto pt = make_typed_unique(EC_POINT_new(group));
-    EC_POINT_mul(group, pt.get(), sk.get(), nullptr, nullptr, nullptr);
-
-    EC_KEY_set_private_key(eckey.get(), sk.get());
-    EC_KEY_set_public_key(eckey.get(), pt.get());
-
-    return std::make_unique<PrivateKey>(to_pkey(eckey.release()));
+    return key_from_scalar(sk.get());
   }
 
   bytes serialize(const Group::PublicKey& pk) const override
@@ -251,24 +273,65 @@ struct ECKeyGroup : public EVPGroup
   std::unique_ptr<Group::PrivateKey> deserialize_private(
     const bytes& skm) const override
   {
-    auto eckey = make_typed_unique(new_ec_key());
-    const auto* group = EC_KEY_get0_group(eckey.get());
     const auto d = make_typed_unique(
       BN_bin2bn(skm.data(), static_cast<int>(skm.size()), nullptr));
-    auto pt = make_typed_unique(EC_POINT_new(group));
-
-    EC_POINT_mul(group, pt.get(), d.get(), nullptr, nullptr, nullptr);
-    EC_KEY_set_private_key(eckey.get(), d.get());
-    EC_KEY_set_public_key(eckey.get(), pt.get());
+    if (d == nullptr) {
+      throw openssl_error();
+    }
 
-    return std::make_unique<EVPGroup::PrivateKey>(to_pkey(eckey.release()));
+    return key_from_scalar(d.get());
   }
 
 private:
   int curve_nid;
+  typed_unique_ptr<BIGNUM> order;
 
   EC_KEY* new_ec_key() const { return EC_KEY_new_by_curve_name(curve_nid); }
 
+  static typed_unique_ptr<BIGNUM> curve_order(int nid)
+  {
+    auto eckey = make_typed_unique(EC_KEY_new_by_curve_name(nid));
+    auto out = make_typed_unique(BN_new());
+    if (eckey == nullptr || out == nullptr ||
+        1 != EC_GROUP_get_order(
+               EC_KEY_get0_group(eckey.get()), out.get(), nullptr)) {
+      throw openssl_error();
+    }
+
+    return out;
+  }
+
+  // The key pair with the given private scalar.  Each thread keeps a BN_CTX
+  // for computing the public point, instead of one being set up and torn down
+  // for every key.  An ASYNC job, which can pause while another job uses the
+  // thread, gets a BN_CTX of its own.
+  std::unique_ptr<Group::PrivateKey> key_from_scalar(const BIGNUM* d) const
+  {
+    thread_local const auto thread_bn_ctx = make_typed_unique(BN_CTX_new());
+    const auto in_job = AsyncBatch::in_job();
+    const auto job_bn_ctx = make_typed_unique(in_job ? BN_CTX_new() : nullptr);
+    const auto& bn_ctx = in_job ? job_bn_ctx : thread_bn_ctx;
+    if (bn_ctx == nullptr) {
+      throw openssl_error();
+    }
+
+    auto eckey = make_typed_unique(new_ec_key());
+    if (eckey == nullptr) {
+      throw openssl_error();
+    }
+
+    const auto* group = EC_KEY_get0_group(eckey.get());
+    auto pt = make_typed_unique(EC_POINT_new(group));
+    if (pt == nullptr ||
+        1 != EC_POINT_mul(group, pt.get(), d, nullptr, nullptr, bn_ctx.get()) ||
+        1 != EC_KEY_set_private_key(eckey.get(), d) ||
+        1 != EC_KEY_set_public_key(eckey.get(), pt.get())) {
+      throw openssl_error();
+    }
+
+    return std::make_unique<EVPGroup::PrivateKey>(to_pkey(eckey.release()));
+  }
+
   static EVP_PKEY* to_pkey(EC_KEY* eckey)
   {
     auto* pkey = EVP_PKEY_new();
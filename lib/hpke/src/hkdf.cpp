@@ -53,22 +53,45 @@ HKDF::HKDF(const Digest& digest_in)
 }
 
 bytes
-HKDF::extract(const bytes& salt, const bytes& ikm) const
+HKDF::extract(bytes_view salt, bytes_view ikm) const
 {
   return digest.hmac_for_hkdf_extract(salt, ikm);
 }
 
 bytes
-HKDF::expand(const bytes& prk, const bytes& info, size_t size) const
+HKDF::expand(bytes_view prk, bytes_view info, size_t size) const
+{
+  auto hmac = digest.keyed_hmac(prk);
+  return expand_with(*hmac, info, size);
+}
+
+std::vector<bytes>
+HKDF::expand_multi(bytes_view prk, const std::vector<Expansion>& outputs) const
+{
+  auto hmac = digest.keyed_hmac(prk);
+  auto okms = std::vector<bytes>{};
+  okms.reserve(outputs.size());
+  for (const auto& [info, size] : outputs) {
+    okms.push_back(expand_with(*hmac, info, size));
+  }
+
+  return okms;
+}
+
+bytes
+HKDF::expand_with(Digest::KeyedHMAC& hmac, bytes_view info, size_t size)
 {
   auto okm = bytes{};
   auto i = uint8_t(0x00);
   auto Ti = bytes{};
+  auto block = std::vector<uint8_t>{};
   while (okm.size() < size) {
     i += 1;
-    auto block = Ti + info + bytes{ i };
+    block.assign(Ti.begin(), Ti.end());
+    block.insert(block.end(), info.begin(), info.end());
+    block.push_back(i);
 
-    Ti = digest.hmac(prk, block);
+    Ti = hmac.hmac(block);
     okm += Ti;
   }
 
@@ -12,12 +12,19 @@ struct HKDF : public KDF
 
   ~HKDF() override = default;
 
-  bytes extract(const bytes& salt, const bytes& ikm) const override;
-  bytes expand(const bytes& prk, const bytes& info, size_t size) const override;
+  bytes extract(bytes_view salt, bytes_view ikm) const override;
+  bytes expand(bytes_view prk, bytes_view info, size_t size) const override;
+  std::vector<bytes> expand_multi(
+    bytes_view prk,
+    const std::vector<Expansion>& outputs) const override;
 
 private:
   const Digest& digest;
 
+  static bytes expand_with(Digest::KeyedHMAC& hmac,
+                           bytes_view info,
+                           size_t size);
+
   explicit HKDF(const Digest& digest_in);
 };
 
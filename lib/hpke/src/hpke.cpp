@@ -1,3 +1,5 @@
+#include <hpke/async.h>
+#include <hpke/backend.h>
 #include <hpke/digest.h>
 #include <hpke/hpke.h>
 
@@ -6,6 +8,7 @@
 #include "dhkem.h"
 #include "hkdf.h"
 
+#include <algorithm>
 #include <limits>
 #include <stdexcept>
 #include <string>
@@ -100,35 +103,40 @@ template<>
 const KEM&
 KEM::get<KEM::ID::DHKEM_P256_SHA256>()
 {
-  return DHKEM::get<KEM::ID::DHKEM_P256_SHA256>();
+  static const auto& instance = Backend::select(KEM::ID::DHKEM_P256_SHA256);
+  return instance;
 }
 
 template<>
 const KEM&
 KEM::get<KEM::ID::DHKEM_P384_SHA384>()
 {
-  return DHKEM::get<KEM::ID::DHKEM_P384_SHA384>();
+  static const auto& instance = Backend::select(KEM::ID::DHKEM_P384_SHA384);
+  return instance;
 }
 
 template<>
 const KEM&
 KEM::get<KEM::ID::DHKEM_P521_SHA512>()
 {
-  return DHKEM::get<KEM::ID::DHKEM_P521_SHA512>();
+  static const auto& instance = Backend::select(KEM::ID::DHKEM_P521_SHA512);
+  return instance;
 }
 
 template<>
 const KEM&
 KEM::get<KEM::ID::DHKEM_X25519_SHA256>()
 {
-  return DHKEM::get<KEM::ID::DHKEM_X25519_SHA256>();
+  static const auto& instance = Backend::select(KEM::ID::DHKEM_X25519_SHA256);
+  return instance;
 }
 
 template<>
 const KEM&
 KEM::get<KEM::ID::DHKEM_X448_SHA512>()
 {
-  return DHKEM::get<KEM::ID::DHKEM_X448_SHA512>();
+  static const auto& instance = Backend::select(KEM::ID::DHKEM_X448_SHA512);
+  return instance;
 }
 
 bytes
@@ -143,6 +151,28 @@ KEM::deserialize_private(const bytes& /* unused */) const
   throw std::runtime_error("Not implemented");
 }
 
+std::vector<std::pair<bytes, bytes>>
+KEM::encap_batch(const std::vector<const PublicKey*>& pkRs) const
+{
+  auto out = std::vector<std::pair<bytes, bytes>>(pkRs.size());
+  if (!AsyncBatch::offload_available()) {
+    for (size_t i = 0; i < pkRs.size(); i++) {
+      out[i] = encap(*pkRs[i]);
+    }
+
+    return out;
+  }
+
+  // Each job writes only its own entry
+  auto batch = AsyncBatch{};
+  for (size_t i = 0; i < pkRs.size(); i++) {
+    batch.add([&, i]() { out[i] = encap(*pkRs[i]); });
+  }
+
+  batch.run();
+  return out;
+}
+
 std::pair<bytes, bytes>
 KEM::auth_encap(const PublicKey& /* unused */,
                 const PrivateKey& /* unused */) const
@@ -162,21 +192,24 @@ template<>
 const KDF&
 KDF::get<KDF::ID::HKDF_SHA256>()
 {
-  return HKDF::get<Digest::ID::SHA256>();
+  static const auto& instance = Backend::select(KDF::ID::HKDF_SHA256);
+  return instance;
 }
 
 template<>
 const KDF&
 KDF::get<KDF::ID::HKDF_SHA384>()
 {
-  return HKDF::get<Digest::ID::SHA384>();
+  static const auto& instance = Backend::select(KDF::ID::HKDF_SHA384);
+  return instance;
 }
 
 template<>
 const KDF&
 KDF::get<KDF::ID::HKDF_SHA512>()
 {
-  return HKDF::get<Digest::ID::SHA512>();
+  static const auto& instance = Backend::select(KDF::ID::HKDF_SHA512);
+  return instance;
 }
 
 KDF::KDF(ID id_in, size_t hash_size_in)
@@ -185,6 +218,18 @@ KDF::KDF(ID id_in, size_t hash_size_in)
 {
 }
 
+std::vector<bytes>
+KDF::expand_multi(bytes_view prk, const std::vector<Expansion>& outputs) const
+{
+  auto okms = std::vector<bytes>{};
+  okms.reserve(outputs.size());
+  for (const auto& [info, size] : outputs) {
+    okms.push_back(expand(prk, info, size));
+  }
+
+  return okms;
+}
+
 bytes
 KDF::labeled_extract(const bytes& suite_id,
                      const bytes& salt,
@@ -211,21 +256,24 @@ template<>
 const AEAD&
 AEAD::get<AEAD::ID::AES_128_GCM>()
 {
-  return AEADCipher::get<AEAD::ID::AES_128_GCM>();
+  static const auto& instance = Backend::select(AEAD::ID::AES_128_GCM);
+  return instance;
 }
 
 template<>
 const AEAD&
 AEAD::get<AEAD::ID::AES_256_GCM>()
 {
-  return AEADCipher::get<AEAD::ID::AES_256_GCM>();
+  static const auto& instance = Backend::select(AEAD::ID::AES_256_GCM);
+  return instance;
 }
 
 template<>
 const AEAD&
 AEAD::get<AEAD::ID::CHACHA20_POLY1305>()
 {
-  return AEADCipher::get<AEAD::ID::CHACHA20_POLY1305>();
+  static const auto& instance = Backend::select(AEAD::ID::CHACHA20_POLY1305);
+  return instance;
 }
 
 template<>
@@ -243,6 +291,88 @@ AEAD::AEAD(ID id_in, size_t key_size_in, size_t nonce_size_in)
 {
 }
 
+size_t
+AEAD::ciphertext_size(size_t pt_size) const
+{
+  const auto tag = seal(bytes(key_size, 0), bytes(nonce_size, 0), {}, {});
+  return pt_size + tag.size();
+}
+
+void
+AEAD::KeyedContext::seal_into(bytes_view nonce,
+                              bytes_view aad,
+                              const std::vector<bytes_view>& pt,
+                              bytes& out)
+{
+  auto assembled = bytes{};
+  for (const auto& piece : pt) {
+    assembled.as_vec().insert(assembled.end(), piece.begin(), piece.end());
+  }
+
+  const auto ct = seal(nonce, aad, assembled);
+  out.as_vec().insert(out.end(), ct.begin(), ct.end());
+}
+
+void
+AEAD::KeyedContext::seal_to(bytes_view nonce,
+                            bytes_view aad,
+                            bytes_view pt,
+                            uint8_t* ct_out)
+{
+  const auto ct = seal(nonce, aad, pt);
+  std::copy(ct.begin(), ct.end(), ct_out);
+}
+
+bool
+AEAD::KeyedContext::open_to(bytes_view nonce,
+                            bytes_view aad,
+                            bytes_view ct,
+                            uint8_t* pt_out)
+{
+  const auto pt = open(nonce, aad, ct);
+  if (!pt) {
+    return false;
+  }
+
+  std::copy(pt->begin(), pt->end(), pt_out);
+  return true;
+}
+
+// By default, a keyed context just remembers the key and passes it through
+struct GenericKeyedContext : AEAD::KeyedContext
+{
+  GenericKeyedContext(const AEAD& aead_in, bytes_view key_in)
+    : aead(aead_in)
+    , key(key_in)
+  {
+  }
+
+  void set_key(bytes_view key_in) override { key = bytes(key_in); }
+  void clear_key() override { key = bytes{}; }
+
+  bytes seal(bytes_view nonce, bytes_view aad, bytes_view pt) override
+  {
+    return aead.seal(key, nonce, aad, pt);
+  }
+
+  std::optional<bytes> open(bytes_view nonce,
+                            bytes_view aad,
+                            bytes_view ct) override
+  {
+    return aead.open(key, nonce, aad, ct);
+  }
+
+private:
+  const AEAD& aead;
+  bytes key;
+};
+
+std::unique_ptr<AEAD::KeyedContext>
+AEAD::keyed(bytes_view key) const
+{
+  return std::make_unique<GenericKeyedContext>(*this, key);
+}
+
 ///
 /// Encryption Contexts
 ///
@@ -254,11 +384,22 @@ Context::do_export(const bytes& exporter_context, size_t size) const
     suite, exporter_secret, label_sec(), exporter_context, size);
 }
 
-bytes
-Context::current_nonce() const
+bytes_view
+Context::current_nonce(NonceBuffer& buffer) const
 {
-  auto curr = i2osp(seq, aead.nonce_size);
-  return curr ^ nonce;
+  const auto size = nonce.size();
+  if (size > buffer.size()) {
+    throw std::runtime_error("Unsupported nonce size");
+  }
+
+  // The sequence number is XORed into the low-order bytes of the base nonce
+  std::copy(nonce.begin(), nonce.end(), buffer.begin());
+  for (size_t i = 0; i < sizeof(seq) && i < size; i++) {
+    const auto shift = 8 * i;
+    buffer.at(size - 1 - i) ^= static_cast<uint8_t>(seq >> shift);
+  }
+
+  return { buffer.data(), size };
 }
 
 void
@@ -305,9 +446,10 @@ SenderContext::SenderContext(Context&& c)
 }
 
 bytes
-SenderContext::seal(const bytes& aad, const bytes& pt)
+SenderContext::seal(bytes_view aad, bytes_view pt)
 {
-  auto ct = aead.seal(key, current_nonce(), aad, pt);
+  auto buffer = NonceBuffer{};
+  auto ct = aead.seal(key, current_nonce(buffer), aad, pt);
   increment_seq();
   return ct;
 }
@@ -318,9 +460,10 @@ ReceiverContext::ReceiverContext(Context&& c)
 }
 
 std::optional<bytes>
-ReceiverContext::open(const bytes& aad, const bytes& ct)
+ReceiverContext::open(bytes_view aad, bytes_view ct)
 {
-  auto maybe_pt = aead.open(key, current_nonce(), aad, ct);
+  auto buffer = NonceBuffer{};
+  auto maybe_pt = aead.open(key, current_nonce(buffer), aad, ct);
   increment_seq();
   return maybe_pt;
 }
@@ -408,6 +551,21 @@ HPKE::setup_base_s(const KEM::PublicKey& pkR, const bytes& info) const
   return std::make_pair(enc, SenderContext(std::move(ctx)));
 }
 
+std::vector<HPKE::SenderInfo>
+HPKE::setup_base_s(const std::vector<const KEM::PublicKey*>& pkRs,
+                   const bytes& info) const
+{
+  auto out = std::vector<SenderInfo>{};
+  out.reserve(pkRs.size());
+  for (auto& [shared_secret, enc] : kem.encap_batch(pkRs)) {
+    auto ctx = key_schedule(
+      Mode::base, shared_secret, info, default_psk, default_psk_id);
+    out.emplace_back(std::move(enc), SenderContext(std::move(ctx)));
+  }
+
+  return out;
+}
+
 ReceiverContext
 HPKE::setup_base_r(const bytes& enc,
                    const KEM::PrivateKey& skR,
@@ -7,6 +7,8 @@
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 
+#include <atomic>
+
 namespace hpke {
 
 template<>
@@ -51,6 +53,13 @@ typed_delete(BIGNUM* ptr)
   BN_free(ptr);
 }
 
+template<>
+void
+typed_delete(BN_CTX* ptr)
+{
+  BN_CTX_free(ptr);
+}
+
 template<>
 void
 typed_delete(EC_POINT* ptr)
@@ -104,4 +113,97 @@ openssl_error()
   return std::runtime_error(ERR_error_string(code, nullptr));
 }
 
+///
+/// Algorithm handles
+///
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static std::atomic<OSSL_LIB_CTX*> library_context = nullptr;
+static std::atomic<bool> algorithms_fetched = false;
+
+void
+set_openssl_library_context(ossl_lib_ctx_st* libctx)
+{
+  if (algorithms_fetched) {
+    throw std::runtime_error("Library context set after algorithms fetched");
+  }
+
+  library_context = libctx;
+}
+
+OSSL_LIB_CTX*
+openssl_library_context()
+{
+  return library_context;
+}
+
+// The fetched handles are deliberately never freed.  They are cached in
+// function-local statics, and freeing them at exit could race with OpenSSL's
+// own cleanup.
+const EVP_MD*
+fetch_digest(const char* name, const EVP_MD* /* legacy */)
+{
+  algorithms_fetched = true;
+  const auto* md = EVP_MD_fetch(library_context, name, nullptr);
+  if (md == nullptr) {
+    throw openssl_error();
+  }
+
+  return md;
+}
+
+const EVP_CIPHER*
+fetch_cipher(const char* name, const EVP_CIPHER* /* legacy */)
+{
+  algorithms_fetched = true;
+  const auto* cipher = EVP_CIPHER_fetch(library_context, name, nullptr);
+  if (cipher == nullptr) {
+    throw openssl_error();
+  }
+
+  return cipher;
+}
+#else
+void
+set_openssl_library_context(ossl_lib_ctx_st* /* libctx */)
+{
+}
+
+const EVP_MD*
+fetch_digest(const char* /* name */, const EVP_MD* legacy)
+{
+  return legacy;
+}
+
+const EVP_CIPHER*
+fetch_cipher(const char* /* name */, const EVP_CIPHER* legacy)
+{
+  return legacy;
+}
+#endif
+
+const EVP_MD*
+openssl_digest_type(Digest::ID digest)
+{
+  switch (digest) {
+    case Digest::ID::SHA256: {
+      static const auto* const md = fetch_digest("SHA2-256", EVP_sha256());
+      return md;
+    }
+
+    case Digest::ID::SHA384: {
+      static const auto* const md = fetch_digest("SHA2-384", EVP_sha384());
+      return md;
+    }
+
+    case Digest::ID::SHA512: {
+      static const auto* const md = fetch_digest("SHA2-512", EVP_sha512());
+      return md;
+    }
+
+    default:
+      throw std::runtime_error("Unsupported ciphersuite");
+  }
+}
+
 } // namespace hpke
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <hpke/digest.h>
 #include <hpke/hpke.h>
+#include <hpke/signature.h>
 #include <memory>
 #include <stdexcept>
 
+#include <openssl/evp.h>
+
 namespace hpke {
 
 template<typename T>
@@ -23,4 +27,32 @@ make_typed_unique(T* ptr)
 std::runtime_error
 openssl_error();
 
+// Under OpenSSL 3, the legacy handles returned by EVP_sha256() and friends make
+// each operation that uses them fetch the algorithm from a provider, under a
+// global lock.  These fetch each algorithm once, from the library context set
+// with set_openssl_library_context(), and keep the handle for the life of the
+// process.  Before OpenSSL 3 there are no providers, and the legacy handles are
+// returned as is.
+const EVP_MD*
+fetch_digest(const char* name, const EVP_MD* legacy);
+
+const EVP_CIPHER*
+fetch_cipher(const char* name, const EVP_CIPHER* legacy);
+
+const EVP_MD*
+openssl_digest_type(Digest::ID digest);
+
+// The built-in implementations of algorithms that have no internal class of
+// their own, for Backend::openssl()
+const Digest&
+openssl_digest(Digest::ID id);
+
+const Signature&
+openssl_signature(Signature::ID id);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+OSSL_LIB_CTX*
+openssl_library_context();
+#endif
+
 } // namespace hpke
@@ -0,0 +1,18 @@
+#pragma once
+
+// Static tracepoints (USDT) on the KEM, signature and AEAD operations, which
+// bpftrace, perf or SystemTap can attach to in a running process, e.g.:
+//
+//   bpftrace -e 'usdt:./app:hpke:sign_start { @[arg0] = count(); }'
+//
+// Each operation has a probe where it starts and one where it completes; an
+// operation that throws does not reach the second.  The first argument is the
+// algorithm ID and the second, where there is one, a byte count.  Probes are compiled in only when MLSPP_USDT is defined, as it is by
+// the USDT build option; a compiled-in probe is a nop until a tracer attaches
+// to it.
+#if defined(MLSPP_USDT)
+#include <sys/sdt.h>
+#define HPKE_PROBE(name, ...) STAP_PROBEV(hpke, name, __VA_ARGS__)
+#else
+#define HPKE_PROBE(name, ...) static_cast<void>(0)
+#endif
@@ -1,18 +1,259 @@
+#include <hpke/async.h>
+#include <hpke/digest.h>
 #include <hpke/random.h>
 
 #include "openssl_common.h"
 
 #include <openssl/rand.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace hpke {
 
+template<typename T>
+static void
+system_random(T& out)
+{
+  if (1 != RAND_bytes(out.data(), static_cast<int>(out.size()))) {
+    throw openssl_error();
+  }
+}
+
+static long
+process_id()
+{
+#if defined(_WIN32)
+  return static_cast<long>(_getpid());
+#else
+  return static_cast<long>(getpid());
+#endif
+}
+
+///
+/// Per-thread DRBG
+///
+
+class ThreadDRBG
+{
+public:
+  static constexpr size_t key_size = 32;
+  static constexpr size_t buffer_size = 256;
+  static constexpr size_t reseed_interval = size_t(1) << 20;
+
+  ThreadDRBG()
+    : ctx(make_typed_unique(EVP_CIPHER_CTX_new()))
+    , key(key_size)
+    , buffer(buffer_size)
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+  }
+
+  void generate(bytes& out)
+  {
+    auto offset = size_t(0);
+    while (offset < out.size()) {
+      if (pos == buffer.size()) {
+        refill();
+      }
+
+      // Output is wiped from the buffer once it has been handed out
+      const auto n = std::min(out.size() - offset, buffer.size() - pos);
+      const auto start = buffer.begin() + static_cast<ptrdiff_t>(pos);
+      const auto end = start + static_cast<ptrdiff_t>(n);
+      std::copy(start, end, out.begin() + static_cast<ptrdiff_t>(offset));
+      std::fill(start, end, uint8_t(0));
+
+      pos += n;
+      offset += n;
+    }
+  }
+
+private:
+  // The generator's state is kept in locked memory, out of swap
+  typed_unique_ptr<EVP_CIPHER_CTX> ctx;
+  secure_vector key;
+  secure_vector buffer;
+  size_t pos = buffer_size;
+  size_t since_reseed = 0;
+  long seeded_pid = -1;
+
+  void reseed()
+  {
+    system_random(key);
+    seeded_pid = process_id();
+    since_reseed = 0;
+  }
+
+  // Encrypt zeros under the current key, keeping the first block of output as
+  // the next key and the rest as the buffer
+  void refill()
+  {
+    if (seeded_pid != process_id() || since_reseed >= reseed_interval) {
+      reseed();
+    }
+
+    static const auto* cipher =
+      fetch_cipher("AES-256-CTR", EVP_aes_256_ctr());
+    static const auto iv = bytes(16, 0);
+    if (1 != EVP_EncryptInit_ex(
+               ctx.get(), cipher, nullptr, key.data(), iv.data())) {
+      throw openssl_error();
+    }
+
+    auto stream = secure_vector(key_size + buffer_size, 0);
+    auto outlen = int(0);
+    if (1 != EVP_EncryptUpdate(ctx.get(),
+                               stream.data(),
+                               &outlen,
+                               stream.data(),
+                               static_cast<int>(stream.size()))) {
+      throw openssl_error();
+    }
+
+    const auto split = stream.begin() + static_cast<ptrdiff_t>(key_size);
+    std::copy(stream.begin(), split, key.begin());
+    std::copy(split, stream.end(), buffer.begin());
+    pos = 0;
+    since_reseed += buffer_size;
+  }
+};
+
+#if defined(HPKE_SEEDED_RANDOM)
+///
+/// Seeded generator, for deterministic runs
+///
+
+class SeededDRBG
+{
+public:
+  static SeededDRBG& get()
+  {
+    static auto instance = SeededDRBG{};
+    return instance;
+  }
+
+  void seed(const bytes& seed)
+  {
+    const auto lock = std::lock_guard(mutex);
+    start(seed);
+  }
+
+  // The output is the AES-256-CTR keystream under the seed's hash, continued
+  // from one call to the next
+  void generate(bytes& out)
+  {
+    const auto lock = std::lock_guard(mutex);
+    if (!seeded) {
+      start({});
+    }
+
+    std::fill(out.begin(), out.end(), uint8_t(0));
+    auto outlen = int(0);
+    if (1 != EVP_EncryptUpdate(ctx.get(),
+                               out.data(),
+                               &outlen,
+                               out.data(),
+                               static_cast<int>(out.size()))) {
+      throw openssl_error();
+    }
+  }
+
+private:
+  std::mutex mutex;
+  typed_unique_ptr<EVP_CIPHER_CTX> ctx;
+  bool seeded = false;
+
+  SeededDRBG()
+    : ctx(make_typed_unique(EVP_CIPHER_CTX_new()))
+  {
+    if (ctx == nullptr) {
+      throw openssl_error();
+    }
+  }
+
+  void start(const bytes& seed)
+  {
+    static const auto* cipher =
+      fetch_cipher("AES-256-CTR", EVP_aes_256_ctr());
+    static const auto iv = bytes(16, 0);
+    const auto& sha256 = Digest::get<Digest::ID::SHA256>();
+    const auto key = sha256.hash(from_ascii("mlspp seeded random") + seed);
+    if (1 != EVP_EncryptInit_ex(
+               ctx.get(), cipher, nullptr, key.data(), iv.data())) {
+      throw openssl_error();
+    }
+
+    seeded = true;
+  }
+};
+#endif
+
+static std::atomic<RandomSource> current_source{ RandomSource::system };
+
+void
+set_random_source(RandomSource source)
+{
+  current_source.store(source);
+}
+
+#if defined(HPKE_SEEDED_RANDOM)
+void
+set_random_seed(const bytes& seed)
+{
+  SeededDRBG::get().seed(seed);
+}
+#endif
+
+RandomSource
+random_source()
+{
+  return current_source.load();
+}
+
 bytes
 random_bytes(size_t size)
 {
   auto rand = bytes(size);
-  if (1 != RAND_bytes(rand.data(), static_cast<int>(size))) {
-    throw openssl_error();
+  if (size == 0) {
+    return rand;
   }
+
+  switch (current_source.load(std::memory_order_relaxed)) {
+    case RandomSource::thread_local_drbg: {
+      // An ASYNC job can pause in the middle of a refill while another job
+      // uses the thread, so jobs draw from the system source instead
+      if (AsyncBatch::in_job()) {
+        system_random(rand);
+        break;
+      }
+
+      thread_local auto drbg = ThreadDRBG{};
+      drbg.generate(rand);
+      break;
+    }
+
+#if defined(HPKE_SEEDED_RANDOM)
+    case RandomSource::seeded:
+      SeededDRBG::get().generate(rand);
+      break;
+#endif
+
+    case RandomSource::system:
+    default:
+      system_random(rand);
+      break;
+  }
+
   return rand;
 }
 
@@ -3,6 +3,7 @@
 #include "common.h"
 #include "openssl/rsa.h"
 #include "openssl_common.h"
+#include "probe.h"
 
 namespace hpke {
 
@@ -101,6 +102,7 @@ bytes
 RSASignature::sign(const bytes& data, const Signature::PrivateKey& sk) const
 {
   const auto& rsk = dynamic_cast<const PrivateKey&>(sk);
+  HPKE_PROBE(sign_start, static_cast<uint16_t>(id), data.size());
 
   auto ctx = make_typed_unique(EVP_MD_CTX_create());
   if (ctx == nullptr) {
@@ -120,6 +122,7 @@ RSASignature::sign(const bytes& data, const Signature::PrivateKey& sk) const
   }
 
   sig.resize(siglen);
+  HPKE_PROBE(sign_done, static_cast<uint16_t>(id), data.size());
   return sig;
 }
 
@@ -129,6 +132,7 @@ RSASignature::verify(const bytes& data,
                      const Signature::PublicKey& pk) const
 {
   const auto& rpk = dynamic_cast<const PublicKey&>(pk);
+  HPKE_PROBE(verify_start, static_cast<uint16_t>(id), data.size());
 
   auto ctx = make_typed_unique(EVP_MD_CTX_create());
   if (ctx == nullptr) {
@@ -143,23 +147,14 @@ RSASignature::verify(const bytes& data,
   auto rv = EVP_DigestVerify(
     ctx.get(), sig.data(), sig.size(), data.data(), data.size());
 
+  HPKE_PROBE(verify_done, static_cast<uint16_t>(id), data.size());
   return rv == 1;
 }
 
 const EVP_MD*
 RSASignature::digest_to_md(Digest::ID digest)
 {
-  // NOLINTNEXTLINE(hicpp-multiway-paths-covered)
-  switch (digest) {
-    case Digest::ID::SHA256:
-      return EVP_sha256();
-    case Digest::ID::SHA384:
-      return EVP_sha384();
-    case Digest::ID::SHA512:
-      return EVP_sha512();
-    default:
-      throw std::runtime_error("Unsupported digest");
-  }
+  return openssl_digest_type(digest);
 }
 
 Signature::ID
@@ -1,3 +1,4 @@
+#include <hpke/backend.h>
 #include <hpke/digest.h>
 #include <hpke/signature.h>
 
@@ -5,6 +6,8 @@
 
 #include "common.h"
 #include "group.h"
+#include "openssl_common.h"
+#include "probe.h"
 #include "rsa.h"
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
@@ -92,7 +95,10 @@ struct GroupSignature : public Signature
   bytes sign(const bytes& data, const Signature::PrivateKey& sk) const override
   {
     const auto& rsk = dynamic_cast<const PrivateKey&>(sk);
-    return group.sign(data, *rsk.group_priv);
+    HPKE_PROBE(sign_start, static_cast<uint16_t>(id), data.size());
+    auto sig = group.sign(data, *rsk.group_priv);
+    HPKE_PROBE(sign_done, static_cast<uint16_t>(id), data.size());
+    return sig;
   }
 
   bool verify(const bytes& data,
@@ -100,7 +106,10 @@ struct GroupSignature : public Signature
               const Signature::PublicKey& pk) const override
   {
     const auto& rpk = dynamic_cast<const Group::PublicKey&>(pk);
-    return group.verify(data, sig, rpk);
+    HPKE_PROBE(verify_start, static_cast<uint16_t>(id), data.size());
+    const auto valid = group.verify(data, sig, rpk);
+    HPKE_PROBE(verify_done, static_cast<uint16_t>(id), data.size());
+    return valid;
   }
 
 private:
@@ -111,7 +120,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::P256_SHA256>()
 {
-  static const auto instance = GroupSignature(Group::get<Group::ID::P256>());
+  static const auto& instance = Backend::select(Signature::ID::P256_SHA256);
   return instance;
 }
 
@@ -119,7 +128,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::P384_SHA384>()
 {
-  static const auto instance = GroupSignature(Group::get<Group::ID::P384>());
+  static const auto& instance = Backend::select(Signature::ID::P384_SHA384);
   return instance;
 }
 
@@ -127,7 +136,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::P521_SHA512>()
 {
-  static const auto instance = GroupSignature(Group::get<Group::ID::P521>());
+  static const auto& instance = Backend::select(Signature::ID::P521_SHA512);
   return instance;
 }
 
@@ -135,7 +144,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::Ed25519>()
 {
-  static const auto instance = GroupSignature(Group::get<Group::ID::Ed25519>());
+  static const auto& instance = Backend::select(Signature::ID::Ed25519);
   return instance;
 }
 
@@ -143,7 +152,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::Ed448>()
 {
-  static const auto instance = GroupSignature(Group::get<Group::ID::Ed448>());
+  static const auto& instance = Backend::select(Signature::ID::Ed448);
   return instance;
 }
 
@@ -151,7 +160,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::RSA_SHA256>()
 {
-  static const auto instance = RSASignature(Digest::ID::SHA256);
+  static const auto& instance = Backend::select(Signature::ID::RSA_SHA256);
   return instance;
 }
 
@@ -159,7 +168,7 @@ template<>
 const Signature&
 Signature::get<Signature::ID::RSA_SHA384>()
 {
-  static const auto instance = RSASignature(Digest::ID::SHA384);
+  static const auto& instance = Backend::select(Signature::ID::RSA_SHA384);
   return instance;
 }
 
@@ -167,10 +176,64 @@ template<>
 const Signature&
 Signature::get<Signature::ID::RSA_SHA512>()
 {
-  static const auto instance = RSASignature(Digest::ID::SHA512);
+  static const auto& instance = Backend::select(Signature::ID::RSA_SHA512);
   return instance;
 }
 
+const Signature&
+openssl_signature(Signature::ID id)
+{
+  switch (id) {
+    case Signature::ID::P256_SHA256: {
+      static const auto instance =
+        GroupSignature(Group::get<Group::ID::P256>());
+      return instance;
+    }
+
+    case Signature::ID::P384_SHA384: {
+      static const auto instance =
+        GroupSignature(Group::get<Group::ID::P384>());
+      return instance;
+    }
+
+    case Signature::ID::P521_SHA512: {
+      static const auto instance =
+        GroupSignature(Group::get<Group::ID::P521>());
+      return instance;
+    }
+
+    case Signature::ID::Ed25519: {
+      static const auto instance =
+        GroupSignature(Group::get<Group::ID::Ed25519>());
+      return instance;
+    }
+
+    case Signature::ID::Ed448: {
+      static const auto instance =
+        GroupSignature(Group::get<Group::ID::Ed448>());
+      return instance;
+    }
+
+    case Signature::ID::RSA_SHA256: {
+      static const auto instance = RSASignature(Digest::ID::SHA256);
+      return instance;
+    }
+
+    case Signature::ID::RSA_SHA384: {
+      static const auto instance = RSASignature(Digest::ID::SHA384);
+      return instance;
+    }
+
+    case Signature::ID::RSA_SHA512: {
+      static const auto instance = RSASignature(Digest::ID::SHA512);
+      return instance;
+    }
+
+    default:
+      throw std::runtime_error("Unsupported algorithm");
+  }
+}
+
 Signature::Signature(Signature::ID id_in)
   : id(id_in)
 {
@@ -188,6 +251,18 @@ Signature::deserialize_private(const bytes& /* unused */) const
   throw std::runtime_error("Not implemented");
 }
 
+bool
+Signature::verify_batch(const std::vector<VerifyItem>& items) const
+{
+  for (const auto& item : items) {
+    if (!verify(item.data, item.sig, item.pk)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 std::unique_ptr<Signature::PrivateKey>
 Signature::generate_rsa(size_t bits)
 {
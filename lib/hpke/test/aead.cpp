@@ -87,6 +87,26 @@ TEST_CASE("AEAD Known-Answer")
 
     auto decrypted = aead.open(tc.key, tc.nonce, tc.aad, tc.ciphertext);
     CHECK(decrypted == tc.plaintext);
+
+    // A keyed context produces the same results, and can be reused across
+    // messages and directions
+    auto ctx = aead.keyed(tc.key);
+    CHECK(ctx->seal(tc.nonce, tc.aad, tc.plaintext) == tc.ciphertext);
+    CHECK(ctx->open(tc.nonce, tc.aad, tc.ciphertext) == tc.plaintext);
+    CHECK(ctx->seal(tc.nonce, tc.aad, tc.plaintext) == tc.ciphertext);
+
+    // Re-keying the context gives the same results as one-shot encryption
+    const auto other_key = bytes(aead.key_size, 0xA0);
+    const auto other_nonce = bytes(aead.nonce_size, 0xA1);
+    ctx->set_key(other_key);
+    const auto other_ct = ctx->seal(other_nonce, tc.aad, tc.plaintext);
+    CHECK(other_ct == aead.seal(other_key, other_nonce, tc.aad, tc.plaintext));
+    CHECK(ctx->open(other_nonce, tc.aad, other_ct) == tc.plaintext);
+
+    // A context whose key has been wiped can be keyed again
+    ctx->clear_key();
+    ctx->set_key(tc.key);
+    CHECK(ctx->seal(tc.nonce, tc.aad, tc.plaintext) == tc.ciphertext);
   }
 }
 
@@ -109,3 +129,68 @@ TEST_CASE("AEAD Round-Trip")
     CHECK(decrypted == plaintext);
   }
 }
+
+TEST_CASE("AEAD Seal into Buffer")
+{
+  const std::vector<AEAD::ID> ids{ AEAD::ID::AES_128_GCM,
+                                   AEAD::ID::AES_256_GCM,
+                                   AEAD::ID::CHACHA20_POLY1305 };
+
+  const auto pieces = std::vector<bytes>{
+    from_hex("0001"), {}, bytes(100, 0x02), from_hex("03")
+  };
+  const auto plaintext = pieces[0] + pieces[1] + pieces[2] + pieces[3];
+  const auto aad = from_hex("04050607");
+  const auto prefix = from_hex("a0a1a2");
+
+  for (const auto& id : ids) {
+    const auto& aead = select_aead(id);
+    auto key = bytes(aead.key_size, 0xA0);
+    auto nonce = bytes(aead.nonce_size, 0xA1);
+
+    const auto encrypted = aead.seal(key, nonce, aad, plaintext);
+    CHECK(aead.ciphertext_size(plaintext.size()) == encrypted.size());
+
+    // The ciphertext of the pieces is appended to the buffer
+    auto ctx = aead.keyed(key);
+    auto out = prefix;
+    const auto views = std::vector<bytes_view>(pieces.begin(), pieces.end());
+    ctx->seal_into(nonce, aad, views, out);
+    CHECK(out == prefix + encrypted);
+  }
+}
+
+TEST_CASE("AEAD Seal and Open in Place")
+{
+  const std::vector<AEAD::ID> ids{ AEAD::ID::AES_128_GCM,
+                                   AEAD::ID::AES_256_GCM,
+                                   AEAD::ID::CHACHA20_POLY1305 };
+
+  const auto plaintext = bytes(100, 0x02);
+  const auto aad = from_hex("04050607");
+
+  for (const auto& id : ids) {
+    const auto& aead = select_aead(id);
+    auto key = bytes(aead.key_size, 0xA0);
+    auto nonce = bytes(aead.nonce_size, 0xA1);
+    const auto encrypted = aead.seal(key, nonce, aad, plaintext);
+
+    // Sealing over the plaintext leaves the ciphertext and tag in its place
+    auto ctx = aead.keyed(key);
+    auto buffer = plaintext;
+    buffer.resize(aead.ciphertext_size(plaintext.size()));
+    ctx->seal_to(
+      nonce, aad, bytes_view(buffer).slice(0, plaintext.size()), buffer.data());
+    CHECK(buffer == encrypted);
+
+    // Opening over the ciphertext leaves the plaintext at its start
+    REQUIRE(ctx->open_to(nonce, aad, buffer, buffer.data()));
+    CHECK(buffer.slice(0, plaintext.size()) == plaintext);
+
+    // A corrupted tag is rejected, as by open()
+    auto corrupted = encrypted;
+    corrupted.at(corrupted.size() - 1) ^= 0x01;
+    auto out = bytes(plaintext.size());
+    REQUIRE_THROWS(ctx->open_to(nonce, aad, corrupted, out.data()));
+  }
+}
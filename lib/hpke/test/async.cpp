@@ -0,0 +1,86 @@
+#include <doctest/doctest.h>
+#include <hpke/async.h>
+#include <hpke/digest.h>
+#include <hpke/signature.h>
+
+#include "common.h"
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+TEST_CASE("Async Batch of Signatures")
+{
+  ensure_fips_if_required();
+
+  const auto& sig = select_signature(Signature::ID::P256_SHA256);
+  const auto data = from_hex("00010203");
+  const auto batch_size = size_t(16);
+
+  auto privs = std::vector<std::unique_ptr<Signature::PrivateKey>>{};
+  auto signatures = std::vector<bytes>(batch_size);
+  auto batch = AsyncBatch{};
+  for (size_t i = 0; i < batch_size; i++) {
+    privs.push_back(sig.generate_key_pair());
+    batch.add([&, i]() { signatures.at(i) = sig.sign(data, *privs.at(i)); });
+  }
+
+  REQUIRE(batch.size() == batch_size);
+  batch.run();
+  REQUIRE(batch.size() == 0);
+
+  for (size_t i = 0; i < batch_size; i++) {
+    auto pub = privs.at(i)->public_key();
+    CHECK(sig.verify(data, signatures.at(i), *pub));
+  }
+}
+
+TEST_CASE("Async Batch Rethrows the First Error")
+{
+  auto ran = std::vector<bool>(3, false);
+  auto batch = AsyncBatch{};
+  batch.add([&]() { ran.at(0) = true; });
+  batch.add([&]() {
+    ran.at(1) = true;
+    throw std::runtime_error("first");
+  });
+  batch.add([&]() {
+    ran.at(2) = true;
+    throw std::logic_error("second");
+  });
+
+  // Every operation runs, even after one of them fails
+  REQUIRE_THROWS_AS(batch.run(), std::runtime_error);
+  CHECK(ran == std::vector<bool>{ true, true, true });
+}
+
+TEST_CASE("Async Batch Jobs Use Their Own Thread-Local State")
+{
+  ensure_fips_if_required();
+
+  const auto& digest = Digest::get<Digest::ID::SHA256>();
+  const auto key = from_hex("000102030405060708090a0b0c0d0e0f");
+  const auto data = from_hex("00010203");
+  const auto expected = digest.hmac(key, data);
+  const auto batch_size = size_t(8);
+
+  REQUIRE_FALSE(AsyncBatch::in_job());
+
+  auto in_job = std::vector<bool>(batch_size, false);
+  auto macs = std::vector<bytes>(batch_size);
+  auto batch = AsyncBatch{};
+  for (size_t i = 0; i < batch_size; i++) {
+    batch.add([&, i]() {
+      in_job.at(i) = AsyncBatch::in_job();
+      macs.at(i) = digest.hmac(key, data);
+    });
+  }
+
+  batch.run();
+  for (size_t i = 0; i < batch_size; i++) {
+    CHECK(macs.at(i) == expected);
+    if (AsyncBatch::supported()) {
+      CHECK(in_job.at(i));
+    }
+  }
+}
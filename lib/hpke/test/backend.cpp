@@ -0,0 +1,35 @@
+#include <doctest/doctest.h>
+#include <hpke/backend.h>
+
+#include "common.h"
+
+TEST_CASE("OpenSSL Backend Provides the Default Algorithms")
+{
+  ensure_fips_if_required();
+
+  const auto& openssl = Backend::openssl();
+
+  // With no backend installed, every algorithm comes from OpenSSL
+  REQUIRE(&KEM::get<KEM::ID::DHKEM_X25519_SHA256>() ==
+          openssl.kem(KEM::ID::DHKEM_X25519_SHA256));
+  REQUIRE(&KDF::get<KDF::ID::HKDF_SHA256>() ==
+          openssl.kdf(KDF::ID::HKDF_SHA256));
+  REQUIRE(&AEAD::get<AEAD::ID::CHACHA20_POLY1305>() ==
+          openssl.aead(AEAD::ID::CHACHA20_POLY1305));
+  REQUIRE(&Digest::get<Digest::ID::SHA384>() ==
+          openssl.digest(Digest::ID::SHA384));
+  REQUIRE(&Signature::get<Signature::ID::Ed25519>() ==
+          openssl.signature(Signature::ID::Ed25519));
+  REQUIRE(&Backend::select(AEAD::ID::AES_128_GCM) ==
+          &AEAD::get<AEAD::ID::AES_128_GCM>());
+
+  // A backend provides nothing unless it overrides a method
+  const auto empty = Backend{};
+  REQUIRE(empty.kem(KEM::ID::DHKEM_X25519_SHA256) == nullptr);
+  REQUIRE(empty.aead(AEAD::ID::AES_128_GCM) == nullptr);
+  REQUIRE(empty.digest(Digest::ID::SHA256) == nullptr);
+
+  // Algorithms have been selected, so the backend can no longer change
+  REQUIRE_THROWS_AS(Backend::install(std::make_shared<Backend>()),
+                    std::runtime_error);
+}
@@ -73,6 +73,23 @@ TEST_CASE("Certificate Known-Answer depth 2")
   CHECK_FALSE(issuing.valid_from(leaf));
   CHECK_FALSE(root.valid_from(issuing));
   CHECK_FALSE(root.valid_from(leaf));
+
+  // A certificate parsed again, or copied, gives the same answers as the
+  // original, including for links that have already been checked
+  const auto leaf_again = Certificate{ leaf_der };
+  const auto issuing_copy = Certificate(issuing);
+  CHECK(leaf_again == leaf);
+  CHECK(leaf_again.hash() == leaf.hash());
+  CHECK(leaf_again.subject() == leaf.subject());
+  CHECK(leaf_again.valid_from(issuing_copy));
+  CHECK_FALSE(issuing_copy.valid_from(leaf_again));
+
+  // A certificate with a corrupted signature is not taken for the original
+  auto forged_der = leaf_der;
+  forged_der.at(forged_der.size() - 1) ^= 0x01;
+  const auto forged = Certificate{ forged_der };
+  CHECK(forged.hash() != leaf.hash());
+  CHECK_FALSE(forged.valid_from(issuing));
 }
 
 TEST_CASE("Certificate Known-Answer depth 2 with SKID/ADID")
@@ -0,0 +1,63 @@
+#include <doctest/doctest.h>
+#include <hpke/digest.h>
+
+#include "common.h"
+
+#include <openssl/opensslv.h>
+
+TEST_CASE("Digest Contexts Match One-Shot Computation")
+{
+  ensure_fips_if_required();
+
+  const auto digests = std::vector<const Digest*>{
+    &Digest::get<Digest::ID::SHA256>(),
+    &Digest::get<Digest::ID::SHA384>(),
+    &Digest::get<Digest::ID::SHA512>(),
+  };
+
+  const auto key = from_hex("000102030405060708090a0b0c0d0e0f");
+  const auto prefix = from_ascii("running transcript");
+  const auto suffix_a = from_ascii("first continuation");
+  const auto suffix_b = from_ascii("second continuation");
+
+  for (const auto* digest_ptr : digests) {
+    const auto& digest = *digest_ptr;
+
+    // Feeding data in pieces gives the same result as one call
+    auto hash = digest.hash_context();
+    hash.update(prefix);
+    auto hmac = digest.hmac_context(key);
+    hmac.update(prefix);
+
+    // A copy continues independently of the original
+    auto hash_copy = hash;
+    auto hmac_copy = hmac;
+
+    hash.update(suffix_a);
+    hash_copy.update(suffix_b);
+    hmac.update(suffix_a);
+    hmac_copy.update(suffix_b);
+
+    REQUIRE(hash.finish() == digest.hash(prefix + suffix_a));
+    REQUIRE(hash_copy.finish() == digest.hash(prefix + suffix_b));
+    REQUIRE(hmac.finish() == digest.hmac(key, prefix + suffix_a));
+    REQUIRE(hmac_copy.finish() == digest.hmac(key, prefix + suffix_b));
+
+    // An empty key and empty input are handled like any other
+    auto empty = digest.hmac_context({});
+    REQUIRE(empty.finish() == digest.hmac({}, {}));
+  }
+}
+
+TEST_CASE("Library Context Is Fixed Once Algorithms Are Fetched")
+{
+  // Use an algorithm, so that at least one handle has been fetched
+  const auto& digest = Digest::get<Digest::ID::SHA256>();
+  REQUIRE(digest.hash(from_ascii("abc")).size() == digest.hash_size);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  REQUIRE_THROWS_AS(set_openssl_library_context(nullptr), std::runtime_error);
+#else
+  REQUIRE_NOTHROW(set_openssl_library_context(nullptr));
+#endif
+}
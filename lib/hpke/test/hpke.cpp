@@ -208,6 +208,14 @@ TEST_CASE("HPKE Round-Trip")
         auto ctxR = hpke.setup_base_r(enc, *skR, info);
         REQUIRE(ctxS == ctxR);
 
+        // A batch setup gives each recipient a context of its own
+        auto senders = hpke.setup_base_s({ pkR.get(), pkS.get() }, info);
+        REQUIRE(senders.size() == 2);
+        REQUIRE(senders[0].second ==
+                hpke.setup_base_r(senders[0].first, *skR, info));
+        REQUIRE(senders[1].second ==
+                hpke.setup_base_r(senders[1].first, *skS, info));
+
         auto last_encrypted = bytes{};
         for (int i = 0; i < iterations; i += 1) {
           auto encrypted = ctxS.seal(aad, plaintext);
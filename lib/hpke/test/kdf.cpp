@@ -83,3 +83,29 @@ TEST_CASE("KDF Known-Answer")
     CHECK(labeled_expanded == tc.labeled_expanded);
   }
 }
+
+TEST_CASE("KDF Expand Multi")
+{
+  ensure_fips_if_required();
+
+  const auto prk = bytes(32, 0xa0);
+  const auto info_a = from_ascii("a");
+  const auto info_b = from_ascii("bb");
+  const auto outputs = std::vector<KDF::Expansion>{
+    { info_a, 16 },
+    { info_b, 100 },
+    { info_a, 12 },
+  };
+
+  for (const auto id : { KDF::ID::HKDF_SHA256,
+                         KDF::ID::HKDF_SHA384,
+                         KDF::ID::HKDF_SHA512 }) {
+    const auto& kdf = select_kdf(id);
+    const auto okms = kdf.expand_multi(prk, outputs);
+    REQUIRE(okms.size() == outputs.size());
+    for (size_t i = 0; i < outputs.size(); i++) {
+      const auto& [info, size] = outputs[i];
+      CHECK(okms[i] == kdf.expand(prk, info, size));
+    }
+  }
+}
@@ -44,6 +44,24 @@ TEST_CASE("KEM round-trip")
       REQUIRE(secretR == secretS);
     }
 
+    SUBCASE("Batch Encap/Decap")
+    {
+      auto skR2 = kem.generate_key_pair();
+      auto pkR2 = skR2->public_key();
+      const auto recipients =
+        std::vector<const KEM::PublicKey*>{ pkR.get(), pkR2.get(), pkR.get() };
+      const auto results = kem.encap_batch(recipients);
+      REQUIRE(results.size() == recipients.size());
+
+      // Each recipient gets its own ephemeral key, even when it is repeated
+      REQUIRE(results[0].second != results[2].second);
+      REQUIRE(kem.decap(results[0].second, *skR) == results[0].first);
+      REQUIRE(kem.decap(results[1].second, *skR2) == results[1].first);
+      REQUIRE(kem.decap(results[2].second, *skR) == results[2].first);
+
+      REQUIRE(kem.encap_batch({}).empty());
+    }
+
     SUBCASE("AuthEncap/AuthDecap")
     {
       auto [secretS_, enc_] = kem.auth_encap(*pkR, *skS);
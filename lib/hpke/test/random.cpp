@@ -3,6 +3,9 @@
 
 #include "common.h"
 
+#include <thread>
+#include <vector>
+
 TEST_CASE("Random bytes")
 {
   ensure_fips_if_required();
@@ -11,3 +14,54 @@ TEST_CASE("Random bytes")
   auto test_val = hpke::random_bytes(size);
   CHECK(test_val.size() == size);
 }
+
+TEST_CASE("Random bytes from a per-thread DRBG")
+{
+  ensure_fips_if_required();
+
+  REQUIRE(hpke::random_source() == hpke::RandomSource::system);
+  hpke::set_random_source(hpke::RandomSource::thread_local_drbg);
+  REQUIRE(hpke::random_source() == hpke::RandomSource::thread_local_drbg);
+
+  // Requests smaller and larger than the generator's buffer, and ones that
+  // straddle a refill, are all filled, and no two outputs repeat
+  auto outputs = std::vector<bytes>{};
+  for (const auto size : { 4, 32, 250, 1000, 32 }) {
+    outputs.push_back(hpke::random_bytes(size_t(size)));
+    CHECK(outputs.back().size() == size_t(size));
+    CHECK(outputs.back() != bytes(size_t(size), 0));
+  }
+  CHECK(hpke::random_bytes(0).empty());
+
+  auto other_thread = bytes{};
+  std::thread([&]() { other_thread = hpke::random_bytes(32); }).join();
+  outputs.push_back(other_thread);
+
+  for (size_t i = 0; i < outputs.size(); i++) {
+    for (size_t j = i + 1; j < outputs.size(); j++) {
+      CHECK(outputs[i] != outputs[j]);
+    }
+  }
+
+  hpke::set_random_source(hpke::RandomSource::system);
+}
+
+#if defined(HPKE_SEEDED_RANDOM)
+TEST_CASE("Random bytes from a seeded generator")
+{
+  hpke::set_random_source(hpke::RandomSource::seeded);
+
+  // The same seed gives the same sequence of outputs, however it is split
+  hpke::set_random_seed(from_hex("0001"));
+  const auto head = hpke::random_bytes(20);
+  const auto first = head + hpke::random_bytes(44);
+  hpke::set_random_seed(from_hex("0001"));
+  const auto second = hpke::random_bytes(64);
+  CHECK(first == second);
+
+  hpke::set_random_seed(from_hex("0002"));
+  CHECK(hpke::random_bytes(64) != first);
+
+  hpke::set_random_source(hpke::RandomSource::system);
+}
+#endif
@@ -130,5 +130,14 @@ TEST_CASE("Signature Round-Trip")
     auto pub_enc = sig.serialize(*pub);
     auto pub3 = sig.deserialize(pub_enc);
     CHECK(sig.verify(data, signature2, *pub3));
+
+    // batch verification
+    const auto other = from_hex("04050607");
+    const auto signature3 = sig.sign(other, *priv);
+    CHECK(sig.verify_batch({}));
+    CHECK(sig.verify_batch({ { data, signature, *pub },
+                             { other, signature3, *pub3 } }));
+    CHECK_FALSE(sig.verify_batch({ { data, signature, *pub },
+                                   { other, signature, *pub } }));
   }
 }
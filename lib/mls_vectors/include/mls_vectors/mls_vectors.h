@@ -10,6 +10,13 @@
 
 namespace mls_vectors {
 
+// An Executor that runs the tasks of each batch on up to `n_threads` threads,
+// the calling thread among them.  The vectors for large groups are mostly
+// independent work per leaf, which the create() and verify() methods that take
+// an Executor spread across it.
+mls::Executor
+thread_executor(size_t n_threads);
+
 struct TreeMathTestVector
 {
   using OptionalNode = std::optional<mls::NodeIndex>;
@@ -67,7 +74,12 @@ struct EncryptionTestVector
   static EncryptionTestVector create(mls::CipherSuite suite,
                                      uint32_t n_leaves,
                                      uint32_t n_generations);
+  static EncryptionTestVector create(mls::CipherSuite suite,
+                                     uint32_t n_leaves,
+                                     uint32_t n_generations,
+                                     const mls::Executor& executor);
   std::optional<std::string> verify() const;
+  std::optional<std::string> verify(const mls::Executor& executor) const;
 };
 
 struct KeyScheduleTestVector
@@ -167,8 +179,13 @@ struct TreeKEMTestVector
   bytes tree_hash_after;
 
   static TreeKEMTestVector create(mls::CipherSuite suite, size_t n_leaves);
+  static TreeKEMTestVector create(mls::CipherSuite suite,
+                                  size_t n_leaves,
+                                  const mls::Executor& executor);
   void initialize_trees();
+  void initialize_trees(const mls::Executor& executor);
   std::optional<std::string> verify() const;
+  std::optional<std::string> verify(const mls::Executor& executor) const;
 };
 
 struct MessagesTestVector
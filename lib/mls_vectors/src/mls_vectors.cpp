@@ -3,10 +3,71 @@
 #include <mls/tree_math.h>
 #include <mls_vectors/mls_vectors.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 namespace mls_vectors {
 
 using namespace mls;
 
+Executor
+thread_executor(size_t n_threads)
+{
+  return [n_threads](size_t count, const std::function<void(size_t)>& task) {
+    // Each thread takes the next task until there are none left.  The first
+    // exception is rethrown once all of the threads have finished.
+    auto next = std::atomic<size_t>(0);
+    auto error = std::exception_ptr{};
+    auto error_mutex = std::mutex{};
+    const auto work = [&] {
+      for (auto i = next++; i < count; i = next++) {
+        try {
+          task(i);
+        } catch (...) {
+          const auto lock = std::lock_guard(error_mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+        }
+      }
+    };
+
+    auto helpers = std::vector<std::thread>{};
+    const auto n_helpers = std::min(std::max(n_threads, size_t(1)), count);
+    for (size_t i = 1; i < n_helpers; i++) {
+      helpers.emplace_back(work);
+    }
+
+    work();
+    for (auto& helper : helpers) {
+      helper.join();
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  };
+}
+
+// The subtrees that tree hashing and parent-hash checks hand to an executor
+// are this many levels below the root
+static constexpr uint32_t parallel_hash_depth = 4;
+
+// The first error among those found by independent checks, if any
+static std::optional<std::string>
+first_error(const std::vector<std::optional<std::string>>& errors)
+{
+  const auto it = std::find_if(
+    errors.begin(), errors.end(), [](const auto& err) { return err; });
+  if (it == errors.end()) {
+    return std::nullopt;
+  }
+
+  return *it;
+}
+
 ///
 /// Assertions for verifying test vectors
 ///
@@ -222,6 +283,15 @@ EncryptionTestVector
 EncryptionTestVector::create(CipherSuite suite,
                              uint32_t n_leaves,
                              uint32_t n_generations)
+{
+  return create(suite, n_leaves, n_generations, {});
+}
+
+EncryptionTestVector
+EncryptionTestVector::create(CipherSuite suite,
+                             uint32_t n_leaves,
+                             uint32_t n_generations,
+                             const Executor& executor)
 {
   auto tv = EncryptionTestVector{};
   tv.cipher_suite = suite;
@@ -238,25 +308,27 @@ EncryptionTestVector::create(CipherSuite suite,
     sender_data_key_nonce.nonce,
   };
 
-  auto sig_privs = std::vector<SignaturePrivateKey>{};
-  auto tree = TreeKEMPublicKey(suite);
-  for (uint32_t i = 0; i < n_leaves; i++) {
+  // The members' keys and leaf nodes are independent of each other
+  auto sig_privs = std::vector<std::optional<SignaturePrivateKey>>(n_leaves);
+  auto leaf_nodes = std::vector<LeafNode>(n_leaves);
+  execute(executor, n_leaves, [&](size_t i) {
     auto leaf_priv = HPKEPrivateKey::generate(suite);
     auto sig_priv = SignaturePrivateKey::generate(suite);
     auto cred = Credential::basic({});
-    auto leaf = LeafNode(suite,
-                         leaf_priv.public_key,
-                         sig_priv.public_key,
-                         cred,
-                         Capabilities::create_default(),
-                         Lifetime::create_default(),
-                         {},
-                         sig_priv);
-
-    sig_privs.emplace_back(std::move(sig_priv));
-    tree.add_leaf(leaf);
-  }
-  tree.set_hash_all();
+    leaf_nodes[i] = LeafNode(suite,
+                             leaf_priv.public_key,
+                             sig_priv.public_key,
+                             cred,
+                             Capabilities::create_default(),
+                             Lifetime::create_default(),
+                             {},
+                             sig_priv);
+    sig_privs[i] = std::move(sig_priv);
+  });
+
+  auto tree = TreeKEMPublicKey(suite);
+  tree.add_leaves(leaf_nodes);
+  tree.set_hash_all({ executor, parallel_hash_depth });
   tv.tree = tls::marshal(tree);
 
   auto src = GroupKeySource(suite, tree.size, tv.encryption_secret);
@@ -269,14 +341,16 @@ EncryptionTestVector::create(CipherSuite suite,
   auto app_data = ApplicationData{ random_bytes(suite.secret_size()) };
   auto authenticated_data = random_bytes(suite.secret_size());
 
+  // Each sender's ratchets are separate, and the key source can be used by
+  // several senders at once
   tv.leaves.resize(n_leaves);
-  auto zero_reuse_guard = ReuseGuard{ 0, 0, 0, 0 };
-  for (uint32_t i = 0; i < n_leaves; i++) {
+  const auto zero_reuse_guard = ReuseGuard{ 0, 0, 0, 0 };
+  execute(executor, n_leaves, [&](size_t i) {
     tv.leaves[i].generations = n_generations;
     tv.leaves[i].handshake.resize(n_generations);
     tv.leaves[i].application.resize(n_generations);
 
-    auto N = LeafIndex{ i };
+    auto N = LeafIndex{ static_cast<uint32_t>(i) };
     auto sender = Sender{ MemberSender{ N } };
 
     auto hs_content =
@@ -285,7 +359,7 @@ EncryptionTestVector::create(CipherSuite suite,
       MLSAuthenticatedContent::sign(WireFormat::mls_ciphertext,
                                     std::move(hs_content),
                                     suite,
-                                    sig_privs[i],
+                                    opt::get(sig_privs[i]),
                                     group_context);
     tv.leaves[i].handshake_content_auth = tls::marshal(hs_content_auth);
 
@@ -295,7 +369,7 @@ EncryptionTestVector::create(CipherSuite suite,
       MLSAuthenticatedContent::sign(WireFormat::mls_ciphertext,
                                     std::move(app_content),
                                     suite,
-                                    sig_privs[i],
+                                    opt::get(sig_privs[i]),
                                     group_context);
     tv.leaves[i].application_content_auth = tls::marshal(app_content_auth);
 
@@ -330,13 +404,19 @@ EncryptionTestVector::create(CipherSuite suite,
         tls::marshal(app_ct),
       };
     }
-  }
+  });
 
   return tv;
 }
 
 std::optional<std::string>
 EncryptionTestVector::verify() const
+{
+  return verify({});
+}
+
+std::optional<std::string>
+EncryptionTestVector::verify(const Executor& executor) const
 {
   auto sender_data_key_nonce = KeyScheduleEpoch::sender_data_keys(
     cipher_suite, sender_data_secret, sender_data_info.ciphertext);
@@ -347,13 +427,13 @@ EncryptionTestVector::verify() const
 
   auto ratchet_tree = tls::get<TreeKEMPublicKey>(tree);
   ratchet_tree.suite = cipher_suite;
-  ratchet_tree.set_hash_all();
+  ratchet_tree.set_hash_all({ executor, parallel_hash_depth });
   auto n_leaves = ratchet_tree.size;
 
   auto src = GroupKeySource(cipher_suite, n_leaves, encryption_secret);
-  auto zero_reuse_guard = ReuseGuard{ 0, 0, 0, 0 };
-  for (uint32_t i = 0; i < leaves.size(); i++) {
-    auto N = LeafIndex{ i };
+  const auto zero_reuse_guard = ReuseGuard{ 0, 0, 0, 0 };
+  const auto verify_leaf = [&](size_t i) -> std::optional<std::string> {
+    auto N = LeafIndex{ static_cast<uint32_t>(i) };
 
     auto hs_content_auth =
       tls::get<MLSAuthenticatedContent>(leaves[i].handshake_content_auth);
@@ -389,9 +469,14 @@ EncryptionTestVector::verify() const
       VERIFY_EQUAL("app pt", opt::get(app_pt), app_content_auth);
       src.erase(ContentType::application, N, j);
     }
-  }
 
-  return std::nullopt;
+    return std::nullopt;
+  };
+
+  auto errors = std::vector<std::optional<std::string>>(leaves.size());
+  execute(
+    executor, leaves.size(), [&](size_t i) { errors[i] = verify_leaf(i); });
+  return first_error(errors);
 }
 
 ///
@@ -466,7 +551,7 @@ KeyScheduleTestVector::create(CipherSuite suite,
       epoch.membership_key,
       epoch.resumption_secret,
 
-      epoch.external_priv.public_key,
+      epoch.external_priv().public_key,
     });
 
     group_context.epoch += 1;
@@ -532,7 +617,7 @@ KeyScheduleTestVector::verify() const
     VERIFY_EQUAL("init secret", epoch.init_secret, tve.init_secret);
 
     VERIFY_EQUAL(
-      "external pub", epoch.external_priv.public_key, tve.external_pub);
+      "external pub", epoch.external_priv().public_key, tve.external_pub);
 
     group_context.epoch += 1;
   }
@@ -663,6 +748,14 @@ new_leaf_node(CipherSuite suite)
 
 TreeKEMTestVector
 TreeKEMTestVector::create(CipherSuite suite, size_t n_leaves)
+{
+  return create(suite, n_leaves, {});
+}
+
+TreeKEMTestVector
+TreeKEMTestVector::create(CipherSuite suite,
+                          size_t n_leaves,
+                          const Executor& executor)
 {
   auto tv = TreeKEMTestVector{};
   tv.cipher_suite = suite;
@@ -679,22 +772,38 @@ TreeKEMTestVector::create(CipherSuite suite, size_t n_leaves)
     tv.update_sender.val = static_cast<uint32_t>(n_leaves) - 2;
   }
 
-  // Construct a full ratchet tree with the required number of leaves
-  auto sig_privs = std::vector<SignaturePrivateKey>{};
-  auto pub = TreeKEMPublicKey{ suite };
-  for (size_t i = 0; i < n_leaves; i++) {
+  // Construct a full ratchet tree with the required number of leaves.  The
+  // members' keys are independent of each other, but each UpdatePath depends
+  // on the tree that the ones before it left, so only the encryptions within
+  // each one are spread across the executor.
+  auto sig_privs = std::vector<std::optional<SignaturePrivateKey>>(n_leaves);
+  auto leaf_nodes = std::vector<LeafNode>(n_leaves);
+  execute(executor, n_leaves, [&](size_t i) {
     auto [init_secret, sig_priv, leaf] = new_leaf_node(suite);
     silence_unused(init_secret);
-    sig_privs.push_back(sig_priv);
+    sig_privs[i] = std::move(sig_priv);
+    leaf_nodes[i] = std::move(leaf);
+  });
 
+  auto pub = TreeKEMPublicKey{ suite };
+  pub.reserve(LeafCount{ static_cast<uint32_t>(n_leaves + 1) });
+  for (size_t i = 0; i < n_leaves; i++) {
     auto leaf_secret = random_bytes(suite.secret_size());
-    auto added = pub.add_leaf(leaf);
-    auto [new_adder_priv, path] =
-      pub.encap(added, tv.group_id, {}, leaf_secret, sig_priv, {}, {});
+    auto added = pub.add_leaf(leaf_nodes[i]);
+    auto [new_adder_priv, path] = pub.encap(added,
+                                            tv.group_id,
+                                            {},
+                                            leaf_secret,
+                                            opt::get(sig_privs[i]),
+                                            {},
+                                            {},
+                                            executor);
     silence_unused(new_adder_priv);
     pub.merge(added, path);
   }
 
+  const auto hash_opts = TreeHashOptions{ executor, parallel_hash_depth };
+
   if (my_index) {
     pub.blank_path(opt::get(my_index));
   }
@@ -703,21 +812,22 @@ TreeKEMTestVector::create(CipherSuite suite, size_t n_leaves)
   auto add_secret = random_bytes(suite.secret_size());
   auto [test_init_secret, test_sig_priv, test_leaf] = new_leaf_node(suite);
   auto test_index = pub.add_leaf(test_leaf);
-  pub.set_hash_all();
+  pub.set_hash_all(hash_opts);
   auto [add_priv, add_path] = pub.encap(tv.add_sender,
                                         tv.group_id,
                                         {},
                                         add_secret,
-                                        sig_privs[tv.add_sender.val],
+                                        opt::get(sig_privs[tv.add_sender.val]),
                                         {},
-                                        {});
+                                        {},
+                                        executor);
   auto [overlap, path_secret, ok] = add_priv.shared_path_secret(test_index);
   silence_unused(test_sig_priv);
   silence_unused(add_path);
   silence_unused(overlap);
   silence_unused(ok);
 
-  pub.set_hash_all();
+  pub.set_hash_all(hash_opts);
 
   tv.ratchet_tree_before = pub;
   tv.tree_hash_before = pub.root_hash();
@@ -729,15 +839,17 @@ TreeKEMTestVector::create(CipherSuite suite, size_t n_leaves)
   // Do a second update that the test participant should be able to process
   auto update_secret = random_bytes(suite.secret_size());
   auto update_context = random_bytes(suite.secret_size());
-  auto [update_priv, update_path] = pub.encap(tv.update_sender,
-                                              tv.group_id,
-                                              update_context,
-                                              update_secret,
-                                              sig_privs[tv.update_sender.val],
-                                              {},
-                                              {});
+  auto [update_priv, update_path] =
+    pub.encap(tv.update_sender,
+              tv.group_id,
+              update_context,
+              update_secret,
+              opt::get(sig_privs[tv.update_sender.val]),
+              {},
+              {},
+              executor);
   pub.merge(tv.update_sender, update_path);
-  pub.set_hash_all();
+  pub.set_hash_all(hash_opts);
 
   tv.update_path = update_path;
   tv.update_group_context = update_context;
@@ -751,21 +863,37 @@ TreeKEMTestVector::create(CipherSuite suite, size_t n_leaves)
 void
 TreeKEMTestVector::initialize_trees()
 {
+  initialize_trees({});
+}
+
+void
+TreeKEMTestVector::initialize_trees(const Executor& executor)
+{
+  const auto hash_opts = TreeHashOptions{ executor, parallel_hash_depth };
+
   ratchet_tree_before.suite = cipher_suite;
-  ratchet_tree_before.set_hash_all();
+  ratchet_tree_before.set_hash_all(hash_opts);
 
   ratchet_tree_after.suite = cipher_suite;
-  ratchet_tree_after.set_hash_all();
+  ratchet_tree_after.set_hash_all(hash_opts);
 }
 
 std::optional<std::string>
 TreeKEMTestVector::verify() const
 {
+  return verify({});
+}
+
+std::optional<std::string>
+TreeKEMTestVector::verify(const Executor& executor) const
+{
+  const auto hash_opts = TreeHashOptions{ executor, parallel_hash_depth };
+
   // Verify that the trees provided are valid
   VERIFY_EQUAL(
     "tree hash before", ratchet_tree_before.root_hash(), tree_hash_before);
   VERIFY("tree before parent hash valid",
-         ratchet_tree_before.parent_hash_valid());
+         ratchet_tree_before.parent_hash_valid(hash_opts));
 
   VERIFY("update path parent hash valid",
          ratchet_tree_before.parent_hash_valid(update_sender, update_path));
@@ -773,7 +901,7 @@ TreeKEMTestVector::verify() const
   VERIFY_EQUAL(
     "tree hash after", ratchet_tree_after.root_hash(), tree_hash_after);
   VERIFY("tree after parent hash valid",
-         ratchet_tree_after.parent_hash_valid());
+         ratchet_tree_after.parent_hash_valid(hash_opts));
 
   // Find ourselves in the tree
   auto maybe_index = ratchet_tree_before.find(my_leaf_node);
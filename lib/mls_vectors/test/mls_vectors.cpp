@@ -27,6 +27,19 @@ TEST_CASE("Encryption Keys")
   }
 }
 
+TEST_CASE("Encryption Keys with a Parallel Executor")
+{
+  // Vectors generated in parallel verify serially, and the reverse
+  const auto executor = thread_executor(4);
+  for (auto suite : supported_suites) {
+    const auto parallel = EncryptionTestVector::create(suite, 33, 4, executor);
+    REQUIRE(parallel.verify() == std::nullopt);
+
+    const auto serial = EncryptionTestVector::create(suite, 33, 4);
+    REQUIRE(serial.verify(executor) == std::nullopt);
+  }
+}
+
 TEST_CASE("Key Schedule")
 {
   for (auto suite : supported_suites) {
@@ -51,6 +64,42 @@ TEST_CASE("TreeKEM")
   }
 }
 
+TEST_CASE("TreeKEM with a Parallel Executor")
+{
+  const auto executor = thread_executor(4);
+  for (auto suite : supported_suites) {
+    auto parallel = TreeKEMTestVector::create(suite, 40, executor);
+    REQUIRE(parallel.verify() == std::nullopt);
+
+    // As when a vector is read back in, with only the wire form of the trees
+    using mls::TreeKEMPublicKey;
+    auto read = parallel;
+    read.ratchet_tree_before =
+      tls::get<TreeKEMPublicKey>(tls::marshal(parallel.ratchet_tree_before));
+    read.ratchet_tree_after =
+      tls::get<TreeKEMPublicKey>(tls::marshal(parallel.ratchet_tree_after));
+    read.initialize_trees(executor);
+    REQUIRE(read.verify(executor) == std::nullopt);
+  }
+}
+
+TEST_CASE("Thread Executor")
+{
+  const auto executor = thread_executor(3);
+
+  auto done = std::vector<int>(100, 0);
+  executor(done.size(), [&](size_t i) { done[i] += 1; });
+  REQUIRE(done == std::vector<int>(100, 1));
+
+  // An exception from any task is rethrown once the batch is over
+  const auto fail_one = [](size_t i) {
+    if (i == 7) {
+      throw std::runtime_error("task failed");
+    }
+  };
+  REQUIRE_THROWS_AS(executor(10, fail_one), std::runtime_error);
+}
+
 TEST_CASE("Messages")
 {
   auto tv = MessagesTestVector::create();
@@ -0,0 +1,284 @@
+#include <benchmark/benchmark.h>
+#include <tls/tls_syntax.h>
+
+#include <cstring>
+#include <string>
+
+// Structs shaped like the MLS structs that are encoded and decoded most often:
+// the framing of an encrypted message, which is handled for every message,
+// and leaf nodes, of which a ratchet tree holds one per member.
+
+struct PrivateMessage
+{
+  std::vector<uint8_t> group_id;
+  uint64_t epoch = 0;
+  uint8_t content_type = 0;
+  std::vector<uint8_t> authenticated_data;
+  std::vector<uint8_t> encrypted_sender_data;
+  std::vector<uint8_t> ciphertext;
+
+  TLS_SERIALIZABLE(group_id,
+                   epoch,
+                   content_type,
+                   authenticated_data,
+                   encrypted_sender_data,
+                   ciphertext)
+};
+
+enum struct LeafNodeSource : uint8_t
+{
+  key_package = 1,
+  commit = 3,
+};
+
+struct Lifetime
+{
+  uint64_t not_before = 0;
+  uint64_t not_after = 0;
+
+  TLS_SERIALIZABLE(not_before, not_after)
+};
+
+struct ParentHash
+{
+  std::vector<uint8_t> value;
+
+  TLS_SERIALIZABLE(value)
+};
+
+namespace tls {
+
+TLS_VARIANT_MAP(LeafNodeSource, Lifetime, key_package)
+TLS_VARIANT_MAP(LeafNodeSource, ParentHash, commit)
+
+} // namespace tls
+
+struct Extension
+{
+  uint16_t type = 0;
+  std::vector<uint8_t> data;
+
+  TLS_SERIALIZABLE(type, data)
+};
+
+struct LeafNode
+{
+  std::vector<uint8_t> encryption_key;
+  std::vector<uint8_t> signature_key;
+  std::vector<uint8_t> identity;
+  std::vector<uint16_t> versions;
+  std::vector<uint16_t> cipher_suites;
+  std::vector<uint16_t> extension_types;
+  tls::var::variant<Lifetime, ParentHash> content;
+  std::vector<Extension> extensions;
+  std::vector<uint8_t> signature;
+
+  TLS_SERIALIZABLE(encryption_key,
+                   signature_key,
+                   identity,
+                   versions,
+                   cipher_suites,
+                   extension_types,
+                   content,
+                   extensions,
+                   signature)
+  TLS_TRAITS(tls::pass,
+             tls::pass,
+             tls::pass,
+             tls::pass,
+             tls::pass,
+             tls::pass,
+             tls::variant<LeafNodeSource>,
+             tls::pass,
+             tls::pass)
+};
+
+static PrivateMessage
+make_message(size_t ciphertext_size)
+{
+  return {
+    std::vector<uint8_t>(16, 0xa0),
+    0x0102030405060708,
+    1,
+    {},
+    std::vector<uint8_t>(28, 0xb0),
+    std::vector<uint8_t>(ciphertext_size, 0xc0),
+  };
+}
+
+static LeafNode
+make_leaf_node(uint8_t seed)
+{
+  return {
+    std::vector<uint8_t>(32, seed),
+    std::vector<uint8_t>(32, seed),
+    std::vector<uint8_t>(24, seed),
+    { 1 },
+    { 1, 2, 3 },
+    { 0x0002, 0x0003 },
+    Lifetime{ 0, 0xffffffffffffffff },
+    { Extension{ 0xff00, std::vector<uint8_t>(8, seed) } },
+    std::vector<uint8_t>(64, seed),
+  };
+}
+
+// The leaves of a full ratchet tree, each present
+static std::vector<std::optional<LeafNode>>
+make_tree(size_t size)
+{
+  auto tree = std::vector<std::optional<LeafNode>>(size);
+  for (size_t i = 0; i < size; i++) {
+    tree.at(i) = make_leaf_node(static_cast<uint8_t>(i));
+  }
+  return tree;
+}
+
+///
+/// Generic encode and decode
+///
+
+template<typename T>
+static void
+bench_marshal(benchmark::State& bench, const T& value)
+{
+  for ([[maybe_unused]] auto _ : bench) {
+    auto data = tls::marshal(value);
+    benchmark::DoNotOptimize(data);
+  }
+}
+
+template<typename T>
+static void
+bench_get(benchmark::State& bench, const T& value)
+{
+  const auto data = tls::marshal(value);
+  for ([[maybe_unused]] auto _ : bench) {
+    auto decoded = tls::get<T>(data);
+    benchmark::DoNotOptimize(decoded);
+  }
+  bench.SetBytesProcessed(bench.iterations() *
+                          static_cast<int64_t>(data.size()));
+}
+
+///
+/// Hand-written encoding, as a baseline
+///
+
+static size_t
+varint_size(size_t size)
+{
+  static constexpr size_t max_1 = 0x3f;
+  static constexpr size_t max_2 = 0x3fff;
+  return (size <= max_1) ? 1 : (size <= max_2) ? 2 : 4;
+}
+
+static uint8_t*
+write_opaque(uint8_t* out, const std::vector<uint8_t>& data)
+{
+  static constexpr uint64_t header_2 = 0x4000;
+  static constexpr uint64_t header_4 = 0x80000000;
+  const auto n = varint_size(data.size());
+  auto header = uint64_t(data.size());
+  header |= (n == 1) ? 0 : (n == 2) ? header_2 : header_4;
+  for (size_t i = 0; i < n; i++) {
+    out[i] = static_cast<uint8_t>(header >> (8 * (n - i - 1))); // NOLINT
+  }
+
+  std::memcpy(out + n, data.data(), data.size()); // NOLINT
+  return out + n + data.size();                   // NOLINT
+}
+
+// Computes the size exactly, then writes each field in place, with no
+// generic machinery in between
+static std::vector<uint8_t>
+hand_marshal(const PrivateMessage& msg)
+{
+  const auto opaque_size = [](const auto& data) {
+    return varint_size(data.size()) + data.size();
+  };
+
+  const auto size =
+    opaque_size(msg.group_id) + sizeof(msg.epoch) + 1 +
+    opaque_size(msg.authenticated_data) +
+    opaque_size(msg.encrypted_sender_data) + opaque_size(msg.ciphertext);
+  auto data = std::vector<uint8_t>(size);
+
+  auto* out = write_opaque(data.data(), msg.group_id);
+  for (size_t i = 0; i < sizeof(msg.epoch); i++) {
+    *out++ = static_cast<uint8_t>(msg.epoch >> (8 * (7 - i))); // NOLINT
+  }
+  *out++ = msg.content_type; // NOLINT
+  out = write_opaque(out, msg.authenticated_data);
+  out = write_opaque(out, msg.encrypted_sender_data);
+  write_opaque(out, msg.ciphertext);
+  return data;
+}
+
+static void
+bench_hand_marshal(benchmark::State& bench, const PrivateMessage& msg)
+{
+  if (hand_marshal(msg) != tls::marshal(msg)) {
+    bench.SkipWithError("Hand-written encoding does not match");
+    return;
+  }
+
+  for ([[maybe_unused]] auto _ : bench) {
+    auto data = hand_marshal(msg);
+    benchmark::DoNotOptimize(data);
+  }
+}
+
+///
+/// Registration
+///
+
+// A typical application message, and a large one
+static const auto message_sizes = std::vector<size_t>{ 1024, 65536 };
+
+// Trees for a small group and a large one
+static const auto tree_sizes = std::vector<size_t>{ 10, 1000 };
+
+// Results can be written in a machine-readable form with the usual Google
+// Benchmark flags, e.g.:
+//
+//   tls_syntax_bench --benchmark_out=tls.json --benchmark_out_format=json
+int
+main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+
+  for (const auto size : message_sizes) {
+    const auto msg = make_message(size);
+    const auto suffix = "/" + std::to_string(size);
+    benchmark::RegisterBenchmark(("marshal/PrivateMessage" + suffix).c_str(),
+                                 bench_marshal<PrivateMessage>,
+                                 msg);
+    benchmark::RegisterBenchmark(
+      ("marshal/PrivateMessage" + suffix + "/hand").c_str(),
+      bench_hand_marshal,
+      msg);
+    benchmark::RegisterBenchmark(
+      ("get/PrivateMessage" + suffix).c_str(), bench_get<PrivateMessage>, msg);
+  }
+
+  const auto leaf = make_leaf_node(0);
+  benchmark::RegisterBenchmark(
+    "marshal/LeafNode", bench_marshal<LeafNode>, leaf);
+  benchmark::RegisterBenchmark("get/LeafNode", bench_get<LeafNode>, leaf);
+
+  using Tree = std::vector<std::optional<LeafNode>>;
+  for (const auto size : tree_sizes) {
+    const auto tree = make_tree(size);
+    const auto suffix = "/" + std::to_string(size);
+    benchmark::RegisterBenchmark(
+      ("marshal/Tree" + suffix).c_str(), bench_marshal<Tree>, tree)
+      ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark(
+      ("get/Tree" + suffix).c_str(), bench_get<Tree>, tree)
+      ->Unit(benchmark::kMicrosecond);
+  }
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -2,10 +2,13 @@
 
 #include <algorithm>
 #include <array>
+#include <functional>
 #include <limits>
 #include <map>
 #include <optional>
 #include <stdexcept>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include <tls/compat.h>
@@ -38,14 +41,37 @@ class ostream
 public:
   static const size_t none = std::numeric_limits<size_t>::max();
 
+  ostream() = default;
+
+  // A counting stream records how many bytes would be written, without
+  // storing them.  This allows encoded sizes to be computed without
+  // allocating.
+  static ostream counting();
+
+  // A streaming stream hands its output to a sink in chunks as it is written,
+  // instead of accumulating all of it.  This allows an encoding to be hashed
+  // without materializing it.  The final chunk is delivered by flush().
+  using Sink = std::function<void(const uint8_t* data, size_t size)>;
+  static ostream streaming(Sink sink);
+  void flush();
+
   void write_raw(const std::vector<uint8_t>& bytes);
+  void write_raw(const uint8_t* data, size_t size);
+  void reserve(size_t size) { _buffer.reserve(size); }
 
   const std::vector<uint8_t>& bytes() const { return _buffer; }
-  size_t size() const { return _buffer.size(); }
-  bool empty() const { return _buffer.empty(); }
+  size_t size() const { return _count + _buffer.size(); }
+  bool empty() const { return size() == 0; }
 
 private:
   std::vector<uint8_t> _buffer;
+  bool _counting = false;
+  size_t _count = 0;
+  Sink _sink;
+
+  static constexpr size_t sink_chunk_size = 1024;
+  void maybe_flush();
+
   ostream& write_uint(uint64_t value, int length);
 
   friend ostream& operator<<(ostream& out, bool data);
@@ -57,40 +83,67 @@ private:
   template<typename T>
   friend ostream& operator<<(ostream& out, const std::vector<T>& data);
 
+  template<typename K, typename V>
+  friend ostream& operator<<(ostream& out, const std::map<K, V>& data);
+
   friend struct varint;
 };
 
+// An istream reads forward over a borrowed view of its input; it does not copy
+// the data, so the underlying buffer must outlive the stream.
 class istream
 {
 public:
+  istream(const uint8_t* data, size_t size)
+    : _data(data)
+    , _size(size)
+  {
+  }
+
   istream(const std::vector<uint8_t>& data)
-    : _buffer(data)
+    : istream(data.data(), data.size())
   {
-    // So that we can use the constant-time pop_back
-    std::reverse(_buffer.begin(), _buffer.end());
   }
 
-  size_t size() const { return _buffer.size(); }
-  bool empty() const { return _buffer.empty(); }
+  // Reading from a temporary would leave the stream dangling
+  istream(std::vector<uint8_t>&& data) = delete;
+
+  size_t size() const { return _size - _pos; }
+  bool empty() const { return _pos == _size; }
 
-  std::vector<uint8_t> bytes()
+  std::vector<uint8_t> bytes() const
   {
-    auto bytes = _buffer;
-    std::reverse(bytes.begin(), bytes.end());
-    return bytes;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    return std::vector<uint8_t>(_data + _pos, _data + _size);
   }
 
+  // Split off a view of the next `size` bytes, advancing past them
+  istream sub_stream(size_t size);
+
+  // The unread bytes.  Together with size(), this lets a decoder capture the
+  // encoding of a value as it is read.
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  const uint8_t* data() const { return _data + _pos; }
+
 private:
-  istream() {}
-  std::vector<uint8_t> _buffer;
+  const uint8_t* _data = nullptr;
+  size_t _size = 0;
+  size_t _pos = 0;
+
   uint8_t next();
+  uint8_t peek() const;
+
+  // Check that `size` bytes remain, and advance past them
+  const uint8_t* read_raw(size_t size);
 
   template<typename T>
   istream& read_uint(T& data, size_t length)
   {
+    const auto* raw = read_raw(length);
     uint64_t value = 0;
     for (size_t i = 0; i < length; i += 1) {
-      value = (value << unsigned(8)) + next();
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      value = (value << unsigned(8)) + raw[i];
     }
     data = static_cast<T>(value);
     return *this;
@@ -102,9 +155,15 @@ private:
   friend istream& operator>>(istream& in, uint32_t& data);
   friend istream& operator>>(istream& in, uint64_t& data);
 
+  template<typename T, size_t N>
+  friend istream& operator>>(istream& in, std::array<T, N>& data);
+
   template<typename T>
   friend istream& operator>>(istream& in, std::vector<T>& data);
 
+  template<typename K, typename V>
+  friend istream& operator>>(istream& in, std::map<K, V>& data);
+
   friend struct varint;
 };
 
@@ -141,16 +200,6 @@ struct variant
   template<typename... Tp>
   static ostream& encode(ostream& str, const var::variant<Tp...>& data);
 
-  template<size_t I = 0, typename Te, typename... Tp>
-  static inline typename std::enable_if<I == sizeof...(Tp), void>::type
-  read_variant(istream&, Te, var::variant<Tp...>&);
-
-  template<size_t I = 0, typename Te, typename... Tp>
-    static inline typename std::enable_if <
-    I<sizeof...(Tp), void>::type read_variant(istream& str,
-                                              Te target_type,
-                                              var::variant<Tp...>& v);
-
   template<typename... Tp>
   static istream& decode(istream& str, var::variant<Tp...>& data);
 };
@@ -161,6 +210,59 @@ struct varint
   static istream& decode(istream& str, uint64_t& val);
 };
 
+// The encoded size of a type whose encoding has the same length for every
+// value, or zero if the length varies.  Integers, enums, arrays of fixed-size
+// elements, and tuples and structs made entirely of fixed-size fields have
+// fixed sizes, which are known without encoding anything.
+//
+// A struct is judged by its fields, so a struct that defines its own
+// operator<< with an encoding of a different length must specialize this.
+template<typename T, typename = void>
+struct fixed_size : std::integral_constant<size_t, 0>
+{};
+
+template<typename T>
+inline constexpr size_t fixed_size_v = fixed_size<T>::value;
+
+template<>
+struct fixed_size<bool> : std::integral_constant<size_t, 1>
+{};
+
+template<>
+struct fixed_size<uint8_t> : std::integral_constant<size_t, 1>
+{};
+
+template<>
+struct fixed_size<uint16_t> : std::integral_constant<size_t, 2>
+{};
+
+template<>
+struct fixed_size<uint32_t> : std::integral_constant<size_t, 4>
+{};
+
+template<>
+struct fixed_size<uint64_t> : std::integral_constant<size_t, 8>
+{};
+
+template<typename T>
+struct fixed_size<T, std::enable_if_t<std::is_enum_v<T>>>
+  : fixed_size<std::underlying_type_t<T>>
+{};
+
+template<typename T, size_t N>
+struct fixed_size<std::array<T, N>>
+  : std::integral_constant<size_t, N * fixed_size_v<T>>
+{};
+
+template<typename... Tp>
+struct fixed_size<std::tuple<Tp...>>
+  : std::integral_constant<
+      size_t,
+      ((fixed_size_v<std::decay_t<Tp>> > 0) && ...)
+        ? (fixed_size_v<std::decay_t<Tp>> + ... + 0)
+        : 0>
+{};
+
 ///
 /// Writer implementations
 ///
@@ -172,6 +274,11 @@ template<typename T, size_t N>
 ostream&
 operator<<(ostream& out, const std::array<T, N>& data)
 {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    out.write_raw(data.data(), N);
+    return out;
+  }
+
   for (const auto& item : data) {
     out << item;
   }
@@ -204,19 +311,69 @@ template<typename T>
 ostream&
 operator<<(ostream& str, const std::vector<T>& vec)
 {
-  // Pre-encode contents
-  ostream temp;
+  // Compute the size of the contents, which for fixed-size elements does not
+  // require encoding them
+  auto size = vec.size() * fixed_size_v<T>;
+  if constexpr (fixed_size_v<T> == 0) {
+    auto counter = ostream::counting();
+    for (const auto& item : vec) {
+      counter << item;
+    }
+    size = counter.size();
+  }
+
+  // Write the encoded length, then encode the contents in place
+  varint::encode(str, size);
+  if (str._counting) {
+    str._count += size;
+    return str;
+  }
+
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    str.write_raw(vec.data(), vec.size());
+    return str;
+  }
+
   for (const auto& item : vec) {
-    temp << item;
+    str << item;
   }
 
-  // Write the encoded length, then the pre-encoded data
-  varint::encode(str, temp._buffer.size());
-  str.write_raw(temp.bytes());
+  return str;
+}
+
+// Map writer.  A map is encoded like a vector of its entries, each entry being
+// the key followed by the value, in key order.
+template<typename K, typename V>
+ostream&
+operator<<(ostream& str, const std::map<K, V>& map)
+{
+  auto counter = ostream::counting();
+  for (const auto& [key, value] : map) {
+    counter << key << value;
+  }
+
+  varint::encode(str, counter.size());
+  if (str._counting) {
+    str._count += counter.size();
+    return str;
+  }
+
+  for (const auto& [key, value] : map) {
+    str << key << value;
+  }
 
   return str;
 }
 
+// Tuple writer, encoding the elements in order
+template<typename... Tp>
+ostream&
+operator<<(ostream& str, const std::tuple<Tp...>& tuple)
+{
+  std::apply([&](const auto&... items) { (str << ... << items); }, tuple);
+  return str;
+}
+
 ///
 /// Reader implementations
 ///
@@ -228,6 +385,11 @@ template<typename T, size_t N>
 istream&
 operator>>(istream& in, std::array<T, N>& data)
 {
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    std::copy_n(in.read_raw(N), N, data.begin());
+    return in;
+  }
+
   for (auto& item : data) {
     in >> item;
   }
@@ -279,35 +441,96 @@ operator>>(istream& str, std::vector<T>& vec)
   auto size = uint64_t(0);
   varint::decode(str, size);
 
-  // Read the elements of the vector
-  // NB: Remember that we store the vector in reverse order
+  // Read the elements of the vector from a view of the next `size` bytes
   // NB: This requires that T be default-constructible
-  istream r;
-  r._buffer =
-    std::vector<uint8_t>{ str._buffer.end() - size, str._buffer.end() };
+  auto r = str.sub_stream(size);
+
+  // Octet strings are copied out whole, in a single allocation
+  if constexpr (std::is_same_v<T, uint8_t>) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    vec.assign(r._data, r._data + r._size);
+    return str;
+  }
 
   vec.clear();
-  while (r._buffer.size() > 0) {
+  while (!r.empty()) {
     vec.emplace_back();
     r >> vec.back();
   }
 
-  // Truncate the primary buffer
-  str._buffer.erase(str._buffer.end() - size, str._buffer.end());
+  return str;
+}
+
+// Map reader
+template<typename K, typename V>
+istream&
+operator>>(istream& str, std::map<K, V>& map)
+{
+  auto size = uint64_t(0);
+  varint::decode(str, size);
+
+  // NB: This requires that K and V be default-constructible
+  auto r = str.sub_stream(size);
+
+  map.clear();
+  while (!r.empty()) {
+    auto key = K{};
+    auto value = V{};
+    r >> key >> value;
+    if (!map.empty() && !(map.rbegin()->first < key)) {
+      throw ReadError("Map keys out of order");
+    }
+
+    map.emplace_hint(map.end(), std::move(key), std::move(value));
+  }
+
+  return str;
+}
 
+// Tuple reader
+template<typename... Tp>
+istream&
+operator>>(istream& str, std::tuple<Tp...>& tuple)
+{
+  std::apply([&](auto&... items) { (str >> ... >> items); }, tuple);
   return str;
 }
 
 // Abbreviations
+template<typename T>
+size_t
+encoded_size(const T& value)
+{
+  if constexpr (fixed_size_v<T> > 0) {
+    return fixed_size_v<T>;
+  }
+
+  auto counter = ostream::counting();
+  counter << value;
+  return counter.size();
+}
+
 template<typename T>
 std::vector<uint8_t>
 marshal(const T& value)
 {
   ostream w;
+  w.reserve(encoded_size(value));
   w << value;
   return w.bytes();
 }
 
+// Passes the encoding of a value to a sink in chunks, without ever holding the
+// whole encoding in memory
+template<typename T>
+void
+marshal_to(const T& value, ostream::Sink sink)
+{
+  auto w = ostream::streaming(std::move(sink));
+  w << value;
+  w.flush();
+}
+
 template<typename T>
 void
 unmarshal(const std::vector<uint8_t>& data, T& value)
@@ -316,6 +539,14 @@ unmarshal(const std::vector<uint8_t>& data, T& value)
   r >> value;
 }
 
+template<typename T>
+void
+unmarshal(const uint8_t* data, size_t size, T& value)
+{
+  istream r(data, size);
+  r >> value;
+}
+
 template<typename T, typename... Tp>
 T
 get(const std::vector<uint8_t>& data, Tp... args)
@@ -325,6 +556,15 @@ get(const std::vector<uint8_t>& data, Tp... args)
   return value;
 }
 
+template<typename T, typename... Tp>
+T
+get(const uint8_t* data, size_t size, Tp... args)
+{
+  T value(args...);
+  unmarshal(data, size, value);
+  return value;
+}
+
 // Use this macro to define struct serialization with minimal boilerplate
 #define TLS_SERIALIZABLE(...)                                                  \
   static const bool _tls_serializable = true;                                  \
@@ -367,6 +607,14 @@ struct has_traits
   static const bool value = decltype(test<T>(true))::value;
 };
 
+// A struct's fixed size is that of its fields, when they all have one
+template<typename T>
+struct fixed_size<
+  T,
+  std::enable_if_t<is_serializable<T>::value && !has_traits<T>::value>>
+  : fixed_size<decltype(std::declval<const T&>()._tls_fields_w())>
+{};
+
 ///
 /// Trait implementations
 ///
@@ -422,30 +670,118 @@ variant<Ts>::encode(ostream& str, const var::variant<Tp...>& data)
   return str;
 }
 
+// The integer value of a variant type label.  Labels are enums, or structs that
+// wrap an integer `val` where the set of values is open-ended.
 template<typename Ts>
-template<size_t I, typename Te, typename... Tp>
-inline typename std::enable_if<I == sizeof...(Tp), void>::type
-variant<Ts>::read_variant(istream&, Te, var::variant<Tp...>&)
+constexpr uint64_t
+variant_label(const Ts& type)
 {
-  throw ReadError("Invalid variant type label");
+  if constexpr (std::is_enum_v<Ts> || std::is_integral_v<Ts>) {
+    return static_cast<uint64_t>(type);
+  } else {
+    return static_cast<uint64_t>(type.val);
+  }
 }
 
-template<typename Ts>
-  template<size_t I, typename Te, typename... Tp>
-  inline
-  typename std::enable_if < I<sizeof...(Tp), void>::type
-                            variant<Ts>::read_variant(istream& str,
-                                                      Te target_type,
-                                                      var::variant<Tp...>& v)
+// The decoders for the alternatives of a variant, looked up by type label.
+// When the labels are dense enough, as TLS enums usually are, the decoders are
+// laid out in a table indexed by label, so that decoding a variant costs one
+// lookup and one indirect call rather than a comparison per alternative.
+template<typename Ts, typename... Tp>
+struct variant_decoders
 {
-  using Tc = var::variant_alternative_t<I, var::variant<Tp...>>;
-  if (variant_map<Ts, Tc>() == target_type) {
+  using Variant = var::variant<Tp...>;
+  using Decoder = void (*)(istream&, Variant&);
+
+  static constexpr size_t count = sizeof...(Tp);
+  static constexpr std::array<uint64_t, count> labels = {
+    variant_label(variant_map<Ts, Tp>())...
+  };
+
+  static constexpr uint64_t min_label()
+  {
+    auto min = labels[0];
+    for (const auto label : labels) {
+      min = (label < min) ? label : min;
+    }
+    return min;
+  }
+
+  static constexpr uint64_t max_label()
+  {
+    auto max = labels[0];
+    for (const auto label : labels) {
+      max = (label > max) ? label : max;
+    }
+    return max;
+  }
+
+  static constexpr bool labels_distinct()
+  {
+    for (size_t i = 0; i < count; i++) {
+      for (size_t j = i + 1; j < count; j++) {
+        if (labels[i] == labels[j]) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  static_assert(labels_distinct(), "Variant alternatives share a type label");
+
+  // Tables are kept small; sparser labels are searched instead
+  static constexpr uint64_t max_table_size = 64;
+  static constexpr uint64_t span = max_label() - min_label() + 1;
+  static constexpr bool indexed = (span <= max_table_size);
+  static constexpr size_t table_size = indexed ? span : 1;
+
+  template<size_t I>
+  static void decode_alternative(istream& str, Variant& v)
+  {
     str >> v.template emplace<I>();
-    return;
   }
 
-  read_variant<I + 1>(str, target_type, v);
-}
+  template<size_t... I>
+  static constexpr std::array<Decoder, count> in_order(
+    std::index_sequence<I...> /* unused */)
+  {
+    return { &decode_alternative<I>... };
+  }
+
+  static constexpr std::array<Decoder, count> decoders =
+    in_order(std::index_sequence_for<Tp...>{});
+
+  static constexpr std::array<Decoder, table_size> make_table()
+  {
+    auto table = std::array<Decoder, table_size>{};
+    if constexpr (indexed) {
+      for (size_t i = 0; i < count; i++) {
+        table[labels[i] - min_label()] = decoders[i];
+      }
+    }
+    return table;
+  }
+
+  static constexpr std::array<Decoder, table_size> table = make_table();
+
+  static Decoder find(uint64_t label)
+  {
+    if constexpr (indexed) {
+      if (label < min_label() || label > max_label()) {
+        return nullptr;
+      }
+      return table[label - min_label()];
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        if (labels[i] == label) {
+          return decoders[i];
+        }
+      }
+      return nullptr;
+    }
+  }
+};
 
 template<typename Ts>
 template<typename... Tp>
@@ -454,7 +790,14 @@ variant<Ts>::decode(istream& str, var::variant<Tp...>& data)
 {
   Ts target_type;
   str >> target_type;
-  read_variant(str, target_type, data);
+
+  const auto label = variant_label(target_type);
+  const auto decode_alternative = variant_decoders<Ts, Tp...>::find(label);
+  if (decode_alternative == nullptr) {
+    throw ReadError("Invalid variant type label");
+  }
+
+  decode_alternative(str, data);
   return str;
 }
 
@@ -3,20 +3,85 @@
 // NOLINTNEXTLINE(llvmlibc-implementation-in-namespace)
 namespace tls {
 
+ostream
+ostream::counting()
+{
+  auto str = ostream{};
+  str._counting = true;
+  return str;
+}
+
+ostream
+ostream::streaming(Sink sink)
+{
+  auto str = ostream{};
+  str._sink = std::move(sink);
+  str._buffer.reserve(sink_chunk_size);
+  return str;
+}
+
+void
+ostream::flush()
+{
+  if (!_sink || _buffer.empty()) {
+    return;
+  }
+
+  _sink(_buffer.data(), _buffer.size());
+  _count += _buffer.size();
+  _buffer.clear();
+}
+
+void
+ostream::maybe_flush()
+{
+  if (_sink && _buffer.size() >= sink_chunk_size) {
+    flush();
+  }
+}
+
 void
 ostream::write_raw(const std::vector<uint8_t>& bytes)
 {
-  // Not sure what the default argument is here
-  _buffer.insert(_buffer.end(), bytes.begin(), bytes.end());
+  write_raw(bytes.data(), bytes.size());
+}
+
+void
+ostream::write_raw(const uint8_t* data, size_t size)
+{
+  if (_counting) {
+    _count += size;
+    return;
+  }
+
+  // A streaming stream takes a large write a chunk at a time, so that its
+  // buffer stays bounded
+  const auto step = _sink ? sink_chunk_size : size;
+  for (size_t offset = 0; offset < size; offset += step) {
+    const auto n = std::min(step, size - offset);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    _buffer.insert(_buffer.end(), data + offset, data + offset + n);
+    maybe_flush();
+  }
 }
 
 // Primitive type writers
 ostream&
 ostream::write_uint(uint64_t value, int length)
 {
-  for (int i = length - 1; i >= 0; --i) {
-    _buffer.push_back(static_cast<uint8_t>(value >> unsigned(8 * i)));
+  if (_counting) {
+    _count += static_cast<size_t>(length);
+    return *this;
   }
+
+  // Lay out the big-endian bytes, then append them in one step
+  auto raw = std::array<uint8_t, sizeof(value)>{};
+  for (int i = 0; i < length; ++i) {
+    const auto shift = unsigned(8 * (length - 1 - i));
+    raw.at(static_cast<size_t>(i)) = static_cast<uint8_t>(value >> shift);
+  }
+
+  write_raw(raw.data(), static_cast<size_t>(length));
   return *this;
 }
 
@@ -54,17 +119,48 @@ operator<<(ostream& out, uint64_t data)
   return out.write_uint(data, 8);
 }
 
-// Because pop_back() on an empty vector is undefined
 uint8_t
 istream::next()
 {
-  if (_buffer.empty()) {
+  const auto value = peek();
+  _pos += 1;
+  return value;
+}
+
+uint8_t
+istream::peek() const
+{
+  if (empty()) {
     throw ReadError("Attempt to read from empty buffer");
   }
 
-  const uint8_t value = _buffer.back();
-  _buffer.pop_back();
-  return value;
+  return _data[_pos]; // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+}
+
+const uint8_t*
+istream::read_raw(size_t size)
+{
+  if (size > this->size()) {
+    throw ReadError("Attempt to read beyond end of buffer");
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  const auto* raw = _data + _pos;
+  _pos += size;
+  return raw;
+}
+
+istream
+istream::sub_stream(size_t size)
+{
+  if (size > this->size()) {
+    throw ReadError("Attempt to read beyond end of buffer");
+  }
+
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  auto sub = istream(_data + _pos, size);
+  _pos += size;
+  return sub;
 }
 
 // Primitive type readers
@@ -139,7 +235,7 @@ varint::encode(ostream& str, const uint64_t& val)
 istream&
 varint::decode(istream& str, uint64_t& val)
 {
-  auto log_size = size_t(str._buffer.back() >> VARINT_HEADER_OFFSET);
+  auto log_size = size_t(str.peek() >> VARINT_HEADER_OFFSET);
   if (log_size > 2) {
     throw ReadError("Malformed varint header");
   }
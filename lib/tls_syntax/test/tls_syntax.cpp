@@ -18,6 +18,25 @@ TLS_VARIANT_MAP(IntType, uint16_t, uint16)
 
 } // namespace tls
 
+// Densely packed variant labels, with a gap, as most TLS enums have.  The
+// labels of IntType are far apart, so the two cover both ways that variant
+// alternatives are looked up.
+enum struct DenseType : uint8_t
+{
+  reserved = 0,
+  uint8 = 1,
+  uint32 = 3,
+  uint16 = 4,
+};
+
+namespace tls {
+
+TLS_VARIANT_MAP(DenseType, uint8_t, uint8)
+TLS_VARIANT_MAP(DenseType, uint16_t, uint16)
+TLS_VARIANT_MAP(DenseType, uint32_t, uint32)
+
+} // namespace tls
+
 // A struct to test struct encoding and traits
 struct ExampleStruct
 {
@@ -47,6 +66,23 @@ operator==(const ExampleStruct& lhs, const ExampleStruct& rhs)
   return (lhs.a == rhs.a) && (lhs.b == rhs.b) && (lhs.c == rhs.c);
 }
 
+// A struct whose encoding always has the same length
+struct FixedStruct
+{
+  uint16_t a{ 0 };
+  IntType b{ IntType::uint8 };
+  std::array<uint8_t, 3> c{ 0, 0, 0 };
+  std::tuple<uint32_t, bool> d{ 0, false };
+
+  TLS_SERIALIZABLE(a, b, c, d)
+};
+
+static bool
+operator==(const FixedStruct& lhs, const FixedStruct& rhs)
+{
+  return lhs.a == rhs.a && lhs.b == rhs.b && lhs.c == rhs.c && lhs.d == rhs.d;
+}
+
 // Known-answer tests
 class TLSSyntaxTest
 {
@@ -187,6 +223,79 @@ TEST_CASE_FIXTURE(TLSSyntaxTest, "TLS abbreviations")
 
   auto val_out2 = tls::get<ExampleStruct>(marshaled);
   REQUIRE(val_in == val_out2);
+
+  auto val_out3 =
+    tls::get<ExampleStruct>(marshaled.data(), marshaled.size());
+  REQUIRE(val_in == val_out3);
+}
+
+TEST_CASE_FIXTURE(TLSSyntaxTest, "TLS encoded size")
+{
+  REQUIRE(tls::encoded_size(val_uint32) == enc_uint32.size());
+  REQUIRE(tls::encoded_size(val_array) == enc_array.size());
+  REQUIRE(tls::encoded_size(val_vector) == enc_vector.size());
+  REQUIRE(tls::encoded_size(val_struct) == enc_struct.size());
+  REQUIRE(tls::encoded_size(val_optional) == enc_optional.size());
+  REQUIRE(tls::encoded_size(val_optional_null) == enc_optional_null.size());
+
+  // A counting stream does not store what is written to it
+  auto counter = tls::ostream::counting();
+  counter << val_struct;
+  REQUIRE(counter.size() == enc_struct.size());
+  REQUIRE(counter.bytes().empty());
+}
+
+TEST_CASE_FIXTURE(TLSSyntaxTest, "TLS streaming ostream")
+{
+  // Large enough to be delivered in several chunks
+  const auto big = std::vector<uint8_t>(5000, 0xa0);
+  const auto expected = tls::marshal(big);
+
+  auto chunks = size_t(0);
+  auto streamed = std::vector<uint8_t>{};
+  tls::marshal_to(big, [&](const uint8_t* data, size_t size) {
+    chunks += 1;
+    streamed.insert(streamed.end(), data, data + size);
+  });
+  REQUIRE(chunks > 1);
+  REQUIRE(streamed == expected);
+
+  // Nothing reaches the sink until the stream fills a chunk or is flushed
+  streamed.clear();
+  auto str = tls::ostream::streaming([&](const uint8_t* data, size_t size) {
+    streamed.insert(streamed.end(), data, data + size);
+  });
+  str << val_struct;
+  REQUIRE(streamed.empty());
+  REQUIRE(str.size() == enc_struct.size());
+
+  str.flush();
+  REQUIRE(streamed == enc_struct);
+  REQUIRE(str.size() == enc_struct.size());
+}
+
+TEST_CASE_FIXTURE(TLSSyntaxTest, "TLS istream over a borrowed view")
+{
+  // Reading from a view leaves the remaining data in place
+  const auto enc = enc_struct + from_hex("a0a1");
+
+  tls::istream r(enc.data(), enc.size()); // NOLINT(misc-const-correctness)
+  ExampleStruct data;
+  r >> data;
+  REQUIRE(data == val_struct);
+  REQUIRE(r.size() == 2);
+  REQUIRE(r.bytes() == std::vector<uint8_t>{ 0xA0, 0xA1 });
+
+  // A vector length that runs past the end of the input is rejected
+  const auto truncated = enc_vector.slice(0, enc_vector.size() - 1);
+  auto data_vector = std::vector<uint32_t>{};
+  REQUIRE_THROWS_AS(tls::unmarshal(truncated, data_vector), tls::ReadError);
+
+  // Reading from an empty stream is rejected
+  const auto empty = std::vector<uint8_t>{};
+  auto val = uint64_t(0);
+  auto r_empty = tls::istream(empty);
+  REQUIRE_THROWS_AS(tls::varint::decode(r_empty, val), tls::ReadError);
 }
 
 TEST_CASE("TLS varint failure cases")
@@ -211,3 +320,97 @@ TEST_CASE("TLS varint failure cases")
 }
 
 // TODO(rlb@ipv.sx) Test failure cases
+
+TEST_CASE("TLS maps and tuples")
+{
+  using Key = std::tuple<uint8_t, uint16_t>;
+  const auto val = std::map<Key, uint32_t>{
+    { { 1, 0x0203 }, 0x04050607 },
+    { { 2, 0x0000 }, 0x08090a0b },
+  };
+  const auto enc = from_hex("0e"
+                            "01020304050607"
+                            "020000"
+                            "08090a0b");
+
+  REQUIRE(tls::marshal(val) == enc);
+  REQUIRE(tls::encoded_size(val) == enc.size());
+  REQUIRE(tls::get<std::map<Key, uint32_t>>(enc) == val);
+
+  // Keys must be strictly increasing
+  const auto unordered = from_hex("0e"
+                                  "020000"
+                                  "08090a0b"
+                                  "01020304050607");
+  auto data = std::map<Key, uint32_t>{};
+  REQUIRE_THROWS_AS(tls::unmarshal(unordered, data), tls::ReadError);
+}
+
+TEST_CASE("TLS variants")
+{
+  using Variant = tls::var::variant<uint8_t, uint16_t, uint32_t>;
+  const auto decode = [](const bytes& data) {
+    auto val = Variant{};
+    auto r = tls::istream(data);
+    tls::variant<DenseType>::decode(r, val);
+    return val;
+  };
+
+  REQUIRE(decode(from_hex("0101")) == Variant{ uint8_t(0x01) });
+  REQUIRE(decode(from_hex("040203")) == Variant{ uint16_t(0x0203) });
+  REQUIRE(decode(from_hex("0304050607")) == Variant{ uint32_t(0x04050607) });
+
+  // Labels in the gap, below the smallest and above the largest are rejected
+  REQUIRE_THROWS_AS(decode(from_hex("0201")), tls::ReadError);
+  REQUIRE_THROWS_AS(decode(from_hex("0001")), tls::ReadError);
+  REQUIRE_THROWS_AS(decode(from_hex("0501")), tls::ReadError);
+  REQUIRE_THROWS_AS(decode(from_hex("ff01")), tls::ReadError);
+
+  // Sparse labels
+  const auto sparse_data = from_hex("bbbb0102");
+  auto sparse = tls::var::variant<uint8_t, uint16_t>{};
+  auto r = tls::istream(sparse_data);
+  tls::variant<IntType>::decode(r, sparse);
+  REQUIRE(sparse == tls::var::variant<uint8_t, uint16_t>{ uint16_t(0x0102) });
+
+  const auto invalid_data = from_hex("aaab01");
+  auto r_invalid = tls::istream(invalid_data);
+  REQUIRE_THROWS_AS(tls::variant<IntType>::decode(r_invalid, sparse),
+                    tls::ReadError);
+}
+
+TEST_CASE("TLS fixed-size types")
+{
+  static_assert(tls::fixed_size_v<bool> == 1);
+  static_assert(tls::fixed_size_v<uint64_t> == 8);
+  static_assert(tls::fixed_size_v<IntType> == 2);
+  static_assert(tls::fixed_size_v<std::array<uint16_t, 4>> == 8);
+  static_assert(tls::fixed_size_v<FixedStruct> == 12);
+  static_assert(tls::fixed_size_v<std::array<FixedStruct, 2>> == 24);
+
+  // Anything holding a vector, optional or variant varies in length
+  static_assert(tls::fixed_size_v<std::vector<uint8_t>> == 0);
+  static_assert(tls::fixed_size_v<std::optional<uint8_t>> == 0);
+  static_assert(tls::fixed_size_v<std::tuple<uint8_t, bytes>> == 0);
+  static_assert(tls::fixed_size_v<ExampleStruct> == 0);
+
+  const auto val = FixedStruct{
+    0x0102, IntType::uint16, { 0x03, 0x04, 0x05 }, { 0x06070809, true }
+  };
+  const auto enc = from_hex("0102bbbb0304050607080901");
+  REQUIRE(tls::marshal(val) == enc);
+  REQUIRE(tls::encoded_size(val) == enc.size());
+  REQUIRE(tls::get<FixedStruct>(enc) == val);
+
+  // Vectors of fixed-size elements are sized without encoding them
+  const auto vec = std::vector<FixedStruct>{ val, val };
+  const auto enc_vec = from_hex("18") + enc + enc;
+  REQUIRE(tls::marshal(vec) == enc_vec);
+  REQUIRE(tls::encoded_size(vec) == enc_vec.size());
+  REQUIRE(tls::get<std::vector<FixedStruct>>(enc_vec) == vec);
+
+  // A truncated value is rejected before anything is read
+  auto data = FixedStruct{};
+  const auto truncated = enc.slice(0, 6);
+  REQUIRE_THROWS_AS(tls::unmarshal(truncated, data), tls::ReadError);
+}
@@ -0,0 +1,181 @@
+#include <hpke/random.h>
+#include <mls/capture.h>
+#include <mls/state.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace mls;
+
+// Replays a capture made with Session::capture() through State, and reports
+// the latency of each kind of operation, next to the latency it had when it
+// was captured.
+//
+//   mlspp_replay <capture file> [seed as hex]
+//
+// All randomness is drawn from a generator seeded from the command line, so
+// that repeated replays of a capture do the same work.
+
+static const char* const default_seed = "00";
+
+struct Latencies
+{
+  std::vector<uint64_t> captured;
+  std::vector<uint64_t> replayed;
+  size_t errors = 0;
+};
+
+static std::string
+type_name(CaptureType type)
+{
+  switch (type) {
+    case CaptureType::handle:
+      return "handle";
+    case CaptureType::unprotect:
+      return "unprotect";
+    case CaptureType::protect:
+      return "protect";
+    case CaptureType::commit:
+      return "commit";
+    default:
+      return "unknown";
+  }
+}
+
+static double
+percentile_us(std::vector<uint64_t> values, double p)
+{
+  if (values.empty()) {
+    return 0.0;
+  }
+
+  std::sort(values.begin(), values.end());
+  const auto rank = static_cast<size_t>(p * double(values.size() - 1));
+  static constexpr auto ns_per_us = 1000.0;
+  return double(values.at(rank)) / ns_per_us;
+}
+
+class Replay
+{
+public:
+  explicit Replay(const CaptureHeader& header)
+    : state(State::deserialize(header.state))
+  {
+  }
+
+  void run(const CaptureRecord& record)
+  {
+    const auto msg = tls::get<MLSMessage>(record.message);
+    switch (record.type) {
+      case CaptureType::handle: {
+        // Our own Commits are recognized by the state that commit() built
+        // when they were replayed
+        auto cached = std::move(own_commit);
+        own_commit.reset();
+        if (auto next = state.handle(msg, std::move(cached))) {
+          state = std::move(opt::get(next));
+        }
+        break;
+      }
+
+      case CaptureType::unprotect:
+        state.unprotect(msg);
+        break;
+
+      case CaptureType::protect:
+        state.protect({}, bytes(record.plaintext_size, 0), 0);
+        break;
+
+      case CaptureType::commit: {
+        // The Commit is built again with the same options; since the
+        // randomness differs from the capture, the message differs too, but
+        // the work is the same
+        const auto encrypt = msg.wire_format() == WireFormat::mls_ciphertext;
+        const auto secret = random_bytes(state.cipher_suite().secret_size());
+        auto [commit, welcome, next] = state.commit(
+          secret, CommitOpts{ {}, true, encrypt, {} }, { encrypt, {}, 0 });
+        silence_unused(commit);
+        silence_unused(welcome);
+        own_commit = std::move(next);
+        break;
+      }
+
+      default:
+        throw InvalidParameterError("Unknown capture record type");
+    }
+  }
+
+private:
+  State state;
+  std::optional<State> own_commit;
+};
+
+int
+main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <capture file> [seed as hex]"
+              << std::endl;
+    return 1;
+  }
+
+  auto file = std::ifstream(argv[1], std::ios::binary);
+  if (!file) {
+    std::cerr << "Cannot open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  const auto data = bytes(std::vector<uint8_t>(
+    std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+  const auto capture = Capture::parse(data);
+
+  hpke::set_random_source(hpke::RandomSource::seeded);
+  hpke::set_random_seed(from_hex(argc > 2 ? argv[2] : default_seed));
+
+  auto replay = Replay(capture.header);
+  auto latencies = std::map<CaptureType, Latencies>{};
+  for (const auto& record : capture.records) {
+    auto& entry = latencies[record.type];
+    entry.captured.push_back(record.duration_ns);
+
+    // A record that fails when replayed, e.g., a late message for an epoch
+    // that a bare State does not keep, is counted and skipped
+    const auto start = std::chrono::steady_clock::now();
+    try {
+      replay.run(record);
+    } catch (const std::exception&) {
+      entry.errors += 1;
+      continue;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    entry.replayed.push_back(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+  }
+
+  std::cout << std::left << std::setw(12) << "operation" << std::right
+            << std::setw(8) << "count" << std::setw(8) << "errors"
+            << std::setw(14) << "capture p50" << std::setw(14) << "p99"
+            << std::setw(14) << "replay p50" << std::setw(14) << "p99"
+            << std::endl;
+
+  std::cout << std::fixed << std::setprecision(1);
+  for (const auto& [type, entry] : latencies) {
+    std::cout << std::left << std::setw(12) << type_name(type) << std::right
+              << std::setw(8) << entry.captured.size() << std::setw(8)
+              << entry.errors << std::setw(14)
+              << percentile_us(entry.captured, 0.50) << std::setw(14)
+              << percentile_us(entry.captured, 0.99) << std::setw(14)
+              << percentile_us(entry.replayed, 0.50) << std::setw(14)
+              << percentile_us(entry.replayed, 0.99) << std::endl;
+  }
+
+  std::cout << std::endl << "latencies in microseconds" << std::endl;
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <mls/async_session.h>
+
+#if defined(MLS_HAS_COROUTINES)
+
+namespace mls {
+
+AsyncSession::Shared::Shared(Session session_in)
+  : session(std::move(session_in))
+{
+}
+
+AsyncSession::AsyncSession(Session session, Options opts)
+  : shared(std::make_shared<Shared>(std::move(session)))
+  , worker(std::move(opts.worker))
+  , strand(std::move(opts.strand))
+{
+  if (!worker || !strand) {
+    throw InvalidParameterError("AsyncSession requires worker and strand");
+  }
+
+  if (opts.executor) {
+    shared->session.set_executor(std::move(opts.executor));
+  }
+}
+
+AsyncSession::Operation<bytes>
+AsyncSession::add(bytes key_package_data)
+{
+  return exclusive<bytes>(
+    [data = std::move(key_package_data)](Session& s) { return s.add(data); });
+}
+
+AsyncSession::Operation<bytes>
+AsyncSession::update()
+{
+  return exclusive<bytes>([](Session& s) { return s.update(); });
+}
+
+AsyncSession::Operation<bytes>
+AsyncSession::remove(uint32_t index)
+{
+  return exclusive<bytes>([index](Session& s) { return s.remove(index); });
+}
+
+AsyncSession::Operation<std::tuple<bytes, bytes>>
+AsyncSession::commit()
+{
+  return exclusive<std::tuple<bytes, bytes>>(
+    [](Session& s) { return s.commit(); });
+}
+
+AsyncSession::Operation<std::tuple<bytes, bytes>>
+AsyncSession::commit(std::vector<bytes> proposals)
+{
+  return exclusive<std::tuple<bytes, bytes>>(
+    [proposals = std::move(proposals)](Session& s) {
+      return s.commit(proposals);
+    });
+}
+
+AsyncSession::Operation<bool>
+AsyncSession::handle(bytes handshake_data)
+{
+  return exclusive<bool>([data = std::move(handshake_data)](Session& s) {
+    return s.handle(data);
+  });
+}
+
+AsyncSession::Operation<bytes>
+AsyncSession::protect(bytes plaintext)
+{
+  return exclusive<bytes>(
+    [pt = std::move(plaintext)](Session& s) { return s.protect(pt); });
+}
+
+AsyncSession::Operation<bytes>
+AsyncSession::unprotect(bytes ciphertext) const
+{
+  // Decryption only needs shared access, as with Session::unprotect()
+  return { worker, strand, [shared = shared, ct = std::move(ciphertext)]() {
+            const auto lock = std::shared_lock(shared->mutex);
+            return shared->session.unprotect(ct);
+          } };
+}
+
+} // namespace mls
+
+#endif // defined(MLS_HAS_COROUTINES)
@@ -0,0 +1,87 @@
+#include <mls/capture.h>
+
+namespace mls {
+
+CaptureWriter::CaptureWriter(std::ostream& out_in)
+  : out(out_in)
+{
+}
+
+void
+CaptureWriter::start(const CaptureHeader& header)
+{
+  const auto lock = std::lock_guard(mutex);
+  write(tls::marshal(header));
+}
+
+void
+CaptureWriter::record(const CaptureRecord& record)
+{
+  const auto lock = std::lock_guard(mutex);
+  write(tls::marshal(record));
+}
+
+void
+CaptureWriter::write(const bytes& data)
+{
+  auto w = tls::ostream{};
+  w << data;
+  const auto& framed = w.bytes();
+  out.write(reinterpret_cast<const char*>(framed.data()), // NOLINT
+            static_cast<std::streamsize>(framed.size()));
+  out.flush();
+}
+
+Capture
+Capture::parse(const bytes& data)
+{
+  auto r = tls::istream(data);
+  auto capture = Capture{};
+
+  auto header_data = bytes{};
+  r >> header_data;
+  capture.header = tls::get<CaptureHeader>(header_data);
+  if (capture.header.version != CaptureHeader::current_version) {
+    throw InvalidParameterError("Unsupported capture version");
+  }
+
+  while (!r.empty()) {
+    auto record_data = bytes{};
+    r >> record_data;
+    capture.records.push_back(tls::get<CaptureRecord>(record_data));
+  }
+
+  return capture;
+}
+
+CaptureTimer::CaptureTimer(CaptureSink* sink_in, Clock::time_point epoch_in)
+  : sink(sink_in)
+  , epoch(epoch_in)
+{
+  if (sink != nullptr) {
+    start = Clock::now();
+  }
+}
+
+void
+CaptureTimer::record(CaptureType type,
+                     const bytes& message,
+                     uint64_t plaintext_size) const
+{
+  if (sink == nullptr) {
+    return;
+  }
+
+  using std::chrono::duration_cast;
+  using std::chrono::nanoseconds;
+  const auto end = Clock::now();
+  sink->record({
+    type,
+    static_cast<uint64_t>(duration_cast<nanoseconds>(start - epoch).count()),
+    static_cast<uint64_t>(duration_cast<nanoseconds>(end - start).count()),
+    plaintext_size,
+    message,
+  });
+}
+
+} // namespace mls
@@ -0,0 +1,132 @@
+#include <mls/chunked.h>
+
+#include <limits>
+
+namespace mls {
+
+static const auto chunked_transfer_label =
+  std::string("MLS 1.0 chunked transfer");
+
+static constexpr uint8_t more_chunks = 0x00;
+static constexpr uint8_t last_chunk = 0x01;
+
+// The exporter context binds the secret to the sender and the transfer
+static bytes
+transfer_context(LeafIndex sender, const bytes& transfer_id)
+{
+  auto w = tls::ostream{};
+  w << sender << transfer_id;
+  return w.bytes();
+}
+
+static size_t
+secret_size(CipherSuite suite)
+{
+  return suite.key_size() + suite.nonce_size();
+}
+
+ChunkCipher::ChunkCipher(const State& state,
+                         LeafIndex sender,
+                         const bytes& transfer_id)
+  : ChunkCipher(state.cipher_suite(),
+                state.do_export(chunked_transfer_label,
+                                transfer_context(sender, transfer_id),
+                                secret_size(state.cipher_suite())))
+{
+}
+
+ChunkCipher::ChunkCipher(const Session& session,
+                         LeafIndex sender,
+                         const bytes& transfer_id)
+  : ChunkCipher(session.cipher_suite(),
+                session.do_export(chunked_transfer_label,
+                                  transfer_context(sender, transfer_id),
+                                  secret_size(session.cipher_suite())))
+{
+}
+
+ChunkCipher::ChunkCipher(CipherSuite suite, const bytes& secret)
+  : aead(suite.hpke().aead)
+  , ctx(aead.keyed(bytes_view(secret).slice(0, aead.key_size)))
+  , base_nonce(bytes_view(secret).slice(aead.key_size, secret.size()))
+{
+}
+
+bytes
+ChunkCipher::nonce() const
+{
+  auto ctr = bytes(aead.nonce_size, 0);
+  for (size_t i = 0; i < sizeof(seq); i++) {
+    ctr.at(aead.nonce_size - 1 - i) = static_cast<uint8_t>(seq >> (8 * i));
+  }
+  return base_nonce ^ ctr;
+}
+
+void
+ChunkCipher::advance()
+{
+  if (seq == std::numeric_limits<uint64_t>::max()) {
+    throw ProtocolError("Chunk sequence number overflow");
+  }
+
+  seq += 1;
+}
+
+ChunkSealer::ChunkSealer(const State& state, const bytes& transfer_id)
+  : ChunkCipher(state, state.index(), transfer_id)
+{
+}
+
+ChunkSealer::ChunkSealer(const Session& session, const bytes& transfer_id)
+  : ChunkCipher(session, session.index(), transfer_id)
+{
+}
+
+bytes
+ChunkSealer::seal(bytes_view chunk, bool last)
+{
+  if (done) {
+    throw InvalidParameterError("Chunked transfer already finished");
+  }
+
+  const auto flag = bytes{ last ? last_chunk : more_chunks };
+  auto sealed = flag;
+  ctx->seal_into(nonce(), flag, { chunk }, sealed);
+  advance();
+  done = last;
+  return sealed;
+}
+
+bytes
+ChunkOpener::open(bytes_view chunk)
+{
+  if (done) {
+    throw ProtocolError("Chunk after the end of a transfer");
+  }
+
+  if (chunk.empty()) {
+    throw ProtocolError("Truncated chunk");
+  }
+
+  const auto flag = chunk.slice(0, 1);
+  if (flag.data()[0] != more_chunks && flag.data()[0] != last_chunk) {
+    throw ProtocolError("Malformed chunk flag");
+  }
+
+  auto pt = std::optional<bytes>{};
+  try {
+    pt = ctx->open(nonce(), flag, chunk.slice(1, chunk.size()));
+  } catch (const std::runtime_error&) {
+    // The AEAD may also report an authentication failure by throwing
+  }
+
+  if (!pt) {
+    throw ProtocolError("Chunk decryption failure");
+  }
+
+  advance();
+  done = (flag.data()[0] == last_chunk);
+  return opt::get(pt);
+}
+
+} // namespace mls
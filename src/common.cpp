@@ -1,5 +1,7 @@
 #include "mls/common.h"
 
+#include <thread>
+
 namespace mls {
 
 uint64_t
@@ -10,4 +12,30 @@ seconds_since_epoch()
   return std::time(nullptr);
 }
 
+void
+execute(const Executor& executor,
+        size_t count,
+        const std::function<void(size_t)>& task)
+{
+  if (!executor) {
+    for (size_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+
+  executor(count, task);
+}
+
+void
+schedule(const Scheduler& scheduler, std::function<void()> task)
+{
+  if (!scheduler) {
+    std::thread(std::move(task)).detach();
+    return;
+  }
+
+  scheduler(std::move(task));
+}
+
 } // namespace mls
@@ -1,6 +1,7 @@
 #include "mls/core_types.h"
 #include "mls/messages.h"
 
+#include <mutex>
 #include <set>
 
 namespace mls {
@@ -54,7 +55,7 @@ Capabilities::create_default()
   return {
     { all_supported_versions.begin(), all_supported_versions.end() },
     { all_supported_ciphersuites.begin(), all_supported_ciphersuites.end() },
-    { /* No non-default extensions */ },
+    { ExtensionType::compressed_ratchet_tree },
     { /* No non-default proposals */ },
     { all_supported_credentials.begin(), all_supported_credentials.end() },
   };
@@ -98,25 +99,65 @@ Lifetime::create_default()
   return Lifetime{ 0x0000000000000000, 0xffffffffffffffff };
 }
 
+struct ExtensionList::ParsedCache
+{
+  std::mutex mutex;
+  std::vector<std::tuple<Extension::Type, std::shared_ptr<const void>>> values;
+};
+
 void
 ExtensionList::add(uint16_t type, bytes data)
 {
+  _parsed.reset();
+
   auto curr = std::find_if(
-    extensions.begin(), extensions.end(), [&](const Extension& ext) -> bool {
+    _extensions.begin(), _extensions.end(), [&](const Extension& ext) -> bool {
       return ext.type == type;
     });
-  if (curr != extensions.end()) {
+  if (curr != _extensions.end()) {
     curr->data = std::move(data);
     return;
   }
 
-  extensions.push_back({ type, std::move(data) });
+  _extensions.push_back({ type, std::move(data) });
+}
+
+const void*
+ExtensionList::parsed(Extension::Type type, Parser parse) const
+{
+  const auto ext = std::find_if(
+    _extensions.begin(), _extensions.end(), [&](const Extension& ext) -> bool {
+      return ext.type == type;
+    });
+  if (ext == _extensions.end()) {
+    return nullptr;
+  }
+
+  // Concurrent readers may race to create the cache; the first one wins
+  auto cache = std::atomic_load(&_parsed);
+  if (!cache) {
+    auto fresh = std::make_shared<ParsedCache>();
+    if (std::atomic_compare_exchange_strong(&_parsed, &cache, fresh)) {
+      cache = std::move(fresh);
+    }
+  }
+
+  const auto lock = std::lock_guard(cache->mutex);
+  for (const auto& [cached_type, value] : cache->values) {
+    if (cached_type == type) {
+      return value.get();
+    }
+  }
+
+  auto value = parse(ext->data);
+  cache->values.emplace_back(type, value);
+  return value.get();
 }
 
 bool
 ExtensionList::has(uint16_t type) const
 {
-  return stdx::any_of(extensions,
+  return stdx::any_of(_extensions,
                       [&](const Extension& ext) { return ext.type == type; });
 }
 
@@ -200,8 +241,15 @@ bool
 LeafNode::verify(CipherSuite cipher_suite,
                  const std::optional<bytes>& group_id) const
 {
-  const auto tbs = to_be_signed(group_id);
+  const auto check = signature_verification(cipher_suite, group_id);
+  return signature_key.verify(
+    cipher_suite, check.label, check.message, check.signature);
+}
 
+SignatureVerification
+LeafNode::signature_verification(CipherSuite cipher_suite,
+                                 const std::optional<bytes>& group_id) const
+{
   if (CredentialType::x509 == credential.type()) {
     const auto& cred = credential.get<X509Credential>();
     if (cred.signature_scheme() !=
@@ -210,8 +258,10 @@ LeafNode::verify(CipherSuite cipher_suite,
     }
   }
 
-  return signature_key.verify(
-    cipher_suite, sign_label::leaf_node, tbs, signature);
+  return { signature_key,
+           sign_label::leaf_node,
+           to_be_signed(group_id),
+           signature };
 }
 
 bool
@@ -231,21 +281,20 @@ LeafNode::verify_extension_support(const ExtensionList& ext_list) const
 {
   // Verify that extensions in the list are supported
   auto ext_types = stdx::transform<Extension::Type>(
-    ext_list.extensions, [](const auto& ext) { return ext.type; });
+    ext_list.extensions(), [](const auto& ext) { return ext.type; });
 
   if (!capabilities.extensions_supported(ext_types)) {
     return false;
   }
 
   // If there's a RequiredCapabilities extension, verify support
-  const auto maybe_req_capas = ext_list.find<RequiredCapabilitiesExtension>();
-  if (!maybe_req_capas) {
+  const auto* req_capas = ext_list.get<RequiredCapabilitiesExtension>();
+  if (req_capas == nullptr) {
     return true;
   }
 
-  const auto& req_capas = opt::get(maybe_req_capas);
-  return capabilities.extensions_supported(req_capas.extensions) &&
-         capabilities.proposals_supported(req_capas.proposals);
+  return capabilities.extensions_supported(req_capas->extensions) &&
+         capabilities.proposals_supported(req_capas->proposals);
 }
 
 LeafNode
@@ -380,6 +429,10 @@ KeyPackage::KeyPackage(CipherSuite suite_in,
 KeyPackageRef
 KeyPackage::ref() const
 {
+  if (_ref) {
+    return opt::get(_ref);
+  }
+
   return cipher_suite.ref(*this);
 }
 
@@ -388,34 +441,55 @@ KeyPackage::sign(const SignaturePrivateKey& sig_priv)
 {
   auto tbs = to_be_signed();
   signature = sig_priv.sign(cipher_suite, sign_label::key_package, tbs);
+
+  _ref.reset();
+  _ref = ref();
 }
 
-bool
-KeyPackage::verify() const
+tls::istream&
+operator>>(tls::istream& str, KeyPackage& obj)
 {
-  // Verify the inner leaf node
-  if (!leaf_node.verify(cipher_suite, std::nullopt)) {
-    return false;
+  const auto* start = str.data();
+  const auto available = str.size();
+  str >> obj.version >> obj.cipher_suite >> obj.init_key >> obj.leaf_node >>
+    obj.extensions >> obj.signature;
+
+  // A KeyPackage for a suite that is not supported can still be decoded, but
+  // has no reference
+  obj._ref.reset();
+  if (stdx::contains(all_supported_suites, obj.cipher_suite.cipher_suite())) {
+    const auto encoded = bytes_view(start, available - str.size());
+    obj._ref = obj.cipher_suite.ref_of_encoding<KeyPackage>(encoded);
   }
 
+  return str;
+}
+
+bool
+KeyPackage::verify() const
+{
   // Check that the inner leaf node is intended for use in a KeyPackage
   if (leaf_node.source() != LeafNodeSource::key_package) {
     return false;
   }
 
-  // Verify the KeyPackage
-  const auto tbs = to_be_signed();
-
-  if (CredentialType::x509 == leaf_node.credential.type()) {
-    const auto& cred = leaf_node.credential.get<X509Credential>();
-    if (cred.signature_scheme() !=
-        tls_signature_scheme(cipher_suite.sig().id)) {
-      throw std::runtime_error("Signature algorithm invalid");
-    }
-  }
+  // Verify the inner leaf node and the KeyPackage
+  return SignaturePublicKey::verify_batch(
+    cipher_suite, signature_verifications(), {});
+}
 
-  return leaf_node.signature_key.verify(
-    cipher_suite, sign_label::key_package, tbs, signature);
+std::vector<SignatureVerification>
+KeyPackage::signature_verifications() const
+{
+  // The leaf node's check covers the credential's signature scheme, which is
+  // also the scheme used for the KeyPackage signature
+  return {
+    leaf_node.signature_verification(cipher_suite, std::nullopt),
+    { leaf_node.signature_key,
+      sign_label::key_package,
+      to_be_signed(),
+      signature },
+  };
 }
 
 bytes
@@ -426,4 +500,123 @@ KeyPackage::to_be_signed() const
   return out.bytes();
 }
 
+///
+/// HPKECiphertextList
+///
+
+HPKECiphertextList::HPKECiphertextList(size_t size)
+  : _ciphertexts(size)
+{
+}
+
+HPKECiphertextList::HPKECiphertextList(std::vector<HPKECiphertext> ciphertexts)
+  : _ciphertexts(std::move(ciphertexts))
+{
+}
+
+HPKECiphertextList::HPKECiphertextList(
+  std::initializer_list<HPKECiphertext> ciphertexts)
+  : _ciphertexts(ciphertexts)
+{
+}
+
+size_t
+HPKECiphertextList::size() const
+{
+  return _offsets.empty() ? _ciphertexts.size() : _offsets.size();
+}
+
+HPKECiphertext
+HPKECiphertextList::at(size_t i) const
+{
+  if (_offsets.empty()) {
+    return _ciphertexts.at(i);
+  }
+
+  const auto offset = _offsets.at(i);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  auto r = tls::istream(_encoded.data() + offset, _encoded.size() - offset);
+  auto ciphertext = HPKECiphertext{};
+  r >> ciphertext;
+  return ciphertext;
+}
+
+void
+HPKECiphertextList::set(size_t i, HPKECiphertext ciphertext)
+{
+  if (!_offsets.empty()) {
+    auto ciphertexts = std::vector<HPKECiphertext>(_offsets.size());
+    for (size_t j = 0; j < ciphertexts.size(); j++) {
+      ciphertexts[j] = at(j);
+    }
+
+    *this = HPKECiphertextList(std::move(ciphertexts));
+  }
+
+  _ciphertexts.at(i) = std::move(ciphertext);
+}
+
+tls::ostream&
+operator<<(tls::ostream& str, const HPKECiphertextList& obj)
+{
+  // The body of the vector is written as it was read
+  if (!obj._offsets.empty()) {
+    return str << obj._encoded;
+  }
+
+  return str << obj._ciphertexts;
+}
+
+// Step over an opaque<V> without copying it
+static void
+skip_opaque(tls::istream& str)
+{
+  auto size = uint64_t(0);
+  tls::varint::decode(str, size);
+  str.sub_stream(static_cast<size_t>(size));
+}
+
+tls::istream&
+operator>>(tls::istream& str, HPKECiphertextList& obj)
+{
+  auto encoded = bytes{};
+  str >> encoded;
+
+  // Index the entries, which also checks that the list is well-formed
+  auto offsets = std::vector<size_t>{};
+  auto r = tls::istream(encoded.data(), encoded.size());
+  while (!r.empty()) {
+    offsets.push_back(encoded.size() - r.size());
+    skip_opaque(r); // kem_output
+    skip_opaque(r); // ciphertext
+  }
+
+  obj = HPKECiphertextList{};
+  obj._encoded = std::move(encoded);
+  obj._offsets = std::move(offsets);
+  return str;
+}
+
+bool
+operator==(const HPKECiphertextList& lhs, const HPKECiphertextList& rhs)
+{
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < lhs.size(); i++) {
+    if (lhs.at(i) != rhs.at(i)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+operator!=(const HPKECiphertextList& lhs, const HPKECiphertextList& rhs)
+{
+  return !(lhs == rhs);
+}
+
 } // namespace mls
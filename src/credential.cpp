@@ -2,6 +2,10 @@
 #include "hpke/certificate.h"
 #include <tls/tls_syntax.h>
 
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
 namespace mls {
 
 ///
@@ -39,43 +43,146 @@ bytes_to_x509_credential_data(const std::vector<bytes>& data_in)
     data_in, [](const bytes& der) { return X509Credential::CertData{ der }; });
 }
 
-X509Credential::X509Credential(const std::vector<bytes>& der_chain_in)
-  : der_chain(bytes_to_x509_credential_data(der_chain_in))
+struct X509Credential::Chain
 {
-  if (der_chain.empty()) {
-    throw std::invalid_argument("empty certificate chain");
+  std::vector<CertData> der_chain;
+  SignaturePublicKey public_key;
+  SignatureScheme signature_scheme;
+
+  explicit Chain(std::vector<CertData> der_chain_in)
+    : der_chain(std::move(der_chain_in))
+  {
+    if (der_chain.empty()) {
+      throw std::invalid_argument("empty certificate chain");
+    }
+
+    // Parse the chain
+    auto parsed = std::vector<Certificate>();
+    for (const auto& cert : der_chain) {
+      parsed.emplace_back(cert.data);
+    }
+
+    // first element represents leaf cert
+    const auto& sig = find_signature(parsed[0].public_key_algorithm());
+    const auto pub_data = sig.serialize(*parsed[0].public_key);
+    signature_scheme = tls_signature_scheme(parsed[0].public_key_algorithm());
+    public_key = SignaturePublicKey{ pub_data };
+
+    // verify chain for valid signatures
+    for (size_t i = 0; i < der_chain.size() - 1; i++) {
+      if (!parsed[i].valid_from(parsed[i + 1])) {
+        throw std::runtime_error("Certificate Chain validation failure");
+      }
+    }
+  }
+};
+
+///
+/// Certificate chain interning
+///
+
+// Chains are indexed by a hash of their contents.  The table only holds weak
+// references, so a chain is freed once no credential refers to it, and its
+// entry is swept out once the table has doubled in size since the last sweep.
+// Only chains that parsed and validated are ever entered.
+class X509Credential::ChainTable
+{
+public:
+  std::shared_ptr<const Chain> get(std::vector<CertData>&& der_chain)
+  {
+    const auto key = hash(der_chain);
+    {
+      const auto lock = std::shared_lock(mutex);
+      if (auto found = find(key, der_chain)) {
+        return found;
+      }
+    }
+
+    // Parse outside the lock; if two threads race, the first insert wins
+    auto parsed = std::make_shared<const Chain>(std::move(der_chain));
+
+    const auto lock = std::unique_lock(mutex);
+    if (auto found = find(key, parsed->der_chain)) {
+      return found;
+    }
+
+    chains.emplace(key, parsed);
+    if (chains.size() > 2 * live_after_sweep) {
+      sweep();
+    }
+
+    return parsed;
   }
 
-  // Parse the chain
-  auto parsed = std::vector<Certificate>();
-  for (const auto& cert : der_chain) {
-    parsed.emplace_back(cert.data);
+private:
+  std::shared_mutex mutex;
+  std::unordered_multimap<size_t, std::weak_ptr<const Chain>> chains;
+  size_t live_after_sweep = 16;
+
+  static size_t hash(const std::vector<CertData>& der_chain)
+  {
+    auto value = der_chain.size();
+    for (const auto& cert : der_chain) {
+      // Boost's hash_combine
+      value ^= std::hash<bytes>{}(cert.data) + 0x9e3779b9 + (value << 6) +
+               (value >> 2);
+    }
+    return value;
   }
 
-  // first element represents leaf cert
-  const auto& sig = find_signature(parsed[0].public_key_algorithm());
-  const auto pub_data = sig.serialize(*parsed[0].public_key);
-  _signature_scheme = tls_signature_scheme(parsed[0].public_key_algorithm());
-  _public_key = SignaturePublicKey{ pub_data };
+  std::shared_ptr<const Chain> find(size_t key,
+                                    const std::vector<CertData>& der_chain)
+  {
+    const auto [begin, end] = chains.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+      auto chain = it->second.lock();
+      if (chain && chain->der_chain == der_chain) {
+        return chain;
+      }
+    }
+
+    return nullptr;
+  }
 
-  // verify chain for valid signatures
-  for (size_t i = 0; i < der_chain.size() - 1; i++) {
-    if (!parsed[i].valid_from(parsed[i + 1])) {
-      throw std::runtime_error("Certificate Chain validation failure");
+  void sweep()
+  {
+    for (auto it = chains.begin(); it != chains.end();) {
+      it = it->second.expired() ? chains.erase(it) : std::next(it);
     }
+    live_after_sweep = std::max(live_after_sweep, chains.size());
   }
+};
+
+std::shared_ptr<const X509Credential::Chain>
+X509Credential::intern(std::vector<CertData>&& der_chain)
+{
+  static auto table = ChainTable{};
+  return table.get(std::move(der_chain));
+}
+
+X509Credential::X509Credential(const std::vector<bytes>& der_chain_in)
+  : _chain(intern(bytes_to_x509_credential_data(der_chain_in)))
+{
 }
 
 SignatureScheme
 X509Credential::signature_scheme() const
 {
-  return _signature_scheme;
+  if (!_chain) {
+    throw InvalidParameterError("Empty X509Credential");
+  }
+
+  return _chain->signature_scheme;
 }
 
 SignaturePublicKey
 X509Credential::public_key() const
 {
-  return _public_key;
+  if (!_chain) {
+    return {};
+  }
+
+  return _chain->public_key;
 }
 
 bool
@@ -84,10 +191,21 @@ X509Credential::valid_for(const SignaturePublicKey& pub) const
   return pub == public_key();
 }
 
+const std::vector<X509Credential::CertData>&
+X509Credential::der_chain() const
+{
+  static const auto empty = std::vector<CertData>{};
+  if (!_chain) {
+    return empty;
+  }
+
+  return _chain->der_chain;
+}
+
 tls::ostream&
 operator<<(tls::ostream& str, const X509Credential& obj)
 {
-  return str << obj.der_chain;
+  return str << obj.der_chain();
 }
 
 tls::istream&
@@ -96,9 +214,9 @@ operator>>(tls::istream& str, X509Credential& obj)
   auto der_chain = std::vector<X509Credential::CertData>{};
   str >> der_chain;
 
-  auto der_in = stdx::transform<bytes>(
-    der_chain, [](const auto& cert_data) { return cert_data.data; });
-  obj = X509Credential(der_in);
+  auto chain = X509Credential{};
+  chain._chain = X509Credential::intern(std::move(der_chain));
+  obj = std::move(chain);
 
   return str;
 }
@@ -106,7 +224,8 @@ operator>>(tls::istream& str, X509Credential& obj)
 bool
 operator==(const X509Credential& lhs, const X509Credential& rhs)
 {
-  return lhs.der_chain == rhs.der_chain;
+  // Interned chains with the same contents are the same object
+  return lhs._chain == rhs._chain || lhs.der_chain() == rhs.der_chain();
 }
 
 ///
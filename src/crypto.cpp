@@ -3,6 +3,12 @@
 #include <mls/log.h>
 #include <mls/messages.h>
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <string>
 
 using hpke::AEAD;      // NOLINT(misc-unused-using-decls)
@@ -12,6 +18,7 @@ using hpke::KDF;       // NOLINT(misc-unused-using-decls)
 using hpke::KEM;       // NOLINT(misc-unused-using-decls)
 using hpke::Signature; // NOLINT(misc-unused-using-decls)
 
+using mls::log::Level;
 using mls::log::Log;
 static const auto log_mod = "crypto"s;
 
@@ -38,6 +45,18 @@ tls_signature_scheme(Signature::ID id)
   }
 }
 
+Executor
+async_crypto_executor()
+{
+  return [](size_t count, const std::function<void(size_t)>& task) {
+    auto batch = hpke::AsyncBatch{};
+    for (size_t i = 0; i < count; i++) {
+      batch.add([&task, i]() { task(i); });
+    }
+    batch.run();
+  };
+}
+
 ///
 /// CipherSuites and details
 ///
@@ -71,92 +90,60 @@ CipherSuite::signature_scheme() const
   }
 }
 
+template<CipherSuite::ID suite_id>
 const CipherSuite::Ciphers&
-CipherSuite::get() const
+CipherSuite::ciphers()
 {
-  static const auto ciphers_X25519_AES128GCM_SHA256_Ed25519 =
-    CipherSuite::Ciphers{
-      HPKE(KEM::ID::DHKEM_X25519_SHA256,
-           KDF::ID::HKDF_SHA256,
-           AEAD::ID::AES_128_GCM),
-      Digest::get<Digest::ID::SHA256>(),
-      Signature::get<Signature::ID::Ed25519>(),
-    };
-
-  static const auto ciphers_P256_AES128GCM_SHA256_P256 = CipherSuite::Ciphers{
-    HPKE(
-      KEM::ID::DHKEM_P256_SHA256, KDF::ID::HKDF_SHA256, AEAD::ID::AES_128_GCM),
-    Digest::get<Digest::ID::SHA256>(),
-    Signature::get<Signature::ID::P256_SHA256>(),
-  };
-
-  static const auto ciphers_X25519_CHACHA20POLY1305_SHA256_Ed25519 =
-    CipherSuite::Ciphers{
-      HPKE(KEM::ID::DHKEM_X25519_SHA256,
-           KDF::ID::HKDF_SHA256,
-           AEAD::ID::CHACHA20_POLY1305),
-      Digest::get<Digest::ID::SHA256>(),
-      Signature::get<Signature::ID::Ed25519>(),
-    };
-
-  static const auto ciphers_X448_AES256GCM_SHA512_Ed448 = CipherSuite::Ciphers{
-    HPKE(
-      KEM::ID::DHKEM_X448_SHA512, KDF::ID::HKDF_SHA512, AEAD::ID::AES_256_GCM),
-    Digest::get<Digest::ID::SHA512>(),
-    Signature::get<Signature::ID::Ed448>(),
-  };
-
-  static const auto ciphers_P521_AES256GCM_SHA512_P521 = CipherSuite::Ciphers{
-    HPKE(
-      KEM::ID::DHKEM_P521_SHA512, KDF::ID::HKDF_SHA512, AEAD::ID::AES_256_GCM),
-    Digest::get<Digest::ID::SHA512>(),
-    Signature::get<Signature::ID::P521_SHA512>(),
+  using Traits = CipherSuiteTraits<suite_id>;
+  static const auto ciphers = Ciphers{
+    HPKE(Traits::kem_id, Traits::kdf_id, Traits::aead_id),
+    Digest::get<Traits::digest_id>(),
+    Signature::get<Traits::sig_id>(),
   };
+  return ciphers;
+}
 
-  static const auto ciphers_X448_CHACHA20POLY1305_SHA512_Ed448 =
-    CipherSuite::Ciphers{
-      HPKE(KEM::ID::DHKEM_X448_SHA512,
-           KDF::ID::HKDF_SHA512,
-           AEAD::ID::CHACHA20_POLY1305),
-      Digest::get<Digest::ID::SHA512>(),
-      Signature::get<Signature::ID::Ed448>(),
-    };
-
-  switch (id) {
-    case ID::unknown:
-      throw InvalidParameterError("Uninitialized ciphersuite");
-
-    case ID::X25519_AES128GCM_SHA256_Ed25519:
-      return ciphers_X25519_AES128GCM_SHA256_Ed25519;
-
-    case ID::P256_AES128GCM_SHA256_P256:
-      return ciphers_P256_AES128GCM_SHA256_P256;
-
-    case ID::X25519_CHACHA20POLY1305_SHA256_Ed25519:
-      return ciphers_X25519_CHACHA20POLY1305_SHA256_Ed25519;
-
-    case ID::X448_AES256GCM_SHA512_Ed448:
-      return ciphers_X448_AES256GCM_SHA512_Ed448;
-
-    case ID::P521_AES256GCM_SHA512_P521:
-      return ciphers_P521_AES256GCM_SHA512_P521;
+const CipherSuite::Ciphers&
+CipherSuite::get() const
+{
+  return visit([](auto traits) -> const Ciphers& {
+    return ciphers<decltype(traits)::id>();
+  });
+}
 
-    case ID::X448_CHACHA20POLY1305_SHA512_Ed448:
-      return ciphers_X448_CHACHA20POLY1305_SHA512_Ed448;
+///
+/// Pre-encoded labels
+///
 
-    default:
-      throw InvalidParameterError("Unsupported ciphersuite");
-  }
+KDFLabel::KDFLabel(const std::string& label)
+  : _encoded(tls::marshal(from_ascii("mls10 " + label)))
+{
 }
 
-struct HKDFLabel
+const KDFLabels&
+KDFLabels::get()
 {
-  uint16_t length;
-  bytes label;
-  bytes context;
+  static const auto labels = KDFLabels{};
+  return labels;
+}
 
-  TLS_SERIALIZABLE(length, label, context)
-};
+// struct {
+//     uint16 length;
+//     opaque label<V>;
+//     opaque context<V>;
+// } HKDFLabel;
+static bytes
+hkdf_label(size_t length, const KDFLabel& label, const bytes& context)
+{
+  const auto length16 = static_cast<uint16_t>(length);
+  auto w = tls::ostream{};
+  w.reserve(sizeof(length16) + label.encoded().size() +
+            tls::encoded_size(context));
+  w << length16;
+  w.write_raw(label.encoded());
+  w << context;
+  return w.bytes();
+}
 
 bytes
 CipherSuite::expand_with_label(const bytes& secret,
@@ -164,15 +151,22 @@ CipherSuite::expand_with_label(const bytes& secret,
                                const bytes& context,
                                size_t length) const
 {
-  auto mls_label = from_ascii(std::string("mls10 ") + label);
-  auto length16 = static_cast<uint16_t>(length);
-  auto label_bytes = tls::marshal(HKDFLabel{ length16, mls_label, context });
+  return expand_with_label(secret, KDFLabel(label), context, length);
+}
+
+bytes
+CipherSuite::expand_with_label(const bytes& secret,
+                               const KDFLabel& label,
+                               const bytes& context,
+                               size_t length) const
+{
+  auto label_bytes = hkdf_label(length, label, context);
   auto derived = get().hpke.kdf.expand(secret, label_bytes, length);
 
-  Log::crypto(log_mod, "=== ExpandWithLabel ===");
-  Log::crypto(log_mod, "  secret ", to_hex(secret));
-  Log::crypto(log_mod, "  label  ", to_hex(label_bytes));
-  Log::crypto(log_mod, "  length ", length);
+  MLS_LOG_CRYPTO(log_mod, "=== ExpandWithLabel ===");
+  MLS_LOG_CRYPTO(log_mod, "  secret ", to_hex(secret));
+  MLS_LOG_CRYPTO(log_mod, "  label  ", to_hex(label_bytes));
+  MLS_LOG_CRYPTO(log_mod, "  length ", length);
 
   return derived;
 }
@@ -180,10 +174,76 @@ CipherSuite::expand_with_label(const bytes& secret,
 bytes
 CipherSuite::derive_secret(const bytes& secret, const std::string& label) const
 {
-  Log::crypto(log_mod, "=== DeriveSecret ===");
+  return derive_secret(secret, KDFLabel(label));
+}
+
+bytes
+CipherSuite::derive_secret(const bytes& secret, const KDFLabel& label) const
+{
+  MLS_LOG_CRYPTO(log_mod, "=== DeriveSecret ===");
   return expand_with_label(secret, label, {}, secret_size());
 }
 
+std::vector<bytes>
+CipherSuite::expand_with_labels(const bytes& secret,
+                                const std::vector<LabelAndLength>& labels,
+                                const bytes& context) const
+{
+  const auto encoded = stdx::transform<KDFLabel>(
+    labels, [](const auto& label) { return KDFLabel(std::get<0>(label)); });
+
+  auto encoded_labels = std::vector<KDFLabelAndLength>{};
+  encoded_labels.reserve(labels.size());
+  for (size_t i = 0; i < labels.size(); i++) {
+    encoded_labels.emplace_back(&encoded[i], std::get<1>(labels[i]));
+  }
+
+  return expand_with_labels(secret, encoded_labels, context);
+}
+
+std::vector<bytes>
+CipherSuite::expand_with_labels(const bytes& secret,
+                                const std::vector<KDFLabelAndLength>& labels,
+                                const bytes& context) const
+{
+  auto label_bytes = std::vector<bytes>{};
+  auto outputs = std::vector<hpke::KDF::Expansion>{};
+  label_bytes.reserve(labels.size());
+  outputs.reserve(labels.size());
+  for (const auto& [label, length] : labels) {
+    label_bytes.push_back(hkdf_label(length, *label, context));
+    outputs.emplace_back(label_bytes.back(), length);
+  }
+
+  auto derived = get().hpke.kdf.expand_multi(secret, outputs);
+
+#ifdef ENABLE_LOG_CRYPTO
+  if (Log::enabled(Level::crypto)) {
+    Log::crypto(log_mod, "=== ExpandWithLabels ===");
+    Log::crypto(log_mod, "  secret ", to_hex(secret));
+    for (size_t i = 0; i < labels.size(); i++) {
+      Log::crypto(log_mod, "  label  ", to_hex(label_bytes[i]));
+      Log::crypto(log_mod, "  length ", std::get<1>(labels[i]));
+    }
+  }
+#endif
+
+  return derived;
+}
+
+std::vector<bytes>
+CipherSuite::derive_secrets(const bytes& secret,
+                            const std::vector<std::string>& labels) const
+{
+  MLS_LOG_CRYPTO(log_mod, "=== DeriveSecrets ===");
+  const auto size = secret_size();
+  const auto labels_and_lengths =
+    stdx::transform<LabelAndLength>(labels, [&](const auto& label) {
+      return LabelAndLength{ label, size };
+    });
+  return expand_with_labels(secret, labels_and_lengths, {});
+}
+
 const std::array<CipherSuite::ID, 6> all_supported_suites = {
   CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519,
   CipherSuite::ID::P256_AES128GCM_SHA256_P256,
@@ -216,6 +276,148 @@ CipherSuite::reference_label<MLSAuthenticatedContent>()
   return label;
 }
 
+///
+/// Parsed public key cache
+///
+
+// Parsing a public key can be expensive (e.g., point decompression and
+// validation for the NIST curves), so each distinct key is parsed once and the
+// parsed key is shared.  The cache holds at most `max_keys` keys, evicting the
+// oldest first.
+template<typename T>
+class PublicKeyCache
+{
+public:
+  static constexpr size_t max_keys = 4096;
+
+  template<typename Parse>
+  std::shared_ptr<const T> get(CipherSuite::ID suite,
+                               const bytes& data,
+                               const Parse& parse)
+  {
+    {
+      const auto lock = std::shared_lock(mutex);
+      const auto suite_it = keys.find(suite);
+      if (suite_it != keys.end()) {
+        const auto it = suite_it->second.find(data);
+        if (it != suite_it->second.end()) {
+          return it->second;
+        }
+      }
+    }
+
+    // Parse outside the lock; if two threads race, the first insert wins
+    auto parsed = std::shared_ptr<const T>(parse(data));
+
+    const auto lock = std::unique_lock(mutex);
+    auto [it, inserted] = keys[suite].emplace(data, parsed);
+    if (!inserted) {
+      return it->second;
+    }
+
+    order.emplace_back(suite, data);
+    if (order.size() > max_keys) {
+      const auto& [old_suite, old_data] = order.front();
+      keys.at(old_suite).erase(old_data);
+      order.pop_front();
+    }
+
+    return parsed;
+  }
+
+private:
+  std::shared_mutex mutex;
+  std::map<CipherSuite::ID, std::map<bytes, std::shared_ptr<const T>>> keys;
+  std::deque<std::tuple<CipherSuite::ID, bytes>> order;
+};
+
+static std::shared_ptr<const KEM::PublicKey>
+parsed_hpke_public_key(CipherSuite suite, const bytes& data)
+{
+  static auto cache = PublicKeyCache<KEM::PublicKey>{};
+  return cache.get(suite.cipher_suite(), data, [&](const auto& pub) {
+    return suite.hpke().kem.deserialize(pub);
+  });
+}
+
+static std::shared_ptr<const Signature::PublicKey>
+parsed_signature_public_key(const CipherSuite& suite, const bytes& data)
+{
+  static auto cache = PublicKeyCache<Signature::PublicKey>{};
+  return cache.get(suite.cipher_suite(), data, [&](const auto& pub) {
+    return suite.sig().deserialize(pub);
+  });
+}
+
+///
+/// Verified signature cache
+///
+
+// The same signature is often checked more than once: a delivery service may
+// retransmit a message, and a KeyPackage is checked both when it is proposed
+// and when the Commit that adds it is applied.  A digest of each successful
+// verification is remembered, so that a repeat skips the asymmetric operation.
+// The digest covers the suite, the key, the signed content and the signature,
+// so only exactly the same check can hit, and failures are never remembered.
+// The cache holds at most `max_entries` digests, evicting the oldest first.
+class VerifiedSignatureCache
+{
+public:
+  static constexpr size_t max_entries = 4096;
+
+  bool contains(const bytes& digest)
+  {
+    const auto lock = std::shared_lock(mutex);
+    return entries.count(digest) > 0;
+  }
+
+  void insert(const bytes& digest)
+  {
+    const auto lock = std::unique_lock(mutex);
+    if (!entries.insert(digest).second) {
+      return;
+    }
+
+    order.push_back(digest);
+    if (order.size() > max_entries) {
+      entries.erase(order.front());
+      order.pop_front();
+    }
+  }
+
+private:
+  std::shared_mutex mutex;
+  std::set<bytes> entries;
+  std::deque<bytes> order;
+};
+
+static VerifiedSignatureCache&
+verified_signatures()
+{
+  static auto cache = VerifiedSignatureCache{};
+  return cache;
+}
+
+struct VerifiedSignature
+{
+  CipherSuite::ID suite;
+  const bytes& key;
+  const bytes& content;
+  const bytes& signature;
+
+  TLS_SERIALIZABLE(suite, key, content, signature)
+};
+
+static bytes
+verified_signature_digest(const CipherSuite& suite,
+                          const bytes& key,
+                          const bytes& content,
+                          const bytes& signature)
+{
+  return suite.digest().hash(tls::marshal(
+    VerifiedSignature{ suite.cipher_suite(), key, content, signature }));
+}
+
 ///
 /// HPKEPublicKey and HPKEPrivateKey
 ///
@@ -225,12 +427,52 @@ HPKEPublicKey::encrypt(CipherSuite suite,
                        const bytes& aad,
                        const bytes& pt) const
 {
-  auto pkR = suite.hpke().kem.deserialize(data);
+  auto pkR = parsed_hpke_public_key(suite, data);
   auto [enc, ctx] = suite.hpke().setup_base_s(*pkR, info);
   auto ct = ctx.seal(aad, pt);
   return HPKECiphertext{ enc, ct };
 }
 
+std::vector<HPKECiphertext>
+HPKEPublicKey::encrypt_batch(CipherSuite suite,
+                             const std::vector<const HPKEPublicKey*>& pubs,
+                             const bytes& info,
+                             const bytes& aad,
+                             const std::vector<bytes>& pts,
+                             const Executor& executor)
+{
+  if (pubs.size() != pts.size()) {
+    throw InvalidParameterError("Wrong number of plaintexts");
+  }
+
+  // Each task writes only its own entry
+  auto out = std::vector<HPKECiphertext>(pubs.size());
+  if (!hpke::AsyncBatch::offload_available()) {
+    execute(executor, pubs.size(), [&](size_t i) {
+      out[i] = pubs[i]->encrypt(suite, info, aad, pts[i]);
+    });
+    return out;
+  }
+
+  // The parsed keys are held until the batch is done
+  auto parsed = std::vector<std::shared_ptr<const KEM::PublicKey>>{};
+  auto pkRs = std::vector<const KEM::PublicKey*>{};
+  parsed.reserve(pubs.size());
+  pkRs.reserve(pubs.size());
+  for (const auto* pub : pubs) {
+    parsed.push_back(parsed_hpke_public_key(suite, pub->data));
+    pkRs.push_back(parsed.back().get());
+  }
+
+  auto senders = suite.hpke().setup_base_s(pkRs, info);
+  for (size_t i = 0; i < senders.size(); i++) {
+    auto& [enc, ctx] = senders[i];
+    out[i] = HPKECiphertext{ std::move(enc), ctx.seal(aad, pts[i]) };
+  }
+
+  return out;
+}
+
 std::tuple<bytes, bytes>
 HPKEPublicKey::do_export(CipherSuite suite,
                          const bytes& info,
@@ -238,7 +480,7 @@ HPKEPublicKey::do_export(CipherSuite suite,
                          size_t size) const
 {
   auto label_data = from_ascii(label);
-  auto pkR = suite.hpke().kem.deserialize(data);
+  auto pkR = parsed_hpke_public_key(suite, data);
   auto [enc, ctx] = suite.hpke().setup_base_s(*pkR, info);
   auto exported = ctx.do_export(label_data, size);
   return std::make_tuple(enc, exported);
@@ -251,7 +493,7 @@ HPKEPrivateKey::generate(CipherSuite suite)
   auto priv_data = suite.hpke().kem.serialize_private(*priv);
   auto pub = priv->public_key();
   auto pub_data = suite.hpke().kem.serialize(*pub);
-  return { priv_data, pub_data };
+  return { suite, priv_data, pub_data, std::move(priv) };
 }
 
 HPKEPrivateKey
@@ -260,7 +502,7 @@ HPKEPrivateKey::parse(CipherSuite suite, const bytes& data)
   auto priv = suite.hpke().kem.deserialize_private(data);
   auto pub = priv->public_key();
   auto pub_data = suite.hpke().kem.serialize(*pub);
-  return { data, pub_data };
+  return { suite, data, pub_data, std::move(priv) };
 }
 
 HPKEPrivateKey
@@ -270,7 +512,7 @@ HPKEPrivateKey::derive(CipherSuite suite, const bytes& secret)
   auto priv_data = suite.hpke().kem.serialize_private(*priv);
   auto pub = priv->public_key();
   auto pub_data = suite.hpke().kem.serialize(*pub);
-  return { priv_data, pub_data };
+  return { suite, priv_data, pub_data, std::move(priv) };
 }
 
 bytes
@@ -279,7 +521,7 @@ HPKEPrivateKey::decrypt(CipherSuite suite,
                         const bytes& aad,
                         const HPKECiphertext& ct) const
 {
-  auto skR = suite.hpke().kem.deserialize_private(data);
+  auto skR = parsed_key(suite);
   auto ctx = suite.hpke().setup_base_r(ct.kem_output, *skR, info);
   auto pt = ctx.open(aad, ct.ciphertext);
   if (!pt) {
@@ -297,15 +539,27 @@ HPKEPrivateKey::do_export(CipherSuite suite,
                           size_t size) const
 {
   auto label_data = from_ascii(label);
-  auto skR = suite.hpke().kem.deserialize_private(data);
+  auto skR = parsed_key(suite);
   auto ctx = suite.hpke().setup_base_r(kem_output, *skR, info);
   return ctx.do_export(label_data, size);
 }
 
-HPKEPrivateKey::HPKEPrivateKey(bytes priv_data, bytes pub_data)
+HPKEPrivateKey::HPKEPrivateKey(CipherSuite suite,
+                               bytes priv_data,
+                               bytes pub_data,
+                               std::unique_ptr<KEM::PrivateKey> priv)
   : data(std::move(priv_data))
   , public_key{ std::move(pub_data) }
 {
+  parsed.set(suite.cipher_suite(), data, std::move(priv));
+}
+
+std::shared_ptr<const KEM::PrivateKey>
+HPKEPrivateKey::parsed_key(CipherSuite suite) const
+{
+  return parsed.get(suite.cipher_suite(), data, [&](const auto& priv) {
+    return suite.hpke().kem.deserialize_private(priv);
+  });
 }
 
 ///
@@ -337,8 +591,89 @@ SignaturePublicKey::verify(const CipherSuite& suite,
                            const bytes& signature) const
 {
   const auto content = tls::marshal(SignContent{ label, message });
-  auto pub = suite.sig().deserialize(data);
-  return suite.sig().verify(content, signature, *pub);
+  const auto digest =
+    verified_signature_digest(suite, data, content, signature);
+  auto& cache = verified_signatures();
+  if (cache.contains(digest)) {
+    log::Metrics::count(log::Counter::signatures_cached, 1);
+    return true;
+  }
+
+  auto pub = parsed_signature_public_key(suite, data);
+  if (!suite.sig().verify(content, signature, *pub)) {
+    return false;
+  }
+
+  cache.insert(digest);
+  return true;
+}
+
+bool
+SignaturePublicKey::verify_batch(
+  const CipherSuite& suite,
+  const std::vector<SignatureVerification>& batch,
+  const Executor& executor)
+{
+  // Signatures that have verified before are skipped
+  auto& cache = verified_signatures();
+  auto contents = std::vector<bytes>{};
+  auto digests = std::vector<bytes>{};
+  auto pending = std::vector<size_t>{};
+  contents.reserve(batch.size());
+  digests.reserve(batch.size());
+  for (size_t i = 0; i < batch.size(); i++) {
+    const auto& v = batch[i];
+    contents.push_back(tls::marshal(SignContent{ v.label, v.message }));
+    digests.push_back(verified_signature_digest(
+      suite, v.key.data, contents.back(), v.signature));
+    if (!cache.contains(digests.back())) {
+      pending.push_back(i);
+    }
+  }
+
+  const auto cached = batch.size() - pending.size();
+  if (cached > 0) {
+    log::Metrics::count(log::Counter::signatures_cached, cached);
+  }
+
+  if (pending.empty()) {
+    return true;
+  }
+
+  // Without an executor there is no use for chunks, so the whole batch is
+  // verified at once
+  static constexpr size_t chunk_size = 16;
+  const auto chunk_count =
+    executor ? (pending.size() + chunk_size - 1) / chunk_size : size_t(1);
+  const auto per_chunk = executor ? chunk_size : pending.size();
+
+  auto valid = std::vector<uint8_t>(chunk_count, 0);
+  execute(executor, chunk_count, [&](size_t c) {
+    const auto start = c * per_chunk;
+    const auto end = std::min(start + per_chunk, pending.size());
+
+    auto keys = std::vector<std::shared_ptr<const Signature::PublicKey>>{};
+    auto items = std::vector<Signature::VerifyItem>{};
+    keys.reserve(end - start);
+    items.reserve(end - start);
+    for (auto j = start; j < end; j++) {
+      const auto i = pending[j];
+      const auto& v = batch[i];
+      keys.push_back(parsed_signature_public_key(suite, v.key.data));
+      items.push_back({ contents[i], v.signature, *keys.back() });
+    }
+
+    if (!suite.sig().verify_batch(items)) {
+      return;
+    }
+
+    valid[c] = 1;
+    for (auto j = start; j < end; j++) {
+      cache.insert(digests[pending[j]]);
+    }
+  });
+
+  return stdx::all_of(valid, [](auto v) { return v != 0; });
 }
 
 SignaturePrivateKey
@@ -348,7 +683,7 @@ SignaturePrivateKey::generate(CipherSuite suite)
   auto priv_data = suite.sig().serialize_private(*priv);
   auto pub = priv->public_key();
   auto pub_data = suite.sig().serialize(*pub);
-  return { priv_data, pub_data };
+  return { suite, priv_data, pub_data, std::move(priv) };
 }
 
 SignaturePrivateKey
@@ -357,7 +692,7 @@ SignaturePrivateKey::parse(CipherSuite suite, const bytes& data)
   auto priv = suite.sig().deserialize_private(data);
   auto pub = priv->public_key();
   auto pub_data = suite.sig().serialize(*pub);
-  return { data, pub_data };
+  return { suite, data, pub_data, std::move(priv) };
 }
 
 SignaturePrivateKey
@@ -367,7 +702,7 @@ SignaturePrivateKey::derive(CipherSuite suite, const bytes& secret)
   auto priv_data = suite.sig().serialize_private(*priv);
   auto pub = priv->public_key();
   auto pub_data = suite.sig().serialize(*pub);
-  return { priv_data, pub_data };
+  return { suite, priv_data, pub_data, std::move(priv) };
 }
 
 bytes
@@ -376,14 +711,27 @@ SignaturePrivateKey::sign(const CipherSuite& suite,
                           const bytes& message) const
 {
   const auto content = tls::marshal(SignContent{ label, message });
-  const auto priv = suite.sig().deserialize_private(data);
+  const auto priv = parsed_key(suite);
   return suite.sig().sign(content, *priv);
 }
 
-SignaturePrivateKey::SignaturePrivateKey(bytes priv_data, bytes pub_data)
+SignaturePrivateKey::SignaturePrivateKey(
+  CipherSuite suite,
+  bytes priv_data,
+  bytes pub_data,
+  std::unique_ptr<Signature::PrivateKey> priv)
   : data(std::move(priv_data))
   , public_key{ std::move(pub_data) }
 {
+  parsed.set(suite.cipher_suite(), data, std::move(priv));
+}
+
+std::shared_ptr<const Signature::PrivateKey>
+SignaturePrivateKey::parsed_key(const CipherSuite& suite) const
+{
+  return parsed.get(suite.cipher_suite(), data, [&](const auto& priv) {
+    return suite.sig().deserialize_private(priv);
+  });
 }
 
 } // namespace mls
@@ -0,0 +1,171 @@
+#include <mls/group_manager.h>
+
+namespace mls {
+
+GroupManager::Group::Group(Session session_in)
+  : session(std::move(session_in))
+{
+}
+
+GroupManager::GroupManager()
+  : GroupManager(Options{})
+{
+}
+
+GroupManager::GroupManager(const Options& opts)
+  : shards(opts.shards)
+  , retained_epochs(opts.retained_epochs)
+{
+  if (opts.shards == 0) {
+    throw InvalidParameterError("GroupManager needs at least one shard");
+  }
+
+  if (opts.retained_epochs == 0) {
+    throw InvalidParameterError("At least one epoch must be retained");
+  }
+}
+
+void
+GroupManager::add(const bytes& group_id, Session session)
+{
+  session.retain_epochs(retained_epochs);
+  auto group = std::make_shared<Group>(std::move(session));
+
+  auto& shard = shard_for(group_id);
+  const auto lock = std::unique_lock(shard.mutex);
+  const auto [it, inserted] = shard.groups.emplace(group_id, std::move(group));
+  silence_unused(it);
+  if (!inserted) {
+    throw InvalidParameterError("Group is already managed");
+  }
+}
+
+bool
+GroupManager::remove(const bytes& group_id)
+{
+  auto& shard = shard_for(group_id);
+  const auto lock = std::unique_lock(shard.mutex);
+  return shard.groups.erase(group_id) > 0;
+}
+
+bool
+GroupManager::contains(const bytes& group_id) const
+{
+  const auto& shard = shard_for(group_id);
+  const auto lock = std::shared_lock(shard.mutex);
+  return shard.groups.count(group_id) > 0;
+}
+
+size_t
+GroupManager::size() const
+{
+  auto count = size_t(0);
+  for (const auto& shard : shards) {
+    const auto lock = std::shared_lock(shard.mutex);
+    count += shard.groups.size();
+  }
+
+  return count;
+}
+
+GroupMemoryUsage
+GroupManager::memory_usage() const
+{
+  auto usage = GroupMemoryUsage{};
+  for (const auto& shard : shards) {
+    // Release the shard before waiting for any of its groups
+    auto groups = std::vector<std::shared_ptr<Group>>{};
+    {
+      const auto lock = std::shared_lock(shard.mutex);
+      for (const auto& [group_id, group] : shard.groups) {
+        silence_unused(group_id);
+        groups.push_back(group);
+      }
+    }
+
+    for (const auto& group : groups) {
+      const auto lock = std::shared_lock(group->mutex);
+      usage += group->session.memory_usage();
+    }
+  }
+
+  return usage;
+}
+
+GroupMemoryUsage
+GroupManager::memory_usage(const bytes& group_id) const
+{
+  auto group = find(group_id);
+  const auto lock = std::shared_lock(group->mutex);
+  return group->session.memory_usage();
+}
+
+bool
+GroupManager::handle(const bytes& group_id, const bytes& handshake_data)
+{
+  return with_session(group_id, [&](Session& session) {
+    return session.handle(handshake_data);
+  });
+}
+
+bytes
+GroupManager::protect(const bytes& group_id, const bytes& plaintext)
+{
+  return with_session(group_id, [&](Session& session) {
+    return session.protect(plaintext);
+  });
+}
+
+bytes
+GroupManager::unprotect(const bytes& group_id, const bytes& ciphertext)
+{
+  auto group = find(group_id);
+  const auto lock = std::shared_lock(group->mutex);
+  return group->session.unprotect(ciphertext);
+}
+
+std::shared_ptr<const EpochSnapshot>
+GroupManager::snapshot(const bytes& group_id) const
+{
+  return find(group_id)->session.snapshot();
+}
+
+// FNV-1a, which is enough to spread group IDs across shards
+static size_t
+shard_hash(const bytes& group_id)
+{
+  auto hash = uint64_t(0xcbf29ce484222325);
+  for (const auto byte : group_id) {
+    hash ^= byte;
+    hash *= uint64_t(0x100000001b3);
+  }
+
+  return static_cast<size_t>(hash);
+}
+
+GroupManager::Shard&
+GroupManager::shard_for(const bytes& group_id)
+{
+  return shards.at(shard_hash(group_id) % shards.size());
+}
+
+const GroupManager::Shard&
+GroupManager::shard_for(const bytes& group_id) const
+{
+  return shards.at(shard_hash(group_id) % shards.size());
+}
+
+std::shared_ptr<GroupManager::Group>
+GroupManager::find(const bytes& group_id) const
+{
+  const auto& shard = shard_for(group_id);
+  const auto lock = std::shared_lock(shard.mutex);
+  const auto it = shard.groups.find(group_id);
+  if (it == shard.groups.end()) {
+    throw InvalidParameterError("Unknown group");
+  }
+
+  return it->second;
+}
+
+} // namespace mls
@@ -1,7 +1,13 @@
 #include <mls/key_schedule.h>
 #include <mls/log.h>
 
+#include <algorithm>
+
+using mls::log::Counter;
+using mls::log::Histogram;
+using mls::log::Level;
 using mls::log::Log;
+using mls::log::Metrics;
 static const auto log_mod = "key_schedule"s;
 
 namespace mls {
@@ -21,7 +27,7 @@ struct TreeContext
 static bytes
 derive_tree_secret(CipherSuite suite,
                    const bytes& secret,
-                   const std::string& label,
+                   const KDFLabel& label,
                    NodeIndex node,
                    uint32_t generation,
                    size_t length)
@@ -29,12 +35,32 @@ derive_tree_secret(CipherSuite suite,
   auto ctx = tls::marshal(TreeContext{ node, generation });
   auto derived = suite.expand_with_label(secret, label, ctx, length);
 
-  Log::crypto(log_mod, "=== DeriveTreeSecret ===");
-  Log::crypto(log_mod, "  secret       ", to_hex(secret));
-  Log::crypto(log_mod, "  label        ", label);
-  Log::crypto(log_mod, "  node         ", node.val);
-  Log::crypto(log_mod, "  generation   ", generation);
-  Log::crypto(log_mod, "  tree_context ", to_hex(ctx));
+  MLS_LOG_CRYPTO(log_mod, "=== DeriveTreeSecret ===");
+  MLS_LOG_CRYPTO(log_mod, "  secret       ", to_hex(secret));
+  MLS_LOG_CRYPTO(log_mod, "  label        ", to_hex(label.encoded()));
+  MLS_LOG_CRYPTO(log_mod, "  node         ", node.val);
+  MLS_LOG_CRYPTO(log_mod, "  generation   ", generation);
+  MLS_LOG_CRYPTO(log_mod, "  tree_context ", to_hex(ctx));
+
+  return derived;
+}
+
+// Derive several tree secrets for the same node and generation in one pass
+static std::vector<bytes>
+derive_tree_secrets(CipherSuite suite,
+                    const bytes& secret,
+                    const std::vector<CipherSuite::KDFLabelAndLength>& labels,
+                    NodeIndex node,
+                    uint32_t generation)
+{
+  auto ctx = tls::marshal(TreeContext{ node, generation });
+  auto derived = suite.expand_with_labels(secret, labels, ctx);
+
+  MLS_LOG_CRYPTO(log_mod, "=== DeriveTreeSecrets ===");
+  MLS_LOG_CRYPTO(log_mod, "  secret       ", to_hex(secret));
+  MLS_LOG_CRYPTO(log_mod, "  node         ", node.val);
+  MLS_LOG_CRYPTO(log_mod, "  generation   ", generation);
+  MLS_LOG_CRYPTO(log_mod, "  tree_context ", to_hex(ctx));
 
   return derived;
 }
@@ -46,49 +72,94 @@ derive_tree_secret(CipherSuite suite,
 HashRatchet::HashRatchet(CipherSuite suite_in,
                          NodeIndex node_in,
                          bytes base_secret_in)
+  : HashRatchet(suite_in, node_in, std::move(base_secret_in), {})
+{
+}
+
+HashRatchet::HashRatchet(CipherSuite suite_in,
+                         NodeIndex node_in,
+                         bytes base_secret_in,
+                         const HashRatchetLimits& limits_in)
   : suite(suite_in)
   , node(node_in)
   , next_secret(std::move(base_secret_in))
   , next_generation(0)
-  , key_size(suite.hpke().aead.key_size)
-  , nonce_size(suite.hpke().aead.nonce_size)
+  , limits(limits_in)
+  , key_size(suite.key_size())
+  , nonce_size(suite.nonce_size())
   , secret_size(suite.secret_size())
 {
 }
 
+HashRatchet::Derived
+HashRatchet::derive(const bytes& secret, uint32_t generation) const
+{
+  const auto& labels = KDFLabels::get();
+  auto derived = derive_tree_secrets(suite,
+                                     secret,
+                                     { { &labels.key, key_size },
+                                       { &labels.nonce, nonce_size },
+                                       { &labels.secret, secret_size } },
+                                     node,
+                                     generation);
+  Metrics::count(Counter::ratchet_advances, 1);
+
+  return {
+    { std::move(derived.at(0)), std::move(derived.at(1)) },
+    std::move(derived.at(2)),
+  };
+}
+
 std::tuple<uint32_t, KeyAndNonce>
 HashRatchet::next()
 {
-  auto key = derive_tree_secret(
-    suite, next_secret, "key", node, next_generation, key_size);
-  auto nonce = derive_tree_secret(
-    suite, next_secret, "nonce", node, next_generation, nonce_size);
-  auto secret = derive_tree_secret(
-    suite, next_secret, "secret", node, next_generation, secret_size);
+  auto derived = Derived{};
+  if (!ahead.empty()) {
+    derived = std::move(ahead.front());
+    ahead.pop_front();
+  } else {
+    derived = derive(next_secret, next_generation);
+  }
 
   auto generation = next_generation;
-
   next_generation += 1;
-  next_secret = secret;
+  next_secret = std::move(derived.next_secret);
+
+  cache_push(derived.keys);
+  return { generation, std::move(derived.keys) };
+}
 
-  cache[generation] = { key, nonce };
-  return { generation, cache.at(generation) };
+void
+HashRatchet::warm(uint32_t count)
+{
+  count = std::min(count, limits.max_forward_distance);
+  while (ahead.size() < count) {
+    const auto& secret = ahead.empty() ? next_secret : ahead.back().next_secret;
+    const auto generation =
+      next_generation + static_cast<uint32_t>(ahead.size());
+    ahead.push_back(derive(secret, generation));
+  }
 }
 
 // Note: This construction deliberately does not preserve the forward-secrecy
 // invariant, in that keys/nonces are not deleted after they are used.
 // Otherwise, it would not be possible for a node to send to itself.  Keys can
-// be deleted once they are not needed by calling HashRatchet::erase().
+// be deleted once they are not needed by calling HashRatchet::erase(), and
+// only the keys for the last `limits.max_cached_keys` generations are kept.
 KeyAndNonce
 HashRatchet::get(uint32_t generation)
 {
-  if (cache.count(generation) > 0) {
-    auto out = cache.at(generation);
-    return out;
+  if (generation < next_generation) {
+    const auto* slot = cache_slot(generation);
+    if (slot == nullptr || !*slot) {
+      throw ProtocolError("Request for expired key");
+    }
+
+    return opt::get(*slot);
   }
 
-  if (next_generation > generation) {
-    throw ProtocolError("Request for expired key");
+  if (generation - next_generation > limits.max_forward_distance) {
+    throw ProtocolError("Request for key too far in the future");
   }
 
   while (next_generation < generation) {
@@ -103,11 +174,78 @@ HashRatchet::get(uint32_t generation)
 void
 HashRatchet::erase(uint32_t generation)
 {
-  if (cache.count(generation) == 0) {
+  auto* slot = cache_slot(generation);
+  if (slot != nullptr) {
+    slot->reset();
+  }
+}
+
+size_t
+HashRatchet::cached_keys() const
+{
+  return static_cast<size_t>(
+    std::count_if(cache.begin(), cache.end(), [](const auto& slot) {
+      return slot.has_value();
+    }));
+}
+
+std::optional<KeyAndNonce>*
+HashRatchet::cache_slot(uint32_t generation)
+{
+  // The cache holds generations [next_generation - cache.size(),
+  // next_generation)
+  if (generation >= next_generation ||
+      next_generation - generation > cache.size()) {
+    return nullptr;
+  }
+
+  const auto age = next_generation - generation;
+  const auto index = (cache_head + cache.size() - age) % cache.size();
+  return &cache.at(index);
+}
+
+void
+HashRatchet::cache_push(const KeyAndNonce& keys)
+{
+  if (limits.max_cached_keys == 0) {
     return;
   }
 
-  cache.erase(generation);
+  if (cache.size() < limits.max_cached_keys) {
+    cache.emplace_back(keys);
+    return;
+  }
+
+  cache.at(cache_head) = keys;
+  cache_head = (cache_head + 1) % cache.size();
+}
+
+tls::ostream&
+operator<<(tls::ostream& str, const HashRatchet& obj)
+{
+  // The key sizes follow from the cipher suite, so they are not stored
+  return str << obj.suite << obj.node << obj.next_secret << obj.next_generation
+             << obj.limits << obj.cache << uint64_t(obj.cache_head);
+}
+
+tls::istream&
+operator>>(tls::istream& str, HashRatchet& obj)
+{
+  auto cache_head = uint64_t(0);
+  str >> obj.suite >> obj.node >> obj.next_secret >> obj.next_generation >>
+    obj.limits >> obj.cache >> cache_head;
+
+  if (obj.cache.size() > obj.limits.max_cached_keys ||
+      (cache_head > 0 && cache_head >= obj.cache.size())) {
+    throw ProtocolError("Malformed HashRatchet cache");
+  }
+
+  obj.cache_head = static_cast<size_t>(cache_head);
+  obj.ahead.clear();
+  obj.key_size = obj.suite.key_size();
+  obj.nonce_size = obj.suite.nonce_size();
+  obj.secret_size = obj.suite.secret_size();
+  return str;
 }
 
 ///
@@ -130,44 +268,69 @@ SecretTree::get(LeafIndex sender)
 {
   auto node = NodeIndex(sender);
 
-  // Find an ancestor that is populated
-  auto dirpath = node.dirpath(group_size);
-  dirpath.insert(dirpath.begin(), node);
-  dirpath.push_back(root);
-  uint32_t curr = 0;
+  // Find an ancestor that is populated.  The path runs from the leaf up to the
+  // root.
+  const auto dirpath = node.ancestors(group_size);
+  size_t curr = 0;
   for (; curr < dirpath.size(); ++curr) {
-    auto i = dirpath.at(curr);
-    if (secrets.count(i) > 0) {
+    if (secrets.count(dirpath[curr]) > 0) {
       break;
     }
   }
 
-  if (curr > dirpath.size()) {
+  if (curr == dirpath.size()) {
     throw InvalidParameterError("No secret found to derive base key");
   }
 
-  // Derive down
+  // Derive down, deleting each parent secret as soon as both of its children
+  // have been derived
+  const auto& label = KDFLabels::get().tree;
   for (; curr > 0; --curr) {
-    auto curr_node = dirpath.at(curr);
+    auto curr_node = dirpath[curr];
     auto left = curr_node.left();
     auto right = curr_node.right();
 
-    auto& secret = secrets.at(curr_node);
+    const auto secret = std::move(secrets.at(curr_node));
+    secrets.erase(curr_node);
     secrets.insert_or_assign(
-      left, derive_tree_secret(suite, secret, "tree", left, 0, secret_size));
+      left, derive_tree_secret(suite, secret, label, left, 0, secret_size));
     secrets.insert_or_assign(
-      right, derive_tree_secret(suite, secret, "tree", right, 0, secret_size));
+      right, derive_tree_secret(suite, secret, label, right, 0, secret_size));
   }
 
-  // Copy the leaf
-  auto out = secrets.at(node);
+  // Hand out the leaf secret, retaining no copy
+  auto out = std::move(secrets.at(node));
+  secrets.erase(node);
+  return out;
+}
 
-  // Zeroize along the direct path
-  for (auto i : dirpath) {
-    secrets.erase(i);
+bool
+SecretTree::has_leaf_secret(LeafIndex sender) const
+{
+  if (!(sender < group_size)) {
+    return false;
   }
 
-  return out;
+  const auto dirpath = NodeIndex(sender).ancestors(group_size);
+  return std::any_of(dirpath.begin(), dirpath.end(), [&](const auto& node) {
+    return secrets.count(node) > 0;
+  });
+}
+
+tls::ostream&
+operator<<(tls::ostream& str, const SecretTree& obj)
+{
+  return str << obj.suite << obj.group_size << obj.secrets;
+}
+
+tls::istream&
+operator>>(tls::istream& str, SecretTree& obj)
+{
+  str >> obj.suite >> obj.group_size >> obj.secrets;
+
+  obj.root = NodeIndex::root(obj.group_size);
+  obj.secret_size = obj.suite.secret_size();
+  return str;
 }
 
 ///
@@ -195,6 +358,12 @@ apply_reuse_guard(const ReuseGuard& guard, bytes& nonce)
 /// GroupKeySource
 ///
 
+const std::array<GroupKeySource::RatchetType, 2>
+  GroupKeySource::all_ratchet_types = {
+    GroupKeySource::RatchetType::handshake,
+    GroupKeySource::RatchetType::application,
+  };
+
 GroupKeySource::GroupKeySource(CipherSuite suite_in,
                                LeafCount group_size,
                                bytes encryption_secret)
@@ -203,51 +372,259 @@ GroupKeySource::GroupKeySource(CipherSuite suite_in,
 {
 }
 
+GroupKeySource::SenderChains::SenderChains(HashRatchet handshake_in,
+                                           HashRatchet application_in)
+  : handshake(std::move(handshake_in))
+  , application(std::move(application_in))
+{
+}
+
 HashRatchet&
-GroupKeySource::chain(ContentType type, LeafIndex sender)
+GroupKeySource::SenderChains::chain(RatchetType type)
+{
+  switch (type) {
+    case RatchetType::handshake:
+      return handshake;
+
+    case RatchetType::application:
+      return application;
+
+    default:
+      throw InvalidParameterError("Invalid ratchet type");
+  }
+}
+
+GroupKeySource::SharedChains::SharedChains(std::shared_ptr<SenderChains> ptr_in)
+  : ptr(std::move(ptr_in))
+{
+}
+
+GroupKeySource::SharedChains::SharedChains(const SharedChains& other)
+{
+  const auto lock = std::lock_guard(other.ptr->mutex);
+  ptr = std::make_shared<SenderChains>(other.ptr->handshake,
+                                       other.ptr->application);
+}
+
+GroupKeySource::SharedChains&
+GroupKeySource::SharedChains::operator=(const SharedChains& other)
+{
+  if (this != &other) {
+    *this = SharedChains(other);
+  }
+  return *this;
+}
+
+GroupKeySource::RatchetType
+GroupKeySource::ratchet_type(ContentType type)
 {
   switch (type) {
     case ContentType::proposal:
     case ContentType::commit:
-      return chain(RatchetType::handshake, sender);
+      return RatchetType::handshake;
 
     case ContentType::application:
-      return chain(RatchetType::application, sender);
+      return RatchetType::application;
 
     default:
       throw InvalidParameterError("Invalid content type");
   }
 }
 
-HashRatchet&
-GroupKeySource::chain(RatchetType type, LeafIndex sender)
+std::shared_ptr<GroupKeySource::SenderChains>
+GroupKeySource::sender_chains(LeafIndex sender)
 {
-  auto key = Key{ type, sender };
-  if (chains.count(key) > 0) {
-    return chains[key];
+  const auto lock = std::lock_guard(senders_mutex.mutex);
+  if (auto it = chains.find(sender); it != chains.end()) {
+    auto ptr = it->second.ptr;
+    touch(sender, false);
+    return ptr;
+  }
+
+  // A sender in the group whose secret is gone must have been evicted, since
+  // it would otherwise still have its ratchets
+  if (!secret_tree.has_leaf_secret(sender) && sender < secret_tree.size()) {
+    throw EvictedKeyError("Keys for sender have been evicted");
   }
 
   auto sender_node = NodeIndex{ sender };
   auto secret_size = suite.secret_size();
   auto leaf_secret = secret_tree.get(sender);
 
+  const auto& labels = KDFLabels::get();
   auto handshake_secret = derive_tree_secret(
-    suite, leaf_secret, "handshake", sender_node, 0, secret_size);
-  chains.emplace(Key{ RatchetType::handshake, sender },
-                 HashRatchet{ suite, sender_node, handshake_secret });
-
+    suite, leaf_secret, labels.handshake, sender_node, 0, secret_size);
   auto application_secret = derive_tree_secret(
-    suite, leaf_secret, "application", sender_node, 0, secret_size);
-  chains.emplace(Key{ RatchetType::application, sender },
-                 HashRatchet{ suite, sender_node, application_secret });
+    suite, leaf_secret, labels.application, sender_node, 0, secret_size);
+
+  auto ptr = std::make_shared<SenderChains>(
+    HashRatchet{
+      suite, sender_node, handshake_secret, retention.ratchet_limits },
+    HashRatchet{
+      suite, sender_node, application_secret, retention.ratchet_limits });
+  chains.emplace(sender, SharedChains(ptr));
+
+  touch(sender, true);
+  return ptr;
+}
+
+void
+GroupKeySource::touch(LeafIndex sender, bool created)
+{
+  auto& use = sender_use[sender];
+  lru.erase(use.seq);
+
+  use_seq += 1;
+  use.seq = use_seq;
+  lru.emplace(use.seq, sender);
+
+  // Senders are only added here, so the count limit needs checking only then,
+  // and the clock is read only every so often
+  const auto check_clock =
+    created || (use_seq % KeyRetentionPolicy::clock_period) == 0;
+  if (check_clock) {
+    last_clock = seconds_since_epoch();
+  }
+
+  use.time = last_clock;
 
-  return chains[key];
+  // The sender just used is the most recent, so it is never evicted here
+  if (check_clock) {
+    evict_locked(last_clock);
+  }
+}
+
+void
+GroupKeySource::evict_sender(LeafIndex sender)
+{
+  chains.erase(sender);
+  lru.erase(sender_use.at(sender).seq);
+  sender_use.erase(sender);
+}
+
+void
+GroupKeySource::set_retention_policy(const KeyRetentionPolicy& policy)
+{
+  const auto lock = std::lock_guard(senders_mutex.mutex);
+  retention = policy;
+  last_clock = seconds_since_epoch();
+  evict_locked(last_clock);
+}
+
+const KeyRetentionPolicy&
+GroupKeySource::retention_policy() const
+{
+  return retention;
+}
+
+void
+GroupKeySource::evict(uint64_t now)
+{
+  const auto lock = std::lock_guard(senders_mutex.mutex);
+  evict_locked(now);
+}
+
+void
+GroupKeySource::set_own_index(LeafIndex index)
+{
+  const auto lock = std::lock_guard(senders_mutex.mutex);
+  own_index = index;
+}
+
+void
+GroupKeySource::evict_locked(uint64_t now)
+{
+  // Senders are visited from least to most recently used, passing over our
+  // own, which neither counts towards the limit nor is evicted
+  const auto pinned = own_index && sender_use.count(opt::get(own_index)) > 0;
+  const auto counted = [&] { return lru.size() - (pinned ? 1 : 0); };
+  const auto too_many = [&] {
+    return retention.max_senders > 0 && counted() > retention.max_senders;
+  };
+  const auto idle = [&](LeafIndex sender) {
+    const auto last_used = sender_use.at(sender).time;
+    return retention.max_idle_seconds > 0 && now >= last_used &&
+           now - last_used > retention.max_idle_seconds;
+  };
+
+  auto it = lru.begin();
+  while (it != lru.end()) {
+    const auto sender = it->second;
+    if (!too_many() && !idle(sender)) {
+      break;
+    }
+
+    it = std::next(it);
+    if (own_index != sender) {
+      evict_sender(sender);
+    }
+  }
+}
+
+GroupKeySource::MemoryUsage
+GroupKeySource::memory_usage() const
+{
+  const auto lock = std::lock_guard(senders_mutex.mutex);
+
+  auto usage = MemoryUsage{};
+  usage.secret_tree_nodes = secret_tree.node_count();
+  usage.senders = sender_use.size();
+  if (usage.secret_tree_nodes > 0) {
+    usage.secret_bytes = usage.secret_tree_nodes * suite.secret_size();
+  }
+
+  for (const auto& entry : chains) {
+    auto& sender_chains = *entry.second.ptr;
+    const auto chains_lock = std::lock_guard(sender_chains.mutex);
+    auto sender_keys = size_t(0);
+    for (const auto type : all_ratchet_types) {
+      const auto& ratchet = sender_chains.chain(type);
+      const auto key_nonce_size = ratchet.key_size + ratchet.nonce_size;
+      const auto cached = ratchet.cached_keys();
+      const auto ahead = ratchet.derived_ahead();
+      usage.cached_keys += cached;
+      usage.derived_keys += ahead;
+      usage.secret_bytes += ratchet.next_secret.size();
+      usage.secret_bytes += cached * key_nonce_size;
+      usage.secret_bytes += ahead * (key_nonce_size + ratchet.secret_size);
+      sender_keys += cached + ahead;
+    }
+
+    usage.max_sender_keys = std::max(usage.max_sender_keys, sender_keys);
+  }
+
+  return usage;
+}
+
+void
+GroupKeySource::warm(const std::vector<LeafIndex>& senders,
+                     uint32_t generations,
+                     const Executor& executor)
+{
+  execute(executor, senders.size(), [&](size_t i) {
+    auto sender_chains = this->sender_chains(senders.at(i));
+    const auto lock = std::lock_guard(sender_chains->mutex);
+    sender_chains->application.warm(generations);
+  });
+}
+
+static void
+record_cached_keys(const HashRatchet& ratchet)
+{
+  if (Metrics::enabled()) {
+    Metrics::record(Histogram::ratchet_cached_keys, ratchet.cached_keys());
+  }
 }
 
 std::tuple<uint32_t, ReuseGuard, KeyAndNonce>
 GroupKeySource::next(ContentType type, LeafIndex sender)
 {
-  auto [generation, keys] = chain(type, sender).next();
+  auto sender_chains = this->sender_chains(sender);
+  const auto lock = std::lock_guard(sender_chains->mutex);
+
+  auto& ratchet = sender_chains->chain(ratchet_type(type));
+  auto [generation, keys] = ratchet.next();
+  record_cached_keys(ratchet);
 
   auto reuse_guard = new_reuse_guard();
   apply_reuse_guard(reuse_guard, keys.nonce);
@@ -261,15 +638,134 @@ GroupKeySource::get(ContentType type,
                     uint32_t generation,
                     ReuseGuard reuse_guard)
 {
-  auto keys = chain(type, sender).get(generation);
+  auto sender_chains = this->sender_chains(sender);
+  const auto lock = std::lock_guard(sender_chains->mutex);
+
+  auto& ratchet = sender_chains->chain(ratchet_type(type));
+  auto keys = ratchet.get(generation);
+  record_cached_keys(ratchet);
+
   apply_reuse_guard(reuse_guard, keys.nonce);
   return keys;
 }
 
+std::shared_ptr<GroupKeySource::SenderChains>
+GroupKeySource::existing_chains(LeafIndex sender)
+{
+  const auto lock = std::lock_guard(senders_mutex.mutex);
+  const auto it = chains.find(sender);
+  return (it == chains.end()) ? nullptr : it->second.ptr;
+}
+
 void
 GroupKeySource::erase(ContentType type, LeafIndex sender, uint32_t generation)
 {
-  return chain(type, sender).erase(generation);
+  // Once a sender's ratchets are evicted, there are no keys left to erase
+  auto sender_chains = existing_chains(sender);
+  if (!sender_chains) {
+    return;
+  }
+
+  const auto lock = std::lock_guard(sender_chains->mutex);
+  sender_chains->chain(ratchet_type(type)).erase(generation);
+}
+
+GroupKeySource::AEADContext&
+GroupKeySource::AEADContext::operator=(const AEADContext& other)
+{
+  if (this != &other) {
+    ctx.reset();
+  }
+  return *this;
+}
+
+GroupKeySource::KeyedUse::KeyedUse(hpke::AEAD::KeyedContext& ctx_in)
+  : ctx(ctx_in)
+{
+}
+
+GroupKeySource::KeyedUse::~KeyedUse()
+{
+  ctx.clear_key();
+}
+
+GroupKeySource::KeyedUse
+GroupKeySource::aead(const bytes& key)
+{
+  if (!aead_ctx.ctx) {
+    aead_ctx.ctx = suite.hpke().aead.keyed(key);
+  } else {
+    aead_ctx.ctx->set_key(key);
+  }
+
+  return KeyedUse(*aead_ctx.ctx);
+}
+
+bytes
+GroupKeySource::seal(const KeyAndNonce& keys, bytes_view aad, bytes_view pt)
+{
+  auto lock = std::unique_lock(aead_mutex.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return suite.hpke().aead.seal(keys.key, keys.nonce, aad, pt);
+  }
+
+  return aead(keys.key)->seal(keys.nonce, aad, pt);
+}
+
+void
+GroupKeySource::seal_into(const KeyAndNonce& keys,
+                          bytes_view aad,
+                          const std::vector<bytes_view>& pt,
+                          bytes& out)
+{
+  auto lock = std::unique_lock(aead_mutex.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    suite.hpke().aead.keyed(keys.key)->seal_into(keys.nonce, aad, pt, out);
+    return;
+  }
+
+  aead(keys.key)->seal_into(keys.nonce, aad, pt, out);
+}
+
+void
+GroupKeySource::seal_to(const KeyAndNonce& keys,
+                        bytes_view aad,
+                        bytes_view pt,
+                        uint8_t* ct_out)
+{
+  auto lock = std::unique_lock(aead_mutex.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    suite.hpke().aead.keyed(keys.key)->seal_to(keys.nonce, aad, pt, ct_out);
+    return;
+  }
+
+  aead(keys.key)->seal_to(keys.nonce, aad, pt, ct_out);
+}
+
+std::optional<bytes>
+GroupKeySource::open(const KeyAndNonce& keys, bytes_view aad, bytes_view ct)
+{
+  auto lock = std::unique_lock(aead_mutex.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return suite.hpke().aead.open(keys.key, keys.nonce, aad, ct);
+  }
+
+  return aead(keys.key)->open(keys.nonce, aad, ct);
+}
+
+bool
+GroupKeySource::open_to(const KeyAndNonce& keys,
+                        bytes_view aad,
+                        bytes_view ct,
+                        uint8_t* pt_out)
+{
+  auto lock = std::unique_lock(aead_mutex.mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    return suite.hpke().aead.keyed(keys.key)->open_to(
+      keys.nonce, aad, ct, pt_out);
+  }
+
+  return aead(keys.key)->open_to(keys.nonce, aad, ct, pt_out);
 }
 
 // struct {
@@ -288,6 +784,83 @@ struct MLSCiphertextContentAAD
   TLS_SERIALIZABLE(group_id, epoch, content_type, authenticated_data)
 };
 
+// Ratchets are serialized like a std::map<ChainKey, HashRatchet>, with all of
+// the handshake ratchets before all of the application ratchets
+using ChainKey = std::tuple<GroupKeySource::RatchetType, LeafIndex>;
+
+tls::ostream&
+operator<<(tls::ostream& str, const GroupKeySource& obj)
+{
+  const auto lock = std::lock_guard(obj.senders_mutex.mutex);
+
+  auto locks = std::vector<std::unique_lock<std::mutex>>{};
+  for (const auto& entry : obj.chains) {
+    locks.emplace_back(entry.second.ptr->mutex);
+  }
+
+  auto chains = std::vector<std::tuple<ChainKey, const HashRatchet&>>{};
+  for (const auto type : GroupKeySource::all_ratchet_types) {
+    for (const auto& [sender, sender_chains] : obj.chains) {
+      chains.emplace_back(ChainKey{ type, sender },
+                          sender_chains.ptr->chain(type));
+    }
+  }
+
+  // The LRU order is rebuilt from the senders' sequence numbers
+  const auto& retention = obj.retention;
+  return str << obj.suite << obj.secret_tree << chains
+             << uint64_t(retention.max_senders) << retention.max_idle_seconds
+             << retention.ratchet_limits << obj.use_seq << obj.sender_use;
+}
+
+tls::istream&
+operator>>(tls::istream& str, GroupKeySource& obj)
+{
+  auto max_senders = uint64_t(0);
+  auto chains = std::map<ChainKey, HashRatchet>{};
+  auto& retention = obj.retention;
+  str >> obj.suite >> obj.secret_tree >> chains >> max_senders >>
+    retention.max_idle_seconds >> retention.ratchet_limits >> obj.use_seq >>
+    obj.sender_use;
+
+  retention.max_senders = static_cast<size_t>(max_senders);
+
+  // Ratchets are created and evicted in pairs, so each sender must have both
+  using RatchetType = GroupKeySource::RatchetType;
+  obj.chains.clear();
+  for (auto& [key, handshake] : chains) {
+    const auto [type, sender] = key;
+    if (type != RatchetType::handshake) {
+      continue;
+    }
+
+    auto application = chains.find({ RatchetType::application, sender });
+    if (application == chains.end()) {
+      throw ProtocolError("Malformed GroupKeySource ratchets");
+    }
+
+    obj.chains.emplace(sender,
+                       std::make_shared<GroupKeySource::SenderChains>(
+                         std::move(handshake), std::move(application->second)));
+  }
+
+  if (2 * obj.chains.size() != chains.size()) {
+    throw ProtocolError("Malformed GroupKeySource ratchets");
+  }
+
+  obj.lru.clear();
+  for (const auto& [sender, use] : obj.sender_use) {
+    obj.lru.emplace(use.seq, sender);
+  }
+
+  if (obj.lru.size() != obj.sender_use.size()) {
+    throw ProtocolError("Malformed GroupKeySource sender state");
+  }
+
+  obj.aead_ctx = {};
+  return str;
+}
+
 ///
 /// KeyScheduleEpoch
 ///
@@ -310,8 +883,10 @@ make_psk_secret(CipherSuite suite, const std::vector<PSKWithSecret>& psks)
   for (const auto& psk : psks) {
     auto psk_extracted = suite.hpke().kdf.extract(suite.zero(), psk.secret);
     auto psk_label = tls::marshal(PSKLabel{ psk.id, index, count });
-    auto psk_input = suite.expand_with_label(
-      psk_extracted, "derived psk", psk_label, suite.secret_size());
+    auto psk_input = suite.expand_with_label(psk_extracted,
+                                             KDFLabels::get().derived_psk,
+                                             psk_label,
+                                             suite.secret_size());
     psk_secret = suite.hpke().kdf.extract(psk_input, psk_secret);
     index += 1;
   }
@@ -326,7 +901,7 @@ make_joiner_secret(CipherSuite suite,
 {
   auto pre_joiner_secret = suite.hpke().kdf.extract(init_secret, commit_secret);
   return suite.expand_with_label(
-    pre_joiner_secret, "joiner", context, suite.secret_size());
+    pre_joiner_secret, KDFLabels::get().joiner, context, suite.secret_size());
 }
 
 static bytes
@@ -337,7 +912,7 @@ make_epoch_secret(CipherSuite suite,
 {
   auto member_secret = suite.hpke().kdf.extract(joiner_secret, psk_secret);
   return suite.expand_with_label(
-    member_secret, "epoch", context, suite.secret_size());
+    member_secret, KDFLabels::get().epoch, context, suite.secret_size());
 }
 
 KeyScheduleEpoch::KeyScheduleEpoch(CipherSuite suite_in,
@@ -349,17 +924,48 @@ KeyScheduleEpoch::KeyScheduleEpoch(CipherSuite suite_in,
   , psk_secret(make_psk_secret(suite_in, psks))
   , epoch_secret(
       make_epoch_secret(suite_in, joiner_secret, psk_secret, context))
-  , sender_data_secret(suite.derive_secret(epoch_secret, "sender data"))
-  , encryption_secret(suite.derive_secret(epoch_secret, "encryption"))
-  , exporter_secret(suite.derive_secret(epoch_secret, "exporter"))
-  , authentication_secret(suite.derive_secret(epoch_secret, "authentication"))
-  , external_secret(suite.derive_secret(epoch_secret, "external"))
-  , confirmation_key(suite.derive_secret(epoch_secret, "confirm"))
-  , membership_key(suite.derive_secret(epoch_secret, "membership"))
-  , resumption_secret(suite.derive_secret(epoch_secret, "resumption"))
-  , init_secret(suite.derive_secret(epoch_secret, "init"))
-  , external_priv(HPKEPrivateKey::derive(suite, external_secret))
 {
+  // All of the epoch's secrets are derived from the epoch secret, so derive
+  // them together to set up the KDF's key only once
+  const auto& labels = KDFLabels::get();
+  const auto size = suite.secret_size();
+  auto derived = suite.expand_with_labels(epoch_secret,
+                                          {
+                                            { &labels.sender_data, size },
+                                            { &labels.encryption, size },
+                                            { &labels.exporter, size },
+                                            { &labels.authentication, size },
+                                            { &labels.external, size },
+                                            { &labels.confirm, size },
+                                            { &labels.membership, size },
+                                            { &labels.resumption, size },
+                                            { &labels.init, size },
+                                          },
+                                          {});
+
+  sender_data_secret = std::move(derived.at(0));
+  encryption_secret = std::move(derived.at(1));
+  exporter_secret = std::move(derived.at(2));
+  authentication_secret = std::move(derived.at(3));
+  external_secret = std::move(derived.at(4));
+  confirmation_key = std::move(derived.at(5));
+  membership_key = std::move(derived.at(6));
+  resumption_secret = std::move(derived.at(7));
+  init_secret = std::move(derived.at(8));
+}
+
+HPKEPrivateKey
+KeyScheduleEpoch::external_priv() const
+{
+  if (external_secret.empty()) {
+    return {};
+  }
+
+  const auto derive = [&](const bytes& secret) {
+    return std::make_unique<HPKEPrivateKey>(
+      HPKEPrivateKey::derive(suite, secret));
+  };
+  return *_external_priv.get(suite.cipher_suite(), external_secret, derive);
 }
 
 KeyScheduleEpoch::KeyScheduleEpoch(CipherSuite suite_in)
@@ -404,7 +1010,7 @@ bytes
 KeyScheduleEpoch::receive_external_init(const bytes& kem_output) const
 {
   auto size = suite.secret_size();
-  return external_priv.do_export(
+  return external_priv().do_export(
     suite, {}, kem_output, "MLS 1.0 external init secret", size);
 }
 
@@ -438,10 +1044,21 @@ bytes
 KeyScheduleEpoch::do_export(const std::string& label,
                             const bytes& context,
                             size_t size) const
+{
+  return do_export(suite, exporter_secret, label, context, size);
+}
+
+bytes
+KeyScheduleEpoch::do_export(CipherSuite suite,
+                            const bytes& exporter_secret,
+                            const std::string& label,
+                            const bytes& context,
+                            size_t size)
 {
   auto secret = suite.derive_secret(exporter_secret, label);
   auto context_hash = suite.digest().hash(context);
-  return suite.expand_with_label(secret, "exporter", context_hash, size);
+  return suite.expand_with_label(
+    secret, KDFLabels::get().exporter, context_hash, size);
 }
 
 PSKWithSecret
@@ -461,28 +1078,28 @@ KeyScheduleEpoch::welcome_secret(CipherSuite suite,
 {
   auto psk_secret = make_psk_secret(suite, psks);
   auto extract = suite.hpke().kdf.extract(joiner_secret, psk_secret);
-  return suite.derive_secret(extract, "welcome");
+  return suite.derive_secret(extract, KDFLabels::get().welcome);
 }
 
 KeyAndNonce
 KeyScheduleEpoch::sender_data_keys(CipherSuite suite,
                                    const bytes& sender_data_secret,
-                                   const bytes& ciphertext)
+                                   bytes_view ciphertext)
 {
-  auto sample_size = suite.secret_size();
-  auto sample = bytes(sample_size);
-  if (ciphertext.size() <= sample_size) {
-    sample = ciphertext;
-  } else {
-    sample = ciphertext.slice(0, sample_size);
-  }
-
-  auto key_size = suite.hpke().aead.key_size;
-  auto nonce_size = suite.hpke().aead.nonce_size;
-  return {
-    suite.expand_with_label(sender_data_secret, "key", sample, key_size),
-    suite.expand_with_label(sender_data_secret, "nonce", sample, nonce_size),
-  };
+  // This runs for every message, so the suite's sizes are read as constants,
+  // and the key and nonce come from one keyed KDF pass
+  return suite.visit([&](auto traits) {
+    using Traits = decltype(traits);
+    const auto sample_size = std::min(Traits::hash_size, ciphertext.size());
+    const auto sample = bytes(ciphertext.slice(0, sample_size));
+    const auto& labels = KDFLabels::get();
+    auto derived = suite.expand_with_labels(
+      sender_data_secret,
+      { { &labels.key, Traits::key_size },
+        { &labels.nonce, Traits::nonce_size } },
+      sample);
+    return KeyAndNonce{ std::move(derived.at(0)), std::move(derived.at(1)) };
+  });
 }
 
 bool
@@ -494,10 +1111,51 @@ operator==(const KeyScheduleEpoch& lhs, const KeyScheduleEpoch& rhs)
   auto exporter_secret = (lhs.exporter_secret == rhs.exporter_secret);
   auto confirmation_key = (lhs.confirmation_key == rhs.confirmation_key);
   auto init_secret = (lhs.init_secret == rhs.init_secret);
-  auto external_priv = (lhs.external_priv == rhs.external_priv);
+  auto external_secret = (lhs.external_secret == rhs.external_secret);
 
   return epoch_secret && sender_data_secret && encryption_secret &&
-         exporter_secret && confirmation_key && init_secret && external_priv;
+         exporter_secret && confirmation_key && init_secret && external_secret;
+}
+
+tls::ostream&
+operator<<(tls::ostream& str, const KeyScheduleEpoch& obj)
+{
+  // The key pair is written if it has been derived, and left empty otherwise,
+  // so that encoding does not derive it
+  const auto cached =
+    obj._external_priv.find(obj.suite.cipher_suite(), obj.external_secret);
+  const auto external_priv = cached ? *cached : HPKEPrivateKey{};
+
+  return str << obj.suite << obj.joiner_secret << obj.psk_secret
+             << obj.epoch_secret << obj.sender_data_secret
+             << obj.encryption_secret << obj.exporter_secret
+             << obj.authentication_secret << obj.external_secret
+             << obj.confirmation_key << obj.membership_key
+             << obj.resumption_secret << obj.init_secret << external_priv;
+}
+
+tls::istream&
+operator>>(tls::istream& str, KeyScheduleEpoch& obj)
+{
+  auto external_priv = HPKEPrivateKey{};
+  str >> obj.suite >> obj.joiner_secret >> obj.psk_secret >> obj.epoch_secret >>
+    obj.sender_data_secret >> obj.encryption_secret >> obj.exporter_secret >>
+    obj.authentication_secret >> obj.external_secret >> obj.confirmation_key >>
+    obj.membership_key >> obj.resumption_secret >> obj.init_secret >>
+    external_priv;
+
+  // A stored key pair must be the one external_secret derives.  It is kept,
+  // so that it is not derived again on use.
+  if (external_priv.data.empty()) {
+    return str;
+  }
+
+  if (obj.external_secret.empty() ||
+      obj.external_priv() != external_priv) {
+    throw ProtocolError("External key pair does not match external_secret");
+  }
+
+  return str;
 }
 
 // struct {
@@ -548,9 +1206,17 @@ TranscriptHash::update(const MLSAuthenticatedContent& content_auth)
 void
 TranscriptHash::update_confirmed(const MLSAuthenticatedContent& content_auth)
 {
-  const auto transcript =
-    interim + content_auth.confirmed_transcript_hash_input();
-  confirmed = suite.digest().hash(transcript);
+  // Hash the input as it is encoded, instead of building interim || input
+  auto hash = suite.digest().hash_context();
+  hash.update(interim);
+
+  auto str = tls::ostream::streaming([&](const uint8_t* data, size_t size) {
+    hash.update({ data, size });
+  });
+  content_auth.write_confirmed_transcript_hash_input(str);
+  str.flush();
+
+  confirmed = hash.finish();
 }
 
 void
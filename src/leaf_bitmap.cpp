@@ -0,0 +1,109 @@
+#include <mls/leaf_bitmap.h>
+
+#include <stdexcept>
+
+namespace mls {
+
+static constexpr uint64_t all_ones = ~uint64_t(0);
+
+// The index of the lowest zero bit in a word that is not all ones, i.e., the
+// number of trailing zeros in its complement
+static size_t
+lowest_zero(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<size_t>(__builtin_ctzll(~word));
+#else
+  auto index = size_t(0);
+  while (((word >> index) & 1U) == 1) {
+    index += 1;
+  }
+  return index;
+#endif
+}
+
+void
+LeafBitmap::resize(size_t size)
+{
+  const auto word_count = (size + word_bits - 1) / word_bits;
+  _words.resize(word_count, 0);
+  _full.resize((word_count + word_bits - 1) / word_bits, 0);
+  _size = size;
+
+  // Drop any positions past the new end from the last word, and any words
+  // past the new end from the summary
+  const auto tail = size % word_bits;
+  if (tail != 0) {
+    _words.back() &= (uint64_t(1) << tail) - 1;
+  }
+
+  const auto summary_tail = word_count % word_bits;
+  if (summary_tail != 0) {
+    _full.back() &= (uint64_t(1) << summary_tail) - 1;
+  }
+
+  if (word_count > 0) {
+    update_summary(word_count - 1);
+  }
+}
+
+void
+LeafBitmap::reserve(size_t size)
+{
+  const auto word_count = (size + word_bits - 1) / word_bits;
+  _words.reserve(word_count);
+  _full.reserve((word_count + word_bits - 1) / word_bits);
+}
+
+bool
+LeafBitmap::occupied(size_t i) const
+{
+  if (i >= _size) {
+    throw std::out_of_range("LeafBitmap position out of range");
+  }
+
+  return ((_words[i / word_bits] >> (i % word_bits)) & 1U) != 0;
+}
+
+void
+LeafBitmap::set(size_t i, bool occupied)
+{
+  if (i >= _size) {
+    throw std::out_of_range("LeafBitmap position out of range");
+  }
+
+  const auto bit = uint64_t(1) << (i % word_bits);
+  auto& word = _words[i / word_bits];
+  word = occupied ? (word | bit) : (word & ~bit);
+  update_summary(i / word_bits);
+}
+
+size_t
+LeafBitmap::first_free() const
+{
+  for (size_t s = 0; s < _full.size(); s++) {
+    if (_full[s] == all_ones) {
+      continue;
+    }
+
+    const auto word = s * word_bits + lowest_zero(_full[s]);
+    if (word >= _words.size()) {
+      break;
+    }
+
+    const auto position = word * word_bits + lowest_zero(_words[word]);
+    return (position < _size) ? position : _size;
+  }
+
+  return _size;
+}
+
+void
+LeafBitmap::update_summary(size_t word)
+{
+  const auto bit = uint64_t(1) << (word % word_bits);
+  auto& summary = _full[word / word_bits];
+  summary = (_words[word] == all_ones) ? (summary | bit) : (summary & ~bit);
+}
+
+} // namespace mls
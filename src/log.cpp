@@ -16,4 +16,22 @@ Log::remove_sink()
   sink = nullptr;
 }
 
+std::atomic<bool> Metrics::active = false;
+std::shared_ptr<MetricsSink> Metrics::sink = nullptr;
+
+void
+Metrics::set_sink(std::shared_ptr<MetricsSink> sink_in)
+{
+  const auto installed = bool(sink_in);
+  std::atomic_store(&sink, std::move(sink_in));
+  active.store(installed, std::memory_order_release);
+}
+
+void
+Metrics::remove_sink()
+{
+  active.store(false, std::memory_order_release);
+  std::atomic_store(&sink, std::shared_ptr<MetricsSink>());
+}
+
 } // namespace mls::log
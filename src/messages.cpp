@@ -3,18 +3,37 @@
 #include <mls/state.h>
 #include <mls/treekem.h>
 
+#include <algorithm>
+#include <array>
+
 namespace mls {
 
 // Extensions
 
 const Extension::Type ExternalPubExtension::type = ExtensionType::external_pub;
 const Extension::Type RatchetTreeExtension::type = ExtensionType::ratchet_tree;
+const Extension::Type CompressedRatchetTreeExtension::type =
+  ExtensionType::compressed_ratchet_tree;
 const Extension::Type ExternalSendersExtension::type =
   ExtensionType::external_senders;
 const Extension::Type SFrameParameters::type = ExtensionType::sframe_parameters;
 const Extension::Type SFrameCapabilities::type =
   ExtensionType::sframe_parameters;
 
+tls::ostream&
+operator<<(tls::ostream& str, const CompressedRatchetTreeExtension& obj)
+{
+  obj.tree.write_compressed(str);
+  return str;
+}
+
+tls::istream&
+operator>>(tls::istream& str, CompressedRatchetTreeExtension& obj)
+{
+  obj.tree.read_compressed(str);
+  return str;
+}
+
 bool
 SFrameCapabilities::compatible(const SFrameParameters& params) const
 {
@@ -72,12 +91,12 @@ GroupInfo::sign(const TreeKEMPublicKey& tree,
                 LeafIndex signer_index,
                 const SignaturePrivateKey& priv)
 {
-  auto maybe_leaf = tree.leaf_node(signer_index);
-  if (!maybe_leaf) {
+  const auto* leaf = tree.leaf_node_ptr(signer_index);
+  if (leaf == nullptr) {
     throw InvalidParameterError("Cannot sign from a blank leaf");
   }
 
-  if (priv.public_key != opt::get(maybe_leaf).signature_key) {
+  if (priv.public_key != leaf->signature_key) {
     throw InvalidParameterError("Bad key for index");
   }
 
@@ -88,14 +107,19 @@ GroupInfo::sign(const TreeKEMPublicKey& tree,
 bool
 GroupInfo::verify(const TreeKEMPublicKey& tree) const
 {
-  auto maybe_leaf = tree.leaf_node(signer);
-  if (!maybe_leaf) {
+  const auto* leaf = tree.leaf_node_ptr(signer);
+  if (leaf == nullptr) {
     throw InvalidParameterError("Signer not found");
   }
 
-  const auto& leaf = opt::get(maybe_leaf);
-  return leaf.signature_key.verify(
-    tree.suite, sign_label::group_info, to_be_signed(), signature);
+  return verify(tree.suite, *leaf);
+}
+
+bool
+GroupInfo::verify(CipherSuite suite, const LeafNode& signer_leaf) const
+{
+  return signer_leaf.signature_key.verify(
+    suite, sign_label::group_info, to_be_signed(), signature);
 }
 
 // Welcome
@@ -123,7 +147,27 @@ Welcome::Welcome(CipherSuite suite,
 std::optional<int>
 Welcome::find(const KeyPackage& kp) const
 {
-  auto ref = kp.ref();
+  return find(kp.ref());
+}
+
+std::optional<int>
+Welcome::find(const KeyPackageRef& ref) const
+{
+  // Since `secrets` is public, it may have been changed since the index was
+  // built.  A hit in the index is checked against `secrets`, and if the index
+  // does not produce a valid hit, we fall back to a linear scan.
+  const auto it = std::lower_bound(
+    _secrets_index.begin(),
+    _secrets_index.end(),
+    ref,
+    [](const auto& entry, const auto& r) { return std::get<0>(entry) < r; });
+  if (it != _secrets_index.end() && std::get<0>(*it) == ref) {
+    const auto pos = std::get<1>(*it);
+    if (pos < secrets.size() && secrets[pos].new_member == ref) {
+      return static_cast<int>(pos);
+    }
+  }
+
   for (size_t i = 0; i < secrets.size(); i++) {
     if (ref == secrets[i].new_member) {
       return static_cast<int>(i);
@@ -132,17 +176,85 @@ Welcome::find(const KeyPackage& kp) const
   return std::nullopt;
 }
 
+void
+Welcome::index_secrets()
+{
+  _secrets_index.clear();
+  _secrets_index.reserve(secrets.size());
+  for (size_t i = 0; i < secrets.size(); i++) {
+    _secrets_index.emplace_back(secrets[i].new_member, i);
+  }
+
+  // A stable sort keeps the first entry for a duplicated ref first, matching
+  // the linear scan
+  std::stable_sort(_secrets_index.begin(),
+                   _secrets_index.end(),
+                   [](const auto& lhs, const auto& rhs) {
+                     return std::get<0>(lhs) < std::get<0>(rhs);
+                   });
+}
+
 void
 Welcome::encrypt(const KeyPackage& kp, const std::optional<bytes>& path_secret)
+{
+  secrets.push_back(group_secrets_for(kp, path_secret));
+
+  const auto& ref = secrets.back().new_member;
+  const auto it = std::upper_bound(
+    _secrets_index.begin(),
+    _secrets_index.end(),
+    ref,
+    [](const auto& r, const auto& entry) { return r < std::get<0>(entry); });
+  _secrets_index.emplace(it, ref, secrets.size() - 1);
+}
+
+void
+Welcome::encrypt(const std::vector<KeyPackage>& kps,
+                 const std::vector<std::optional<bytes>>& path_secrets,
+                 const Executor& executor)
+{
+  if (kps.size() != path_secrets.size()) {
+    throw InvalidParameterError("Wrong number of path secrets");
+  }
+
+  // The joiners' KeyPackages have been checked to use the group's cipher
+  // suite, so the group secrets can be encrypted to them as one batch
+  auto pubs = std::vector<const HPKEPublicKey*>(kps.size());
+  auto pts = std::vector<bytes>(kps.size());
+  auto refs = std::vector<KeyPackageRef>(kps.size());
+  execute(executor, kps.size(), [&](size_t i) {
+    pubs[i] = &kps[i].init_key;
+    pts[i] = tls::marshal(group_secrets(path_secrets[i]));
+    refs[i] = kps[i].ref();
+  });
+
+  auto cts =
+    HPKEPublicKey::encrypt_batch(cipher_suite, pubs, {}, {}, pts, executor);
+  for (size_t i = 0; i < kps.size(); i++) {
+    secrets.push_back({ refs[i], std::move(cts[i]) });
+  }
+
+  index_secrets();
+}
+
+GroupSecrets
+Welcome::group_secrets(const std::optional<bytes>& path_secret) const
 {
   auto gs = GroupSecrets{ _joiner_secret, std::nullopt, {} };
   if (path_secret) {
     gs.path_secret = { opt::get(path_secret) };
   }
 
-  auto gs_data = tls::marshal(gs);
+  return gs;
+}
+
+EncryptedGroupSecrets
+Welcome::group_secrets_for(const KeyPackage& kp,
+                           const std::optional<bytes>& path_secret) const
+{
+  auto gs_data = tls::marshal(group_secrets(path_secret));
   auto enc_gs = kp.init_key.encrypt(kp.cipher_suite, {}, {}, gs_data);
-  secrets.push_back({ kp.ref(), enc_gs });
+  return { kp.ref(), enc_gs };
 }
 
 GroupInfo
@@ -159,6 +271,36 @@ Welcome::decrypt(const bytes& joiner_secret,
   return tls::get<GroupInfo>(opt::get(group_info_data));
 }
 
+tls::ostream&
+operator<<(tls::ostream& str, const Welcome& obj)
+{
+  return str << obj.version << obj.cipher_suite << obj.secrets
+             << obj.encrypted_group_info;
+}
+
+tls::istream&
+operator>>(tls::istream& str, Welcome& obj)
+{
+  str >> obj.version >> obj.cipher_suite >> obj.secrets >>
+    obj.encrypted_group_info;
+  obj.index_secrets();
+  return str;
+}
+
+bool
+operator==(const Welcome& lhs, const Welcome& rhs)
+{
+  return lhs.version == rhs.version && lhs.cipher_suite == rhs.cipher_suite &&
+         lhs.secrets == rhs.secrets &&
+         lhs.encrypted_group_info == rhs.encrypted_group_info;
+}
+
+bool
+operator!=(const Welcome& lhs, const Welcome& rhs)
+{
+  return !(lhs == rhs);
+}
+
 KeyAndNonce
 Welcome::group_info_key_nonce(CipherSuite suite,
                               const bytes& joiner_secret,
@@ -354,7 +496,10 @@ MLSAuthenticatedContent::sign(WireFormat wire_format,
 
   auto content_auth =
     MLSAuthenticatedContent{ wire_format, std::move(content) };
-  auto tbs = content_auth.to_be_signed(context);
+  const auto prefix = content_auth.tbs_prefix();
+  content_auth._tbs_prefix = prefix;
+
+  const auto tbs = content_auth.to_be_signed(*prefix, context);
   content_auth.auth.signature =
     sig_priv.sign(suite, sign_label::mls_content, tbs);
   return content_auth;
@@ -371,7 +516,7 @@ MLSAuthenticatedContent::verify(
     return false;
   }
 
-  auto tbs = to_be_signed(context);
+  const auto tbs = to_be_signed(*tbs_prefix(), context);
   return sig_pub.verify(suite, sign_label::mls_content, tbs, auth.signature);
 }
 
@@ -394,11 +539,26 @@ struct InterimTranscriptHashInput
 bytes
 MLSAuthenticatedContent::confirmed_transcript_hash_input() const
 {
-  return tls::marshal(ConfirmedTranscriptHashInput{
-    wire_format,
-    content,
-    auth.signature,
-  });
+  auto w = tls::ostream{};
+  write_confirmed_transcript_hash_input(w);
+  return w.bytes();
+}
+
+void
+MLSAuthenticatedContent::write_confirmed_transcript_hash_input(
+  tls::ostream& str) const
+{
+  // The wire format and content are the TBS prefix, less the version
+  if (_tbs_prefix) {
+    const auto& prefix = *_tbs_prefix;
+    const auto version_size = sizeof(ProtocolVersion);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    str.write_raw(prefix.data() + version_size, prefix.size() - version_size);
+    str << auth.signature;
+    return;
+  }
+
+  str << ConfirmedTranscriptHashInput{ wire_format, content, auth.signature };
 }
 
 bytes
@@ -461,17 +621,31 @@ MLSAuthenticatedContent::MLSAuthenticatedContent(WireFormat wire_format_in,
 {
 }
 
-struct MLSContentTBS
+// The start of MLSContentTBS, which does not depend on the group context
+struct MLSContentTBSPrefix
 {
   WireFormat wire_format = WireFormat::reserved;
   const MLSContent& content;
+};
+
+static tls::ostream&
+operator<<(tls::ostream& str, const MLSContentTBSPrefix& obj)
+{
+  return str << ProtocolVersion::mls10 << obj.wire_format << obj.content;
+}
+
+// MLSContentTBS, with the prefix already encoded
+struct MLSContentTBS
+{
+  const bytes& prefix;
+  const MLSContent& content;
   const std::optional<GroupContext>& context;
 };
 
 static tls::ostream&
 operator<<(tls::ostream& str, const MLSContentTBS& obj)
 {
-  str << ProtocolVersion::mls10 << obj.wire_format << obj.content;
+  str.write_raw(obj.prefix);
 
   switch (obj.content.sender.sender_type()) {
     case SenderType::member:
@@ -490,15 +664,23 @@ operator<<(tls::ostream& str, const MLSContentTBS& obj)
   return str;
 }
 
+std::shared_ptr<const bytes>
+MLSAuthenticatedContent::tbs_prefix() const
+{
+  if (_tbs_prefix) {
+    return _tbs_prefix;
+  }
+
+  return std::make_shared<const bytes>(
+    tls::marshal(MLSContentTBSPrefix{ wire_format, content }));
+}
+
 bytes
 MLSAuthenticatedContent::to_be_signed(
+  const bytes& prefix,
   const std::optional<GroupContext>& context) const
 {
-  return tls::marshal(MLSContentTBS{
-    wire_format,
-    content,
-    context,
-  });
+  return tls::marshal(MLSContentTBS{ prefix, content, context });
 }
 
 MLSPlaintext
@@ -507,13 +689,14 @@ MLSPlaintext::protect(MLSAuthenticatedContent content_auth,
                       const std::optional<bytes>& membership_key,
                       const std::optional<GroupContext>& context)
 {
+  const auto prefix = content_auth.tbs_prefix();
   auto pt = MLSPlaintext(std::move(content_auth));
 
   // Add the membership_mac if required
   switch (pt.content.sender.sender_type()) {
     case SenderType::member:
       pt.membership_tag =
-        pt.membership_mac(suite, opt::get(membership_key), context);
+        pt.membership_mac(suite, opt::get(membership_key), *prefix, context);
       break;
 
     default:
@@ -528,10 +711,15 @@ MLSPlaintext::unprotect(CipherSuite suite,
                         const std::optional<bytes>& membership_key,
                         const std::optional<GroupContext>& context) const
 {
-  // Verify the membership_tag if the message was sent within the group
+  // Verify the membership_tag if the message was sent within the group.  The
+  // content is encoded once for this, and again used when the signature is
+  // verified.
+  auto content_auth = authenticated_content();
   switch (content.sender.sender_type()) {
     case SenderType::member: {
-      auto candidate = membership_mac(suite, opt::get(membership_key), context);
+      content_auth._tbs_prefix = content_auth.tbs_prefix();
+      const auto candidate = membership_mac(
+        suite, opt::get(membership_key), *content_auth._tbs_prefix, context);
       if (candidate != opt::get(membership_tag)) {
         return std::nullopt;
       }
@@ -542,6 +730,12 @@ MLSPlaintext::unprotect(CipherSuite suite,
       break;
   }
 
+  return content_auth;
+}
+
+MLSAuthenticatedContent
+MLSPlaintext::authenticated_content() const
+{
   return MLSAuthenticatedContent{
     WireFormat::mls_plaintext,
     content,
@@ -561,7 +755,7 @@ MLSPlaintext::MLSPlaintext(MLSAuthenticatedContent content_auth)
 struct MLSContentTBM
 {
   MLSContentTBS content_tbs;
-  MLSContentAuthData auth;
+  const MLSContentAuthData& auth;
 
   TLS_SERIALIZABLE(content_tbs, auth);
 };
@@ -569,14 +763,20 @@ struct MLSContentTBM
 bytes
 MLSPlaintext::membership_mac(CipherSuite suite,
                              const bytes& membership_key,
+                             const bytes& tbs_prefix,
                              const std::optional<GroupContext>& context) const
 {
-  auto tbm = tls::marshal(MLSContentTBM{
-    { WireFormat::mls_plaintext, content, context },
+  // Stream the TBM straight into the MAC, rather than marshaling it first
+  auto mac = suite.digest().hmac_context(membership_key);
+  const auto tbm = MLSContentTBM{
+    { tbs_prefix, content, context },
     auth,
+  };
+  tls::marshal_to(tbm, [&](const uint8_t* data, size_t size) {
+    mac.update({ data, size });
   });
 
-  return suite.digest().hmac(membership_key, tbm);
+  return mac.finish();
 }
 
 tls::ostream&
@@ -625,11 +825,11 @@ marshal_ciphertext_content(const MLSContent& content,
 }
 
 static void
-unmarshal_ciphertext_content(const bytes& content_pt,
+unmarshal_ciphertext_content(bytes_view content_pt,
                              MLSContent& content,
                              MLSContentAuthData& auth)
 {
-  auto r = tls::istream(content_pt);
+  auto r = tls::istream(content_pt.data(), content_pt.size());
 
   var::visit([&r](auto& val) { r >> val; }, content.content);
   r >> auth;
@@ -660,6 +860,9 @@ struct MLSSenderData
   TLS_SERIALIZABLE(sender, generation, reuse_guard)
 };
 
+// The sender data is encoded without a pass to measure it
+static_assert(tls::fixed_size_v<MLSSenderData> == 12);
+
 struct MLSSenderDataAAD
 {
   const bytes& group_id;
@@ -691,8 +894,7 @@ MLSCiphertext::protect(MLSAuthenticatedContent content_auth,
     content_auth.content.authenticated_data,
   });
 
-  auto content_ct = suite.hpke().aead.seal(
-    content_keys.key, content_keys.nonce, content_aad, content_pt);
+  auto content_ct = keys.seal(content_keys, content_aad, content_pt);
 
   // Encrypt the sender data
   auto sender_index =
@@ -711,10 +913,8 @@ MLSCiphertext::protect(MLSAuthenticatedContent content_auth,
   auto sender_data_keys =
     KeyScheduleEpoch::sender_data_keys(suite, sender_data_secret, content_ct);
 
-  auto sender_data_ct = suite.hpke().aead.seal(sender_data_keys.key,
-                                               sender_data_keys.nonce,
-                                               sender_data_aad,
-                                               sender_data_pt);
+  auto sender_data_ct =
+    keys.seal(sender_data_keys, sender_data_aad, sender_data_pt);
 
   return MLSCiphertext{
     std::move(content_auth.content),
@@ -723,11 +923,113 @@ MLSCiphertext::protect(MLSAuthenticatedContent content_auth,
   };
 }
 
+void
+MLSCiphertext::protect_into(MLSAuthenticatedContent content_auth,
+                            CipherSuite suite,
+                            const LeafIndex& index,
+                            GroupKeySource& keys,
+                            const bytes& sender_data_secret,
+                            size_t padding_size,
+                            bytes& out)
+{
+  const auto& content = content_auth.content;
+  const auto& aead = suite.hpke().aead;
+
+  // Pull keys from the secret tree
+  auto content_type = content.content_type();
+  auto [generation, reuse_guard, content_keys] = keys.next(content_type, index);
+
+  // The content plaintext is sealed in pieces, so that application data is
+  // encrypted straight from the caller's buffer.  Other content is small, and
+  // is marshaled as a whole.
+  auto content_head = tls::ostream{};
+  auto content_tail = tls::ostream{};
+  auto content_body = bytes_view{};
+  const auto* app_data = var::get_if<ApplicationData>(&content.content);
+  if (app_data != nullptr) {
+    tls::varint::encode(content_head, app_data->data.size());
+    content_body = app_data->data;
+  } else {
+    var::visit([&](const auto& val) { content_head << val; }, content.content);
+  }
+
+  content_tail << content_auth.auth;
+  content_tail.write_raw(bytes(padding_size, 0));
+
+  const auto& head = content_head.bytes();
+  const auto& tail = content_tail.bytes();
+  const auto content_pt_size = head.size() + content_body.size() + tail.size();
+
+  // The sender data is fixed-size, so space can be left for it ahead of the
+  // content ciphertext it is derived from
+  auto sender_index = var::get<MemberSender>(content.sender.sender).sender;
+  auto sender_data_pt = tls::marshal(MLSSenderData{
+    sender_index,
+    generation,
+    reuse_guard,
+  });
+
+  auto prefix = tls::ostream{};
+  prefix << content.group_id << content.epoch << content_type
+         << content.authenticated_data;
+  tls::varint::encode(prefix, aead.ciphertext_size(sender_data_pt.size()));
+  const auto& prefix_data = prefix.bytes();
+  out.as_vec().insert(out.end(), prefix_data.begin(), prefix_data.end());
+
+  const auto sender_data_offset = out.size();
+  out.resize(sender_data_offset + aead.ciphertext_size(sender_data_pt.size()));
+
+  auto ct_size = tls::ostream{};
+  tls::varint::encode(ct_size, aead.ciphertext_size(content_pt_size));
+  const auto& ct_size_data = ct_size.bytes();
+  out.as_vec().insert(out.end(), ct_size_data.begin(), ct_size_data.end());
+
+  // Encrypt the content
+  auto content_aad = tls::marshal(MLSCiphertextContentAAD{
+    content.group_id,
+    content.epoch,
+    content_type,
+    content.authenticated_data,
+  });
+
+  const auto content_offset = out.size();
+  keys.seal_into(
+    content_keys, content_aad, { head, content_body, tail }, out);
+
+  // Encrypt the sender data into the space left for it
+  auto sender_data_aad = tls::marshal(MLSSenderDataAAD{
+    content.group_id,
+    content.epoch,
+    content_type,
+  });
+
+  const auto content_ct = bytes_view(out).slice(content_offset, out.size());
+  auto sender_data_keys =
+    KeyScheduleEpoch::sender_data_keys(suite, sender_data_secret, content_ct);
+  keys.seal_to(sender_data_keys,
+               sender_data_aad,
+               sender_data_pt,
+               &out.at(sender_data_offset));
+}
+
 std::optional<MLSAuthenticatedContent>
 MLSCiphertext::unprotect(CipherSuite suite,
                          const TreeKEMPublicKey& tree,
                          GroupKeySource& keys,
                          const bytes& sender_data_secret) const
+{
+  return unprotect(
+    suite,
+    [&](LeafIndex leaf) { return tree.has_leaf(leaf); },
+    keys,
+    sender_data_secret);
+}
+
+std::optional<MLSAuthenticatedContent>
+MLSCiphertext::unprotect(CipherSuite suite,
+                         const std::function<bool(LeafIndex)>& has_leaf,
+                         GroupKeySource& keys,
+                         const bytes& sender_data_secret) const
 {
   // Decrypt and parse the sender data
   auto sender_data_keys =
@@ -738,16 +1040,24 @@ MLSCiphertext::unprotect(CipherSuite suite,
     content_type,
   });
 
-  auto sender_data_pt = suite.hpke().aead.open(sender_data_keys.key,
-                                               sender_data_keys.nonce,
-                                               sender_data_aad,
-                                               encrypted_sender_data);
-  if (!sender_data_pt) {
+  // The sender data is fixed-size, so it is decrypted onto the stack
+  const auto& aead = suite.hpke().aead;
+  auto sender_data_pt = std::array<uint8_t, tls::fixed_size_v<MLSSenderData>>{};
+  if (encrypted_sender_data.size() !=
+      aead.ciphertext_size(sender_data_pt.size())) {
+    throw ProtocolError("Malformed MLSCiphertext sender data");
+  }
+
+  if (!keys.open_to(sender_data_keys,
+                    sender_data_aad,
+                    encrypted_sender_data,
+                    sender_data_pt.data())) {
     return std::nullopt;
   }
 
-  auto sender_data = tls::get<MLSSenderData>(opt::get(sender_data_pt));
-  if (!tree.has_leaf(sender_data.sender)) {
+  auto sender_data = tls::get<MLSSenderData>(sender_data_pt.data(),
+                                             sender_data_pt.size());
+  if (!has_leaf(sender_data.sender)) {
     return std::nullopt;
   }
 
@@ -765,13 +1075,22 @@ MLSCiphertext::unprotect(CipherSuite suite,
     authenticated_data,
   });
 
-  auto content_pt = suite.hpke().aead.open(
-    content_keys.key, content_keys.nonce, content_aad, ciphertext);
-  if (!content_pt) {
-    return std::nullopt;
+  // The content is decrypted into a per-thread buffer that keeps its capacity
+  // from one message to the next, and is wiped once it has been parsed.  An
+  // ASYNC job can pause while another job uses the thread, so a job decrypts
+  // into a buffer of its own.
+  const auto tag_size = aead.ciphertext_size(0);
+  if (ciphertext.size() < tag_size) {
+    throw ProtocolError("MLSCiphertext content smaller than tag");
   }
 
-  // Parse the content
+  thread_local auto thread_scratch = bytes{};
+  auto job_scratch = bytes{};
+  auto& scratch =
+    hpke::AsyncBatch::in_job() ? job_scratch : thread_scratch;
+  const auto content_pt_size = ciphertext.size() - tag_size;
+  scratch.resize(content_pt_size);
+
   auto content = MLSContent{ group_id,
                              epoch,
                              { MemberSender{ sender_data.sender } },
@@ -779,7 +1098,20 @@ MLSCiphertext::unprotect(CipherSuite suite,
                              content_type };
   auto auth = MLSContentAuthData{ content_type, {}, {} };
 
-  unmarshal_ciphertext_content(opt::get(content_pt), content, auth);
+  try {
+    if (!keys.open_to(content_keys, content_aad, ciphertext, scratch.data())) {
+      secure_wipe(scratch.data(), content_pt_size);
+      return std::nullopt;
+    }
+
+    unmarshal_ciphertext_content(
+      bytes_view(scratch).slice(0, content_pt_size), content, auth);
+  } catch (...) {
+    secure_wipe(scratch.data(), content_pt_size);
+    throw;
+  }
+
+  secure_wipe(scratch.data(), content_pt_size);
 
   return MLSAuthenticatedContent{
     WireFormat::mls_ciphertext,
@@ -820,6 +1152,44 @@ MLSMessage::wire_format() const
   return tls::variant<WireFormat>::type(message);
 }
 
+MLSMessageHeader
+MLSMessage::peek_header(bytes_view data)
+{
+  auto str = tls::istream(data.data(), data.size());
+
+  auto version = ProtocolVersion::mls10;
+  auto header = MLSMessageHeader{};
+  str >> version >> header.wire_format;
+
+  switch (header.wire_format) {
+    case WireFormat::mls_plaintext: {
+      // The content type follows the sender and the authenticated data, which
+      // is skipped over rather than copied out
+      auto sender = Sender{};
+      auto aad_size = uint64_t(0);
+      str >> header.group_id >> header.epoch >> sender;
+      tls::varint::decode(str, aad_size);
+      str.sub_stream(static_cast<size_t>(aad_size));
+      str >> header.content_type;
+      break;
+    }
+
+    case WireFormat::mls_ciphertext:
+      str >> header.group_id >> header.epoch >> header.content_type;
+      break;
+
+    case WireFormat::mls_welcome:
+    case WireFormat::mls_group_info:
+    case WireFormat::mls_key_package:
+      break;
+
+    default:
+      throw InvalidParameterError("Illegal wire format");
+  }
+
+  return header;
+}
+
 MLSMessage::MLSMessage(MLSPlaintext mls_plaintext)
   : message(std::move(mls_plaintext))
 {
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <mls/crypto.h>
+
+#include <utility>
+
+// Static tracepoints (USDT) on the main State and TreeKEM operations, which
+// bpftrace, perf or SystemTap can attach to in a running process, e.g.:
+//
+//   bpftrace -e 'usdt:./app:mlspp:handle_start { @[arg0] = count(); }'
+//
+// Each operation has a probe where it starts and one where it ends, with
+// arguments among: the number of leaves in the tree, the epoch, the cipher
+// suite, and a byte count.  Probes are compiled in only when MLSPP_USDT is
+// defined, as it is by the USDT build option; a compiled-in probe is a nop
+// until a tracer attaches to it.
+#if defined(MLSPP_USDT)
+#include <sys/sdt.h>
+#define MLS_PROBE(name, ...) STAP_PROBEV(mlspp, name, __VA_ARGS__)
+#else
+#define MLS_PROBE(name, ...) static_cast<void>(0)
+#endif
+
+namespace mls {
+
+inline uint16_t
+probe_suite(const CipherSuite& suite)
+{
+  return static_cast<uint16_t>(suite.cipher_suite());
+}
+
+// Runs a function as it goes out of scope, so that the probe at the end of an
+// operation fires however the operation ends
+template<typename F>
+class ProbeOnExit
+{
+public:
+  explicit ProbeOnExit(F f_in)
+    : f(std::move(f_in))
+  {
+  }
+
+  ProbeOnExit(const ProbeOnExit&) = delete;
+  ProbeOnExit(ProbeOnExit&&) = delete;
+  ProbeOnExit& operator=(const ProbeOnExit&) = delete;
+  ProbeOnExit& operator=(ProbeOnExit&&) = delete;
+
+  ~ProbeOnExit() { f(); }
+
+private:
+  F f;
+};
+
+} // namespace mls
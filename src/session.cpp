@@ -1,11 +1,27 @@
 #include <mls/session.h>
 
+#include <mls/log.h>
 #include <mls/messages.h>
 
+#include <algorithm>
+#include <chrono>
 #include <deque>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 
 namespace mls {
 
+// Serialize an outbound message, counting the bytes produced
+template<typename T>
+static bytes
+serialize(const T& value)
+{
+  auto data = tls::marshal(value);
+  log::Metrics::count(log::Counter::bytes_serialized, data.size());
+  return data;
+}
+
 ///
 /// Inner struct declarations for PendingJoin and Session
 ///
@@ -25,14 +41,207 @@ struct PendingJoin::Inner
   static PendingJoin create(CipherSuite suite,
                             SignaturePrivateKey sig_priv,
                             Credential cred);
+
+  Session complete(const Welcome& welcome) const;
+};
+
+struct KeyPackagePool::Inner
+{
+  const Client client;
+  const size_t target_depth;
+  const Executor executor;
+
+  mutable std::mutex mutex;
+  std::deque<PendingJoin> available;
+  std::unordered_map<KeyPackageRef, PendingJoin, HashReferenceHash>
+    outstanding;
+
+  Inner(Client client_in, size_t target_depth_in, Executor executor_in);
+
+  std::vector<PendingJoin> generate(size_t count) const;
 };
 
+// Past epochs, in a ring indexed by epoch number.  Epochs advance one at a
+// time, so the most recent `capacity` epochs occupy distinct slots, and
+// entering a new epoch overwrites the oldest one.
+class EpochRing
+{
+public:
+  explicit EpochRing(size_t capacity)
+    : slots(capacity)
+  {
+  }
+
+  size_t capacity() const { return slots.size(); }
+
+  void push(RetainedEpoch retained)
+  {
+    if (slots.empty()) {
+      return;
+    }
+
+    slots.at(slot_for(retained.epoch())).emplace(std::move(retained));
+  }
+
+  RetainedEpoch* find(epoch_t epoch)
+  {
+    if (slots.empty()) {
+      return nullptr;
+    }
+
+    auto& slot = slots.at(slot_for(epoch));
+    if (!slot || slot->epoch() != epoch) {
+      return nullptr;
+    }
+
+    return &opt::get(slot);
+  }
+
+  const RetainedEpoch* find(epoch_t epoch) const
+  {
+    return const_cast<EpochRing*>(this)->find(epoch); // NOLINT
+  }
+
+  GroupMemoryUsage memory_usage() const
+  {
+    auto usage = GroupMemoryUsage{};
+    for (const auto& slot : slots) {
+      if (slot) {
+        usage += slot->memory_usage();
+      }
+    }
+    return usage;
+  }
+
+  // Change the capacity, keeping as many of the epochs up to `latest` as fit
+  void resize(size_t capacity, epoch_t latest)
+  {
+    auto resized = EpochRing(capacity);
+    for (size_t i = 0; i < capacity && i <= latest; i++) {
+      if (auto* retained = find(latest - i)) {
+        resized.push(std::move(*retained));
+      }
+    }
+
+    *this = std::move(resized);
+  }
+
+private:
+  std::vector<std::optional<RetainedEpoch>> slots;
+
+  size_t slot_for(epoch_t epoch) const
+  {
+    return static_cast<size_t>(epoch % slots.size());
+  }
+};
+
+// Membership changes waiting for the next Commit.  Members to be removed are
+// identified by their signature keys rather than by their places in the tree,
+// which another member's Commit can change, and the changes only become
+// proposals when the Commit is built.
+struct QueuedChanges
+{
+  std::vector<KeyPackage> adds;
+  std::vector<SignaturePublicKey> removes;
+  bool update{ false };
+
+  size_t size() const
+  {
+    return adds.size() + removes.size() + (update ? 1 : 0);
+  }
+
+  // Drop the changes that no longer apply to `state`: Removes of members who
+  // have left, and Adds of members who have joined
+  void prune(const State& state);
+
+  std::vector<Proposal> proposals(const State& state) const;
+};
+
+static std::optional<LeafIndex>
+find_member(const TreeKEMPublicKey& tree, const SignaturePublicKey& key)
+{
+  const auto view = tree.leaves();
+  for (auto it = view.begin(); it != view.end(); ++it) {
+    if (it->signature_key == key) {
+      return it.index();
+    }
+  }
+
+  return std::nullopt;
+}
+
+void
+QueuedChanges::prune(const State& state)
+{
+  const auto& tree = state.tree();
+  const auto gone = [&](const auto& key) {
+    return !find_member(tree, key).has_value();
+  };
+  const auto joined = [&](const auto& key_package) {
+    return tree.has_signature_key(key_package.leaf_node.signature_key,
+                                  std::nullopt);
+  };
+
+  removes.erase(std::remove_if(removes.begin(), removes.end(), gone),
+                removes.end());
+  adds.erase(std::remove_if(adds.begin(), adds.end(), joined), adds.end());
+}
+
+std::vector<Proposal>
+QueuedChanges::proposals(const State& state) const
+{
+  auto out = std::vector<Proposal>{};
+  out.reserve(adds.size() + removes.size());
+  for (const auto& key_package : adds) {
+    out.push_back(state.add_proposal(key_package));
+  }
+
+  for (const auto& key : removes) {
+    const auto removed = find_member(state.tree(), key);
+    if (!removed) {
+      throw InvalidParameterError("Queued Remove of a non-member");
+    }
+
+    out.push_back(state.remove_proposal(opt::get(removed)));
+  }
+
+  return out;
+}
+
 struct Session::Inner
 {
-  std::deque<State> history;
-  std::map<bytes, State> outbound_cache;
+  // The state for the current epoch, and what is left of earlier ones
+  State state;
+  EpochRing history{ Session::default_retained_epochs - 1 };
+
+  // The view of the current epoch given to readers.  It is only accessed
+  // atomically, since it is read without the Session being locked.
+  std::shared_ptr<const EpochSnapshot> published;
+
+  // States for the Commits we have sent, keyed by the hash of the message
+  std::unordered_map<HashReference, State, HashReferenceHash> outbound_cache;
+  std::vector<std::shared_ptr<PendingCommit::Job>> pending_commits;
   bool encrypt_handshake{ false };
 
+  // Where Commits built by commit_async() run
+  Scheduler scheduler;
+
+  // Senders whose keys are derived ahead on each new epoch
+  std::vector<LeafIndex> warm_senders;
+  uint32_t warm_generations{ 0 };
+  Executor warm_executor;
+
+  // Membership changes to be carried by the next Commit, and when the oldest
+  // of them was queued
+  CommitSchedule commit_schedule;
+  QueuedChanges queued;
+  std::optional<CommitSchedule::Clock::time_point> queued_since;
+
+  // Where traffic is recorded, if anywhere
+  std::shared_ptr<CaptureSink> capture_sink;
+  CaptureTimer::Clock::time_point capture_epoch;
+  CaptureTimer capture_timer() const;
+
   explicit Inner(State state);
 
   static Session begin(CipherSuite suite,
@@ -44,11 +253,29 @@ struct Session::Inner
                       const HPKEPrivateKey& leaf_priv,
                       const SignaturePrivateKey& sig_priv,
                       const KeyPackage& key_package,
-                      const bytes& welcome_data);
+                      const Welcome& welcome);
 
   bytes fresh_secret() const;
   MLSMessage import_handshake(const bytes& encoded) const;
-  State& for_epoch(epoch_t epoch);
+  HashReference commit_ref(const bytes& commit_data) const;
+  void cache_commit(const bytes& commit_data, State next);
+  void enter_epoch(State next);
+  void warm_keys() const;
+  std::tuple<bytes, bytes> unprotect(const MLSMessage& msg) const;
+  std::vector<std::tuple<bytes, bytes>> unprotect_batch(
+    epoch_t epoch,
+    const std::vector<MLSMessage>& msgs) const;
+  void collect_commits();
+  void drop_stale_commits();
+  void mark_queued();
+  void clear_queue();
+  std::shared_ptr<PendingCommit::Job> take_queue();
+  void requeue(PendingCommit::Job& job);
+
+  static PendingCommit::Result build_commit(State state,
+                                            const QueuedChanges& queued,
+                                            const bytes& commit_secret,
+                                            bool encrypt);
 };
 
 ///
@@ -86,6 +313,14 @@ Client::start_join() const
   return PendingJoin::Inner::create(suite, sig_priv, cred);
 }
 
+KeyPackagePool
+Client::key_package_pool(size_t target_depth, Executor executor) const
+{
+  auto inner = std::make_unique<KeyPackagePool::Inner>(
+    *this, target_depth, std::move(executor));
+  return { inner.release() };
+}
+
 ///
 /// PendingJoin
 ///
@@ -137,25 +372,266 @@ PendingJoin::PendingJoin(Inner* inner_in)
 bytes
 PendingJoin::key_package() const
 {
-  return tls::marshal(inner->key_package);
+  return serialize(inner->key_package);
+}
+
+Session
+PendingJoin::Inner::complete(const Welcome& welcome) const
+{
+  return Session::Inner::join(
+    init_priv, leaf_priv, sig_priv, key_package, welcome);
 }
 
 Session
 PendingJoin::complete(const bytes& welcome) const
 {
-  return Session::Inner::join(inner->init_priv,
-                              inner->leaf_priv,
-                              inner->sig_priv,
-                              inner->key_package,
-                              welcome);
+  return inner->complete(tls::get<Welcome>(welcome));
+}
+
+///
+/// KeyPackagePool
+///
+
+KeyPackagePool::Inner::Inner(Client client_in,
+                             size_t target_depth_in,
+                             Executor executor_in)
+  : client(std::move(client_in))
+  , target_depth(target_depth_in)
+  , executor(std::move(executor_in))
+{
+}
+
+std::vector<PendingJoin>
+KeyPackagePool::Inner::generate(size_t count) const
+{
+  auto generated = std::vector<std::unique_ptr<PendingJoin::Inner>>(count);
+  execute(executor, count, [&](size_t i) {
+    generated[i] = std::make_unique<PendingJoin::Inner>(
+      client.suite, client.sig_priv, client.cred);
+  });
+
+  auto joins = std::vector<PendingJoin>{};
+  joins.reserve(count);
+  for (auto& join : generated) {
+    joins.push_back(PendingJoin(join.release()));
+  }
+  return joins;
+}
+
+KeyPackagePool::KeyPackagePool(KeyPackagePool&& other) noexcept = default;
+
+KeyPackagePool&
+KeyPackagePool::operator=(KeyPackagePool&& other) noexcept = default;
+
+KeyPackagePool::~KeyPackagePool() = default;
+
+KeyPackagePool::KeyPackagePool(Inner* inner_in)
+  : inner(inner_in)
+{
+}
+
+void
+KeyPackagePool::refill()
+{
+  auto needed = size_t(0);
+  {
+    const auto lock = std::lock_guard(inner->mutex);
+    if (inner->available.size() < inner->target_depth) {
+      needed = inner->target_depth - inner->available.size();
+    }
+  }
+
+  // Generate outside the lock, so that KeyPackages can still be taken
+  auto generated = inner->generate(needed);
+
+  const auto lock = std::lock_guard(inner->mutex);
+  for (auto& join : generated) {
+    inner->available.push_back(std::move(join));
+  }
+}
+
+size_t
+KeyPackagePool::available() const
+{
+  const auto lock = std::lock_guard(inner->mutex);
+  return inner->available.size();
+}
+
+size_t
+KeyPackagePool::outstanding() const
+{
+  const auto lock = std::lock_guard(inner->mutex);
+  return inner->outstanding.size();
+}
+
+std::vector<bytes>
+KeyPackagePool::take(size_t count)
+{
+  auto taken = std::vector<PendingJoin>{};
+  {
+    const auto lock = std::lock_guard(inner->mutex);
+    while (taken.size() < count && !inner->available.empty()) {
+      taken.push_back(std::move(inner->available.front()));
+      inner->available.pop_front();
+    }
+  }
+
+  // If the pool has run dry, generate the rest here
+  auto generated = inner->generate(count - taken.size());
+  for (auto& join : generated) {
+    taken.push_back(std::move(join));
+  }
+
+  auto key_packages = std::vector<bytes>{};
+  key_packages.reserve(taken.size());
+
+  const auto lock = std::lock_guard(inner->mutex);
+  for (auto& join : taken) {
+    key_packages.push_back(join.key_package());
+    auto ref = join.inner->key_package.ref();
+    inner->outstanding.emplace(std::move(ref), std::move(join));
+  }
+
+  return key_packages;
+}
+
+Session
+KeyPackagePool::join(const bytes& welcome)
+{
+  // The Welcome is decoded once, both to find the KeyPackage it is for and to
+  // join with it
+  const auto welcome_obj = tls::get<Welcome>(welcome);
+
+  // Take the KeyPackage out of the pool while joining, and put it back if the
+  // Welcome turns out not to be usable
+  auto join = std::optional<PendingJoin>{};
+  {
+    const auto lock = std::lock_guard(inner->mutex);
+    for (const auto& secrets : welcome_obj.secrets) {
+      auto it = inner->outstanding.find(secrets.new_member);
+      if (it != inner->outstanding.end()) {
+        join.emplace(std::move(it->second));
+        inner->outstanding.erase(it);
+        break;
+      }
+    }
+  }
+
+  if (!join) {
+    throw MissingStateError("No outstanding KeyPackage for Welcome");
+  }
+
+  try {
+    return opt::get(join).inner->complete(welcome_obj);
+  } catch (...) {
+    const auto lock = std::lock_guard(inner->mutex);
+    auto ref = opt::get(join).inner->key_package.ref();
+    inner->outstanding.emplace(std::move(ref), std::move(opt::get(join)));
+    throw;
+  }
+}
+
+bool
+KeyPackagePool::discard(const bytes& key_package)
+{
+  const auto ref = tls::get<KeyPackage>(key_package).ref();
+
+  const auto lock = std::lock_guard(inner->mutex);
+  return inner->outstanding.erase(ref) > 0;
+}
+
+///
+/// PendingCommit
+///
+
+// The build of a Commit, and the builds chained on it, which are started once
+// it has finished
+struct PendingCommit::Job
+{
+  std::promise<Result> promise;
+  std::shared_future<Result> result = promise.get_future().share();
+
+  std::mutex mutex;
+  bool done = false;
+  std::vector<std::function<void()>> chained;
+
+  // The queued changes that the Commit carries, which go back in the queue if
+  // it cannot be built
+  QueuedChanges changes;
+  std::optional<CommitSchedule::Clock::time_point> queued_since;
+
+  bool ready() const;
+  void run(const std::function<Result()>& build);
+  void then(std::function<void()> next);
+};
+
+bool
+PendingCommit::Job::ready() const
+{
+  const auto status = result.wait_for(std::chrono::seconds(0));
+  return status == std::future_status::ready;
+}
+
+void
+PendingCommit::Job::run(const std::function<Result()>& build)
+{
+  try {
+    promise.set_value(build());
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+
+  auto next = decltype(chained){};
+  {
+    const auto lock = std::lock_guard(mutex);
+    done = true;
+    next.swap(chained);
+  }
+
+  for (const auto& task : next) {
+    task();
+  }
+}
+
+void
+PendingCommit::Job::then(std::function<void()> next)
+{
+  {
+    const auto lock = std::lock_guard(mutex);
+    if (!done) {
+      chained.push_back(std::move(next));
+      return;
+    }
+  }
+
+  next();
+}
+
+PendingCommit::PendingCommit(std::shared_ptr<Job> job_in)
+  : job(std::move(job_in))
+{
+}
+
+bool
+PendingCommit::ready() const
+{
+  return job->ready();
+}
+
+std::tuple<bytes, bytes>
+PendingCommit::get() const
+{
+  const auto& built = job->result.get();
+  return { built.welcome, built.commit };
 }
 
 ///
 /// Session
 ///
 
-Session::Inner::Inner(State state)
-  : history{ std::move(state) }
+Session::Inner::Inner(State state_in)
+  : state(std::move(state_in))
+  , published(state.snapshot())
   , encrypt_handshake(true)
 {
 }
@@ -177,42 +653,45 @@ Session::Inner::join(const HPKEPrivateKey& init_priv,
                      const HPKEPrivateKey& leaf_priv,
                      const SignaturePrivateKey& sig_priv,
                      const KeyPackage& key_package,
-                     const bytes& welcome_data)
+                     const Welcome& welcome)
 {
-  auto welcome = tls::get<Welcome>(welcome_data);
-
   auto state =
     State(init_priv, leaf_priv, sig_priv, key_package, welcome, std::nullopt);
   auto inner = std::make_unique<Inner>(state);
   return { inner.release() };
 }
 
+CaptureTimer
+Session::Inner::capture_timer() const
+{
+  return { capture_sink.get(), capture_epoch };
+}
+
 bytes
 Session::Inner::fresh_secret() const
 {
-  const auto suite = history.front().cipher_suite();
+  const auto suite = state.cipher_suite();
   return random_bytes(suite.secret_size());
 }
 
 MLSMessage
 Session::Inner::import_handshake(const bytes& encoded) const
 {
-  auto msg = tls::get<MLSMessage>(encoded);
-
-  switch (msg.wire_format()) {
+  // Check the wire format before decoding the whole message
+  switch (MLSMessage::peek_header(encoded).wire_format) {
     case WireFormat::mls_plaintext:
       if (encrypt_handshake) {
         throw ProtocolError("Handshake not encrypted as required");
       }
 
-      return msg;
+      return tls::get<MLSMessage>(encoded);
 
     case WireFormat::mls_ciphertext: {
       if (!encrypt_handshake) {
         throw ProtocolError("Unexpected handshake encryption");
       }
 
-      return msg;
+      return tls::get<MLSMessage>(encoded);
     }
 
     default:
@@ -220,16 +699,207 @@ Session::Inner::import_handshake(const bytes& encoded) const
   }
 }
 
-State&
-Session::Inner::for_epoch(epoch_t epoch)
+HashReference
+Session::Inner::commit_ref(const bytes& commit_data) const
+{
+  const auto digest = state.cipher_suite().digest().hash(commit_data);
+
+  auto ref = HashReference{};
+  std::copy(digest.begin(), digest.begin() + ref.size(), ref.begin());
+  return ref;
+}
+
+void
+Session::Inner::cache_commit(const bytes& commit_data, State next)
 {
-  for (auto& state : history) {
-    if (state.epoch() == epoch) {
-      return state;
+  outbound_cache.insert_or_assign(commit_ref(commit_data), std::move(next));
+}
+
+void
+Session::Inner::enter_epoch(State next)
+{
+  if (history.capacity() > 0) {
+    history.push(state.retain());
+  }
+
+  state = std::move(next);
+  std::atomic_store(&published, state.snapshot());
+
+  // Queued changes that another member's Commit has made moot are dropped
+  queued.prune(state);
+  if (queued.size() == 0) {
+    queued_since.reset();
+  }
+
+  // Cached states for any other Commits we sent in the last epoch can no
+  // longer be used
+  drop_stale_commits();
+
+  try {
+    warm_keys();
+  } catch (const std::exception&) {
+    // Warming is only an optimization.  If it fails, the same failure will be
+    // reported when the keys are used.
+  }
+}
+
+void
+Session::Inner::warm_keys() const
+{
+  if (warm_generations == 0) {
+    return;
+  }
+
+  auto senders = warm_senders;
+  if (std::find(senders.begin(), senders.end(), state.index()) ==
+      senders.end()) {
+    senders.push_back(state.index());
+  }
+
+  state.warm_keys(senders, warm_generations, warm_executor);
+}
+
+std::tuple<bytes, bytes>
+Session::Inner::unprotect(const MLSMessage& msg) const
+{
+  const auto epoch = msg.epoch();
+  if (epoch == state.epoch()) {
+    return state.unprotect(msg);
+  }
+
+  auto* retained = history.find(epoch);
+  if (retained == nullptr) {
+    throw MissingStateError("No state for epoch");
+  }
+
+  return retained->unprotect(msg);
+}
+
+std::vector<std::tuple<bytes, bytes>>
+Session::Inner::unprotect_batch(epoch_t epoch,
+                                const std::vector<MLSMessage>& msgs) const
+{
+  if (epoch == state.epoch()) {
+    return state.unprotect_batch(msgs);
+  }
+
+  auto* retained = history.find(epoch);
+  if (retained == nullptr) {
+    throw MissingStateError("No state for epoch");
+  }
+
+  return stdx::transform<std::tuple<bytes, bytes>>(
+    msgs, [&](const auto& msg) { return retained->unprotect(msg); });
+}
+
+void
+Session::Inner::collect_commits()
+{
+  // Commits only need to be collected once they are built, since a Commit
+  // cannot have been sent before then
+  auto built = decltype(pending_commits){};
+  auto still_pending = decltype(pending_commits){};
+  for (auto& job : pending_commits) {
+    auto& out = job->ready() ? built : still_pending;
+    out.push_back(std::move(job));
+  }
+
+  pending_commits = std::move(still_pending);
+
+  for (const auto& job : built) {
+    // A failed build produced no Commit that could be handled, and its error
+    // is reported by PendingCommit::get().  The changes it would have carried
+    // are queued again.
+    const PendingCommit::Result* result = nullptr;
+    try {
+      result = &job->result.get();
+    } catch (...) {
+      requeue(*job);
+      continue;
+    }
+
+    // A built Commit that cannot be recorded would fail when the group sends
+    // it back, so the error is raised here instead
+    cache_commit(result->commit, result->next);
+  }
+}
+
+void
+Session::Inner::drop_stale_commits()
+{
+  // Only Commits for the current epoch, or speculative Commits for later
+  // epochs, can still be used
+  const auto epoch = state.epoch();
+  for (auto it = outbound_cache.begin(); it != outbound_cache.end();) {
+    if (it->second.epoch() <= epoch) {
+      it = outbound_cache.erase(it);
+    } else {
+      ++it;
     }
   }
+}
+
+void
+Session::Inner::mark_queued()
+{
+  if (!queued_since) {
+    queued_since = CommitSchedule::Clock::now();
+  }
+}
+
+void
+Session::Inner::clear_queue()
+{
+  queued = QueuedChanges{};
+  queued_since.reset();
+}
+
+std::shared_ptr<PendingCommit::Job>
+Session::Inner::take_queue()
+{
+  auto job = std::make_shared<PendingCommit::Job>();
+  job->changes = std::move(queued);
+  job->queued_since = queued_since;
+  clear_queue();
+  return job;
+}
+
+void
+Session::Inner::requeue(PendingCommit::Job& job)
+{
+  // The returned changes were queued first, so they go ahead of the others
+  auto& changes = job.changes;
+  changes.adds.insert(changes.adds.end(),
+                      std::make_move_iterator(queued.adds.begin()),
+                      std::make_move_iterator(queued.adds.end()));
+  changes.removes.insert(changes.removes.end(),
+                         std::make_move_iterator(queued.removes.begin()),
+                         std::make_move_iterator(queued.removes.end()));
+  changes.update = changes.update || queued.update;
+  queued = std::move(changes);
+
+  if (!queued_since || (job.queued_since && job.queued_since < queued_since)) {
+    queued_since = job.queued_since;
+  }
 
-  throw MissingStateError("No state for epoch");
+  // The group may have moved on since the changes were taken
+  queued.prune(state);
+  if (queued.size() == 0) {
+    queued_since.reset();
+  }
+}
+
+PendingCommit::Result
+Session::Inner::build_commit(State state,
+                             const QueuedChanges& queued,
+                             const bytes& commit_secret,
+                             bool encrypt)
+{
+  const auto opts =
+    CommitOpts{ queued.proposals(state), true, encrypt, {} };
+  auto [commit, welcome, next] =
+    state.commit(commit_secret, opts, { encrypt, {}, 0 });
+  return { serialize(welcome), serialize(commit), std::move(next) };
 }
 
 Session::Session(Session&& other) noexcept = default;
@@ -250,30 +920,75 @@ Session::encrypt_handshake(bool enabled)
   inner->encrypt_handshake = enabled;
 }
 
+void
+Session::retain_epochs(size_t count)
+{
+  if (count == 0) {
+    throw InvalidParameterError("At least one epoch must be retained");
+  }
+
+  inner->history.resize(count - 1, inner->state.epoch() - 1);
+}
+
+void
+Session::warm_keys(std::vector<LeafIndex> senders,
+                   uint32_t generations,
+                   Executor executor)
+{
+  inner->warm_senders = std::move(senders);
+  inner->warm_generations = generations;
+  inner->warm_executor = std::move(executor);
+  inner->warm_keys();
+}
+
+void
+Session::capture(std::shared_ptr<CaptureSink> sink)
+{
+  inner->capture_sink = std::move(sink);
+  inner->capture_epoch = CaptureTimer::Clock::now();
+  if (inner->capture_sink) {
+    inner->capture_sink->start({ CaptureHeader::current_version,
+                                 inner->state.serialize() });
+  }
+}
+
+void
+Session::set_executor(Executor executor)
+{
+  inner->state.set_executor(std::move(executor));
+}
+
+void
+Session::set_executor(Executor executor, Scheduler scheduler)
+{
+  inner->state.set_executor(std::move(executor));
+  inner->scheduler = std::move(scheduler);
+}
+
 bytes
 Session::add(const bytes& key_package_data)
 {
   auto key_package = tls::get<KeyPackage>(key_package_data);
-  auto proposal = inner->history.front().add(
+  auto proposal = inner->state.add(
     key_package, { inner->encrypt_handshake, {}, 0 });
-  return tls::marshal(proposal);
+  return serialize(proposal);
 }
 
 bytes
 Session::update()
 {
   auto leaf_secret = inner->fresh_secret();
-  auto proposal = inner->history.front().update(
+  auto proposal = inner->state.update(
     leaf_secret, {}, { inner->encrypt_handshake, {}, 0 });
-  return tls::marshal(proposal);
+  return serialize(proposal);
 }
 
 bytes
 Session::remove(uint32_t index)
 {
-  auto proposal = inner->history.front().remove(
+  auto proposal = inner->state.remove(
     RosterIndex{ index }, { inner->encrypt_handshake, {}, 0 });
-  return tls::marshal(proposal);
+  return serialize(proposal);
 }
 
 std::tuple<bytes, bytes>
@@ -285,83 +1000,218 @@ Session::commit(const bytes& proposal)
 std::tuple<bytes, bytes>
 Session::commit(const std::vector<bytes>& proposals)
 {
-  auto provisional_state = inner->history.front();
-  for (const auto& proposal_data : proposals) {
-    auto msg = inner->import_handshake(proposal_data);
-    auto maybe_state = provisional_state.handle(msg);
-    if (maybe_state) {
-      throw InvalidParameterError("Invalid proposal; actually a commit");
-    }
+  const auto timer = inner->capture_timer();
+  auto msgs = stdx::transform<MLSMessage>(proposals, [&](const auto& data) {
+    return inner->import_handshake(data);
+  });
+
+  auto provisional_state = inner->state;
+  provisional_state.cache_proposals(msgs);
+  inner->state = std::move(provisional_state);
+
+  // The proposals are replayed as if they had been handled one by one
+  for (const auto& proposal : proposals) {
+    timer.record(CaptureType::handle, proposal);
   }
 
-  inner->history.front() = std::move(provisional_state);
   return commit();
 }
 
 std::tuple<bytes, bytes>
 Session::commit()
 {
+  const auto timer = inner->capture_timer();
+  inner->collect_commits();
   auto commit_secret = inner->fresh_secret();
   auto encrypt = inner->encrypt_handshake;
-  auto [commit, welcome, new_state] = inner->history.front().commit(
-    commit_secret, CommitOpts{ {}, true, encrypt, {} }, { encrypt, {}, 0 });
+  const auto opts =
+    CommitOpts{ inner->queued.proposals(inner->state), true, encrypt, {} };
+  auto [commit, welcome, new_state] =
+    inner->state.commit(commit_secret, opts, { encrypt, {}, 0 });
+  inner->clear_queue();
 
-  auto commit_msg = tls::marshal(commit);
-  auto welcome_msg = tls::marshal(welcome);
+  auto commit_msg = serialize(commit);
+  auto welcome_msg = serialize(welcome);
+  timer.record(CaptureType::commit, commit_msg);
 
-  inner->outbound_cache.insert({ commit_msg, new_state });
+  inner->cache_commit(commit_msg, std::move(new_state));
   return std::make_tuple(welcome_msg, commit_msg);
 }
 
+void
+Session::set_commit_schedule(const CommitSchedule& schedule)
+{
+  inner->commit_schedule = schedule;
+}
+
+void
+Session::queue_add(const bytes& key_package_data)
+{
+  // The KeyPackage is checked now, so that a bad one is refused here rather
+  // than failing the Commit
+  auto key_package = tls::get<KeyPackage>(key_package_data);
+  silence_unused(inner->state.add_proposal(key_package));
+  inner->collect_commits();
+  inner->queued.adds.push_back(std::move(key_package));
+  inner->mark_queued();
+}
+
+void
+Session::queue_remove(uint32_t index)
+{
+  const auto proposal = inner->state.remove_proposal(RosterIndex{ index });
+  const auto removed = var::get<Remove>(proposal.content).removed;
+  const auto* leaf = inner->state.tree().leaf_node_ptr(removed);
+  inner->collect_commits();
+  inner->queued.removes.push_back(leaf->signature_key);
+  inner->mark_queued();
+}
+
+void
+Session::queue_update()
+{
+  inner->collect_commits();
+  inner->queued.update = true;
+  inner->mark_queued();
+}
+
+size_t
+Session::queued_changes() const
+{
+  return inner->queued.size();
+}
+
+void
+Session::clear_queue()
+{
+  inner->collect_commits();
+  inner->clear_queue();
+}
+
+std::optional<std::tuple<bytes, bytes>>
+Session::commit_due()
+{
+  return commit_due(CommitSchedule::Clock::now());
+}
+
+std::optional<std::tuple<bytes, bytes>>
+Session::commit_due(CommitSchedule::Clock::time_point now)
+{
+  inner->collect_commits();
+  const auto& schedule = inner->commit_schedule;
+  const auto count = inner->queued.size();
+  if (count == 0) {
+    return std::nullopt;
+  }
+
+  const auto full = (count >= schedule.max_changes);
+  const auto waited = (now - opt::get(inner->queued_since));
+  if (!full && waited < schedule.max_delay) {
+    return std::nullopt;
+  }
+
+  return commit();
+}
+
+PendingCommit
+Session::commit_async()
+{
+  // The task works on its own copy of the state, and the job takes the queued
+  // changes, so it does not race with later operations on the Session
+  inner->collect_commits();
+  auto job = inner->take_queue();
+  auto task = [job,
+               state = inner->state,
+               commit_secret = inner->fresh_secret(),
+               encrypt = inner->encrypt_handshake]() mutable {
+    job->run([&]() {
+      return Inner::build_commit(
+        std::move(state), job->changes, commit_secret, encrypt);
+    });
+  };
+
+  schedule(inner->scheduler, std::move(task));
+  inner->pending_commits.push_back(job);
+  return PendingCommit(std::move(job));
+}
+
+PendingCommit
+Session::commit_async(const PendingCommit& previous)
+{
+  // The build is scheduled once `previous` has been built, rather than
+  // holding a thread while it waits
+  inner->collect_commits();
+  auto job = inner->take_queue();
+  auto task = [job,
+               previous = previous.job->result,
+               commit_secret = inner->fresh_secret(),
+               encrypt = inner->encrypt_handshake]() {
+    job->run([&]() {
+      return Inner::build_commit(
+        previous.get().next, job->changes, commit_secret, encrypt);
+    });
+  };
+
+  previous.job->then([scheduler = inner->scheduler, task]() {
+    schedule(scheduler, task);
+  });
+  inner->pending_commits.push_back(job);
+  return PendingCommit(std::move(job));
+}
+
 bool
 Session::handle(const bytes& handshake_data)
 {
+  const auto timer = inner->capture_timer();
   auto msg = inner->import_handshake(handshake_data);
+  inner->collect_commits();
 
   auto maybe_cached_state = std::optional<State>{};
-  auto node = inner->outbound_cache.extract(handshake_data);
+  auto node = inner->outbound_cache.extract(inner->commit_ref(handshake_data));
   if (!node.empty()) {
-    maybe_cached_state = node.mapped();
+    maybe_cached_state = std::move(node.mapped());
   }
 
   auto maybe_next_state =
-    inner->history.front().handle(msg, maybe_cached_state);
+    inner->state.handle(msg, maybe_cached_state);
   if (!maybe_next_state) {
+    timer.record(CaptureType::handle, handshake_data);
     return false;
   }
 
-  inner->history.emplace_front(opt::get(maybe_next_state));
+  inner->enter_epoch(std::move(opt::get(maybe_next_state)));
+  timer.record(CaptureType::handle, handshake_data);
   return true;
 }
 
 epoch_t
 Session::epoch() const
 {
-  return inner->history.front().epoch();
+  return inner->state.epoch();
 }
 
 LeafIndex
 Session::index() const
 {
-  return inner->history.front().index();
+  return inner->state.index();
 }
 
 CipherSuite
 Session::cipher_suite() const
 {
-  return inner->history.front().cipher_suite();
+  return inner->state.cipher_suite();
 }
 
 const ExtensionList&
 Session::extensions() const
 {
-  return inner->history.front().extensions();
+  return inner->state.extensions();
 }
 
 const TreeKEMPublicKey&
 Session::tree() const
 {
-  return inner->history.front().tree();
+  return inner->state.tree();
 }
 
 bytes
@@ -369,47 +1219,132 @@ Session::do_export(const std::string& label,
                    const bytes& context,
                    size_t size) const
 {
-  return inner->history.front().do_export(label, context, size);
+  return inner->state.do_export(label, context, size);
 }
 
 GroupInfo
 Session::group_info() const
 {
-  return inner->history.front().group_info();
+  return inner->state.group_info();
+}
+
+bytes
+Session::group_info_data(bool inline_tree) const
+{
+  return inner->state.group_info_data(inline_tree);
 }
 
 std::vector<LeafNode>
 Session::roster() const
 {
-  return inner->history.front().roster();
+  return inner->state.roster();
 }
 
 bytes
 Session::authentication_secret() const
 {
-  return inner->history.front().authentication_secret();
+  return inner->state.authentication_secret();
+}
+
+std::shared_ptr<const EpochSnapshot>
+Session::snapshot() const
+{
+  return std::atomic_load(&inner->published);
+}
+
+GroupMemoryUsage
+Session::memory_usage() const
+{
+  auto usage = inner->state.memory_usage();
+  usage += inner->history.memory_usage();
+  return usage;
 }
 
 bytes
 Session::protect(const bytes& plaintext)
 {
-  auto msg = inner->history.front().protect({}, plaintext, 0);
-  return tls::marshal(msg);
+  const auto timer = inner->capture_timer();
+  auto msg = inner->state.protect({}, plaintext, 0);
+  auto data = serialize(msg);
+  timer.record(CaptureType::protect, data, plaintext.size());
+  return data;
+}
+
+void
+Session::protect_into(const bytes& plaintext, bytes& out)
+{
+  const auto timer = inner->capture_timer();
+  const auto start = out.size();
+  inner->state.protect_into({}, plaintext, 0, out);
+  log::Metrics::count(log::Counter::bytes_serialized, out.size() - start);
+  if (inner->capture_sink) {
+    timer.record(
+      CaptureType::protect, out.slice(start, out.size()), plaintext.size());
+  }
 }
 
 // TODO(rlb@ipv.sx): It would be good to expose identity information
 // here, since ciphertexts are authenticated per sender.  Who sent
 // this ciphertext?
 bytes
-Session::unprotect(const bytes& ciphertext)
+Session::unprotect(const bytes& ciphertext) const
 {
+  // Find the epoch first, so that a message for an epoch that is no longer
+  // held is rejected without being decoded
+  const auto header = MLSMessage::peek_header(ciphertext);
+  if (header.wire_format != WireFormat::mls_plaintext &&
+      header.wire_format != WireFormat::mls_ciphertext) {
+    throw InvalidParameterError("MLSMessage has no epoch");
+  }
+
+  if (header.epoch != inner->state.epoch() &&
+      inner->history.find(header.epoch) == nullptr) {
+    throw MissingStateError("No state for epoch");
+  }
+
+  const auto timer = inner->capture_timer();
   auto ciphertext_obj = tls::get<MLSMessage>(ciphertext);
-  auto& state = inner->for_epoch(ciphertext_obj.epoch());
-  auto [aad, pt] = state.unprotect(ciphertext_obj);
+  auto [aad, pt] = inner->unprotect(ciphertext_obj);
   silence_unused(aad);
+  timer.record(CaptureType::unprotect, ciphertext);
   return pt;
 }
 
+std::vector<bytes>
+Session::protect_batch(const std::vector<bytes>& plaintexts)
+{
+  auto msgs = inner->state.protect_batch({}, plaintexts, 0);
+  return stdx::transform<bytes>(
+    msgs, [](const auto& msg) { return serialize(msg); });
+}
+
+std::vector<bytes>
+Session::unprotect_batch(const std::vector<bytes>& ciphertexts) const
+{
+  // Group the ciphertexts by epoch, so that each epoch's state handles its
+  // messages as one batch
+  auto by_epoch = std::map<epoch_t, std::vector<size_t>>{};
+  auto msgs = std::vector<MLSMessage>{};
+  msgs.reserve(ciphertexts.size());
+  for (const auto& ciphertext : ciphertexts) {
+    msgs.push_back(tls::get<MLSMessage>(ciphertext));
+    by_epoch[msgs.back().epoch()].push_back(msgs.size() - 1);
+  }
+
+  auto plaintexts = std::vector<bytes>(ciphertexts.size());
+  for (const auto& [epoch, indices] : by_epoch) {
+    auto batch = stdx::transform<MLSMessage>(
+      indices, [&](auto i) { return std::move(msgs.at(i)); });
+
+    auto results = inner->unprotect_batch(epoch, batch);
+    for (size_t i = 0; i < indices.size(); i++) {
+      plaintexts.at(indices[i]) = std::move(std::get<1>(results[i]));
+    }
+  }
+
+  return plaintexts;
+}
+
 bool
 operator==(const Session& lhs, const Session& rhs)
 {
@@ -417,9 +1352,19 @@ operator==(const Session& lhs, const Session& rhs)
     return false;
   }
 
-  auto size = std::min(lhs.inner->history.size(), rhs.inner->history.size());
-  for (size_t i = 0; i < size; i += 1) {
-    if (lhs.inner->history.at(i) != rhs.inner->history.at(i)) {
+  if (lhs.inner->state != rhs.inner->state) {
+    return false;
+  }
+
+  // Compare the past epochs that both sessions still hold
+  const auto current = lhs.inner->state.epoch();
+  const auto depth =
+    std::min(lhs.inner->history.capacity(), rhs.inner->history.capacity());
+  for (size_t i = 1; i <= depth && i <= current; i += 1) {
+    const auto* lhs_epoch = lhs.inner->history.find(current - i);
+    const auto* rhs_epoch = rhs.inner->history.find(current - i);
+    if (lhs_epoch != nullptr && rhs_epoch != nullptr &&
+        *lhs_epoch != *rhs_epoch) {
       return false;
     }
   }
@@ -0,0 +1,305 @@
+#include <mls/sframe.h>
+
+#include <limits>
+
+namespace mls {
+
+///
+/// SFrameHeader
+///
+
+// The number of bytes needed to carry a value in an extended header field
+static size_t
+min_size(uint64_t value)
+{
+  auto size = size_t(1);
+  while (size < sizeof(value) && (value >> (8 * size)) > 0) {
+    size += 1;
+  }
+  return size;
+}
+
+static void
+append_big_endian(bytes& data, uint64_t value, size_t size)
+{
+  for (size_t i = size; i > 0; i--) {
+    data.as_vec().push_back(static_cast<uint8_t>(value >> (8 * (i - 1))));
+  }
+}
+
+static uint64_t
+read_big_endian(bytes_view data)
+{
+  auto value = uint64_t(0);
+  for (const auto byte : data) {
+    value = (value << 8) | byte;
+  }
+  return value;
+}
+
+// Each field takes three bits in the first byte, either holding the value
+// itself or, with the extension flag set, the size of the value minus one
+static constexpr uint8_t short_limit = 0x08;
+static constexpr uint8_t field_mask = 0x07;
+static constexpr uint8_t kid_extended = 0x80;
+static constexpr uint8_t ctr_extended = 0x08;
+static constexpr int kid_shift = 4;
+
+bytes
+SFrameHeader::encode() const
+{
+  auto config = uint8_t(0);
+  auto kid_size = size_t(0);
+  auto ctr_size = size_t(0);
+
+  if (key_id < short_limit) {
+    config |= static_cast<uint8_t>(key_id << kid_shift);
+  } else {
+    kid_size = min_size(key_id);
+    config |= kid_extended | static_cast<uint8_t>((kid_size - 1) << kid_shift);
+  }
+
+  if (counter < short_limit) {
+    config |= static_cast<uint8_t>(counter);
+  } else {
+    ctr_size = min_size(counter);
+    config |= ctr_extended | static_cast<uint8_t>(ctr_size - 1);
+  }
+
+  auto data = bytes{ config };
+  append_big_endian(data, key_id, kid_size);
+  append_big_endian(data, counter, ctr_size);
+  return data;
+}
+
+std::tuple<SFrameHeader, size_t>
+SFrameHeader::decode(bytes_view data)
+{
+  if (data.empty()) {
+    throw ProtocolError("Truncated SFrame header");
+  }
+
+  const auto config = data.data()[0];
+  const auto kid_field =
+    static_cast<uint8_t>((config >> kid_shift) & field_mask);
+  const auto ctr_field = static_cast<uint8_t>(config & field_mask);
+
+  const auto kid_size = (config & kid_extended) ? size_t(kid_field) + 1 : 0;
+  const auto ctr_size = (config & ctr_extended) ? size_t(ctr_field) + 1 : 0;
+  const auto size = 1 + kid_size + ctr_size;
+  if (data.size() < size) {
+    throw ProtocolError("Truncated SFrame header");
+  }
+
+  auto header = SFrameHeader{ kid_field, ctr_field };
+  if (kid_size > 0) {
+    header.key_id = read_big_endian(data.slice(1, 1 + kid_size));
+  }
+
+  if (ctr_size > 0) {
+    header.counter = read_big_endian(data.slice(1 + kid_size, size));
+  }
+
+  return { header, size };
+}
+
+///
+/// SFrameKeyProvider
+///
+
+static const hpke::KDF&
+sframe_kdf(SFrameKeyProvider::CipherSuite suite)
+{
+  switch (suite) {
+    case SFrameKeyProvider::CipherSuite::AES_128_GCM_SHA256_128:
+      return hpke::KDF::get<hpke::KDF::ID::HKDF_SHA256>();
+
+    case SFrameKeyProvider::CipherSuite::AES_256_GCM_SHA512_128:
+      return hpke::KDF::get<hpke::KDF::ID::HKDF_SHA512>();
+
+    default:
+      throw InvalidParameterError("Unsupported SFrame cipher suite");
+  }
+}
+
+static const hpke::AEAD&
+sframe_aead(SFrameKeyProvider::CipherSuite suite)
+{
+  switch (suite) {
+    case SFrameKeyProvider::CipherSuite::AES_128_GCM_SHA256_128:
+      return hpke::AEAD::get<hpke::AEAD::ID::AES_128_GCM>();
+
+    case SFrameKeyProvider::CipherSuite::AES_256_GCM_SHA512_128:
+      return hpke::AEAD::get<hpke::AEAD::ID::AES_256_GCM>();
+
+    default:
+      throw InvalidParameterError("Unsupported SFrame cipher suite");
+  }
+}
+
+// Enough epochs to tell apart everything a group is likely to still be using,
+// while keeping the table of epochs small
+static constexpr uint8_t max_epoch_bits = 8;
+
+static uint8_t
+checked_epoch_bits(uint8_t epoch_bits)
+{
+  if (epoch_bits > max_epoch_bits) {
+    throw InvalidParameterError("Too many SFrame epoch bits");
+  }
+  return epoch_bits;
+}
+
+static const auto sframe_base_key_label = std::string("SFrame 1.0 Base Key");
+static const auto sframe_key_label = from_ascii("SFrame 1.0 Secret key ");
+static const auto sframe_salt_label = from_ascii("SFrame 1.0 Secret salt ");
+
+SFrameKeyProvider::SFrameKeyProvider(const SFrameParameters& params)
+  : suite(static_cast<CipherSuite>(params.cipher_suite))
+  , epoch_bits(checked_epoch_bits(params.epoch_bits))
+  , kdf(sframe_kdf(suite))
+  , aead(sframe_aead(suite))
+  , epochs(size_t(1) << epoch_bits)
+{
+}
+
+void
+SFrameKeyProvider::add_epoch(const State& state)
+{
+  add_epoch(state.epoch(),
+            state.index(),
+            state.do_export(sframe_base_key_label, {}, kdf.hash_size));
+}
+
+void
+SFrameKeyProvider::add_epoch(const Session& session)
+{
+  add_epoch(session.epoch(),
+            session.index(),
+            session.do_export(sframe_base_key_label, {}, kdf.hash_size));
+}
+
+void
+SFrameKeyProvider::add_epoch(epoch_t epoch, LeafIndex own_index, bytes secret)
+{
+  const auto slot = static_cast<size_t>(epoch % epochs.size());
+  epochs.at(slot) = Epoch{ epoch, own_index, std::move(secret), 0, {} };
+
+  if (!latest || opt::get(latest) < epoch) {
+    latest = epoch;
+  }
+}
+
+uint64_t
+SFrameKeyProvider::key_id(epoch_t epoch, LeafIndex sender) const
+{
+  const auto mask = epochs.size() - 1;
+  return (uint64_t(sender.val) << epoch_bits) | (epoch & mask);
+}
+
+SFrameKeyProvider::SenderKeys
+SFrameKeyProvider::derive_sender_keys(const Epoch& epoch,
+                                      LeafIndex sender) const
+{
+  // sender_base_key = HKDF-Expand(epoch_secret, uint32(index), Nh)
+  const auto sender_base_key =
+    kdf.expand(epoch.secret, tls::marshal(sender.val), kdf.hash_size);
+
+  // The key and salt for the sender's key ID, as in RFC 9605, Section 4.4.2
+  const auto kid = tls::marshal(key_id(epoch.epoch, sender));
+  const auto suite_id = tls::marshal(static_cast<uint16_t>(suite));
+  const auto sframe_secret = kdf.extract({}, sender_base_key);
+  const auto key_label = sframe_key_label + kid + suite_id;
+  const auto salt_label = sframe_salt_label + kid + suite_id;
+  auto derived = kdf.expand_multi(sframe_secret,
+                                  { { key_label, aead.key_size },
+                                    { salt_label, aead.nonce_size } });
+
+  return { std::move(derived.at(1)), aead.keyed(derived.at(0)) };
+}
+
+bytes
+SFrameKeyProvider::nonce(const SenderKeys& keys, uint64_t counter) const
+{
+  auto ctr = bytes(aead.nonce_size - sizeof(counter), 0);
+  append_big_endian(ctr, counter, sizeof(counter));
+  return keys.salt ^ ctr;
+}
+
+bytes
+SFrameKeyProvider::protect(bytes_view metadata, bytes_view plaintext)
+{
+  if (!latest) {
+    throw InvalidParameterError("No SFrame epoch");
+  }
+
+  auto& epoch = opt::get(epochs.at(opt::get(latest) % epochs.size()));
+  auto it = epoch.senders.find(epoch.own_index);
+  if (it == epoch.senders.end()) {
+    it = epoch.senders
+           .emplace(epoch.own_index, derive_sender_keys(epoch, epoch.own_index))
+           .first;
+  }
+
+  auto& keys = it->second;
+
+  const auto header =
+    SFrameHeader{ key_id(epoch.epoch, epoch.own_index), epoch.counter };
+  epoch.counter += 1;
+
+  // The AAD is the header followed by the metadata
+  auto ciphertext = header.encode();
+  auto aad = ciphertext + bytes(metadata);
+  ciphertext += keys.aead->seal(nonce(keys, header.counter), aad, plaintext);
+  return ciphertext;
+}
+
+bytes
+SFrameKeyProvider::unprotect(bytes_view metadata, bytes_view ciphertext)
+{
+  const auto [header, header_size] = SFrameHeader::decode(ciphertext);
+
+  const auto mask = epochs.size() - 1;
+  auto& slot = epochs.at(static_cast<size_t>(header.key_id & mask));
+  if (!slot) {
+    throw MissingStateError("No SFrame keys for epoch");
+  }
+
+  const auto sender_val = header.key_id >> epoch_bits;
+  if (sender_val > std::numeric_limits<uint32_t>::max()) {
+    throw ProtocolError("Invalid SFrame key ID");
+  }
+
+  // A new sender's keys are only kept once a frame has decrypted under them,
+  // so that forged key IDs cannot fill up the table
+  auto& epoch = opt::get(slot);
+  const auto sender = LeafIndex{ static_cast<uint32_t>(sender_val) };
+  auto it = epoch.senders.find(sender);
+  auto new_keys = std::optional<SenderKeys>{};
+  if (it == epoch.senders.end()) {
+    new_keys = derive_sender_keys(epoch, sender);
+  }
+
+  auto& keys = new_keys ? opt::get(new_keys) : it->second;
+  auto aad = bytes(ciphertext.slice(0, header_size)) + bytes(metadata);
+  auto pt = std::optional<bytes>{};
+  try {
+    pt = keys.aead->open(nonce(keys, header.counter),
+                         aad,
+                         ciphertext.slice(header_size, ciphertext.size()));
+  } catch (const std::runtime_error&) {
+    // The AEAD may also report an authentication failure by throwing
+  }
+
+  if (!pt) {
+    throw ProtocolError("SFrame decryption failure");
+  }
+
+  if (new_keys) {
+    epoch.senders.emplace(sender, std::move(opt::get(new_keys)));
+  }
+
+  return opt::get(pt);
+}
+
+} // namespace mls
@@ -1,7 +1,398 @@
+#include <mls/log.h>
 #include <mls/state.h>
 
+#include "probe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <set>
+
+using mls::log::Histogram;
+using mls::log::Metrics;
+using mls::log::ScopedTimer;
+
 namespace mls {
 
+///
+/// Checks on the public group state, shared by State and GroupObserver
+///
+
+// The checks on an imported tree beyond its tree hash, which may be deferred
+static void
+validate_public_tree(const TreeKEMPublicKey& tree,
+                     const bytes& group_id,
+                     const TreeHashOptions& hash_opts)
+{
+  if (!tree.parent_hash_valid(hash_opts)) {
+    throw InvalidParameterError("Invalid tree");
+  }
+
+  if (!tree.leaf_signatures_valid(group_id, hash_opts.executor)) {
+    throw InvalidParameterError("Invalid leaf node signature in tree");
+  }
+}
+
+// Import a tree and check it against the tree hash in the GroupInfo
+static TreeKEMPublicKey
+import_public_tree_unvalidated(CipherSuite suite,
+                               const bytes& tree_hash,
+                               const std::optional<TreeKEMPublicKey>& external,
+                               const ExtensionList& extensions,
+                               const TreeHashOptions& hash_opts)
+{
+  MLS_PROBE(import_tree_start, probe_suite(suite));
+
+  auto tree = TreeKEMPublicKey(suite);
+  if (external) {
+    tree = opt::get(external);
+  } else if (const auto* extn = extensions.get<RatchetTreeExtension>()) {
+    tree = extn->tree;
+  } else if (const auto* compressed =
+               extensions.get<CompressedRatchetTreeExtension>()) {
+    tree = compressed->tree;
+  } else {
+    throw InvalidParameterError("No tree available");
+  }
+
+  tree.suite = suite;
+
+  tree.set_hash_all(hash_opts);
+  if (tree.root_hash() != tree_hash) {
+    throw InvalidParameterError("Tree does not match GroupInfo");
+  }
+
+  MLS_PROBE(import_tree_done, probe_suite(suite), tree.size.val);
+  return tree;
+}
+
+static TreeKEMPublicKey
+import_public_tree(CipherSuite suite,
+                   const bytes& group_id,
+                   const bytes& tree_hash,
+                   const std::optional<TreeKEMPublicKey>& external,
+                   const ExtensionList& extensions,
+                   const TreeHashOptions& hash_opts)
+{
+  auto tree = import_public_tree_unvalidated(
+    suite, tree_hash, external, extensions, hash_opts);
+  validate_public_tree(tree, group_id, hash_opts);
+  return tree;
+}
+
+// Carry the tree in the compressed encoding if the group requires every member
+// to support it and the tree is within its limits, and otherwise in the plain
+// encoding
+static void
+add_tree_extension(ExtensionList& extensions,
+                   const ExtensionList& group_extensions,
+                   const TreeKEMPublicKey& tree)
+{
+  const auto* required = group_extensions.get<RequiredCapabilitiesExtension>();
+  const auto negotiated =
+    required != nullptr &&
+    stdx::contains(required->extensions,
+                   ExtensionType::compressed_ratchet_tree);
+  if (negotiated && tree.compressible()) {
+    extensions.add(CompressedRatchetTreeExtension{ tree });
+    return;
+  }
+
+  extensions.add(RatchetTreeExtension{ tree });
+}
+
+// A LeafNode in an Add KeyPackage must not have the same leaf_node.public_key
+// or signature_key as any KeyPackage for a current member.  The joiner must
+// support all credential types in use by other members, and vice versa.
+static void
+check_add_leaf_node(const TreeKEMPublicKey& tree,
+                    const LeafNode& leaf,
+                    std::optional<LeafIndex> except)
+{
+  if (tree.has_encryption_key(leaf.encryption_key, except) ||
+      tree.has_signature_key(leaf.signature_key, except)) {
+    throw ProtocolError("Duplicate parameters in new KeyPackage");
+  }
+
+  if (!tree.credentials_supported(leaf.capabilities, except)) {
+    throw ProtocolError("Member credential not supported by joiner");
+  }
+
+  if (!tree.credential_supported_by_all(leaf.credential.type(), except)) {
+    throw ProtocolError("Joiner credential not supported by group member");
+  }
+}
+
+// The joiners added by one Commit must also meet these criteria with regard to
+// each other, as they would if they were added one at a time.
+static void
+check_joiner_leaf_nodes(const TreeKEMPublicKey& tree,
+                        const std::vector<LeafNode>& leaves)
+{
+  auto encryption_keys = std::set<bytes>{};
+  auto signature_keys = std::set<bytes>{};
+  auto credential_types = std::map<CredentialType, size_t>{};
+  for (const auto& leaf : leaves) {
+    check_add_leaf_node(tree, leaf, std::nullopt);
+
+    const auto new_hpke_key = encryption_keys.insert(leaf.encryption_key.data);
+    const auto new_sig_key = signature_keys.insert(leaf.signature_key.data);
+    if (!new_hpke_key.second || !new_sig_key.second) {
+      throw ProtocolError("Duplicate parameters in new KeyPackage");
+    }
+
+    credential_types[leaf.credential.type()] += 1;
+  }
+
+  // Each joiner must support the credential types of the other joiners
+  for (const auto& leaf : leaves) {
+    const auto own_type = leaf.credential.type();
+    for (const auto& [type, count] : credential_types) {
+      if (type == own_type && count == 1) {
+        continue;
+      }
+
+      if (!stdx::contains(leaf.capabilities.credentials, type)) {
+        throw ProtocolError("Joiner credential not supported by other joiner");
+      }
+    }
+  }
+}
+
+// A KeyPackage in an Update must meet the same uniqueness criteria as for an
+// Add, except with regard to the KeyPackage it replaces.
+static void
+check_update_leaf_node(const TreeKEMPublicKey& tree,
+                       LeafIndex target,
+                       const LeafNode& leaf,
+                       LeafNodeSource required_source)
+{
+  check_add_leaf_node(tree, leaf, target);
+
+  if (leaf.source() != required_source) {
+    throw ProtocolError("LeafNode in Update has incorrect LeafNodeSource");
+  }
+
+  const auto* tree_leaf = tree.leaf_node_ptr(target);
+  if (tree_leaf == nullptr) {
+    return;
+  }
+
+  if (tree_leaf->encryption_key == leaf.encryption_key) {
+    throw ProtocolError("Update without a fresh init key");
+  }
+}
+
+static std::vector<LeafIndex>
+remove_members(TreeKEMPublicKey& tree, const std::vector<Remove>& removes)
+{
+  auto removed = std::set<LeafIndex>{};
+  for (const auto& remove : removes) {
+    // A second Remove of the same member is a Remove of a non-member
+    const auto is_new = removed.insert(remove.removed).second;
+    if (!is_new || !tree.has_leaf(remove.removed)) {
+      throw ProtocolError("Attempt to remove non-member");
+    }
+  }
+
+  auto locations = stdx::transform<LeafIndex>(
+    removes, [](const auto& remove) { return remove.removed; });
+  tree.blank_paths(locations);
+  return locations;
+}
+
+// Whether every member supports `exts`, i.e., whether verify_extension_support()
+// would pass for every leaf
+static bool
+extensions_supported(const TreeKEMPublicKey& tree, const ExtensionList& exts)
+{
+  auto leaf = LeafNode{};
+  leaf.capabilities = tree.common_capabilities();
+  return leaf.verify_extension_support(exts);
+}
+
+// Apply the proposals of a Commit to a tree and its group context extensions.
+// Updates are applied first, then Removes, then Adds, then any change to the
+// extensions.  Proposals that do not change the tree, such as ExternalInit and
+// PreSharedKey, are skipped.  Each Update is handed to `apply_update`, since a
+// member applies its own Update with the secret it cached.  Returns the
+// removed leaves and the joiners' leaves.
+template<typename Cached, typename ApplyUpdate>
+static std::tuple<std::vector<LeafIndex>, std::vector<LeafIndex>>
+apply_proposals(TreeKEMPublicKey& tree,
+                ExtensionList& extensions,
+                const std::vector<Cached>& proposals,
+                const ApplyUpdate& apply_update)
+{
+  auto removes = std::vector<Remove>{};
+  auto joiners = std::vector<LeafNode>{};
+  const ExtensionList* new_extensions = nullptr;
+  for (const auto& cached : proposals) {
+    const auto& content = cached.proposal.content;
+    switch (cached.proposal.proposal_type()) {
+      case ProposalType::update:
+        if (!cached.sender) {
+          throw ProtocolError("Update without target leaf");
+        }
+
+        apply_update(opt::get(cached.sender), var::get<Update>(content));
+        break;
+
+      case ProposalType::remove:
+        removes.push_back(var::get<Remove>(content));
+        break;
+
+      case ProposalType::add:
+        joiners.push_back(var::get<Add>(content).key_package.leaf_node);
+        break;
+
+      case ProposalType::group_context_extensions:
+        new_extensions =
+          &var::get<GroupContextExtensions>(content).group_context_extensions;
+        break;
+
+      case ProposalType::psk:
+      case ProposalType::reinit:
+      case ProposalType::external_init:
+        break;
+
+      default:
+        throw ProtocolError("Unsupported proposal type");
+    }
+  }
+
+  auto removed = std::vector<LeafIndex>{};
+  if (!removes.empty()) {
+    removed = remove_members(tree, removes);
+  }
+
+  auto joiner_locations = std::vector<LeafIndex>{};
+  if (!joiners.empty()) {
+    check_joiner_leaf_nodes(tree, joiners);
+    joiner_locations = tree.add_leaves(joiners);
+  }
+
+  // TODO(RLB): Update spec to clarify that you MUST verify that the new
+  // extensions are compatible with all members.
+  if (new_extensions != nullptr) {
+    if (!extensions_supported(tree, *new_extensions)) {
+      throw ProtocolError("Unsupported extensions in GroupContextExtensions");
+    }
+
+    extensions = *new_extensions;
+  }
+
+  return { removed, joiner_locations };
+}
+
+// Verify the signatures on the KeyPackages in any Add proposals
+template<typename Cached>
+static void
+verify_add_key_packages(CipherSuite suite,
+                        const std::vector<Cached>& proposals,
+                        const Executor& executor)
+{
+  auto checks = std::vector<SignatureVerification>{};
+  for (const auto& cached : proposals) {
+    if (cached.proposal.proposal_type() != ProposalType::add) {
+      continue;
+    }
+
+    const auto& add = var::get<Add>(cached.proposal.content);
+    const auto& key_package = add.key_package;
+    if (key_package.leaf_node.source() != LeafNodeSource::key_package) {
+      throw ProtocolError("Add with a LeafNode not from a KeyPackage");
+    }
+
+    for (auto& check : key_package.signature_verifications()) {
+      checks.push_back(std::move(check));
+    }
+  }
+
+  if (!SignaturePublicKey::verify_batch(suite, checks, executor)) {
+    throw ProtocolError("Invalid signature on key package");
+  }
+}
+
+// For an external Commit, identify the new joiner's location in the new tree
+// from the Add that is carried by value in the Commit
+template<typename Cached>
+static LeafIndex
+external_joiner_location(const Commit& commit,
+                         const std::vector<Cached>& proposals,
+                         const std::vector<LeafIndex>& joiner_locations)
+{
+  auto add_index = size_t(0);
+  for (size_t i = 0; i < commit.proposals.size(); i++) {
+    if (proposals[i].proposal.proposal_type() != ProposalType::add) {
+      continue;
+    }
+
+    if (!var::holds_alternative<ProposalRef>(commit.proposals[i].content)) {
+      return joiner_locations[add_index];
+    }
+
+    add_index += 1;
+  }
+
+  throw ProtocolError("Unable to locate external joiner");
+}
+
+// Signature verification over a handshake message, with the key for the
+// sender found in the tree, the group's external senders, or the message
+static bool
+verify_signature(CipherSuite suite,
+                 const TreeKEMPublicKey& tree,
+                 const ExtensionList& extensions,
+                 const MLSAuthenticatedContent& content_auth,
+                 const GroupContext& ctx)
+{
+  const auto& sender = content_auth.content.sender.sender;
+  const auto& content = content_auth.content.content;
+  switch (content_auth.content.sender.sender_type()) {
+    case SenderType::member: {
+      const auto index = var::get<MemberSender>(sender).sender;
+      const auto* leaf = tree.leaf_node_ptr(index);
+      if (leaf == nullptr) {
+        throw InvalidParameterError("Signature from blank node");
+      }
+
+      return content_auth.verify(suite, leaf->signature_key, ctx);
+    }
+
+    case SenderType::external: {
+      const auto& ext_sender = var::get<ExternalSenderIndex>(sender);
+      const auto* senders_ext = extensions.get<ExternalSendersExtension>();
+      if (senders_ext == nullptr) {
+        throw InvalidParameterError("No external senders extension");
+      }
+
+      const auto& senders = senders_ext->senders;
+      const auto& pub = senders.at(ext_sender.sender_index).signature_key;
+      return content_auth.verify(suite, pub, ctx);
+    }
+
+    case SenderType::new_member_proposal: {
+      const auto& proposal = var::get<Proposal>(content);
+      const auto& add = var::get<Add>(proposal.content);
+      const auto& pub = add.key_package.leaf_node.signature_key;
+      return content_auth.verify(suite, pub, ctx);
+    }
+
+    case SenderType::new_member_commit: {
+      const auto& commit = var::get<Commit>(content);
+      const auto& path = opt::get(commit.path);
+      const auto& pub = path.leaf_node.signature_key;
+      return content_auth.verify(suite, pub, ctx);
+    }
+
+    default:
+      throw ProtocolError("Invalid sender type");
+  }
+}
+
 ///
 /// Constructors
 ///
@@ -34,7 +425,7 @@ State::State(bytes group_id,
   }
 
   // XXX(RLB): Convert KeyScheduleEpoch to take GroupContext?
-  auto ctx = tls::marshal(group_context());
+  const auto& ctx = group_context_cache().encoded;
   _key_schedule =
     KeyScheduleEpoch(_suite, random_bytes(_suite.secret_size()), ctx);
   _keys = _key_schedule.encryption_keys(_tree.size);
@@ -45,32 +436,14 @@ State::State(bytes group_id,
 }
 
 TreeKEMPublicKey
-State::import_tree(const bytes& tree_hash,
+State::import_tree(const bytes& group_id,
+                   const bytes& tree_hash,
                    const std::optional<TreeKEMPublicKey>& external,
-                   const ExtensionList& extensions)
+                   const ExtensionList& extensions,
+                   const TreeHashOptions& hash_opts)
 {
-  auto tree = TreeKEMPublicKey(_suite);
-  auto maybe_tree_extn = extensions.find<RatchetTreeExtension>();
-  if (external) {
-    tree = opt::get(external);
-  } else if (maybe_tree_extn) {
-    tree = opt::get(maybe_tree_extn).tree;
-  } else {
-    throw InvalidParameterError("No tree available");
-  }
-
-  tree.suite = _suite;
-
-  tree.set_hash_all();
-  if (tree.root_hash() != tree_hash) {
-    throw InvalidParameterError("Tree does not match GroupInfo");
-  }
-
-  if (!tree.parent_hash_valid()) {
-    throw InvalidParameterError("Invalid tree");
-  }
-
-  return tree;
+  return import_public_tree(
+    _suite, group_id, tree_hash, external, extensions, hash_opts);
 }
 
 State::State(SignaturePrivateKey sig_priv,
@@ -79,9 +452,11 @@ State::State(SignaturePrivateKey sig_priv,
   : _suite(group_info.group_context.cipher_suite)
   , _group_id(group_info.group_context.group_id)
   , _epoch(group_info.group_context.epoch)
-  , _tree(import_tree(group_info.group_context.tree_hash,
+  , _tree(import_tree(group_info.group_context.group_id,
+                      group_info.group_context.tree_hash,
                       tree,
-                      group_info.extensions))
+                      group_info.extensions,
+                      {}))
   , _transcript_hash(_suite,
                      group_info.group_context.confirmed_transcript_hash,
                      group_info.confirmation_tag)
@@ -105,6 +480,102 @@ State::State(const HPKEPrivateKey& init_priv,
              const KeyPackage& kp,
              const Welcome& welcome,
              const std::optional<TreeKEMPublicKey>& tree)
+  : State(init_priv,
+          std::move(leaf_priv),
+          std::move(sig_priv),
+          kp,
+          welcome,
+          tree,
+          TreeHashOptions{})
+{
+}
+
+State::State(const HPKEPrivateKey& init_priv,
+             HPKEPrivateKey leaf_priv,
+             SignaturePrivateKey sig_priv,
+             const KeyPackage& kp,
+             const Welcome& welcome,
+             const std::optional<TreeKEMPublicKey>& tree,
+             const TreeHashOptions& hash_opts)
+  : State(init_priv,
+          std::move(leaf_priv),
+          std::move(sig_priv),
+          kp,
+          welcome,
+          tree,
+          JoinOptions{ hash_opts, false })
+{
+}
+
+State::State(const HPKEPrivateKey& init_priv,
+             HPKEPrivateKey leaf_priv,
+             SignaturePrivateKey sig_priv,
+             const KeyPackage& kp,
+             const Welcome& welcome,
+             const std::optional<TreeKEMPublicKey>& tree,
+             const JoinOptions& join_opts)
+  : State(init_priv,
+          std::move(leaf_priv),
+          std::move(sig_priv),
+          kp,
+          welcome,
+          tree,
+          nullptr,
+          nullptr,
+          {},
+          join_opts)
+{
+}
+
+State::State(const HPKEPrivateKey& init_priv,
+             HPKEPrivateKey leaf_priv,
+             SignaturePrivateKey sig_priv,
+             const KeyPackage& kp,
+             const Welcome& welcome,
+             const TreeSlice& slice,
+             const TreeSlice& signer_slice,
+             TreeFetcher fetch_tree,
+             const JoinOptions& join_opts)
+  : State(init_priv,
+          std::move(leaf_priv),
+          std::move(sig_priv),
+          kp,
+          welcome,
+          std::nullopt,
+          &slice,
+          &signer_slice,
+          std::move(fetch_tree),
+          join_opts)
+{
+}
+
+// The leaf at the start of a slice, once the slice has been checked against
+// the tree hash
+static const LeafNode&
+slice_leaf(CipherSuite suite, const TreeSlice& slice, const bytes& tree_hash)
+{
+  if (slice.tree_hash(suite) != tree_hash) {
+    throw InvalidParameterError("Tree slice does not match GroupInfo");
+  }
+
+  const auto& leaf = slice.direct_path_nodes.front();
+  if (leaf.blank()) {
+    throw InvalidParameterError("Blank leaf in tree slice");
+  }
+
+  return leaf.leaf_node();
+}
+
+State::State(const HPKEPrivateKey& init_priv,
+             HPKEPrivateKey leaf_priv,
+             SignaturePrivateKey sig_priv,
+             const KeyPackage& kp,
+             const Welcome& welcome,
+             const std::optional<TreeKEMPublicKey>& tree,
+             const TreeSlice* slice,
+             const TreeSlice* signer_slice,
+             TreeFetcher fetch_tree,
+             const JoinOptions& join_opts)
   : _suite(welcome.cipher_suite)
   , _epoch(0)
   , _tree(welcome.cipher_suite)
@@ -135,18 +606,58 @@ State::State(const HPKEPrivateKey& init_priv,
     throw InvalidParameterError("GroupInfo and Welcome ciphersuites disagree");
   }
 
-  // Import the tree from the argument or from the extension
-  _tree = import_tree(
-    group_info.group_context.tree_hash, tree, group_info.extensions);
+  const auto& group_id = group_info.group_context.group_id;
+  const auto& tree_hash = group_info.group_context.tree_hash;
+  const auto& hash_opts = join_opts.hash_opts;
+  const auto defer = join_opts.defer_tree_validation;
+  auto size = LeafCount{};
+  if (slice != nullptr) {
+    // Given slices, our leaf and the signer's are authenticated by the tree
+    // hash, which is all that is needed to verify the GroupInfo.  The rest of
+    // the tree is left to be fetched when it is first needed.
+    if (slice_leaf(_suite, *slice, tree_hash) != kp.leaf_node) {
+      throw InvalidParameterError("New joiner not in tree slice");
+    }
 
-  // Verify the signature on the GroupInfo
-  if (!group_info.verify(_tree)) {
-    throw InvalidParameterError("Invalid GroupInfo");
+    const auto& signer_leaf = slice_leaf(_suite, *signer_slice, tree_hash);
+    if (signer_slice->leaf_index != group_info.signer ||
+        !signer_leaf.verify(_suite, group_id)) {
+      throw InvalidParameterError("Invalid leaf node signature in tree");
+    }
+
+    if (!group_info.verify(_suite, signer_leaf)) {
+      throw InvalidParameterError("Invalid GroupInfo");
+    }
+
+    _index = slice->leaf_index;
+    size = slice->n_leaves;
+  } else {
+    // Import the tree from the argument or from the extension
+    if (defer) {
+      _tree = import_public_tree_unvalidated(
+        _suite, tree_hash, tree, group_info.extensions, hash_opts);
+    } else {
+      _tree = import_tree(
+        group_id, tree_hash, tree, group_info.extensions, hash_opts);
+    }
+
+    // Verify the signature on the GroupInfo
+    if (!group_info.verify(_tree)) {
+      throw InvalidParameterError("Invalid GroupInfo");
+    }
+
+    auto maybe_index = _tree.find(kp.leaf_node);
+    if (!maybe_index) {
+      throw InvalidParameterError("New joiner not in tree");
+    }
+
+    _index = opt::get(maybe_index);
+    size = _tree.size;
   }
 
   // Ingest the GroupSecrets and GroupInfo
   _epoch = group_info.group_context.epoch;
-  _group_id = group_info.group_context.group_id;
+  _group_id = group_id;
 
   _transcript_hash.confirmed =
     group_info.group_context.confirmed_transcript_hash;
@@ -154,28 +665,60 @@ State::State(const HPKEPrivateKey& init_priv,
 
   _extensions = group_info.group_context.extensions;
 
-  // Construct TreeKEM private key from parts provided
-  auto maybe_index = _tree.find(kp.leaf_node);
-  if (!maybe_index) {
-    throw InvalidParameterError("New joiner not in tree");
-  }
+  // With deferred validation, first check the parts of the tree we rely on
+  // right away: the signer's leaf and the parent nodes on our direct path,
+  // whose keys we hold.  The rest of the tree is checked in the background.
+  if (defer && slice == nullptr) {
+    const auto* signer_leaf = _tree.leaf_node_ptr(group_info.signer);
+    if (signer_leaf == nullptr || !signer_leaf->verify(_suite, group_id)) {
+      throw InvalidParameterError("Invalid leaf node signature in tree");
+    }
+
+    if (!_tree.direct_path_parent_hash_valid(_index)) {
+      throw InvalidParameterError("Invalid tree");
+    }
 
-  _index = opt::get(maybe_index);
+    auto done = std::make_shared<std::promise<void>>();
+    _tree_validation = done->get_future().share();
+    schedule(join_opts.scheduler, [done, tree = _tree, group_id, hash_opts]() {
+      try {
+        validate_public_tree(tree, group_id, hash_opts);
+        done->set_value();
+      } catch (...) {
+        done->set_exception(std::current_exception());
+      }
+    });
+  }
 
+  // Construct TreeKEM private key from parts provided.  Without the tree, the
+  // path secret is kept until the tree is fetched.
   auto ancestor = _index.ancestor(group_info.signer);
   auto path_secret = std::optional<bytes>{};
   if (secrets.path_secret) {
     path_secret = opt::get(secrets.path_secret).secret;
   }
 
+  if (slice != nullptr) {
+    _lazy = std::make_shared<LazyLoad>();
+    _lazy->pending_tree = PendingTree{
+      std::move(fetch_tree), tree_hash, hash_opts, ancestor, path_secret
+    };
+    path_secret = std::nullopt;
+  }
+
   _tree_priv = TreeKEMPrivateKey::joiner(
     _tree, _index, std::move(leaf_priv), ancestor, path_secret);
 
-  // Ratchet forward into the current epoch
-  auto group_ctx = tls::marshal(group_context());
+  // Ratchet forward into the current epoch.  The tree hash has been checked,
+  // so the GroupContext is taken from the GroupInfo, without the tree.
+  _group_context_cache = std::make_shared<const GroupContextCache>(
+    GroupContextCache{ group_info.group_context,
+                       tls::marshal(group_info.group_context) });
+
+  const auto& group_ctx = group_context_cache().encoded;
   _key_schedule = KeyScheduleEpoch(
     _suite, secrets.joiner_secret, { /* no PSKs */ }, group_ctx);
-  _keys = _key_schedule.encryption_keys(_tree.size);
+  _keys = _key_schedule.encryption_keys(size);
 
   // Verify the confirmation
   const auto confirmation_tag =
@@ -195,13 +738,13 @@ State::external_join(const bytes& leaf_secret,
 {
   auto initial_state = State(std::move(sig_priv), group_info, tree);
 
-  const auto maybe_external_pub =
-    group_info.extensions.find<ExternalPubExtension>();
-  if (!maybe_external_pub) {
+  const auto* external_pub_ext =
+    group_info.extensions.get<ExternalPubExtension>();
+  if (external_pub_ext == nullptr) {
     throw InvalidParameterError("No external pub in GroupInfo");
   }
 
-  const auto& external_pub = opt::get(maybe_external_pub).external_pub;
+  const auto& external_pub = external_pub_ext->external_pub;
 
   auto add = initial_state.add_proposal(kp);
   auto opts = CommitOpts{ { add }, false, false, {} };
@@ -231,15 +774,294 @@ State::new_member_add(const bytes& group_id,
 }
 
 ///
-/// Proposal and commit factories
+/// Persistence
 ///
-template<typename Inner>
-MLSMessage
-State::protect_full(Inner&& inner_content, const MessageOpts& msg_opts)
+
+struct State::Serialized
 {
-  auto content_auth = sign({ MemberSender{ _index } },
-                           inner_content,
-                           msg_opts.authenticated_data,
+  CipherSuite suite;
+  bytes group_id;
+  epoch_t epoch = 0;
+  bytes tree_hash;
+  TreeKEMPrivateKey tree_priv;
+  bytes confirmed_transcript_hash;
+  bytes interim_transcript_hash;
+  ExtensionList extensions;
+  KeyScheduleEpoch key_schedule;
+  LeafIndex index;
+  bytes identity_priv;
+  std::vector<CachedProposal> pending_proposals;
+  std::optional<CachedUpdate> cached_update;
+
+  TLS_SERIALIZABLE(suite,
+                   group_id,
+                   epoch,
+                   tree_hash,
+                   tree_priv,
+                   confirmed_transcript_hash,
+                   interim_transcript_hash,
+                   extensions,
+                   key_schedule,
+                   index,
+                   identity_priv,
+                   pending_proposals,
+                   cached_update)
+};
+
+// Write a value as a length-prefixed section
+template<typename T>
+static void
+write_section(tls::ostream& str, const T& value)
+{
+  tls::varint::encode(str, tls::encoded_size(value));
+  str << value;
+}
+
+// Read a length-prefixed section, which must hold exactly one value
+static tls::istream
+section_stream(tls::istream& str)
+{
+  auto size = uint64_t(0);
+  tls::varint::decode(str, size);
+  return str.sub_stream(size);
+}
+
+template<typename T>
+static void
+read_section(tls::istream& str, T& value)
+{
+  auto section = section_stream(str);
+  section >> value;
+  if (!section.empty()) {
+    throw ProtocolError("Trailing data in serialized state");
+  }
+}
+
+bytes
+State::serialize() const
+{
+  hydrate();
+  wait_for_tree_validation();
+
+  const auto serialized = Serialized{
+    _suite,
+    _group_id,
+    _epoch,
+    _tree.root_hash(),
+    _tree_priv,
+    _transcript_hash.confirmed,
+    _transcript_hash.interim,
+    _extensions,
+    _key_schedule,
+    _index,
+    _identity_priv.data,
+    _pending_proposals,
+    _cached_update,
+  };
+
+  auto str = tls::ostream{};
+  str << serialization_version;
+  write_section(str, serialized);
+  write_section(str, _keys);
+  write_section(str, _tree);
+  return str.bytes();
+}
+
+State
+State::deserialize(const uint8_t* data, size_t size)
+{
+  auto str = tls::istream(data, size);
+  auto state = read_state(str);
+  state.load_sections(str);
+  return state;
+}
+
+State
+State::deserialize(const bytes& data)
+{
+  return deserialize(data.data(), data.size());
+}
+
+State
+State::deserialize_lazy(const uint8_t* data, size_t size, Loader loader)
+{
+  if (!loader) {
+    throw InvalidParameterError("A lazily restored state needs a loader");
+  }
+
+  auto str = tls::istream(data, size);
+  auto state = read_state(str);
+
+  const auto restored_size = size - str.size();
+  const auto restored = bytes(std::vector<uint8_t>(data, data + restored_size));
+  state._lazy = std::make_shared<LazyLoad>();
+  state._lazy->loader = std::move(loader);
+  state._lazy->restored_digest = state._suite.digest().hash(restored);
+  return state;
+}
+
+State
+State::deserialize_lazy(const bytes& data, Loader loader)
+{
+  return deserialize_lazy(data.data(), data.size(), std::move(loader));
+}
+
+State
+State::read_state(tls::istream& str)
+{
+  auto version = uint16_t(0);
+  str >> version;
+  if (version != serialization_version) {
+    throw ProtocolError("Unsupported serialized state version");
+  }
+
+  auto serialized = Serialized{};
+  read_section(str, serialized);
+  return State(std::move(serialized));
+}
+
+void
+State::load_sections(tls::istream& str) const
+{
+  auto keys = GroupKeySource{};
+  read_section(str, keys);
+
+  auto tree = TreeKEMPublicKey(_suite);
+  read_section(str, tree);
+
+  if (!str.empty()) {
+    throw ProtocolError("Trailing data in serialized state");
+  }
+
+  tree.suite = _suite;
+  tree.set_hash_all();
+  if (tree.root_hash() != group_context().tree_hash) {
+    throw ProtocolError("Serialized tree does not match its tree hash");
+  }
+
+  if (!tree.has_leaf(_index) || !_tree_priv.consistent(tree)) {
+    throw ProtocolError("Serialized private state does not match the tree");
+  }
+
+  _tree = std::move(tree);
+  _keys = std::move(keys);
+  _keys.set_own_index(_index);
+}
+
+void
+State::load_tree(const PendingTree& pending) const
+{
+  auto tree = import_public_tree(_suite,
+                                 _group_id,
+                                 pending.tree_hash,
+                                 pending.fetch_tree(),
+                                 {},
+                                 pending.hash_opts);
+  if (!tree.has_leaf(_index)) {
+    throw ProtocolError("Fetched tree does not hold our leaf");
+  }
+
+  const auto leaf_priv = opt::get(_tree_priv.private_key(NodeIndex(_index)));
+  auto tree_priv = TreeKEMPrivateKey::joiner(
+    tree, _index, leaf_priv, pending.intersect, pending.path_secret);
+  if (!tree_priv.consistent(tree)) {
+    throw ProtocolError("Fetched tree does not match the private state");
+  }
+
+  _tree = std::move(tree);
+  _tree_priv = std::move(tree_priv);
+}
+
+void
+State::hydrate() const
+{
+  const auto lazy = std::atomic_load(&_lazy);
+  if (!lazy) {
+    return;
+  }
+
+  // Concurrent readers of a lazily restored state wait for the first of them
+  // to load it
+  const auto lock = std::lock_guard(lazy->mutex);
+  if (!std::atomic_load(&_lazy)) {
+    return;
+  }
+
+  if (lazy->pending_tree) {
+    load_tree(opt::get(lazy->pending_tree));
+    std::atomic_store(&_lazy, std::shared_ptr<LazyLoad>{});
+    return;
+  }
+
+  // The loaded state must be the one this state was restored from.  Its first
+  // section is compared by digest rather than parsed again.
+  const auto data = lazy->loader();
+  auto str = tls::istream(data.data(), data.size());
+
+  auto version = uint16_t(0);
+  str >> version;
+  if (version != serialization_version) {
+    throw ProtocolError("Unsupported serialized state version");
+  }
+
+  const auto skipped = section_stream(str);
+  silence_unused(skipped);
+
+  const auto restored_size = data.size() - str.size();
+  const auto restored = data.slice(0, restored_size);
+  if (_suite.digest().hash(restored) != lazy->restored_digest) {
+    throw ProtocolError("Loaded state is not the one restored");
+  }
+
+  load_sections(str);
+  std::atomic_store(&_lazy, std::shared_ptr<LazyLoad>{});
+}
+
+State::State(Serialized&& serialized)
+  : _suite(serialized.suite)
+  , _group_id(std::move(serialized.group_id))
+  , _epoch(serialized.epoch)
+  , _tree(_suite)
+  , _tree_priv(std::move(serialized.tree_priv))
+  , _transcript_hash(_suite)
+  , _extensions(std::move(serialized.extensions))
+  , _key_schedule(std::move(serialized.key_schedule))
+  , _index(serialized.index)
+  , _identity_priv(SignaturePrivateKey::parse(_suite, serialized.identity_priv))
+  , _cached_update(std::move(serialized.cached_update))
+{
+  for (auto& cached : serialized.pending_proposals) {
+    cache_proposal(std::move(cached));
+  }
+
+  _transcript_hash.confirmed = std::move(serialized.confirmed_transcript_hash);
+  _transcript_hash.interim = std::move(serialized.interim_transcript_hash);
+
+  // The group context is known from the saved tree hash, so it does not
+  // depend on the tree having been loaded
+  auto context = GroupContext{
+    _suite,
+    _group_id,
+    _epoch,
+    std::move(serialized.tree_hash),
+    _transcript_hash.confirmed,
+    _extensions,
+  };
+  auto encoded = tls::marshal(context);
+  _group_context_cache = std::make_shared<const GroupContextCache>(
+    GroupContextCache{ std::move(context), std::move(encoded) });
+}
+
+///
+/// Proposal and commit factories
+///
+template<typename Inner>
+MLSMessage
+State::protect_full(Inner&& inner_content, const MessageOpts& msg_opts)
+{
+  auto content_auth = sign({ MemberSender{ _index } },
+                           inner_content,
+                           msg_opts.authenticated_data,
                            msg_opts.encrypt);
   return protect(std::move(content_auth), msg_opts.padding_size);
 }
@@ -251,6 +1073,8 @@ State::sign(const Sender& sender,
             const bytes& authenticated_data,
             bool encrypt) const
 {
+  wait_for_tree_validation();
+
   auto content = MLSContent{
     _group_id, _epoch, sender, authenticated_data, { inner_content }
   };
@@ -267,6 +1091,8 @@ State::sign(const Sender& sender,
 MLSMessage
 State::protect(MLSAuthenticatedContent&& content_auth, size_t padding_size)
 {
+  hydrate();
+
   switch (content_auth.wire_format) {
     case WireFormat::mls_plaintext:
       return MLSPlaintext::protect(std::move(content_auth),
@@ -288,8 +1114,10 @@ State::protect(MLSAuthenticatedContent&& content_auth, size_t padding_size)
 }
 
 MLSAuthenticatedContent
-State::unprotect_to_content_auth(const MLSMessage& msg)
+State::unprotect_to_content_auth(const MLSMessage& msg) const
 {
+  hydrate();
+
   const auto unprotect = overloaded{
     [&](const MLSPlaintext& pt) -> MLSAuthenticatedContent {
       auto maybe_content_auth =
@@ -320,6 +1148,8 @@ State::unprotect_to_content_auth(const MLSMessage& msg)
 Proposal
 State::add_proposal(const KeyPackage& key_package) const
 {
+  hydrate();
+
   // Check that the key package is validly signed
   if (!key_package.verify()) {
     throw InvalidParameterError("Invalid signature on key package");
@@ -343,6 +1173,8 @@ State::add_proposal(const KeyPackage& key_package) const
 Proposal
 State::update_proposal(const bytes& leaf_secret, const LeafNodeOptions& opts)
 {
+  hydrate();
+
   if (_cached_update) {
     return { opt::get(_cached_update).proposal };
   }
@@ -361,12 +1193,16 @@ State::update_proposal(const bytes& leaf_secret, const LeafNodeOptions& opts)
 Proposal
 State::remove_proposal(RosterIndex index) const
 {
+  hydrate();
+
   return remove_proposal(leaf_for_roster_entry(index));
 }
 
 Proposal
 State::remove_proposal(LeafIndex removed) const
 {
+  hydrate();
+
   if (!_tree.has_leaf(removed)) {
     throw InvalidParameterError("Remove on blank leaf");
   }
@@ -377,6 +1213,8 @@ State::remove_proposal(LeafIndex removed) const
 Proposal
 State::group_context_extensions_proposal(ExtensionList exts) const
 {
+  hydrate();
+
   if (!extensions_supported(exts)) {
     throw InvalidParameterError("Unsupported extensions");
   }
@@ -432,6 +1270,15 @@ State::commit(const bytes& leaf_secret,
               const std::optional<KeyPackage>& joiner_key_package,
               const std::optional<HPKEPublicKey>& external_pub)
 {
+  hydrate();
+  wait_for_tree_validation();
+
+  const auto timer = ScopedTimer(Histogram::commit_time);
+  MLS_PROBE(commit_start, _tree.size.val, _epoch, probe_suite(_suite));
+  const auto probe_done = ProbeOnExit([&] {
+    MLS_PROBE(commit_done, _tree.size.val, _epoch, probe_suite(_suite));
+  });
+
   // Construct a commit from cached proposals
   // TODO(rlb) ignore some proposals:
   // * Update after Update
@@ -512,8 +1359,10 @@ State::commit(const bytes& leaf_secret,
     });
 
     auto leaf_node_opts = LeafNodeOptions{};
+    auto executor = Executor{};
     if (opts) {
       leaf_node_opts = opt::get(opts).leaf_node_opts;
+      executor = opt::get(opts).executor;
     }
 
     auto [new_priv, path] = next._tree.encap(next._index,
@@ -522,7 +1371,8 @@ State::commit(const bytes& leaf_secret,
                                              leaf_secret,
                                              _identity_priv,
                                              joiner_locations,
-                                             leaf_node_opts);
+                                             leaf_node_opts,
+                                             executor);
     next._tree_priv = new_priv;
     commit.path = path;
     commit_secret = new_priv.update_secret;
@@ -557,27 +1407,30 @@ State::commit(const bytes& leaf_secret,
 
   // Complete the GroupInfo and form the Welcome
   auto group_info = GroupInfo{
-    {
-      next._suite,
-      next._group_id,
-      next._epoch,
-      next._tree.root_hash(),
-      next._transcript_hash.confirmed,
-      next._extensions,
-    },
+    next.group_context(),
     { /* No other extensions */ },
     { confirmation_tag },
   };
   if (opts && opt::get(opts).inline_tree) {
-    group_info.extensions.add(RatchetTreeExtension{ next._tree });
+    add_tree_extension(group_info.extensions, next._extensions, next._tree);
   }
   group_info.sign(next._tree, next._index, next._identity_priv);
 
   auto welcome = Welcome{
     _suite, next._key_schedule.joiner_secret, { /* no PSKs */ }, group_info
   };
-  for (size_t i = 0; i < joiners.size(); i++) {
-    welcome.encrypt(joiners[i], path_secrets[i]);
+  const auto executor = opts ? opt::get(opts).executor : Executor{};
+  welcome.encrypt(joiners, path_secrets, executor);
+
+  if (Metrics::enabled()) {
+    auto hpke_ops = joiners.size();
+    if (commit.path) {
+      for (const auto& node : opt::get(commit.path).nodes) {
+        hpke_ops += node.encrypted_path_secret.size();
+      }
+    }
+
+    Metrics::record(Histogram::commit_hpke_ops, hpke_ops);
   }
 
   return std::make_tuple(commit_message, welcome, next);
@@ -587,10 +1440,27 @@ State::commit(const bytes& leaf_secret,
 /// Message handlers
 ///
 
-GroupContext
+const TreeKEMPublicKey&
+State::tree() const
+{
+  hydrate();
+  return _tree;
+}
+
+const GroupContext&
 State::group_context() const
 {
-  return GroupContext{
+  return group_context_cache().context;
+}
+
+const State::GroupContextCache&
+State::group_context_cache() const
+{
+  if (auto cached = std::atomic_load(&_group_context_cache)) {
+    return *cached;
+  }
+
+  auto context = GroupContext{
     _suite,
     _group_id,
     _epoch,
@@ -598,6 +1468,28 @@ State::group_context() const
     _transcript_hash.confirmed,
     _extensions,
   };
+  auto encoded = tls::marshal(context);
+  auto cache = std::make_shared<const GroupContextCache>(
+    GroupContextCache{ std::move(context), std::move(encoded) });
+
+  // As for the GroupInfo cache, a concurrent reader may have filled it first
+  auto expected = std::shared_ptr<const GroupContextCache>{};
+  if (!std::atomic_compare_exchange_strong(
+        &_group_context_cache, &expected, cache)) {
+    return *expected;
+  }
+
+  return *cache;
+}
+
+void
+State::reset_epoch_caches()
+{
+  std::atomic_store(&_group_context_cache,
+                    std::shared_ptr<const GroupContextCache>{});
+  for (auto& group_info : _group_info_cache) {
+    std::atomic_store(&group_info, std::shared_ptr<const bytes>{});
+  }
 }
 
 std::optional<State>
@@ -609,6 +1501,125 @@ State::handle(const MLSMessage& msg)
 std::optional<State>
 State::handle(const MLSMessage& msg, std::optional<State> cached_state)
 {
+  hydrate();
+
+  const auto timer = ScopedTimer(Histogram::handle_time);
+  MLS_PROBE(handle_start, _tree.size.val, _epoch, probe_suite(_suite));
+  const auto probe_done = ProbeOnExit([&] {
+    MLS_PROBE(handle_done, _tree.size.val, _epoch, probe_suite(_suite));
+  });
+
+  auto content_auth = authenticate_handshake(msg);
+  const auto& content = content_auth.content;
+
+  // Proposals get queued, do not result in a state transition
+  if (content.content_type() == ContentType::proposal) {
+    cache_proposal(std::move(content_auth));
+    return std::nullopt;
+  }
+
+  const auto sender = commit_sender(content);
+  if (sender == _index) {
+    if (cached_state) {
+      // Verify that the cached state is a plausible successor to this state
+      const auto& next = opt::get(cached_state);
+      if (next._group_id != _group_id || next._epoch != _epoch + 1 ||
+          next._index != _index) {
+        throw InvalidParameterError("Invalid successor state");
+      }
+
+      return next;
+    }
+
+    throw InvalidParameterError("Handle own commits with caching");
+  }
+
+  // Apply the commit
+  const auto& commit = var::get<Commit>(content.content);
+  const auto proposals = must_resolve(commit.proposals, sender);
+  verify_add_key_packages(proposals);
+
+  auto next = successor();
+  next.apply_commit(content_auth, sender, proposals, true);
+  return next;
+}
+
+State::SequenceResult
+State::handle_sequence(const std::vector<MLSMessage>& msgs)
+{
+  hydrate();
+
+  auto work = *this;
+  auto result = work.apply_sequence(msgs, msgs.size());
+  if (result.error) {
+    // The working state may have been left part-way through the failed
+    // message, so the messages before it are applied again from the start
+    work = *this;
+    work.apply_sequence(msgs, result.handled);
+  }
+
+  *this = std::move(work);
+  return result;
+}
+
+State::SequenceResult
+State::apply_sequence(const std::vector<MLSMessage>& msgs, size_t count)
+{
+  // The encryption keys for an epoch are only set up if one of its messages
+  // is encrypted, or if it is the final epoch
+  auto result = SequenceResult{};
+  auto keys_current = true;
+  for (; result.handled < count; result.handled++) {
+    const auto& msg = msgs.at(result.handled);
+    const auto timer = ScopedTimer(Histogram::handle_time);
+
+    try {
+      if (!keys_current && var::holds_alternative<MLSCiphertext>(msg.message)) {
+        derive_encryption_keys();
+        keys_current = true;
+      }
+
+      auto content_auth = authenticate_handshake(msg);
+      const auto& content = content_auth.content;
+      if (content.content_type() == ContentType::proposal) {
+        cache_proposal(std::move(content_auth));
+        continue;
+      }
+
+      // Without a cached successor, a member's own Commit cannot be applied
+      const auto sender = commit_sender(content);
+      if (sender == _index) {
+        throw InvalidParameterError("Handle own commits with caching");
+      }
+
+      const auto& commit = var::get<Commit>(content.content);
+      const auto proposals = must_resolve(commit.proposals, sender);
+      verify_add_key_packages(proposals);
+
+      _pending_proposals.clear();
+      _pending_proposal_index.clear();
+      reset_epoch_caches();
+      apply_commit(content_auth, sender, proposals, false);
+      keys_current = false;
+    } catch (...) {
+      result.error = std::current_exception();
+      break;
+    }
+  }
+
+  if (!keys_current) {
+    derive_encryption_keys();
+  }
+
+  return result;
+}
+
+MLSAuthenticatedContent
+State::authenticate_handshake(const MLSMessage& msg) const
+{
+  hydrate();
+  wait_for_tree_validation();
+
   // Check the version
   if (msg.version != ProtocolVersion::mls10) {
     throw InvalidParameterError("Unsupported version");
@@ -630,60 +1641,47 @@ State::handle(const MLSMessage& msg, std::optional<State> cached_state)
     throw InvalidParameterError("Epoch mismatch");
   }
 
-  // Dispatch on content type
+  // Only Proposals and Commits are handshake messages
+  // TODO(RLB): We should validate that the proposal makes sense here, e.g.,
+  // that an Add KeyPackage is for the right CipherSuite or that a Remove
+  // target is actually in the group.
   switch (content.content_type()) {
-    // Proposals get queued, do not result in a state transition
-    // TODO(RLB): We should validate that the proposal makes sense here, e.g.,
-    // that an Add KeyPackage is for the right CipherSuite or that a Remove
-    // target is actually in the group.
     case ContentType::proposal:
-      cache_proposal(content_auth);
-      return std::nullopt;
-
-    // Commits are handled in the remainder of this method
     case ContentType::commit:
       break;
 
-    // Any other content type in this method is an error
     default:
       throw InvalidParameterError("Invalid content type");
   }
 
+  return content_auth;
+}
+
+std::optional<LeafIndex>
+State::commit_sender(const MLSContent& content)
+{
   switch (content.sender.sender_type()) {
     case SenderType::member:
+      return var::get<MemberSender>(content.sender.sender).sender;
+
     case SenderType::new_member_commit:
-      break;
+      return std::nullopt;
 
     default:
       throw ProtocolError("Invalid commit sender type");
   }
+}
 
-  auto sender = std::optional<LeafIndex>();
-  if (content.sender.sender_type() == SenderType::member) {
-    sender = var::get<MemberSender>(content.sender.sender).sender;
-  }
-
-  if (sender == _index) {
-    if (cached_state) {
-      // Verify that the cached state is a plausible successor to this state
-      const auto& next = opt::get(cached_state);
-      if (next._group_id != _group_id || next._epoch != _epoch + 1 ||
-          next._index != _index) {
-        throw InvalidParameterError("Invalid successor state");
-      }
-
-      return next;
-    }
-
-    throw InvalidParameterError("Handle own commits with caching");
-  }
-
-  // Apply the commit
+void
+State::apply_commit(const MLSAuthenticatedContent& content_auth,
+                    std::optional<LeafIndex> sender,
+                    const std::vector<CachedProposal>& proposals,
+                    bool derive_keys)
+{
+  const auto& content = content_auth.content;
   const auto& commit = var::get<Commit>(content.content);
-  const auto proposals = must_resolve(commit.proposals, sender);
 
-  auto next = successor();
-  auto [_has_updates, _has_removes, joiner_locations] = next.apply(proposals);
+  auto [_has_updates, _has_removes, joiner_locations] = apply(proposals);
   silence_unused(_has_updates);
   silence_unused(_has_removes);
 
@@ -707,24 +1705,8 @@ State::handle(const MLSMessage& msg, std::optional<State> cached_state)
 
     // Figure out where the new joiner was added by identifying the Add by value
     // in the proposals vector
-    auto add_index = size_t(0);
-    for (size_t i = 0; i < commit.proposals.size(); i++) {
-      if (proposals[i].proposal.proposal_type() != ProposalType::add) {
-        continue;
-      }
-
-      if (var::holds_alternative<ProposalRef>(commit.proposals[i].content)) {
-        add_index += 1;
-      } else {
-        sender_location = joiner_locations[add_index];
-        break;
-      }
-
-      if (i == commit.proposals.size() - 1) {
-        // If we make it to the end of the loop, we're missing a sender location
-        throw ProtocolError("Unable to locate external joiner");
-      }
-    }
+    sender_location =
+      external_joiner_location(commit, proposals, joiner_locations);
   }
 
   // Decapsulate and apply the UpdatePath, if provided
@@ -737,106 +1719,53 @@ State::handle(const MLSMessage& msg, std::optional<State> cached_state)
       throw ProtocolError("Commit path leaf node has invalid source");
     }
 
-    if (!next._tree.parent_hash_valid(sender_location, path)) {
+    if (!_tree.parent_hash_valid(sender_location, path)) {
       throw ProtocolError("Commit path has invalid parent hash");
     }
 
-    next.check_update_leaf_node(
+    check_update_leaf_node(
       sender_location, path.leaf_node, LeafNodeSource::commit);
 
     auto ctx = tls::marshal(GroupContext{
-      next._suite,
-      next._group_id,
-      next._epoch + 1,
-      next._tree.root_hash(),
-      next._transcript_hash.confirmed,
-      next._extensions,
-    });
-    next._tree_priv.decap(
-      sender_location, next._tree, ctx, path, joiner_locations);
-    next._tree.merge(sender_location, path);
-    commit_secret = next._tree_priv.update_secret;
-  }
-
+      _suite,
+      _group_id,
+      _epoch + 1,
+      _tree.root_hash(),
+      _transcript_hash.confirmed,
+      _extensions,
+    });
+    _tree_priv.decap(sender_location, _tree, ctx, path, joiner_locations);
+    _tree.merge(sender_location, path);
+    commit_secret = _tree_priv.update_secret;
+  }
+
   // Update the transcripts and advance the key schedule
-  next._transcript_hash.update(content_auth);
-  next._epoch += 1;
-  next.update_epoch_secrets(
-    commit_secret, { /* no PSKs */ }, force_init_secret);
+  _transcript_hash.update(content_auth);
+  _epoch += 1;
+  update_epoch_secrets(
+    commit_secret, { /* no PSKs */ }, force_init_secret, derive_keys);
 
   // Verify the confirmation MAC
   const auto confirmation_tag =
-    next._key_schedule.confirmation_tag(next._transcript_hash.confirmed);
+    _key_schedule.confirmation_tag(_transcript_hash.confirmed);
   if (!content_auth.check_confirmation_tag(confirmation_tag)) {
     throw ProtocolError("Confirmation failed to verify");
   }
-
-  return next;
 }
 
-// A LeafNode in an Add KeyPackage must not have the same leaf_node.public_key
-// or signature_key as any KeyPackage for a current member.  The joiner must
-// support all credential types in use by other members, and vice versa.
 void
 State::check_add_leaf_node(const LeafNode& leaf,
                            std::optional<LeafIndex> except) const
 {
-  for (LeafIndex i{ 0 }; i < _tree.size; i.val++) {
-    if (i == except) {
-      continue;
-    }
-
-    const auto maybe_tree_leaf = _tree.leaf_node(i);
-    if (!maybe_tree_leaf) {
-      continue;
-    }
-
-    const auto& tree_leaf = opt::get(maybe_tree_leaf);
-    const auto hpke_key_eq = tree_leaf.encryption_key == leaf.encryption_key;
-    const auto sig_key_eq = tree_leaf.signature_key == leaf.signature_key;
-    if (hpke_key_eq || sig_key_eq) {
-      throw ProtocolError("Duplicate parameters in new KeyPackage");
-    }
-
-    if (!leaf.capabilities.credential_supported(tree_leaf.credential)) {
-      throw ProtocolError("Member credential not supported by joiner");
-    }
-
-    if (!tree_leaf.capabilities.credential_supported(leaf.credential)) {
-      throw ProtocolError("Joiner credential not supported by group member");
-    }
-  }
+  mls::check_add_leaf_node(_tree, leaf, except);
 }
 
-// A KeyPackage in an Update must meet the same uniqueness criteria as for an
-// Add, except with regard to the KeyPackage it replaces.
 void
 State::check_update_leaf_node(LeafIndex target,
                               const LeafNode& leaf,
                               LeafNodeSource required_source) const
 {
-  check_add_leaf_node(leaf, target);
-
-  if (leaf.source() != required_source) {
-    throw ProtocolError("LeafNode in Update has incorrect LeafNodeSource");
-  }
-
-  const auto maybe_tree_leaf = _tree.leaf_node(target);
-  if (!maybe_tree_leaf) {
-    return;
-  }
-
-  const auto& tree_leaf = opt::get(maybe_tree_leaf);
-  if (tree_leaf.encryption_key == leaf.encryption_key) {
-    throw ProtocolError("Update without a fresh init key");
-  }
-}
-
-LeafIndex
-State::apply(const Add& add)
-{
-  check_add_leaf_node(add.key_package.leaf_node, std::nullopt);
-  return _tree.add_leaf(add.key_package.leaf_node);
+  mls::check_update_leaf_node(_tree, target, leaf, required_source);
 }
 
 void
@@ -853,45 +1782,10 @@ State::apply(LeafIndex target, const Update& update, const bytes& leaf_secret)
   _tree_priv.set_leaf_secret(leaf_secret);
 }
 
-LeafIndex
-State::apply(const Remove& remove)
-{
-  if (!_tree.has_leaf(remove.removed)) {
-    throw ProtocolError("Attempt to remove non-member");
-  }
-
-  _tree.blank_path(remove.removed);
-  return remove.removed;
-}
-
-void
-State::apply(const GroupContextExtensions& gce)
-{
-  // TODO(RLB): Update spec to clarify that you MUST verify that the new
-  // extensions are compatible with all members.
-  if (!extensions_supported(gce.group_context_extensions)) {
-    throw ProtocolError("Unsupported extensions in GroupContextExtensions");
-  }
-
-  _extensions = gce.group_context_extensions;
-}
-
 bool
 State::extensions_supported(const ExtensionList& exts) const
 {
-  for (LeafIndex i{ 0 }; i < _tree.size; i.val++) {
-    const auto& maybe_leaf = _tree.leaf_node(i);
-    if (!maybe_leaf) {
-      continue;
-    }
-
-    const auto& leaf = opt::get(maybe_leaf);
-    if (!leaf.verify_extension_support(exts)) {
-      return false;
-    }
-  }
-
-  return true;
+  return mls::extensions_supported(_tree, exts);
 }
 
 void
@@ -903,13 +1797,67 @@ State::cache_proposal(MLSAuthenticatedContent content_auth)
     sender_location = var::get<MemberSender>(sender).sender;
   }
 
-  _pending_proposals.push_back({
+  cache_proposal({
     _suite.ref(content_auth),
     var::get<Proposal>(content_auth.content.content),
     sender_location,
   });
 }
 
+void
+State::cache_proposal(CachedProposal cached)
+{
+  // If the same proposal is sent twice, references resolve to the first copy
+  _pending_proposal_index.emplace(cached.ref, _pending_proposals.size());
+  _pending_proposals.push_back(std::move(cached));
+}
+
+void
+State::cache_proposals(const std::vector<MLSMessage>& msgs)
+{
+  hydrate();
+  wait_for_tree_validation();
+
+  auto content_auths = std::vector<MLSAuthenticatedContent>{};
+  content_auths.reserve(msgs.size());
+  for (const auto& msg : msgs) {
+    if (msg.version != ProtocolVersion::mls10) {
+      throw InvalidParameterError("Unsupported version");
+    }
+
+    auto content_auth = unprotect_to_content_auth(msg);
+    const auto& content = content_auth.content;
+    if (content.group_id != _group_id) {
+      throw InvalidParameterError("GroupID mismatch");
+    }
+
+    if (content.epoch != _epoch) {
+      throw InvalidParameterError("Epoch mismatch");
+    }
+
+    if (content.content_type() != ContentType::proposal) {
+      throw InvalidParameterError("Invalid content type");
+    }
+
+    content_auths.push_back(std::move(content_auth));
+  }
+
+  // The group context is shared by all of the signatures
+  const auto& ctx = group_context();
+  auto valid = std::vector<uint8_t>(content_auths.size(), 0);
+  execute(_executor, content_auths.size(), [&](size_t i) {
+    valid[i] = verify(content_auths[i], ctx) ? 1 : 0;
+  });
+
+  if (!stdx::all_of(valid, [](auto ok) { return ok != 0; })) {
+    throw InvalidParameterError("Message signature failed to verify");
+  }
+
+  for (auto& content_auth : content_auths) {
+    cache_proposal(std::move(content_auth));
+  }
+}
+
 std::optional<State::CachedProposal>
 State::resolve(const ProposalOrRef& id,
                std::optional<LeafIndex> sender_index) const
@@ -923,13 +1871,12 @@ State::resolve(const ProposalOrRef& id,
   }
 
   const auto& ref = var::get<ProposalRef>(id.content);
-  for (const auto& cached : _pending_proposals) {
-    if (cached.ref == ref) {
-      return cached;
-    }
+  const auto it = _pending_proposal_index.find(ref);
+  if (it == _pending_proposal_index.end()) {
+    return std::nullopt;
   }
 
-  return std::nullopt;
+  return _pending_proposals.at(it->second);
 }
 
 std::vector<State::CachedProposal>
@@ -942,90 +1889,48 @@ State::must_resolve(const std::vector<ProposalOrRef>& ids,
   return stdx::transform<CachedProposal>(ids, must_resolve);
 }
 
-std::vector<LeafIndex>
-State::apply(const std::vector<CachedProposal>& proposals,
-             Proposal::Type required_type)
+std::tuple<bool, bool, std::vector<LeafIndex>>
+State::apply(const std::vector<CachedProposal>& proposals)
 {
-  auto locations = std::vector<LeafIndex>{};
-  for (const auto& cached : proposals) {
-    auto proposal_type = cached.proposal.proposal_type();
-    if (proposal_type != required_type) {
-      continue;
+  // Our own Update is applied with the secret we cached when we sent it
+  auto has_updates = false;
+  auto apply_update = [&](LeafIndex target, const Update& update) {
+    if (target != _index) {
+      apply(target, update);
+      return;
     }
 
-    switch (proposal_type) {
-      case ProposalType::add: {
-        locations.push_back(apply(var::get<Add>(cached.proposal.content)));
-        break;
-      }
-
-      case ProposalType::update: {
-        const auto& update = var::get<Update>(cached.proposal.content);
-
-        if (!cached.sender) {
-          throw ProtocolError("Update without target leaf");
-        }
-
-        auto target = opt::get(cached.sender);
-        if (target != _index) {
-          apply(target, update);
-          break;
-        }
-
-        if (!_cached_update) {
-          throw ProtocolError("Self-update with no cached secret");
-        }
-
-        const auto& cached_update = opt::get(_cached_update);
-        if (update != cached_update.proposal) {
-          throw ProtocolError("Self-update does not match cached data");
-        }
-
-        apply(target, update, cached_update.update_secret);
-        locations.push_back(target);
-        break;
-      }
-
-      case ProposalType::remove: {
-        const auto& remove = var::get<Remove>(cached.proposal.content);
-        locations.push_back(apply(remove));
-        break;
-      }
-
-      case ProposalType::group_context_extensions: {
-        const auto& gce =
-          var::get<GroupContextExtensions>(cached.proposal.content);
-        apply(gce);
-        break;
-      }
-
-      default:
-        throw ProtocolError("Unsupported proposal type");
+    if (!_cached_update) {
+      throw ProtocolError("Self-update with no cached secret");
     }
-  }
-
-  return locations;
-}
 
-std::tuple<bool, bool, std::vector<LeafIndex>>
-State::apply(const std::vector<CachedProposal>& proposals)
-{
-  auto update_locations = apply(proposals, ProposalType::update);
-  auto remove_locations = apply(proposals, ProposalType::remove);
-  auto joiner_locations = apply(proposals, ProposalType::add);
-  apply(proposals, ProposalType::group_context_extensions);
+    const auto& cached_update = opt::get(_cached_update);
+    if (update != cached_update.proposal) {
+      throw ProtocolError("Self-update does not match cached data");
+    }
 
-  // TODO(RLB) Check for unknown / unhandled proposal types.
+    apply(target, update, cached_update.update_secret);
+    has_updates = true;
+  };
 
-  auto has_updates = !update_locations.empty();
-  auto has_removes = !remove_locations.empty();
+  auto [removed, joiner_locations] =
+    apply_proposals(_tree, _extensions, proposals, apply_update);
+  auto has_removes = !removed.empty();
 
   _tree.truncate();
   _tree_priv.truncate(_tree.size);
   _tree.set_hash_all();
+  reset_epoch_caches();
   return std::make_tuple(has_updates, has_removes, joiner_locations);
 }
 
+void
+State::verify_add_key_packages(
+  const std::vector<CachedProposal>& proposals) const
+{
+  mls::verify_add_key_packages(_suite, proposals, _executor);
+}
+
 ///
 /// Message protection
 ///
@@ -1035,16 +1940,135 @@ State::protect(const bytes& authenticated_data,
                const bytes& pt,
                size_t padding_size)
 {
+  hydrate();
+
+  MLS_PROBE(
+    protect_start, _tree.size.val, _epoch, probe_suite(_suite), pt.size());
+  const auto probe_done = ProbeOnExit([&] {
+    MLS_PROBE(
+      protect_done, _tree.size.val, _epoch, probe_suite(_suite), pt.size());
+  });
+
   auto msg_opts = MessageOpts{ true, authenticated_data, padding_size };
   return protect_full(ApplicationData{ pt }, msg_opts);
 }
 
+void
+State::protect_into(const bytes& authenticated_data,
+                    const bytes& pt,
+                    size_t padding_size,
+                    bytes& out)
+{
+  hydrate();
+
+  MLS_PROBE(
+    protect_start, _tree.size.val, _epoch, probe_suite(_suite), pt.size());
+  const auto probe_done = ProbeOnExit([&] {
+    MLS_PROBE(
+      protect_done, _tree.size.val, _epoch, probe_suite(_suite), out.size());
+  });
+
+  auto content_auth = sign({ MemberSender{ _index } },
+                           ApplicationData{ pt },
+                           authenticated_data,
+                           true);
+
+  auto header = tls::ostream{};
+  header << ProtocolVersion::mls10 << WireFormat::mls_ciphertext;
+  const auto& header_data = header.bytes();
+  out.as_vec().insert(out.end(), header_data.begin(), header_data.end());
+
+  MLSCiphertext::protect_into(std::move(content_auth),
+                              _suite,
+                              _index,
+                              _keys,
+                              _key_schedule.sender_data_secret,
+                              padding_size,
+                              out);
+}
+
 std::tuple<bytes, bytes>
-State::unprotect(const MLSMessage& ct)
+State::unprotect(const MLSMessage& ct) const
 {
+  return unprotect(ct, group_context());
+}
+
+std::vector<MLSMessage>
+State::protect_batch(const bytes& authenticated_data,
+                     const std::vector<bytes>& pts,
+                     size_t padding_size)
+{
+  wait_for_tree_validation();
+
+  const auto& ctx = group_context();
+  const auto sender = Sender{ MemberSender{ _index } };
+
+  auto cts = std::vector<MLSMessage>{};
+  cts.reserve(pts.size());
+  for (const auto& pt : pts) {
+    auto content = MLSContent{
+      _group_id, _epoch, sender, authenticated_data, { ApplicationData{ pt } }
+    };
+
+    auto content_auth =
+      MLSAuthenticatedContent::sign(WireFormat::mls_ciphertext,
+                                    std::move(content),
+                                    _suite,
+                                    _identity_priv,
+                                    ctx);
+    cts.push_back(protect(std::move(content_auth), padding_size));
+  }
+
+  return cts;
+}
+
+std::vector<std::tuple<bytes, bytes>>
+State::unprotect_batch(const std::vector<MLSMessage>& cts) const
+{
+  // Each message is decrypted and verified as its own task, so a batch from
+  // many senders is spread across the executor rather than being bound by the
+  // latency of one message at a time
+  const auto& ctx = group_context();
+  auto out = std::vector<std::tuple<bytes, bytes>>(cts.size());
+  auto errors = std::vector<std::exception_ptr>(cts.size());
+  auto failed = std::atomic<bool>(false);
+  execute(_executor, cts.size(), [&](size_t i) {
+    if (failed.load()) {
+      return;
+    }
+
+    try {
+      out[i] = unprotect(cts[i], ctx);
+    } catch (...) {
+      errors[i] = std::current_exception();
+      failed.store(true);
+    }
+  });
+
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  return out;
+}
+
+std::tuple<bytes, bytes>
+State::unprotect(const MLSMessage& ct, const GroupContext& ctx) const
+{
+  hydrate();
+
+  [[maybe_unused]] auto pt_size = size_t(0);
+  MLS_PROBE(unprotect_start, _tree.size.val, _epoch, probe_suite(_suite));
+  const auto probe_done = ProbeOnExit([&] {
+    MLS_PROBE(
+      unprotect_done, _tree.size.val, _epoch, probe_suite(_suite), pt_size);
+  });
+
   auto content_auth = unprotect_to_content_auth(ct);
 
-  if (!verify(content_auth)) {
+  if (!verify(content_auth, ctx)) {
     throw InvalidParameterError("Message signature failed to verify");
   }
 
@@ -1056,12 +2080,120 @@ State::unprotect(const MLSMessage& ct)
     throw ProtocolError("Application data not sent as MLSCiphertext");
   }
 
+  auto& pt = var::get<ApplicationData>(content_auth.content.content).data;
+  pt_size = pt.size();
   return {
     std::move(content_auth.content.authenticated_data),
-    std::move(var::get<ApplicationData>(content_auth.content.content).data),
+    std::move(pt),
   };
 }
 
+RetainedEpoch
+State::retain() const
+{
+  hydrate();
+
+  auto retained = RetainedEpoch{};
+  retained._suite = _suite;
+  retained._context = group_context();
+  retained._sender_data_secret = _key_schedule.sender_data_secret;
+  retained._keys = _keys;
+  retained._signature_keys.resize(_tree.size.val);
+
+  const auto view = _tree.leaves();
+  for (auto it = view.begin(); it != view.end(); ++it) {
+    retained._signature_keys.at(it.index().val) = it->signature_key;
+  }
+
+  return retained;
+}
+
+std::shared_ptr<const EpochSnapshot>
+State::snapshot() const
+{
+  hydrate();
+
+  auto snapshot = std::shared_ptr<EpochSnapshot>(new EpochSnapshot());
+  snapshot->_suite = _suite;
+  snapshot->_epoch = _epoch;
+  snapshot->_index = _index;
+  snapshot->_extensions = _extensions;
+  snapshot->_tree = _tree;
+  snapshot->_exporter_secret = _key_schedule.exporter_secret;
+  snapshot->_authentication_secret = _key_schedule.authentication_secret;
+  return snapshot;
+}
+
+void
+State::set_key_retention(const KeyRetentionPolicy& policy)
+{
+  hydrate();
+
+  _keys.set_retention_policy(policy);
+  _keys.set_own_index(_index);
+}
+
+bool
+State::tree_validation_pending() const
+{
+  if (!_tree_validation.valid()) {
+    return false;
+  }
+
+  const auto status = _tree_validation.wait_for(std::chrono::seconds(0));
+  return status != std::future_status::ready;
+}
+
+void
+State::wait_for_tree_validation() const
+{
+  if (_tree_validation.valid()) {
+    _tree_validation.get();
+  }
+}
+
+void
+State::set_executor(Executor executor)
+{
+  _executor = std::move(executor);
+}
+
+GroupKeySource::MemoryUsage
+State::key_memory_usage() const
+{
+  return _keys.memory_usage();
+}
+
+GroupMemoryUsage
+State::memory_usage() const
+{
+  auto usage = GroupMemoryUsage{};
+  usage.tree = _tree.memory_usage();
+  usage.tree_priv = _tree_priv.memory_usage();
+  usage.keys = _keys.memory_usage();
+  usage.pending_proposals = _pending_proposals.size();
+  for (const auto& cached : _pending_proposals) {
+    usage.proposal_bytes += tls::marshal(cached.proposal).size();
+  }
+  usage.epochs = 1;
+  return usage;
+}
+
+void
+State::warm_keys(const std::vector<LeafIndex>& senders,
+                 uint32_t generations,
+                 const Executor& executor) const
+{
+  hydrate();
+
+  auto members = std::vector<LeafIndex>{};
+  std::copy_if(senders.begin(),
+               senders.end(),
+               std::back_inserter(members),
+               [&](auto sender) { return _tree.has_leaf(sender); });
+  _keys.warm(members, generations, executor);
+}
+
 ///
 /// Inner logic and convenience functions
 ///
@@ -1069,6 +2201,9 @@ State::unprotect(const MLSMessage& ct)
 bool
 operator==(const State& lhs, const State& rhs)
 {
+  lhs.hydrate();
+  rhs.hydrate();
+
   auto suite = (lhs._suite == rhs._suite);
   auto group_id = (lhs._group_id == rhs._group_id);
   auto epoch = (lhs._epoch == rhs._epoch);
@@ -1090,88 +2225,45 @@ operator!=(const State& lhs, const State& rhs)
 void
 State::update_epoch_secrets(const bytes& commit_secret,
                             const std::vector<PSKWithSecret>& psks,
-                            const std::optional<bytes>& force_init_secret)
+                            const std::optional<bytes>& force_init_secret,
+                            bool derive_keys)
 {
-  auto ctx = tls::marshal(GroupContext{
-    _suite,
-    _group_id,
-    _epoch,
-    _tree.root_hash(),
-    _transcript_hash.confirmed,
-    _extensions,
-  });
+  // This is called once the new epoch's group state is complete, so the
+  // context computed here serves the rest of the epoch
+  reset_epoch_caches();
+  const auto& ctx = group_context_cache().encoded;
   _key_schedule =
     _key_schedule.next(commit_secret, psks, force_init_secret, ctx);
-  _keys = _key_schedule.encryption_keys(_tree.size);
-}
 
-///
-/// Message encryption and decryption
-///
-bool
-State::verify_internal(const MLSAuthenticatedContent& content_auth) const
-{
-  const auto& sender =
-    var::get<MemberSender>(content_auth.content.sender.sender).sender;
-  auto maybe_leaf = _tree.leaf_node(sender);
-  if (!maybe_leaf) {
-    throw InvalidParameterError("Signature from blank node");
+  if (derive_keys) {
+    derive_encryption_keys();
   }
-
-  const auto& pub = opt::get(maybe_leaf).signature_key;
-  return content_auth.verify(_suite, pub, group_context());
 }
 
-bool
-State::verify_external(const MLSAuthenticatedContent& content_auth) const
-{
-  const auto& ext_sender =
-    var::get<ExternalSenderIndex>(content_auth.content.sender.sender);
-  const auto senders_ext = _extensions.find<ExternalSendersExtension>();
-  const auto& senders = opt::get(senders_ext).senders;
-  const auto& pub = senders.at(ext_sender.sender_index).signature_key;
-  return content_auth.verify(_suite, pub, group_context());
-}
-
-bool
-State::verify_new_member_proposal(
-  const MLSAuthenticatedContent& content_auth) const
+void
+State::derive_encryption_keys()
 {
-  const auto& proposal = var::get<Proposal>(content_auth.content.content);
-  const auto& add = var::get<Add>(proposal.content);
-  const auto& pub = add.key_package.leaf_node.signature_key;
-  return content_auth.verify(_suite, pub, group_context());
+  const auto retention = _keys.retention_policy();
+  _keys = _key_schedule.encryption_keys(_tree.size);
+  _keys.set_retention_policy(retention);
+  _keys.set_own_index(_index);
 }
 
+///
+/// Message encryption and decryption
+///
 bool
-State::verify_new_member_commit(
-  const MLSAuthenticatedContent& content_auth) const
+State::verify(const MLSAuthenticatedContent& content_auth) const
 {
-  const auto& commit = var::get<Commit>(content_auth.content.content);
-  const auto& path = opt::get(commit.path);
-  const auto& pub = path.leaf_node.signature_key;
-  return content_auth.verify(_suite, pub, group_context());
+  return verify(content_auth, group_context());
 }
 
 bool
-State::verify(const MLSAuthenticatedContent& content_auth) const
+State::verify(const MLSAuthenticatedContent& content_auth,
+              const GroupContext& ctx) const
 {
-  switch (content_auth.content.sender.sender_type()) {
-    case SenderType::member:
-      return verify_internal(content_auth);
-
-    case SenderType::external:
-      return verify_external(content_auth);
-
-    case SenderType::new_member_proposal:
-      return verify_new_member_proposal(content_auth);
-
-    case SenderType::new_member_commit:
-      return verify_new_member_commit(content_auth);
-
-    default:
-      throw ProtocolError("Invalid sender type");
-  }
+  hydrate();
+  return verify_signature(_suite, _tree, _extensions, content_auth, ctx);
 }
 
 bytes
@@ -1185,43 +2277,51 @@ State::do_export(const std::string& label,
 GroupInfo
 State::group_info() const
 {
+  return tls::get<GroupInfo>(group_info_data(true));
+}
+
+const bytes&
+State::group_info_data(bool inline_tree) const
+{
+  hydrate();
+  wait_for_tree_validation();
+
+  auto& slot = _group_info_cache.at(inline_tree ? 1 : 0);
+  if (auto cached = std::atomic_load(&slot)) {
+    return *cached;
+  }
+
   auto group_info = GroupInfo{
-    {
-      _suite,
-      _group_id,
-      _epoch,
-      _tree.root_hash(),
-      _transcript_hash.confirmed,
-      _extensions,
-    },
+    group_context(),
     { /* No other extensions */ },
     _key_schedule.confirmation_tag(_transcript_hash.confirmed),
   };
 
   group_info.extensions.add(
-    ExternalPubExtension{ _key_schedule.external_priv.public_key });
-  group_info.extensions.add(RatchetTreeExtension{ _tree });
+    ExternalPubExtension{ _key_schedule.external_priv().public_key });
+  if (inline_tree) {
+    add_tree_extension(group_info.extensions, _extensions, _tree);
+  }
   group_info.sign(_tree, _index, _identity_priv);
-  return group_info;
+
+  // If another thread got here first, use its bytes, so that every caller sees
+  // the same encoding
+  auto encoded = std::make_shared<const bytes>(tls::marshal(group_info));
+  auto expected = std::shared_ptr<const bytes>{};
+  if (!std::atomic_compare_exchange_strong(&slot, &expected, encoded)) {
+    return *expected;
+  }
+
+  return *encoded;
 }
 
 std::vector<LeafNode>
 State::roster() const
 {
-  auto leaves = std::vector<LeafNode>(_tree.size.val);
-  auto leaf_count = uint32_t(0);
-
-  for (uint32_t i = 0; i < _tree.size.val; i++) {
-    const auto& maybe_leaf = _tree.leaf_node(LeafIndex{ i });
-    if (!maybe_leaf) {
-      continue;
-    }
-    leaves.at(leaf_count) = opt::get(maybe_leaf);
-    leaf_count++;
-  }
+  hydrate();
 
-  leaves.resize(leaf_count);
-  return leaves;
+  const auto view = _tree.leaves();
+  return { view.begin(), view.end() };
 }
 
 bytes
@@ -1235,13 +2335,10 @@ State::leaf_for_roster_entry(RosterIndex index) const
 {
   auto non_blank_leaves = uint32_t(0);
 
-  for (auto i = LeafIndex{ 0 }; i < _tree.size; i.val++) {
-    const auto& maybe_leaf = _tree.leaf_node(i);
-    if (!maybe_leaf) {
-      continue;
-    }
+  const auto view = _tree.leaves();
+  for (auto it = view.begin(); it != view.end(); ++it) {
     if (non_blank_leaves == index.val) {
-      return i;
+      return it.index();
     }
     non_blank_leaves += 1;
   }
@@ -1252,10 +2349,354 @@ State::leaf_for_roster_entry(RosterIndex index) const
 State
 State::successor() const
 {
-  // Copy everything, then clear things that shouldn't be copied
+  hydrate();
+
+  // Copy everything, then clear things that shouldn't be copied.  The next
+  // epoch's tree is the one whose leaf lookups will be used and changed.
   auto next = *this;
+  _tree.release_lookups();
   next._pending_proposals.clear();
+  next._pending_proposal_index.clear();
+  next.reset_epoch_caches();
   return next;
 }
 
+///
+/// GroupMemoryUsage
+///
+
+size_t
+GroupMemoryUsage::total_bytes() const
+{
+  return tree.bytes + tree_priv.bytes + keys.secret_bytes + proposal_bytes;
+}
+
+GroupMemoryUsage&
+GroupMemoryUsage::operator+=(const GroupMemoryUsage& other)
+{
+  tree.nodes += other.tree.nodes;
+  tree.cached_hashes += other.tree.cached_hashes;
+  tree.bytes += other.tree.bytes;
+
+  tree_priv.path_secrets += other.tree_priv.path_secrets;
+  tree_priv.private_keys += other.tree_priv.private_keys;
+  tree_priv.bytes += other.tree_priv.bytes;
+
+  keys.secret_tree_nodes += other.keys.secret_tree_nodes;
+  keys.senders += other.keys.senders;
+  keys.cached_keys += other.keys.cached_keys;
+  keys.derived_keys += other.keys.derived_keys;
+  keys.max_sender_keys =
+    std::max(keys.max_sender_keys, other.keys.max_sender_keys);
+  keys.secret_bytes += other.keys.secret_bytes;
+
+  pending_proposals += other.pending_proposals;
+  proposal_bytes += other.proposal_bytes;
+  epochs += other.epochs;
+  return *this;
+}
+
+///
+/// RetainedEpoch
+///
+
+std::tuple<bytes, bytes>
+RetainedEpoch::unprotect(const MLSMessage& msg) const
+{
+  const auto* ct = var::get_if<MLSCiphertext>(&msg.message);
+  if (ct == nullptr) {
+    throw ProtocolError("Application data not sent as MLSCiphertext");
+  }
+
+  const auto has_leaf = [&](LeafIndex leaf) {
+    return leaf.val < _signature_keys.size() &&
+           _signature_keys.at(leaf.val).has_value();
+  };
+
+  auto maybe_content_auth =
+    ct->unprotect(_suite, has_leaf, _keys, _sender_data_secret);
+  if (!maybe_content_auth) {
+    throw ProtocolError("MLSCiphertext decryption failure");
+  }
+
+  auto& content_auth = opt::get(maybe_content_auth);
+  const auto sender =
+    var::get<MemberSender>(content_auth.content.sender.sender).sender;
+  const auto& pub = opt::get(_signature_keys.at(sender.val));
+  if (!content_auth.verify(_suite, pub, _context)) {
+    throw InvalidParameterError("Message signature failed to verify");
+  }
+
+  if (content_auth.content.content_type() != ContentType::application) {
+    throw ProtocolError("Unprotect of handshake message");
+  }
+
+  return {
+    std::move(content_auth.content.authenticated_data),
+    std::move(var::get<ApplicationData>(content_auth.content.content).data),
+  };
+}
+
+GroupMemoryUsage
+RetainedEpoch::memory_usage() const
+{
+  auto usage = GroupMemoryUsage{};
+  usage.keys = _keys.memory_usage();
+  usage.keys.secret_bytes += _sender_data_secret.size();
+  usage.epochs = 1;
+  return usage;
+}
+
+///
+/// EpochSnapshot
+///
+
+bytes
+EpochSnapshot::do_export(const std::string& label,
+                         const bytes& context,
+                         size_t size) const
+{
+  return KeyScheduleEpoch::do_export(
+    _suite, _exporter_secret, label, context, size);
+}
+
+std::vector<LeafNode>
+EpochSnapshot::roster() const
+{
+  const auto view = _tree.leaves();
+  return { view.begin(), view.end() };
+}
+
+bool
+operator==(const RetainedEpoch& lhs, const RetainedEpoch& rhs)
+{
+  return lhs._suite == rhs._suite && lhs._context == rhs._context &&
+         lhs._sender_data_secret == rhs._sender_data_secret &&
+         lhs._signature_keys == rhs._signature_keys;
+}
+
+bool
+operator!=(const RetainedEpoch& lhs, const RetainedEpoch& rhs)
+{
+  return !(lhs == rhs);
+}
+
+///
+/// GroupObserver
+///
+
+GroupObserver::GroupObserver(const GroupInfo& group_info,
+                             const std::optional<TreeKEMPublicKey>& tree)
+  : _suite(group_info.group_context.cipher_suite)
+  , _group_id(group_info.group_context.group_id)
+  , _epoch(group_info.group_context.epoch)
+  , _tree(import_public_tree(_suite,
+                             _group_id,
+                             group_info.group_context.tree_hash,
+                             tree,
+                             group_info.extensions,
+                             {}))
+  , _transcript_hash(_suite,
+                     group_info.group_context.confirmed_transcript_hash,
+                     group_info.confirmation_tag)
+  , _extensions(group_info.group_context.extensions)
+{
+  if (!group_info.verify(_tree)) {
+    throw InvalidParameterError("Invalid GroupInfo");
+  }
+
+  _group_info = group_info;
+}
+
+GroupContext
+GroupObserver::group_context() const
+{
+  return {
+    _suite,
+    _group_id,
+    _epoch,
+    _tree.root_hash(),
+    _transcript_hash.confirmed,
+    _extensions,
+  };
+}
+
+void
+GroupObserver::set_group_info(const GroupInfo& group_info)
+{
+  if (!(group_info.group_context == group_context())) {
+    throw InvalidParameterError("GroupInfo not for the current epoch");
+  }
+
+  if (!group_info.verify(_tree)) {
+    throw InvalidParameterError("Invalid GroupInfo");
+  }
+
+  _group_info = group_info;
+}
+
+void
+GroupObserver::set_executor(Executor executor)
+{
+  _executor = std::move(executor);
+}
+
+bool
+GroupObserver::handle(const MLSMessage& msg)
+{
+  if (msg.version != ProtocolVersion::mls10) {
+    throw InvalidParameterError("Unsupported version");
+  }
+
+  const auto* pt = var::get_if<MLSPlaintext>(&msg.message);
+  if (pt == nullptr) {
+    throw ProtocolError("Observed handshake message not sent as MLSPlaintext");
+  }
+
+  // Without the membership key, only the signature can be checked
+  const auto content_auth = pt->authenticated_content();
+  const auto& content = content_auth.content;
+  if (content.group_id != _group_id) {
+    throw InvalidParameterError("GroupID mismatch");
+  }
+
+  if (content.epoch != _epoch) {
+    throw InvalidParameterError("Epoch mismatch");
+  }
+
+  const auto ctx = group_context();
+  if (!verify_signature(_suite, _tree, _extensions, content_auth, ctx)) {
+    throw InvalidParameterError("Message signature failed to verify");
+  }
+
+  auto sender = std::optional<LeafIndex>{};
+  if (content.sender.sender_type() == SenderType::member) {
+    sender = var::get<MemberSender>(content.sender.sender).sender;
+  }
+
+  switch (content.content_type()) {
+    case ContentType::proposal:
+      cache_proposal({
+        _suite.ref(content_auth),
+        var::get<Proposal>(content.content),
+        sender,
+      });
+      return false;
+
+    case ContentType::commit:
+      break;
+
+    default:
+      throw InvalidParameterError("Invalid content type");
+  }
+
+  switch (content.sender.sender_type()) {
+    case SenderType::member:
+    case SenderType::new_member_commit:
+      break;
+
+    default:
+      throw ProtocolError("Invalid commit sender type");
+  }
+
+  const auto& commit = var::get<Commit>(content.content);
+  const auto proposals = must_resolve(commit.proposals, sender);
+  verify_add_key_packages(_suite, proposals, _executor);
+
+  // Work on a copy, so that an invalid Commit leaves the observer unchanged
+  auto next = *this;
+  next._pending_proposals.clear();
+  next._pending_proposal_index.clear();
+  next._group_info.reset();
+  const auto joiner_locations = next.apply(proposals);
+
+  auto sender_location = LeafIndex{ 0 };
+  if (sender) {
+    sender_location = opt::get(sender);
+  }
+
+  if (content.sender.sender_type() == SenderType::new_member_commit) {
+    if (!commit.valid_external()) {
+      throw ProtocolError("Invalid external commit");
+    }
+
+    sender_location =
+      external_joiner_location(commit, proposals, joiner_locations);
+  }
+
+  if (commit.path) {
+    const auto& path = opt::get(commit.path);
+    if (path.leaf_node.source() != LeafNodeSource::commit) {
+      throw ProtocolError("Commit path leaf node has invalid source");
+    }
+
+    if (!path.leaf_node.verify(_suite, _group_id)) {
+      throw ProtocolError("Invalid signature on commit path leaf node");
+    }
+
+    if (!next._tree.parent_hash_valid(sender_location, path)) {
+      throw ProtocolError("Commit path has invalid parent hash");
+    }
+
+    if (!next._tree.path_shape_valid(
+          sender_location, path, joiner_locations)) {
+      throw ProtocolError("Malformed direct path");
+    }
+
+    check_update_leaf_node(
+      next._tree, sender_location, path.leaf_node, LeafNodeSource::commit);
+    next._tree.merge(sender_location, path);
+  }
+
+  next._transcript_hash.update(content_auth);
+  next._epoch += 1;
+  *this = std::move(next);
+  return true;
+}
+
+void
+GroupObserver::cache_proposal(CachedProposal cached)
+{
+  // If the same proposal is sent twice, references resolve to the first copy
+  _pending_proposal_index.emplace(cached.ref, _pending_proposals.size());
+  _pending_proposals.push_back(std::move(cached));
+}
+
+std::vector<GroupObserver::CachedProposal>
+GroupObserver::must_resolve(const std::vector<ProposalOrRef>& ids,
+                            std::optional<LeafIndex> sender_index) const
+{
+  return stdx::transform<CachedProposal>(ids, [&](const auto& id) {
+    if (var::holds_alternative<Proposal>(id.content)) {
+      return CachedProposal{ {}, var::get<Proposal>(id.content), sender_index };
+    }
+
+    const auto& ref = var::get<ProposalRef>(id.content);
+    const auto it = _pending_proposal_index.find(ref);
+    if (it == _pending_proposal_index.end()) {
+      throw ProtocolError("Commit refers to an unknown proposal");
+    }
+
+    return _pending_proposals.at(it->second);
+  });
+}
+
+std::vector<LeafIndex>
+GroupObserver::apply(const std::vector<CachedProposal>& proposals)
+{
+  auto apply_update = [&](LeafIndex target, const Update& update) {
+    check_update_leaf_node(
+      _tree, target, update.leaf_node, LeafNodeSource::update);
+    _tree.update_leaf(target, update.leaf_node);
+  };
+
+  auto [removed, joiner_locations] =
+    apply_proposals(_tree, _extensions, proposals, apply_update);
+  silence_unused(removed);
+
+  _tree.truncate();
+  _tree.set_hash_all();
+  return joiner_locations;
+}
+
 } // namespace mls
@@ -1,9 +1,23 @@
+#include <mls/log.h>
 #include <mls/treekem.h>
 
+#include "probe.h"
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
 #if ENABLE_TREE_DUMP
 #include <iostream>
 #endif
 
+using mls::log::Histogram;
+using mls::log::ScopedTimer;
+
 namespace mls {
 
 // Utility method used for removing leaves from a resolution
@@ -106,13 +120,14 @@ TreeKEMPrivateKey::implant(const TreeKEMPublicKey& pub,
   path_secrets.insert_or_assign(start, secret);
   private_key_cache.erase(start);
 
+  const auto& path_label = KDFLabels::get().path;
   for (const auto& [n, _res] : fdp) {
-    secret = pub.suite.derive_secret(secret, "path");
+    secret = pub.suite.derive_secret(secret, path_label);
     path_secrets.insert_or_assign(n, secret);
     private_key_cache.erase(n);
   }
 
-  update_secret = pub.suite.derive_secret(secret, "path");
+  update_secret = pub.suite.derive_secret(secret, path_label);
 }
 
 std::optional<HPKEPrivateKey>
@@ -128,7 +143,7 @@ TreeKEMPrivateKey::private_key(NodeIndex n) const
     return std::nullopt;
   }
 
-  auto node_secret = suite.derive_secret(i->second, "node");
+  auto node_secret = suite.derive_secret(i->second, KDFLabels::get().node);
   return HPKEPrivateKey::derive(suite, node_secret);
 }
 
@@ -203,8 +218,8 @@ TreeKEMPublicKey::dump() const
   auto width = NodeCount(size);
   for (auto i = NodeIndex{ 0 }; i.val < width.val; i.val++) {
     printf("  %03d : ", i.val); // NOLINT
-    if (!node_at(i).blank()) {
-      auto pkRm = to_hex(opt::get(node_at(i).node).public_key().data);
+    if (!blank_at(i)) {
+      auto pkRm = to_hex(public_key_at(i).data);
       std::cout << pkRm.substr(0, 8);
     } else {
       std::cout << "        ";
@@ -215,13 +230,12 @@ TreeKEMPublicKey::dump() const
       std::cout << "  ";
     }
 
-    if (!node_at(i).blank()) {
+    if (!blank_at(i)) {
       std::cout << "X";
 
       if (!i.is_leaf()) {
-        auto parent = node_at(i).parent_node();
         std::cout << " [";
-        for (const auto u : parent.unmerged_leaves) {
+        for (const auto u : unmerged_at(i)) {
           std::cout << u.val << ", ";
         }
         std::cout << "]";
@@ -243,9 +257,10 @@ TreeKEMPrivateKey::decap(LeafIndex from,
                          const UpdatePath& path,
                          const std::vector<LeafIndex>& except)
 {
-  if (!consistent(pub)) {
-    throw ProtocolError("TreeKEMPublicKey inconsistent with TreeKEMPrivateKey");
-  }
+  const auto timer = ScopedTimer(Histogram::decap_time);
+  MLS_PROBE(decap_start, pub.size.val, probe_suite(suite), from.val);
+  const auto probe_done = ProbeOnExit(
+    [&] { MLS_PROBE(decap_done, pub.size.val, probe_suite(suite), from.val); });
 
   // Identify which node in the path secret we will be decrypting
   auto ni = NodeIndex(index);
@@ -288,10 +303,16 @@ TreeKEMPrivateKey::decap(LeafIndex from,
     throw ProtocolError("No private key to decrypt path secret");
   }
 
-  // Decrypt and implant
+  // Only the private key used to decrypt needs to match the public tree.  The
+  // others are either replaced by the implant below or left as they are.
   auto priv = opt::get(private_key(res[resi]));
+  if (priv.public_key != pub.public_key_at(res[resi])) {
+    throw ProtocolError("TreeKEMPublicKey inconsistent with TreeKEMPrivateKey");
+  }
+
+  // Decrypt and implant.  Only this one ciphertext is decoded.
   auto path_secret = priv.decrypt(
-    suite, context, {}, path.nodes[dpi].encrypted_path_secret[resi]);
+    suite, context, {}, path.nodes[dpi].encrypted_path_secret.at(resi));
   implant(pub, overlap_node, path_secret);
 }
 
@@ -299,17 +320,35 @@ void
 TreeKEMPrivateKey::truncate(LeafCount size)
 {
   auto ni = NodeIndex(LeafIndex{ size.val - 1 });
-  auto to_remove = std::vector<NodeIndex>{};
-  for (const auto& entry : path_secrets) {
-    if (entry.first.val > ni.val) {
-      to_remove.push_back(entry.first);
+  for (auto it = path_secrets.begin(); it != path_secrets.end();) {
+    // Erasing an entry from a PathMap leaves the other iterators valid
+    const auto n = (it++)->first;
+    if (n.val > ni.val) {
+      path_secrets.erase(n);
+      private_key_cache.erase(n);
     }
   }
+}
 
-  for (auto n : to_remove) {
-    path_secrets.erase(n);
-    private_key_cache.erase(n);
+TreeKEMPrivateKey::MemoryUsage
+TreeKEMPrivateKey::memory_usage() const
+{
+  auto usage = MemoryUsage{};
+  usage.path_secrets = path_secrets.size();
+  usage.private_keys = private_key_cache.size();
+  usage.bytes = update_secret.size();
+
+  for (const auto& [n, secret] : path_secrets) {
+    silence_unused(n);
+    usage.bytes += secret.size();
+  }
+
+  for (const auto& [n, priv] : private_key_cache) {
+    silence_unused(n);
+    usage.bytes += priv.data.size() + priv.public_key.data.size();
   }
+
+  return usage;
 }
 
 bool
@@ -345,10 +384,9 @@ TreeKEMPrivateKey::consistent(const TreeKEMPublicKey& other) const
     private_key(node);
   }
 
-  return stdx::all_of(private_key_cache, [other](const auto& entry) {
+  return stdx::all_of(private_key_cache, [&other](const auto& entry) {
     const auto& [node, priv] = entry;
-    const auto& opt_node = other.node_at(node).node;
-    if (!opt_node) {
+    if (other.blank_at(node)) {
       // It's OK for a TreeKEMPrivateKey to have private keys
       // for nodes that are blank in the TreeKEMPublicKey.
       // This will happen traniently during Commit
@@ -357,11 +395,66 @@ TreeKEMPrivateKey::consistent(const TreeKEMPublicKey& other) const
       return true;
     }
 
-    const auto& pub = opt::get(opt_node).public_key();
-    return priv.public_key == pub;
+    return priv.public_key == other.public_key_at(node);
   });
 }
 
+///
+/// LeafView
+///
+
+LeafView::iterator::iterator(const TreeKEMPublicKey* tree, LeafIndex index)
+  : _tree(tree)
+  , _index(index)
+{
+  skip_blanks();
+}
+
+LeafView::iterator::reference
+LeafView::iterator::operator*() const
+{
+  return _tree->leaf_at(_index);
+}
+
+LeafView::iterator&
+LeafView::iterator::operator++()
+{
+  _index.val += 1;
+  skip_blanks();
+  return *this;
+}
+
+bool
+LeafView::iterator::operator==(const iterator& other) const
+{
+  return _tree == other._tree && _index == other._index;
+}
+
+void
+LeafView::iterator::skip_blanks()
+{
+  while (_index < _tree->size && _tree->blank_at(NodeIndex(_index))) {
+    _index.val += 1;
+  }
+}
+
+LeafView::LeafView(const TreeKEMPublicKey& tree)
+  : _tree(&tree)
+{
+}
+
+LeafView::iterator
+LeafView::begin() const
+{
+  return { _tree, LeafIndex{ 0 } };
+}
+
+LeafView::iterator
+LeafView::end() const
+{
+  return { _tree, LeafIndex{ _tree->size.val } };
+}
+
 ///
 /// TreeKEMPublicKey
 ///
@@ -375,88 +468,205 @@ LeafIndex
 TreeKEMPublicKey::add_leaf(const LeafNode& leaf)
 {
   // Find the leftmost free leaf
-  auto index = LeafIndex(0);
-  while (index.val < size.val && node_at(NodeIndex(index)).node) {
-    index.val++;
-  }
+  const auto index = leftmost_blank_leaf();
 
   // Extend the tree if necessary
   auto ni = NodeIndex(index);
   if (index.val >= size.val) {
     if (size.val == 0) {
       size.val = 1;
-      nodes.resize(1);
+      resize_nodes(1);
     } else {
       size.val *= 2;
-      nodes.resize(2 * nodes.size() + 1);
+      resize_nodes(2 * width() + 1);
     }
   }
 
   // Set the leaf
-  node_at(ni).node = Node{ leaf };
+  set_leaf(index, leaf);
 
   // Update the unmerged list
-  for (auto& n : ni.dirpath(size)) {
-    if (!node_at(n).node) {
+  for (const auto n : ni.dirpath_range(size)) {
+    if (blank_at(n)) {
       continue;
     }
 
-    auto& parent = var::get<ParentNode>(opt::get(node_at(n).node).node);
-
     // Insert into unmerged leaves while maintaining order
-    const auto insert_point = stdx::upper_bound(parent.unmerged_leaves, index);
-    parent.unmerged_leaves.insert(insert_point, index);
+    auto& unmerged = parent_unmerged.mut(n.val >> 1U);
+    const auto insert_point = stdx::upper_bound(unmerged, index);
+    unmerged.insert(insert_point, index);
   }
 
   clear_hash_path(index);
   return index;
 }
 
+std::vector<LeafIndex>
+TreeKEMPublicKey::add_leaves(const std::vector<LeafNode>& leaves)
+{
+  // Fill the leaves that successive calls to add_leaf() would: the blank
+  // leaves from left to right, then new leaves past the end of the tree
+  auto indices = std::vector<LeafIndex>{};
+  indices.reserve(leaves.size());
+  while (indices.size() < leaves.size()) {
+    const auto index = leftmost_blank_leaf();
+    if (index.val >= size.val) {
+      break;
+    }
+
+    set_leaf(index, leaves[indices.size()]);
+    indices.push_back(index);
+  }
+
+  if (indices.size() < leaves.size()) {
+    // Extend the tree once, to the size that the last add would have reached
+    const auto first_new = size.val;
+    const auto last = first_new + uint32_t(leaves.size() - indices.size()) - 1;
+    size.val = std::max(size.val, uint32_t(1));
+    while (last >= size.val) {
+      size.val *= 2;
+    }
+
+    reserve(size);
+    resize_nodes(NodeCount(size).val);
+    for (auto next = first_new; indices.size() < leaves.size(); next++) {
+      set_leaf(LeafIndex{ next }, leaves[indices.size()]);
+      indices.push_back(LeafIndex{ next });
+    }
+  }
+
+  if (indices.empty()) {
+    return indices;
+  }
+
+  // Gather the new leaves below each parent node, then merge them into the
+  // parent's unmerged list.  The new leaves are in increasing order, so the
+  // gathered lists are sorted.
+  auto added = std::map<NodeIndex, std::vector<LeafIndex>>{};
+  for (const auto index : indices) {
+    for (const auto n : NodeIndex(index).dirpath_range(size)) {
+      if (!blank_at(n)) {
+        added[n].push_back(index);
+      }
+    }
+  }
+
+  for (const auto& [n, new_unmerged] : added) {
+    auto& unmerged = parent_unmerged.mut(n.val >> 1U);
+    auto merged = std::vector<LeafIndex>{};
+    merged.reserve(unmerged.size() + new_unmerged.size());
+    std::merge(unmerged.begin(),
+               unmerged.end(),
+               new_unmerged.begin(),
+               new_unmerged.end(),
+               std::back_inserter(merged));
+    unmerged = std::move(merged);
+  }
+
+  clear_hash_paths(indices);
+  return indices;
+}
+
+void
+TreeKEMPublicKey::blank_paths(const std::vector<LeafIndex>& indices)
+{
+  if (node_present.empty()) {
+    return;
+  }
+
+  // Direct paths converge towards the root, so each one only needs to be
+  // blanked up to the first node that an earlier path has already blanked
+  auto blanked = std::vector<bool>(width(), false);
+  for (const auto index : indices) {
+    clear_node(NodeIndex(index));
+    for (const auto n : NodeIndex(index).dirpath_range(size)) {
+      if (blanked[n.val]) {
+        break;
+      }
+
+      clear_node(n);
+      blanked[n.val] = true;
+    }
+  }
+
+  clear_hash_paths(indices);
+}
+
 void
 TreeKEMPublicKey::update_leaf(LeafIndex index, const LeafNode& leaf)
 {
   blank_path(index);
-  node_at(NodeIndex(index)).node = Node{ leaf };
+  set_leaf(index, leaf);
   clear_hash_path(index);
 }
 
 void
 TreeKEMPublicKey::blank_path(LeafIndex index)
 {
-  if (nodes.empty()) {
+  if (node_present.empty()) {
     return;
   }
 
-  auto ni = NodeIndex(index);
-  node_at(ni).node.reset();
-  for (auto n : ni.dirpath(size)) {
-    node_at(n).node.reset();
+  for (const auto n : NodeIndex(index).ancestors(size)) {
+    clear_node(n);
   }
 
   clear_hash_path(index);
 }
 
 void
-TreeKEMPublicKey::merge(LeafIndex from, const UpdatePath& path)
+TreeKEMPublicKey::reserve(LeafCount leaves)
 {
-  node_at(from).node = Node{ path.leaf_node };
+  // The tree grows by doubling, so it will be a power of two wide
+  auto leaf_slots = uint64_t(1);
+  while (leaf_slots < leaves.val) {
+    leaf_slots *= 2;
+  }
+
+  const auto parent_slots = leaf_slots - 1;
+  const auto node_slots = leaf_slots + parent_slots;
+  node_present.reserve(node_slots);
+  leaf_present.reserve(leaf_slots);
+  leaf_payloads.reserve(leaf_slots);
+  leaf_encodings.reserve(leaf_slots);
+  parent_keys.reserve(parent_slots);
+  parent_hash_values.reserve(parent_slots);
+  parent_unmerged.reserve(parent_slots);
+
+  hash_valid.reserve(node_slots);
+  hash_data.reserve(node_slots);
+  resolutions.reserve(node_slots);
+}
 
+void
+TreeKEMPublicKey::merge(LeafIndex from, const UpdatePath& path)
+{
   auto dp = filtered_direct_path(NodeIndex(from));
   if (dp.size() != path.nodes.size()) {
     throw ProtocolError("Malformed direct path");
   }
 
   auto ph = parent_hashes(from, dp, path.nodes);
-  for (size_t i = 0; i < dp.size(); i++) {
-    auto [n, _res] = dp[i];
+  merge(from, path, dp, ph);
+}
+
+void
+TreeKEMPublicKey::merge(LeafIndex from,
+                        const UpdatePath& path,
+                        const FilteredDirectPath& fdp,
+                        const std::vector<bytes>& ph)
+{
+  set_leaf(from, path.leaf_node);
+
+  for (size_t i = 0; i < fdp.size(); i++) {
+    const auto& n = std::get<0>(fdp[i]);
 
     auto parent_hash = bytes{};
-    if (i < dp.size() - 1) {
+    if (i < fdp.size() - 1) {
       parent_hash = ph[i + 1];
     }
 
-    node_at(n).node = { ParentNode{
-      path.nodes[i].public_key, parent_hash, {} } };
+    set_parent(n, { path.nodes[i].public_key, parent_hash, {} });
   }
 
   clear_hash_path(from);
@@ -466,88 +676,233 @@ TreeKEMPublicKey::merge(LeafIndex from, const UpdatePath& path)
 void
 TreeKEMPublicKey::set_hash_all()
 {
+  const auto timer = ScopedTimer(Histogram::tree_hash_time);
   auto r = NodeIndex::root(size);
   get_hash(r);
 }
 
+void
+TreeKEMPublicKey::set_hash_all(const TreeHashOptions& opts)
+{
+  const auto roots = subtree_roots(opts.depth);
+  if (!opts.executor || roots.size() < 2) {
+    set_hash_all();
+    return;
+  }
+
+  const auto timer = ScopedTimer(Histogram::tree_hash_time);
+
+  // Size the cache up front and make sure none of it is shared with another
+  // tree, so that each task writes only to its own range of digests.  The
+  // validity bitmap is packed, so it is not safe to write from several
+  // threads; the subtrees are marked valid once all tasks are done.
+  reserve_hashes(NodeCount(size).val);
+  hash_data.detach();
+  resolutions.detach();
+  execute(opts.executor, roots.size(), [&](size_t i) {
+    get_hash(roots[i], false);
+  });
+
+  for (const auto& root : roots) {
+    const auto span = (size_t(1) << root.level()) - 1;
+    const auto start = hash_valid.begin() + (root.val - span);
+    std::fill(start, start + 2 * span + 1, true);
+  }
+
+  get_hash(NodeIndex::root(size));
+}
+
 bytes
 TreeKEMPublicKey::root_hash() const
 {
   auto r = NodeIndex::root(size);
-  if (hashes.count(r) == 0) {
+  if (!has_hash(r)) {
     throw InvalidParameterError("Root hash not set");
   }
 
-  return hashes.at(r);
+  return cached_hash(r);
 }
 
 bool
 TreeKEMPublicKey::has_parent_hash(NodeIndex child, const bytes& target_ph) const
 {
-  const auto res = resolve(child);
+  auto scratch = std::vector<NodeIndex>{};
+  const auto& res = resolve(child, scratch);
   return stdx::any_of(res, [&](auto nr) {
-    return opt::get(node_at(nr).node).parent_hash() == target_ph;
+    if (!nr.is_leaf()) {
+      return parent_hash_values.at(nr.val >> 1U) == target_ph;
+    }
+
+    const auto& content = leaf_at(LeafIndex(nr)).content;
+    return var::holds_alternative<ParentHash>(content) &&
+           var::get<ParentHash>(content).parent_hash == target_ph;
   });
 }
 
 bool
 TreeKEMPublicKey::parent_hash_valid() const
 {
-  auto cache = TreeHashCache{};
+  if (size.val == 0) {
+    return true;
+  }
+
+  if (!parent_hash_valid(NodeIndex::root(size), 1)) {
+    dump();
+    return false;
+  }
+
+  return true;
+}
+
+bool
+TreeKEMPublicKey::parent_hash_valid(const TreeHashOptions& opts) const
+{
+  const auto roots = subtree_roots(opts.depth);
+  if (!opts.executor || roots.size() < 2) {
+    return parent_hash_valid();
+  }
 
-  auto width = NodeCount(size);
-  auto height = NodeIndex::root(size).level();
-  for (auto level = uint32_t(1); level <= height; level++) {
-    auto stride = uint32_t(2) << level;
-    auto start = NodeIndex{ (stride >> 1U) - 1 };
+  // Each task checks the parent nodes within one subtree.  The levels above the
+  // subtrees are then checked serially, reusing the original tree hashes the
+  // tasks computed.
+  auto valid = std::vector<uint8_t>(roots.size(), 0);
+  execute(opts.executor, roots.size(), [&](size_t i) {
+    valid[i] = parent_hash_valid(roots[i], 1) ? 1 : 0;
+  });
 
-    for (auto p = start; p.val < width.val; p.val += stride) {
-      if (node_at(p).blank()) {
-        continue;
-      }
+  const auto top_level = roots.front().level() + 1;
+  if (stdx::contains(valid, uint8_t(0)) ||
+      !parent_hash_valid(NodeIndex::root(size), top_level)) {
+    dump();
+    return false;
+  }
+
+  return true;
+}
+
+bool
+TreeKEMPublicKey::leaf_signatures_valid(const bytes& group_id,
+                                        const Executor& executor) const
+{
+  auto checks = std::vector<SignatureVerification>{};
+  for (LeafIndex i{ 0 }; i < size; i.val++) {
+    if (has_leaf(i)) {
+      checks.push_back(leaf_at(i).signature_verification(suite, group_id));
+    }
+  }
+
+  return SignaturePublicKey::verify_batch(suite, checks, executor);
+}
 
-      auto l = p.left();
-      auto r = p.right();
+bool
+TreeKEMPublicKey::parent_hash_valid(NodeIndex subtree,
+                                    uint32_t min_level) const
+{
+  const auto cache = original_hash_cache();
 
-      auto lh = original_parent_hash(cache, p, r);
-      auto rh = original_parent_hash(cache, p, l);
+  // Walk the parent nodes of the subtree level by level, bottom up
+  const auto span = (uint32_t(1) << subtree.level()) - 1;
+  const auto first = subtree.val - span;
+  const auto last = subtree.val + span;
+  for (auto level = min_level; level <= subtree.level(); level++) {
+    auto stride = uint32_t(2) << level;
+    auto start = NodeIndex{ first + (stride >> 1U) - 1 };
 
-      if (!has_parent_hash(l, lh) && !has_parent_hash(r, rh)) {
-        dump();
+    for (auto p = start; p.val <= last; p.val += stride) {
+      if (!blank_at(p) && !parent_node_valid(*cache, p)) {
         return false;
       }
     }
   }
+
   return true;
 }
 
-std::vector<NodeIndex>
-TreeKEMPublicKey::resolve(NodeIndex index) const // NOLINT(misc-no-recursion)
+bool
+TreeKEMPublicKey::direct_path_parent_hash_valid(LeafIndex leaf) const
 {
-  auto at_leaf = (index.level() == 0);
-  if (!node_at(index).blank()) {
-    auto out = std::vector<NodeIndex>{ index };
-    if (index.is_leaf()) {
-      return out;
+  const auto cache = original_hash_cache();
+  for (const auto p : NodeIndex(leaf).dirpath_range(size)) {
+    if (!blank_at(p) && !parent_node_valid(*cache, p)) {
+      return false;
     }
+  }
 
-    const auto& node = node_at(index);
-    auto unmerged =
-      stdx::transform<NodeIndex>(node.parent_node().unmerged_leaves,
-                                 [](LeafIndex x) { return NodeIndex(x); });
+  return true;
+}
 
-    out.insert(out.end(), unmerged.begin(), unmerged.end());
-    return out;
+// A parent node is valid if one of its children holds its parent hash
+bool
+TreeKEMPublicKey::parent_node_valid(OriginalHashCache& cache,
+                                    NodeIndex parent) const
+{
+  auto l = parent.left();
+  auto r = parent.right();
+
+  auto lh = original_parent_hash(cache, parent, r);
+  auto rh = original_parent_hash(cache, parent, l);
+
+  return has_parent_hash(l, lh) || has_parent_hash(r, rh);
+}
+
+std::vector<NodeIndex>
+TreeKEMPublicKey::resolve(NodeIndex index) const
+{
+  auto scratch = std::vector<NodeIndex>{};
+  return resolve(index, scratch);
+}
+
+const std::vector<NodeIndex>&
+TreeKEMPublicKey::resolve(NodeIndex index,
+                          std::vector<NodeIndex>& scratch) const
+{
+  if (has_hash(index)) {
+    return resolutions.at(index.val);
+  }
+
+  scratch.clear();
+  append_resolution(index, scratch);
+  return scratch;
+}
+
+void
+TreeKEMPublicKey::append_resolution( // NOLINT(misc-no-recursion)
+  NodeIndex index,
+  std::vector<NodeIndex>& out) const
+{
+  if (has_hash(index)) {
+    const auto& cached = resolutions.at(index.val);
+    out.insert(out.end(), cached.begin(), cached.end());
+    return;
+  }
+
+  if (!blank_at(index) || index.is_leaf()) {
+    const auto own = node_resolution(index);
+    out.insert(out.end(), own.begin(), own.end());
+    return;
   }
 
-  if (at_leaf) {
+  append_resolution(index.left(), out);
+  append_resolution(index.right(), out);
+}
+
+std::vector<NodeIndex>
+TreeKEMPublicKey::node_resolution(NodeIndex index) const
+{
+  if (blank_at(index)) {
     return {};
   }
 
-  auto l = resolve(index.left());
-  auto r = resolve(index.right());
-  l.insert(l.end(), r.begin(), r.end());
-  return l;
+  auto out = std::vector<NodeIndex>{ index };
+  if (index.is_leaf()) {
+    return out;
+  }
+
+  auto unmerged = stdx::transform<NodeIndex>(
+    unmerged_at(index), [](LeafIndex x) { return NodeIndex(x); });
+
+  out.insert(out.end(), unmerged.begin(), unmerged.end());
+  return out;
 }
 
 TreeKEMPublicKey::FilteredDirectPath
@@ -555,11 +910,12 @@ TreeKEMPublicKey::filtered_direct_path(NodeIndex index) const
 {
   auto fdp = FilteredDirectPath{};
 
-  const auto cp = index.copath(size);
+  const auto cp = index.copath_range(size);
   auto last = index;
+  auto scratch = std::vector<NodeIndex>{};
   for (auto n : cp) {
     const auto p = n.parent();
-    const auto res = resolve(n);
+    const auto& res = resolve(n, scratch);
     last = p;
     if (res.empty()) {
       continue;
@@ -574,15 +930,114 @@ TreeKEMPublicKey::filtered_direct_path(NodeIndex index) const
 bool
 TreeKEMPublicKey::has_leaf(LeafIndex index) const
 {
-  return !node_at(index).blank();
+  return !blank_at(NodeIndex(index));
 }
 
+struct TreeKEMPublicKey::LeafLookup
+{
+  std::unordered_map<bytes, std::set<LeafIndex>> by_encryption_key;
+  std::unordered_map<bytes, std::set<LeafIndex>> by_signature_key;
+
+  // The number of members using and supporting each credential type, and
+  // supporting each extension and proposal type.  The capabilities that the
+  // whole group has in common are the types supported by every member.
+  std::map<CredentialType, uint32_t> credential_types;
+  std::map<CredentialType, uint32_t> supported_types;
+  std::map<Extension::Type, uint32_t> supported_extensions;
+  std::map<uint16_t, uint32_t> supported_proposals;
+  uint32_t member_count = 0;
+
+  void add(LeafIndex index, const LeafNode& leaf)
+  {
+    by_encryption_key[leaf.encryption_key.data].insert(index);
+    by_signature_key[leaf.signature_key.data].insert(index);
+    credential_types[leaf.credential.type()] += 1;
+    for (const auto type : unique(leaf.capabilities.credentials)) {
+      supported_types[type] += 1;
+    }
+    for (const auto type : unique(leaf.capabilities.extensions)) {
+      supported_extensions[type] += 1;
+    }
+    for (const auto type : unique(leaf.capabilities.proposals)) {
+      supported_proposals[type] += 1;
+    }
+    member_count += 1;
+  }
+
+  void remove(LeafIndex index, const LeafNode& leaf)
+  {
+    erase(by_encryption_key, leaf.encryption_key.data, index);
+    erase(by_signature_key, leaf.signature_key.data, index);
+    decrement(credential_types, leaf.credential.type());
+    for (const auto type : unique(leaf.capabilities.credentials)) {
+      decrement(supported_types, type);
+    }
+    for (const auto type : unique(leaf.capabilities.extensions)) {
+      decrement(supported_extensions, type);
+    }
+    for (const auto type : unique(leaf.capabilities.proposals)) {
+      decrement(supported_proposals, type);
+    }
+    member_count -= 1;
+  }
+
+  template<typename T>
+  std::vector<T> supported_by_all(const std::map<T, uint32_t>& counts) const
+  {
+    auto types = std::vector<T>{};
+    for (const auto& [type, count] : counts) {
+      if (count == member_count) {
+        types.push_back(type);
+      }
+    }
+    return types;
+  }
+
+private:
+  static void erase(std::unordered_map<bytes, std::set<LeafIndex>>& index,
+                    const bytes& key,
+                    LeafIndex leaf)
+  {
+    const auto it = index.find(key);
+    if (it == index.end()) {
+      return;
+    }
+
+    it->second.erase(leaf);
+    if (it->second.empty()) {
+      index.erase(it);
+    }
+  }
+
+  // A type listed twice by one leaf is still only supported by one member
+  template<typename T>
+  static std::set<T> unique(const std::vector<T>& types)
+  {
+    return { types.begin(), types.end() };
+  }
+
+  template<typename T>
+  static void decrement(std::map<T, uint32_t>& counts, T type)
+  {
+    const auto it = counts.find(type);
+    if (it != counts.end() && --it->second == 0) {
+      counts.erase(it);
+    }
+  }
+};
+
 std::optional<LeafIndex>
 TreeKEMPublicKey::find(const LeafNode& leaf) const
 {
-  for (LeafIndex i{ 0 }; i < size; i.val++) {
-    const auto& node = node_at(i);
-    if (!node.blank() && node.leaf_node() == leaf) {
+  // Only leaves with the same encryption key can be equal to `leaf`
+  const auto table = lookup();
+  const auto it = table->by_encryption_key.find(leaf.encryption_key.data);
+  if (it == table->by_encryption_key.end()) {
+    return std::nullopt;
+  }
+
+  for (const auto i : it->second) {
+    if (leaf_at(i) == leaf) {
       return i;
     }
   }
@@ -590,15 +1045,112 @@ TreeKEMPublicKey::find(const LeafNode& leaf) const
   return std::nullopt;
 }
 
+// Whether any leaves other than `except` are listed under `key`
+static bool
+has_key(const std::unordered_map<bytes, std::set<LeafIndex>>& index,
+        const bytes& key,
+        std::optional<LeafIndex> except)
+{
+  const auto it = index.find(key);
+  if (it == index.end()) {
+    return false;
+  }
+
+  const auto& leaves = it->second;
+  return leaves.size() > 1 || !except || leaves.count(opt::get(except)) == 0;
+}
+
+bool
+TreeKEMPublicKey::has_encryption_key(const HPKEPublicKey& key,
+                                     std::optional<LeafIndex> except) const
+{
+  return has_key(lookup()->by_encryption_key, key.data, except);
+}
+
+bool
+TreeKEMPublicKey::has_signature_key(const SignaturePublicKey& key,
+                                    std::optional<LeafIndex> except) const
+{
+  return has_key(lookup()->by_signature_key, key.data, except);
+}
+
+bool
+TreeKEMPublicKey::credentials_supported(const Capabilities& capabilities,
+                                        std::optional<LeafIndex> except) const
+{
+  const auto table = lookup();
+  const auto* excepted = (except && has_leaf(opt::get(except)))
+                           ? &leaf_at(opt::get(except))
+                           : nullptr;
+  for (const auto& [type, count] : table->credential_types) {
+    const auto excepted_uses =
+      (excepted != nullptr && excepted->credential.type() == type) ? 1U : 0U;
+    if (count > excepted_uses &&
+        !stdx::contains(capabilities.credentials, type)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+TreeKEMPublicKey::credential_supported_by_all(
+  CredentialType type,
+  std::optional<LeafIndex> except) const
+{
+  const auto table = lookup();
+  auto members = table->member_count;
+  auto supporters = uint32_t(0);
+  const auto it = table->supported_types.find(type);
+  if (it != table->supported_types.end()) {
+    supporters = it->second;
+  }
+
+  if (except && has_leaf(opt::get(except))) {
+    const auto& capabilities = leaf_at(opt::get(except)).capabilities;
+    members -= 1;
+    supporters -= stdx::contains(capabilities.credentials, type) ? 1U : 0U;
+  }
+
+  return supporters == members;
+}
+
+Capabilities
+TreeKEMPublicKey::common_capabilities() const
+{
+  const auto table = lookup();
+  auto common = Capabilities{};
+  common.extensions = table->supported_by_all(table->supported_extensions);
+  common.proposals = table->supported_by_all(table->supported_proposals);
+  common.credentials = table->supported_by_all(table->supported_types);
+  return common;
+}
+
 std::optional<LeafNode>
 TreeKEMPublicKey::leaf_node(LeafIndex index) const
 {
-  const auto& node = node_at(index);
-  if (node.blank()) {
+  if (blank_at(NodeIndex(index))) {
     return std::nullopt;
   }
 
-  return node.leaf_node();
+  return leaf_at(index);
+}
+
+const LeafNode*
+TreeKEMPublicKey::leaf_node_ptr(LeafIndex index) const
+{
+  if (blank_at(NodeIndex(index))) {
+    return nullptr;
+  }
+
+  return &leaf_at(index);
+}
+
+LeafView
+TreeKEMPublicKey::leaves() const
+{
+  return LeafView(*this);
 }
 
 std::tuple<TreeKEMPrivateKey, UpdatePath>
@@ -610,33 +1162,70 @@ TreeKEMPublicKey::encap(LeafIndex from,
                         const std::vector<LeafIndex>& except,
                         const LeafNodeOptions& opts)
 {
-  // Grab information about the sender
-  const auto& leaf_node = node_at(from);
-  if (leaf_node.blank()) {
-    throw InvalidParameterError("Cannot encap from blank node");
-  }
+  return encap(
+    from, group_id, context, leaf_secret, sig_priv, except, opts, {});
+}
+
+std::tuple<TreeKEMPrivateKey, UpdatePath>
+TreeKEMPublicKey::encap(LeafIndex from,
+                        const bytes& group_id,
+                        const bytes& context,
+                        const bytes& leaf_secret,
+                        const SignaturePrivateKey& sig_priv,
+                        const std::vector<LeafIndex>& except,
+                        const LeafNodeOptions& opts,
+                        const Executor& executor)
+{
+  const auto timer = ScopedTimer(Histogram::encap_time);
+  MLS_PROBE(encap_start, size.val, probe_suite(suite), from.val);
+  const auto probe_done = ProbeOnExit(
+    [&] { MLS_PROBE(encap_done, size.val, probe_suite(suite), from.val); });
+
+  // Grab information about the sender
+  if (blank_at(NodeIndex(from))) {
+    throw InvalidParameterError("Cannot encap from blank node");
+  }
 
   // Generate path secrets
   auto priv = TreeKEMPrivateKey::create(*this, from, leaf_secret);
   auto dp = filtered_direct_path(NodeIndex(from));
 
-  // Encrypt path secrets to the copath
-  auto path_nodes = stdx::transform<UpdatePathNode>(dp, [&](const auto& dpn) {
+  // Lay out the UpdatePath and list the (path node, ciphertext, recipient)
+  // triples to be encrypted
+  auto path_nodes = std::vector<UpdatePathNode>{};
+  auto recipients = std::vector<std::tuple<size_t, size_t, NodeIndex>>{};
+  for (size_t i = 0; i < dp.size(); i++) {
     // We need the copy here so that we can modify the resolution.
     // NOLINTNEXTLINE(performance-unnecessary-copy-initialization)
-    auto [n, res] = dpn;
+    auto [n, res] = dp[i];
     remove_leaves(res, except);
 
-    auto path_secret = priv.path_secrets.at(n);
+    for (size_t j = 0; j < res.size(); j++) {
+      recipients.emplace_back(i, j, res[j]);
+    }
+
     auto node_priv = opt::get(priv.private_key(n));
+    path_nodes.push_back(
+      { node_priv.public_key, HPKECiphertextList(res.size()) });
+  }
 
-    auto ct = stdx::transform<HPKECiphertext>(res, [&](auto nr) {
-      const auto& node_pub = opt::get(node_at(nr).node).public_key();
-      return node_pub.encrypt(suite, context, {}, path_secret);
-    });
+  // Encrypt path secrets to the copath, as one batch
+  auto pubs = std::vector<const HPKEPublicKey*>{};
+  auto pts = std::vector<bytes>{};
+  pubs.reserve(recipients.size());
+  pts.reserve(recipients.size());
+  for (const auto& recipient : recipients) {
+    const auto& n = std::get<0>(dp.at(std::get<0>(recipient)));
+    pubs.push_back(&public_key_at(std::get<2>(recipient)));
+    pts.push_back(priv.path_secrets.at(n));
+  }
 
-    return UpdatePathNode{ node_priv.public_key, std::move(ct) };
-  });
+  auto cts =
+    HPKEPublicKey::encrypt_batch(suite, pubs, context, {}, pts, executor);
+  for (size_t k = 0; k < recipients.size(); k++) {
+    const auto [i, j, nr] = recipients.at(k);
+    path_nodes.at(i).encrypted_path_secret.set(j, std::move(cts.at(k)));
+  }
 
   // Update and re-sign the leaf_node
   auto ph = parent_hashes(from, dp, path_nodes);
@@ -646,14 +1235,15 @@ TreeKEMPublicKey::encap(LeafIndex from,
   }
 
   auto leaf_pub = opt::get(priv.private_key(NodeIndex(from))).public_key;
-  auto new_leaf = leaf_node.leaf_node().for_commit(
+  auto new_leaf = leaf_at(from).for_commit(
     suite, group_id, leaf_pub, ph0, opts, sig_priv);
 
   // Package everything into an UpdatePath
   auto path = UpdatePath{ std::move(new_leaf), std::move(path_nodes) };
 
-  // Update the public key itself
-  merge(from, path);
+  // Update the public key itself, with the direct path and parent hashes that
+  // the leaf was just signed over
+  merge(from, path, dp, ph);
   return std::make_tuple(priv, path);
 }
 
@@ -667,82 +1257,405 @@ TreeKEMPublicKey::truncate()
   // Clear the parent hashes across blank leaves before truncating
   auto index = LeafIndex{ size.val - 1 };
   for (; index.val > 0; index.val--) {
-    if (!node_at(index).blank()) {
+    if (!blank_at(NodeIndex(index))) {
       break;
     }
     clear_hash_path(index);
   }
 
-  if (node_at(index).blank()) {
-    nodes.clear();
+  if (blank_at(NodeIndex(index))) {
+    resize_nodes(0);
+    clear_hash_all();
     return;
   }
 
   // Remove the right subtree until the tree is of minimal size
   while (size.val / 2 > index.val) {
-    nodes.resize(nodes.size() / 2);
+    resize_nodes(width() / 2);
     size.val /= 2;
   }
+
+  // Invalidate any cached hashes for nodes that are no longer in the tree
+  const auto width = size_t(NodeCount(size).val);
+  if (width < hash_valid.size()) {
+    std::fill(hash_valid.begin() + width, hash_valid.end(), false);
+  }
 }
 
-OptionalNode&
-TreeKEMPublicKey::node_at(NodeIndex n)
+OptionalNode
+TreeKEMPublicKey::node_at(NodeIndex n) const
 {
-  auto width = NodeCount(size);
-  if (n.val >= width.val) {
-    throw InvalidParameterError("Node index not in tree");
+  if (blank_at(n)) {
+    return {};
   }
 
-  if (n.val >= nodes.size()) {
-    return blank_node;
+  const auto slot = n.val >> 1U;
+  if (n.is_leaf()) {
+    return { Node{ leaf_payloads.at(slot) } };
   }
 
-  return nodes.at(n.val);
+  return { Node{ ParentNode{
+    parent_keys.at(slot),
+    parent_hash_values.at(slot),
+    parent_unmerged.at(slot),
+  } } };
 }
 
-const OptionalNode&
-TreeKEMPublicKey::node_at(NodeIndex n) const
+OptionalNode
+TreeKEMPublicKey::node_at(LeafIndex n) const
 {
-  auto width = NodeCount(size);
-  if (n.val >= width.val) {
+  return node_at(NodeIndex(n));
+}
+
+TreeKEMPublicKey::MemoryUsage
+TreeKEMPublicKey::memory_usage() const
+{
+  auto usage = MemoryUsage{};
+
+  // The arrays themselves, including their blank slots
+  usage.bytes += node_present.size() / CHAR_BIT;
+  usage.bytes += leaf_payloads.size() * sizeof(LeafNode);
+  usage.bytes += leaf_encodings.size() * sizeof(bytes);
+  usage.bytes += parent_keys.size() * sizeof(HPKEPublicKey);
+  usage.bytes += parent_hash_values.size() * sizeof(bytes);
+  usage.bytes += parent_unmerged.size() * sizeof(std::vector<LeafIndex>);
+  usage.bytes += hash_data.size() * hash_data.row_width();
+  usage.bytes += resolutions.size() * sizeof(std::vector<NodeIndex>);
+
+  // What the present nodes hold outside of the arrays
+  for (uint32_t i = 0; i < node_present.size(); i++) {
+    if (!node_present[i]) {
+      continue;
+    }
+
+    usage.nodes += 1;
+
+    const auto n = NodeIndex{ i };
+    const auto slot = i >> 1U;
+    if (n.is_leaf()) {
+      const auto& leaf = leaf_payloads.at(slot);
+      usage.bytes += leaf.encryption_key.data.size();
+      usage.bytes += leaf.signature_key.data.size();
+      usage.bytes += leaf.signature.size();
+      usage.bytes += leaf_encodings.at(slot).size();
+      continue;
+    }
+
+    usage.bytes += parent_keys.at(slot).data.size();
+    usage.bytes += parent_hash_values.at(slot).size();
+    usage.bytes += parent_unmerged.at(slot).size() * sizeof(LeafIndex);
+  }
+
+  for (uint32_t i = 0; i < hash_valid.size(); i++) {
+    if (!hash_valid[i]) {
+      continue;
+    }
+
+    usage.cached_hashes += 1;
+    if (i < resolutions.size()) {
+      usage.bytes += resolutions.at(i).size() * sizeof(NodeIndex);
+    }
+  }
+
+  return usage;
+}
+
+size_t
+TreeKEMPublicKey::width() const
+{
+  return node_present.size();
+}
+
+void
+TreeKEMPublicKey::resize_nodes(size_t width)
+{
+  // Truncation only drops blank leaves, which are not in the index
+  if (width == 0) {
+    leaf_lookup.reset();
+  }
+
+  node_present.resize(width, false);
+  leaf_present.resize((width + 1) / 2);
+  leaf_payloads.resize((width + 1) / 2);
+  leaf_encodings.resize((width + 1) / 2);
+  parent_keys.resize(width / 2);
+  parent_hash_values.resize(width / 2);
+  parent_unmerged.resize(width / 2);
+}
+
+bool
+TreeKEMPublicKey::blank_at(NodeIndex n) const
+{
+  if (n.val >= NodeCount(size).val) {
     throw InvalidParameterError("Node index not in tree");
   }
 
-  if (n.val >= nodes.size()) {
-    return blank_node;
+  return n.val >= node_present.size() || !node_present[n.val];
+}
+
+LeafIndex
+TreeKEMPublicKey::leftmost_blank_leaf() const
+{
+  // Leaves past the end of the node arrays are blank as well
+  return LeafIndex{ static_cast<uint32_t>(leaf_present.first_free()) };
+}
+
+const LeafNode&
+TreeKEMPublicKey::leaf_at(LeafIndex n) const
+{
+  return leaf_payloads.at(n.val);
+}
+
+const HPKEPublicKey&
+TreeKEMPublicKey::public_key_at(NodeIndex n) const
+{
+  if (n.is_leaf()) {
+    return leaf_payloads.at(n.val >> 1U).encryption_key;
   }
 
-  return nodes.at(n.val);
+  return parent_keys.at(n.val >> 1U);
 }
 
-OptionalNode&
-TreeKEMPublicKey::node_at(LeafIndex n)
+const std::vector<LeafIndex>&
+TreeKEMPublicKey::unmerged_at(NodeIndex n) const
 {
-  return nodes.at(NodeIndex(n).val);
+  return parent_unmerged.at(n.val >> 1U);
 }
 
-const OptionalNode&
-TreeKEMPublicKey::node_at(LeafIndex n) const
+void
+TreeKEMPublicKey::set_leaf(LeafIndex n, LeafNode leaf)
+{
+  auto encoding = tls::marshal(leaf);
+  set_leaf(n, std::move(leaf), std::move(encoding));
+}
+
+void
+TreeKEMPublicKey::set_leaf(LeafIndex n, LeafNode leaf, bytes encoding)
 {
-  return nodes.at(NodeIndex(n).val);
+  if (!blank_at(NodeIndex(n))) {
+    lookup_remove(n);
+  }
+
+  node_present.at(NodeIndex(n).val) = true;
+  leaf_present.set(n.val, true);
+  leaf_payloads.mut(n.val) = std::move(leaf);
+  leaf_encodings.mut(n.val) = std::move(encoding);
+  lookup_add(n);
+}
+
+void
+TreeKEMPublicKey::set_parent(NodeIndex n, ParentNode parent)
+{
+  const auto slot = n.val >> 1U;
+  node_present.at(n.val) = true;
+  parent_keys.mut(slot) = std::move(parent.public_key);
+  parent_hash_values.mut(slot) = std::move(parent.parent_hash);
+  parent_unmerged.mut(slot) = std::move(parent.unmerged_leaves);
+}
+
+void
+TreeKEMPublicKey::clear_node(NodeIndex n)
+{
+  if (n.val >= node_present.size() || !node_present[n.val]) {
+    return;
+  }
+
+  // Release the storage for the node's content along with marking it blank
+  const auto slot = n.val >> 1U;
+  if (n.is_leaf()) {
+    lookup_remove(LeafIndex(n));
+  }
+
+  node_present[n.val] = false;
+  if (n.is_leaf()) {
+    leaf_present.set(slot, false);
+    leaf_payloads.mut(slot) = {};
+    leaf_encodings.mut(slot) = {};
+  } else {
+    parent_keys.mut(slot) = {};
+    parent_hash_values.mut(slot) = {};
+    parent_unmerged.mut(slot) = {};
+  }
+}
+
+std::shared_ptr<const TreeKEMPublicKey::LeafLookup>
+TreeKEMPublicKey::lookup() const
+{
+  auto table = std::atomic_load(&leaf_lookup);
+  if (table) {
+    return table;
+  }
+
+  table = std::make_shared<LeafLookup>();
+  for (auto i = LeafIndex{ 0 }; i < size; i.val++) {
+    if (!blank_at(NodeIndex(i))) {
+      table->add(i, leaf_at(i));
+    }
+  }
+
+  std::atomic_store(&leaf_lookup, table);
+  return table;
+}
+
+void
+TreeKEMPublicKey::release_lookups() const
+{
+  std::atomic_store(&leaf_lookup, std::shared_ptr<LeafLookup>{});
+}
+
+TreeKEMPublicKey::LeafLookup*
+TreeKEMPublicKey::mutable_lookup()
+{
+  if (!leaf_lookup) {
+    return nullptr;
+  }
+
+  // Another copy of the tree, or a caller of lookup(), still holds the index,
+  // so take a private copy before applying the change
+  if (leaf_lookup.use_count() != 1) {
+    leaf_lookup = std::make_shared<LeafLookup>(*leaf_lookup);
+  }
+
+  return leaf_lookup.get();
+}
+
+void
+TreeKEMPublicKey::lookup_remove(LeafIndex index)
+{
+  if (auto* table = mutable_lookup()) {
+    table->remove(index, leaf_at(index));
+  }
+}
+
+void
+TreeKEMPublicKey::lookup_add(LeafIndex index)
+{
+  if (auto* table = mutable_lookup()) {
+    table->add(index, leaf_at(index));
+  }
 }
 
 void
 TreeKEMPublicKey::clear_hash_all()
 {
-  hashes.clear();
+  original_hashes.reset();
+  std::fill(hash_valid.begin(), hash_valid.end(), false);
 }
 
 void
 TreeKEMPublicKey::clear_hash_path(LeafIndex index)
 {
-  auto dp = NodeIndex(index).dirpath(size);
-  hashes.erase(NodeIndex(index));
-  for (auto n : dp) {
-    hashes.erase(n);
+  original_hashes.reset();
+  const auto clear = [&](NodeIndex n) {
+    if (n.val < hash_valid.size()) {
+      hash_valid[n.val] = false;
+    }
+  };
+
+  for (const auto n : NodeIndex(index).ancestors(size)) {
+    clear(n);
   }
 }
 
+void
+TreeKEMPublicKey::clear_hash_paths(const std::vector<LeafIndex>& indices)
+{
+  original_hashes.reset();
+  // As in blank_paths(), stop at the first node already cleared in this pass
+  auto cleared = std::vector<bool>(hash_valid.size(), false);
+  const auto clear = [&](NodeIndex n) {
+    if (n.val >= hash_valid.size()) {
+      return true;
+    }
+
+    if (cleared[n.val]) {
+      return false;
+    }
+
+    hash_valid[n.val] = false;
+    cleared[n.val] = true;
+    return true;
+  };
+
+  for (const auto index : indices) {
+    clear(NodeIndex(index));
+    for (const auto n : NodeIndex(index).dirpath_range(size)) {
+      if (!clear(n)) {
+        break;
+      }
+    }
+  }
+}
+
+bool
+TreeKEMPublicKey::has_hash(NodeIndex index) const
+{
+  return index.val < hash_valid.size() && hash_valid[index.val];
+}
+
+bytes
+TreeKEMPublicKey::cached_hash(NodeIndex index) const
+{
+  if (!has_hash(index)) {
+    throw InvalidParameterError("Tree hash not set");
+  }
+
+  const auto* start = hash_data.row(index.val);
+  return std::vector<uint8_t>(start, start + hash_data.row_width());
+}
+
+void
+TreeKEMPublicKey::reserve_hashes(size_t count)
+{
+  // Each row of the cache holds one digest
+  const auto hash_size = suite.digest().hash_size;
+  if (hash_data.row_width() != hash_size) {
+    hash_data = CowVector<uint8_t>(hash_size);
+    hash_data.resize(hash_valid.size());
+    clear_hash_all();
+  }
+
+  // Leave room for the tree to double before the cache has to be reallocated
+  if (count > hash_valid.size()) {
+    const auto width = NodeCount(LeafCount::full(size)).val;
+    hash_valid.resize(std::max<size_t>(width, count), false);
+    hash_data.resize(hash_valid.size());
+    resolutions.resize(hash_valid.size());
+  }
+}
+
+void
+TreeKEMPublicKey::set_hash(NodeIndex index, const bytes& hash, bool mark_valid)
+{
+  reserve_hashes(size_t(index.val) + 1);
+
+  std::copy(hash.begin(), hash.end(), hash_data.mut_row(index.val));
+  if (mark_valid) {
+    hash_valid[index.val] = true;
+  }
+}
+
+std::vector<NodeIndex>
+TreeKEMPublicKey::subtree_roots(uint32_t depth) const
+{
+  if (size.val == 0) {
+    return {};
+  }
+
+  const auto width = NodeCount(size);
+  const auto height = NodeIndex::root(size).level();
+  const auto level = height - std::min(depth, height);
+  const auto stride = uint32_t(2) << level;
+
+  auto roots = std::vector<NodeIndex>{};
+  for (auto n = NodeIndex{ (stride >> 1U) - 1 }; n.val < width.val;
+       n.val += stride) {
+    roots.push_back(n);
+  }
+
+  return roots;
+}
+
 struct LeafNodeHashInput
 {
   LeafIndex leaf_index;
@@ -765,39 +1678,168 @@ struct TreeHashInput
   TLS_TRAITS(tls::variant<NodeType>)
 };
 
-const bytes&
-TreeKEMPublicKey::get_hash(NodeIndex index) // NOLINT(misc-no-recursion)
+// TreeHashInput{ ParentNodeHashInput{ ... } } for a non-blank parent, written
+// out from the parent's fields, so that they are not copied into a ParentNode
+static bytes
+parent_tree_hash_input(const HPKEPublicKey& public_key,
+                       const bytes& parent_hash,
+                       const std::vector<LeafIndex>& unmerged_leaves,
+                       const bytes& left_hash,
+                       const bytes& right_hash)
 {
-  if (hashes.count(index) > 0) {
-    return hashes.at(index);
+  auto w = tls::ostream{};
+  w << NodeType::parent << uint8_t(1) << public_key << parent_hash
+    << unmerged_leaves << left_hash << right_hash;
+  return w.bytes();
+}
+
+bytes
+TreeKEMPublicKey::get_hash(NodeIndex index)
+{
+  return get_hash(index, true);
+}
+
+bytes
+TreeKEMPublicKey::get_hash(NodeIndex index, // NOLINT(misc-no-recursion)
+                           bool mark_valid)
+{
+  if (has_hash(index)) {
+    return cached_hash(index);
   }
 
   auto hash_input = bytes{};
-  const auto& node = node_at(index);
+  const auto blank = blank_at(index);
   if (index.level() == 0) {
-    auto input = LeafNodeHashInput{ LeafIndex(index), {} };
-    if (!node.blank()) {
-      input.leaf_node = node.leaf_node();
+    // TreeHashInput{ LeafNodeHashInput{ ... } }, written out here so that the
+    // leaf's retained encoding is copied in rather than the leaf re-marshaled
+    const auto leaf = LeafIndex(index);
+    auto w = tls::ostream{};
+    w << NodeType::leaf << leaf;
+    if (blank) {
+      w << uint8_t(0);
+    } else {
+      w << uint8_t(1);
+      w.write_raw(leaf_encodings.at(leaf.val));
+    }
+
+    hash_input = w.bytes();
+  } else {
+    const auto left_hash = get_hash(index.left(), mark_valid);
+    const auto right_hash = get_hash(index.right(), mark_valid);
+    if (blank) {
+      const auto input = ParentNodeHashInput{ {}, left_hash, right_hash };
+      hash_input = tls::marshal(TreeHashInput{ input });
+    } else {
+      const auto slot = index.val >> 1U;
+      hash_input = parent_tree_hash_input(parent_keys.at(slot),
+                                          parent_hash_values.at(slot),
+                                          parent_unmerged.at(slot),
+                                          left_hash,
+                                          right_hash);
     }
+  }
+
+  auto hash = suite.digest().hash(hash_input);
+  set_hash(index, hash, mark_valid);
+
+  // The children's resolutions were stored along with their hashes above
+  auto& resolution = resolutions.mut(index.val);
+  if (index.level() > 0 && blank) {
+    const auto& left = resolutions.at(index.left().val);
+    const auto& right = resolutions.at(index.right().val);
+    resolution = left;
+    resolution.insert(resolution.end(), right.begin(), right.end());
+  } else {
+    resolution = node_resolution(index);
+  }
+
+  return hash;
+}
+
+TreeSlice
+TreeKEMPublicKey::slice(LeafIndex index) const
+{
+  if (!(index < size)) {
+    throw InvalidParameterError("Leaf index outside of tree");
+  }
 
-    hash_input = tls::marshal(TreeHashInput{ input });
+  auto leaf = NodeIndex(index);
+  const auto dirpath = leaf.dirpath_range(size);
+  auto out = TreeSlice{ size, index, {}, {} };
+  out.direct_path_nodes.reserve(dirpath.size() + 1);
+  out.copath_hashes.reserve(dirpath.size());
+
+  // Each node is copied once, straight into the slice
+  out.direct_path_nodes.push_back(node_at(leaf));
+  for (const auto n : dirpath) {
+    out.direct_path_nodes.push_back(node_at(n));
+  }
+
+  for (const auto n : leaf.copath_range(size)) {
+    out.copath_hashes.push_back(cached_hash(n));
+  }
+
+  return out;
+}
+
+bytes
+TreeSlice::tree_hash(CipherSuite suite) const
+{
+  if (!(leaf_index < n_leaves)) {
+    throw ProtocolError("Slice leaf outside of tree");
+  }
+
+  auto curr = NodeIndex(leaf_index);
+  const auto dirpath = curr.dirpath_range(n_leaves);
+  if (direct_path_nodes.size() != dirpath.size() + 1 ||
+      copath_hashes.size() != dirpath.size()) {
+    throw ProtocolError("Malformed tree slice");
+  }
+
+  const auto& leaf = direct_path_nodes.front();
+  if (!leaf.blank() && !leaf.leaf()) {
+    throw ProtocolError("Parent node in leaf position");
+  }
+
+  // TreeHashInput{ LeafNodeHashInput{ ... } }, written out so that the leaf
+  // is not copied
+  auto w = tls::ostream{};
+  w << NodeType::leaf << leaf_index;
+  if (leaf.blank()) {
+    w << uint8_t(0);
   } else {
-    auto input = ParentNodeHashInput{
-      {},
-      get_hash(index.left()),
-      get_hash(index.right()),
-    };
+    w << uint8_t(1) << leaf.leaf_node();
+  }
 
-    if (!node.blank()) {
-      input.parent_node = node.parent_node();
+  auto hash = suite.digest().hash(w.bytes());
+  for (size_t i = 0; i < dirpath.size(); i++) {
+    const auto& parent = direct_path_nodes[i + 1];
+    if (parent.leaf()) {
+      throw ProtocolError("Leaf node in parent position");
     }
 
-    hash_input = tls::marshal(TreeHashInput{ input });
+    const auto& sibling_hash = copath_hashes[i];
+    const auto curr_is_left = curr < dirpath[i];
+    const auto& left_hash = curr_is_left ? hash : sibling_hash;
+    const auto& right_hash = curr_is_left ? sibling_hash : hash;
+    auto input = bytes{};
+    if (parent.blank()) {
+      input = tls::marshal(
+        TreeHashInput{ ParentNodeHashInput{ {}, left_hash, right_hash } });
+    } else {
+      const auto& node = parent.parent_node();
+      input = parent_tree_hash_input(node.public_key,
+                                     node.parent_hash,
+                                     node.unmerged_leaves,
+                                     left_hash,
+                                     right_hash);
+    }
+
+    hash = suite.digest().hash(input);
+    curr = dirpath[i];
   }
 
-  auto hash = suite.digest().hash(hash_input);
-  hashes.insert_or_assign(index, hash);
-  return hashes.at(index);
+  return hash;
 }
 
 // struct {
@@ -818,14 +1860,15 @@ bytes
 TreeKEMPublicKey::parent_hash(const ParentNode& parent,
                               NodeIndex copath_child) const
 {
-  if (hashes.count(copath_child) == 0) {
+  if (!has_hash(copath_child)) {
     throw InvalidParameterError("Child hash not set");
   }
 
+  const auto child_hash = cached_hash(copath_child);
   auto hash_input = ParentHashInput{
     parent.public_key,
     parent.parent_hash,
-    hashes.at(copath_child),
+    child_hash,
   };
 
   return suite.digest().hash(tls::marshal(hash_input));
@@ -873,11 +1916,50 @@ TreeKEMPublicKey::parent_hashes(
   return ph;
 }
 
-const bytes&
+struct TreeKEMPublicKey::OriginalHashCache
+{
+  using Key = std::pair<NodeIndex, std::vector<LeafIndex>>;
+
+  std::mutex mutex;
+  std::map<Key, bytes> hashes;
+
+  std::optional<bytes> find(const Key& key)
+  {
+    const auto lock = std::lock_guard(mutex);
+    const auto it = hashes.find(key);
+    if (it == hashes.end()) {
+      return std::nullopt;
+    }
+
+    return it->second;
+  }
+
+  void insert(Key key, const bytes& hash)
+  {
+    const auto lock = std::lock_guard(mutex);
+    hashes.insert_or_assign(std::move(key), hash);
+  }
+};
+
+std::shared_ptr<TreeKEMPublicKey::OriginalHashCache>
+TreeKEMPublicKey::original_hash_cache() const
+{
+  auto cache = std::atomic_load(&original_hashes);
+  if (cache) {
+    return cache;
+  }
+
+  cache = std::make_shared<OriginalHashCache>();
+  std::atomic_store(&original_hashes, cache);
+  return cache;
+}
+
+bytes
 // NOLINTNEXTLINE(misc-no-recursion)
-TreeKEMPublicKey::original_tree_hash(TreeHashCache& cache,
-                                     NodeIndex index,
-                                     std::vector<LeafIndex> parent_except) const
+TreeKEMPublicKey::original_tree_hash(
+  OriginalHashCache& cache,
+  NodeIndex index,
+  const std::vector<LeafIndex>& parent_except) const
 {
   // Scope the unmerged leaves list down to this subtree
   auto except = std::vector<LeafIndex>{};
@@ -890,19 +1972,19 @@ TreeKEMPublicKey::original_tree_hash(TreeHashCache& cache,
 
   // If there are no local changes, then we can use the cached tree hash
   if (!have_local_changes) {
-    return hashes.at(index);
+    return cached_hash(index);
   }
 
-  // If this method has been called before with the same number of excluded
-  // leaves (which implies the same set), then use the cached value.
-  if (auto it = cache.find(index); it != cache.end()) {
-    const auto& [key, value] = *it;
-    const auto& [except_size, hash] = value;
-    if (except_size == except.size()) {
-      return hash;
-    }
+  // Unmerged leaves are listed in the order they were added, so put the list
+  // in a canonical order before looking it up
+  std::sort(except.begin(), except.end());
+  auto key = OriginalHashCache::Key{ index, std::move(except) };
+  if (auto cached = cache.find(key)) {
+    return opt::get(cached);
   }
 
+  const auto& excluded = key.second;
+
   // If there is no entry in either cache, recompute the value
   auto hash = bytes{};
   if (index.is_leaf()) {
@@ -914,43 +1996,53 @@ TreeKEMPublicKey::original_tree_hash(TreeHashCache& cache,
     // If there is no cached value, recalculate the child hashes with the
     // specified `except` list, removing the `except` list from
     // `unmerged_leaves`.
-    auto parent_hash_input = ParentNodeHashInput{
-      std::nullopt,
-      original_tree_hash(cache, index.left(), except),
-      original_tree_hash(cache, index.right(), except),
-    };
+    const auto left_hash = original_tree_hash(cache, index.left(), excluded);
+    const auto right_hash =
+      original_tree_hash(cache, index.right(), excluded);
+
+    if (blank_at(index)) {
+      const auto input =
+        ParentNodeHashInput{ std::nullopt, left_hash, right_hash };
+      hash = suite.digest().hash(tls::marshal(TreeHashInput{ input }));
+    } else {
+      // Only the unmerged leaves are copied, and only if some are excluded
+      const auto slot = index.val >> 1U;
+      const auto& unmerged = parent_unmerged.at(slot);
+      auto kept = std::vector<LeafIndex>{};
+      if (!excluded.empty()) {
+        std::copy_if(
+          unmerged.begin(),
+          unmerged.end(),
+          std::back_inserter(kept),
+          [&](auto leaf) {
+            return !std::binary_search(excluded.begin(), excluded.end(), leaf);
+          });
+      }
 
-    if (!node_at(index).blank()) {
-      parent_hash_input.parent_node = node_at(index).parent_node();
-      auto& unmerged_leaves =
-        opt::get(parent_hash_input.parent_node).unmerged_leaves;
-      auto end = std::remove_if(
-        unmerged_leaves.begin(), unmerged_leaves.end(), [&](auto leaf) {
-          return std::count(except.begin(), except.end(), leaf) != 0;
-        });
-      unmerged_leaves.erase(end, unmerged_leaves.end());
+      hash = suite.digest().hash(
+        parent_tree_hash_input(parent_keys.at(slot),
+                               parent_hash_values.at(slot),
+                               excluded.empty() ? unmerged : kept,
+                               left_hash,
+                               right_hash));
     }
-
-    hash =
-      suite.digest().hash(tls::marshal(TreeHashInput{ parent_hash_input }));
   }
 
-  cache.insert_or_assign(index, std::make_pair(except.size(), hash));
-  return cache.at(index).second;
+  cache.insert(std::move(key), hash);
+  return hash;
 }
 
 bytes
-TreeKEMPublicKey::original_parent_hash(TreeHashCache& cache,
+TreeKEMPublicKey::original_parent_hash(OriginalHashCache& cache,
                                        NodeIndex parent,
                                        NodeIndex sibling) const
 {
-  const auto& parent_node = node_at(parent).parent_node();
-  const auto& unmerged = parent_node.unmerged_leaves;
+  const auto& unmerged = unmerged_at(parent);
   const auto& sibling_hash = original_tree_hash(cache, sibling, unmerged);
 
   return suite.digest().hash(tls::marshal(ParentHashInput{
-    parent_node.public_key,
-    parent_node.parent_hash,
+    public_key_at(parent),
+    parent_hash_values.at(parent.val >> 1U),
     sibling_hash,
   }));
 }
@@ -980,25 +2072,316 @@ TreeKEMPublicKey::parent_hash_valid(LeafIndex from,
   return leaf_ph && opt::get(leaf_ph) == hash_chain[0];
 }
 
+bool
+TreeKEMPublicKey::path_shape_valid(LeafIndex from,
+                                   const UpdatePath& path,
+                                   const std::vector<LeafIndex>& joiners) const
+{
+  auto fdp = filtered_direct_path(NodeIndex(from));
+  if (fdp.size() != path.nodes.size()) {
+    return false;
+  }
+
+  for (size_t i = 0; i < fdp.size(); i++) {
+    auto& res = std::get<1>(fdp[i]);
+    remove_leaves(res, joiners);
+    if (res.size() != path.nodes[i].encrypted_path_secret.size()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool
+operator==(const TreeKEMPublicKey& lhs, const TreeKEMPublicKey& rhs)
+{
+  // Blank slots are always reset, so the arrays can be compared directly
+  return lhs.node_present == rhs.node_present &&
+         lhs.leaf_payloads == rhs.leaf_payloads &&
+         lhs.parent_keys == rhs.parent_keys &&
+         lhs.parent_hash_values == rhs.parent_hash_values &&
+         lhs.parent_unmerged == rhs.parent_unmerged;
+}
+
+bool
+operator!=(const TreeKEMPublicKey& lhs, const TreeKEMPublicKey& rhs)
+{
+  return !(lhs == rhs);
+}
+
+// Views of the present nodes in the tree, encoded in the same form as
+// OptionalNode without assembling Node objects
+struct ParentNodeView
+{
+  const HPKEPublicKey& public_key;
+  const bytes& parent_hash;
+  const std::vector<LeafIndex>& unmerged_leaves;
+
+  TLS_SERIALIZABLE(public_key, parent_hash, unmerged_leaves)
+};
+
 tls::ostream&
 operator<<(tls::ostream& str, const TreeKEMPublicKey& obj)
 {
-  return str << obj.nodes;
+  const auto write_node = [&](tls::ostream& out, NodeIndex n) {
+    if (obj.blank_at(n)) {
+      out << uint8_t(0);
+      return;
+    }
+
+    const auto slot = n.val >> 1U;
+    out << uint8_t(1);
+    if (n.is_leaf()) {
+      out << NodeType::leaf;
+      out.write_raw(obj.leaf_encodings.at(slot));
+      return;
+    }
+
+    out << NodeType::parent
+        << ParentNodeView{ obj.parent_keys.at(slot),
+                           obj.parent_hash_values.at(slot),
+                           obj.parent_unmerged.at(slot) };
+  };
+
+  // optional<Node> nodes<V>
+  auto counter = tls::ostream::counting();
+  for (auto n = NodeIndex{ 0 }; n.val < obj.width(); n.val++) {
+    write_node(counter, n);
+  }
+
+  tls::varint::encode(str, counter.size());
+  for (auto n = NodeIndex{ 0 }; n.val < obj.width(); n.val++) {
+    write_node(str, n);
+  }
+
+  return str;
+}
+
+bool
+TreeKEMPublicKey::compressible() const
+{
+  auto present = size_t(0);
+  for (size_t i = 0; i < node_present.size(); i++) {
+    if (!node_present[i]) {
+      continue;
+    }
+
+    present += 1;
+    if (i >= max_compressed_expansion * present) {
+      return false;
+    }
+  }
+
+  return node_present.size() <= max_compressed_expansion * present;
+}
+
+void
+TreeKEMPublicKey::write_compressed(tls::ostream& str) const
+{
+  if (!compressible()) {
+    throw InvalidParameterError("Tree cannot be compressed");
+  }
+
+  const auto write_nodes = [&](tls::ostream& out) {
+    auto profiles = std::unordered_map<bytes, uint64_t>{};
+    auto blanks = uint64_t(0);
+    for (auto n = NodeIndex{ 0 }; n.val < width(); n.val++) {
+      if (!node_present[n.val]) {
+        blanks += 1;
+        continue;
+      }
+
+      tls::varint::encode(out, blanks);
+      blanks = 0;
+
+      const auto slot = n.val >> 1U;
+      if (!n.is_leaf()) {
+        out << ParentNodeView{ parent_keys.at(slot),
+                               parent_hash_values.at(slot),
+                               parent_unmerged.at(slot) };
+        continue;
+      }
+
+      const auto& leaf = leaf_payloads.at(slot);
+      out << leaf.encryption_key << leaf.signature_key << leaf.credential;
+
+      auto profile_writer = tls::ostream{};
+      profile_writer << leaf.capabilities << leaf.extensions;
+      auto profile = bytes(profile_writer.bytes());
+      const auto it = profiles.find(profile);
+      if (it != profiles.end()) {
+        tls::varint::encode(out, it->second + 1);
+      } else {
+        tls::varint::encode(out, 0);
+        out << leaf.capabilities << leaf.extensions;
+        profiles.emplace(std::move(profile), profiles.size());
+      }
+
+      tls::variant<LeafNodeSource>::encode(out, leaf.content);
+      out << leaf.signature;
+    }
+
+    // The tree keeps its full width, which usually ends in blank nodes
+    if (blanks > 0) {
+      tls::varint::encode(out, blanks);
+    }
+  };
+
+  auto counter = tls::ostream::counting();
+  write_nodes(counter);
+
+  tls::varint::encode(str, counter.size());
+  write_nodes(str);
+}
+
+void
+TreeKEMPublicKey::read_compressed(tls::istream& str)
+{
+  auto nodes_size = uint64_t(0);
+  tls::varint::decode(str, nodes_size);
+  auto r = str.sub_stream(nodes_size);
+
+  size.val = 0;
+  resize_nodes(0);
+  clear_hash_all();
+
+  auto profiles = std::vector<std::pair<Capabilities, ExtensionList>>{};
+  auto next = uint64_t(0);
+  auto present = uint64_t(0);
+  while (!r.empty()) {
+    auto blanks = uint64_t(0);
+    tls::varint::decode(r, blanks);
+
+    // A run of blanks with no node after it ends the tree
+    if (r.empty()) {
+      if (next + blanks > max_compressed_expansion * present) {
+        throw ProtocolError("Compressed tree is too sparse");
+      }
+
+      next += blanks;
+      break;
+    }
+
+    // Check the bound before allocating anything for the node
+    present += 1;
+    if (blanks >= max_compressed_expansion * present ||
+        next + blanks >= max_compressed_expansion * present) {
+      throw ProtocolError("Compressed tree is too sparse");
+    }
+
+    const auto n = NodeIndex{ static_cast<uint32_t>(next + blanks) };
+    next = n.val + 1;
+
+    size.val = std::max(size.val, uint32_t(1));
+    while (NodeCount(size).val < next) {
+      size.val *= 2;
+    }
+    resize_nodes(next);
+
+    if (!n.is_leaf()) {
+      auto parent = ParentNode{};
+      r >> parent;
+      set_parent(n, std::move(parent));
+      continue;
+    }
+
+    auto leaf = LeafNode{};
+    r >> leaf.encryption_key >> leaf.signature_key >> leaf.credential;
+
+    auto profile = uint64_t(0);
+    tls::varint::decode(r, profile);
+    if (profile == 0) {
+      r >> leaf.capabilities >> leaf.extensions;
+      profiles.emplace_back(leaf.capabilities, leaf.extensions);
+    } else if (profile <= profiles.size()) {
+      const auto& [capabilities, extensions] = profiles.at(profile - 1);
+      leaf.capabilities = capabilities;
+      leaf.extensions = extensions;
+    } else {
+      throw ProtocolError("Unknown leaf profile in compressed tree");
+    }
+
+    tls::variant<LeafNodeSource>::decode(r, leaf.content);
+    r >> leaf.signature;
+    set_leaf(LeafIndex(n), std::move(leaf));
+  }
+
+  if (next == 0) {
+    return;
+  }
+
+  size.val = std::max(size.val, uint32_t(1));
+  while (NodeCount(size).val < next) {
+    size.val *= 2;
+  }
+
+  if (NodeCount(size).val != next) {
+    throw ProtocolError("Compressed tree does not fill its width");
+  }
+  resize_nodes(next);
 }
 
 tls::istream&
 operator>>(tls::istream& str, TreeKEMPublicKey& obj)
 {
-  str >> obj.nodes;
-  if (obj.nodes.empty()) {
+  // optional<Node> nodes<V>, read one node at a time so that the encoding of
+  // each leaf can be kept.  A present node is preceded by its presence and
+  // NodeType octets.
+  static constexpr size_t node_header_size = 2;
+
+  auto nodes_size = uint64_t(0);
+  tls::varint::decode(str, nodes_size);
+  auto r = str.sub_stream(nodes_size);
+
+  auto nodes = std::vector<OptionalNode>{};
+  auto encodings = std::vector<bytes_view>{};
+  while (!r.empty()) {
+    const auto* start = r.data();
+    const auto available = r.size();
+    r >> nodes.emplace_back();
+
+    auto encoding = bytes_view{};
+    const auto read = available - r.size();
+    if (read > node_header_size) {
+      encoding = bytes_view(start, read).slice(node_header_size, read);
+    }
+    encodings.push_back(encoding);
+  }
+
+  obj.size.val = 0;
+  obj.resize_nodes(0);
+  obj.clear_hash_all();
+  if (nodes.empty()) {
     return str;
   }
 
   obj.size.val = 1;
-  while (NodeCount(obj.size).val < obj.nodes.size()) {
+  while (NodeCount(obj.size).val < nodes.size()) {
     obj.size.val *= 2;
   }
 
+  obj.resize_nodes(nodes.size());
+  for (auto n = NodeIndex{ 0 }; n.val < nodes.size(); n.val++) {
+    auto& node = nodes.at(n.val).node;
+    if (!node) {
+      continue;
+    }
+
+    auto& content = opt::get(node).node;
+    if (n.is_leaf() != var::holds_alternative<LeafNode>(content)) {
+      throw ProtocolError("Node type does not match position in tree");
+    }
+
+    if (n.is_leaf()) {
+      obj.set_leaf(LeafIndex(n),
+                   std::move(var::get<LeafNode>(content)),
+                   bytes(encodings.at(n.val)));
+    } else {
+      obj.set_parent(n, std::move(var::get<ParentNode>(content)));
+    }
+  }
+
   return str;
 }
 
@@ -0,0 +1,120 @@
+#include <doctest/doctest.h>
+#include <mls/state.h>
+
+#include "../test_helpers.h"
+#include "counting_allocator.h"
+
+using namespace mls;
+
+// Upper bounds on the heap allocations made by operations that run for every
+// message.  The bounds have some headroom over what the operations allocate
+// today, so that they only trip when a change adds allocations.  When a
+// change removes allocations, the bounds should be lowered to match.
+struct Budget
+{
+  size_t allocations;
+  size_t bytes;
+};
+
+static void
+check_budget(const AllocationCount& count, const Budget& budget)
+{
+  CHECK(count.allocations <= budget.allocations);
+  CHECK(count.bytes <= budget.bytes);
+}
+
+class AllocationBudgetTest
+{
+protected:
+  const CipherSuite suite{ CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519 };
+  const bytes group_id = from_ascii("group");
+  static constexpr size_t message_size = 1024;
+
+  // A group of the given size, of which only the creator and one other member
+  // are instantiated
+  struct Group
+  {
+    State creator;
+    State member;
+  };
+
+  Group make_group(size_t size) const
+  {
+    auto members = bootstrap_group<State>(suite, group_id, size, 2);
+    return { std::move(members[0]), std::move(members[1]) };
+  }
+};
+
+TEST_CASE_FIXTURE(AllocationBudgetTest, "Allocations per Application Message")
+{
+  auto group = make_group(2);
+  const auto pt = bytes(message_size, 0xa0);
+
+  // The first message from a sender derives its keys; later ones are the
+  // steady state
+  group.member.unprotect(group.creator.protect({}, pt, 0));
+
+  auto ct = MLSMessage{};
+  {
+    const auto counter = CountAllocations{};
+    ct = group.creator.protect({}, pt, 0);
+    check_budget(counter.count(), { 96, 20 * 1024 });
+  }
+
+  {
+    const auto counter = CountAllocations{};
+    const auto [aad, out] = group.member.unprotect(ct);
+    check_budget(counter.count(), { 96, 16 * 1024 });
+    silence_unused(aad);
+    silence_unused(out);
+  }
+}
+
+TEST_CASE_FIXTURE(AllocationBudgetTest, "Allocations per Received Commit")
+{
+  // Handling a Commit copies and updates the tree, so the budget grows with
+  // the size of the group
+  const auto budgets = std::vector<std::tuple<size_t, Budget>>{
+    { 8, { 800, 80 * 1024 } },
+    { 64, { 1900, 170 * 1024 } },
+  };
+
+  for (const auto& [size, budget] : budgets) {
+    auto group = make_group(size);
+    const auto opts = CommitOpts{ {}, false, false, {} };
+    auto [commit, welcome, next] =
+      group.creator.commit(random_bytes(suite.secret_size()), opts, {});
+    silence_unused(welcome);
+    silence_unused(next);
+
+    const auto counter = CountAllocations{};
+    auto handled = group.member.handle(commit);
+    check_budget(counter.count(), budget);
+    REQUIRE(handled);
+  }
+}
+
+TEST_CASE_FIXTURE(AllocationBudgetTest, "Allocations per Message Decode")
+{
+  auto group = make_group(2);
+  const auto data = tls::marshal(
+    group.creator.protect({}, bytes(message_size, 0xa0), 0));
+
+  const auto counter = CountAllocations{};
+  const auto msg = tls::get<MLSMessage>(data);
+  check_budget(counter.count(), { 4, message_size + 256 });
+}
+
+TEST_CASE_FIXTURE(AllocationBudgetTest, "Allocations per Hash Ratchet Step")
+{
+  auto ratchet = HashRatchet{ suite,
+                              NodeIndex{ 0 },
+                              random_bytes(suite.secret_size()) };
+  ratchet.next();
+
+  const auto counter = CountAllocations{};
+  const auto [generation, keys] = ratchet.next();
+  check_budget(counter.count(), { 36, 1280 });
+  silence_unused(generation);
+  silence_unused(keys);
+}
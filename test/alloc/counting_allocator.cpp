@@ -0,0 +1,47 @@
+#include "counting_allocator.h"
+
+#include <cstdlib>
+#include <new>
+
+// Counts are kept per thread, so that tests are not disturbed by allocations
+// on other threads, and so that counting needs no synchronization
+static thread_local AllocationCount thread_count;
+
+CountAllocations::CountAllocations()
+  : start(thread_count)
+{
+}
+
+AllocationCount
+CountAllocations::count() const
+{
+  return { thread_count.allocations - start.allocations,
+           thread_count.bytes - start.bytes };
+}
+
+// The other forms of operator new and delete call these by default
+void*
+operator new(std::size_t size)
+{
+  thread_count.allocations += 1;
+  thread_count.bytes += size;
+
+  // NOLINTNEXTLINE(cppcoreguidelines-no-malloc)
+  if (auto* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc();
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+  std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+void
+operator delete(void* ptr, std::size_t /* size */) noexcept
+{
+  std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+
+// Heap allocations made through operator new
+struct AllocationCount
+{
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+// Counts the allocations made on the current thread while it is alive.  This
+// binary replaces the global operator new to keep the counts, so everything in
+// it is counted; allocations that OpenSSL makes with malloc are not.
+class CountAllocations
+{
+public:
+  CountAllocations();
+  CountAllocations(const CountAllocations&) = delete;
+  CountAllocations(CountAllocations&&) = delete;
+  CountAllocations& operator=(const CountAllocations&) = delete;
+  CountAllocations& operator=(CountAllocations&&) = delete;
+  ~CountAllocations() = default;
+
+  AllocationCount count() const;
+
+private:
+  AllocationCount start;
+};
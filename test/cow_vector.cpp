@@ -0,0 +1,56 @@
+#include <doctest/doctest.h>
+#include <mls/cow_vector.h>
+
+using namespace mls;
+
+TEST_CASE("CowVector copies on write")
+{
+  const auto count = 3 * CowVector<int>::chunk_rows + 5;
+
+  auto original = CowVector<int>{};
+  original.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    original.mut(i) = static_cast<int>(i);
+  }
+
+  // A copy sees the same contents, and writes to it do not affect the original
+  auto copy = original;
+  REQUIRE(copy == original);
+
+  copy.mut(1) = -1;
+  REQUIRE(copy.at(1) == -1);
+  REQUIRE(original.at(1) == 1);
+  REQUIRE(copy != original);
+
+  copy.mut(1) = 1;
+  REQUIRE(copy == original);
+
+  // Shrinking and growing again yields default values
+  copy.resize(2);
+  copy.resize(count);
+  REQUIRE(copy.at(1) == 1);
+  REQUIRE(copy.at(2) == 0);
+  REQUIRE(copy.at(count - 1) == 0);
+  REQUIRE(original.at(2) == 2);
+  REQUIRE(original.at(count - 1) == static_cast<int>(count - 1));
+
+  REQUIRE_THROWS_AS(original.at(count), std::out_of_range);
+}
+
+TEST_CASE("CowVector rows")
+{
+  auto rows = CowVector<uint8_t>{ 4 };
+  rows.resize(2);
+  REQUIRE(rows.row_width() == 4);
+
+  auto* row = rows.mut_row(1);
+  std::fill(row, row + 4, uint8_t(0xff));
+
+  auto copy = rows;
+  copy.detach();
+  copy.mut_row(1)[0] = 0;
+  REQUIRE(rows.row(1)[0] == 0xff);
+  REQUIRE(copy.row(1)[0] == 0);
+  REQUIRE(copy.row(1)[1] == 0xff);
+  REQUIRE(copy.row(0)[0] == 0);
+}
@@ -45,7 +45,7 @@ TEST_CASE("X509 Credential Depth 2")
   CHECK(x509.public_key().data.size() != 0);
 
   const auto& x509_original = cred.get<X509Credential>();
-  CHECK(x509.der_chain == x509_original.der_chain);
+  CHECK(x509.der_chain() == x509_original.der_chain());
 }
 
 TEST_CASE("X509 Credential Depth 2 Marshal/Unmarshal")
@@ -79,7 +79,7 @@ TEST_CASE("X509 Credential Depth 2 Marshal/Unmarshal")
   CHECK(original == unmarshaled);
 
   auto x509_unmarshaled = unmarshaled.get<X509Credential>();
-  CHECK(x509_unmarshaled.der_chain == x509_original.der_chain);
+  CHECK(x509_unmarshaled.der_chain() == x509_original.der_chain());
 }
 
 TEST_CASE("X509 Credential Depth 1 Marshal/Unmarshal")
@@ -105,5 +105,31 @@ TEST_CASE("X509 Credential Depth 1 Marshal/Unmarshal")
   CHECK(original == unmarshaled);
 
   auto x509_unmarshaled = unmarshaled.get<X509Credential>();
-  CHECK(x509_unmarshaled.der_chain == x509_original.der_chain);
+  CHECK(x509_unmarshaled.der_chain() == x509_original.der_chain());
+}
+
+TEST_CASE("X509 Credential Chains are Interned")
+{
+  const auto leaf_der = from_hex(
+    "3081fd3081b0a003020102021100af5442db77d60c749fffe8eebf193afa300506032b6570"
+    "3000301e170d3230313132353232333135365a170d3230313132363232333135365a300030"
+    "2a300506032b6570032100885cc6836723e204b54275c97928481c55b149e1ed0e22b30d2f"
+    "1a89aa24e2d1a33f303d300e0603551d0f0101ff0404030202a4300c0603551d130101ff04"
+    "023000301d0603551d110101ff04133011810f7573657240646f6d61696e2e636f6d300506"
+    "032b65700341002cc5b3f1a8954ccc872ecddf5779fb007c08ebc869227dec09cfba8fd977"
+    "ea49a182a2e51b67d4440d42248f6951f4c765e9e72e301225c953e89b2747129a0c");
+
+  const std::vector<bytes> der_in{ { leaf_der } };
+
+  // Credentials built or decoded from the same chain share one copy of it
+  const auto original = Credential::x509(der_in);
+  const auto rebuilt = Credential::x509(der_in);
+  const auto unmarshaled = tls::get<Credential>(tls::marshal(original));
+
+  const auto& x509_original = original.get<X509Credential>();
+  const auto& x509_rebuilt = rebuilt.get<X509Credential>();
+  const auto& x509_unmarshaled = unmarshaled.get<X509Credential>();
+  CHECK(&x509_rebuilt.der_chain() == &x509_original.der_chain());
+  CHECK(&x509_unmarshaled.der_chain() == &x509_original.der_chain());
+  CHECK(x509_unmarshaled.public_key() == x509_original.public_key());
 }
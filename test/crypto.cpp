@@ -1,8 +1,11 @@
 #include <doctest/doctest.h>
 #include <mls/crypto.h>
+#include <mls/log.h>
 
 #include <string>
 
+#include "test_helpers.h"
+
 using namespace mls;
 
 TEST_CASE("Basic HPKE")
@@ -74,6 +77,52 @@ TEST_CASE("Basic Signature")
   }
 }
 
+TEST_CASE("Repeated Signature Verification")
+{
+  const auto suite =
+    CipherSuite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  const auto priv = SignaturePrivateKey::generate(suite);
+  const auto label = from_ascii("label");
+  const auto message = from_hex("01020304");
+  const auto signature = priv.sign(suite, label, message);
+
+  auto bad_signature = signature;
+  bad_signature.at(bad_signature.size() - 1) ^= 0x01;
+
+  const auto cached = log::Counter::signatures_cached;
+  auto sink = std::make_shared<CountingMetricsSink>();
+  log::Metrics::set_sink(sink);
+
+  // The first verification is done in full, and repeats are answered from
+  // the cache, whether singly or in a batch
+  REQUIRE(priv.public_key.verify(suite, label, message, signature));
+  REQUIRE(sink->total(cached) == 0);
+  REQUIRE(priv.public_key.verify(suite, label, message, signature));
+  REQUIRE(sink->total(cached) == 1);
+
+  const auto batch = std::vector<SignatureVerification>{
+    { priv.public_key, label, message, signature },
+  };
+  REQUIRE(SignaturePublicKey::verify_batch(suite, batch, {}));
+  REQUIRE(sink->total(cached) == 2);
+
+  // Failures are never cached, and a cached success does not vouch for a
+  // different message or signature
+  REQUIRE_FALSE(priv.public_key.verify(suite, label, message, bad_signature));
+  REQUIRE_FALSE(priv.public_key.verify(suite, label, message, bad_signature));
+  REQUIRE_FALSE(
+    priv.public_key.verify(suite, label, from_hex("05"), signature));
+
+  const auto bad_batch = std::vector<SignatureVerification>{
+    { priv.public_key, label, message, signature },
+    { priv.public_key, label, message, bad_signature },
+  };
+  REQUIRE_FALSE(SignaturePublicKey::verify_batch(suite, bad_batch, {}));
+  REQUIRE(sink->total(cached) == 3);
+
+  log::Metrics::remove_sink();
+}
+
 TEST_CASE("Signature Key Serializion")
 {
   for (auto suite_id : all_supported_suites) {
@@ -88,3 +137,94 @@ TEST_CASE("Signature Key Serializion")
     REQUIRE(gX2 == gX);
   }
 }
+
+TEST_CASE("Parsed Keys Follow Serialized Keys")
+{
+  auto label = from_ascii("label");
+  auto message = from_hex("01020304");
+  auto info = random_bytes(10);
+  auto aad = random_bytes(10);
+  auto pt = random_bytes(10);
+
+  for (auto suite_id : all_supported_suites) {
+    auto suite = CipherSuite{ suite_id };
+
+    // Changing the serialized key changes the key that is used, even if the
+    // parsed key was shared with a copy
+    auto a = SignaturePrivateKey::generate(suite);
+    auto b = SignaturePrivateKey::generate(suite);
+    auto a2 = a;
+    auto signature = a2.sign(suite, label, message);
+    REQUIRE(a.public_key.verify(suite, label, message, signature));
+
+    a2.data = b.data;
+    signature = a2.sign(suite, label, message);
+    REQUIRE(b.public_key.verify(suite, label, message, signature));
+    REQUIRE(!a.public_key.verify(suite, label, message, signature));
+
+    // Keys read from the wire are parsed on first use
+    auto x = HPKEPrivateKey::generate(suite);
+    auto y = HPKEPrivateKey::generate(suite);
+    auto x2 = tls::get<HPKEPrivateKey>(tls::marshal(x));
+    auto ct = x.public_key.encrypt(suite, info, aad, pt);
+    REQUIRE(x2.decrypt(suite, info, aad, ct) == pt);
+
+    x2.data = y.data;
+    REQUIRE_THROWS(x2.decrypt(suite, info, aad, ct));
+    ct = y.public_key.encrypt(suite, info, aad, pt);
+    REQUIRE(x2.decrypt(suite, info, aad, ct) == pt);
+  }
+}
+
+TEST_CASE("Cipher Suite Traits")
+{
+  using P256 = CipherSuiteTraits<CipherSuite::ID::P256_AES128GCM_SHA256_P256>;
+  using X448 = CipherSuiteTraits<CipherSuite::ID::X448_AES256GCM_SHA512_Ed448>;
+  static_assert(P256::key_size == 16);
+  static_assert(X448::hash_size == 64);
+
+  for (auto suite_id : all_supported_suites) {
+    auto suite = CipherSuite{ suite_id };
+
+    // The constant sizes and primitives agree with the suite's own
+    suite.visit([&](auto traits) {
+      using Traits = decltype(traits);
+      REQUIRE(Traits::id == suite_id);
+      REQUIRE(Traits::hash_size == suite.digest().hash_size);
+      REQUIRE(Traits::key_size == suite.hpke().aead.key_size);
+      REQUIRE(Traits::nonce_size == suite.hpke().aead.nonce_size);
+      REQUIRE(&Traits::kdf() == &suite.hpke().kdf);
+      REQUIRE(&Traits::aead() == &suite.hpke().aead);
+      REQUIRE(&Traits::digest() == &suite.digest());
+      REQUIRE(tls_signature_scheme(Traits::sig_id) ==
+              suite.signature_scheme());
+    });
+
+    REQUIRE(suite.secret_size() == suite.digest().hash_size);
+    REQUIRE(suite.key_size() == suite.hpke().aead.key_size);
+    REQUIRE(suite.nonce_size() == suite.hpke().aead.nonce_size);
+  }
+
+  REQUIRE_THROWS_AS(CipherSuite{}.secret_size(), InvalidParameterError);
+}
+
+TEST_CASE("Pre-encoded Labels")
+{
+  const auto& labels = KDFLabels::get();
+  for (auto suite_id : all_supported_suites) {
+    auto suite = CipherSuite{ suite_id };
+    auto secret = random_bytes(suite.secret_size());
+    auto context = random_bytes(17);
+
+    REQUIRE(suite.expand_with_label(secret, labels.nonce, context, 12) ==
+            suite.expand_with_label(secret, "nonce", context, 12));
+    REQUIRE(suite.derive_secret(secret, labels.path) ==
+            suite.derive_secret(secret, "path"));
+
+    const auto batched = suite.expand_with_labels(
+      secret, { { &labels.key, 16 }, { &labels.sender_data, 32 } }, context);
+    REQUIRE(batched ==
+            suite.expand_with_labels(
+              secret, { { "key", 16 }, { "sender data", 32 } }, context));
+  }
+}
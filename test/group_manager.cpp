@@ -0,0 +1,113 @@
+#include <doctest/doctest.h>
+#include <mls/group_manager.h>
+
+#include "test_helpers.h"
+
+using namespace mls;
+
+class GroupManagerTest
+{
+protected:
+  const CipherSuite suite{ CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519 };
+  static constexpr size_t group_count = 8;
+
+  GroupManager creators{ GroupManager::Options{ 4, 2 } };
+  GroupManager joiners{ GroupManager::Options{ 4, 2 } };
+  std::vector<bytes> group_ids;
+
+  GroupManagerTest()
+  {
+    for (size_t i = 0; i < group_count; i++) {
+      auto group_id = bytes{ 0, 1, 2, static_cast<uint8_t>(i) };
+      auto members = bootstrap_group<Session>(suite, group_id, 2, 2);
+      creators.add(group_id, std::move(members[0]));
+      joiners.add(group_id, std::move(members[1]));
+      group_ids.push_back(group_id);
+    }
+  }
+};
+
+TEST_CASE_FIXTURE(GroupManagerTest, "Group Manager Membership")
+{
+  REQUIRE(creators.size() == group_count);
+  for (const auto& group_id : group_ids) {
+    REQUIRE(creators.contains(group_id));
+  }
+
+  const auto unknown = bytes{ 9, 9, 9, 9 };
+  REQUIRE_FALSE(creators.contains(unknown));
+  REQUIRE_THROWS_AS(creators.protect(unknown, { 0 }), InvalidParameterError);
+
+  auto duplicate = bootstrap_group<Session>(suite, group_ids[0], 1, 1);
+  REQUIRE_THROWS_AS(creators.add(group_ids[0], std::move(duplicate[0])),
+                    InvalidParameterError);
+
+  REQUIRE(creators.remove(group_ids[0]));
+  REQUIRE_FALSE(creators.remove(group_ids[0]));
+  REQUIRE_FALSE(creators.contains(group_ids[0]));
+  REQUIRE(creators.size() == group_count - 1);
+}
+
+TEST_CASE_FIXTURE(GroupManagerTest, "Group Manager Memory Usage")
+{
+  // Each creator holds its current epoch and the one before it
+  const auto one = creators.memory_usage(group_ids[0]);
+  REQUIRE(one.epochs == 2);
+  REQUIRE(one.tree.nodes > 0);
+
+  // The groups all have the same shape, so their trees are the same size
+  const auto all = creators.memory_usage();
+  REQUIRE(all.epochs == 2 * group_count);
+  REQUIRE(all.tree.nodes == group_count * one.tree.nodes);
+  REQUIRE(all.total_bytes() >= one.total_bytes());
+}
+
+TEST_CASE_FIXTURE(GroupManagerTest, "Group Manager Handles Groups in Parallel")
+{
+  const auto pt = bytes{ 0, 1, 2, 3 };
+  const auto rounds = 3;
+
+  auto failures = std::vector<int>(group_count, 0);
+  parallel_executor(group_count, [&](size_t i) {
+    const auto& group_id = group_ids[i];
+    for (int round = 0; round < rounds; round++) {
+      // Advance the epoch, then exchange a message in each direction
+      auto commit = creators.with_session(group_id, [](Session& session) {
+        auto [welcome, commit] = session.commit();
+        session.handle(commit);
+        return commit;
+      });
+      joiners.handle(group_id, commit);
+
+      auto ct = creators.protect(group_id, pt);
+      failures[i] += (joiners.unprotect(group_id, ct) != pt);
+
+      ct = joiners.protect(group_id, pt);
+      failures[i] += (creators.unprotect(group_id, ct) != pt);
+    }
+  });
+
+  for (size_t i = 0; i < group_count; i++) {
+    REQUIRE(failures[i] == 0);
+
+    auto creator_epoch = creators.with_session(
+      group_ids[i], [](const Session& session) { return session.epoch(); });
+    auto joiner_epoch = joiners.with_session(
+      group_ids[i], [](const Session& session) { return session.epoch(); });
+    REQUIRE(creator_epoch == joiner_epoch);
+  }
+
+  // Only the retained epochs can be decrypted
+  const auto& group_id = group_ids[0];
+  auto old_ct = creators.protect(group_id, pt);
+  for (size_t i = 0; i < 2; i++) {
+    auto commit = creators.with_session(group_id, [](Session& session) {
+      auto [welcome, commit] = session.commit();
+      session.handle(commit);
+      return commit;
+    });
+    joiners.handle(group_id, commit);
+  }
+
+  REQUIRE_THROWS_AS(joiners.unprotect(group_id, old_ct), MissingStateError);
+}
@@ -2,6 +2,10 @@
 #include <mls/state.h>
 #include <mls_vectors/mls_vectors.h>
 
+#include <limits>
+
+#include "test_helpers.h"
+
 using namespace mls;
 using namespace mls_vectors;
 
@@ -20,3 +24,235 @@ TEST_CASE("Key Schedule Interop")
     REQUIRE(tv.verify() == std::nullopt);
   }
 }
+
+TEST_CASE("Secret Tree Deletes Consumed Secrets")
+{
+  const CipherSuite suite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  auto tree = SecretTree{ suite,
+                          LeafCount{ 4 },
+                          random_bytes(suite.secret_size()) };
+  REQUIRE(tree.node_count() == 1);
+
+  // Deriving a leaf retains only its copath, so deriving its sibling as well
+  // leaves fewer secrets behind
+  tree.get(LeafIndex{ 0 });
+  const auto after_first = tree.node_count();
+  tree.get(LeafIndex{ 1 });
+  REQUIRE(tree.node_count() == after_first - 1);
+
+  // Leaf secrets are not retained once handed out
+  REQUIRE_THROWS_AS(tree.get(LeafIndex{ 0 }), InvalidParameterError);
+}
+
+TEST_CASE("External Key Pair Is Derived on Demand")
+{
+  const CipherSuite suite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  const auto epoch = KeyScheduleEpoch(
+    suite, random_bytes(suite.secret_size()), bytes{ 0, 1, 2, 3 });
+
+  const auto expected = HPKEPrivateKey::derive(suite, epoch.external_secret);
+  REQUIRE(epoch.external_priv() == expected);
+
+  // Encoding does not derive the key pair, but carries it once derived
+  const auto fresh = KeyScheduleEpoch(
+    suite, random_bytes(suite.secret_size()), bytes{ 0, 1, 2, 3 });
+  const auto lazy_encoding = tls::marshal(fresh);
+  REQUIRE(tls::marshal(fresh) == lazy_encoding);
+  REQUIRE(tls::get<KeyScheduleEpoch>(lazy_encoding) == fresh);
+
+  const bytes encoded = tls::marshal(epoch);
+  REQUIRE(encoded.size() > lazy_encoding.size());
+  const auto decoded = tls::get<KeyScheduleEpoch>(encoded);
+  REQUIRE(decoded == epoch);
+  REQUIRE(decoded.external_priv().public_key == expected.public_key);
+
+  // A decoded key pair must match the external secret
+  const auto other = HPKEPrivateKey::derive(suite, fresh.external_secret);
+  const auto key_size = tls::marshal(expected).size();
+  auto swapped = encoded.slice(0, encoded.size() - key_size);
+  swapped += tls::marshal(other);
+  REQUIRE_THROWS_AS(tls::get<KeyScheduleEpoch>(swapped), ProtocolError);
+
+  // A new external secret yields a new key pair
+  auto changed = epoch;
+  changed.external_secret = random_bytes(suite.secret_size());
+  REQUIRE(changed.external_priv() ==
+          HPKEPrivateKey::derive(suite, changed.external_secret));
+
+  REQUIRE(KeyScheduleEpoch(suite).external_priv() == HPKEPrivateKey{});
+}
+
+TEST_CASE("Group Key Source Retention Policy")
+{
+  const CipherSuite suite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  const auto type = ContentType::application;
+  auto keys = GroupKeySource{ suite,
+                              LeafCount{ 4 },
+                              random_bytes(suite.secret_size()) };
+
+  // Least recently used senders are evicted beyond the limit
+  keys.set_retention_policy({ 2, 0 });
+  keys.next(type, LeafIndex{ 0 });
+  keys.next(type, LeafIndex{ 1 });
+  keys.next(type, LeafIndex{ 0 });
+  keys.next(type, LeafIndex{ 2 });
+
+  auto usage = keys.memory_usage();
+  REQUIRE(usage.senders == 2);
+  REQUIRE(usage.cached_keys == 3);
+  REQUIRE(usage.secret_bytes > 0);
+
+  // An evicted sender's ratchets cannot be re-derived, and there is nothing
+  // left of them to erase
+  const auto guard = ReuseGuard{ 0, 0, 0, 0 };
+  REQUIRE_THROWS_AS(keys.next(type, LeafIndex{ 1 }), EvictedKeyError);
+  REQUIRE_THROWS_AS(keys.get(type, LeafIndex{ 1 }, 0, guard), EvictedKeyError);
+  REQUIRE_NOTHROW(keys.erase(type, LeafIndex{ 1 }, 0));
+  keys.next(type, LeafIndex{ 0 });
+  keys.next(type, LeafIndex{ 2 });
+
+  // Idle senders are evicted by time
+  keys.set_retention_policy({ 0, 60 });
+  keys.evict(seconds_since_epoch());
+  REQUIRE(keys.memory_usage().senders == 2);
+
+  keys.evict(seconds_since_epoch() + 3600);
+  REQUIRE(keys.memory_usage().senders == 0);
+
+  // Our own ratchets are never evicted, since our leaf secret is gone and we
+  // could not send without them
+  keys.set_own_index(LeafIndex{ 3 });
+  keys.next(type, LeafIndex{ 3 });
+  keys.evict(seconds_since_epoch() + 3600);
+  REQUIRE(keys.memory_usage().senders == 1);
+  REQUIRE_NOTHROW(keys.next(type, LeafIndex{ 3 }));
+}
+
+TEST_CASE("Group Key Source Warming")
+{
+  const CipherSuite suite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  const auto type = ContentType::application;
+  const auto guard = ReuseGuard{ 0, 0, 0, 0 };
+  auto keys = GroupKeySource{ suite,
+                              LeafCount{ 4 },
+                              random_bytes(suite.secret_size()) };
+  auto cold = keys;
+
+  // Warming derives keys ahead without using up any generations
+  const auto senders = std::vector<LeafIndex>{ LeafIndex{ 0 }, LeafIndex{ 2 } };
+  keys.warm(senders, 4, {});
+  REQUIRE(keys.memory_usage().senders == 2);
+  REQUIRE(keys.memory_usage().derived_keys == 8);
+  REQUIRE(keys.memory_usage().cached_keys == 0);
+
+  // Pre-derived keys are the ones that would have been derived anyway
+  auto [generation, reuse_guard, sent] = keys.next(type, LeafIndex{ 0 });
+  auto [cold_generation, cold_guard, cold_sent] =
+    cold.next(type, LeafIndex{ 0 });
+  silence_unused(reuse_guard);
+  silence_unused(cold_guard);
+  REQUIRE(generation == cold_generation);
+  REQUIRE(sent.key == cold_sent.key);
+
+  const auto received = keys.get(type, LeafIndex{ 2 }, 5, guard);
+  REQUIRE(received.key == cold.get(type, LeafIndex{ 2 }, 5, guard).key);
+  REQUIRE(keys.memory_usage().derived_keys == 3);
+
+  // Keys derived ahead are not serialized
+  REQUIRE(tls::get<GroupKeySource>(tls::marshal(keys))
+            .memory_usage()
+            .derived_keys == 0);
+}
+
+TEST_CASE("Group Key Source Concurrent Senders")
+{
+  const CipherSuite suite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  const auto type = ContentType::application;
+  const auto senders = uint32_t(8);
+  const auto generations = uint32_t(32);
+  const auto guard = ReuseGuard{ 0, 0, 0, 0 };
+
+  auto keys = GroupKeySource{ suite,
+                              LeafCount{ senders },
+                              random_bytes(suite.secret_size()) };
+  auto expected = keys;
+
+  // Each sender's ratchet is advanced on its own thread
+  auto derived = std::vector<std::vector<KeyAndNonce>>(senders);
+  parallel_executor(senders, [&](size_t i) {
+    const auto sender = LeafIndex{ static_cast<uint32_t>(i) };
+    for (uint32_t gen = 0; gen < generations; gen++) {
+      derived[i].push_back(keys.get(type, sender, gen, guard));
+    }
+  });
+
+  for (uint32_t i = 0; i < senders; i++) {
+    for (uint32_t gen = 0; gen < generations; gen++) {
+      const auto key = expected.get(type, LeafIndex{ i }, gen, guard);
+      REQUIRE(derived[i][gen].key == key.key);
+      REQUIRE(derived[i][gen].nonce == key.nonce);
+    }
+  }
+
+  const auto usage = keys.memory_usage();
+  const auto expected_usage = expected.memory_usage();
+  REQUIRE(usage.senders == senders);
+  REQUIRE(usage.cached_keys == expected_usage.cached_keys);
+  REQUIRE(usage.secret_bytes == expected_usage.secret_bytes);
+
+  // A copy has ratchets of its own
+  auto copy = keys;
+  copy.erase(type, LeafIndex{ 0 }, 0);
+  REQUIRE_NOTHROW(keys.get(type, LeafIndex{ 0 }, 0, guard));
+  REQUIRE_THROWS_AS(copy.get(type, LeafIndex{ 0 }, 0, guard), ProtocolError);
+}
+
+TEST_CASE("Hash Ratchet Window")
+{
+  const CipherSuite suite{ CipherSuite::ID::P256_AES128GCM_SHA256_P256 };
+  const auto limits = HashRatchetLimits{ 10, 4 };
+  auto ratchet = HashRatchet{
+    suite, NodeIndex{ 0 }, random_bytes(suite.secret_size()), limits
+  };
+
+  // Requests too far ahead are rejected without deriving anything
+  REQUIRE_THROWS_AS(ratchet.get(11), ProtocolError);
+  REQUIRE(ratchet.next_generation == 0);
+
+  // Skipping ahead retains keys for only the most recent generations
+  const auto key_10 = ratchet.get(10);
+  REQUIRE(ratchet.next_generation == 11);
+  REQUIRE(ratchet.cached_keys() == 4);
+  REQUIRE(ratchet.get(10).key == key_10.key);
+  REQUIRE_NOTHROW(ratchet.get(7));
+  REQUIRE_THROWS_AS(ratchet.get(6), ProtocolError);
+
+  // Erased keys are gone, and new keys displace the oldest ones
+  ratchet.erase(8);
+  REQUIRE(ratchet.cached_keys() == 3);
+  REQUIRE_THROWS_AS(ratchet.get(8), ProtocolError);
+
+  auto [generation, key_11] = ratchet.next();
+  REQUIRE(generation == 11);
+  REQUIRE(ratchet.get(11).key == key_11.key);
+  REQUIRE_THROWS_AS(ratchet.get(7), ProtocolError);
+  REQUIRE(ratchet.cached_keys() == 3);
+
+  // The default limits apply unless a ratchet is given others, and the
+  // largest limits serve any generation, as ratchets used to
+  REQUIRE_THROWS_AS(
+    HashRatchet(suite, NodeIndex{ 0 }, random_bytes(suite.secret_size()))
+      .get(1025),
+    ProtocolError);
+
+  const auto unbounded = HashRatchetLimits{
+    std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max()
+  };
+  auto open = HashRatchet{
+    suite, NodeIndex{ 0 }, random_bytes(suite.secret_size()), unbounded
+  };
+  const auto key_2000 = open.get(2000);
+  REQUIRE(open.cached_keys() == 2001);
+  REQUIRE_NOTHROW(open.get(0));
+  REQUIRE(open.get(2000).key == key_2000.key);
+}
@@ -0,0 +1,40 @@
+#include <doctest/doctest.h>
+#include <mls/leaf_bitmap.h>
+
+#include <stdexcept>
+
+using namespace mls;
+
+TEST_CASE("LeafBitmap finds the lowest free position")
+{
+  const auto count = size_t(3 * 4096 + 100);
+
+  auto bitmap = LeafBitmap{};
+  REQUIRE(bitmap.first_free() == 0);
+
+  bitmap.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    REQUIRE(bitmap.first_free() == i);
+    bitmap.set(i, true);
+  }
+  REQUIRE(bitmap.first_free() == count);
+
+  // Freed positions are found lowest first, across word boundaries
+  bitmap.set(5000, false);
+  bitmap.set(70, false);
+  REQUIRE(bitmap.first_free() == 70);
+  bitmap.set(70, true);
+  REQUIRE(bitmap.first_free() == 5000);
+  REQUIRE_FALSE(bitmap.occupied(5000));
+  REQUIRE(bitmap.occupied(5001));
+
+  // Shrinking drops positions, and growing again adds free ones
+  bitmap.set(5000, true);
+  bitmap.resize(64);
+  REQUIRE(bitmap.first_free() == 64);
+  bitmap.resize(4096 + 1);
+  REQUIRE(bitmap.first_free() == 64);
+  REQUIRE_FALSE(bitmap.occupied(4096));
+
+  REQUIRE_THROWS_AS(bitmap.set(4097, true), std::out_of_range);
+}
@@ -1,6 +1,9 @@
 #include <doctest/doctest.h>
+#include <mls/common.h>
 #include <mls/log.h>
 
+#include "test_helpers.h"
+
 using namespace std::literals::string_literals;
 using namespace mls;
 using log::Log;
@@ -67,5 +70,98 @@ TEST_CASE("Logging")
   TEST_LOG_LEVEL(info)
   TEST_LOG_LEVEL(warn)
   TEST_LOG_LEVEL(debug)
+#ifdef ENABLE_LOG_CRYPTO
   TEST_LOG_LEVEL(crypto)
+#endif
+}
+
+struct FilteringSink : public TestSink
+{
+  ~FilteringSink() override = default;
+
+  bool enabled(log::Level level) const override
+  {
+    return level != log::Level::crypto;
+  }
+};
+
+TEST_CASE("Logging with Disabled Levels")
+{
+  const auto mod = "test"s;
+  auto sink = std::make_shared<FilteringSink>();
+  Log::set_sink(sink);
+
+  REQUIRE(Log::enabled(log::Level::info));
+  REQUIRE_FALSE(Log::enabled(log::Level::crypto));
+
+  Log::info(mod, "info");
+  Log::crypto(mod, "crypto");
+  REQUIRE(sink->last_level == Level::info);
+  REQUIRE(sink->last_message == "info");
+
+  Log::remove_sink();
+  REQUIRE_FALSE(Log::enabled(log::Level::info));
+}
+
+TEST_CASE("Crypto Tracing Arguments are Evaluated Lazily")
+{
+  const auto mod = "test"s;
+  auto evaluated = 0;
+  const auto secret = [&]() {
+    evaluated += 1;
+    return "secret"s;
+  };
+
+  // With no sink, or a sink that filters out the crypto level, the arguments
+  // are never computed
+  MLS_LOG_CRYPTO(mod, secret());
+  REQUIRE(evaluated == 0);
+
+  auto filtering = std::make_shared<FilteringSink>();
+  Log::set_sink(filtering);
+  MLS_LOG_CRYPTO(mod, secret());
+  REQUIRE(evaluated == 0);
+
+  auto sink = std::make_shared<TestSink>();
+  Log::set_sink(sink);
+  MLS_LOG_CRYPTO(mod, "value ", secret());
+#ifdef ENABLE_LOG_CRYPTO
+  REQUIRE(evaluated == 1);
+  REQUIRE(sink->last_level == Level::crypto);
+  REQUIRE(sink->last_message == "value secret");
+#else
+  REQUIRE(evaluated == 0);
+  silence_unused(secret);
+#endif
+
+  Log::remove_sink();
+}
+
+TEST_CASE("Metrics")
+{
+  using log::Metrics;
+
+  auto sink = std::make_shared<CountingMetricsSink>();
+  Metrics::set_sink(sink);
+  REQUIRE(Metrics::enabled());
+
+  Metrics::count(log::Counter::bytes_serialized, 3);
+  Metrics::count(log::Counter::bytes_serialized, 4);
+  REQUIRE(sink->total(log::Counter::bytes_serialized) == 7);
+
+  {
+    const auto timer = log::ScopedTimer(log::Histogram::commit_time);
+  }
+  REQUIRE(sink->samples(log::Histogram::commit_time).size() == 1);
+
+  // Timers started with no sink installed do not record
+  Metrics::remove_sink();
+  {
+    const auto timer = log::ScopedTimer(log::Histogram::handle_time);
+    Metrics::set_sink(sink);
+  }
+  REQUIRE(sink->samples(log::Histogram::handle_time).empty());
+
+  Metrics::remove_sink();
+  REQUIRE_FALSE(Metrics::enabled());
 }
@@ -23,6 +23,34 @@ TEST_CASE("Extensions")
   REQUIRE(tree0 == tree1);
 }
 
+TEST_CASE("Parsed Extensions are Remembered")
+{
+  auto exts = ExtensionList{};
+  exts.add(ApplicationIDExtension{ { 0, 1, 2, 3 } });
+  REQUIRE(exts.get<RatchetTreeExtension>() == nullptr);
+
+  // Repeated lookups, also on a copy, return the same parsed value
+  const auto* kid = exts.get<ApplicationIDExtension>();
+  REQUIRE(kid != nullptr);
+  REQUIRE(kid->id == bytes{ 0, 1, 2, 3 });
+  REQUIRE(exts.get<ApplicationIDExtension>() == kid);
+
+  const auto copy = exts;
+  REQUIRE(copy.get<ApplicationIDExtension>() == kid);
+
+  // Changing the list drops what was parsed from it
+  exts.add(ApplicationIDExtension{ { 4, 5, 6, 7 } });
+  REQUIRE(exts.get<ApplicationIDExtension>()->id == bytes{ 4, 5, 6, 7 });
+  REQUIRE(copy.get<ApplicationIDExtension>()->id == bytes{ 0, 1, 2, 3 });
+  REQUIRE(exts.extensions().size() == 1);
+
+  // As does reading new contents into it
+  exts = tls::get<ExtensionList>(tls::marshal(copy));
+  REQUIRE(exts.get<ApplicationIDExtension>()->id == bytes{ 0, 1, 2, 3 });
+  tls::unmarshal(tls::marshal(ExtensionList{}), exts);
+  REQUIRE(exts.get<ApplicationIDExtension>() == nullptr);
+}
+
 // TODO(RLB) Verify sign/verify on:
 // * KeyPackage
 // * GroupInfo
@@ -120,6 +148,26 @@ TEST_CASE_FIXTURE(MLSMessageTest, "MLSPlaintext Protect/Unprotect")
     content_auth_original, suite, membership_key, context);
   auto content_auth_unprotected = pt.unprotect(suite, membership_key, context);
   REQUIRE(content_auth_unprotected == content_auth_original);
+
+  // The content encoded to check the membership tag is reused to verify the
+  // signature and for the transcript hash, with the same results as when the
+  // content is encoded afresh
+  const auto& unprotected = opt::get(content_auth_unprotected);
+  const auto decoded =
+    tls::get<MLSAuthenticatedContent>(tls::marshal(unprotected));
+  REQUIRE(unprotected.verify(suite, sig_priv.public_key, context));
+  REQUIRE(decoded.verify(suite, sig_priv.public_key, context));
+  REQUIRE(unprotected.confirmed_transcript_hash_input() ==
+          decoded.confirmed_transcript_hash_input());
+
+  // A tag computed with a different membership key is rejected
+  const auto other_pt = MLSPlaintext::protect(
+    MLSAuthenticatedContent::sign(
+      WireFormat::mls_plaintext, proposal_content, suite, sig_priv, context),
+    suite,
+    from_ascii("other_membership_key"),
+    context);
+  REQUIRE_FALSE(other_pt.unprotect(suite, membership_key, context));
 }
 
 TEST_CASE_FIXTURE(MLSMessageTest, "MLSCiphertext Protect/Unprotect")
@@ -139,6 +187,73 @@ TEST_CASE_FIXTURE(MLSMessageTest, "MLSCiphertext Protect/Unprotect")
   REQUIRE(content_auth_unprotected == content_auth_original);
 }
 
+TEST_CASE_FIXTURE(MLSMessageTest, "KeyPackage References are Remembered")
+{
+  const auto init_priv = HPKEPrivateKey::generate(suite);
+  const auto leaf_node = opt::get(tree.leaf_node(index));
+  const auto key_package =
+    KeyPackage{ suite, init_priv.public_key, leaf_node, {}, sig_priv };
+
+  // Signing and decoding both yield the reference of the whole KeyPackage
+  const auto expected = suite.ref(key_package);
+  REQUIRE(key_package.ref() == expected);
+
+  const auto encoded = tls::marshal(MLSMessage{ key_package });
+  const auto decoded = tls::get<MLSMessage>(encoded);
+  REQUIRE(var::get<KeyPackage>(decoded.message).ref() == expected);
+
+  // Re-signing after an edit gives a fresh reference
+  auto edited = key_package;
+  edited.extensions.add(ApplicationIDExtension{ { 0, 1, 2, 3 } });
+  edited.sign(sig_priv);
+  REQUIRE(edited.ref() != expected);
+  REQUIRE(edited.ref() == suite.ref(edited));
+}
+
+TEST_CASE_FIXTURE(MLSMessageTest, "MLSMessage Header Peek")
+{
+  auto pt_content = proposal_content;
+  auto pt_content_auth = MLSAuthenticatedContent::sign(
+    WireFormat::mls_plaintext, std::move(pt_content), suite, sig_priv, context);
+  const auto pt = MLSMessage{ MLSPlaintext::protect(
+    pt_content_auth, suite, membership_key, context) };
+
+  auto ct_content = application_content;
+  auto ct_content_auth =
+    MLSAuthenticatedContent::sign(WireFormat::mls_ciphertext,
+                                  std::move(ct_content),
+                                  suite,
+                                  sig_priv,
+                                  context);
+  const auto ct = MLSMessage{ MLSCiphertext::protect(ct_content_auth,
+                                                     suite,
+                                                     index,
+                                                     keys,
+                                                     sender_data_secret,
+                                                     padding_size) };
+
+  const auto pt_header = MLSMessage::peek_header(tls::marshal(pt));
+  REQUIRE(pt_header.wire_format == WireFormat::mls_plaintext);
+  REQUIRE(pt_header.group_id == group_id);
+  REQUIRE(pt_header.epoch == epoch);
+  REQUIRE(pt_header.content_type == ContentType::proposal);
+
+  const auto ct_header = MLSMessage::peek_header(tls::marshal(ct));
+  REQUIRE(ct_header.wire_format == WireFormat::mls_ciphertext);
+  REQUIRE(ct_header.group_id == group_id);
+  REQUIRE(ct_header.epoch == epoch);
+  REQUIRE(ct_header.content_type == ContentType::application);
+
+  // Only the header has to be present: version, wire format, group_id with
+  // its length, epoch and content type
+  const auto encoded = bytes(tls::marshal(ct));
+  const auto header_size = 2 + 1 + 1 + group_id.size() + sizeof(epoch_t) + 1;
+  const auto prefix = encoded.slice(0, header_size);
+  REQUIRE(MLSMessage::peek_header(prefix).epoch == epoch);
+  REQUIRE_THROWS_AS(MLSMessage::peek_header(encoded.slice(0, 5)),
+                    tls::ReadError);
+}
+
 TEST_CASE("Messages Interop")
 {
   auto tv = MessagesTestVector::create();
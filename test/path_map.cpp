@@ -0,0 +1,74 @@
+#include <doctest/doctest.h>
+#include <mls/path_map.h>
+
+#include <map>
+
+using namespace mls;
+
+TEST_CASE("PathMap holds one node per level")
+{
+  // The direct path of leaf 5 (node 10) in a tree of 16 leaves
+  const auto path = std::vector<NodeIndex>{
+    NodeIndex{ 10 }, NodeIndex{ 9 }, NodeIndex{ 11 },
+    NodeIndex{ 7 },  NodeIndex{ 15 },
+  };
+
+  auto map = PathMap<bytes>{};
+  REQUIRE(map.empty());
+  REQUIRE(map.find(NodeIndex{ 10 }) == map.end());
+
+  for (const auto n : path) {
+    map[n] = bytes{ static_cast<uint8_t>(n.val) };
+  }
+
+  REQUIRE(map.size() == path.size());
+  REQUIRE(map.at(NodeIndex{ 11 }) == bytes{ 11 });
+  REQUIRE(map.find(NodeIndex{ 3 }) == map.end());
+  REQUIRE_THROWS_AS(map.at(NodeIndex{ 3 }), InvalidParameterError);
+
+  // Entries are visited from the lowest level up
+  auto visited = std::vector<NodeIndex>{};
+  for (const auto& [node, value] : map) {
+    REQUIRE(value == bytes{ static_cast<uint8_t>(node.val) });
+    visited.push_back(node);
+  }
+  REQUIRE(visited == path);
+
+  // A node that cannot share a direct path with the others is rejected
+  REQUIRE_THROWS_AS(map.insert({ NodeIndex{ 13 }, {} }), InvalidParameterError);
+  REQUIRE_FALSE(map.insert({ NodeIndex{ 11 }, {} }).second);
+
+  map.insert_or_assign(NodeIndex{ 11 }, bytes{ 0xff });
+  REQUIRE(map.at(NodeIndex{ 11 }) == bytes{ 0xff });
+
+  REQUIRE(map.erase(NodeIndex{ 11 }) == 1);
+  REQUIRE(map.erase(NodeIndex{ 11 }) == 0);
+  REQUIRE(map.size() == path.size() - 1);
+  REQUIRE(map.count(NodeIndex{ 11 }) == 0);
+  map[NodeIndex{ 3 }] = bytes{ 3 };
+  REQUIRE(map.count(NodeIndex{ 3 }) == 1);
+}
+
+TEST_CASE("PathMap encodes like std::map")
+{
+  auto map = PathMap<bytes>{};
+  auto std_map = std::map<NodeIndex, bytes>{};
+  for (const auto n : { NodeIndex{ 10 }, NodeIndex{ 9 }, NodeIndex{ 3 } }) {
+    map[n] = bytes{ static_cast<uint8_t>(n.val), 0x01 };
+    std_map[n] = bytes{ static_cast<uint8_t>(n.val), 0x01 };
+  }
+
+  const auto encoded = tls::marshal(map);
+  REQUIRE(encoded == tls::marshal(std_map));
+  REQUIRE(tls::get<PathMap<bytes>>(encoded) == map);
+
+  // Entries out of NodeIndex order are rejected, as they are for std::map
+  auto reversed = tls::ostream{};
+  auto entries = std::vector<std::tuple<NodeIndex, bytes>>{
+    { NodeIndex{ 10 }, bytes{ 1 } },
+    { NodeIndex{ 3 }, bytes{ 2 } },
+  };
+  reversed << entries;
+  REQUIRE_THROWS_AS(tls::get<PathMap<bytes>>(reversed.bytes()),
+                    tls::ReadError);
+}
@@ -1,7 +1,16 @@
 #include <doctest/doctest.h>
 #include <hpke/random.h>
+#include <mls/async_session.h>
+#include <mls/chunked.h>
 #include <mls/session.h>
 
+#include <atomic>
+#include <deque>
+#include <sstream>
+#include <thread>
+
+#include "test_helpers.h"
+
 using namespace mls;
 
 class SessionTest
@@ -137,6 +146,45 @@ TEST_CASE_FIXTURE(SessionTest, "Full-Size Session Creation")
   }
 }
 
+TEST_CASE_FIXTURE(SessionTest, "KeyPackage Pool")
+{
+  broadcast_add();
+
+  const auto client =
+    Client(suite, new_identity_key(), Credential::basic(user_id));
+  auto pool = client.key_package_pool(4, parallel_executor);
+  REQUIRE(pool.available() == 0);
+  pool.refill();
+  REQUIRE(pool.available() == 4);
+
+  // Taking more than the pool holds generates the rest
+  const auto key_packages = pool.take(6);
+  REQUIRE(key_packages.size() == 6);
+  REQUIRE(pool.available() == 0);
+  REQUIRE(pool.outstanding() == 6);
+  for (size_t i = 1; i < key_packages.size(); i++) {
+    REQUIRE(key_packages[i] != key_packages[i - 1]);
+  }
+
+  // A Welcome is joined with the KeyPackage it adds
+  const auto initial_epoch = sessions[0].epoch();
+  auto add = sessions[0].add(key_packages[3]);
+  broadcast(add);
+  auto [welcome, commit] = sessions[0].commit();
+  broadcast(commit);
+
+  sessions.push_back(pool.join(welcome));
+  REQUIRE(pool.outstanding() == 5);
+  check(initial_epoch);
+
+  // Its private keys are dropped once it has been used
+  REQUIRE_THROWS_AS(pool.join(welcome), MissingStateError);
+  REQUIRE_FALSE(pool.discard(key_packages[3]));
+
+  REQUIRE(pool.discard(key_packages[0]));
+  REQUIRE(pool.outstanding() == 4);
+}
+
 class RunningSessionTest : public SessionTest
 {
 protected:
@@ -226,6 +274,597 @@ TEST_CASE_FIXTURE(RunningSessionTest, "Full Session Life-Cycle")
   }
 }
 
+TEST_CASE_FIXTURE(RunningSessionTest, "Batch Protect and Unprotect")
+{
+  const auto pts_before = std::vector<bytes>{ { 0 }, { 1, 2 } };
+  const auto pts_after = std::vector<bytes>{ { 3, 4, 5 }, { 6 } };
+
+  // Encrypt one batch in the current epoch and one in the next
+  auto cts = sessions[0].protect_batch(pts_before);
+
+  auto initial_epoch = sessions[0].epoch();
+  auto update = sessions[0].update();
+  broadcast(update);
+  auto welcome_commit = sessions[0].commit();
+  broadcast(std::get<1>(welcome_commit));
+  check(initial_epoch);
+
+  const auto cts_after = sessions[0].protect_batch(pts_after);
+  cts.insert(cts.begin() + 1, cts_after.begin(), cts_after.end());
+
+  // Messages from both epochs can be decrypted in a single batch
+  const auto expected = std::vector<bytes>{
+    pts_before[0],
+    pts_after[0],
+    pts_after[1],
+    pts_before[1],
+  };
+  for (size_t i = 1; i < sessions.size(); i++) {
+    REQUIRE(sessions[i].unprotect_batch(cts) == expected);
+  }
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Protect into Caller Buffer")
+{
+  const auto plaintexts = std::vector<bytes>{ {}, { 1, 2, 3 }, bytes(5000, 7) };
+
+  // Messages are appended after whatever the buffer already holds
+  const auto prefix = bytes{ 0xa0, 0xa1 };
+  auto out = prefix;
+  auto offsets = std::vector<size_t>{};
+  for (const auto& pt : plaintexts) {
+    offsets.push_back(out.size());
+    sessions[0].protect_into(pt, out);
+  }
+  offsets.push_back(out.size());
+
+  REQUIRE(bytes(bytes_view(out).slice(0, prefix.size())) == prefix);
+  for (size_t i = 0; i < plaintexts.size(); i++) {
+    const auto ct = bytes(bytes_view(out).slice(offsets[i], offsets[i + 1]));
+    for (size_t j = 1; j < sessions.size(); j++) {
+      REQUIRE(sessions[j].unprotect(ct) == plaintexts[i]);
+    }
+  }
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Chunked Transfer")
+{
+  const auto transfer_id = bytes{ 0x01, 0x02 };
+  const auto chunks = std::vector<bytes>{ bytes(1000, 1), { 2, 3 }, {} };
+
+  auto sealer = ChunkSealer(sessions[1], transfer_id);
+  auto sealed = std::vector<bytes>{};
+  for (size_t i = 0; i < chunks.size(); i++) {
+    sealed.push_back(sealer.seal(chunks[i], i + 1 == chunks.size()));
+  }
+  REQUIRE_THROWS_AS(sealer.seal(chunks[0], true), InvalidParameterError);
+
+  const auto sender = sessions[1].index();
+  for (const auto& session : sessions) {
+    auto opener = ChunkOpener(session, sender, transfer_id);
+    for (size_t i = 0; i < chunks.size(); i++) {
+      REQUIRE_FALSE(opener.finished());
+      REQUIRE(opener.open(sealed[i]) == chunks[i]);
+    }
+    REQUIRE(opener.finished());
+    REQUIRE_THROWS_AS(opener.open(sealed[0]), ProtocolError);
+  }
+
+  // Reordered chunks fail to open
+  auto reordered = ChunkOpener(sessions[2], sender, transfer_id);
+  REQUIRE_THROWS_AS(reordered.open(sealed[1]), ProtocolError);
+
+  // A chunk whose flag has been changed fails to open, so a truncated
+  // transfer cannot be passed off as complete
+  auto truncated = ChunkOpener(sessions[2], sender, transfer_id);
+  auto forged = sealed[1];
+  forged.at(0) = 0x01;
+  REQUIRE(truncated.open(sealed[0]) == chunks[0]);
+  REQUIRE_THROWS_AS(truncated.open(forged), ProtocolError);
+  REQUIRE_FALSE(truncated.finished());
+
+  // Chunks are bound to the sender and the transfer ID
+  const auto other = sessions[0].index();
+  auto other_sender = ChunkOpener(sessions[2], other, transfer_id);
+  REQUIRE_THROWS_AS(other_sender.open(sealed[0]), ProtocolError);
+
+  auto other_transfer = ChunkOpener(sessions[2], sender, bytes{ 0x03 });
+  REQUIRE_THROWS_AS(other_transfer.open(sealed[0]), ProtocolError);
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Concurrent Unprotect")
+{
+  const auto rounds = size_t(16);
+  const auto pt = bytes{ 0, 1, 2, 3 };
+
+  // Every other member sends a series of messages to the first member
+  auto cts = std::vector<std::vector<bytes>>(sessions.size());
+  for (size_t i = 1; i < sessions.size(); i++) {
+    for (size_t j = 0; j < rounds; j++) {
+      cts[i].push_back(sessions[i].protect(pt));
+    }
+  }
+
+  // Each sender's messages are decrypted on a thread of their own
+  const auto& receiver = sessions[0];
+  auto failures = std::vector<int>(sessions.size(), 0);
+  parallel_executor(sessions.size(), [&](size_t i) {
+    for (const auto& ct : cts[i]) {
+      failures[i] += (receiver.unprotect(ct) != pt);
+    }
+  });
+
+  REQUIRE(failures == std::vector<int>(sessions.size(), 0));
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Key Warming on Epoch Change")
+{
+  const auto pt = bytes{ 0, 1, 2, 3 };
+
+  // Warm the keys for the other members on a thread each
+  auto others = std::vector<LeafIndex>{};
+  for (uint32_t i = 1; i < sessions.size(); i++) {
+    others.push_back(LeafIndex{ i });
+  }
+  sessions[0].warm_keys(others, 4, parallel_executor);
+
+  for (size_t round = 0; round < 2; round++) {
+    auto initial_epoch = sessions[0].epoch();
+    auto [welcome, commit] = sessions[0].commit();
+    silence_unused(welcome);
+    broadcast(commit);
+    check(initial_epoch);
+
+    // Messages before, at and beyond the warmed generations all decrypt
+    for (size_t i = 1; i < sessions.size(); i++) {
+      for (size_t j = 0; j < 6; j++) {
+        REQUIRE(sessions[0].unprotect(sessions[i].protect(pt)) == pt);
+      }
+    }
+
+    for (size_t i = 1; i < sessions.size(); i++) {
+      REQUIRE(sessions[i].unprotect(sessions[0].protect(pt)) == pt);
+    }
+  }
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Late Messages from Retained Epochs")
+{
+  const auto pt = bytes{ 0, 1, 2, 3 };
+  const auto advance = [&] {
+    auto [welcome, commit] = sessions[0].commit();
+    silence_unused(welcome);
+    broadcast(commit);
+  };
+
+  // Keep the current epoch and the two before it
+  sessions[1].retain_epochs(3);
+
+  auto late = sessions[0].protect(pt);
+  auto initial_epoch = sessions[0].epoch();
+  advance();
+  advance();
+  REQUIRE(sessions[1].epoch() == initial_epoch + 2);
+
+  // A message from two epochs ago still decrypts, even in a batch
+  REQUIRE(sessions[1].unprotect(late) == pt);
+  late = sessions[0].protect(pt);
+  const auto current = sessions[0].protect(pt);
+  advance();
+  REQUIRE(sessions[1].unprotect_batch({ late, current }) ==
+          std::vector<bytes>{ pt, pt });
+
+  // Anything older has been dropped
+  advance();
+  advance();
+  REQUIRE_THROWS_AS(sessions[1].unprotect(late), MissingStateError);
+
+  // Shrinking the retention keeps only the most recent epochs
+  late = sessions[0].protect(pt);
+  advance();
+  sessions[1].retain_epochs(1);
+  REQUIRE_THROWS_AS(sessions[1].unprotect(late), MissingStateError);
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Epoch Snapshots for Readers")
+{
+  const auto label = std::string("test");
+  const auto context = bytes{ 4, 5, 6, 7 };
+  const auto size = size_t(16);
+
+  // A snapshot matches the Session at the epoch it was taken
+  auto& session = sessions[1];
+  const auto first = session.snapshot();
+  REQUIRE(first->epoch() == session.epoch());
+  REQUIRE(first->index() == session.index());
+  REQUIRE(first->tree() == session.tree());
+  REQUIRE(first->roster() == session.roster());
+  REQUIRE(first->authentication_secret() == session.authentication_secret());
+  REQUIRE(first->do_export(label, context, size) ==
+          session.do_export(label, context, size));
+
+  // Readers take snapshots while the Session moves through several epochs
+  const auto rounds = 4;
+  auto done = std::atomic<bool>(false);
+  auto failures = std::atomic<int>(0);
+  auto readers = std::vector<std::thread>{};
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&] {
+      auto last_epoch = first->epoch();
+      while (!done) {
+        const auto snapshot = session.snapshot();
+        const auto epoch = snapshot->epoch();
+        failures += (epoch < last_epoch);
+        failures += (snapshot->roster().size() != sessions.size());
+        silence_unused(snapshot->do_export(label, context, size));
+        last_epoch = epoch;
+      }
+    });
+  }
+
+  for (int i = 0; i < rounds; i++) {
+    auto [welcome, commit] = sessions[0].commit();
+    silence_unused(welcome);
+    broadcast(commit);
+  }
+
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  REQUIRE(failures == 0);
+
+  // The first snapshot still shows its own epoch
+  const auto last = session.snapshot();
+  REQUIRE(last->epoch() == first->epoch() + rounds);
+  REQUIRE(first->do_export(label, context, size) !=
+          last->do_export(label, context, size));
+  REQUIRE(last->do_export(label, context, size) ==
+          session.do_export(label, context, size));
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Pipelined Commits within Session")
+{
+  auto initial_epoch = sessions[0].epoch();
+  auto update = sessions[0].update();
+  broadcast(update);
+
+  // Build the next Commit, and a speculative Commit for the epoch after it,
+  // while the group is still in use
+  auto first = sessions[0].commit_async();
+  auto second = sessions[0].commit_async(first);
+
+  const auto plaintext = bytes{ 0, 1, 2, 3 };
+  auto ct = sessions[0].protect(plaintext);
+  REQUIRE(sessions[1].unprotect(ct) == plaintext);
+
+  auto [first_welcome, first_commit] = first.get();
+  silence_unused(first_welcome);
+  REQUIRE(first.ready());
+  broadcast(first_commit);
+  check(initial_epoch);
+
+  // The speculative Commit is usable once the first one has been accepted
+  initial_epoch = sessions[0].epoch();
+  auto [second_welcome, second_commit] = second.get();
+  silence_unused(second_welcome);
+  broadcast(second_commit);
+  check(initial_epoch);
+
+  // A Commit that lost to another member's Commit is not used
+  auto lost = sessions[0].commit_async();
+  auto [winner_welcome, winner_commit] = sessions[1].commit();
+  silence_unused(winner_welcome);
+  auto [lost_welcome, lost_commit] = lost.get();
+  silence_unused(lost_welcome);
+
+  initial_epoch = sessions[0].epoch();
+  broadcast(winner_commit);
+  check(initial_epoch);
+  REQUIRE_THROWS(sessions[0].handle(lost_commit));
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Pipelined Commits on a Scheduler")
+{
+  // Tasks are held until the test runs them
+  auto tasks = std::deque<std::function<void()>>{};
+  const auto run_next = [&]() {
+    auto task = std::move(tasks.front());
+    tasks.pop_front();
+    task();
+  };
+  sessions[0].set_executor(
+    {}, [&](std::function<void()> task) { tasks.push_back(std::move(task)); });
+
+  // The speculative Commit is only scheduled once the first has been built
+  auto first = sessions[0].commit_async();
+  auto second = sessions[0].commit_async(first);
+  REQUIRE(tasks.size() == 1);
+  REQUIRE_FALSE(first.ready());
+
+  run_next();
+  REQUIRE(first.ready());
+  REQUIRE_FALSE(second.ready());
+  REQUIRE(tasks.size() == 1);
+
+  run_next();
+  REQUIRE(second.ready());
+  REQUIRE(tasks.empty());
+
+  auto initial_epoch = sessions[0].epoch();
+  broadcast(std::get<1>(first.get()));
+  check(initial_epoch);
+
+  initial_epoch = sessions[0].epoch();
+  broadcast(std::get<1>(second.get()));
+  check(initial_epoch);
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Failed Commits Queue Their Changes")
+{
+  auto tasks = std::deque<std::function<void()>>{};
+  sessions[0].set_executor(
+    {}, [&](std::function<void()> task) { tasks.push_back(std::move(task)); });
+
+  // The speculative Commit cannot be built, since the member it removes is
+  // already removed by the Commit before it
+  const auto removed = uint32_t(sessions.size() - 1);
+  sessions[0].queue_remove(removed);
+  auto first = sessions[0].commit_async();
+  sessions[0].queue_remove(removed);
+  sessions[0].queue_update();
+  auto second = sessions[0].commit_async(first);
+  REQUIRE(sessions[0].queued_changes() == 0);
+
+  while (!tasks.empty()) {
+    tasks.front()();
+    tasks.pop_front();
+  }
+
+  REQUIRE_NOTHROW(first.get());
+  REQUIRE_THROWS(second.get());
+
+  // Its changes are queued again, ahead of any queued since
+  sessions[0].queue_update();
+  REQUIRE(sessions[0].queued_changes() == 2);
+
+  // ... and dropped again if the group moves on without them
+  auto initial_epoch = sessions[0].epoch();
+  broadcast(std::get<1>(first.get()), removed);
+  sessions.pop_back();
+  check(initial_epoch);
+  REQUIRE(sessions[0].queued_changes() == 1);
+
+  initial_epoch = sessions[0].epoch();
+  auto [welcome, commit] = sessions[0].commit();
+  silence_unused(welcome);
+  REQUIRE(sessions[0].queued_changes() == 0);
+  broadcast(commit);
+  check(initial_epoch);
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Coalesced Membership Changes")
+{
+  using Clock = CommitSchedule::Clock;
+  const auto max_delay = std::chrono::milliseconds(50);
+  sessions[0].set_commit_schedule({ 4, max_delay });
+
+  // Nothing is due until a change has been queued
+  const auto start = Clock::now();
+  REQUIRE_FALSE(sessions[0].commit_due(start + max_delay));
+
+  // Two joins, a removal and an update of our own leaf are queued
+  auto joins = std::vector<PendingJoin>{};
+  for (int i = 0; i < 2; i++) {
+    const auto client =
+      Client(suite, new_identity_key(), Credential::basic(user_id));
+    joins.push_back(client.start_join());
+    sessions[0].queue_add(joins.back().key_package());
+  }
+
+  const auto removed = uint32_t(sessions.size() - 1);
+  sessions[0].queue_remove(removed);
+  REQUIRE(sessions[0].queued_changes() == 3);
+  REQUIRE_FALSE(sessions[0].commit_due(start));
+
+  // The queue fills up before the delay has passed
+  sessions[0].queue_update();
+  REQUIRE(sessions[0].queued_changes() == 4);
+  auto initial_epoch = sessions[0].epoch();
+  auto due = sessions[0].commit_due(start);
+  REQUIRE(due);
+  REQUIRE(sessions[0].queued_changes() == 0);
+
+  // All of the changes take effect in a single epoch
+  auto [welcome, commit] = opt::get(due);
+  sessions.pop_back();
+  broadcast(commit);
+  for (const auto& join : joins) {
+    sessions.push_back(join.complete(welcome));
+  }
+
+  check(initial_epoch);
+  REQUIRE(sessions[0].epoch() == initial_epoch + 1);
+  REQUIRE(sessions[0].roster().size() == sessions.size());
+
+  // A single change is committed once it has waited long enough
+  sessions[0].queue_update();
+  REQUIRE_FALSE(sessions[0].commit_due(Clock::now()));
+  due = sessions[0].commit_due(Clock::now() + max_delay);
+  REQUIRE(due);
+
+  initial_epoch = sessions[0].epoch();
+  broadcast(std::get<1>(opt::get(due)));
+  check(initial_epoch);
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Queued Removes Follow Other Commits")
+{
+  // Two members are queued for removal
+  const auto moved = uint32_t(2);
+  const auto stays = uint32_t(3);
+  sessions[0].queue_remove(moved);
+  sessions[0].queue_remove(stays);
+  REQUIRE(sessions[0].queued_changes() == 2);
+
+  // Another member removes one of them first, and the queue drops it
+  auto initial_epoch = sessions[0].epoch();
+  broadcast(sessions[1].remove(moved), moved);
+  broadcast(std::get<1>(sessions[1].commit()), moved);
+  check(initial_epoch, moved);
+  REQUIRE(sessions[0].queued_changes() == 1);
+
+  // A new member takes the blank leaf, and is not removed by the queued
+  // change that used to point there
+  broadcast_add(1, moved);
+  REQUIRE(sessions[0].queued_changes() == 1);
+
+  initial_epoch = sessions[0].epoch();
+  auto [welcome, commit] = sessions[0].commit();
+  silence_unused(welcome);
+  REQUIRE(sessions[0].queued_changes() == 0);
+  broadcast(commit, stays);
+  sessions.erase(sessions.begin() + stays);
+  check(initial_epoch);
+  REQUIRE(sessions[0].roster().size() == sessions.size());
+
+  // Queued changes can be dropped without committing them
+  sessions[0].queue_update();
+  sessions[0].queue_remove(1);
+  REQUIRE(sessions[0].queued_changes() == 2);
+  sessions[0].clear_queue();
+  REQUIRE(sessions[0].queued_changes() == 0);
+  REQUIRE_FALSE(sessions[0].commit_due(CommitSchedule::Clock::now() +
+                                       std::chrono::hours(1)));
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Capture Session Traffic")
+{
+  auto out = std::stringstream{};
+  sessions[1].capture(std::make_shared<CaptureWriter>(out));
+
+  auto update = sessions[0].update();
+  broadcast(update);
+  auto [welcome, commit] = sessions[1].commit();
+  silence_unused(welcome);
+  broadcast(commit);
+
+  const auto ct = sessions[0].protect({ 0, 1, 2, 3 });
+  sessions[1].unprotect(ct);
+  const auto own_ct = sessions[1].protect({ 4, 5, 6 });
+  sessions[1].capture(nullptr);
+  sessions[1].unprotect(sessions[2].protect({ 7 }));
+
+  // The capture starts from the state at the time, and holds each operation
+  // in order, with the messages involved
+  const auto str = out.str();
+  const auto data = bytes(std::vector<uint8_t>(str.begin(), str.end()));
+  const auto capture = Capture::parse(data);
+  REQUIRE(capture.header.version == CaptureHeader::current_version);
+  REQUIRE(State::deserialize(capture.header.state).epoch() + 1 ==
+          sessions[1].epoch());
+
+  const auto expected = std::vector<std::tuple<CaptureType, bytes>>{
+    { CaptureType::handle, update },
+    { CaptureType::commit, commit },
+    { CaptureType::handle, commit },
+    { CaptureType::unprotect, ct },
+    { CaptureType::protect, own_ct },
+  };
+  REQUIRE(capture.records.size() == expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    const auto& [type, message] = expected[i];
+    CHECK(capture.records[i].type == type);
+    CHECK(capture.records[i].message == message);
+  }
+  CHECK(capture.records.back().plaintext_size == 3);
+}
+
+#if defined(MLS_HAS_COROUTINES)
+// A coroutine that starts at once and is not awaited by anyone
+struct Detached
+{
+  struct promise_type
+  {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Coroutine Session")
+{
+  auto initial_epoch = sessions[0].epoch();
+
+  // The worker and the strand are queues that the test runs by hand, so that
+  // it can see where each stage runs
+  auto worker_queue = std::deque<std::function<void()>>{};
+  auto strand_queue = std::deque<std::function<void()>>{};
+  auto async = AsyncSession(
+    std::move(sessions[0]),
+    { [&](auto task) { worker_queue.push_back(std::move(task)); },
+      [&](auto task) { strand_queue.push_back(std::move(task)); },
+      {} });
+
+  auto commit = bytes{};
+  auto handled = false;
+  auto done = false;
+  auto group = [&]() -> Detached {
+    auto [welcome, commit_data] = co_await async.commit();
+    silence_unused(welcome);
+    commit = commit_data;
+    handled = co_await async.handle(commit);
+    done = true;
+  };
+
+  group();
+  while (!done) {
+    // Nothing happens on the strand until the worker has run
+    REQUIRE(worker_queue.size() == 1);
+    REQUIRE(strand_queue.empty());
+    worker_queue.front()();
+    worker_queue.pop_front();
+
+    REQUIRE(strand_queue.size() == 1);
+    strand_queue.front()();
+    strand_queue.pop_front();
+  }
+
+  REQUIRE(handled);
+  sessions[0] = std::move(async.session());
+  broadcast(commit, 0);
+  check(initial_epoch);
+}
+
+TEST_CASE_FIXTURE(RunningSessionTest, "Inline Coroutine Session")
+{
+  auto initial_epoch = sessions[0].epoch();
+
+  // Each operation completes, and resumes the coroutine, before the call to
+  // the scheduler returns
+  const auto inline_scheduler = [](auto task) { task(); };
+  auto async = AsyncSession(std::move(sessions[0]),
+                            { inline_scheduler, inline_scheduler, {} });
+
+  auto commit = bytes{};
+  auto handled = false;
+  auto group = [&]() -> Detached {
+    auto [welcome, commit_data] = co_await async.commit();
+    silence_unused(welcome);
+    commit = commit_data;
+    handled = co_await async.handle(commit);
+  };
+
+  group();
+  REQUIRE(handled);
+  sessions[0] = std::move(async.session());
+  broadcast(commit, 0);
+  check(initial_epoch);
+}
+#endif
+
 TEST_CASE("Session with X509 Credential")
 {
   // leaf_cert with p-256 public key
@@ -0,0 +1,115 @@
+#include <doctest/doctest.h>
+#include <mls/sframe.h>
+
+#include "test_helpers.h"
+
+using namespace mls;
+
+TEST_CASE("SFrame Header Encoding")
+{
+  const auto cases = std::vector<std::tuple<SFrameHeader, bytes>>{
+    { { 0, 0 }, from_hex("00") },
+    { { 5, 7 }, from_hex("57") },
+    { { 8, 0 }, from_hex("8008") },
+    { { 0x12345, 1 }, from_hex("a1012345") },
+    { { 3, 0x100 }, from_hex("390100") },
+    { { 0xffffffffffffffff, 0xff },
+      from_hex("f8ffffffffffffffffff") },
+  };
+
+  for (const auto& [header, encoded] : cases) {
+    REQUIRE(header.encode() == encoded);
+
+    const auto [decoded, size] = SFrameHeader::decode(encoded + bytes{ 0xaa });
+    REQUIRE(size == encoded.size());
+    REQUIRE(decoded.key_id == header.key_id);
+    REQUIRE(decoded.counter == header.counter);
+  }
+
+  REQUIRE_THROWS_AS(SFrameHeader::decode(bytes{}), ProtocolError);
+  REQUIRE_THROWS_AS(SFrameHeader::decode(from_hex("a10123")), ProtocolError);
+}
+
+class SFrameTest
+{
+protected:
+  const CipherSuite suite{ CipherSuite::ID::X25519_AES128GCM_SHA256_Ed25519 };
+  const SFrameParameters params{ 0x0004, 2 };
+  const bytes group_id = { 0, 1, 2, 3 };
+
+  std::vector<Session> sessions =
+    bootstrap_group<Session>(suite, group_id, 3, 3);
+
+  void advance()
+  {
+    auto [welcome, commit] = sessions[0].commit();
+    silence_unused(welcome);
+    for (auto& session : sessions) {
+      session.handle(commit);
+    }
+  }
+};
+
+TEST_CASE_FIXTURE(SFrameTest, "SFrame Key Provider")
+{
+  auto providers = std::vector<SFrameKeyProvider>{};
+  for (const auto& session : sessions) {
+    providers.emplace_back(params);
+    providers.back().add_epoch(session);
+  }
+
+  const auto metadata = bytes{ 0xa0, 0xa1 };
+  const auto frame = bytes{ 0, 1, 2, 3, 4, 5, 6, 7 };
+
+  // Every member can decrypt frames from every other member
+  auto old_frames = std::vector<bytes>{};
+  for (size_t i = 0; i < providers.size(); i++) {
+    const auto ct = providers[i].protect(metadata, frame);
+    const auto [header, size] = SFrameHeader::decode(ct);
+    silence_unused(size);
+    REQUIRE(header.key_id ==
+            providers[i].key_id(sessions[i].epoch(), sessions[i].index()));
+
+    for (size_t j = 0; j < providers.size(); j++) {
+      REQUIRE(providers[j].unprotect(metadata, ct) == frame);
+    }
+
+    REQUIRE_THROWS_AS(providers[0].unprotect({}, ct), ProtocolError);
+    old_frames.push_back(ct);
+  }
+
+  // Each frame uses a fresh counter
+  const auto first = providers[0].protect(metadata, frame);
+  const auto second = providers[0].protect(metadata, frame);
+  REQUIRE(first != second);
+
+  // Frames from the previous epoch still decrypt after a new one is added
+  advance();
+  for (size_t i = 0; i < providers.size(); i++) {
+    providers[i].add_epoch(sessions[i]);
+  }
+
+  const auto ct = providers[1].protect(metadata, frame);
+  REQUIRE(providers[2].unprotect(metadata, ct) == frame);
+  REQUIRE(providers[2].unprotect(metadata, old_frames[0]) == frame);
+
+  // ... until the epoch's slot is reused
+  for (size_t n = 0; n < 4; n++) {
+    advance();
+    providers[2].add_epoch(sessions[2]);
+  }
+  REQUIRE_THROWS_AS(providers[2].unprotect(metadata, old_frames[0]),
+                    ProtocolError);
+}
+
+TEST_CASE("SFrame Parameter Checks")
+{
+  REQUIRE_THROWS_AS(SFrameKeyProvider(SFrameParameters{ 0x0001, 2 }),
+                    InvalidParameterError);
+  REQUIRE_THROWS_AS(SFrameKeyProvider(SFrameParameters{ 0x0004, 9 }),
+                    InvalidParameterError);
+
+  auto provider = SFrameKeyProvider(SFrameParameters{ 0x0005, 0 });
+  REQUIRE_THROWS_AS(provider.protect({}, { 0 }), InvalidParameterError);
+  REQUIRE_THROWS_AS(provider.unprotect({}, from_hex("00")), MissingStateError);
+}
@@ -1,8 +1,15 @@
 #include <doctest/doctest.h>
 #include <hpke/random.h>
 #include <mls/common.h>
+#include <mls/log.h>
 #include <mls/state.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "test_helpers.h"
+
 using namespace mls;
 
 struct CustomExtension
@@ -305,6 +312,72 @@ TEST_CASE_FIXTURE(StateTest, "Two Person with external tree for welcome")
   verify_group_functionality(group);
 }
 
+TEST_CASE_FIXTURE(StateTest, "Join from a Tree Slice")
+{
+  auto first0 = State{ group_id,
+                       suite,
+                       leaf_privs[0],
+                       identity_privs[0],
+                       key_packages[0].leaf_node,
+                       {} };
+
+  // Add two members, without a RatchetTree extension
+  auto adds = std::vector<Proposal>{ first0.add_proposal(key_packages[1]),
+                                     first0.add_proposal(key_packages[2]) };
+  auto [commit, welcome, first1] =
+    first0.commit(fresh_secret(), CommitOpts{ adds, false, false, {} }, {});
+  silence_unused(commit);
+
+  // The join completes from the slices alone
+  auto fetches = 0;
+  const auto fetch_tree = [&] {
+    fetches += 1;
+    return first1.tree();
+  };
+
+  const auto signer_slice = first1.tree().slice(LeafIndex{ 0 });
+  const auto join = [&](const TreeSlice& slice, const TreeSlice& signer) {
+    return State{ init_privs[1],   leaf_privs[1], identity_privs[1],
+                  key_packages[1], welcome,       slice,
+                  signer,          fetch_tree,    {} };
+  };
+
+  // A slice for another member, or from another epoch, is rejected, as is a
+  // slice for a signer other than the GroupInfo's
+  const auto slice = first1.tree().slice(LeafIndex{ 1 });
+  CHECK_THROWS_AS(join(first1.tree().slice(LeafIndex{ 2 }), signer_slice),
+                  InvalidParameterError);
+  CHECK_THROWS_AS(join(first0.tree().slice(LeafIndex{ 0 }), signer_slice),
+                  InvalidParameterError);
+  CHECK_THROWS_AS(join(slice, first1.tree().slice(LeafIndex{ 2 })),
+                  InvalidParameterError);
+
+  auto second = join(slice, signer_slice);
+  REQUIRE(fetches == 0);
+  REQUIRE_FALSE(second.hydrated());
+  REQUIRE(second.epoch() == first1.epoch());
+  REQUIRE(second.authentication_secret() == first1.authentication_secret());
+  REQUIRE(second.do_export("label", {}, 32) ==
+          first1.do_export("label", {}, 32));
+
+  // The tree is fetched the first time it is needed, and only then
+  REQUIRE(second == first1);
+  REQUIRE(fetches == 1);
+  REQUIRE(second.hydrated());
+
+  auto group = std::vector<State>{ first1, second };
+  verify_group_functionality(group);
+  REQUIRE(fetches == 1);
+
+  // A fetched tree that does not match the GroupInfo is rejected when it is
+  // first needed
+  const auto fetch_wrong = [&] { return first0.tree(); };
+  auto third = State{ init_privs[1],   leaf_privs[1], identity_privs[1],
+                      key_packages[1], welcome,       slice,
+                      signer_slice,    fetch_wrong,   {} };
+  CHECK_THROWS_AS(third.tree(), InvalidParameterError);
+}
+
 TEST_CASE_FIXTURE(StateTest, "External Join")
 {
   // Initialize the creator's state
@@ -331,6 +404,33 @@ TEST_CASE_FIXTURE(StateTest, "External Join")
   verify_group_functionality(group);
 }
 
+TEST_CASE_FIXTURE(StateTest, "Observe an External Join")
+{
+  auto first0 = State{ group_id,
+                       suite,
+                       leaf_privs[0],
+                       identity_privs[0],
+                       key_packages[0].leaf_node,
+                       {} };
+  auto observer = GroupObserver(first0.group_info(), std::nullopt);
+
+  // The ExternalInit in an external Commit leaves the tree alone, while the
+  // joiner's UpdatePath puts it in the tree
+  auto [commit, second0] = State::external_join(fresh_secret(),
+                                                identity_privs[1],
+                                                key_packages[1],
+                                                first0.group_info(),
+                                                std::nullopt,
+                                                {});
+  REQUIRE(observer.handle(commit));
+
+  auto first1 = opt::get(first0.handle(commit));
+  REQUIRE(observer.epoch() == first1.epoch());
+  REQUIRE(observer.tree() == first1.tree());
+  REQUIRE(observer.tree() == second0.tree());
+  REQUIRE(observer.group_context() == first1.group_context());
+}
+
 TEST_CASE_FIXTURE(StateTest, "External Join with External Tree")
 {
   // Initialize the creator's state
@@ -455,6 +555,49 @@ TEST_CASE_FIXTURE(StateTest, "Enforce Required Capabilities")
   state.handle(state.add(kp_yes_2, msg_opts));
 }
 
+TEST_CASE_FIXTURE(StateTest, "Compressed Tree When Required")
+{
+  // Every member supports the compressed tree by default, so a group can
+  // require it
+  auto group_extensions = ExtensionList{};
+  group_extensions.add(RequiredCapabilitiesExtension{
+    { ExtensionType::compressed_ratchet_tree }, {} });
+
+  states.emplace_back(group_id,
+                      suite,
+                      leaf_privs[0],
+                      identity_privs[0],
+                      key_packages[0].leaf_node,
+                      group_extensions);
+
+  auto adds = std::vector<Proposal>{};
+  for (size_t i = 1; i < group_size; i += 1) {
+    adds.push_back(states[0].add_proposal(key_packages[i]));
+  }
+
+  auto [commit, welcome, new_state] =
+    states[0].commit(fresh_secret(), CommitOpts{ adds, true, false, {} }, {});
+  silence_unused(commit);
+  states[0] = new_state;
+
+  // The joiners read the tree from the compressed extension in the Welcome
+  for (size_t i = 1; i < group_size; i += 1) {
+    states.emplace_back(init_privs[i],
+                        leaf_privs[i],
+                        identity_privs[i],
+                        key_packages[i],
+                        welcome,
+                        std::nullopt);
+  }
+
+  verify_group_functionality(states);
+
+  const auto group_info = states[0].group_info();
+  REQUIRE(group_info.extensions.get<CompressedRatchetTreeExtension>() !=
+          nullptr);
+  REQUIRE(group_info.extensions.get<RatchetTreeExtension>() == nullptr);
+}
+
 TEST_CASE_FIXTURE(StateTest, "Add Multiple Members")
 {
   // Initialize the creator's state
@@ -490,6 +633,88 @@ TEST_CASE_FIXTURE(StateTest, "Add Multiple Members")
   verify_group_functionality(states);
 }
 
+TEST_CASE_FIXTURE(StateTest, "Add Multiple Members with a Parallel Executor")
+{
+  states.emplace_back(group_id,
+                      suite,
+                      leaf_privs[0],
+                      identity_privs[0],
+                      key_packages[0].leaf_node,
+                      ExtensionList{});
+
+  auto adds = std::vector<Proposal>{};
+  for (size_t i = 1; i < group_size; i += 1) {
+    adds.push_back(states[0].add_proposal(key_packages[i]));
+  }
+
+  // Encrypt the group secrets for each joiner on its own thread
+  auto task_count = std::atomic<size_t>(0);
+  const auto executor = [&](size_t count, const auto& task) {
+    parallel_executor(count, [&](size_t i) {
+      task(i);
+      task_count += 1;
+    });
+  };
+
+  auto opts = CommitOpts{ adds, true, false, {} };
+  opts.executor = executor;
+  auto [commit, welcome, new_state] =
+    states[0].commit(fresh_secret(), opts, {});
+  silence_unused(commit);
+  states[0] = new_state;
+  REQUIRE(task_count >= group_size - 1);
+
+  // The joiners' entries are in the order they were added
+  REQUIRE(welcome.secrets.size() == group_size - 1);
+  for (size_t i = 1; i < group_size; i += 1) {
+    REQUIRE(welcome.find(key_packages[i]) == static_cast<int>(i - 1));
+    states.emplace_back(init_privs[i],
+                        leaf_privs[i],
+                        identity_privs[i],
+                        key_packages[i],
+                        welcome,
+                        std::nullopt);
+  }
+
+  verify_group_functionality(states);
+}
+
+TEST_CASE_FIXTURE(StateTest, "Welcome Lookup by KeyPackageRef")
+{
+  states.emplace_back(group_id,
+                      suite,
+                      leaf_privs[0],
+                      identity_privs[0],
+                      key_packages[0].leaf_node,
+                      ExtensionList{});
+
+  auto adds = std::vector<Proposal>{};
+  for (size_t i = 1; i < group_size; i += 1) {
+    adds.push_back(states[0].add_proposal(key_packages[i]));
+  }
+
+  auto [commit, welcome, new_state] =
+    states[0].commit(fresh_secret(), CommitOpts{ adds, true, false, {} }, {});
+  silence_unused(commit);
+  silence_unused(new_state);
+
+  // Lookups agree before and after a round trip through the wire format
+  const auto decoded = tls::get<Welcome>(tls::marshal(welcome));
+  REQUIRE(decoded == welcome);
+  for (size_t i = 1; i < group_size; i += 1) {
+    const auto expected = static_cast<int>(i - 1);
+    REQUIRE(welcome.find(key_packages[i]) == expected);
+    REQUIRE(decoded.find(key_packages[i].ref()) == expected);
+  }
+  REQUIRE(decoded.find(key_packages[0]) == std::nullopt);
+
+  // Changes to the entries are reflected even though the index is stale
+  auto changed = decoded;
+  std::swap(changed.secrets.front(), changed.secrets.back());
+  REQUIRE(changed.find(key_packages[1]) == static_cast<int>(group_size - 2));
+  REQUIRE(changed.find(key_packages[group_size - 1]) == 0);
+}
+
 TEST_CASE_FIXTURE(StateTest, "Full Size Group")
 {
   // Initialize the creator's state
@@ -531,6 +756,106 @@ TEST_CASE_FIXTURE(StateTest, "Full Size Group")
   }
 }
 
+TEST_CASE_FIXTURE(StateTest, "Join with Deferred Tree Validation")
+{
+  auto first0 = State{ group_id,
+                       suite,
+                       leaf_privs[0],
+                       identity_privs[0],
+                       key_packages[0].leaf_node,
+                       {} };
+  auto join_opts = JoinOptions{ {}, true };
+
+  SUBCASE("Valid tree")
+  {
+    auto add = first0.add_proposal(key_packages[1]);
+    auto [commit, welcome, first1] =
+      first0.commit(fresh_secret(), CommitOpts{ { add }, true, false, {} }, {});
+    silence_unused(commit);
+
+    auto second = State{ init_privs[1],   leaf_privs[1], identity_privs[1],
+                         key_packages[1], welcome,       std::nullopt,
+                         join_opts };
+
+    // Application messages can be read before validation has finished
+    auto ct = first1.protect(test_aad, test_message, 0);
+    auto [aad, pt] = second.unprotect(ct);
+    REQUIRE(aad == test_aad);
+    REQUIRE(pt == test_message);
+
+    second.wait_for_tree_validation();
+    REQUIRE_FALSE(second.tree_validation_pending());
+    REQUIRE(second == first1);
+
+    auto group = std::vector<State>{ first1, second };
+    verify_group_functionality(group);
+  }
+
+  SUBCASE("Validation started by a scheduler")
+  {
+    auto add = first0.add_proposal(key_packages[1]);
+    auto [commit, welcome, first1] =
+      first0.commit(fresh_secret(), CommitOpts{ { add }, true, false, {} }, {});
+    silence_unused(commit);
+
+    // The validation does not start until the scheduler runs it
+    auto tasks = std::vector<std::function<void()>>{};
+    auto scheduled_opts = join_opts;
+    scheduled_opts.scheduler = [&](std::function<void()> task) {
+      tasks.push_back(std::move(task));
+    };
+
+    auto second = State{ init_privs[1],   leaf_privs[1], identity_privs[1],
+                         key_packages[1], welcome,       std::nullopt,
+                         scheduled_opts };
+    REQUIRE(tasks.size() == 1);
+    REQUIRE(second.tree_validation_pending());
+
+    tasks.at(0)();
+    REQUIRE_FALSE(second.tree_validation_pending());
+    REQUIRE(second == first1);
+  }
+
+  SUBCASE("Invalid leaf elsewhere in the tree")
+  {
+    // The committer adds a member whose leaf is not validly signed, by
+    // building the Add itself rather than through add_proposal()
+    auto bad_leaf = key_packages[1].leaf_node;
+    bad_leaf.signature.at(0) ^= 0xff;
+    auto bad_kp = KeyPackage{
+      suite, init_privs[1].public_key, bad_leaf, {}, identity_privs[1]
+    };
+    auto bad_add = Proposal{ Add{ bad_kp } };
+    auto add = first0.add_proposal(key_packages[2]);
+    auto opts = CommitOpts{ { bad_add, add }, true, false, {} };
+    auto [commit, welcome, first1] = first0.commit(fresh_secret(), opts, {});
+    silence_unused(commit);
+
+    REQUIRE_THROWS(State{ init_privs[2],
+                          leaf_privs[2],
+                          identity_privs[2],
+                          key_packages[2],
+                          welcome,
+                          std::nullopt });
+
+    auto third = State{ init_privs[2],   leaf_privs[2], identity_privs[2],
+                        key_packages[2], welcome,       std::nullopt,
+                        join_opts };
+
+    auto ct = first1.protect(test_aad, test_message, 0);
+    auto [aad, pt] = third.unprotect(ct);
+    REQUIRE(aad == test_aad);
+    REQUIRE(pt == test_message);
+
+    // The failure is reported once validation finishes, and blocks sending
+    REQUIRE_THROWS_AS(third.wait_for_tree_validation(), InvalidParameterError);
+    REQUIRE_THROWS_AS(third.protect(test_aad, test_message, 0),
+                      InvalidParameterError);
+    REQUIRE_THROWS_AS(third.commit(fresh_secret(), {}, {}),
+                      InvalidParameterError);
+  }
+}
+
 class RunningGroupTest : public StateTest
 {
 protected:
@@ -637,6 +962,116 @@ TEST_CASE_FIXTURE(RunningGroupTest, "Remove Members from a Group")
   }
 }
 
+TEST_CASE_FIXTURE(RunningGroupTest, "Catch Up on a Backlog of Handshakes")
+{
+  // The last member goes offline while the others send Proposals and Commits
+  auto offline = states.back();
+  states.pop_back();
+
+  auto backlog = std::vector<MLSMessage>{};
+  for (size_t i = 0; i < states.size(); i += 1) {
+    auto sender = (i + 1) % states.size();
+    auto update = states[sender].update(fresh_secret(), {}, msg_opts);
+    for (auto& state : states) {
+      REQUIRE_FALSE(state.handle(update).has_value());
+    }
+
+    auto [commit, welcome, new_state] = states[i].commit(fresh_secret(), {}, {});
+    silence_unused(welcome);
+    for (auto& state : states) {
+      if (state.index().val == i) {
+        state = new_state;
+      } else {
+        state = opt::get(state.handle(commit));
+      }
+    }
+
+    backlog.push_back(update);
+    backlog.push_back(commit);
+  }
+
+  // A state that fails part way is left just before the failing message
+  auto stalled = offline;
+  auto replayed = std::vector<MLSMessage>(backlog.begin(), backlog.begin() + 2);
+  replayed.push_back(backlog.at(1));
+  const auto failed = stalled.handle_sequence(replayed);
+  REQUIRE(failed.handled == 2);
+  REQUIRE(failed.error != nullptr);
+  REQUIRE(stalled.epoch() == offline.epoch() + 1);
+
+  // Catching up from the start brings the member back into the group
+  const auto result = offline.handle_sequence(backlog);
+  REQUIRE(result.handled == backlog.size());
+  REQUIRE(result.error == nullptr);
+
+  states.push_back(offline);
+  check_consistency();
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Commit a Batch of Proposals by Reference")
+{
+  auto proposals = std::vector<MLSMessage>{
+    states[1].remove(LeafIndex{ 4 }, msg_opts),
+    states[2].remove(LeafIndex{ 3 }, msg_opts),
+  };
+
+  for (auto& state : states) {
+    state.cache_proposals(proposals);
+  }
+
+  auto [commit, welcome, new_state] = states[0].commit(fresh_secret(), {}, {});
+  silence_unused(welcome);
+
+  // A batch is rejected as a whole if any message is not a proposal
+  auto rejected = states[1];
+  proposals.push_back(commit);
+  REQUIRE_THROWS_AS(rejected.cache_proposals(proposals), InvalidParameterError);
+
+  states.erase(states.begin() + 3, states.end());
+  for (auto& state : states) {
+    if (state.index() == new_state.index()) {
+      state = new_state;
+    } else {
+      state = opt::get(state.handle(commit));
+    }
+  }
+
+  check_consistency();
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Commit with a Parallel Executor")
+{
+  // Run each task on its own thread
+  auto task_count = std::atomic<size_t>(0);
+  const auto executor = [&](size_t count, const auto& task) {
+    parallel_executor(count, [&](size_t i) {
+      task(i);
+      task_count += 1;
+    });
+  };
+
+  for (size_t i = 0; i < group_size; i += 1) {
+    auto opts = CommitOpts{ {}, true, false, {} };
+    opts.executor = executor;
+
+    auto [commit, welcome, new_state] =
+      states[i].commit(fresh_secret(), opts, {});
+    silence_unused(welcome);
+
+    for (auto& state : states) {
+      if (state.index().val == i) {
+        state = new_state;
+      } else {
+        state = opt::get(state.handle(commit));
+      }
+    }
+
+    check_consistency();
+  }
+
+  REQUIRE(task_count > 0);
+}
+
 TEST_CASE_FIXTURE(RunningGroupTest, "Roster Updates")
 {
   static const auto get_creds = [](const auto& kps) {
@@ -687,3 +1122,383 @@ TEST_CASE_FIXTURE(RunningGroupTest, "Roster Updates")
     REQUIRE(expected_creds == get_creds(states[i].roster()));
   }
 }
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Batch Protect and Unprotect")
+{
+  const auto pts = std::vector<bytes>{
+    from_hex("00"),
+    from_hex("0102"),
+    from_hex("030405"),
+  };
+
+  for (auto& state : states) {
+    auto cts = state.protect_batch(test_aad, pts, 0);
+    REQUIRE(cts.size() == pts.size());
+
+    for (auto& other : states) {
+      if (other.index() == state.index()) {
+        continue;
+      }
+
+      auto decrypted = other.unprotect_batch(cts);
+      REQUIRE(decrypted.size() == pts.size());
+      for (size_t i = 0; i < pts.size(); i++) {
+        const auto& [aad, pt] = decrypted[i];
+        REQUIRE(aad == test_aad);
+        REQUIRE(pt == pts[i]);
+      }
+    }
+  }
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Batch Unprotect with a Parallel Executor")
+{
+  // Messages from every other member, interleaved
+  auto& receiver = states[0];
+  receiver.set_executor(parallel_executor);
+
+  auto cts = std::vector<MLSMessage>{};
+  auto pts = std::vector<bytes>{};
+  for (uint8_t round = 0; round < 3; round++) {
+    for (size_t i = 1; i < group_size; i++) {
+      pts.push_back(bytes(size_t(round) + 1, static_cast<uint8_t>(i)));
+      cts.push_back(states[i].protect(test_aad, pts.back(), 0));
+    }
+  }
+
+  const auto decrypted = receiver.unprotect_batch(cts);
+  REQUIRE(decrypted.size() == pts.size());
+  for (size_t i = 0; i < pts.size(); i++) {
+    const auto& [aad, pt] = decrypted[i];
+    REQUIRE(aad == test_aad);
+    REQUIRE(pt == pts[i]);
+  }
+
+  // A failure anywhere in the batch is reported.  Keys are deleted once used,
+  // so a repeated message cannot be decrypted.
+  const auto ct = states[1].protect(test_aad, pts.front(), 0);
+  REQUIRE_THROWS(receiver.unprotect_batch({ ct, ct }));
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Cached Group Context Follows the Epoch")
+{
+  const auto check_context = [](const State& state) {
+    const auto& ctx = state.group_context();
+    REQUIRE(&ctx == &state.group_context());
+    REQUIRE(ctx.epoch == state.epoch());
+    REQUIRE(ctx.tree_hash == state.tree().root_hash());
+    REQUIRE(ctx.extensions == state.extensions());
+  };
+
+  for (const auto& state : states) {
+    check_context(state);
+  }
+
+  auto remove = states[0].remove_proposal(LeafIndex{ 1 });
+  auto [commit, welcome, new_state] = states[0].commit(
+    fresh_secret(), CommitOpts{ { remove }, false, false, {} }, {});
+  silence_unused(welcome);
+  check_context(new_state);
+  REQUIRE(new_state.group_context().epoch == states[0].epoch() + 1);
+
+  auto handled = opt::get(states[2].handle(commit));
+  check_context(handled);
+  REQUIRE(handled.group_context() == new_state.group_context());
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Cached GroupInfo Follows the Epoch")
+{
+  const auto check_group_info = [](const State& state) {
+    // Each form is signed once and then returned as is
+    const auto& with_tree = state.group_info_data(true);
+    const auto& without_tree = state.group_info_data(false);
+    REQUIRE(&with_tree == &state.group_info_data(true));
+    REQUIRE(&without_tree == &state.group_info_data(false));
+
+    const auto full = tls::get<GroupInfo>(with_tree);
+    const auto bare = tls::get<GroupInfo>(without_tree);
+    REQUIRE(full.group_context == state.group_context());
+    REQUIRE(bare.group_context == state.group_context());
+    REQUIRE(full.verify(state.tree()));
+    REQUIRE(bare.verify(state.tree()));
+    REQUIRE(full.extensions.find<RatchetTreeExtension>());
+    REQUIRE_FALSE(bare.extensions.find<RatchetTreeExtension>());
+    REQUIRE(bare.extensions.find<ExternalPubExtension>());
+    REQUIRE(state.group_info() == full);
+  };
+
+  for (const auto& state : states) {
+    check_group_info(state);
+  }
+
+  // The next epoch does not reuse the previous epoch's GroupInfo
+  auto [commit, welcome, new_state] = states[0].commit(fresh_secret(), {}, {});
+  silence_unused(welcome);
+  check_group_info(new_state);
+  REQUIRE(new_state.group_info().group_context.epoch == states[0].epoch() + 1);
+
+  auto handled = opt::get(states[1].handle(commit));
+  check_group_info(handled);
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Observe a Group from Outside")
+{
+  auto observer = GroupObserver(states[0].group_info(), std::nullopt);
+  const auto check_observer = [&](const State& state) {
+    REQUIRE(observer.epoch() == state.epoch());
+    REQUIRE(observer.tree() == state.tree());
+    REQUIRE(observer.group_context() == state.group_context());
+  };
+  check_observer(states[0]);
+  REQUIRE(observer.group_info() == states[0].group_info());
+
+  const auto advance = [&](size_t committer, const MLSMessage& commit) {
+    REQUIRE(observer.handle(commit));
+    for (auto& state : states) {
+      if (state.index().val != committer) {
+        state = opt::get(state.handle(commit));
+      }
+    }
+  };
+
+  // Proposals are cached and can then be committed by reference
+  const auto remove = states[1].remove(LeafIndex{ 4 }, msg_opts);
+  REQUIRE_FALSE(observer.handle(remove));
+  for (auto& state : states) {
+    state.handle(remove);
+  }
+
+  auto [commit_remove, welcome_remove, state_remove] =
+    states[0].commit(fresh_secret(), {}, {});
+  silence_unused(welcome_remove);
+  states.pop_back();
+  states[0] = state_remove;
+  advance(0, commit_remove);
+  check_observer(states[0]);
+  check_consistency();
+
+  // A GroupInfo is only dropped in favor of one for the new epoch
+  REQUIRE_FALSE(observer.group_info());
+  const auto stale = tls::get<GroupInfo>(states[1].group_info_data(false));
+  observer.set_group_info(states[1].group_info());
+  REQUIRE(observer.group_info() == states[1].group_info());
+
+  // Updates by value in a Commit with a path
+  auto new_leaf = fresh_secret();
+  auto update = states[2].update_proposal(new_leaf, {});
+  auto [commit_update, welcome_update, state_update] =
+    states[2].commit(new_leaf, CommitOpts{ { update }, true, false, {} }, {});
+  silence_unused(welcome_update);
+  states[2] = state_update;
+  advance(2, commit_update);
+  check_observer(states[2]);
+  REQUIRE_THROWS_AS(observer.set_group_info(stale), InvalidParameterError);
+
+  // An invalid message leaves the observer as it was
+  const auto epoch = observer.epoch();
+  REQUIRE_THROWS_AS(observer.handle(commit_update), InvalidParameterError);
+  REQUIRE(observer.epoch() == epoch);
+  check_observer(states[0]);
+
+  // Commits sent as MLSCiphertext cannot be read from outside
+  const auto encrypt = MessageOpts{ true, {}, 0 };
+  auto [commit_encrypted, welcome_encrypted, state_encrypted] =
+    states[0].commit(fresh_secret(), {}, encrypt);
+  silence_unused(welcome_encrypted);
+  silence_unused(state_encrypted);
+  REQUIRE_THROWS_AS(observer.handle(commit_encrypted), ProtocolError);
+  REQUIRE(observer.epoch() == epoch);
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Serialize and Restore State")
+{
+  // Use some ratchet positions and leave a proposal pending
+  auto first = states[0].protect(test_aad, test_message, 0);
+  auto second = states[0].protect(test_aad, test_message, 0);
+  states[1].unprotect(first);
+
+  auto remove = states[0].remove(LeafIndex{ 2 }, {});
+  states[1].handle(remove);
+
+  auto restored = std::vector<State>{};
+  for (const auto& state : states) {
+    auto saved = state.serialize();
+    restored.push_back(State::deserialize(saved.data(), saved.size()));
+
+    REQUIRE(restored.back() == state);
+    REQUIRE(restored.back().index() == state.index());
+    REQUIRE(restored.back().serialize() == saved);
+  }
+
+  // The ratchets resume where they left off
+  REQUIRE_THROWS(restored[1].unprotect(first));
+  auto [aad, pt] = restored[1].unprotect(second);
+  REQUIRE(aad == test_aad);
+  REQUIRE(pt == test_message);
+
+  // The pending proposal is carried over
+  for (size_t i = 0; i < restored.size(); i++) {
+    if (i != 1) {
+      restored[i].handle(remove);
+    }
+  }
+
+  auto [commit, welcome, new_state] =
+    restored[1].commit(fresh_secret(), {}, {});
+  silence_unused(welcome);
+
+  auto next = std::vector<State>{};
+  for (auto& state : restored) {
+    if (state.index() == LeafIndex{ 2 }) {
+      continue;
+    }
+
+    if (state.index() == restored[1].index()) {
+      next.push_back(new_state);
+    } else {
+      next.push_back(opt::get(state.handle(commit)));
+    }
+  }
+
+  REQUIRE(new_state.roster().size() == group_size - 1);
+  verify_group_functionality(next);
+
+  // Malformed input is rejected
+  auto saved = states[0].serialize();
+  auto bad_version = saved;
+  bad_version.at(1) ^= 0xff;
+  REQUIRE_THROWS_AS(State::deserialize(bad_version), ProtocolError);
+
+  saved = saved + bytes{ 0 };
+  REQUIRE_THROWS_AS(State::deserialize(saved), ProtocolError);
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Lazily Restore State")
+{
+  const auto saved = states[1].serialize();
+  auto loads = 0;
+  auto lazy = State::deserialize_lazy(saved, [&]() {
+    loads += 1;
+    return saved;
+  });
+
+  // Metadata and exported secrets do not need the tree or the keys
+  REQUIRE_FALSE(lazy.hydrated());
+  REQUIRE(lazy.epoch() == states[1].epoch());
+  REQUIRE(lazy.index() == states[1].index());
+  REQUIRE(lazy.group_context() == states[1].group_context());
+  REQUIRE(lazy.do_export("test", {}, 16) ==
+          states[1].do_export("test", {}, 16));
+  REQUIRE(lazy.key_memory_usage().senders == 0);
+  REQUIRE(loads == 0);
+
+  // The first message loads the rest of the state, once
+  auto ct = states[0].protect(test_aad, test_message, 0);
+  auto [aad, pt] = lazy.unprotect(ct);
+  REQUIRE(aad == test_aad);
+  REQUIRE(pt == test_message);
+  REQUIRE(lazy.hydrated());
+
+  ct = lazy.protect(test_aad, test_message, 0);
+  std::tie(aad, pt) = states[0].unprotect(ct);
+  REQUIRE(pt == test_message);
+  REQUIRE(loads == 1);
+
+  auto eager = State::deserialize(saved);
+  REQUIRE(lazy == eager);
+
+  // A loader that fails is only noticed when the state is used
+  const auto truncated = saved.slice(0, saved.size() - 1);
+  auto broken = State::deserialize_lazy(saved, [&]() { return truncated; });
+  REQUIRE(broken.epoch() == states[1].epoch());
+  REQUIRE_THROWS(broken.roster());
+  REQUIRE_FALSE(broken.hydrated());
+
+  // So is a loader that returns another state, even one with the same tree
+  const auto other = states[2].serialize();
+  auto swapped = State::deserialize_lazy(saved, [&]() { return other; });
+  REQUIRE_THROWS_AS(swapped.roster(), ProtocolError);
+  REQUIRE_FALSE(swapped.hydrated());
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Key Retention Keeps Our Own Ratchets")
+{
+  // Every member has sent and received, so each holds ratchets for all senders
+  auto& sender = states[0];
+  sender.set_key_retention({ 0, 1, {} });
+  REQUIRE(sender.key_memory_usage().senders == group_size);
+
+  // Once the TTL has passed, the next check of the clock evicts every sender
+  // but ourselves, and we can still send
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  for (size_t i = 0; i < KeyRetentionPolicy::clock_period; i++) {
+    sender.protect(test_aad, test_message, 0);
+  }
+
+  REQUIRE(sender.key_memory_usage().senders == 1);
+  const auto ct = sender.protect(test_aad, test_message, 0);
+  REQUIRE(std::get<1>(states[1].unprotect(ct)) == test_message);
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Report Memory Usage")
+{
+  const auto before = states[1].memory_usage();
+  REQUIRE(before.epochs == 1);
+  REQUIRE(before.tree.nodes >= group_size);
+  REQUIRE(before.tree.cached_hashes > 0);
+  REQUIRE(before.tree_priv.private_keys > 0);
+  REQUIRE(before.keys.secret_tree_nodes > 0);
+  REQUIRE(before.pending_proposals == 0);
+  REQUIRE(before.total_bytes() > before.tree.bytes);
+
+  // Pending proposals and the keys held for senders are counted as they
+  // accumulate
+  auto remove = states[0].remove(RosterIndex{ 2 }, {});
+  REQUIRE_FALSE(states[1].handle(remove));
+  auto ct = states[0].protect(test_aad, test_message, 0);
+  states[1].unprotect(ct);
+
+  const auto after = states[1].memory_usage();
+  REQUIRE(after.pending_proposals == 1);
+  REQUIRE(after.proposal_bytes > 0);
+  REQUIRE(after.keys.senders > 0);
+  REQUIRE(after.tree.nodes == before.tree.nodes);
+
+  // Usage for several epochs adds up
+  auto sum = before;
+  sum += after;
+  REQUIRE(sum.epochs == 2);
+  REQUIRE(sum.tree.nodes == before.tree.nodes + after.tree.nodes);
+  REQUIRE(sum.total_bytes() == before.total_bytes() + after.total_bytes());
+}
+
+TEST_CASE_FIXTURE(RunningGroupTest, "Metrics for Group Operations")
+{
+  using log::Histogram;
+
+  auto sink = std::make_shared<CountingMetricsSink>();
+  log::Metrics::set_sink(sink);
+
+  auto [commit, welcome, new_state] = states[0].commit(fresh_secret(), {}, {});
+  silence_unused(welcome);
+  auto handled = opt::get(states[1].handle(commit));
+
+  auto ct = new_state.protect({}, from_hex("00"), 0);
+  handled.unprotect(ct);
+
+  log::Metrics::remove_sink();
+
+  REQUIRE(sink->samples(Histogram::commit_time).size() == 1);
+  REQUIRE(sink->samples(Histogram::handle_time).size() == 1);
+  REQUIRE(sink->samples(Histogram::encap_time).size() == 1);
+  REQUIRE(sink->samples(Histogram::decap_time).size() == 1);
+  REQUIRE_FALSE(sink->samples(Histogram::tree_hash_time).empty());
+  REQUIRE_FALSE(sink->samples(Histogram::ratchet_cached_keys).empty());
+
+  // An empty Commit encrypts once to each subtree along the committer's path
+  const auto hpke_ops = sink->samples(Histogram::commit_hpke_ops);
+  REQUIRE(hpke_ops.size() == 1);
+  REQUIRE(hpke_ops[0] > 0);
+
+  REQUIRE(sink->total(log::Counter::ratchet_advances) > 0);
+}
@@ -0,0 +1,41 @@
+#include "test_helpers.h"
+
+#include <mls_vectors/mls_vectors.h>
+
+using namespace mls;
+
+void
+parallel_executor(size_t count, const std::function<void(size_t)>& task)
+{
+  mls_vectors::thread_executor(count)(count, task);
+}
+
+void
+CountingMetricsSink::count(log::Counter counter, uint64_t value)
+{
+  const auto lock = std::lock_guard(mutex);
+  counters[counter] += value;
+}
+
+void
+CountingMetricsSink::record(log::Histogram histogram, uint64_t value)
+{
+  const auto lock = std::lock_guard(mutex);
+  histograms[histogram].push_back(value);
+}
+
+uint64_t
+CountingMetricsSink::total(log::Counter counter) const
+{
+  const auto lock = std::lock_guard(mutex);
+  const auto it = counters.find(counter);
+  return (it == counters.end()) ? 0 : it->second;
+}
+
+std::vector<uint64_t>
+CountingMetricsSink::samples(log::Histogram histogram) const
+{
+  const auto lock = std::lock_guard(mutex);
+  const auto it = histograms.find(histogram);
+  return (it == histograms.end()) ? std::vector<uint64_t>{} : it->second;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <mls/log.h>
+#include <mls/session.h>
+#include <mls/state.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+// An Executor that runs every task of a batch concurrently, each on a thread of
+// its own (the calling thread among them)
+void
+parallel_executor(size_t count, const std::function<void(size_t)>& task);
+
+// A metrics sink that keeps every counter and histogram sample it receives.
+// Metrics may be recorded from executor threads, so access is locked.
+class CountingMetricsSink : public mls::log::MetricsSink
+{
+public:
+  ~CountingMetricsSink() override = default;
+
+  void count(mls::log::Counter counter, uint64_t value) override;
+  void record(mls::log::Histogram histogram, uint64_t value) override;
+
+  uint64_t total(mls::log::Counter counter) const;
+  std::vector<uint64_t> samples(mls::log::Histogram histogram) const;
+
+private:
+  mutable std::mutex mutex;
+  std::map<mls::log::Counter, uint64_t> counters;
+  std::map<mls::log::Histogram, std::vector<uint64_t>> histograms;
+};
+
+// A group of `size` members, as States or as Sessions.  The first member
+// creates the group and adds the others with a single Commit, and they join
+// from its Welcome.  Only the first `count` members are returned, so that a
+// large group costs little more than the KeyPackages of the others.
+//
+// This is defined here rather than in test_helpers.cpp so that the allocation
+// tests, which are built without that file, can use it too.
+template<typename Member>
+std::vector<Member>
+bootstrap_group(mls::CipherSuite suite,
+                const bytes_ns::bytes& group_id,
+                size_t size,
+                size_t count)
+{
+  using namespace mls;
+  static_assert(std::is_same_v<Member, State> ||
+                std::is_same_v<Member, Session>);
+
+  const auto credential = Credential::basic({ 4, 5, 6, 7 });
+  auto members = std::vector<Member>{};
+
+  if constexpr (std::is_same_v<Member, Session>) {
+    const auto new_client = [&]() {
+      return Client(suite, SignaturePrivateKey::generate(suite), credential);
+    };
+
+    auto creator = new_client().begin_session(group_id);
+    auto joins = std::vector<PendingJoin>{};
+    for (size_t i = 1; i < size; i++) {
+      auto join = new_client().start_join();
+      creator.handle(creator.add(join.key_package()));
+      if (i < count) {
+        joins.push_back(std::move(join));
+      }
+    }
+
+    auto [welcome, commit] = creator.commit();
+    creator.handle(commit);
+
+    members.push_back(std::move(creator));
+    for (const auto& join : joins) {
+      members.push_back(join.complete(welcome));
+    }
+  } else {
+    struct Client
+    {
+      HPKEPrivateKey init_priv;
+      HPKEPrivateKey leaf_priv;
+      SignaturePrivateKey sig_priv;
+      KeyPackage key_package;
+    };
+
+    const auto new_client = [&]() {
+      auto init_priv = HPKEPrivateKey::generate(suite);
+      auto leaf_priv = HPKEPrivateKey::generate(suite);
+      auto sig_priv = SignaturePrivateKey::generate(suite);
+      auto leaf_node = LeafNode{ suite,
+                                 leaf_priv.public_key,
+                                 sig_priv.public_key,
+                                 credential,
+                                 Capabilities::create_default(),
+                                 Lifetime::create_default(),
+                                 {},
+                                 sig_priv };
+      auto key_package =
+        KeyPackage{ suite, init_priv.public_key, leaf_node, {}, sig_priv };
+      return Client{ init_priv, leaf_priv, sig_priv, key_package };
+    };
+
+    const auto creator_client = new_client();
+    auto creator = State{ group_id,
+                          suite,
+                          creator_client.leaf_priv,
+                          creator_client.sig_priv,
+                          creator_client.key_package.leaf_node,
+                          {} };
+
+    auto joiners = std::vector<Client>{};
+    auto adds = std::vector<Proposal>{};
+    for (size_t i = 1; i < size; i++) {
+      auto client = new_client();
+      adds.push_back(creator.add_proposal(client.key_package));
+      if (i < count) {
+        joiners.push_back(std::move(client));
+      }
+    }
+
+    const auto opts = CommitOpts{ adds, true, false, {} };
+    auto [commit, welcome, next] =
+      creator.commit(random_bytes(suite.secret_size()), opts, {});
+    silence_unused(commit);
+
+    members.push_back(std::move(next));
+    for (const auto& client : joiners) {
+      members.push_back(State{ client.init_priv,
+                               client.leaf_priv,
+                               client.sig_priv,
+                               client.key_package,
+                               welcome,
+                               std::nullopt });
+    }
+  }
+
+  return members;
+}
@@ -10,3 +10,53 @@ TEST_CASE("Tree Math Test Vectors")
   const auto tv = TreeMathTestVector::create(256);
   REQUIRE(tv.verify() == std::nullopt);
 }
+
+using namespace mls;
+
+// The ranges are usable in constant expressions
+static_assert(NodeIndex::root(LeafCount{ 8 }).val == 7);
+static_assert(NodeIndex{ 5 }.level() == 1 && NodeIndex{ 7 }.level() == 3);
+static_assert(LeafIndex{ 2 }.ancestor(LeafIndex{ 5 }).val == 7);
+static_assert(NodeIndex{ 4 }.dirpath_range(LeafCount{ 8 }).size() == 3);
+static_assert(NodeIndex{ 4 }.dirpath_range(LeafCount{ 8 })[1].val == 3);
+static_assert(NodeIndex{ 4 }.copath_range(LeafCount{ 8 })[0].val == 6);
+static_assert(NodeIndex{ 11 }.leaves(LeafCount{ 6 }).size() == 2);
+
+TEST_CASE("Tree Math Ranges Match Stepwise Paths")
+{
+  for (uint32_t n_leaves = 1; n_leaves <= 70; n_leaves++) {
+    const auto n = LeafCount{ n_leaves };
+    const auto root = NodeIndex::root(n);
+    for (NodeIndex x{ 0 }; x.val < NodeCount(n).val; x.val++) {
+      // Walk up to the root one parent at a time
+      auto path = std::vector<NodeIndex>{ x };
+      while (path.back() != root) {
+        path.push_back(path.back().parent());
+      }
+
+      const auto ancestors = x.ancestors(n);
+      REQUIRE(std::vector<NodeIndex>(ancestors.begin(), ancestors.end()) ==
+              path);
+
+      const auto dirpath = std::vector<NodeIndex>(path.begin() + 1, path.end());
+      REQUIRE(x.dirpath(n) == dirpath);
+
+      auto copath = std::vector<NodeIndex>{};
+      for (size_t i = 0; i + 1 < path.size(); i++) {
+        copath.push_back(path[i].sibling());
+      }
+      REQUIRE(x.copath(n) == copath);
+
+      // The subtree's leaves are those below x, clipped to the tree
+      auto leaves = std::vector<LeafIndex>{};
+      for (LeafIndex i{ 0 }; i < n; i.val++) {
+        if (NodeIndex(i).is_below(x)) {
+          leaves.push_back(i);
+        }
+      }
+
+      const auto range = x.leaves(n);
+      REQUIRE(std::vector<LeafIndex>(range.begin(), range.end()) == leaves);
+    }
+  }
+}
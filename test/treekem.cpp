@@ -4,6 +4,8 @@
 #include <mls/treekem.h>
 #include <mls_vectors/mls_vectors.h>
 
+#include "test_helpers.h"
+
 using namespace mls;
 using namespace mls_vectors;
 
@@ -192,6 +194,332 @@ TEST_CASE_FIXTURE(TreeKEMTest, "TreeKEM Public Key")
   pub.blank_path(removed);
   REQUIRE_FALSE(pub.leaf_node(removed));
   REQUIRE(root_resolution == pub.resolve(NodeIndex::root(size)));
+
+  // Verify that the incrementally maintained tree hash matches a full
+  // recomputation
+  pub.set_hash_all();
+  const auto encoded = tls::marshal(pub);
+  auto fresh = tls::get<TreeKEMPublicKey>(encoded);
+  fresh.suite = suite;
+  REQUIRE(fresh == pub);
+
+  // A decoded tree is re-encoded from the leaf encodings it read
+  REQUIRE(tls::marshal(fresh) == encoded);
+  fresh.set_hash_all();
+  REQUIRE(fresh.root_hash() == pub.root_hash());
+
+  // Modifying a copy of the tree leaves the original intact
+  auto copy = pub;
+  copy.blank_path(LeafIndex{ 0 });
+  copy.set_hash_all();
+  REQUIRE(copy != pub);
+  REQUIRE(pub.has_leaf(LeafIndex{ 0 }));
+  REQUIRE(fresh == pub);
+  REQUIRE(fresh.root_hash() == pub.root_hash());
+
+  // Cached resolutions match those computed from scratch
+  auto unhashed = tls::get<TreeKEMPublicKey>(tls::marshal(pub));
+  for (auto n = NodeIndex{ 0 }; n.val < NodeCount(size).val; n.val++) {
+    REQUIRE(pub.resolve(n) == unhashed.resolve(n));
+  }
+
+  // A hashed tree returns its cached resolutions without copying them
+  auto scratch = std::vector<NodeIndex>{};
+  const auto root = NodeIndex::root(size);
+  REQUIRE(&pub.resolve(root, scratch) != &scratch);
+  REQUIRE(&unhashed.resolve(root, scratch) == &scratch);
+  REQUIRE(scratch == pub.resolve(root));
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "Bulk Add and Remove Match Single Changes")
+{
+  // Build a tree with populated parent nodes and some blank leaves
+  auto [leaf_priv, sig_priv, leaf] = new_leaf_node();
+  silence_unused(leaf_priv);
+
+  auto pub = TreeKEMPublicKey(suite);
+  pub.add_leaf(leaf);
+  for (uint32_t i = 1; i < 8; i++) {
+    pub.add_leaf(std::get<2>(new_leaf_node()));
+  }
+
+  pub.set_hash_all();
+  pub.encap(LeafIndex{ 0 }, {}, {}, random_bytes(32), sig_priv, {}, {});
+  pub.blank_path(LeafIndex{ 2 });
+  pub.blank_path(LeafIndex{ 5 });
+  pub.set_hash_all();
+
+  auto compare = [&](TreeKEMPublicKey& bulk, TreeKEMPublicKey& single) {
+    REQUIRE(bulk == single);
+
+    bulk.set_hash_all();
+    single.set_hash_all();
+    auto fresh = tls::get<TreeKEMPublicKey>(tls::marshal(single));
+    fresh.suite = suite;
+    fresh.set_hash_all();
+    REQUIRE(bulk.root_hash() == fresh.root_hash());
+    REQUIRE(single.root_hash() == fresh.root_hash());
+  };
+
+  // Fill the blank leaves and grow the tree
+  auto leaves = std::vector<LeafNode>{};
+  for (size_t i = 0; i < 11; i++) {
+    leaves.push_back(std::get<2>(new_leaf_node()));
+  }
+
+  auto bulk = pub;
+  auto single = pub;
+  const auto added = bulk.add_leaves(leaves);
+  for (size_t i = 0; i < leaves.size(); i++) {
+    REQUIRE(added.at(i) == single.add_leaf(leaves[i]));
+  }
+
+  REQUIRE(bulk.size == LeafCount{ 32 });
+  compare(bulk, single);
+
+  // Blank leaves whose direct paths overlap
+  const auto removed =
+    std::vector<LeafIndex>{ LeafIndex{ 0 }, LeafIndex{ 1 }, LeafIndex{ 6 } };
+  bulk.blank_paths(removed);
+  for (const auto index : removed) {
+    single.blank_path(index);
+  }
+
+  compare(bulk, single);
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "Reserving Space Does Not Change the Tree")
+{
+  auto reserved = TreeKEMPublicKey(suite);
+  auto plain = TreeKEMPublicKey(suite);
+  reserved.reserve(LeafCount{ 40 });
+  REQUIRE(reserved == plain);
+
+  for (uint32_t i = 0; i < 40; i++) {
+    const auto leaf = std::get<2>(new_leaf_node());
+    REQUIRE(reserved.add_leaf(leaf) == plain.add_leaf(leaf));
+  }
+
+  // Reserving less than the current size has no effect
+  reserved.reserve(LeafCount{ 3 });
+  REQUIRE(reserved == plain);
+
+  reserved.set_hash_all();
+  plain.set_hash_all();
+  REQUIRE(reserved.size == LeafCount{ 64 });
+  REQUIRE(reserved.root_hash() == plain.root_hash());
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "Leaf Lookup Follows Tree Changes")
+{
+  auto [priv_a, sig_a, leaf_a] = new_leaf_node();
+  auto [priv_b, sig_b, leaf_b] = new_leaf_node();
+  auto [priv_c, sig_c, leaf_c] = new_leaf_node();
+  silence_unused(priv_a);
+  silence_unused(priv_b);
+  silence_unused(priv_c);
+  silence_unused(sig_b);
+  silence_unused(sig_c);
+
+  auto pub = TreeKEMPublicKey(suite);
+  const auto index_a = pub.add_leaf(leaf_a);
+  const auto index_b = pub.add_leaf(leaf_b);
+  REQUIRE(pub.find(leaf_b) == index_b);
+  REQUIRE_FALSE(pub.find(leaf_c).has_value());
+  REQUIRE(pub.has_encryption_key(leaf_a.encryption_key, std::nullopt));
+  REQUIRE(pub.has_signature_key(leaf_a.signature_key, std::nullopt));
+  REQUIRE_FALSE(pub.has_encryption_key(leaf_a.encryption_key, index_a));
+  REQUIRE_FALSE(pub.has_signature_key(leaf_c.signature_key, std::nullopt));
+
+  const auto basic = CredentialType::basic;
+  const auto custom = static_cast<CredentialType>(0xff00);
+  REQUIRE(pub.credentials_supported(leaf_c.capabilities, std::nullopt));
+  REQUIRE(pub.credential_supported_by_all(basic, std::nullopt));
+
+  // A copy keeps its own view when the original changes
+  auto copy = pub;
+  pub.blank_path(index_b);
+  REQUIRE_FALSE(pub.find(leaf_b).has_value());
+  REQUIRE(copy.find(leaf_b) == index_b);
+
+  // ... and the original keeps its view when the copy changes
+  copy.blank_path(index_a);
+  REQUIRE_FALSE(copy.find(leaf_a).has_value());
+  REQUIRE(copy.find(leaf_b) == index_b);
+  REQUIRE(pub.find(leaf_a) == index_a);
+
+  // Blank leaves are reused
+  REQUIRE(pub.add_leaf(leaf_c) == index_b);
+  REQUIRE(pub.find(leaf_c) == index_b);
+  REQUIRE(pub.has_signature_key(leaf_c.signature_key, std::nullopt));
+
+  // Replacing a leaf drops the old leaf's keys
+  pub.set_hash_all();
+  pub.encap(index_a, {}, {}, random_bytes(32), sig_a, {}, {});
+  const auto updated = opt::get(pub.leaf_node(index_a));
+  REQUIRE(updated.encryption_key != leaf_a.encryption_key);
+  REQUIRE_FALSE(pub.has_encryption_key(leaf_a.encryption_key, std::nullopt));
+  REQUIRE(pub.find(updated) == index_a);
+
+  // The lookups agree with a tree read from the wire
+  auto fresh = tls::get<TreeKEMPublicKey>(tls::marshal(pub));
+  REQUIRE(fresh.find(updated) == index_a);
+  REQUIRE(fresh.find(leaf_c) == index_b);
+  REQUIRE_FALSE(fresh.find(leaf_b).has_value());
+
+  // Credential support is judged against the other members
+  auto caps = Capabilities::create_default();
+  caps.credentials = { custom };
+  REQUIRE_FALSE(pub.credentials_supported(caps, std::nullopt));
+  REQUIRE_FALSE(pub.credential_supported_by_all(custom, std::nullopt));
+
+  const auto custom_priv = HPKEPrivateKey::generate(suite);
+  const auto custom_leaf = LeafNode(suite,
+                                    custom_priv.public_key,
+                                    sig_a.public_key,
+                                    leaf_a.credential,
+                                    caps,
+                                    Lifetime::create_default(),
+                                    {},
+                                    sig_a);
+  pub.update_leaf(index_a, custom_leaf);
+  REQUIRE_FALSE(pub.credential_supported_by_all(basic, std::nullopt));
+  REQUIRE(pub.credential_supported_by_all(basic, index_a));
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "Common Capabilities Follow Tree Changes")
+{
+  const auto custom_ext = Extension::Type(0xff10);
+  const auto custom_proposal = uint16_t(0xff20);
+  const auto custom_credential = static_cast<CredentialType>(0xff30);
+
+  auto pub = TreeKEMPublicKey(suite);
+  auto indices = std::vector<LeafIndex>{};
+  for (uint32_t i = 0; i < 3; i++) {
+    auto [priv, sig, leaf] = new_leaf_node();
+    silence_unused(priv);
+
+    auto caps = Capabilities::create_default();
+    caps.extensions = { custom_ext, custom_ext };
+    if (i > 0) {
+      caps.proposals = { custom_proposal };
+    }
+    if (i == 0) {
+      caps.credentials.push_back(custom_credential);
+      caps.credentials.push_back(custom_credential);
+    }
+    if (i == 1) {
+      caps.credentials.push_back(custom_credential);
+    }
+
+    leaf = LeafNode(suite,
+                    leaf.encryption_key,
+                    leaf.signature_key,
+                    leaf.credential,
+                    caps,
+                    Lifetime::create_default(),
+                    {},
+                    sig);
+    indices.push_back(pub.add_leaf(leaf));
+  }
+
+  // A type listed twice by one member counts once
+  const auto common = pub.common_capabilities();
+  REQUIRE(common.extensions == std::vector<Extension::Type>{ custom_ext });
+  REQUIRE(common.proposals.empty());
+  REQUIRE(common.credentials == std::vector<CredentialType>{
+                                  CredentialType::basic,
+                                  CredentialType::x509,
+                                });
+  REQUIRE_FALSE(
+    pub.credential_supported_by_all(custom_credential, std::nullopt));
+
+  // Once the member without the proposal type leaves, everyone supports it
+  pub.blank_path(indices[0]);
+  REQUIRE(pub.common_capabilities().proposals ==
+          std::vector<uint16_t>{ custom_proposal });
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "Leaf Views Skip Blank Leaves")
+{
+  auto pub = TreeKEMPublicKey(suite);
+  REQUIRE(pub.leaves().begin() == pub.leaves().end());
+
+  for (uint32_t i = 0; i < 6; i++) {
+    pub.add_leaf(std::get<2>(new_leaf_node()));
+  }
+
+  pub.blank_path(LeafIndex{ 0 });
+  pub.blank_path(LeafIndex{ 3 });
+  REQUIRE(pub.leaf_node_ptr(LeafIndex{ 3 }) == nullptr);
+  REQUIRE(*pub.leaf_node_ptr(LeafIndex{ 4 }) ==
+          opt::get(pub.leaf_node(LeafIndex{ 4 })));
+
+  auto visited = std::vector<LeafIndex>{};
+  const auto view = pub.leaves();
+  for (auto it = view.begin(); it != view.end(); ++it) {
+    REQUIRE(&*it == pub.leaf_node_ptr(it.index()));
+    visited.push_back(it.index());
+  }
+
+  const auto expected = std::vector<LeafIndex>{
+    LeafIndex{ 1 }, LeafIndex{ 2 }, LeafIndex{ 4 }, LeafIndex{ 5 }
+  };
+  REQUIRE(visited == expected);
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "Compressed Tree Encoding")
+{
+  // Leaves made alike share a profile, and a blank leaf becomes a run
+  auto pub = TreeKEMPublicKey{ suite };
+  for (uint32_t i = 0; i < 6; i++) {
+    auto [leaf_priv, sig_priv, leaf] = new_leaf_node();
+    silence_unused(leaf_priv);
+    silence_unused(sig_priv);
+    pub.add_leaf(leaf);
+  }
+  pub.blank_path(LeafIndex{ 2 });
+  pub.set_hash_all();
+  REQUIRE(pub.compressible());
+
+  auto w = tls::ostream{};
+  pub.write_compressed(w);
+  const auto compressed = w.bytes();
+  REQUIRE(compressed.size() < tls::marshal(pub).size());
+
+  auto r = tls::istream(compressed);
+  auto decoded = TreeKEMPublicKey{ suite };
+  decoded.read_compressed(r);
+  REQUIRE(r.empty());
+  REQUIRE(decoded == pub);
+  decoded.set_hash_all();
+  REQUIRE(decoded.root_hash() == pub.root_hash());
+
+  // A tree that is mostly blank is left to the plain encoding
+  auto sparse = TreeKEMPublicKey{ suite };
+  const auto last = TreeKEMPublicKey::max_compressed_expansion;
+  for (uint32_t i = 0; i <= last; i++) {
+    auto [leaf_priv, sig_priv, leaf] = new_leaf_node();
+    silence_unused(leaf_priv);
+    silence_unused(sig_priv);
+    sparse.add_leaf(leaf);
+  }
+  for (uint32_t i = 1; i < last; i++) {
+    sparse.blank_path(LeafIndex{ i });
+  }
+  REQUIRE_FALSE(sparse.compressible());
+
+  auto sparse_w = tls::ostream{};
+  REQUIRE_THROWS_AS(sparse.write_compressed(sparse_w), InvalidParameterError);
+
+  // The decoder enforces the same limit before allocating the tree
+  auto nodes = tls::ostream{};
+  tls::varint::encode(nodes, last);
+  auto framed = tls::ostream{};
+  framed << nodes.bytes();
+
+  auto bad = tls::istream(framed.bytes());
+  REQUIRE_THROWS_AS(decoded.read_compressed(bad), ProtocolError);
 }
 
 TEST_CASE_FIXTURE(TreeKEMTest, "TreeKEM encap/decap")
@@ -261,6 +589,124 @@ TEST_CASE_FIXTURE(TreeKEMTest, "TreeKEM encap/decap")
       REQUIRE(privs[j].consistent(pubs[j]));
     }
   }
+
+  // Hashing and validating the tree in parallel gives the same results as
+  // doing so serially, for any depth cutoff
+  const auto tree_data = tls::marshal(pubs.back());
+  for (auto depth = uint32_t(0); depth < 6; depth++) {
+    auto tree = tls::get<TreeKEMPublicKey>(tree_data);
+    tree.suite = suite;
+    tree.set_hash_all({ parallel_executor, depth });
+    REQUIRE(tree.root_hash() == pubs.back().root_hash());
+    REQUIRE(tree.parent_hash_valid({ parallel_executor, depth }));
+    REQUIRE(tree.parent_hash_valid());
+  }
+
+  // Original tree hashes cached by one check are dropped when the tree changes
+  auto changed = tls::get<TreeKEMPublicKey>(tree_data);
+  changed.suite = suite;
+  changed.set_hash_all();
+  REQUIRE(changed.parent_hash_valid());
+
+  const auto add_index = changed.add_leaf(std::get<2>(new_leaf_node()));
+  changed.set_hash_all();
+  auto reparsed = tls::get<TreeKEMPublicKey>(tls::marshal(changed));
+  reparsed.suite = suite;
+  reparsed.set_hash_all();
+  REQUIRE(changed.parent_hash_valid() == reparsed.parent_hash_valid());
+
+  changed.blank_path(add_index);
+  changed.set_hash_all();
+  REQUIRE(changed.parent_hash_valid());
+
+  // Leaf signatures verify the same way serially or on threads
+  REQUIRE(pubs.back().leaf_signatures_valid(group_id, {}));
+  REQUIRE(pubs.back().leaf_signatures_valid(group_id, parallel_executor));
+
+  auto tampered = pubs.back();
+  auto tampered_leaf = opt::get(tampered.leaf_node(LeafIndex{ 1 }));
+  tampered_leaf.signature.at(0) ^= 0xff;
+  tampered.update_leaf(LeafIndex{ 1 }, tampered_leaf);
+  REQUIRE_FALSE(tampered.leaf_signatures_valid(group_id, {}));
+  REQUIRE_FALSE(tampered.leaf_signatures_valid(group_id, parallel_executor));
+
+  // Each member's slice of the tree reproduces the tree hash
+  const auto& full = pubs.back();
+  for (LeafIndex i{ 0 }; i < full.size; i.val++) {
+    const auto slice = tls::get<TreeSlice>(tls::marshal(full.slice(i)));
+    REQUIRE(slice.tree_hash(suite) == full.root_hash());
+  }
+
+  auto bad_slice = full.slice(LeafIndex{ 2 });
+  bad_slice.copath_hashes.back().at(0) ^= 0xff;
+  REQUIRE(bad_slice.tree_hash(suite) != full.root_hash());
+
+  bad_slice.copath_hashes.pop_back();
+  REQUIRE_THROWS_AS(bad_slice.tree_hash(suite), ProtocolError);
+}
+
+TEST_CASE("Decoded Ciphertext Lists")
+{
+  auto ciphertexts = std::vector<HPKECiphertext>{};
+  for (uint8_t i = 0; i < 5; i++) {
+    ciphertexts.push_back({ random_bytes(32 + i), random_bytes(48 + i) });
+  }
+
+  const auto built = HPKECiphertextList(ciphertexts);
+  const auto encoded = tls::marshal(built);
+  REQUIRE(encoded == tls::marshal(ciphertexts));
+
+  // A decoded list reads entries on demand and writes back what it read
+  auto decoded = tls::get<HPKECiphertextList>(encoded);
+  REQUIRE(decoded.size() == ciphertexts.size());
+  for (size_t i = 0; i < ciphertexts.size(); i++) {
+    REQUIRE(decoded.at(i) == ciphertexts.at(i));
+  }
+  REQUIRE(decoded == built);
+  REQUIRE(tls::marshal(decoded) == encoded);
+
+  // Replacing an entry in a decoded list keeps the others
+  const auto replacement = HPKECiphertext{ random_bytes(32), random_bytes(48) };
+  decoded.set(2, replacement);
+  ciphertexts.at(2) = replacement;
+  REQUIRE(tls::marshal(decoded) == tls::marshal(ciphertexts));
+
+  // Malformed lists are rejected when they are decoded, e.g., one with a
+  // kem_output that runs past the end of the list
+  const auto truncated = tls::marshal(bytes{ 0x05, 0x01 });
+  REQUIRE_THROWS(tls::get<HPKECiphertextList>(truncated));
+  REQUIRE(tls::get<HPKECiphertextList>(tls::marshal(HPKECiphertextList{}))
+            .empty());
+}
+
+TEST_CASE_FIXTURE(TreeKEMTest, "TreeKEM decap checks the decryption key")
+{
+  auto [priv_a, sig_a, leaf_a] = new_leaf_node();
+  auto [priv_b, sig_b, leaf_b] = new_leaf_node();
+  silence_unused(priv_a);
+  silence_unused(sig_b);
+
+  auto pub = TreeKEMPublicKey(suite);
+  const auto index_a = pub.add_leaf(leaf_a);
+  const auto index_b = pub.add_leaf(leaf_b);
+  pub.set_hash_all();
+
+  auto sender_pub = pub;
+  const auto context = bytes{ 0, 1, 2, 3 };
+  auto [sender_priv, path] = sender_pub.encap(
+    index_a, {}, context, random_bytes(32), sig_a, {}, {});
+  silence_unused(sender_priv);
+
+  // A private key that does not match the tree is caught before decryption
+  auto wrong_priv =
+    TreeKEMPrivateKey::solo(suite, index_b, HPKEPrivateKey::generate(suite));
+  REQUIRE_THROWS_AS(wrong_priv.decap(index_a, pub, context, path, {}),
+                    ProtocolError);
+
+  auto priv = TreeKEMPrivateKey::solo(suite, index_b, priv_b);
+  priv.decap(index_a, pub, context, path, {});
+  pub.merge(index_a, path);
+  REQUIRE(priv.consistent(pub));
 }
 
 TEST_CASE("TreeKEM Interop")